@@ -5,18 +5,42 @@
 #include "audio_codec.h"
 #include "mqtt_protocol.h"
 #include "websocket_protocol.h"
+#if CONFIG_SESSION_RECORDER
+#include "replay_protocol.h"
+#endif
+#if CONFIG_SOAK_TEST
+#include "soak_test.h"
+#endif
 #include "font_awesome_symbols.h"
+#include "assets.h"
 #include "assets/lang_config.h"
 #include "mcp_server.h"
+#include "network_monitor.h"
+#include "transfer_manager.h"
+#include "network_worker.h"
+#include "system_metrics.h"
+#include "tick_service.h"
+#include "task_stack.h"
+#include "black_box.h"
+#include "memory_guard.h"
+#include "cache_profiler.h"
+#include "settings.h"
+#include "power_policy.h"
+#include "warm_boot.h"
+#include "boards/common/esp32_music.h"
 
 #include <cstring>
 #include <esp_log.h>
 #include <cJSON.h>
 #include <driver/gpio.h>
 #include <arpa/inet.h>
+#include <esp_app_desc.h>
+#include <freertos/semphr.h>
 
 #define TAG "Application"
 
+#define PROTOCOL_LIVENESS_CHECK_SECONDS 5
+
 
 static const char* const STATE_STRINGS[] = {
     "unknown",
@@ -35,6 +59,10 @@ static const char* const STATE_STRINGS[] = {
 
 Application::Application() {
     event_group_ = xEventGroupCreate();
+    for (auto& tasks : main_tasks_) {
+        tasks.reserve(MAIN_TASK_QUEUE_RESERVE);
+    }
+    running_tasks_.reserve(MAIN_TASK_QUEUE_RESERVE);
 
 #if CONFIG_USE_DEVICE_AEC && CONFIG_USE_SERVER_AEC
 #error "CONFIG_USE_DEVICE_AEC and CONFIG_USE_SERVER_AEC cannot be enabled at the same time"
@@ -46,35 +74,33 @@ Application::Application() {
     aec_mode_ = kAecOff;
 #endif
 
-    esp_timer_create_args_t clock_timer_args = {
-        .callback = [](void* arg) {
-            Application* app = (Application*)arg;
-            app->OnClockTimer();
-        },
-        .arg = this,
-        .dispatch_method = ESP_TIMER_TASK,
-        .name = "clock_timer",
-        .skip_unhandled_events = true
-    };
-    esp_timer_create(&clock_timer_args, &clock_timer_handle_);
+    clock_tick_id_ = TickService::GetInstance().Add("clock", 1000, 50, [this]() {
+        OnClockTimer();
+    }, false);
 }
 
 Application::~Application() {
-    if (clock_timer_handle_ != nullptr) {
-        esp_timer_stop(clock_timer_handle_);
-        esp_timer_delete(clock_timer_handle_);
-    }
+    TickService::GetInstance().Remove(clock_tick_id_);
     vEventGroupDelete(event_group_);
 }
 
-void Application::CheckNewVersion(Ota& ota) {
+void Application::CheckNewVersion(Ota& ota, bool background) {
     const int MAX_RETRY = 10;
     int retry_count = 0;
     int retry_delay = 10; // 初始重试延迟为10秒
 
+    // SetDeviceState() 只能在主循环里调用
+    auto set_state = [this, background](DeviceState state) {
+        if (background) {
+            SetDeviceStateOnMainLoop(state);
+        } else {
+            SetDeviceState(state);
+        }
+    };
+
     auto& board = Board::GetInstance();
     while (true) {
-        SetDeviceState(kDeviceStateActivating);
+        set_state(kDeviceStateActivating);
         auto display = board.GetDisplay();
         display->SetStatus(Lang::Strings::CHECKING_NEW_VERSION);
 
@@ -87,7 +113,7 @@ void Application::CheckNewVersion(Ota& ota) {
 
             char buffer[128];
             snprintf(buffer, sizeof(buffer), Lang::Strings::CHECK_NEW_VERSION_FAILED, retry_delay, ota.GetCheckVersionUrl().c_str());
-            Alert(Lang::Strings::ERROR, buffer, "sad", Lang::Sounds::P3_EXCLAMATION);
+            Alert(Lang::Strings::ERROR, buffer, "sad", Assets::GetInstance().GetSound("exclamation", Lang::Sounds::P3_EXCLAMATION));
 
             ESP_LOGW(TAG, "Check new version failed, retry in %d seconds (%d/%d)", retry_delay, retry_count, MAX_RETRY);
             for (int i = 0; i < retry_delay; i++) {
@@ -103,11 +129,11 @@ void Application::CheckNewVersion(Ota& ota) {
         retry_delay = 10; // 重置重试延迟时间
 
         if (ota.HasNewVersion()) {
-            Alert(Lang::Strings::OTA_UPGRADE, Lang::Strings::UPGRADING, "happy", Lang::Sounds::P3_UPGRADE);
+            Alert(Lang::Strings::OTA_UPGRADE, Lang::Strings::UPGRADING, "happy", Assets::GetInstance().GetSound("upgrade", Lang::Sounds::P3_UPGRADE));
 
             vTaskDelay(pdMS_TO_TICKS(3000));
 
-            SetDeviceState(kDeviceStateUpgrading);
+            set_state(kDeviceStateUpgrading);
             
             display->SetIcon(FONT_AWESOME_DOWNLOAD);
             std::string message = std::string(Lang::Strings::NEW_VERSION) + ota.GetFirmwareVersion();
@@ -117,10 +143,11 @@ void Application::CheckNewVersion(Ota& ota) {
             audio_service_.Stop();
             vTaskDelay(pdMS_TO_TICKS(1000));
 
-            bool upgrade_success = ota.StartUpgrade([display](int progress, size_t speed) {
-                std::thread([display, progress, speed]() {
-                    char buffer[32];
-                    snprintf(buffer, sizeof(buffer), "%d%% %uKB/s", progress, speed / 1024);
+            bool upgrade_success = ota.StartUpgrade([display](int progress, size_t speed, size_t flash_speed) {
+                std::thread([display, progress, speed, flash_speed]() {
+                    // 下载速度和写 flash 的速度，看升级慢在网络还是 flash
+                    char buffer[48];
+                    snprintf(buffer, sizeof(buffer), "%d%% %uKB/s, flash %uKB/s", progress, speed / 1024, flash_speed / 1024);
                     display->SetChatMessage("system", buffer);
                 }).detach();
             });
@@ -130,7 +157,7 @@ void Application::CheckNewVersion(Ota& ota) {
                 ESP_LOGE(TAG, "Firmware upgrade failed, restarting audio service and continuing operation...");
                 audio_service_.Start(); // Restart audio service
                 board.SetPowerSaveMode(true); // Restore power save mode
-                Alert(Lang::Strings::ERROR, Lang::Strings::UPGRADE_FAILED, "sad", Lang::Sounds::P3_EXCLAMATION);
+                Alert(Lang::Strings::ERROR, Lang::Strings::UPGRADE_FAILED, "sad", Assets::GetInstance().GetSound("exclamation", Lang::Sounds::P3_EXCLAMATION));
                 vTaskDelay(pdMS_TO_TICKS(3000));
                 // Continue to normal operation (don't break, just fall through)
             } else {
@@ -145,6 +172,7 @@ void Application::CheckNewVersion(Ota& ota) {
 
         // No new version, mark the current version as valid
         ota.MarkCurrentVersionValid();
+        WarmBoot::GetInstance().MarkVersionChecked();
         if (!ota.HasActivationCode() && !ota.HasActivationChallenge()) {
             xEventGroupSetBits(event_group_, MAIN_EVENT_CHECK_NEW_VERSION_DONE);
             // Exit the loop if done checking new version
@@ -176,26 +204,117 @@ void Application::CheckNewVersion(Ota& ota) {
     }
 }
 
+// 在主循环里切换状态，等切换完成再返回，之后的停止音频、升级等步骤仍然在新状态下进行
+void Application::SetDeviceStateOnMainLoop(DeviceState state) {
+    auto done = xSemaphoreCreateBinary();
+    Schedule([this, state, done]() {
+        SetDeviceState(state);
+        xSemaphoreGive(done);
+    });
+    xSemaphoreTake(done, portMAX_DELAY);
+    vSemaphoreDelete(done);
+}
+
+// 快速启动时在后台检查版本，升级或重新激活要等设备空闲后再打断用户
+// 每次尝试只是一次请求，放在网络工作任务上，重试和等待空闲由定时器完成，不占用任务栈；
+// 升级、激活会提示、等待、下载固件，可能持续几分钟，在自己的 check_version 任务里进行
+void Application::CheckNewVersionInBackground(std::shared_ptr<Ota> ota, int attempt) {
+    const int MAX_RETRY = 10;
+    if (!ota->CheckVersion()) {
+        if (attempt >= MAX_RETRY) {
+            ESP_LOGE(TAG, "Too many retries, exit background version check");
+            return;
+        }
+        int retry_delay = 10 << (attempt - 1);
+        ESP_LOGW(TAG, "Background version check failed, retry in %d seconds (%d/%d)", retry_delay, attempt, MAX_RETRY);
+        NetworkWorker::GetInstance().PostDelayed(retry_delay * 1000, [this, ota, attempt]() {
+            CheckNewVersionInBackground(ota, attempt + 1);
+        });
+        return;
+    }
+    has_server_time_ = ota->HasServerTime();
+
+    if (!ota->HasNewVersion() && !ota->HasActivationCode() && !ota->HasActivationChallenge()) {
+        ota->MarkCurrentVersionValid();
+        WarmBoot::GetInstance().MarkVersionChecked();
+        SaveBootProtocol(*ota);
+        xEventGroupSetBits(event_group_, MAIN_EVENT_CHECK_NEW_VERSION_DONE);
+        return;
+    }
+    FinishBackgroundVersionCheck(ota);
+}
+
+void Application::FinishBackgroundVersionCheck(std::shared_ptr<Ota> ota) {
+    if (device_state_ != kDeviceStateIdle) {
+        NetworkWorker::GetInstance().PostDelayed(1000, [this, ota]() {
+            FinishBackgroundVersionCheck(ota);
+        });
+        return;
+    }
+    ESP_LOGI(TAG, "Background version check needs %s", ota->HasNewVersion() ? "an upgrade" : "activation");
+    if (!ota->HasNewVersion()) {
+        // 重新激活前不再走快速启动
+        Settings("boot", true).EraseKey("protocol");
+    }
+    // 不能在网络工作任务上休眠，否则会饿死 OpenAudioChannel() 等任务
+    auto arg = new std::shared_ptr<Ota>(std::move(ota));
+    if (xTaskCreate([](void* arg) {
+            auto ota = static_cast<std::shared_ptr<Ota>*>(arg);
+            Application::GetInstance().RunBackgroundUpgrade(**ota);
+            delete ota;
+            vTaskDelete(NULL);
+        }, "check_version", 4096 * 2, arg, 2, nullptr) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the check_version task");
+        delete arg;
+    }
+}
+
+void Application::RunBackgroundUpgrade(Ota& ota) {
+    CheckNewVersion(ota, true);
+    SaveBootProtocol(ota);
+    Schedule([this]() {
+        if (device_state_ == kDeviceStateActivating) {
+            SetDeviceState(kDeviceStateIdle);
+        }
+    });
+}
+
+// 只在版本检查和激活都完成后记录，下次启动可以跳过等待
+void Application::SaveBootProtocol(Ota& ota) {
+    if (!(xEventGroupGetBits(event_group_) & MAIN_EVENT_CHECK_NEW_VERSION_DONE) &&
+        (ota.HasActivationCode() || ota.HasActivationChallenge())) {
+        return;
+    }
+    std::string protocol = ota.HasMqttConfig() ? "mqtt" : (ota.HasWebsocketConfig() ? "websocket" : "");
+    if (protocol.empty()) {
+        return;
+    }
+    Settings settings("boot", true);
+    if (settings.GetString("protocol") != protocol) {
+        settings.SetString("protocol", protocol);
+    }
+}
+
 void Application::ShowActivationCode(const std::string& code, const std::string& message) {
     struct digit_sound {
         char digit;
-        const std::string_view& sound;
+        std::string_view sound;
     };
     static const std::array<digit_sound, 10> digit_sounds{{
-        digit_sound{'0', Lang::Sounds::P3_0},
-        digit_sound{'1', Lang::Sounds::P3_1}, 
-        digit_sound{'2', Lang::Sounds::P3_2},
-        digit_sound{'3', Lang::Sounds::P3_3},
-        digit_sound{'4', Lang::Sounds::P3_4},
-        digit_sound{'5', Lang::Sounds::P3_5},
-        digit_sound{'6', Lang::Sounds::P3_6},
-        digit_sound{'7', Lang::Sounds::P3_7},
-        digit_sound{'8', Lang::Sounds::P3_8},
-        digit_sound{'9', Lang::Sounds::P3_9}
+        digit_sound{'0', Assets::GetInstance().GetSound("0", Lang::Sounds::P3_0)},
+        digit_sound{'1', Assets::GetInstance().GetSound("1", Lang::Sounds::P3_1)}, 
+        digit_sound{'2', Assets::GetInstance().GetSound("2", Lang::Sounds::P3_2)},
+        digit_sound{'3', Assets::GetInstance().GetSound("3", Lang::Sounds::P3_3)},
+        digit_sound{'4', Assets::GetInstance().GetSound("4", Lang::Sounds::P3_4)},
+        digit_sound{'5', Assets::GetInstance().GetSound("5", Lang::Sounds::P3_5)},
+        digit_sound{'6', Assets::GetInstance().GetSound("6", Lang::Sounds::P3_6)},
+        digit_sound{'7', Assets::GetInstance().GetSound("7", Lang::Sounds::P3_7)},
+        digit_sound{'8', Assets::GetInstance().GetSound("8", Lang::Sounds::P3_8)},
+        digit_sound{'9', Assets::GetInstance().GetSound("9", Lang::Sounds::P3_9)}
     }};
 
     // This sentence uses 9KB of SRAM, so we need to wait for it to finish
-    Alert(Lang::Strings::ACTIVATION, message.c_str(), "happy", Lang::Sounds::P3_ACTIVATION);
+    Alert(Lang::Strings::ACTIVATION, message.c_str(), "happy", Assets::GetInstance().GetSound("activation", Lang::Sounds::P3_ACTIVATION));
 
     for (const auto& digit : code) {
         auto it = std::find_if(digit_sounds.begin(), digit_sounds.end(),
@@ -247,14 +366,9 @@ void Application::ToggleChatState() {
 
     if (device_state_ == kDeviceStateIdle) {
         Schedule([this]() {
-            if (!protocol_->IsAudioChannelOpened()) {
-                SetDeviceState(kDeviceStateConnecting);
-                if (!protocol_->OpenAudioChannel()) {
-                    return;
-                }
-            }
-
-            SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+            OpenAudioChannelAsync([this]() {
+                SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+            });
         });
     } else if (device_state_ == kDeviceStateSpeaking) {
         Schedule([this]() {
@@ -282,16 +396,15 @@ void Application::StartListening() {
         return;
     }
     
+    // 按键回调中直接记下按下的时间，开始录音时补发这之后的音频
+    if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateSpeaking) {
+        audio_service_.BackfillCaptureFrom(esp_timer_get_time());
+    }
     if (device_state_ == kDeviceStateIdle) {
         Schedule([this]() {
-            if (!protocol_->IsAudioChannelOpened()) {
-                SetDeviceState(kDeviceStateConnecting);
-                if (!protocol_->OpenAudioChannel()) {
-                    return;
-                }
-            }
-
-            SetListeningMode(kListeningModeManualStop);
+            OpenAudioChannelAsync([this]() {
+                SetListeningMode(kListeningModeManualStop);
+            });
         });
     } else if (device_state_ == kDeviceStateSpeaking) {
         Schedule([this]() {
@@ -336,11 +449,15 @@ void Application::Start() {
     /* Setup the audio service */
     auto codec = board.GetAudioCodec();
     audio_service_.Initialize(codec);
+    auto& tracer = audio_service_.latency_tracer();
+    for (int i = 0; i < kAudioStageCount; i++) {
+        SystemMetrics::GetInstance().AddHistogram(LatencyTracer::StageName((AudioLatencyStage)i), &tracer.histogram((AudioLatencyStage)i));
+    }
     audio_service_.Start();
 
     AudioServiceCallbacks callbacks;
     callbacks.on_send_queue_available = [this]() {
-        xEventGroupSetBits(event_group_, MAIN_EVENT_SEND_AUDIO);
+        NotifyAudioUplink();
     };
     callbacks.on_wake_word_detected = [this](const std::string& wake_word) {
         xEventGroupSetBits(event_group_, MAIN_EVENT_WAKE_WORD_DETECTED);
@@ -348,30 +465,89 @@ void Application::Start() {
     callbacks.on_vad_change = [this](bool speaking) {
         xEventGroupSetBits(event_group_, MAIN_EVENT_VAD_CHANGE);
     };
+    callbacks.on_speech_command = [this](const std::string& tool, const std::string& arguments) {
+        Schedule([this, tool, arguments]() {
+            OnSpeechCommand(tool, arguments);
+        });
+    };
+    callbacks.on_wake_word_degrade = [this](int level) {
+        Schedule([level]() {
+            Board::GetInstance().GetDisplay()->SetCpuSaver(level >= 1);
+        });
+    };
+    callbacks.on_critical_window = [this](bool critical) {
+        Schedule([critical]() {
+            Board::GetInstance().GetDisplay()->SetAudioCritical(critical);
+        });
+    };
+    callbacks.on_decode_buffer_level = [this](int buffered_ms, bool overflow) {
+        Schedule([this, buffered_ms, overflow]() {
+            if (protocol_ && device_state_ == kDeviceStateSpeaking) {
+                protocol_->SendFlowControl(buffered_ms, overflow);
+            }
+        });
+    };
     audio_service_.SetCallbacks(callbacks);
+    SubscribePowerPolicy();
 
     /* Start the clock timer to update the status bar */
-    esp_timer_start_periodic(clock_timer_handle_, 1000000);
+    TickService::GetInstance().SetEnabled(clock_tick_id_, true);
+    int64_t audio_ready_time = esp_timer_get_time();
+
+    // 已激活过的设备用上次 OTA 下发并保存的协议配置直接连接，版本检查放到后台
+    std::string boot_protocol = Settings("boot", false).GetString("protocol");
+    bool fast_boot = !boot_protocol.empty();
+    // 从深度睡眠唤醒时先开唤醒词检测，联网期间说出的唤醒词在启动完成后由主循环处理
+    bool warm_boot = fast_boot && WarmBoot::GetInstance().active();
+    if (warm_boot) {
+        audio_service_.EnableWakeWordDetection(true);
+    }
+
+    // Add MCP common tools while the network connects, they must be ready before the protocol starts
+    auto tools_ready = xSemaphoreCreateBinary();
+    xTaskCreate([](void* arg) {
+        McpServer::GetInstance().AddCommonTools();
+        xSemaphoreGive((SemaphoreHandle_t)arg);
+        vTaskDelete(NULL);
+    }, "mcp_tools", 6144, tools_ready, 2, nullptr);
 
     /* Wait for the network to be ready */
     board.StartNetwork();
+    int64_t network_ready_time = esp_timer_get_time();
 
     // Update the status bar immediately to show the network state
     display->UpdateStatusBar(true);
 
-    // Check for new firmware version or get the MQTT broker address
-    Ota ota;
-    CheckNewVersion(ota);
+    if (!fast_boot) {
+        // Check for new firmware version or get the MQTT broker address
+        Ota ota;
+        CheckNewVersion(ota);
+        has_server_time_ = ota.HasServerTime();
+        if (ota.HasMqttConfig()) {
+            boot_protocol = "mqtt";
+        } else if (ota.HasWebsocketConfig()) {
+            boot_protocol = "websocket";
+        }
+        SaveBootProtocol(ota);
+    }
+    int64_t ota_ready_time = esp_timer_get_time();
 
     // Initialize the protocol
     display->SetStatus(Lang::Strings::LOADING_PROTOCOL);
 
-    // Add MCP common tools before initializing the protocol
-    McpServer::GetInstance().AddCommonTools();
+    xSemaphoreTake(tools_ready, portMAX_DELAY);
+    vSemaphoreDelete(tools_ready);
 
-    if (ota.HasMqttConfig()) {
+#if CONFIG_SESSION_RECORDER
+    // self.session.replay 设置后重启进入回放
+    int replay_mode = Settings("session").GetInt("replay", kReplayModeOff);
+    if (replay_mode != kReplayModeOff) {
+        protocol_ = std::make_unique<ReplayProtocol>((ReplayMode)replay_mode);
+    } else
+#endif
+    if (boot_protocol == "mqtt") {
         protocol_ = std::make_unique<MqttProtocol>();
-    } else if (ota.HasWebsocketConfig()) {
+    } else if (boot_protocol == "websocket") {
         protocol_ = std::make_unique<WebsocketProtocol>();
     } else {
         ESP_LOGW(TAG, "No protocol specified in the OTA config, using MQTT");
@@ -382,13 +558,17 @@ void Application::Start() {
         last_error_message_ = message;
         xEventGroupSetBits(event_group_, MAIN_EVENT_ERROR);
     });
-    protocol_->OnIncomingAudio([this](std::unique_ptr<AudioStreamPacket> packet) {
-        if (device_state_ == kDeviceStateSpeaking) {
+    protocol_->OnIncomingAudio([this](AudioStreamPacketPtr packet) {
+        if (device_state_ == kDeviceStateSpeaking && !aborted_) {
             audio_service_.PushPacketToDecodeQueue(std::move(packet));
         }
     });
     protocol_->OnAudioChannelOpened([this, codec, &board]() {
         board.SetPowerSaveMode(false);
+        auto camera = board.GetCamera();
+        if (camera && !PowerPolicy::GetInstance().saving()) {
+            camera->KeepWarm(true);
+        }
         if (protocol_->server_sample_rate() != codec->output_sample_rate()) {
             ESP_LOGW(TAG, "Server sample rate %d does not match device output sample rate %d, resampling may cause distortion",
                 protocol_->server_sample_rate(), codec->output_sample_rate());
@@ -396,61 +576,77 @@ void Application::Start() {
     });
     protocol_->OnAudioChannelClosed([this, &board]() {
         board.SetPowerSaveMode(true);
+        auto camera = board.GetCamera();
+        if (camera) {
+            camera->StopStreaming();
+            camera->KeepWarm(false);
+        }
         Schedule([this]() {
             auto display = Board::GetInstance().GetDisplay();
             display->SetChatMessage("system", "");
             SetDeviceState(kDeviceStateIdle);
+            // 弱网时预热连接多半也会被断开，不再占用资源
+            if (device_state_ == kDeviceStateIdle && !NetworkMonitor::GetInstance().IsPoor()) {
+                protocol_->PrewarmAudioChannel();
+            }
         });
     });
-    protocol_->OnIncomingJson([this, display](const cJSON* root) {
-        // Parse JSON data
-        auto type = cJSON_GetObjectItem(root, "type");
-        if (strcmp(type->valuestring, "tts") == 0) {
-            auto state = cJSON_GetObjectItem(root, "state");
-            if (strcmp(state->valuestring, "start") == 0) {
-                Schedule([this]() {
-                    aborted_ = false;
-                    if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
-                        SetDeviceState(kDeviceStateSpeaking);
-                    }
-                });
-            } else if (strcmp(state->valuestring, "stop") == 0) {
-                Schedule([this]() {
-                    if (device_state_ == kDeviceStateSpeaking) {
-                        if (listening_mode_ == kListeningModeManualStop) {
-                            SetDeviceState(kDeviceStateIdle);
-                        } else {
-                            SetDeviceState(kDeviceStateListening);
-                        }
+    // tts/stt/llm arrive several times per sentence, they are read without building a cJSON tree
+    protocol_->OnIncomingMessage("tts", [this](const JsonFields& fields) {
+        if (fields.Equals("state", "start")) {
+            // Power up the amplifier while the first audio packets are still on the way
+            audio_service_.PrepareOutput();
+            // Cleared here rather than in the scheduled task, the packets of the new reply follow this message directly
+            aborted_ = false;
+#if CONFIG_USE_WECHAT_MESSAGE_STYLE
+            {
+                // 新的回复从新气泡开始
+                std::lock_guard<std::mutex> lock(mutex_);
+                assistant_reply_open_ = false;
+            }
+#endif
+            Schedule([this]() {
+                if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
+                    SetDeviceState(kDeviceStateSpeaking);
+                }
+            }, kTaskPriorityHigh);
+        } else if (fields.Equals("state", "stop")) {
+            Schedule([this]() {
+                if (device_state_ == kDeviceStateSpeaking) {
+                    if (listening_mode_ == kListeningModeManualStop) {
+                        SetDeviceState(kDeviceStateIdle);
+                    } else {
+                        SetDeviceState(kDeviceStateListening);
                     }
-                });
-            } else if (strcmp(state->valuestring, "sentence_start") == 0) {
-                auto text = cJSON_GetObjectItem(root, "text");
-                if (cJSON_IsString(text)) {
-                    ESP_LOGI(TAG, "<< %s", text->valuestring);
-                    Schedule([this, display, message = std::string(text->valuestring)]() {
-                        display->SetChatMessage("assistant", message.c_str());
-                    });
                 }
+            }, kTaskPriorityHigh);
+        } else if (fields.Equals("state", "sentence_start")) {
+            std::string text;
+            if (fields.GetString("text", text)) {
+                ESP_LOGI(TAG, "<< %s", text.c_str());
+                ScheduleDisplayUpdate(kDisplayUpdateAssistantMessage, text);
             }
-        } else if (strcmp(type->valuestring, "stt") == 0) {
-            auto text = cJSON_GetObjectItem(root, "text");
-            if (cJSON_IsString(text)) {
-                ESP_LOGI(TAG, ">> %s", text->valuestring);
-                Schedule([this, display, message = std::string(text->valuestring)]() {
-                    display->SetChatMessage("user", message.c_str());
-                });
-            }
-        } else if (strcmp(type->valuestring, "llm") == 0) {
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (cJSON_IsString(emotion)) {
-                Schedule([this, display, emotion_str = std::string(emotion->valuestring)]() {
-                    display->SetEmotion(emotion_str.c_str());
-                });
-            }
-        } else if (strcmp(type->valuestring, "mcp") == 0) {
+        }
+    });
+    protocol_->OnIncomingMessage("stt", [this](const JsonFields& fields) {
+        std::string text;
+        if (fields.GetString("text", text)) {
+            ESP_LOGI(TAG, ">> %s", text.c_str());
+            ScheduleDisplayUpdate(kDisplayUpdateUserMessage, text);
+        }
+    });
+    protocol_->OnIncomingMessage("llm", [this](const JsonFields& fields) {
+        std::string emotion;
+        if (fields.GetString("emotion", emotion)) {
+            ScheduleDisplayUpdate(kDisplayUpdateEmotion, emotion);
+        }
+    });
+    protocol_->OnIncomingJson([this, display](const cJSON* root) {
+        // Parse JSON data
+        auto type = cJSON_GetObjectItem(root, "type");
+        if (strcmp(type->valuestring, "mcp") == 0) {
             auto payload = cJSON_GetObjectItem(root, "payload");
-            if (cJSON_IsObject(payload)) {
+            if (cJSON_IsObject(payload) || cJSON_IsArray(payload)) {
                 McpServer::GetInstance().ParseMessage(payload);
             }
         } else if (strcmp(type->valuestring, "system") == 0) {
@@ -471,7 +667,7 @@ void Application::Start() {
             auto message = cJSON_GetObjectItem(root, "message");
             auto emotion = cJSON_GetObjectItem(root, "emotion");
             if (cJSON_IsString(status) && cJSON_IsString(message) && cJSON_IsString(emotion)) {
-                Alert(status->valuestring, message->valuestring, emotion->valuestring, Lang::Sounds::P3_VIBRATION);
+                Alert(status->valuestring, message->valuestring, emotion->valuestring, Assets::GetInstance().GetSound("vibration", Lang::Sounds::P3_VIBRATION));
             } else {
                 ESP_LOGW(TAG, "Alert command requires status, message and emotion");
             }
@@ -493,44 +689,335 @@ void Application::Start() {
     });
     bool protocol_started = protocol_->Start();
 
+    xTaskCreatePinnedToCore([](void* arg) {
+        ((Application*)arg)->AudioUplinkTask();
+        vTaskDelete(NULL);
+    }, "audio_uplink", AUDIO_UPLINK_TASK_STACK_SIZE, this, CONFIG_AUDIO_UPLINK_TASK_PRIORITY, &audio_uplink_task_handle_,
+        AUDIO_UPLINK_TASK_CORE);
+
     SetDeviceState(kDeviceStateIdle);
+    int64_t ready_time = esp_timer_get_time();
+    ESP_LOGI(TAG, "Boot: ready in %lld ms (audio %lld ms, network %lld ms, ota %lld ms, protocol %lld ms)%s",
+        ready_time / 1000, audio_ready_time / 1000, (network_ready_time - audio_ready_time) / 1000,
+        (ota_ready_time - network_ready_time) / 1000, (ready_time - ota_ready_time) / 1000,
+        warm_boot ? ", warm boot" : (fast_boot ? ", fast boot" : ""));
+
+    if (fast_boot && WarmBoot::GetInstance().IsVersionCheckDue()) {
+        NetworkWorker::GetInstance().Post([this]() {
+            CheckNewVersionInBackground(std::make_shared<Ota>(), 1);
+        });
+    } else if (fast_boot) {
+        xEventGroupSetBits(event_group_, MAIN_EVENT_CHECK_NEW_VERSION_DONE);
+    }
 
-    has_server_time_ = ota.HasServerTime();
-    if (protocol_started) {
-        std::string message = std::string(Lang::Strings::VERSION) + ota.GetCurrentVersion();
+    if (protocol_started && !warm_boot) {
+        std::string message = std::string(Lang::Strings::VERSION) + esp_app_get_description()->version;
         display->ShowNotification(message.c_str());
         display->SetChatMessage("system", "");
         // Play the success sound to indicate the device is ready
-        audio_service_.PlaySound(Lang::Sounds::P3_SUCCESS);
+        audio_service_.PlaySound(Assets::GetInstance().GetSound("success", Lang::Sounds::P3_SUCCESS));
     }
 
+#if CONFIG_SOAK_TEST_AUTO_START
+    SoakTest::GetInstance().Start(0);
+#endif
+
+    // 空闲时提前创建语音处理流水线，第一次对话不用等
+    audio_service_.PreinitializeVoiceProcessing();
+
     // Print heap stats
     SystemInfo::PrintHeapStats();
 }
 
+// 每个模块各自订阅，电量低时降低负载，电量恢复或开始充电后还原
+void Application::SubscribePowerPolicy() {
+    auto& board = Board::GetInstance();
+    auto& policy = PowerPolicy::GetInstance();
+    auto display = board.GetDisplay();
+    policy.Subscribe([display](PowerPolicyLevel level) {
+        display->SetBatterySaver(level != kPowerPolicyNormal);
+    });
+    auto backlight = board.GetBacklight();
+    if (backlight) {
+        policy.Subscribe([backlight](PowerPolicyLevel level) {
+            backlight->SetBrightnessLimit(level != kPowerPolicyNormal ? CONFIG_POWER_POLICY_SAVER_BRIGHTNESS : 100);
+        });
+    }
+    policy.Subscribe([this](PowerPolicyLevel level) {
+        audio_service_.SetBatterySaver(level != kPowerPolicyNormal);
+        audio_service_.SetCpuFrequencyCap(level == kPowerPolicyCritical ? CONFIG_POWER_POLICY_CRITICAL_CPU_MHZ : 0);
+    });
+    auto camera = board.GetCamera();
+    if (camera) {
+        policy.Subscribe([camera](PowerPolicyLevel level) {
+            if (level != kPowerPolicyNormal) {
+                camera->KeepWarm(false);
+            }
+        });
+    }
+    auto music = board.GetMusic();
+    if (music) {
+        // 频谱需要持续做 FFT 并全速刷新，省电时换成歌词
+        policy.Subscribe([music, display, saved = Esp32Music::DISPLAY_MODE_SPECTRUM, switched = false](PowerPolicyLevel level) mutable {
+            auto esp32_music = static_cast<Esp32Music*>(music);
+            if (level != kPowerPolicyNormal && !switched) {
+                saved = esp32_music->GetDisplayMode();
+                switched = true;
+                if (saved == Esp32Music::DISPLAY_MODE_SPECTRUM) {
+                    esp32_music->SetDisplayMode(Esp32Music::DISPLAY_MODE_LYRICS);
+                    display->stopFft();
+                }
+            } else if (level == kPowerPolicyNormal && switched) {
+                switched = false;
+                esp32_music->SetDisplayMode(saved);
+            }
+        });
+    }
+}
+
 void Application::OnClockTimer() {
     clock_ticks_++;
 
     auto display = Board::GetInstance().GetDisplay();
     display->UpdateStatusBar();
 
+    // 预热连接到期后在主循环中释放
+    if (protocol_ && protocol_->IsWarmAudioChannelExpired()) {
+        Schedule([this]() {
+            // 正在连接时预热连接可能已被复用
+            if (device_state_ == kDeviceStateIdle) {
+                protocol_->ReleaseWarmAudioChannel();
+            }
+        });
+    }
+
+    // 空闲时探测连接是否还活着，断了就在后台重连，唤醒时连接已就绪
+    if (protocol_ && clock_ticks_ % PROTOCOL_LIVENESS_CHECK_SECONDS == 0 && device_state_ == kDeviceStateIdle) {
+        Schedule([this]() {
+            if (device_state_ == kDeviceStateIdle) {
+                protocol_->CheckLiveness();
+            }
+        });
+    }
+
     // Print the debug info every 10 seconds
     if (clock_ticks_ % 10 == 0) {
+        PowerPolicy::GetInstance().Update();
         // SystemInfo::PrintTaskCpuUsage(pdMS_TO_TICKS(1000));
         // SystemInfo::PrintTaskList();
+        // audio_service_.latency_tracer().Print();
         SystemInfo::PrintHeapStats();
+        MemoryGuard::GetInstance().Check();
+        TaskStacks::GetInstance().Check();
+        TransferManager::GetInstance().PrintStats();
+        TickService::GetInstance().PrintStats();
+        StreamPlayer::GetInstance().ReleaseIdle();
+#if CONFIG_MUSIC_SUSPEND_TIMEOUT_S > 0
+        if (StreamPlayer::GetInstance().suspended_ms() > CONFIG_MUSIC_SUSPEND_TIMEOUT_S * 1000LL) {
+            // 对话太久没有回到待机，放弃暂停的歌曲，释放缓冲区和连接
+            Schedule([]() {
+                auto& board = Board::GetInstance();
+                ESP_LOGI(TAG, "Suspended for more than %d s, stopping music/sing streaming", CONFIG_MUSIC_SUSPEND_TIMEOUT_S);
+                if (auto music = board.GetMusic()) {
+                    music->StopStreaming();
+                }
+                if (auto sing = board.GetSing()) {
+                    sing->StopStreaming();
+                }
+            });
+        }
+#endif
+#if CONFIG_AUDIO_CACHE_PROFILE
+        CacheProfiler::GetInstance().Print();
+#endif
+        auto& metrics = SystemMetrics::GetInstance();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ESP_LOGI(TAG, "Main tasks: max queue depth %u, coalesced display updates %lu",
+                (unsigned)max_task_queue_depth_, (unsigned long)coalesced_display_updates_);
+            metrics.Gauge("main_queue_max_depth") = max_task_queue_depth_;
+            metrics.Counter("coalesced_display_updates") = coalesced_display_updates_;
+        }
+        auto& network = NetworkMonitor::GetInstance();
+        metrics.Gauge("network_score") = std::max(network.Score(), 0);
+        metrics.Gauge("network_rtt_ms") = network.rtt_ms();
+        metrics.Sample();
     }
+
+#if CONFIG_METRICS_REPORT_INTERVAL > 0
+    if (clock_ticks_ % CONFIG_METRICS_REPORT_INTERVAL == 0 && protocol_ && protocol_->IsAudioChannelOpened()) {
+        Schedule([this]() {
+            uint8_t report[METRICS_REPORT_MAX_SIZE];
+            size_t size = SystemMetrics::GetInstance().BuildReport(report, sizeof(report));
+            if (size > 0 && protocol_) {
+                protocol_->SendMetricsReport(report, size);
+            }
+        });
+    }
+#endif
 }
 
 // Add a async task to MainLoop
-void Application::Schedule(std::function<void()> callback) {
+void Application::Schedule(std::function<void()> callback, TaskPriority priority) {
     {
         std::lock_guard<std::mutex> lock(mutex_);
-        main_tasks_.push_back(std::move(callback));
+        main_tasks_[priority].push_back(std::move(callback));
+        size_t depth = main_tasks_[kTaskPriorityHigh].size() + main_tasks_[kTaskPriorityNormal].size();
+        if (depth > max_task_queue_depth_) {
+            max_task_queue_depth_ = depth;
+            if (depth > MAIN_TASK_QUEUE_RESERVE) {
+                ESP_LOGW(TAG, "Main task queue depth %u", (unsigned)depth);
+                BlackBox::GetInstance().Record(kBlackBoxQueueFull, kBlackBoxQueueMainTask, depth);
+            }
+        }
     }
     xEventGroupSetBits(event_group_, MAIN_EVENT_SCHEDULE);
 }
 
+void Application::ScheduleDisplayUpdate(DisplayUpdate type, std::string_view text) {
+#if CONFIG_USE_WECHAT_MESSAGE_STYLE
+    // 回复的句子接到当前气泡后面。和其他消息一样按顺序排队，还没执行时新来的句子直接拼上去
+    if (type == kDisplayUpdateAssistantMessage) {
+        bool append;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (assistant_batch_scheduled_) {
+                if (!assistant_batch_.empty() && !text.empty() && NeedsSentenceSpace(assistant_batch_.back(), text.front())) {
+                    assistant_batch_ += ' ';
+                }
+                assistant_batch_.append(text.data(), text.size());
+                coalesced_display_updates_++;
+                return;
+            }
+            assistant_batch_.assign(text.data(), text.size());
+            assistant_batch_scheduled_ = true;
+            append = assistant_reply_open_;
+            assistant_reply_open_ = true;
+        }
+        Schedule([this, append]() {
+            std::string message;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                message.swap(assistant_batch_);
+                assistant_batch_scheduled_ = false;
+            }
+            auto display = Board::GetInstance().GetDisplay();
+            if (append) {
+                display->AppendChatMessage("assistant", message.c_str());
+            } else {
+                display->SetChatMessage("assistant", message.c_str());
+            }
+        });
+        return;
+    }
+    // 聊天气泡保留每一条消息，不能合并
+    if (type != kDisplayUpdateEmotion) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            assistant_reply_open_ = false;
+        }
+        Schedule([this, type, message = std::string(text)]() {
+            ApplyDisplayUpdate(type, message.c_str());
+        });
+        return;
+    }
+#endif
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (pending_display_updates_ & (1 << type)) {
+            coalesced_display_updates_++;
+        }
+        display_updates_[type].assign(text.data(), text.size());
+        pending_display_updates_ |= 1 << type;
+    }
+    xEventGroupSetBits(event_group_, MAIN_EVENT_SCHEDULE);
+}
+
+void Application::ApplyDisplayUpdate(DisplayUpdate type, const char* text) {
+    auto display = Board::GetInstance().GetDisplay();
+    switch (type) {
+        case kDisplayUpdateUserMessage:
+            display->SetChatMessage("user", text);
+            break;
+        case kDisplayUpdateAssistantMessage:
+            display->SetChatMessage("assistant", text);
+            break;
+        case kDisplayUpdateEmotion:
+            display->SetEmotion(text);
+            break;
+        default:
+            break;
+    }
+}
+
+// State changes first, then the latest display updates, then everything else
+void Application::RunScheduledTasks() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    running_tasks_.swap(main_tasks_[kTaskPriorityHigh]);
+    lock.unlock();
+    for (auto& task : running_tasks_) {
+        task();
+    }
+    running_tasks_.clear();
+
+    lock.lock();
+    uint32_t pending = pending_display_updates_;
+    pending_display_updates_ = 0;
+    for (int i = 0; i < kDisplayUpdateCount; i++) {
+        if (pending & (1 << i)) {
+            applying_display_updates_[i].swap(display_updates_[i]);
+        }
+    }
+    lock.unlock();
+    for (int i = 0; i < kDisplayUpdateCount; i++) {
+        if (pending & (1 << i)) {
+            ApplyDisplayUpdate((DisplayUpdate)i, applying_display_updates_[i].c_str());
+        }
+    }
+
+    lock.lock();
+    running_tasks_.swap(main_tasks_[kTaskPriorityNormal]);
+    lock.unlock();
+    for (auto& task : running_tasks_) {
+        task();
+    }
+    running_tasks_.clear();
+}
+
+void Application::NotifyAudioUplink() {
+    if (audio_uplink_task_handle_ != nullptr) {
+        xTaskNotifyGive(audio_uplink_task_handle_);
+    }
+}
+
+/*
+ * Sends the encoded frames outside the main loop, a send that blocks on a congested link only delays
+ * the uplink. While it blocks the send queue fills up and the encoder stops taking new frames, which
+ * also lowers its complexity (see AudioService::TuneEncoder).
+ */
+void Application::AudioUplinkTask() {
+    AudioStreamPacketPtr batch[AUDIO_SEND_BATCH_MAX_PACKETS];
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        // 连接期间采集的音频留在发送队列中，通道打开后再发
+        if (device_state_ == kDeviceStateConnecting) {
+            continue;
+        }
+        // 发送队列积压时（如 4G 网络较慢）一次写入多帧，减少每包的协议开销
+        NetworkMonitor::GetInstance().ReportSendBacklog(audio_service_.GetSendQueueSize());
+        while (true) {
+            size_t limit = audio_service_.GetSendQueueSize() >= AUDIO_SEND_BATCH_WATERMARK ? AUDIO_SEND_BATCH_MAX_PACKETS : 1;
+            size_t count = 0;
+            while (count < limit && (batch[count] = audio_service_.PopPacketFromSendQueue())) {
+                count++;
+            }
+            if (count == 0 || !protocol_->SendAudioBatch(batch, count)) {
+                break;
+            }
+        }
+    }
+}
+
 // The Main Event Loop controls the chat state and websocket connection
 // If other tasks need to access the websocket or chat state,
 // they should use Schedule to call this function
@@ -540,20 +1027,26 @@ void Application::MainEventLoop() {
 
     while (true) {
         auto bits = xEventGroupWaitBits(event_group_, MAIN_EVENT_SCHEDULE |
-            MAIN_EVENT_SEND_AUDIO |
             MAIN_EVENT_WAKE_WORD_DETECTED |
             MAIN_EVENT_VAD_CHANGE |
             MAIN_EVENT_ERROR, pdTRUE, pdFALSE, portMAX_DELAY);
         if (bits & MAIN_EVENT_ERROR) {
+            bool in_session = device_state_ == kDeviceStateConnecting || device_state_ == kDeviceStateListening ||
+                device_state_ == kDeviceStateSpeaking;
             SetDeviceState(kDeviceStateIdle);
-            Alert(Lang::Strings::ERROR, last_error_message_.c_str(), "sad", Lang::Sounds::P3_EXCLAMATION);
-        }
-
-        if (bits & MAIN_EVENT_SEND_AUDIO) {
-            while (auto packet = audio_service_.PopPacketFromSendQueue()) {
-                if (!protocol_->SendAudio(std::move(packet))) {
-                    break;
+            // 双网络板卡切换到备用网络后，中断的对话直接重连继续
+            bool failover = Board::GetInstance().FailoverNetwork([this, in_session]() {
+                if (!in_session || device_state_ != kDeviceStateIdle) {
+                    return;
                 }
+                OpenAudioChannelAsync([this]() {
+                    SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+                });
+            });
+            if (failover) {
+                Board::GetInstance().GetDisplay()->ShowNotification(Lang::Strings::SWITCH_TO_4G_NETWORK);
+            } else {
+                Alert(Lang::Strings::ERROR, last_error_message_.c_str(), "sad", Assets::GetInstance().GetSound("exclamation", Lang::Sounds::P3_EXCLAMATION));
             }
         }
 
@@ -569,12 +1062,7 @@ void Application::MainEventLoop() {
         }
 
         if (bits & MAIN_EVENT_SCHEDULE) {
-            std::unique_lock<std::mutex> lock(mutex_);
-            auto tasks = std::move(main_tasks_);
-            lock.unlock();
-            for (auto& task : tasks) {
-                task();
-            }
+            RunScheduledTasks();
         }
     }
 }
@@ -585,31 +1073,27 @@ void Application::OnWakeWordDetected() {
     }
 
     if (device_state_ == kDeviceStateIdle) {
+        audio_service_.PrepareOutput();
         audio_service_.EncodeWakeWord();
+        audio_service_.StartSpeechCommands();
 
-        if (!protocol_->IsAudioChannelOpened()) {
-            SetDeviceState(kDeviceStateConnecting);
-            if (!protocol_->OpenAudioChannel()) {
-                audio_service_.EnableWakeWordDetection(true);
-                return;
-            }
-        }
-
-        auto wake_word = audio_service_.GetLastWakeWord();
-        ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
+        OpenAudioChannelAsync([this]() {
+            auto wake_word = audio_service_.GetLastWakeWord();
+            ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
 #if CONFIG_USE_AFE_WAKE_WORD || CONFIG_USE_CUSTOM_WAKE_WORD
-        // Encode and send the wake word data to the server
-        while (auto packet = audio_service_.PopWakeWordPacket()) {
-            protocol_->SendAudio(std::move(packet));
-        }
-        // Set the chat state to wake word detected
-        protocol_->SendWakeWordDetected(wake_word);
-        SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+            // Encode and send the wake word data to the server
+            while (auto packet = audio_service_.PopWakeWordPacket()) {
+                protocol_->SendAudio(std::move(packet));
+            }
+            // Set the chat state to wake word detected
+            protocol_->SendWakeWordDetected(wake_word);
+            SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
 #else
-        SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
-        // Play the pop up sound to indicate the wake word is detected
-        audio_service_.PlaySound(Lang::Sounds::P3_POPUP);
+            SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+            // Play the pop up sound to indicate the wake word is detected
+            audio_service_.PlaySound(Assets::GetInstance().GetSound("popup", Lang::Sounds::P3_POPUP));
 #endif
+        });
     } else if (device_state_ == kDeviceStateSpeaking) {
         AbortSpeaking(kAbortReasonWakeWordDetected);
     } else if (device_state_ == kDeviceStateActivating) {
@@ -617,9 +1101,76 @@ void Application::OnWakeWordDetected() {
     }
 }
 
+// 命令词已在本地执行，不再等待服务器回复，结束这次对话
+void Application::OnSpeechCommand(const std::string& tool, const std::string& arguments) {
+    if (device_state_ != kDeviceStateConnecting && device_state_ != kDeviceStateListening) {
+        return;
+    }
+    ESP_LOGI(TAG, "Speech command: %s %s", tool.c_str(), arguments.c_str());
+    McpServer::GetInstance().CallToolLocally(tool, arguments);
+    if (protocol_->IsAudioChannelOpened()) {
+        protocol_->CloseAudioChannel();
+    } else {
+        SetDeviceState(kDeviceStateIdle);
+    }
+}
+
+/*
+ * Open the audio channel without blocking the main loop, DNS, TLS and the hello exchange run in a
+ * separate task. Capturing starts right away, the frames wait in the send queue and go out after
+ * on_opened has started listening, so the first words are not lost. on_opened runs in the main loop.
+ */
+void Application::OpenAudioChannelAsync(std::function<void()> on_opened) {
+    if (protocol_->IsAudioChannelOpened()) {
+        on_opened();
+        return;
+    }
+    if (audio_channel_opening_) {
+        return;
+    }
+    audio_channel_opening_ = true;
+    on_audio_channel_ready_ = std::move(on_opened);
+    SetDeviceState(kDeviceStateConnecting);
+    audio_service_.ClearSendQueue();
+    audio_service_.EnableUplinkGate(false);
+    audio_service_.EnableWakeWordDetection(false);
+    // Realtime conversations propose shorter frames, capturing starts at the default until the server agrees
+    protocol_->SetFrameDuration(aec_mode_ != kAecOff ? CONFIG_AUDIO_REALTIME_FRAME_DURATION_MS : OPUS_FRAME_DURATION_MS);
+    audio_service_.SetFrameDuration(OPUS_FRAME_DURATION_MS);
+    audio_service_.EnableVoiceProcessing(true);
+
+    // DNS、TLS 握手在网络工作任务上进行
+    NetworkWorker::GetInstance().Post([app = this]() {
+        bool opened = app->protocol_->OpenAudioChannel();
+        app->Schedule([app, opened]() {
+            app->audio_channel_opening_ = false;
+            auto on_opened = std::move(app->on_audio_channel_ready_);
+            app->on_audio_channel_ready_ = nullptr;
+            if (app->device_state_ != kDeviceStateConnecting) {
+                // The error handler or a local speech command has already gone back to idle
+                app->audio_service_.ClearSendQueue();
+                if (opened) {
+                    app->protocol_->CloseAudioChannel();
+                }
+                return;
+            }
+            if (!opened) {
+                app->audio_service_.ClearSendQueue();
+                app->SetDeviceState(kDeviceStateIdle);
+                return;
+            }
+            app->audio_service_.SetFrameDuration(app->protocol_->uplink_frame_duration());
+            on_opened();
+            app->NotifyAudioUplink();
+        });
+    });
+}
+
 void Application::AbortSpeaking(AbortReason reason) {
     ESP_LOGI(TAG, "Abort speaking");
     aborted_ = true;
+    // 不等服务器的 tts stop，本地立刻淡出并清空播放队列
+    audio_service_.InterruptPlayback();
     protocol_->SendAbortSpeaking(reason);
 }
 
@@ -628,6 +1179,69 @@ void Application::SetListeningMode(ListeningMode mode) {
     SetDeviceState(kDeviceStateListening);
 }
 
+static bool InConversation(DeviceState state) {
+    return state == kDeviceStateConnecting || state == kDeviceStateListening || state == kDeviceStateSpeaking;
+}
+
+// 对话期间暂停音乐/唱歌，回到待机后从原来的位置继续；进入配网、升级等其他状态时停止播放，释放采样率和网络连接
+void Application::UpdateStreamingForState(DeviceState previous_state, DeviceState state) {
+    auto& board = Board::GetInstance();
+    auto music = board.GetMusic();
+    auto sing = board.GetSing();
+    if (!music && !sing) {
+        return;
+    }
+#if CONFIG_MUSIC_CONVERSATION_STOP
+    bool stop = previous_state == kDeviceStateIdle && state != kDeviceStateIdle;
+#else
+    bool stop = (previous_state == kDeviceStateIdle || InConversation(previous_state)) &&
+        state != kDeviceStateIdle && !InConversation(state);
+#endif
+    if (stop) {
+        ESP_LOGI(TAG, "Stopping music/sing streaming due to state change: %s -> %s",
+                 STATE_STRINGS[previous_state], STATE_STRINGS[state]);
+        if (music) {
+            music->StopStreaming();
+        }
+        if (sing) {
+            sing->StopStreaming();
+        }
+        return;
+    }
+#if !CONFIG_MUSIC_CONVERSATION_STOP
+    if (state == kDeviceStateIdle && previous_state != kDeviceStateIdle) {
+        if (music) {
+            music->ResumeStreaming(false);
+        }
+        if (sing) {
+            sing->ResumeStreaming(false);
+        }
+    } else if (InConversation(state)) {
+#if CONFIG_MUSIC_CONVERSATION_DUCK
+        // 说话时在 TTS 下方继续播放，聆听时暂停，避免音乐干扰识别
+        bool under_voice = state == kDeviceStateSpeaking;
+#else
+        bool under_voice = false;
+#endif
+        if (under_voice) {
+            if (music) {
+                music->ResumeStreaming(true);
+            }
+            if (sing) {
+                sing->ResumeStreaming(true);
+            }
+        } else {
+            if (music) {
+                music->SuspendStreaming();
+            }
+            if (sing) {
+                sing->SuspendStreaming();
+            }
+        }
+    }
+#endif
+}
+
 void Application::SetDeviceState(DeviceState state) {
     if (device_state_ == state) {
         return;
@@ -637,6 +1251,8 @@ void Application::SetDeviceState(DeviceState state) {
     auto previous_state = device_state_;
     device_state_ = state;
     ESP_LOGI(TAG, "STATE: %s", STATE_STRINGS[device_state_]);
+    BlackBox::GetInstance().Record(kBlackBoxStateChange, previous_state << 8 | state);
+    TransferManager::GetInstance().SetConversationActive(InConversation(state));
 
     // Send the state change event
     DeviceStateEventManager::GetInstance().PostStateChangeEvent(previous_state, state);
@@ -646,23 +1262,16 @@ void Application::SetDeviceState(DeviceState state) {
     auto led = board.GetLed();
     led->OnStateChanged();
     
-    // 当从idle状态变成其他任何状态时，停止音乐/唱歌播放，避免占用采样率和网络连接
-    if (previous_state == kDeviceStateIdle && state != kDeviceStateIdle) {
-        auto music = board.GetMusic();
-        if (music) {
-            ESP_LOGI(TAG, "Stopping music streaming due to state change: %s -> %s", 
-                    STATE_STRINGS[previous_state], STATE_STRINGS[state]);
-            music->StopStreaming();
-        }
+    UpdateStreamingForState(previous_state, state);
 
-        auto sing = board.GetSing();
-        if (sing) {
-            ESP_LOGI(TAG, "Stopping sing streaming due to state change: %s -> %s", 
-                     STATE_STRINGS[previous_state], STATE_STRINGS[state]);
-            sing->StopStreaming();
-        }
+    if (state == kDeviceStateIdle || state == kDeviceStateUnknown) {
+        audio_service_.SetPowerTimeouts(CONFIG_AUDIO_POWER_IDLE_TIMEOUT_MS, CONFIG_AUDIO_POWER_IDLE_TIMEOUT_MS);
+    } else {
+        audio_service_.SetPowerTimeouts(CONFIG_AUDIO_POWER_ACTIVE_TIMEOUT_MS, CONFIG_AUDIO_POWER_ACTIVE_TIMEOUT_MS);
     }
-    
+    // 待机时画面基本静止，降低刷新率
+    display->SetIdle(state == kDeviceStateIdle || state == kDeviceStateUnknown);
+
     switch (state) {
         case kDeviceStateUnknown:
         case kDeviceStateIdle:
@@ -680,12 +1289,18 @@ void Application::SetDeviceState(DeviceState state) {
             display->SetStatus(Lang::Strings::LISTENING);
             display->SetEmotion("neutral");
 
+            // Silence is only dropped in realtime mode, the server VAD needs it to detect the end of speech
+            audio_service_.EnableUplinkGate(listening_mode_ == kListeningModeRealtime);
+
             // Make sure the audio processor is running
             if (!audio_service_.IsAudioProcessorRunning()) {
                 // Send the start listening command
                 protocol_->SendStartListening(listening_mode_);
                 audio_service_.EnableVoiceProcessing(true);
                 audio_service_.EnableWakeWordDetection(false);
+            } else if (previous_state == kDeviceStateConnecting) {
+                // 连接期间已开始采集，补发开始监听，积压的音频随后发出
+                protocol_->SendStartListening(listening_mode_);
             }
             break;
         case kDeviceStateSpeaking:
@@ -715,12 +1330,15 @@ void Application::Reboot() {
 
 void Application::WakeWordInvoke(const std::string& wake_word) {
     if (device_state_ == kDeviceStateIdle) {
-        ToggleChatState();
         Schedule([this, wake_word]() {
-            if (protocol_) {
-                protocol_->SendWakeWordDetected(wake_word); 
+            if (!protocol_ || device_state_ != kDeviceStateIdle) {
+                return;
             }
-        }); 
+            OpenAudioChannelAsync([this, wake_word]() {
+                SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+                protocol_->SendWakeWordDetected(wake_word);
+            });
+        });
     } else if (device_state_ == kDeviceStateSpeaking) {
         Schedule([this]() {
             AbortSpeaking(kAbortReasonNone);
@@ -751,11 +1369,26 @@ bool Application::CanEnterSleepMode() {
     return true;
 }
 
+bool Application::SendVideoFrame(const uint8_t* jpeg, size_t size) {
+    if (!protocol_ || !protocol_->IsAudioChannelOpened()) {
+        return false;
+    }
+    return protocol_->SendVideoFrame(jpeg, size, (uint32_t)(esp_timer_get_time() / 1000));
+}
+
 void Application::SendMcpMessage(const std::string& payload) {
-    Schedule([this, payload]() {
-        if (protocol_) {
-            protocol_->SendMcpMessage(payload);
-        }
+    SendMcpMessage([&payload](JsonWriter& writer) {
+        writer.Raw(payload);
+    }, payload.size());
+}
+
+void Application::SendMcpMessage(const std::function<void(JsonWriter& writer)>& write_payload, size_t size_hint) {
+    if (!protocol_) {
+        return;
+    }
+    auto message = protocol_->BuildMcpMessage(write_payload, size_hint);
+    Schedule([this, message = std::move(message)]() {
+        protocol_->SendMcpEnvelope(message);
     });
 }
 
@@ -788,85 +1421,36 @@ void Application::SetAecMode(AecMode mode) {
 
 // 新增：接收外部音频数据（如音乐播放）
 void Application::AddAudioData(AudioStreamPacket&& packet) {
+    // packet.payload包含的是原始PCM数据（int16_t）
+    AddAudioData(reinterpret_cast<const int16_t*>(packet.payload.data()),
+                 packet.payload.size() / sizeof(int16_t), packet.sample_rate);
+}
+
+void Application::AddAudioData(const int16_t* pcm, size_t num_samples, int sample_rate) {
     auto codec = Board::GetInstance().GetAudioCodec();
-    // 放宽播放条件：只要存在编解码器即可尝试输出，并在需要时自动开启输出
-    if (codec) {
-        // packet.payload包含的是原始PCM数据（int16_t）
-        if (packet.payload.size() >= 2) {
-            size_t num_samples = packet.payload.size() / sizeof(int16_t);
-            std::vector<int16_t> pcm_data(num_samples);
-            memcpy(pcm_data.data(), packet.payload.data(), packet.payload.size());
-            
-            // 检查采样率是否匹配，如果不匹配则进行简单重采样
-            if (packet.sample_rate != codec->output_sample_rate()) {
-                // ESP_LOGI(TAG, "Resampling music audio from %d to %d Hz", 
-                //         packet.sample_rate, codec->output_sample_rate());
-                
-                // 验证采样率参数
-                if (packet.sample_rate <= 0 || codec->output_sample_rate() <= 0) {
-                    ESP_LOGE(TAG, "Invalid sample rates: %d -> %d", 
-                            packet.sample_rate, codec->output_sample_rate());
-                    return;
-                }
-                
-                std::vector<int16_t> resampled;
-                
-                if (packet.sample_rate > codec->output_sample_rate()) {
-                    ESP_LOGI(TAG, "音乐播放：将采样率从 %d Hz 切换到 %d Hz", 
-                        codec->output_sample_rate(), packet.sample_rate);
-
-                    // 尝试动态切换采样率
-                    if (codec->SetOutputSampleRate(packet.sample_rate)) {
-                        ESP_LOGI(TAG, "成功切换到音乐播放采样率: %d Hz", packet.sample_rate);
-                    } else {
-                        ESP_LOGW(TAG, "无法切换采样率，继续使用当前采样率: %d Hz", codec->output_sample_rate());
-                    }
-                } else {
-                    // 上采样：线性插值
-                    float upsample_ratio = codec->output_sample_rate() / static_cast<float>(packet.sample_rate);
-                    size_t expected_size = static_cast<size_t>(pcm_data.size() * upsample_ratio + 0.5f);
-                    resampled.reserve(expected_size);
-                    
-                    for (size_t i = 0; i < pcm_data.size(); ++i) {
-                        // 添加原始样本
-                        resampled.push_back(pcm_data[i]);
-                        
-                        // 计算需要插值的样本数
-                        int interpolation_count = static_cast<int>(upsample_ratio) - 1;
-                        if (interpolation_count > 0 && i + 1 < pcm_data.size()) {
-                            int16_t current = pcm_data[i];
-                            int16_t next = pcm_data[i + 1];
-                            for (int j = 1; j <= interpolation_count; ++j) {
-                                float t = static_cast<float>(j) / (interpolation_count + 1);
-                                int16_t interpolated = static_cast<int16_t>(current + (next - current) * t);
-                                resampled.push_back(interpolated);
-                            }
-                        } else if (interpolation_count > 0) {
-                            // 最后一个样本，直接重复
-                            for (int j = 1; j <= interpolation_count; ++j) {
-                                resampled.push_back(pcm_data[i]);
-                            }
-                        }
-                    }
-                    
-                    ESP_LOGI(TAG, "Upsampled %d -> %d samples (ratio: %.2f)", 
-                            pcm_data.size(), resampled.size(), upsample_ratio);
-                }
-                
-                pcm_data = std::move(resampled);
-            }
-            
-            // 确保音频输出已启用
-            if (!codec->output_enabled()) {
-                codec->EnableOutput(true);
-            }
-            
-            // 发送PCM数据到音频编解码器
-            codec->OutputData(pcm_data);
-            
-            audio_service_.UpdateOutputTimestamp();
-        }
+    // 放宽播放条件：只要存在编解码器即可尝试输出
+    if (codec == nullptr || num_samples == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(music_mutex_);
+    if (sample_rate == codec->output_sample_rate()) {
+        audio_service_.WriteMusicData(pcm, num_samples);
+        return;
+    }
+    if (sample_rate <= 0) {
+        ESP_LOGE(TAG, "Invalid sample rate: %d", sample_rate);
+        return;
+    }
+
+    // 重采样到编解码器的输出采样率，不再为每首歌切换 I2S 时钟
+    if (music_resampler_.input_sample_rate() != sample_rate ||
+        music_resampler_.output_sample_rate() != codec->output_sample_rate()) {
+        ESP_LOGI(TAG, "Resampling music audio from %d to %d Hz", sample_rate, codec->output_sample_rate());
+        music_resampler_.Configure(sample_rate, codec->output_sample_rate());
     }
+    music_resampler_.Process(pcm, num_samples, music_resample_buffer_);
+    audio_service_.WriteMusicData(music_resample_buffer_.data(), music_resample_buffer_.size());
 }
 
 void Application::PlaySound(const std::string_view& sound) {
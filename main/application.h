@@ -7,23 +7,49 @@
 #include <esp_timer.h>
 
 #include <string>
+#include <atomic>
 #include <mutex>
-#include <deque>
+#include <array>
 #include <vector>
 #include <memory>
+#include <string_view>
 
 #include "protocol.h"
 #include "ota.h"
 #include "audio_service.h"
+#include "polyphase_resampler.h"
 #include "device_state_event.h"
 
 #define MAIN_EVENT_SCHEDULE (1 << 0)
-#define MAIN_EVENT_SEND_AUDIO (1 << 1)
 #define MAIN_EVENT_WAKE_WORD_DETECTED (1 << 2)
 #define MAIN_EVENT_VAD_CHANGE (1 << 3)
 #define MAIN_EVENT_ERROR (1 << 4)
 #define MAIN_EVENT_CHECK_NEW_VERSION_DONE (1 << 5)
 
+#define AUDIO_UPLINK_TASK_STACK_SIZE 4096
+#if CONFIG_FREERTOS_UNICORE || CONFIG_AUDIO_UPLINK_TASK_CORE < 0
+#define AUDIO_UPLINK_TASK_CORE tskNO_AFFINITY
+#else
+#define AUDIO_UPLINK_TASK_CORE CONFIG_AUDIO_UPLINK_TASK_CORE
+#endif
+
+// Preallocated scheduled tasks per priority, the queues only grow during unusual bursts
+#define MAIN_TASK_QUEUE_RESERVE 16
+
+enum TaskPriority {
+    kTaskPriorityHigh,      // Device state changes, run before display updates and other tasks
+    kTaskPriorityNormal,
+    kTaskPriorityCount,
+};
+
+// Display updates where only the latest value matters, a pending one is replaced instead of queued again
+enum DisplayUpdate {
+    kDisplayUpdateUserMessage,
+    kDisplayUpdateAssistantMessage,
+    kDisplayUpdateEmotion,
+    kDisplayUpdateCount,
+};
+
 enum AecMode {
     kAecOff,
     kAecOnDeviceSide,
@@ -44,7 +70,8 @@ public:
     void MainEventLoop();
     DeviceState GetDeviceState() const { return device_state_; }
     bool IsVoiceDetected() const { return audio_service_.IsVoiceDetected(); }
-    void Schedule(std::function<void()> callback);
+    void Schedule(std::function<void()> callback, TaskPriority priority = kTaskPriorityNormal);
+    void ScheduleDisplayUpdate(DisplayUpdate type, std::string_view text);
     void SetDeviceState(DeviceState state);
     void Alert(const char* status, const char* message, const char* emotion = "", const std::string_view& sound = "");
     void DismissAlert();
@@ -56,11 +83,17 @@ public:
     void WakeWordInvoke(const std::string& wake_word);
     bool CanEnterSleepMode();
     void SendMcpMessage(const std::string& payload);
+    // Serializes the message on the calling task, only the send goes through the main loop
+    void SendMcpMessage(const std::function<void(JsonWriter& writer)>& write_payload, size_t size_hint = 0);
+    // 由摄像头任务直接调用，协议内部对发送加锁
+    bool SendVideoFrame(const uint8_t* jpeg, size_t size);
     void SetAecMode(AecMode mode);
     AecMode GetAecMode() const { return aec_mode_; }
     
     // 新增：接收外部音频数据（如音乐播放）
     void AddAudioData(AudioStreamPacket&& packet);
+    // 直接写入混音器，不经过 AudioStreamPacket，供逐帧解码的流播放使用
+    void AddAudioData(const int16_t* pcm, size_t samples, int sample_rate);
     void PlaySound(const std::string_view& sound);
     AudioService& GetAudioService() { return audio_service_; }
 
@@ -69,10 +102,27 @@ private:
     ~Application();
 
     std::mutex mutex_;
-    std::deque<std::function<void()>> main_tasks_;
+    // Music and sing PCM is resampled to the codec output rate before mixing
+    std::mutex music_mutex_;
+    PolyphaseResampler music_resampler_;
+    std::vector<int16_t> music_resample_buffer_;
+    std::array<std::vector<std::function<void()>>, kTaskPriorityCount> main_tasks_;
+    std::vector<std::function<void()>> running_tasks_;
+    // 待刷新的显示内容，字符串容量复用，不随每条消息分配
+    std::array<std::string, kDisplayUpdateCount> display_updates_;
+    std::array<std::string, kDisplayUpdateCount> applying_display_updates_;
+    uint32_t pending_display_updates_ = 0;
+    size_t max_task_queue_depth_ = 0;
+    uint32_t coalesced_display_updates_ = 0;
+#if CONFIG_USE_WECHAT_MESSAGE_STYLE
+    // 同一次回复的句子追加到当前气泡，排队期间到达的句子拼在一起
+    std::string assistant_batch_;
+    bool assistant_batch_scheduled_ = false;
+    bool assistant_reply_open_ = false;
+#endif
     std::unique_ptr<Protocol> protocol_;
     EventGroupHandle_t event_group_ = nullptr;
-    esp_timer_handle_t clock_timer_handle_ = nullptr;
+    int clock_tick_id_ = 0;
     volatile DeviceState device_state_ = kDeviceStateUnknown;
     ListeningMode listening_mode_ = kListeningModeAutoStop;
     AecMode aec_mode_ = kAecOff;
@@ -80,15 +130,32 @@ private:
     AudioService audio_service_;
 
     bool has_server_time_ = false;
-    bool aborted_ = false;
+    // Set on barge-in until the next tts start, TTS audio still in flight from the aborted reply is dropped
+    std::atomic<bool> aborted_{false};
     int clock_ticks_ = 0;
-    TaskHandle_t check_new_version_task_handle_ = nullptr;
+    TaskHandle_t audio_uplink_task_handle_ = nullptr;
+    bool audio_channel_opening_ = false;
+    std::function<void()> on_audio_channel_ready_;
 
     void OnWakeWordDetected();
-    void CheckNewVersion(Ota& ota);
+    void OnSpeechCommand(const std::string& tool, const std::string& arguments);
+    void RunScheduledTasks();
+    void AudioUplinkTask();
+    void NotifyAudioUplink();
+    void ApplyDisplayUpdate(DisplayUpdate type, const char* text);
+    // background 为 true 时在其他任务上运行，状态切换交给主循环
+    void CheckNewVersion(Ota& ota, bool background = false);
+    void SetDeviceStateOnMainLoop(DeviceState state);
+    void CheckNewVersionInBackground(std::shared_ptr<Ota> ota, int attempt);
+    void FinishBackgroundVersionCheck(std::shared_ptr<Ota> ota);
+    void RunBackgroundUpgrade(Ota& ota);
+    void SaveBootProtocol(Ota& ota);
     void ShowActivationCode(const std::string& code, const std::string& message);
     void OnClockTimer();
+    void UpdateStreamingForState(DeviceState previous_state, DeviceState state);
+    void SubscribePowerPolicy();
     void SetListeningMode(ListeningMode mode);
+    void OpenAudioChannelAsync(std::function<void()> on_opened);
 };
 
 #endif // _APPLICATION_H_
@@ -0,0 +1,121 @@
+#include "assets.h"
+
+#include <esp_log.h>
+
+#include <cstring>
+
+#define TAG "Assets"
+
+Assets::Assets() {
+#ifdef CONFIG_USE_ASSETS_PARTITION
+    // 分区自带文件表和校验和，不与固件绑定，单独烧录或升级后无需重新编译
+    const mmap_assets_config_t config = {
+        .partition_label = CONFIG_ASSETS_PARTITION,
+        .max_files = 0,
+        .checksum = 0,
+        .flags = {.mmap_enable = true, .full_check = true},
+    };
+    esp_err_t err = mmap_assets_new(&config, &handle_);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Assets partition '%s' not usable (%s), using built-in assets",
+            CONFIG_ASSETS_PARTITION, esp_err_to_name(err));
+        handle_ = nullptr;
+        return;
+    }
+
+    int count = mmap_assets_get_stored_files(handle_);
+    for (int i = 0; i < count; i++) {
+        const char* name = mmap_assets_get_name(handle_, i);
+        if (name != nullptr) {
+            index_.emplace(name, i);
+        }
+    }
+    ESP_LOGI(TAG, "Mapped %d assets from partition '%s'", count, CONFIG_ASSETS_PARTITION);
+#endif
+}
+
+Assets::~Assets() {
+#if LV_USE_FS_MEMFS
+    for (auto& [name, font] : fonts_) {
+        lv_binfont_destroy(font);
+    }
+#endif
+    if (handle_ != nullptr) {
+        mmap_assets_del(handle_);
+    }
+}
+
+bool Assets::GetAssetData(const std::string& name, const void*& data, size_t& size) {
+    auto it = index_.find(name);
+    if (it == index_.end()) {
+        return false;
+    }
+    int length = mmap_assets_get_size(handle_, it->second);
+    const uint8_t* mem = mmap_assets_get_mem(handle_, it->second);
+    if (mem == nullptr || length <= 0) {
+        return false;
+    }
+    data = mem;
+    size = length;
+    return true;
+}
+
+std::string_view Assets::GetSound(const char* name, const std::string_view& fallback) {
+    const void* data;
+    size_t size;
+    if (handle_ != nullptr && GetAssetData(std::string(name) + ".p3", data, size)) {
+        return std::string_view(static_cast<const char*>(data), size);
+    }
+    return fallback;
+}
+
+const lv_font_t* Assets::GetFont(const char* name, const lv_font_t* fallback) {
+    if (handle_ == nullptr) {
+        return fallback;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = fonts_.find(name);
+    if (it != fonts_.end()) {
+        return it->second != nullptr ? it->second : fallback;
+    }
+
+    lv_font_t* font = nullptr;
+    const void* data;
+    size_t size;
+    if (GetAssetData(std::string(name) + ".bin", data, size)) {
+#if LV_USE_FS_MEMFS
+        // binfont 在创建时把字形数据整体读到堆上，之后不再访问映射区
+        font = lv_binfont_create_from_buffer(const_cast<void*>(data), size);
+        if (font == nullptr) {
+            ESP_LOGE(TAG, "Failed to load font %s", name);
+        }
+#else
+        ESP_LOGW(TAG, "Font %s found but LV_USE_FS_MEMFS is disabled", name);
+#endif
+    }
+    fonts_.emplace(name, font);
+    return font != nullptr ? font : fallback;
+}
+
+const lv_image_dsc_t* Assets::GetEmoji(const char* name, const lv_image_dsc_t* fallback) {
+    if (handle_ == nullptr) {
+        return fallback;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = emojis_.find(name);
+    if (it != emojis_.end()) {
+        return it->second.data != nullptr ? &it->second : fallback;
+    }
+
+    lv_image_dsc_t dsc = {};
+    const void* data;
+    size_t size;
+    if (GetAssetData(std::string(name) + ".gif", data, size)) {
+        dsc.header.magic = LV_IMAGE_HEADER_MAGIC;
+        dsc.header.cf = LV_COLOR_FORMAT_RAW;
+        dsc.data_size = size;
+        dsc.data = static_cast<const uint8_t*>(data);
+    }
+    auto& entry = emojis_.emplace(name, dsc).first->second;
+    return entry.data != nullptr ? &entry : fallback;
+}
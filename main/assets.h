@@ -0,0 +1,50 @@
+#ifndef ASSETS_H
+#define ASSETS_H
+
+#include <lvgl.h>
+#include <esp_mmap_assets.h>
+
+#include <string>
+#include <string_view>
+#include <map>
+#include <mutex>
+
+/*
+ * Sounds, fonts and emoji in a separate "assets" partition (esp_mmap_assets format), mapped into the
+ * address space once at boot so they are used in place from flash. The partition carries its own index
+ * table and checksum and is not tied to the app image, so it can be reflashed on its own, e.g. to switch
+ * the language pack. Every lookup falls back to what is compiled into the app when the partition is
+ * missing or has no such file.
+ */
+class Assets {
+public:
+    static Assets& GetInstance() {
+        static Assets instance;
+        return instance;
+    }
+
+    bool available() const { return handle_ != nullptr; }
+
+    bool GetAssetData(const std::string& name, const void*& data, size_t& size);
+
+    // name 为不带扩展名的文件名，例如 "welcome" 对应 welcome.p3
+    std::string_view GetSound(const char* name, const std::string_view& fallback);
+    // LVGL 二进制字体（lv_font_conv --format bin），需要开启 LV_USE_FS_MEMFS 并设置盘符
+    const lv_font_t* GetFont(const char* name, const lv_font_t* fallback);
+    // GIF 表情，描述符由 Assets 持有，一直有效
+    const lv_image_dsc_t* GetEmoji(const char* name, const lv_image_dsc_t* fallback);
+
+private:
+    Assets();
+    ~Assets();
+    Assets(const Assets&) = delete;
+    Assets& operator=(const Assets&) = delete;
+
+    mmap_assets_handle_t handle_ = nullptr;
+    std::map<std::string, int, std::less<>> index_;
+    std::mutex mutex_;
+    std::map<std::string, lv_font_t*, std::less<>> fonts_;
+    std::map<std::string, lv_image_dsc_t, std::less<>> emojis_;
+};
+
+#endif // ASSETS_H
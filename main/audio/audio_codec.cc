@@ -1,10 +1,13 @@
 #include "audio_codec.h"
 #include "board.h"
 #include "settings.h"
+#include "audio_dsp.h"
 
 #include <esp_log.h>
 #include <cstring>
+#include <algorithm>
 #include <driver/i2s_common.h>
+#include <esp_attr.h>
 
 #define TAG "AudioCodec"
 
@@ -12,18 +15,142 @@ AudioCodec::AudioCodec() {
 }
 
 AudioCodec::~AudioCodec() {
+    if (volume_timer_ != nullptr) {
+        esp_timer_stop(volume_timer_);
+        esp_timer_delete(volume_timer_);
+    }
+}
+
+std::string AudioCodec::input_format() const {
+    if (!input_format_.empty()) {
+        return input_format_;
+    }
+    int ref_num = input_reference_ ? 1 : 0;
+    std::string format(input_channels_ - ref_num, 'M');
+    format.append(ref_num, 'R');
+    return format;
+}
+
+int AudioCodec::input_mics() const {
+    int mics = 0;
+    for (char c : input_format()) {
+        mics += c == 'M';
+    }
+    return mics;
+}
+
+// 每帧都会调用，直接扫描格式字符串，不构造 input_format()
+int AudioCodec::input_mic_channel(int n) const {
+    if (input_format_.empty()) {
+        int mics = input_channels_ - (input_reference_ ? 1 : 0);
+        return n >= 0 && n < mics ? n : -1;
+    }
+    for (int i = 0; i < (int)input_format_.size(); i++) {
+        if (input_format_[i] == 'M' && n-- == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int AudioCodec::input_reference_channel() const {
+    if (input_format_.empty()) {
+        return input_reference_ ? input_channels_ - 1 : -1;
+    }
+    auto pos = input_format_.find('R');
+    return pos == std::string::npos ? -1 : (int)pos;
+}
+
+void AudioChannelView::CopyTo(int16_t* output) const {
+    if (frames_ > 0) {
+        AudioDsp::ExtractChannel(data_, stride_, 0, output, frames_);
+    }
 }
 
 void AudioCodec::OutputData(std::vector<int16_t>& data) {
-    Write(data.data(), data.size());
+    OutputData(data.data(), data.size());
 }
 
-bool AudioCodec::InputData(std::vector<int16_t>& data) {
-    int samples = Read(data.data(), data.size());
-    if (samples > 0) {
+void AudioCodec::OutputData(const int16_t* data, int samples) {
+    // 与 SetOutputSampleRate 互斥，换时钟时不会有写入进行到一半
+    std::lock_guard<std::mutex> lock(output_mutex_);
+    if (output_tracking_) {
+        // The DMA ran dry since the last write, it restarts from empty
+        if ((int32_t)(output_written_frames_ - output_sent_frames_.load(std::memory_order_relaxed)) < 0) {
+            output_written_frames_ = output_sent_frames_.load(std::memory_order_relaxed);
+        }
+        output_written_frames_ += samples / output_channels_;
+    }
+    if (shaper_dirty_.exchange(false)) {
+        shaper_.Configure(shaper_profile_.load(), shaper_limiter_.load());
+    }
+    if (shaper_.active()) {
+        shaped_.assign(data, data + samples);
+        shaper_.Process(shaped_.data(), samples, output_sample_rate_, output_channels_);
+        data = shaped_.data();
+    }
+    Write(data, samples);
+}
+
+bool IRAM_ATTR AudioCodec::OnOutputSent(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx) {
+    auto codec = static_cast<AudioCodec*>(user_ctx);
+    codec->output_sent_frames_.fetch_add(AUDIO_CODEC_DMA_FRAME_NUM, std::memory_order_relaxed);
+    TaskHandle_t waiter = codec->output_waiter_.load(std::memory_order_relaxed);
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    if (waiter != nullptr) {
+        vTaskNotifyGiveFromISR(waiter, &higher_priority_task_woken);
+    }
+    return higher_priority_task_woken == pdTRUE;
+}
+
+void AudioCodec::RegisterOutputCallbacks() {
+    i2s_event_callbacks_t callbacks = {};
+    callbacks.on_sent = OnOutputSent;
+    esp_err_t ret = i2s_channel_register_event_callback(tx_handle_, &callbacks, this);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Output DMA tracking unavailable: %s", esp_err_to_name(ret));
+        return;
+    }
+    output_tracking_ = true;
+}
+
+int AudioCodec::output_buffered_frames() {
+    if (!output_tracking_) {
+        return 0;
+    }
+    int32_t buffered = output_written_frames_ - output_sent_frames_.load(std::memory_order_relaxed);
+    return buffered > 0 ? buffered : 0;
+}
+
+int64_t AudioCodec::output_latency_us() {
+    return output_sample_rate_ > 0 ? (int64_t)output_buffered_frames() * 1000000 / output_sample_rate_ : 0;
+}
+
+bool AudioCodec::WaitForOutputSpace(int samples, int timeout_ms) {
+    if (!output_tracking_) {
         return true;
     }
-    return false;
+    const int capacity = AUDIO_CODEC_DMA_DESC_NUM * AUDIO_CODEC_DMA_FRAME_NUM;
+    int frames = samples / output_channels_;
+    TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(timeout_ms);
+    output_waiter_.store(xTaskGetCurrentTaskHandle(), std::memory_order_relaxed);
+    while (output_buffered_frames() + frames > capacity) {
+        TickType_t now = xTaskGetTickCount();
+        if ((int32_t)(deadline - now) <= 0) {
+            break;
+        }
+        ulTaskNotifyTake(pdTRUE, deadline - now);
+    }
+    output_waiter_.store(nullptr, std::memory_order_relaxed);
+    return output_buffered_frames() + frames <= capacity;
+}
+
+bool AudioCodec::InputData(std::vector<int16_t>& data) {
+    return InputData(data.data(), data.size());
+}
+
+bool AudioCodec::InputData(int16_t* data, int samples) {
+    return Read(data, samples) > 0;
 }
 
 void AudioCodec::Start() {
@@ -41,6 +168,7 @@ void AudioCodec::Start() {
     }
 
     if (tx_handle_ != nullptr) {
+        RegisterOutputCallbacks();
         ESP_ERROR_CHECK(i2s_channel_enable(tx_handle_));
     }
 
@@ -50,6 +178,9 @@ void AudioCodec::Start() {
 
     EnableInput(true);
     EnableOutput(true);
+    eq_profile_ = (AudioEqProfile)settings.GetInt("eq_profile", kAudioEqFlat);
+    limiter_enabled_ = settings.GetInt("limiter", 0) != 0;
+    UpdateShaper();
     ESP_LOGI(TAG, "Audio codec started");
 }
 
@@ -61,6 +192,80 @@ void AudioCodec::SetOutputVolume(int volume) {
     settings.SetInt("output_volume", output_volume_);
 }
 
+void AudioCodec::RequestOutputVolume(int volume) {
+    target_volume_ = std::clamp(volume, 0, 100);
+    if (volume_timer_ == nullptr) {
+        esp_timer_create_args_t timer_args = {
+            .callback = [](void* arg) {
+                ((AudioCodec*)arg)->ApplyTargetVolume();
+            },
+            .arg = this,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "codec_volume",
+            .skip_unhandled_events = true,
+        };
+        if (esp_timer_create(&timer_args, &volume_timer_) != ESP_OK) {
+            volume_timer_ = nullptr;
+            ApplyTargetVolume();
+            return;
+        }
+    }
+    if (esp_timer_is_active(volume_timer_)) {
+        // 到期时写入最新的目标值
+        return;
+    }
+    int64_t wait_us = volume_written_us_ + AUDIO_CODEC_VOLUME_INTERVAL_MS * 1000 - esp_timer_get_time();
+    if (wait_us <= 0) {
+        ApplyTargetVolume();
+    } else {
+        esp_timer_start_once(volume_timer_, wait_us);
+    }
+}
+
+int AudioCodec::target_output_volume() const {
+    int volume = target_volume_;
+    return volume >= 0 ? volume : output_volume_;
+}
+
+void AudioCodec::ApplyTargetVolume() {
+    std::lock_guard<std::mutex> lock(volume_mutex_);
+    int volume = target_volume_;
+    if (volume < 0) {
+        return;
+    }
+    volume_written_us_ = esp_timer_get_time();
+    SetOutputVolume(volume);
+    // 写入期间又有新的目标值时保留，由发起的调用接着写入
+    target_volume_.compare_exchange_strong(volume, -1);
+}
+
+void AudioCodec::SetEqProfile(AudioEqProfile profile) {
+    eq_profile_ = profile;
+    ESP_LOGI(TAG, "Set EQ profile to %d", profile);
+    UpdateShaper();
+
+    Settings settings("audio", true);
+    settings.SetInt("eq_profile", profile);
+}
+
+void AudioCodec::SetLimiter(bool enable) {
+    limiter_enabled_ = enable;
+    ESP_LOGI(TAG, "Set limiter to %s", enable ? "true" : "false");
+    UpdateShaper();
+
+    Settings settings("audio", true);
+    settings.SetInt("limiter", enable ? 1 : 0);
+}
+
+void AudioCodec::UpdateShaper() {
+    bool hardware_eq = SupportsHardwareEq() && ApplyHardwareEq(eq_profile_);
+    bool hardware_limiter = SupportsHardwareLimiter() && ApplyHardwareLimiter(limiter_enabled_);
+    // 由输出任务在下一次 OutputData 时生效
+    shaper_profile_ = hardware_eq ? kAudioEqFlat : eq_profile_;
+    shaper_limiter_ = !hardware_limiter && limiter_enabled_;
+    shaper_dirty_ = true;
+}
+
 void AudioCodec::EnableInput(bool enable) {
     if (enable == input_enabled_) {
         return;
@@ -104,10 +309,27 @@ bool AudioCodec::SetOutputSampleRate(int sample_rate) {
         output_sample_rate_ = sample_rate;
         return true;
     }
-    
+
+    // 双工时收发共用同一组时钟，改输出采样率会连带麦克风一起变；调用方应保持设备采样率并重采样
+    if (duplex_ && rx_handle_ != nullptr) {
+        ESP_LOGW(TAG, "Output clock is shared with input, keeping %d Hz", output_sample_rate_);
+        return false;
+    }
+
     ESP_LOGI(TAG, "Changing output sample rate from %d to %d Hz", output_sample_rate_, sample_rate);
-    
-    // 先尝试禁用 I2S 通道（如果已启用的话）
+
+    // 挡住所有输出写入，等 DMA 里已写入的数据播完；DMA 自动清零，之后发出的都是静音，换时钟不会爆音
+    std::lock_guard<std::mutex> lock(output_mutex_);
+    int drain_ms = AUDIO_CODEC_DMA_DESC_NUM * AUDIO_CODEC_DMA_FRAME_NUM * 1000 / output_sample_rate_ + 10;
+    if (output_tracking_) {
+        TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(drain_ms);
+        while (output_buffered_frames() > 0 && (int32_t)(deadline - xTaskGetTickCount()) > 0) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+    } else {
+        vTaskDelay(pdMS_TO_TICKS(drain_ms));
+    }
+
     esp_err_t disable_ret = i2s_channel_disable(tx_handle_);
     if (disable_ret == ESP_OK) {
         ESP_LOGI(TAG, "Disabled I2S TX channel for reconfiguration");
@@ -138,6 +360,8 @@ bool AudioCodec::SetOutputSampleRate(int sample_rate) {
         ESP_LOGI(TAG, "Enabled I2S TX channel");
     }
     
+    // DMA 已经清空，重新从空开始计数
+    output_written_frames_ = output_sent_frames_.load(std::memory_order_relaxed);
     if (ret == ESP_OK) {
         output_sample_rate_ = sample_rate;
         ESP_LOGI(TAG, "Successfully changed output sample rate to %d Hz", sample_rate);
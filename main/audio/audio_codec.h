@@ -3,17 +3,46 @@
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <freertos/task.h>
 #include <driver/i2s_std.h>
+#include <esp_timer.h>
 
+#include <atomic>
+#include <mutex>
 #include <vector>
 #include <string>
 #include <functional>
 
 #include "board.h"
+#include "audio_shaper.h"
 
 #define AUDIO_CODEC_DMA_DESC_NUM 6
 #define AUDIO_CODEC_DMA_FRAME_NUM 240
 #define AUDIO_CODEC_DEFAULT_MIC_GAIN 30.0
+// 连续调节音量时写入 codec 的最小间隔
+#define AUDIO_CODEC_VOLUME_INTERVAL_MS 100
+
+// 交织输入中某一路的跨步视图，不复制数据；channel 为 -1（通道不存在）时为空
+class AudioChannelView {
+public:
+    AudioChannelView(const int16_t* data, size_t samples, int channels, int channel)
+        : data_(channel >= 0 ? data + channel : nullptr), stride_(channels),
+          frames_(channel >= 0 ? samples / channels : 0) {}
+
+    inline int16_t operator[](size_t frame) const { return data_[frame * stride_]; }
+    inline size_t size() const { return frames_; }
+    inline bool empty() const { return frames_ == 0; }
+    // 单声道输入时可以直接使用 data()
+    inline bool contiguous() const { return stride_ == 1; }
+    inline const int16_t* data() const { return data_; }
+    // output 可以与原始交织数据相同
+    void CopyTo(int16_t* output) const;
+
+private:
+    const int16_t* data_;
+    int stride_;
+    size_t frames_;
+};
 
 class AudioCodec {
 public:
@@ -21,22 +50,54 @@ public:
     virtual ~AudioCodec();
     
     virtual void SetOutputVolume(int volume);
+    // 旋钮等连续调节用：SetOutputVolume 最多每 AUDIO_CODEC_VOLUME_INTERVAL_MS 调用一次，中间的值合并成最后一个
+    void RequestOutputVolume(int volume);
     virtual void EnableInput(bool enable);
     virtual void EnableOutput(bool enable);
     virtual bool SetOutputSampleRate(int sample_rate);
 
     virtual void OutputData(std::vector<int16_t>& data);
+    void OutputData(const int16_t* data, int samples);
     virtual bool InputData(std::vector<int16_t>& data);
+    bool InputData(int16_t* data, int samples);
     virtual void Start();
 
+    // 响度调整：codec 有对应的硬件模块时交给硬件，否则在 OutputData 里用软件处理
+    virtual bool SupportsHardwareEq() const { return false; }
+    virtual bool SupportsHardwareLimiter() const { return false; }
+    void SetEqProfile(AudioEqProfile profile);
+    void SetLimiter(bool enable);
+    inline AudioEqProfile eq_profile() const { return eq_profile_; }
+    inline bool limiter_enabled() const { return limiter_enabled_; }
+
+    // Frames written to the TX DMA buffers but not played yet, tracked by the I2S on_sent callback
+    int output_buffered_frames();
+    int64_t output_latency_us();
+    // Blocks on the on_sent callback until the samples fit into the DMA buffers, so Write() returns at once
+    bool WaitForOutputSpace(int samples, int timeout_ms);
+
     inline bool duplex() const { return duplex_; }
     inline bool input_reference() const { return input_reference_; }
     inline int input_sample_rate() const { return input_sample_rate_; }
     inline int output_sample_rate() const { return output_sample_rate_; }
     inline int original_output_sample_rate() const { return original_output_sample_rate_; }
     inline int input_channels() const { return input_channels_; }
+    // AFE 的输入格式，M 为麦克风，R 为回采，N 为未使用的通道
+    std::string input_format() const;
+    int input_mics() const;
+    // 按 input_format() 找到第 n 个麦克风和回采所在的通道，不存在时返回 -1
+    int input_mic_channel(int n = 0) const;
+    int input_reference_channel() const;
+    inline AudioChannelView InputMic(const std::vector<int16_t>& data, int n = 0) const {
+        return AudioChannelView(data.data(), data.size(), input_channels_, input_mic_channel(n));
+    }
+    inline AudioChannelView InputReference(const std::vector<int16_t>& data) const {
+        return AudioChannelView(data.data(), data.size(), input_channels_, input_reference_channel());
+    }
     inline int output_channels() const { return output_channels_; }
     inline int output_volume() const { return output_volume_; }
+    // 还没写入的目标音量，没有时等于 output_volume()，连续调节时按它计算下一步
+    int target_output_volume() const;
     inline bool input_enabled() const { return input_enabled_; }
     inline bool output_enabled() const { return output_enabled_; }
 
@@ -52,11 +113,45 @@ protected:
     int output_sample_rate_ = 0;
     int original_output_sample_rate_ = 0;
     int input_channels_ = 1;
+    // 为空时按 input_channels_ 和 input_reference_ 生成，即麦克风在前、回采在后
+    std::string input_format_;
     int output_channels_ = 1;
     int output_volume_ = 70;
 
+    AudioEqProfile eq_profile_ = kAudioEqFlat;
+    bool limiter_enabled_ = false;
+
     virtual int Read(int16_t* dest, int samples) = 0;
     virtual int Write(const int16_t* data, int samples) = 0;
+    // 返回 false 表示硬件未能设置，改用软件处理；输出设备重新打开后子类需要再次调用
+    virtual bool ApplyHardwareEq(AudioEqProfile profile) { return false; }
+    virtual bool ApplyHardwareLimiter(bool enable) { return false; }
+
+private:
+    // Output DMA accounting, only valid if the on_sent callback could be registered
+    bool output_tracking_ = false;
+    std::atomic<uint32_t> output_sent_frames_{0};
+    uint32_t output_written_frames_ = 0;
+    std::atomic<TaskHandle_t> output_waiter_{nullptr};
+    std::mutex output_mutex_;
+
+    // 软件响度处理，只由输出任务使用
+    AudioShaper shaper_;
+    std::atomic<AudioEqProfile> shaper_profile_{kAudioEqFlat};
+    std::atomic<bool> shaper_limiter_{false};
+    std::atomic<bool> shaper_dirty_{false};
+    std::vector<int16_t> shaped_;
+
+    void UpdateShaper();
+
+    esp_timer_handle_t volume_timer_ = nullptr;
+    std::atomic<int> target_volume_{-1};
+    int64_t volume_written_us_ = 0;
+    std::mutex volume_mutex_;
+    void ApplyTargetVolume();
+
+    void RegisterOutputCallbacks();
+    static bool OnOutputSent(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx);
 };
 
 #endif // _AUDIO_CODEC_H
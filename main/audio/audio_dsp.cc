@@ -0,0 +1,126 @@
+#include "audio_dsp.h"
+
+#include <dsps_add.h>
+#include <dsps_mulc.h>
+#include <algorithm>
+#include <cstring>
+
+void AudioDsp::DownmixStereo(const int16_t* stereo, int16_t* mono, size_t frames) {
+    // 输出位置不超过输入位置，原地计算也安全
+    dsps_add_s16(stereo, stereo + 1, mono, frames, 2, 2, 1, 1);
+}
+
+void AudioDsp::ExtractChannel(const int16_t* input, int channels, int channel, int16_t* output, size_t frames) {
+    const int16_t* src = input + channel;
+    for (size_t i = 0; i < frames; i++, src += channels) {
+        output[i] = *src;
+    }
+}
+
+void AudioDsp::InsertChannel(const int16_t* input, int16_t* output, int channels, int channel, size_t frames) {
+    int16_t* dst = output + channel;
+    for (size_t i = 0; i < frames; i++, dst += channels) {
+        *dst = input[i];
+    }
+}
+
+void AudioDsp::Deinterleave(const int16_t* stereo, int16_t* left, int16_t* right, size_t frames) {
+    for (size_t i = 0; i < frames; i++) {
+        left[i] = stereo[i * 2];
+        right[i] = stereo[i * 2 + 1];
+    }
+}
+
+void AudioDsp::Interleave(const int16_t* left, const int16_t* right, int16_t* stereo, size_t frames) {
+    for (size_t i = 0; i < frames; i++) {
+        stereo[i * 2] = left[i];
+        stereo[i * 2 + 1] = right[i];
+    }
+}
+
+// 读取一个样本，按左对齐的 32 位返回
+static inline int32_t ReadSample32(const uint8_t* p, int bytes, bool is_float) {
+    switch (bytes) {
+    case 1:
+        return (int32_t)(p[0] - 128) << 24;
+    case 2:
+        return (int32_t)((uint32_t)p[0] << 16 | (uint32_t)p[1] << 24);
+    case 3:
+        return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24);
+    default:
+        if (is_float) {
+            float value;
+            memcpy(&value, p, sizeof(value));
+            return (int32_t)(std::clamp(value, -1.0f, 1.0f) * 2147483520.0f);
+        }
+        return (int32_t)((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+    }
+}
+
+void AudioDsp::PcmToMono(const uint8_t* input, int bits_per_sample, bool is_float, int channels, int16_t* mono, size_t frames) {
+    int bytes = bits_per_sample / 8;
+    if (bytes == 2 && !is_float && ((uintptr_t)input & 1) == 0 && channels <= 2) {
+        if (channels == 2) {
+            DownmixStereo((const int16_t*)input, mono, frames);
+        } else if ((const void*)mono != (const void*)input) {
+            memcpy(mono, input, frames * sizeof(int16_t));
+        }
+        return;
+    }
+    // 每个样本先截到 16 位再累加，声道数不超过 2 时用移位代替除法
+    size_t frame_bytes = bytes * channels;
+    for (size_t i = 0; i < frames; i++, input += frame_bytes) {
+        int32_t sum = 0;
+        for (int ch = 0; ch < channels; ch++) {
+            sum += ReadSample32(input + ch * bytes, bytes, is_float) >> 16;
+        }
+        if (channels == 2) {
+            sum >>= 1;
+        } else if (channels > 2) {
+            sum /= channels;
+        }
+        mono[i] = (int16_t)sum;
+    }
+}
+
+void AudioDsp::ApplyGain(int16_t* pcm, size_t samples, int32_t gain_q15) {
+    if (gain_q15 == (1 << 15)) {
+        return;
+    }
+    size_t i = 0;
+    if (gain_q15 >= 0 && gain_q15 < (1 << 15)) {
+        // 不超过1倍时不会溢出，交给esp-dsp，汇编版本每次处理两个样本
+        i = samples & ~(size_t)1;
+        dsps_mulc_s16(pcm, pcm, i, (int16_t)gain_q15, 1, 1);
+    }
+    for (; i < samples; i++) {
+        pcm[i] = std::clamp<int32_t>((pcm[i] * gain_q15) >> 15, INT16_MIN, INT16_MAX);
+    }
+}
+
+void AudioDsp::ApplyGainRamp(int16_t* pcm, size_t samples, int32_t start_q15, int32_t end_q15) {
+    if (samples == 0) {
+        return;
+    }
+    if (start_q15 == end_q15) {
+        ApplyGain(pcm, samples, start_q15);
+        return;
+    }
+    int64_t gain = (int64_t)start_q15 << 16;
+    int64_t step = ((int64_t)(end_q15 - start_q15) << 16) / (int64_t)samples;
+    for (size_t i = 0; i < samples; i++, gain += step) {
+        pcm[i] = std::clamp<int32_t>((pcm[i] * (int32_t)(gain >> 16)) >> 15, INT16_MIN, INT16_MAX);
+    }
+}
+
+void AudioDsp::MixRamp(int16_t* dst, const int16_t* src, size_t samples, int32_t start_q15, int32_t end_q15) {
+    if (samples == 0) {
+        return;
+    }
+    int64_t gain = (int64_t)start_q15 << 16;
+    int64_t step = ((int64_t)(end_q15 - start_q15) << 16) / (int64_t)samples;
+    for (size_t i = 0; i < samples; i++, gain += step) {
+        int32_t mixed = dst[i] + ((src[i] * (int32_t)(gain >> 16)) >> 15);
+        dst[i] = std::clamp<int32_t>(mixed, INT16_MIN, INT16_MAX);
+    }
+}
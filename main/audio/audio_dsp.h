@@ -0,0 +1,36 @@
+#ifndef AUDIO_DSP_H
+#define AUDIO_DSP_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Shared int16 PCM kernels for the capture, stream and mixer paths.
+ *
+ * The plain strided and constant gain loops go through esp-dsp, which picks the ae32 / S3 (aes3)
+ * assembly when CONFIG_DSP_OPTIMIZED is set and its ANSI C version on other targets. Per-sample
+ * ramps step a Q16 gain instead of dividing for every sample. Gains are Q15, 1 << 15 is unity,
+ * results saturate to int16. In-place calls are allowed where noted.
+ */
+class AudioDsp {
+public:
+    // (left + right) / 2，mono 可以与 stereo 相同
+    static void DownmixStereo(const int16_t* stereo, int16_t* mono, size_t frames);
+    // 取出交织数据中的一个声道，按顺序写入，output 可以与 input 相同
+    static void ExtractChannel(const int16_t* input, int channels, int channel, int16_t* output, size_t frames);
+    // 把单声道数据写入交织数据的一个声道
+    static void InsertChannel(const int16_t* input, int16_t* output, int channels, int channel, size_t frames);
+    static void Deinterleave(const int16_t* stereo, int16_t* left, int16_t* right, size_t frames);
+    static void Interleave(const int16_t* left, const int16_t* right, int16_t* stereo, size_t frames);
+    // 交织的 8 位无符号 / 16、24、32 位有符号小端 PCM 或 32 位浮点，一遍转换成单声道 int16，input 不要求对齐
+    static void PcmToMono(const uint8_t* input, int bits_per_sample, bool is_float, int channels, int16_t* mono, size_t frames);
+
+    // 原地乘以增益
+    static void ApplyGain(int16_t* pcm, size_t samples, int32_t gain_q15);
+    // 增益从 start 线性变化到 end（不含）
+    static void ApplyGainRamp(int16_t* pcm, size_t samples, int32_t start_q15, int32_t end_q15);
+    // dst += src * gain，增益同样线性变化
+    static void MixRamp(int16_t* dst, const int16_t* src, size_t samples, int32_t start_q15, int32_t end_q15);
+};
+
+#endif // AUDIO_DSP_H
@@ -0,0 +1,151 @@
+#include "audio_memory.h"
+
+#include <esp_log.h>
+#include <esp_memory_utils.h>
+#include <atomic>
+#include <mutex>
+
+#define TAG "AudioMemory"
+
+namespace {
+
+constexpr int kSlabClasses = 7;     // 256 ... 16384 bytes, including the header
+constexpr uint8_t kDirectClass = 0xff;
+constexpr size_t kHeaderBytes = 16;
+// Free blocks kept for reuse, internal RAM is scarce so it keeps only a few small blocks
+constexpr size_t kCachedBytesLimit[2] = { 128 * 1024, 8 * 1024 };   // PSRAM, internal
+
+struct BlockHeader {
+    BlockHeader* next;      // Free list link
+    uint32_t size;          // Requested bytes
+    uint8_t owner;
+    uint8_t size_class;
+    uint8_t internal;
+};
+static_assert(sizeof(BlockHeader) <= kHeaderBytes, "Block header too large");
+
+struct OwnerStats {
+    std::atomic<size_t> used[2];    // PSRAM, internal
+    std::atomic<size_t> peak[2];
+};
+
+std::mutex slab_mutex;
+BlockHeader* free_lists[2][kSlabClasses] = {};
+size_t cached_bytes[2] = {};
+OwnerStats owner_stats[kAudioMemoryOwnerCount];
+
+int SizeClass(size_t total) {
+    size_t class_size = AudioMemory::kMinSlabBytes;
+    for (int i = 0; i < kSlabClasses; i++, class_size <<= 1) {
+        if (total <= class_size) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void Account(const BlockHeader* header, bool allocated) {
+    auto& stats = owner_stats[header->owner];
+    int heap = header->internal;
+    if (allocated) {
+        size_t used = stats.used[heap].fetch_add(header->size, std::memory_order_relaxed) + header->size;
+        size_t peak = stats.peak[heap].load(std::memory_order_relaxed);
+        while (used > peak && !stats.peak[heap].compare_exchange_weak(peak, used, std::memory_order_relaxed)) {
+        }
+    } else {
+        stats.used[heap].fetch_sub(header->size, std::memory_order_relaxed);
+    }
+}
+
+// Take a cached block from the heap the capabilities ask for, plain 8 bit memory may come from either
+BlockHeader* TakeCached(int size_class, uint32_t caps) {
+    std::lock_guard<std::mutex> lock(slab_mutex);
+    for (int heap = 0; heap < 2; heap++) {
+        if ((heap == 0 && (caps & MALLOC_CAP_INTERNAL)) || (heap == 1 && (caps & MALLOC_CAP_SPIRAM))) {
+            continue;
+        }
+        BlockHeader* header = free_lists[heap][size_class];
+        if (header != nullptr) {
+            free_lists[heap][size_class] = header->next;
+            cached_bytes[heap] -= AudioMemory::kMinSlabBytes << size_class;
+            return header;
+        }
+    }
+    return nullptr;
+}
+
+} // namespace
+
+void* AudioMemory::Allocate(AudioMemoryOwner owner, size_t size, uint32_t caps) {
+    if (size == 0) {
+        return nullptr;
+    }
+    size_t total = size + kHeaderBytes;
+    bool slab_caps = (caps & ~(MALLOC_CAP_SPIRAM | MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT)) == 0;
+    int size_class = slab_caps ? SizeClass(total) : -1;
+
+    BlockHeader* header = size_class >= 0 ? TakeCached(size_class, caps) : nullptr;
+    if (header == nullptr) {
+        size_t alloc_size = size_class >= 0 ? (kMinSlabBytes << size_class) : total;
+        header = (BlockHeader*)heap_caps_malloc(alloc_size, caps);
+        if (header == nullptr) {
+            ESP_LOGW(TAG, "%s: failed to allocate %u bytes, caps 0x%lx", OwnerName(owner), (unsigned)size, (unsigned long)caps);
+            return nullptr;
+        }
+        header->internal = esp_ptr_external_ram(header) ? 0 : 1;
+    }
+    header->next = nullptr;
+    header->size = size;
+    header->owner = owner;
+    header->size_class = size_class >= 0 ? size_class : kDirectClass;
+    Account(header, true);
+    return (uint8_t*)header + kHeaderBytes;
+}
+
+void AudioMemory::Free(void* ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+    BlockHeader* header = (BlockHeader*)((uint8_t*)ptr - kHeaderBytes);
+    Account(header, false);
+    if (header->size_class != kDirectClass) {
+        std::lock_guard<std::mutex> lock(slab_mutex);
+        size_t class_size = kMinSlabBytes << header->size_class;
+        int heap = header->internal;
+        if (cached_bytes[heap] + class_size <= kCachedBytesLimit[heap]) {
+            header->next = free_lists[heap][header->size_class];
+            free_lists[heap][header->size_class] = header;
+            cached_bytes[heap] += class_size;
+            return;
+        }
+    }
+    heap_caps_free(header);
+}
+
+size_t AudioMemory::used_bytes(AudioMemoryOwner owner, bool internal) {
+    return owner_stats[owner].used[internal ? 1 : 0].load(std::memory_order_relaxed);
+}
+
+const char* AudioMemory::OwnerName(AudioMemoryOwner owner) {
+    switch (owner) {
+        case kAudioMemoryMixer: return "mixer";
+        case kAudioMemorySoundCache: return "sound_cache";
+        case kAudioMemoryWakeWord: return "wake_word";
+        case kAudioMemoryMusic: return "music";
+        case kAudioMemoryStream: return "stream";
+        default: return "unknown";
+    }
+}
+
+void AudioMemory::PrintStats() {
+    for (int i = 0; i < kAudioMemoryOwnerCount; i++) {
+        auto& stats = owner_stats[i];
+        if (stats.peak[0] == 0 && stats.peak[1] == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "%-11s sram: %u (peak %u) psram: %u (peak %u)", OwnerName((AudioMemoryOwner)i),
+            (unsigned)stats.used[1].load(), (unsigned)stats.peak[1].load(), (unsigned)stats.used[0].load(), (unsigned)stats.peak[0].load());
+    }
+    std::lock_guard<std::mutex> lock(slab_mutex);
+    ESP_LOGI(TAG, "cached free sram: %u psram: %u", (unsigned)cached_bytes[1], (unsigned)cached_bytes[0]);
+}
@@ -0,0 +1,74 @@
+#ifndef AUDIO_MEMORY_H
+#define AUDIO_MEMORY_H
+
+#include <esp_heap_caps.h>
+#include <cstddef>
+#include <cstdint>
+
+enum AudioMemoryOwner {
+    kAudioMemoryMixer,
+    kAudioMemorySoundCache,
+    kAudioMemoryWakeWord,
+    kAudioMemoryMusic,
+    kAudioMemoryStream,
+    kAudioMemoryOwnerCount,
+};
+
+/*
+ * Central allocator for audio buffers with per owner accounting.
+ *
+ * Blocks up to kMaxSlabBytes are rounded up to a power of two size class and recycled through free lists,
+ * one set per heap (PSRAM / internal), so streaming chunks of varying sizes do not fragment the heap.
+ * Bigger blocks and other capabilities (e.g. DMA) go to heap_caps_malloc directly.
+ * Every live block is counted for its owner, see PrintStats().
+ */
+class AudioMemory {
+public:
+    static constexpr size_t kMinSlabBytes = 256;
+    static constexpr size_t kMaxSlabBytes = 16384;
+
+    static void* Allocate(AudioMemoryOwner owner, size_t size, uint32_t caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    static void Free(void* ptr);
+
+    static size_t used_bytes(AudioMemoryOwner owner, bool internal);
+    static void PrintStats();
+
+    static const char* OwnerName(AudioMemoryOwner owner);
+};
+
+/* Owning, move-only buffer from AudioMemory */
+class AudioBuffer {
+public:
+    AudioBuffer() = default;
+    AudioBuffer(AudioMemoryOwner owner, size_t size, uint32_t caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+        : data_(AudioMemory::Allocate(owner, size, caps)), size_(data_ ? size : 0) {}
+    ~AudioBuffer() { AudioMemory::Free(data_); }
+
+    AudioBuffer(AudioBuffer&& other) : data_(other.data_), size_(other.size_) {
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+    AudioBuffer& operator=(AudioBuffer&& other) {
+        if (this != &other) {
+            AudioMemory::Free(data_);
+            data_ = other.data_;
+            size_ = other.size_;
+            other.data_ = nullptr;
+            other.size_ = 0;
+        }
+        return *this;
+    }
+    AudioBuffer(const AudioBuffer&) = delete;
+    AudioBuffer& operator=(const AudioBuffer&) = delete;
+
+    template <typename T = uint8_t>
+    T* data() const { return (T*)data_; }
+    size_t size() const { return size_; }
+    explicit operator bool() const { return data_ != nullptr; }
+
+private:
+    void* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+#endif // AUDIO_MEMORY_H
@@ -0,0 +1,133 @@
+#include "audio_mixer.h"
+#include "audio_memory.h"
+#include "audio_dsp.h"
+
+#include <esp_log.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#define TAG "AudioMixer"
+
+// Music gain while voice is playing, Q15
+#define AUDIO_MIXER_DUCK_GAIN_Q15 (8192)
+// Source gains stay below 2.0, so a gain times a sample still fits in int32
+#define AUDIO_MIXER_MAX_GAIN_Q15 ((2 << 15) - 1)
+
+// Q15 product of two gains, each can reach AUDIO_MIXER_MAX_GAIN_Q15, so the product is formed in int64
+static inline int32_t MulQ15(int32_t a, int32_t b) {
+    return (int32_t)std::min<int64_t>(((int64_t)a * b) >> 15, AUDIO_MIXER_MAX_GAIN_Q15);
+}
+
+AudioMixer::~AudioMixer() {
+    if (music_buffer_ != nullptr) {
+        AudioMemory::Free(music_buffer_);
+    }
+}
+
+void AudioMixer::Initialize(size_t music_buffer_samples) {
+    for (auto& gain : gains_q15_) {
+        gain.store(1 << 15, std::memory_order_relaxed);
+    }
+    music_buffer_ = (int16_t*)AudioMemory::Allocate(kAudioMemoryMixer, music_buffer_samples * sizeof(int16_t));
+    if (music_buffer_ == nullptr) {
+        music_buffer_ = (int16_t*)AudioMemory::Allocate(kAudioMemoryMixer, music_buffer_samples * sizeof(int16_t), MALLOC_CAP_8BIT);
+    }
+    if (music_buffer_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate music buffer");
+        return;
+    }
+    music_capacity_ = music_buffer_samples;
+}
+
+size_t AudioMixer::WriteMusic(const int16_t* pcm, size_t samples, int timeout_ms) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (music_capacity_ == 0) {
+        return 0;
+    }
+    space_cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this]() {
+        return music_size_ < music_capacity_;
+    });
+
+    size_t written = std::min(samples, music_capacity_ - music_size_);
+    size_t write_pos = (music_read_ + music_size_) % music_capacity_;
+    size_t first = std::min(written, music_capacity_ - write_pos);
+    memcpy(music_buffer_ + write_pos, pcm, first * sizeof(int16_t));
+    memcpy(music_buffer_, pcm + first, (written - first) * sizeof(int16_t));
+    music_size_ += written;
+    return written;
+}
+
+void AudioMixer::ClearMusic() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    music_read_ = 0;
+    music_size_ = 0;
+    space_cv_.notify_all();
+}
+
+size_t AudioMixer::music_available() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return music_size_;
+}
+
+size_t AudioMixer::ReadMusicLocked(int16_t* pcm, size_t samples) {
+    size_t count = std::min(samples, music_size_);
+    size_t first = std::min(count, music_capacity_ - music_read_);
+    memcpy(pcm, music_buffer_ + music_read_, first * sizeof(int16_t));
+    memcpy(pcm + first, music_buffer_, (count - first) * sizeof(int16_t));
+    music_read_ = (music_read_ + count) % music_capacity_;
+    music_size_ -= count;
+    if (count > 0) {
+        space_cv_.notify_all();
+    }
+    return count;
+}
+
+void AudioMixer::MixVoice(std::vector<int16_t>& voice) {
+    int32_t voice_gain = gains_q15_[kMixerSourceVoice].load(std::memory_order_relaxed);
+    int32_t music_gain = gains_q15_[kMixerSourceMusic].load(std::memory_order_relaxed);
+    AudioDsp::ApplyGain(voice.data(), voice.size(), voice_gain);
+
+    // Mix the music in chunks, ramping the ducking gain down over this frame
+    int16_t* music = mix_chunk_;
+    size_t n = voice.size();
+    size_t offset = 0;
+    int32_t duck_start = duck_q15_;
+    while (offset < n) {
+        size_t count;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            count = ReadMusicLocked(music, std::min(n - offset, sizeof(mix_chunk_) / sizeof(mix_chunk_[0])));
+        }
+        if (count == 0) {
+            break;
+        }
+        int32_t duck_from = duck_start + (AUDIO_MIXER_DUCK_GAIN_Q15 - duck_start) * (int32_t)offset / (int32_t)n;
+        int32_t duck_to = duck_start + (AUDIO_MIXER_DUCK_GAIN_Q15 - duck_start) * (int32_t)(offset + count) / (int32_t)n;
+        AudioDsp::MixRamp(voice.data() + offset, music, count, MulQ15(music_gain, duck_from), MulQ15(music_gain, duck_to));
+        offset += count;
+    }
+    duck_q15_ = AUDIO_MIXER_DUCK_GAIN_Q15;
+}
+
+bool AudioMixer::ReadMusic(std::vector<int16_t>& pcm, size_t max_samples) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pcm.resize(std::min(max_samples, music_size_));
+        ReadMusicLocked(pcm.data(), pcm.size());
+    }
+    if (pcm.empty()) {
+        return false;
+    }
+
+    // Ramp back to the full music gain after voice
+    int32_t music_gain = gains_q15_[kMixerSourceMusic].load(std::memory_order_relaxed);
+    AudioDsp::ApplyGainRamp(pcm.data(), pcm.size(), MulQ15(music_gain, duck_q15_), music_gain);
+    duck_q15_ = 1 << 15;
+    return true;
+}
+
+void AudioMixer::SetGain(AudioMixerSource source, float gain) {
+    int32_t gain_q15 = (int32_t)(std::clamp(gain, 0.0f, 2.0f) * (1 << 15));
+    gains_q15_[source].store(std::min<int32_t>(gain_q15, AUDIO_MIXER_MAX_GAIN_Q15), std::memory_order_relaxed);
+}
@@ -0,0 +1,59 @@
+#ifndef AUDIO_MIXER_H
+#define AUDIO_MIXER_H
+
+#include <atomic>
+#include <array>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <cstdint>
+
+enum AudioMixerSource {
+    kMixerSourceVoice,      // TTS and notification sounds from the playback queue
+    kMixerSourceMusic,      // Music and sing PCM written by their player threads
+    kMixerSourceCount,
+};
+
+/*
+ * Mixes the music stream into the voice frames before they reach the codec.
+ *
+ * Music is written into a PSRAM ring by its player thread, which blocks while the ring is full,
+ * so it is paced by the output task. While voice is playing the music gain is ramped down (ducking)
+ * and ramped back up afterwards. All sources must already be at the codec output sample rate.
+ */
+class AudioMixer {
+public:
+    ~AudioMixer();
+
+    void Initialize(size_t music_buffer_samples);
+
+    // Music producer, waits at most timeout_ms for free space and returns the samples written
+    size_t WriteMusic(const int16_t* pcm, size_t samples, int timeout_ms);
+    void ClearMusic();
+    size_t music_available();
+    // 0 when the ring could not be allocated
+    size_t music_capacity() const { return music_capacity_; }
+
+    // Output task only
+    void MixVoice(std::vector<int16_t>& voice);
+    bool ReadMusic(std::vector<int16_t>& pcm, size_t max_samples);
+
+    // 0.0 to just under 2.0, the gain times a sample has to fit in int32
+    void SetGain(AudioMixerSource source, float gain);
+
+private:
+    std::mutex mutex_;
+    std::condition_variable space_cv_;
+    int16_t* music_buffer_ = nullptr;
+    size_t music_capacity_ = 0;
+    size_t music_read_ = 0;
+    size_t music_size_ = 0;
+
+    std::array<std::atomic<int32_t>, kMixerSourceCount> gains_q15_{};
+    int32_t duck_q15_ = 1 << 15;    // Current music ducking gain, ramped per frame
+    int16_t mix_chunk_[256];        // Music read for MixVoice(), kept off the output task stack
+
+    size_t ReadMusicLocked(int16_t* pcm, size_t samples);
+};
+
+#endif // AUDIO_MIXER_H
@@ -0,0 +1,20 @@
+#ifndef AUDIO_PLACEMENT_H
+#define AUDIO_PLACEMENT_H
+
+#include <esp_attr.h>
+
+/*
+ * Code and data placement of the audio hot paths, see CONFIG_AUDIO_HOT_PATH_IN_IRAM.
+ * Whole small objects (DSP, resampler, mixer, the MP3 inner loops) are moved by linker.lf, these markers
+ * are for single per frame functions and lookup tables inside bigger files. Code in IRAM and tables in
+ * DRAM never miss in the flash / PSRAM cache, so LVGL rendering into PSRAM cannot stall them.
+ */
+#if CONFIG_AUDIO_HOT_PATH_IN_IRAM
+#define AUDIO_HOT_FUNC IRAM_ATTR
+#define AUDIO_HOT_DATA DRAM_ATTR
+#else
+#define AUDIO_HOT_FUNC
+#define AUDIO_HOT_DATA
+#endif
+
+#endif // AUDIO_PLACEMENT_H
@@ -0,0 +1,104 @@
+#include "audio_power_governor.h"
+#include "tick_service.h"
+
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "AudioPowerGovernor"
+
+#define AUDIO_POWER_REPORT_INTERVAL_MS (60 * 1000)
+
+AudioPowerGovernor::AudioPowerGovernor() {
+}
+
+AudioPowerGovernor::~AudioPowerGovernor() {
+    if (report_tick_id_ != 0) {
+        TickService::GetInstance().Remove(report_tick_id_);
+    }
+    if (pm_lock_ != nullptr) {
+        esp_pm_lock_delete(pm_lock_);
+    }
+}
+
+void AudioPowerGovernor::Initialize() {
+#if CONFIG_AUDIO_POWER_GOVERNOR && CONFIG_PM_ENABLE
+    esp_pm_config_t pm_config = {};
+    if (esp_pm_get_configuration(&pm_config) != ESP_OK) {
+        return;
+    }
+    pm_config.min_freq_mhz = CONFIG_AUDIO_POWER_GOVERNOR_MIN_FREQ_MHZ;
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+    // I2S 打开期间驱动自己持有锁，只有输入输出都关闭后才会真正进入 light sleep
+    pm_config.light_sleep_enable = true;
+#endif
+    auto ret = esp_pm_configure(&pm_config);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to configure DFS: %s", esp_err_to_name(ret));
+        return;
+    }
+    ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "audio", &pm_lock_));
+    ESP_LOGI(TAG, "CPU %d - %d MHz, light sleep: %d", pm_config.min_freq_mhz, pm_config.max_freq_mhz,
+        pm_config.light_sleep_enable);
+
+    window_start_us_ = esp_timer_get_time();
+    // 统计报告不要求准时，和其他整秒任务一起唤醒
+    report_tick_id_ = TickService::GetInstance().Add("audio_power_report", AUDIO_POWER_REPORT_INTERVAL_MS, 5000, [this]() {
+        ESP_LOGI(TAG, "CPU max frequency held %d%% of the time", TakeDutyCycle());
+    });
+#endif
+}
+
+void AudioPowerGovernor::SetActive(uint32_t activities, bool active) {
+    if (pm_lock_ == nullptr) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint32_t last = activities_;
+    activities_ = active ? (activities_ | activities) : (activities_ & ~activities);
+    if (last == 0 && activities_ != 0) {
+        esp_pm_lock_acquire(pm_lock_);
+        held_since_us_ = esp_timer_get_time();
+    } else if (last != 0 && activities_ == 0) {
+        esp_pm_lock_release(pm_lock_);
+        held_time_us_ += esp_timer_get_time() - held_since_us_;
+    }
+}
+
+void AudioPowerGovernor::SetMaxFrequency(int mhz) {
+#if CONFIG_PM_ENABLE
+    std::lock_guard<std::mutex> lock(mutex_);
+    esp_pm_config_t pm_config = {};
+    if (esp_pm_get_configuration(&pm_config) != ESP_OK) {
+        return;
+    }
+    if (default_max_freq_mhz_ == 0) {
+        default_max_freq_mhz_ = pm_config.max_freq_mhz;
+    }
+    int target = mhz > 0 ? std::min(mhz, default_max_freq_mhz_) : default_max_freq_mhz_;
+    target = std::max(target, pm_config.min_freq_mhz);
+    if (target == pm_config.max_freq_mhz) {
+        return;
+    }
+    pm_config.max_freq_mhz = target;
+    auto ret = esp_pm_configure(&pm_config);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to set CPU max frequency %d MHz: %s", target, esp_err_to_name(ret));
+        return;
+    }
+    ESP_LOGI(TAG, "CPU max frequency %d MHz", target);
+#endif
+}
+
+int AudioPowerGovernor::TakeDutyCycle() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t now = esp_timer_get_time();
+    int64_t held = held_time_us_;
+    if (activities_ != 0) {
+        held += now - held_since_us_;
+        held_since_us_ = now;
+    }
+    int64_t elapsed = now - window_start_us_;
+    window_start_us_ = now;
+    held_time_us_ = 0;
+    return elapsed > 0 ? held * 100 / elapsed : 0;
+}
@@ -0,0 +1,48 @@
+#ifndef AUDIO_POWER_GOVERNOR_H
+#define AUDIO_POWER_GOVERNOR_H
+
+#include <esp_pm.h>
+#include <esp_timer.h>
+
+#include <cstdint>
+#include <mutex>
+
+enum AudioPowerActivity {
+    kAudioPowerVoice = 0x01,        // AFE 语音处理
+    kAudioPowerEncode = 0x02,
+    kAudioPowerDecode = 0x04,
+    kAudioPowerPlayback = 0x08,     // 输出已打开，包括音乐的 MP3 解码
+};
+
+/*
+ * Holds the CPU at its maximum frequency only while an audio workload is active.
+ *
+ * With CONFIG_AUDIO_POWER_GOVERNOR, DFS is configured to drop to CONFIG_AUDIO_POWER_GOVERNOR_MIN_FREQ_MHZ
+ * (with automatic light sleep if tickless idle is enabled) and an ESP_PM_CPU_FREQ_MAX lock is taken
+ * while any activity is set, so wake word only standby runs at the low clock. The share of time the
+ * lock was held is logged every minute. Without the option, or without CONFIG_PM_ENABLE, this is a no-op.
+ */
+class AudioPowerGovernor {
+public:
+    AudioPowerGovernor();
+    ~AudioPowerGovernor();
+
+    void Initialize();
+    void SetActive(uint32_t activities, bool active);
+    // Caps the DFS maximum frequency e.g. on low battery, 0 restores the configured maximum
+    void SetMaxFrequency(int mhz);
+    // CPU 最高频率锁定的时间占比，自上次调用起
+    int TakeDutyCycle();
+
+private:
+    std::mutex mutex_;
+    esp_pm_lock_handle_t pm_lock_ = nullptr;
+    int report_tick_id_ = 0;
+    uint32_t activities_ = 0;
+    int64_t held_since_us_ = 0;
+    int64_t held_time_us_ = 0;
+    int64_t window_start_us_ = 0;
+    int default_max_freq_mhz_ = 0;
+};
+
+#endif // AUDIO_POWER_GOVERNOR_H
@@ -1,5 +1,23 @@
 #include "audio_service.h"
+#include "audio_dsp.h"
+#include "sound_asset.h"
+#include "network_monitor.h"
+#include "board_traits.h"
+#include "audio_placement.h"
+#include "cache_profiler.h"
+#include "black_box.h"
+#include "system_metrics.h"
+#include "tick_service.h"
+#include "task_stack.h"
+#include "hot_log.h"
+#include "benchmark.h"
+#include "model_manager.h"
+#if CONFIG_SESSION_RECORDER
+#include "session_recorder.h"
+#endif
 #include <esp_log.h>
+#include <esp_app_desc.h>
+#include <algorithm>
 
 #if CONFIG_USE_AUDIO_PROCESSOR
 #include "processors/afe_audio_processor.h"
@@ -23,6 +41,9 @@ AudioService::AudioService() {
 }
 
 AudioService::~AudioService() {
+    if (audio_power_tick_id_ != 0) {
+        TickService::GetInstance().Remove(audio_power_tick_id_);
+    }
     if (event_group_ != nullptr) {
         vEventGroupDelete(event_group_);
     }
@@ -32,17 +53,55 @@ AudioService::~AudioService() {
 void AudioService::Initialize(AudioCodec* codec) {
     codec_ = codec;
     codec_->Start();
+    power_governor_.Initialize();
 
     /* Setup the audio codec */
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_->SetComplexity(0);
+    SetDecodeSampleRate(codec->output_sample_rate(), OPUS_FRAME_DURATION_MS);
+    opus_encoder_ = std::make_unique<OpusFecEncoder>(16000, 1, OPUS_FRAME_DURATION_MS);
+#if CONFIG_AUDIO_OPUS_ENCODER_AUTO_TUNE
+    encoder_profile_.auto_tune = true;
+    encoder_profile_.max_complexity = CONFIG_AUDIO_OPUS_ENCODER_MAX_COMPLEXITY;
+    {
+        // 本固件测过的实时复杂度上限，换了固件或没测过时沿用配置
+        auto profile = PerformanceProfile::Load();
+        if (profile.opus_max_complexity >= 0 && profile.firmware == esp_app_get_description()->version) {
+            encoder_profile_.max_complexity = std::min(encoder_profile_.max_complexity, profile.opus_max_complexity);
+        }
+    }
+#endif
+    encoder_profile_changed_ = true;
+    ApplyEncoderProfile();
+#if CONFIG_USE_AUDIO_DEBUGGER
+    audio_debugger_ = std::make_unique<AudioDebugger>();
+#endif
 
-    if (codec->input_sample_rate() != 16000) {
+    if (!BoardTraits::kInputNeedsResample && codec->input_sample_rate() != 16000) {
+        // config.h 说不需要输入重采样，codec 却不是 16 kHz：报错并退回运行时重采样，release 版本也不会静默出错
+        ESP_LOGE(TAG, "Codec input is %d Hz but config.h says 16000, falling back to runtime resampling",
+            codec->input_sample_rate());
+        input_resample_fallback_ = true;
+    }
+    if ((BoardTraits::kInputNeedsResample || input_resample_fallback_) && codec->input_sample_rate() != 16000) {
         input_resampler_.Configure(codec->input_sample_rate(), 16000);
         reference_resampler_.Configure(codec->input_sample_rate(), 16000);
+        for (int i = 2; i < codec->input_channels(); i++) {
+            extra_input_resamplers_.push_back(std::make_unique<OpusResampler>());
+            extra_input_resamplers_.back()->Configure(codec->input_sample_rate(), 16000);
+        }
+
+        size_t max_input_samples = codec->input_sample_rate() * OPUS_FRAME_DURATION_MS / 1000 * codec->input_channels();
+        input_raw_buffer_.reserve(max_input_samples);
+        input_split_buffer_.reserve(max_input_samples);
+        input_resampled_buffer_.reserve(16000 * OPUS_FRAME_DURATION_MS / 1000 * codec->input_channels());
     }
 
+#if CONFIG_AUDIO_INPUT_BATCH_MS > 0
+    input_batch_samples_ = codec->input_sample_rate() * CONFIG_AUDIO_INPUT_BATCH_MS / 1000 * codec->input_channels();
+    input_batch_buffer_.reserve(input_batch_samples_ * 2);
+#endif
+    audio_mixer_.Initialize(codec->output_sample_rate() * AUDIO_MIXER_MUSIC_BUFFER_MS / 1000);
+    music_output_buffer_.reserve(codec->output_sample_rate() * AUDIO_MIXER_MUSIC_CHUNK_MS / 1000);
+
 #if CONFIG_USE_AUDIO_PROCESSOR
     audio_processor_ = std::make_unique<AfeAudioProcessor>();
 #else
@@ -59,12 +118,58 @@ void AudioService::Initialize(AudioCodec* codec) {
     wake_word_ = nullptr;
 #endif
 
+#if CONFIG_USE_SPEECH_COMMANDS
+    speech_commands_ = std::make_unique<SpeechCommandRecognizer>();
+    if (speech_commands_->Initialize()) {
+        speech_commands_->OnCommand([this](const SpeechCommand& command) {
+            if (callbacks_.on_speech_command) {
+                callbacks_.on_speech_command(command.tool, command.arguments ? command.arguments() : "{}");
+            }
+        });
+    } else {
+        speech_commands_.reset();
+    }
+#endif
+
     audio_processor_->OnOutput([this](std::vector<int16_t>&& data) {
-        PushTaskToEncodeQueue(kAudioTaskTypeEncodeToSendQueue, std::move(data));
+        processor_output_samples_ += data.size();
+        int32_t buffered_samples = processor_fed_samples_ - processor_output_samples_;
+        if (buffered_samples > 0) {
+            latency_tracer_.Record(kAudioStageProcessor, buffered_samples * 1000 / 16);
+        }
+#if CONFIG_USE_SPEECH_COMMANDS
+        if (speech_commands_ && speech_commands_->IsRunning()) {
+            speech_commands_->Feed(data);
+        }
+#endif
+#if CONFIG_USE_AUDIO_DEBUGGER
+        audio_debugger_->Feed(kAudioDebugProcessorOutput, data, 16000);
+#endif
+        // The frame was captured before the samples still held by the processor, stamp it with what was playing then
+        int64_t captured_us = esp_timer_get_time() - (int64_t)(std::max<int32_t>(buffered_samples, 0) + data.size()) * 1000 / 16;
+        uint32_t timestamp = playout_clock_.Lookup(captured_us);
+        if (capture_backfill_pending_.exchange(false, std::memory_order_acquire)) {
+            const size_t frame_samples = 16000 / 1000 * frame_duration_ms_;
+            for (size_t offset = 0; offset + frame_samples <= capture_backfill_.size(); offset += frame_samples) {
+                PushTaskToEncodeQueue(kAudioTaskTypeEncodeToSendQueue, std::vector<int16_t>(capture_backfill_.begin() + offset,
+                    capture_backfill_.begin() + offset + frame_samples));
+            }
+            capture_backfill_.clear();
+        }
+        if (uplink_gate_enabled_ && !PassUplinkGate(data, timestamp)) {
+            return;
+        }
+        PushTaskToEncodeQueue(kAudioTaskTypeEncodeToSendQueue, std::move(data), timestamp, false);
     });
 
     audio_processor_->OnVadStateChange([this](bool speaking) {
         voice_detected_ = speaking;
+        {
+            std::lock_guard<std::mutex> lock(encoder_profile_mutex_);
+            if (encoder_profile_.dtx) {
+                opus_encoder_->SetDtx(!speaking);
+            }
+        }
         if (callbacks_.on_vad_change) {
             callbacks_.on_vad_change(speaking);
         }
@@ -76,33 +181,50 @@ void AudioService::Initialize(AudioCodec* codec) {
                 callbacks_.on_wake_word_detected(wake_word);
             }
         });
+#if CONFIG_USE_AFE_WAKE_WORD || CONFIG_USE_ESP_WAKE_WORD || CONFIG_USE_CUSTOM_WAKE_WORD
+        if (auto budget = wake_word_->budget()) {
+            budget->OnLevelChange([this](int level) {
+                wake_word_->SetDegradeLevel(level);
+                if (callbacks_.on_wake_word_degrade) {
+                    callbacks_.on_wake_word_degrade(level);
+                }
+            });
+        }
+#endif
     }
 
-    esp_timer_create_args_t audio_power_timer_args = {
+    audio_power_tick_id_ = TickService::GetInstance().Add("audio_power", AUDIO_POWER_CHECK_INTERVAL_MS, 200, [this]() {
+        CheckAndUpdateAudioPowerState();
+    }, false);
+
+    esp_timer_create_args_t critical_timer_args = {
         .callback = [](void* arg) {
             AudioService* audio_service = (AudioService*)arg;
-            audio_service->CheckAndUpdateAudioPowerState();
+            audio_service->critical_window_ = false;
+            ESP_LOGI(TAG, "Audio critical window closed");
+            if (audio_service->callbacks_.on_critical_window) {
+                audio_service->callbacks_.on_critical_window(false);
+            }
         },
         .arg = this,
         .dispatch_method = ESP_TIMER_TASK,
-        .name = "audio_power_timer",
+        .name = "audio_critical",
         .skip_unhandled_events = true,
     };
-    esp_timer_create(&audio_power_timer_args, &audio_power_timer_);
+    esp_timer_create(&critical_timer_args, &critical_timer_);
 }
 
 void AudioService::Start() {
     service_stopped_ = false;
     xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING | AS_EVENT_WAKE_WORD_RUNNING | AS_EVENT_AUDIO_PROCESSOR_RUNNING);
 
-    esp_timer_start_periodic(audio_power_timer_, 1000000);
+    TickService::GetInstance().SetEnabled(audio_power_tick_id_, true);
 
 #if CONFIG_USE_AUDIO_PROCESSOR
     /* Start the audio input task */
-    xTaskCreatePinnedToCore([](void* arg) {
+    TaskStacks::GetInstance().Create([](void* arg) {
         AudioService* audio_service = (AudioService*)arg;
         audio_service->AudioInputTask();
-        vTaskDelete(NULL);
     }, "audio_input", 2048 * 3, this, 8, &audio_input_task_handle_, 1);
 
     /* Start the audio output task */
@@ -113,10 +235,9 @@ void AudioService::Start() {
     }, "audio_output", 2048 * 2, this, 3, &audio_output_task_handle_);
 #else
     /* Start the audio input task */
-    xTaskCreate([](void* arg) {
+    TaskStacks::GetInstance().Create([](void* arg) {
         AudioService* audio_service = (AudioService*)arg;
         audio_service->AudioInputTask();
-        vTaskDelete(NULL);
     }, "audio_input", 2048 * 2, this, 8, &audio_input_task_handle_);
 
     /* Start the audio output task */
@@ -127,64 +248,141 @@ void AudioService::Start() {
     }, "audio_output", 2048, this, 3, &audio_output_task_handle_);
 #endif
 
+#if CONFIG_AUDIO_SPLIT_OPUS_CODEC_TASK
+    /* Start the opus encoder and decoder tasks, so a slow decode never delays the uplink */
+    TaskStacks::GetInstance().Create([](void* arg) {
+        AudioService* audio_service = (AudioService*)arg;
+        audio_service->OpusEncoderTask();
+    }, "opus_encoder", OPUS_ENCODER_TASK_STACK_SIZE, this, CONFIG_AUDIO_OPUS_ENCODER_TASK_PRIORITY, &opus_encoder_task_handle_,
+        CONFIG_AUDIO_OPUS_ENCODER_TASK_CORE < 0 ? tskNO_AFFINITY : CONFIG_AUDIO_OPUS_ENCODER_TASK_CORE);
+
+    TaskStacks::GetInstance().Create([](void* arg) {
+        AudioService* audio_service = (AudioService*)arg;
+        audio_service->OpusDecoderTask();
+    }, "opus_decoder", OPUS_DECODER_TASK_STACK_SIZE, this, CONFIG_AUDIO_OPUS_DECODER_TASK_PRIORITY, &opus_decoder_task_handle_,
+        CONFIG_AUDIO_OPUS_DECODER_TASK_CORE < 0 ? tskNO_AFFINITY : CONFIG_AUDIO_OPUS_DECODER_TASK_CORE);
+#else
     /* Start the opus codec task */
-    xTaskCreate([](void* arg) {
+    TaskStacks::GetInstance().Create([](void* arg) {
         AudioService* audio_service = (AudioService*)arg;
         audio_service->OpusCodecTask();
-        vTaskDelete(NULL);
-    }, "opus_codec", 2048 * 13, this, 2, &opus_codec_task_handle_);
+    }, "opus_codec", OPUS_CODEC_TASK_STACK_SIZE, this, 2, &opus_encoder_task_handle_);
+    opus_decoder_task_handle_ = opus_encoder_task_handle_;
+#endif
 }
 
 void AudioService::Stop() {
-    esp_timer_stop(audio_power_timer_);
+    TickService::GetInstance().SetEnabled(audio_power_tick_id_, false);
     service_stopped_ = true;
     xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING |
         AS_EVENT_WAKE_WORD_RUNNING |
         AS_EVENT_AUDIO_PROCESSOR_RUNNING);
 
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    audio_encode_queue_.clear();
-    audio_decode_queue_.clear();
-    audio_playback_queue_.clear();
-    audio_testing_queue_.clear();
-    audio_queue_cv_.notify_all();
+    audio_encode_queue_.Clear();
+    audio_decode_queue_.Clear();
+    audio_playback_queue_.Clear();
+    audio_testing_queue_.Clear();
+
+    /* Wake up the workers and the producers waiting for free space, so they can see the service stopped */
+    xEventGroupSetBits(event_group_, AS_EVENT_ENCODE_QUEUE_AVAILABLE | AS_EVENT_DECODE_QUEUE_AVAILABLE);
+    NotifyTask(audio_output_task_handle_);
+    NotifyTask(opus_encoder_task_handle_);
+    NotifyTask(opus_decoder_task_handle_);
 }
 
-bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples) {
+/* Feed shared capture data to the wake word, which may use a different chunk size than the audio processor */
+void AudioService::FeedWakeWord(const std::vector<int16_t>& data, size_t feed_size) {
+    if (wake_word_feed_buffer_.empty() && data.size() == feed_size) {
+        wake_word_->Feed(data);
+        return;
+    }
+    wake_word_feed_buffer_.insert(wake_word_feed_buffer_.end(), data.begin(), data.end());
+    size_t offset = 0;
+    while (wake_word_feed_buffer_.size() - offset >= feed_size) {
+        wake_word_feed_chunk_.assign(wake_word_feed_buffer_.begin() + offset, wake_word_feed_buffer_.begin() + offset + feed_size);
+        wake_word_->Feed(wake_word_feed_chunk_);
+        offset += feed_size;
+    }
+    wake_word_feed_buffer_.erase(wake_word_feed_buffer_.begin(), wake_word_feed_buffer_.begin() + offset);
+}
+
+/* Serve reads from larger codec transfers, so the input task only waits on the I2S driver once per batch */
+bool AUDIO_HOT_FUNC AudioService::ReadCodecInput(std::vector<int16_t>& data, size_t samples) {
+    if (input_batch_samples_ == 0) {
+        data.resize(samples);
+        return codec_->InputData(data);
+    }
+
+    size_t available = input_batch_buffer_.size() - input_batch_offset_;
+    if (available < samples) {
+        std::copy(input_batch_buffer_.begin() + input_batch_offset_, input_batch_buffer_.end(), input_batch_buffer_.begin());
+        input_batch_offset_ = 0;
+        size_t read_samples = std::max(samples - available, input_batch_samples_);
+        input_batch_buffer_.resize(available + read_samples);
+        if (!codec_->InputData(input_batch_buffer_.data() + available, read_samples)) {
+            input_batch_buffer_.resize(available);
+            return false;
+        }
+    }
+
+    auto begin = input_batch_buffer_.begin() + input_batch_offset_;
+    data.assign(begin, begin + samples);
+    input_batch_offset_ += samples;
+    return true;
+}
+
+bool AUDIO_HOT_FUNC AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples) {
+    AUDIO_CACHE_PROFILE_SCOPE(kCacheRegionAudioInput);
     if (!codec_->input_enabled()) {
         codec_->EnableInput(true);
-        esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
+        input_enabled_time_us_ = esp_timer_get_time();
+        TickService::GetInstance().SetEnabled(audio_power_tick_id_, true);
     }
 
-    if (codec_->input_sample_rate() != sample_rate) {
-        data.resize(samples * codec_->input_sample_rate() / sample_rate);
-        if (!codec_->InputData(data)) {
+    if ((BoardTraits::kInputNeedsResample || input_resample_fallback_) && codec_->input_sample_rate() != sample_rate) {
+        /* Read at the codec sample rate into the scratch buffer, the result is written straight into data */
+        if (!ReadCodecInput(input_raw_buffer_, samples * codec_->input_sample_rate() / sample_rate)) {
             return false;
         }
-        if (codec_->input_channels() == 2) {
-            auto mic_channel = std::vector<int16_t>(data.size() / 2);
-            auto reference_channel = std::vector<int16_t>(data.size() / 2);
-            for (size_t i = 0, j = 0; i < mic_channel.size(); ++i, j += 2) {
-                mic_channel[i] = data[j];
-                reference_channel[i] = data[j + 1];
-            }
-            auto resampled_mic = std::vector<int16_t>(input_resampler_.GetOutputSamples(mic_channel.size()));
-            auto resampled_reference = std::vector<int16_t>(reference_resampler_.GetOutputSamples(reference_channel.size()));
-            input_resampler_.Process(mic_channel.data(), mic_channel.size(), resampled_mic.data());
-            reference_resampler_.Process(reference_channel.data(), reference_channel.size(), resampled_reference.data());
-            data.resize(resampled_mic.size() + resampled_reference.size());
-            for (size_t i = 0, j = 0; i < resampled_mic.size(); ++i, j += 2) {
-                data[j] = resampled_mic[i];
-                data[j + 1] = resampled_reference[i];
+        const int16_t* raw = input_raw_buffer_.data();
+        int channels = codec_->input_channels();
+        if (channels > 2) {
+            /* Multi-mic capture: resample every channel separately, each with its own state */
+            int frames = input_raw_buffer_.size() / channels;
+            int resampled_frames = input_resampler_.GetOutputSamples(frames);
+            input_split_buffer_.resize(frames);
+            input_resampled_buffer_.resize(resampled_frames);
+            data.resize(resampled_frames * channels);
+            for (int channel = 0; channel < channels; channel++) {
+                OpusResampler* resampler = channel == 0 ? &input_resampler_ :
+                    channel == 1 ? &reference_resampler_ : extra_input_resamplers_[channel - 2].get();
+                AudioDsp::ExtractChannel(raw, channels, channel, input_split_buffer_.data(), frames);
+                resampler->Process(input_split_buffer_.data(), frames, input_resampled_buffer_.data());
+                AudioDsp::InsertChannel(input_resampled_buffer_.data(), data.data(), channels, channel, resampled_frames);
             }
+        } else if (channels == 2) {
+            /* Deinterleave into [mic | reference], resample both halves, then interleave into data */
+            int frames = input_raw_buffer_.size() / 2;
+            input_split_buffer_.resize(frames * 2);
+            int16_t* mic_channel = input_split_buffer_.data();
+            int16_t* reference_channel = mic_channel + frames;
+            AudioDsp::Deinterleave(raw, mic_channel, reference_channel, frames);
+
+            int resampled_frames = input_resampler_.GetOutputSamples(frames);
+            input_resampled_buffer_.resize(resampled_frames * 2);
+            int16_t* resampled_mic = input_resampled_buffer_.data();
+            int16_t* resampled_reference = resampled_mic + resampled_frames;
+            input_resampler_.Process(mic_channel, frames, resampled_mic);
+            reference_resampler_.Process(reference_channel, frames, resampled_reference);
+
+            data.resize(resampled_frames * 2);
+            AudioDsp::Interleave(resampled_mic, resampled_reference, data.data(), resampled_frames);
         } else {
-            auto resampled = std::vector<int16_t>(input_resampler_.GetOutputSamples(data.size()));
-            input_resampler_.Process(data.data(), data.size(), resampled.data());
-            data = std::move(resampled);
+            data.resize(input_resampler_.GetOutputSamples(input_raw_buffer_.size()));
+            input_resampler_.Process(raw, input_raw_buffer_.size(), data.data());
         }
     } else {
-        data.resize(samples);
-        if (!codec_->InputData(data)) {
+        if (!ReadCodecInput(data, samples)) {
             return false;
         }
     }
@@ -193,21 +391,32 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
     last_input_time_ = std::chrono::steady_clock::now();
     debug_statistics_.input_count++;
 
+#if CONFIG_SESSION_RECORDER
+    // 回放时用录制的 PCM 代替麦克风，仍按真实输入的节奏
+    auto& recorder = SessionRecorder::GetInstance();
+    if (recorder.replaying_mic()) {
+        recorder.PullMic(data);
+    } else if (recorder.recording()) {
+        recorder.RecordMic(data, sample_rate, codec_->input_channels());
+    }
+#endif
+
 #if CONFIG_USE_AUDIO_DEBUGGER
-    // 音频调试：发送原始音频数据
-    if (audio_debugger_ == nullptr) {
-        audio_debugger_ = std::make_unique<AudioDebugger>();
+    audio_debugger_->Feed(kAudioDebugMicInput, data, sample_rate, codec_->input_channels(), codec_->input_mic_channel());
+    if (codec_->input_reference()) {
+        audio_debugger_->Feed(kAudioDebugReference, data, sample_rate, codec_->input_channels(), codec_->input_reference_channel());
     }
-    audio_debugger_->Feed(data);
 #endif
 
     return true;
 }
 
 void AudioService::AudioInputTask() {
+    /* The buffer is reused across reads, consumers that take it by rvalue swap in a recycled one */
+    std::vector<int16_t> data;
     while (true) {
         EventBits_t bits = xEventGroupWaitBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING |
-            AS_EVENT_WAKE_WORD_RUNNING | AS_EVENT_AUDIO_PROCESSOR_RUNNING,
+            AS_EVENT_WAKE_WORD_RUNNING | AS_EVENT_AUDIO_PROCESSOR_RUNNING | AS_EVENT_LOOPBACK_RUNNING,
             pdFALSE, pdFALSE, portMAX_DELAY);
 
         if (service_stopped_) {
@@ -215,39 +424,91 @@ void AudioService::AudioInputTask() {
         }
         if (audio_input_need_warmup_) {
             audio_input_need_warmup_ = false;
-            vTaskDelay(pdMS_TO_TICKS(120));
+            /* Drop the batched samples captured before the consumer changed */
+            input_batch_buffer_.clear();
+            input_batch_offset_ = 0;
+            /* Only a freshly powered input needs to settle, e.g. not when the wake word kept it running */
+            if (!codec_->input_enabled()) {
+                codec_->EnableInput(true);
+                input_enabled_time_us_ = esp_timer_get_time();
+                TickService::GetInstance().SetEnabled(audio_power_tick_id_, true);
+            }
+            int64_t settle_us = AUDIO_INPUT_WARMUP_MS * 1000 - (esp_timer_get_time() - input_enabled_time_us_);
+            if (settle_us > 0) {
+                vTaskDelay(pdMS_TO_TICKS(settle_us / 1000) + 1);
+            }
             continue;
         }
 
+        /* Loopback benchmark, takes over the microphone until the capture is complete */
+        if (bits & AS_EVENT_LOOPBACK_RUNNING) {
+            int samples = OPUS_FRAME_DURATION_MS * 16000 / 1000;
+            if (ReadAudioData(data, 16000, samples)) {
+                if (loopback_capture_.empty()) {
+                    loopback_capture_start_us_ = esp_timer_get_time() - OPUS_FRAME_DURATION_MS * 1000;
+                    loopback_probe_requested_ = true;
+                    NotifyTask(audio_output_task_handle_);
+                }
+                auto mic = codec_->InputMic(data);
+                for (size_t i = 0; i < mic.size() && loopback_capture_.size() < loopback_capture_samples_; i++) {
+                    loopback_capture_.push_back(mic[i]);
+                }
+                if (loopback_capture_.size() >= loopback_capture_samples_) {
+                    xEventGroupClearBits(event_group_, AS_EVENT_LOOPBACK_RUNNING);
+                    xEventGroupSetBits(event_group_, AS_EVENT_LOOPBACK_DONE);
+                }
+                continue;
+            }
+        }
+
         /* Used for audio testing in NetworkConfiguring mode by clicking the BOOT button */
         if (bits & AS_EVENT_AUDIO_TESTING_RUNNING) {
-            if (audio_testing_queue_.size() >= AUDIO_TESTING_MAX_DURATION_MS / OPUS_FRAME_DURATION_MS) {
+            if (audio_testing_queue_.size() >= MAX_AUDIO_TESTING_PACKETS) {
                 ESP_LOGW(TAG, "Audio testing queue is full, stopping audio testing");
                 EnableAudioTesting(false);
                 continue;
             }
-            std::vector<int16_t> data;
             int samples = OPUS_FRAME_DURATION_MS * 16000 / 1000;
             if (ReadAudioData(data, 16000, samples)) {
-                // If input channels is 2, we need to fetch the left channel data
-                if (codec_->input_channels() == 2) {
-                    auto mono_data = std::vector<int16_t>(data.size() / 2);
-                    for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
-                        mono_data[i] = data[j];
-                    }
-                    data = std::move(mono_data);
+                // If there are several input channels, we need to fetch the first microphone
+                auto mic = codec_->InputMic(data);
+                if (!mic.contiguous()) {
+                    mic.CopyTo(data.data());
+                    data.resize(mic.size());
                 }
                 PushTaskToEncodeQueue(kAudioTaskTypeEncodeToTestingQueue, std::move(data));
                 continue;
             }
         }
 
+        /* Wake word and voice processing share one capture, e.g. for barge-in while listening */
+        if ((bits & AS_EVENT_WAKE_WORD_RUNNING) && (bits & AS_EVENT_AUDIO_PROCESSOR_RUNNING)) {
+            int samples = audio_processor_->GetFeedSize();
+            int wake_word_samples = wake_word_->GetFeedSize();
+            if (samples > 0 && wake_word_samples > 0) {
+                if (ReadAudioData(data, 16000, samples)) {
+                    FeedWakeWord(data, wake_word_samples);
+                    processor_fed_samples_ += data.size() / codec_->input_channels();
+                    audio_processor_->Feed(std::move(data));
+                    continue;
+                }
+            }
+        }
+
         /* Feed the wake word */
         if (bits & AS_EVENT_WAKE_WORD_RUNNING) {
-            std::vector<int16_t> data;
+            wake_word_feed_buffer_.clear();
             int samples = wake_word_->GetFeedSize();
             if (samples > 0) {
                 if (ReadAudioData(data, 16000, samples)) {
+#if CONFIG_WAKE_WORD_ENERGY_GATE
+                    if (!standby_gate_.Process(data, codec_->InputMic(data), [this](const std::vector<int16_t>& held) {
+                            wake_word_->Feed(held);
+                        })) {
+                        debug_statistics_.standby_gated_count++;
+                        continue;
+                    }
+#endif
                     wake_word_->Feed(data);
                     continue;
                 }
@@ -256,10 +517,10 @@ void AudioService::AudioInputTask() {
 
         /* Feed the audio processor */
         if (bits & AS_EVENT_AUDIO_PROCESSOR_RUNNING) {
-            std::vector<int16_t> data;
             int samples = audio_processor_->GetFeedSize();
             if (samples > 0) {
                 if (ReadAudioData(data, 16000, samples)) {
+                    processor_fed_samples_ += data.size() / codec_->input_channels();
                     audio_processor_->Feed(std::move(data));
                     continue;
                 }
@@ -271,182 +532,756 @@ void AudioService::AudioInputTask() {
     }
 
     ESP_LOGW(TAG, "Audio input task stopped");
+    audio_input_task_handle_ = nullptr;
 }
 
 void AudioService::AudioOutputTask() {
-    while (true) {
-        std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-        audio_queue_cv_.wait(lock, [this]() { return !audio_playback_queue_.empty() || service_stopped_; });
-        if (service_stopped_) {
-            break;
+    PooledPtr<AudioTask> pending_task;
+    int64_t pending_time_us = 0;
+    size_t music_chunk_samples = codec_->output_sample_rate() * AUDIO_MIXER_MUSIC_CHUNK_MS / 1000;
+    while (!service_stopped_) {
+        if (output_warmup_requested_.exchange(false)) {
+            EnableCodecOutput();
+            last_output_time_ = std::chrono::steady_clock::now();
+        }
+        if (loopback_probe_requested_.exchange(false)) {
+            EnableCodecOutput();
+            loopback_output_latency_us_ = codec_->output_latency_us();
+            loopback_probe_time_us_ = esp_timer_get_time();
+            WriteOutput(loopback_probe_pcm_);
+            last_output_time_ = std::chrono::steady_clock::now();
+        }
+        if (playback_reset_.exchange(false)) {
+            // An interrupt that came in between two frames has nothing left to fade
+            playback_interrupted_ = false;
+            pending_task.reset();
+            pending_time_us = 0;
+            playback_primed_ = false;
+            playback_drained_time_us_ = 0;
         }
 
-        auto task = std::move(audio_playback_queue_.front());
-        audio_playback_queue_.pop_front();
-        audio_queue_cv_.notify_all();
-        lock.unlock();
+        PooledPtr<AudioTask> task;
+        if (pending_task) {
+            task = std::move(pending_task);
+        } else {
+            bool popped = audio_playback_queue_.Pop(task);
+            /* Pop() also releases the slots of cleared tasks, so the codec task may continue decoding */
+            NotifyTask(opus_decoder_task_handle_);
+            if (!popped && playback_primed_) {
+                playback_primed_ = false;
+                playback_drained_time_us_ = esp_timer_get_time();
+            }
+        }
 
-        if (!codec_->output_enabled()) {
-            codec_->EnableOutput(true);
-            esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
+        /* Hold the first frame of a stream until enough audio is buffered behind it */
+        if (task && !playback_primed_) {
+            int64_t now_us = esp_timer_get_time();
+            if (pending_time_us == 0) {
+                pending_time_us = now_us;
+                OnPlaybackRestart(now_us);
+            }
+            if (IsPlaybackPrebuffered(*task, now_us - pending_time_us)) {
+                playback_primed_ = true;
+                pending_time_us = 0;
+            } else {
+                pending_task = std::move(task);
+            }
+        }
+
+        /* Music keeps playing on its own while there is no voice frame */
+        bool has_music = !task && audio_mixer_.ReadMusic(music_output_buffer_, music_chunk_samples);
+        if (!task && !has_music) {
+            ulTaskNotifyTake(pdTRUE, pending_task ? pdMS_TO_TICKS(10) : portMAX_DELAY);
+            continue;
         }
-        codec_->OutputData(task->pcm);
 
+        EnableCodecOutput();
         /* Update the last output time */
         last_output_time_ = std::chrono::steady_clock::now();
+
+        if (!task) {
+            WriteOutput(music_output_buffer_);
+            continue;
+        }
+
+        audio_mixer_.MixVoice(task->pcm);
+        WriteOutput(task->pcm, true);
+
+        /* The frame is heard once the DMA buffers queued before it have been played */
+        int64_t played_us = esp_timer_get_time() + codec_->output_latency_us();
+        latency_tracer_.Record(kAudioStagePlayback, played_us - task->time_us);
+        latency_tracer_.Record(kAudioStageDownlink, played_us - task->origin_time_us);
         debug_statistics_.playback_count++;
 
 #if CONFIG_USE_SERVER_AEC
-        /* Record the timestamp for server AEC */
+        /* Record when the frame plays for server AEC, it ends when the DMA buffers written so far have been played */
         if (task->timestamp > 0) {
-            lock.lock();
-            timestamp_queue_.push_back(task->timestamp);
+            int64_t duration_us = (int64_t)(task->pcm.size() / codec_->output_channels()) * 1000000 / codec_->output_sample_rate();
+            playout_clock_.Record(task->timestamp, played_us - duration_us, duration_us);
         }
 #endif
     }
 
     ESP_LOGW(TAG, "Audio output task stopped");
+    audio_output_task_handle_ = nullptr;
 }
 
-void AudioService::OpusCodecTask() {
-    while (true) {
-        std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-        audio_queue_cv_.wait(lock, [this]() {
-            return service_stopped_ ||
-                (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) ||
-                (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE);
-        });
-        if (service_stopped_) {
-            break;
+/* Write in DMA buffer sized chunks, so the task waits on the I2S callback instead of inside the driver for a whole frame */
+void AUDIO_HOT_FUNC AudioService::WriteOutput(const std::vector<int16_t>& pcm, bool interruptible) {
+#if CONFIG_USE_AUDIO_DEBUGGER
+    audio_debugger_->Feed(kAudioDebugOutput, pcm, codec_->output_sample_rate(), codec_->output_channels());
+#endif
+    const size_t chunk = AUDIO_CODEC_DMA_FRAME_NUM * codec_->output_channels();
+    for (size_t offset = 0; offset < pcm.size(); offset += chunk) {
+        int samples = std::min(chunk, pcm.size() - offset);
+        codec_->WaitForOutputSpace(samples, 100);
+        if (interruptible && playback_interrupted_.exchange(false)) {
+            // Ramp the next chunk down to silence and drop the rest of the frame, the DMA clears itself behind it
+            const int channels = codec_->output_channels();
+            const int frames = samples / channels;
+            fade_buffer_.assign(pcm.begin() + offset, pcm.begin() + offset + samples);
+            for (int i = 0; i < frames; i++) {
+                int32_t gain = (frames - i) * 256 / frames;
+                for (int c = 0; c < channels; c++) {
+                    fade_buffer_[i * channels + c] = (int32_t)fade_buffer_[i * channels + c] * gain >> 8;
+                }
+            }
+            codec_->OutputData(fade_buffer_.data(), samples);
+            return;
         }
+        AUDIO_CACHE_PROFILE_SCOPE(kCacheRegionAudioOutput);
+        codec_->OutputData(pcm.data() + offset, samples);
+    }
+}
 
-        /* Decode the audio from decode queue */
-        if (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE) {
-            auto packet = std::move(audio_decode_queue_.front());
-            audio_decode_queue_.pop_front();
-            audio_queue_cv_.notify_all();
-            lock.unlock();
-
-            auto task = std::make_unique<AudioTask>();
-            task->type = kAudioTaskTypeDecodeToPlaybackQueue;
-            task->timestamp = packet->timestamp;
-
-            SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
-            if (opus_decoder_->Decode(std::move(packet->payload), task->pcm)) {
-                // Resample if the sample rate is different
-                if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
-                    int target_size = output_resampler_.GetOutputSamples(task->pcm.size());
-                    std::vector<int16_t> resampled(target_size);
-                    output_resampler_.Process(task->pcm.data(), task->pcm.size(), resampled.data());
-                    task->pcm = std::move(resampled);
-                }
+// Called when the first frame after the playback ran dry shows up
+void AudioService::OnPlaybackRestart(int64_t now_us) {
+    if (playback_drained_time_us_ != 0 && now_us - playback_drained_time_us_ < AUDIO_UNDERRUN_WINDOW_MS * 1000) {
+        debug_statistics_.underrun_count++;
+        BlackBox::GetInstance().Record(kBlackBoxUnderrun, kBlackBoxSourceVoice, prebuffer_ms_);
+        last_underrun_time_us_ = now_us;
+        prebuffer_ms_ = std::min(prebuffer_ms_ + AUDIO_PREBUFFER_STEP_MS, AUDIO_PREBUFFER_MAX_MS);
+        ESP_LOGW(TAG, "Playback underrun %lu, prebuffer raised to %d ms",
+            (unsigned long)debug_statistics_.underrun_count, prebuffer_ms_);
+        EnterCriticalWindow();
+    } else if (prebuffer_ms_ != CONFIG_AUDIO_PLAYBACK_PREBUFFER_MS &&
+        now_us - last_underrun_time_us_ > AUDIO_PREBUFFER_RESTORE_MS * 1000) {
+        prebuffer_ms_ = CONFIG_AUDIO_PLAYBACK_PREBUFFER_MS;
+    }
+    playback_drained_time_us_ = 0;
+}
 
-                lock.lock();
-                audio_playback_queue_.push_back(std::move(task));
-                audio_queue_cv_.notify_all();
-            } else {
-                ESP_LOGE(TAG, "Failed to decode audio");
-                lock.lock();
-            }
-            debug_statistics_.decode_count++;
-        }
-        
-        /* Encode the audio to send queue */
-        if (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) {
-            auto task = std::move(audio_encode_queue_.front());
-            audio_encode_queue_.pop_front();
-            audio_queue_cv_.notify_all();
-            lock.unlock();
-
-            auto packet = std::make_unique<AudioStreamPacket>();
-            packet->frame_duration = OPUS_FRAME_DURATION_MS;
-            packet->sample_rate = 16000;
-            packet->timestamp = task->timestamp;
-            if (!opus_encoder_->Encode(std::move(task->pcm), packet->payload)) {
-                ESP_LOGE(TAG, "Failed to encode audio");
-                continue;
-            }
+/* Other subsystems back off until the audio has kept up for AUDIO_CRITICAL_HOLD_MS, the callback only runs on edges */
+void AudioService::EnterCriticalWindow() {
+    if (critical_timer_ == nullptr) {
+        return;
+    }
+    esp_timer_stop(critical_timer_);
+    esp_timer_start_once(critical_timer_, AUDIO_CRITICAL_HOLD_MS * 1000);
+    if (!critical_window_.exchange(true)) {
+        ESP_LOGI(TAG, "Audio critical window opened");
+        if (callbacks_.on_critical_window) {
+            callbacks_.on_critical_window(true);
+        }
+    }
+}
 
-            if (task->type == kAudioTaskTypeEncodeToSendQueue) {
-                {
-                    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-                    audio_send_queue_.push_back(std::move(packet));
-                }
-                if (callbacks_.on_send_queue_available) {
-                    callbacks_.on_send_queue_available();
-                }
-            } else if (task->type == kAudioTaskTypeEncodeToTestingQueue) {
-                std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-                audio_testing_queue_.push_back(std::move(packet));
-            }
-            debug_statistics_.encode_count++;
-            lock.lock();
+/* Buffered audio counts the decoded frames and the packets still waiting to be decoded */
+bool AudioService::IsPlaybackPrebuffered(const AudioTask& first_task, int64_t waited_us) {
+    // Short sounds and stream tails never reach the watermark, so do not hold them longer than it
+    if (prebuffer_ms_ <= 0 || waited_us >= prebuffer_ms_ * 1000) {
+        return true;
+    }
+    int frame_ms = first_task.pcm.size() * 1000 / codec_->output_sample_rate();
+    int frames = 1 + audio_playback_queue_.size() + audio_decode_queue_.size();
+    return frames * frame_ms >= prebuffer_ms_;
+}
+
+void AUDIO_HOT_FUNC AudioService::OpusCodecTask() {
+    while (!service_stopped_) {
+        bool busy = DecodeNextPacket();
+        busy = EncodeNextTask() || busy;
+        if (!busy) {
+            power_governor_.SetActive(kAudioPowerEncode | kAudioPowerDecode, false);
+            ulTaskNotifyTake(pdTRUE, DecodeWaitTicks());
+            power_governor_.SetActive(kAudioPowerEncode | kAudioPowerDecode, true);
         }
     }
 
     ESP_LOGW(TAG, "Opus codec task stopped");
+    opus_encoder_task_handle_ = nullptr;
+    opus_decoder_task_handle_ = nullptr;
+}
+
+void AudioService::OpusEncoderTask() {
+    while (!service_stopped_) {
+        if (!EncodeNextTask()) {
+            power_governor_.SetActive(kAudioPowerEncode, false);
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            power_governor_.SetActive(kAudioPowerEncode, true);
+        }
+    }
+
+    ESP_LOGW(TAG, "Opus encoder task stopped");
+    opus_encoder_task_handle_ = nullptr;
+}
+
+void AudioService::OpusDecoderTask() {
+    while (!service_stopped_) {
+        if (!DecodeNextPacket()) {
+            power_governor_.SetActive(kAudioPowerDecode, false);
+            ulTaskNotifyTake(pdTRUE, DecodeWaitTicks());
+            power_governor_.SetActive(kAudioPowerDecode, true);
+        }
+    }
+
+    ESP_LOGW(TAG, "Opus decoder task stopped");
+    opus_decoder_task_handle_ = nullptr;
+}
+
+/* Decode one packet from the decode queue, return false if there is nothing to do */
+bool AUDIO_HOT_FUNC AudioService::DecodeNextPacket() {
+    if (decoder_reset_.exchange(false)) {
+        jitter_buffer_.Reset();
+        for (auto& slot : opus_decoders_) {
+            if (slot.decoder) {
+                slot.decoder->ResetState();
+            }
+        }
+    }
+    if (audio_playback_queue_.full()) {
+        return false;
+    }
+
+    // Sequenced packets go through the jitter buffer, ordered ones (TCP, local sounds) are decoded directly
+    int64_t start_time = esp_timer_get_time();
+    AudioStreamPacketPtr packet;
+    int popped_frame_ms = 0;
+    while (!jitter_buffer_.full() && audio_decode_queue_.Pop(packet)) {
+        xEventGroupSetBits(event_group_, AS_EVENT_DECODE_QUEUE_AVAILABLE);
+        popped_frame_ms = packet->frame_duration;
+        if (packet->sequence == 0) {
+            break;
+        }
+        jitter_buffer_.Push(std::move(packet), start_time);
+    }
+    if (popped_frame_ms > 0) {
+        UpdateDecodeBufferLevel(popped_frame_ms, false);
+    }
+
+    bool conceal = false;
+    if (!packet) {
+        auto& network_monitor = NetworkMonitor::GetInstance();
+        // 弱网时多缓冲几帧，减少丢包补偿造成的断续
+        jitter_buffer_.SetMinDepth(network_monitor.IsPoor() ? AUDIO_POOR_NETWORK_JITTER_DEPTH : JITTER_BUFFER_MIN_DEPTH);
+        auto result = jitter_buffer_.Pop(start_time, packet);
+        if (result == JitterBuffer::kResultNone) {
+            return false;
+        }
+        conceal = result == JitterBuffer::kResultConceal;
+        network_monitor.ReportPacket(conceal);
+    }
+
+    AUDIO_CACHE_PROFILE_SCOPE(kCacheRegionDecode);
+    auto task = audio_task_pool_.Acquire();
+    task->type = kAudioTaskTypeDecodeToPlaybackQueue;
+    bool decoded;
+    bool resample = true;
+    if (conceal) {
+        task->timestamp = 0;
+        task->origin_time_us = start_time;
+        auto next = jitter_buffer_.PeekNext();
+        // 下一包已到且带有 FEC 数据时用它恢复丢失的帧
+        if (next != nullptr && next->codec == kAudioPayloadOpus && next->borrowed_payload.empty() &&
+            next->sample_rate == opus_stream_sample_rate_ && next->frame_duration == opus_decoder_->duration_ms() &&
+            opus_decoder_->DecodeFec(next->payload, task->pcm)) {
+            decoded = true;
+            debug_statistics_.fec_recovered_count++;
+        } else {
+            // An empty packet makes opus run packet loss concealment with the current decoder settings
+            decoded = opus_decoder_->Decode(std::vector<uint8_t>(), task->pcm);
+            debug_statistics_.conceal_count++;
+        }
+    } else if (packet->codec != kAudioPayloadOpus) {
+        // 按输出采样率预先生成的音效，不经过 opus 解码和重采样
+        task->timestamp = 0;
+        task->origin_time_us = packet->time_us;
+        decoded = SoundAsset::DecodeRawFrame(packet->codec, packet->borrowed_payload, task->pcm);
+        resample = false;
+    } else if (packet->cached_sound && packet->cached_sound->ReadFrame(packet->cached_frame, task->pcm)) {
+        // Cached sounds are already at the output sample rate and leave the TTS decoder untouched
+        task->timestamp = 0;
+        task->origin_time_us = packet->time_us;
+        decoded = true;
+        resample = false;
+    } else {
+        task->timestamp = packet->timestamp;
+        task->origin_time_us = packet->time_us;
+        SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
+        if (!packet->borrowed_payload.empty()) {
+            // The packet keeps the borrowed frame valid until it is released after the decode
+            auto& borrowed = packet->borrowed_payload;
+            decoded = opus_decoder_->Decode((const uint8_t*)borrowed.data(), borrowed.size(), task->pcm);
+        } else {
+            decoded = opus_decoder_->Decode(std::move(packet->payload), task->pcm);
+        }
+    }
+    if (decoded) {
+#if CONFIG_USE_AUDIO_DEBUGGER
+        if (resample) {
+            audio_debugger_->Feed(kAudioDebugDecoded, task->pcm, opus_decoder_->sample_rate());
+        }
+#endif
+        // Resample if the sample rate is different
+        if (resample && output_resampler_ != nullptr) {
+            int target_size = output_resampler_->GetOutputSamples(task->pcm.size());
+            output_resample_buffer_.resize(target_size);
+            output_resampler_->Process(task->pcm.data(), task->pcm.size(), output_resample_buffer_.data());
+            task->pcm.swap(output_resample_buffer_);
+        }
+        if (resample && packet && packet->cached_sound) {
+            packet->cached_sound->Record(packet->cached_frame, task->pcm);
+        }
+
+        task->time_us = esp_timer_get_time();
+        latency_tracer_.Record(kAudioStageDecode, task->time_us - task->origin_time_us);
+        audio_playback_queue_.Push(std::move(task));
+        NotifyTask(audio_output_task_handle_);
+    } else {
+        HOT_LOGE(TAG, "Failed to decode audio");
+        BlackBox::GetInstance().Record(kBlackBoxDecodeError, kBlackBoxSourceVoice);
+    }
+    if (packet) {
+        // Pooled packets must not keep evicted sounds alive
+        packet->cached_sound.reset();
+    }
+
+    uint32_t elapsed_us = esp_timer_get_time() - start_time;
+    debug_statistics_.decode_count++;
+    debug_statistics_.decode_time_us += elapsed_us;
+    debug_statistics_.decode_max_us = std::max(debug_statistics_.decode_max_us, elapsed_us);
+    return true;
+}
+
+/* Encode one task from the encode queue, return false if there is nothing to do */
+bool AUDIO_HOT_FUNC AudioService::EncodeNextTask() {
+    PooledPtr<AudioTask> task;
+    if (SendQueueFull() || !audio_encode_queue_.Pop(task)) {
+        return false;
+    }
+    xEventGroupSetBits(event_group_, AS_EVENT_ENCODE_QUEUE_AVAILABLE);
+    ApplyEncoderProfile();
+    UpdateEncoderPacketLoss();
+    AUDIO_CACHE_PROFILE_SCOPE(kCacheRegionOpusEncode);
+
+    int64_t start_time = esp_timer_get_time();
+    // The frame duration follows the frames handed in, opus packets carry their own duration
+    int duration_ms = task->pcm.size() / 16;
+    if (duration_ms != opus_encoder_->duration_ms()) {
+        ESP_LOGI(TAG, "Opus encoder frame duration %d -> %d ms", opus_encoder_->duration_ms(), duration_ms);
+        opus_encoder_->SetDuration(duration_ms);
+    }
+    auto packet = AcquireAudioStreamPacket();
+    packet->frame_duration = duration_ms;
+    packet->sample_rate = 16000;
+    packet->timestamp = task->timestamp;
+    packet->sequence = 0;
+    if (!opus_encoder_->Encode(std::move(task->pcm), packet->payload)) {
+        HOT_LOGE(TAG, "Failed to encode audio");
+        return true;
+    }
+    packet->time_us = esp_timer_get_time();
+    latency_tracer_.Record(kAudioStageEncode, packet->time_us - task->time_us);
+
+    if (task->type == kAudioTaskTypeEncodeToSendQueue) {
+        audio_send_queue_.Push(std::move(packet));
+        if (callbacks_.on_send_queue_available) {
+            callbacks_.on_send_queue_available();
+        }
+    } else if (task->type == kAudioTaskTypeEncodeToTestingQueue) {
+        audio_testing_queue_.Push(std::move(packet));
+    }
+
+    uint32_t elapsed_us = esp_timer_get_time() - start_time;
+    debug_statistics_.encode_count++;
+    debug_statistics_.encode_time_us += elapsed_us;
+    debug_statistics_.encode_max_us = std::max(debug_statistics_.encode_max_us, elapsed_us);
+    if (encoder_auto_tune_) {
+        TuneEncoder();
+    }
+    return true;
+}
+
+void AudioService::SetEncoderProfile(const OpusEncoderProfile& profile) {
+    std::lock_guard<std::mutex> lock(encoder_profile_mutex_);
+    encoder_profile_ = profile;
+    encoder_profile_.complexity = std::clamp(profile.complexity, 0, 10);
+    encoder_profile_.max_complexity = std::clamp(profile.max_complexity, encoder_profile_.complexity, 10);
+    encoder_profile_changed_ = true;
+}
+
+OpusEncoderProfile AudioService::GetEncoderProfile() {
+    std::lock_guard<std::mutex> lock(encoder_profile_mutex_);
+    OpusEncoderProfile profile = encoder_profile_;
+    profile.complexity = encoder_complexity_;
+    return profile;
+}
+
+void AudioService::SetBatterySaver(bool enable) {
+    std::lock_guard<std::mutex> lock(encoder_profile_mutex_);
+    if (battery_saver_ == enable) {
+        return;
+    }
+    battery_saver_ = enable;
+    if (enable) {
+        saved_encoder_profile_ = encoder_profile_;
+        encoder_profile_.complexity = 0;
+        encoder_profile_.max_complexity = 0;
+        encoder_profile_.auto_tune = false;
+    } else {
+        encoder_profile_ = saved_encoder_profile_;
+    }
+    encoder_profile_changed_ = true;
+}
+
+/* Encoder task only, picks up a profile set from another task */
+void AudioService::ApplyEncoderProfile() {
+    if (!encoder_profile_changed_.exchange(false)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(encoder_profile_mutex_);
+    encoder_complexity_ = encoder_profile_.complexity;
+    encoder_auto_tune_ = encoder_profile_.auto_tune;
+    encoder_max_complexity_ = encoder_profile_.max_complexity;
+    opus_encoder_->SetComplexity(encoder_complexity_);
+    opus_encoder_->SetDtx(encoder_profile_.dtx && !voice_detected_);
+    tune_start_encode_count_ = debug_statistics_.encode_count;
+    tune_start_opus_time_us_ = debug_statistics_.encode_time_us + debug_statistics_.decode_time_us;
+    tune_start_encode_dropped_ = debug_statistics_.encode_dropped_count;
+}
+
+/*
+ * The uplink loss is not reported back by the server, the downlink loss measured by NetworkMonitor
+ * stands in for it. FEC turns on at OPUS_FEC_ENABLE_PERMILLE and off below OPUS_FEC_DISABLE_PERMILLE
+ * so a loss rate near the threshold does not toggle it every frame.
+ */
+void AudioService::UpdateEncoderPacketLoss() {
+#if CONFIG_AUDIO_OPUS_FEC
+    int loss_permille = NetworkMonitor::GetInstance().loss_permille();
+    int percent = opus_encoder_->packet_loss();
+    if (percent == 0 && loss_permille < OPUS_FEC_ENABLE_PERMILLE) {
+        return;
+    }
+    if (loss_permille < OPUS_FEC_DISABLE_PERMILLE) {
+        percent = 0;
+    } else {
+        percent = std::clamp((loss_permille + 9) / 10, 1, OPUS_FEC_MAX_LOSS_PERCENT);
+    }
+    if (percent != opus_encoder_->packet_loss()) {
+        ESP_LOGI(TAG, "Opus FEC packet loss %d%% -> %d%%", opus_encoder_->packet_loss(), percent);
+        opus_encoder_->SetPacketLoss(percent);
+    }
+#endif
+}
+
+/*
+ * Step the complexity by one per window: down when the send queue backs up or the opus tasks use
+ * too much of the frame time, up when there is headroom. The bitrate and frame duration are left
+ * alone, the wrapper does not expose the bitrate and the frame duration is negotiated in hello.
+ */
+void AudioService::TuneEncoder() {
+    uint32_t frames = debug_statistics_.encode_count - tune_start_encode_count_;
+    if (frames < OPUS_ENCODER_TUNE_WINDOW_FRAMES) {
+        return;
+    }
+    uint64_t opus_time_us = debug_statistics_.encode_time_us + debug_statistics_.decode_time_us;
+    int load_percent = (opus_time_us - tune_start_opus_time_us_) * 100 / ((uint64_t)frames * opus_encoder_->duration_ms() * 1000);
+    tune_start_encode_count_ = debug_statistics_.encode_count;
+    tune_start_opus_time_us_ = opus_time_us;
+
+    // 窗口内有帧因为编码跟不上被丢弃
+    bool dropped = debug_statistics_.encode_dropped_count != tune_start_encode_dropped_;
+    tune_start_encode_dropped_ = debug_statistics_.encode_dropped_count;
+    bool backlog = audio_send_queue_.size() * opus_encoder_->duration_ms() > AUDIO_SEND_QUEUE_MS / 4 || audio_encode_queue_.size() > 1 ||
+        dropped || NetworkMonitor::GetInstance().IsPoor();
+    int complexity = encoder_complexity_;
+    if (backlog || load_percent > OPUS_ENCODER_TUNE_LOWER_LOAD_PERCENT) {
+        complexity = std::max(complexity - 1, 0);
+    } else if (load_percent < OPUS_ENCODER_TUNE_RAISE_LOAD_PERCENT) {
+        complexity = std::min(complexity + 1, encoder_max_complexity_);
+    }
+    if (complexity != encoder_complexity_) {
+        ESP_LOGI(TAG, "Opus encoder complexity %d -> %d, load %d%%, send queue %u", encoder_complexity_, complexity,
+            load_percent, (unsigned)audio_send_queue_.size());
+        encoder_complexity_ = complexity;
+        opus_encoder_->SetComplexity(complexity);
+    }
+}
+
+// Opus 可以按这些采样率解码，与编码时的采样率无关
+static bool IsOpusSampleRate(int sample_rate) {
+    return sample_rate == 8000 || sample_rate == 12000 || sample_rate == 16000 || sample_rate == 24000 || sample_rate == 48000;
 }
 
 void AudioService::SetDecodeSampleRate(int sample_rate, int frame_duration) {
-    if (opus_decoder_->sample_rate() == sample_rate && opus_decoder_->duration_ms() == frame_duration) {
+    opus_decoder_uses_++;
+    if (opus_decoder_ != nullptr && opus_stream_sample_rate_ == sample_rate && opus_decoder_->duration_ms() == frame_duration) {
         return;
     }
 
-    opus_decoder_.reset();
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(sample_rate, 1, frame_duration);
+    OpusDecoderSlot* target = nullptr;
+    for (auto& slot : opus_decoders_) {
+        if (slot.decoder && slot.stream_sample_rate == sample_rate && slot.decoder->duration_ms() == frame_duration) {
+            target = &slot;
+            break;
+        }
+        if (target == nullptr || !slot.decoder || (target->decoder && slot.last_used < target->last_used)) {
+            target = &slot;
+        }
+    }
+
+    if (!target->decoder || target->stream_sample_rate != sample_rate || target->decoder->duration_ms() != frame_duration) {
+        // Replace the least recently used decoder
+        int output_sample_rate = codec_->output_sample_rate();
+        target->stream_sample_rate = sample_rate;
+        target->resampler.reset();
+        if (IsOpusSampleRate(output_sample_rate)) {
+            // 直接解码到输出采样率，不需要再重采样
+            target->decoder = std::make_unique<OpusFecDecoder>(output_sample_rate, 1, frame_duration);
+        } else {
+            target->decoder = std::make_unique<OpusFecDecoder>(sample_rate, 1, frame_duration);
+            if (sample_rate != output_sample_rate) {
+                ESP_LOGI(TAG, "Resampling audio from %d to %d", sample_rate, output_sample_rate);
+                target->resampler = std::make_unique<OpusResampler>();
+                target->resampler->Configure(sample_rate, output_sample_rate);
+            }
+        }
+    }
+    target->last_used = opus_decoder_uses_;
+    opus_decoder_ = target->decoder.get();
+    opus_stream_sample_rate_ = sample_rate;
+    output_resampler_ = target->resampler.get();
+}
 
-    auto codec = Board::GetInstance().GetAudioCodec();
-    if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
-        ESP_LOGI(TAG, "Resampling audio from %d to %d", opus_decoder_->sample_rate(), codec->output_sample_rate());
-        output_resampler_.Configure(opus_decoder_->sample_rate(), codec->output_sample_rate());
+/*
+ * Processor output task only. Silent frames are held back as pre-roll and dropped once they are older
+ * than the pre-roll window, so the start of speech still reaches the server. After the VAD reports
+ * silence, frames keep passing for the hangover window. Returns false if the frame was held back.
+ */
+bool AudioService::PassUplinkGate(std::vector<int16_t>& pcm, uint32_t timestamp) {
+#if CONFIG_AUDIO_UPLINK_VAD_GATE
+    if (voice_detected_) {
+        uplink_hangover_frames_ = CONFIG_AUDIO_UPLINK_GATE_HANGOVER_MS / frame_duration_ms_;
+        while (uplink_preroll_count_ > 0) {
+            auto& frame = uplink_preroll_[uplink_preroll_start_];
+            PushTaskToEncodeQueue(kAudioTaskTypeEncodeToSendQueue, std::move(frame.pcm), frame.timestamp);
+            uplink_preroll_start_ = (uplink_preroll_start_ + 1) % uplink_preroll_.size();
+            uplink_preroll_count_--;
+        }
+        return true;
+    }
+    if (uplink_hangover_frames_ > 0) {
+        uplink_hangover_frames_--;
+        return true;
+    }
+
+    size_t preroll_frames = std::min<size_t>(CONFIG_AUDIO_UPLINK_GATE_PREROLL_MS / frame_duration_ms_, uplink_preroll_.size());
+    if (preroll_frames > 0) {
+        if (uplink_preroll_count_ == preroll_frames) {
+            uplink_preroll_start_ = (uplink_preroll_start_ + 1) % uplink_preroll_.size();
+            uplink_preroll_count_--;
+        }
+        auto& frame = uplink_preroll_[(uplink_preroll_start_ + uplink_preroll_count_) % uplink_preroll_.size()];
+        frame.pcm.swap(pcm);
+        frame.timestamp = timestamp;
+        uplink_preroll_count_++;
+    }
+    debug_statistics_.uplink_gated_count++;
+    return false;
+#else
+    return true;
+#endif
+}
+
+/*
+ * round_trip_ms: probe written to the codec -> found in the capture
+ * output_ms: samples already queued in the I2S DMA when the probe was written
+ * input_ms: the rest, the acoustic path plus the microphone and capture buffering
+ */
+std::string AudioService::RunLoopbackBenchmark() {
+    std::lock_guard<std::mutex> lock(loopback_mutex_);
+    LoopbackProbe playback_probe(codec_->output_sample_rate());
+    LoopbackProbe capture_probe(16000);
+    loopback_probe_pcm_ = playback_probe.pcm();
+    loopback_capture_samples_ = 16000 * AUDIO_LOOPBACK_CAPTURE_MS / 1000;
+    loopback_capture_.clear();
+    loopback_capture_.reserve(loopback_capture_samples_);
+    loopback_probe_time_us_ = 0;
+
+    audio_input_need_warmup_ = true;
+    xEventGroupClearBits(event_group_, AS_EVENT_LOOPBACK_DONE);
+    xEventGroupSetBits(event_group_, AS_EVENT_LOOPBACK_RUNNING);
+    auto bits = xEventGroupWaitBits(event_group_, AS_EVENT_LOOPBACK_DONE, pdTRUE, pdFALSE,
+        pdMS_TO_TICKS(AUDIO_LOOPBACK_CAPTURE_MS + 1000));
+    if (!(bits & AS_EVENT_LOOPBACK_DONE)) {
+        xEventGroupClearBits(event_group_, AS_EVENT_LOOPBACK_RUNNING);
+        ESP_LOGE(TAG, "Loopback capture timeout");
+        return "{\"error\":\"capture timeout\"}";
+    }
+
+    float score = 0;
+    int offset = capture_probe.Find(loopback_capture_.data(), loopback_capture_.size(), AUDIO_LOOPBACK_MIN_SCORE, &score);
+    int64_t probe_time_us = loopback_probe_time_us_;
+    if (offset < 0 || probe_time_us == 0) {
+        ESP_LOGW(TAG, "Loopback probe not found, score: %.2f", score);
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "{\"error\":\"probe not found\",\"score\":%.2f}", score);
+        return buffer;
+    }
+
+    int64_t found_us = loopback_capture_start_us_ + (int64_t)offset * 1000000 / 16000;
+    float round_trip_ms = (found_us - probe_time_us) / 1000.0f;
+    float output_ms = loopback_output_latency_us_ / 1000.0f;
+    auto& stats = debug_statistics_;
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "{\"round_trip_ms\":%.1f,\"output_ms\":%.1f,\"input_ms\":%.1f,\"score\":%.2f,"
+        "\"encode_avg_us\":%lu,\"decode_avg_us\":%lu,\"stages\":", round_trip_ms, output_ms, round_trip_ms - output_ms, score,
+        (unsigned long)(stats.encode_count ? stats.encode_time_us / stats.encode_count : 0),
+        (unsigned long)(stats.decode_count ? stats.decode_time_us / stats.decode_count : 0));
+    ESP_LOGI(TAG, "Loopback round trip: %.1f ms, output: %.1f ms, score: %.2f", round_trip_ms, output_ms, score);
+    return std::string(buffer) + latency_tracer_.ToJson() + "}";
+}
+
+void AudioService::EnableUplinkGate(bool enable) {
+#if CONFIG_AUDIO_UPLINK_VAD_GATE
+    uplink_gate_enabled_ = enable;
+#else
+    (void)enable;
+#endif
+}
+
+void AudioService::SetFrameDuration(int duration_ms) {
+    if (duration_ms != 20 && duration_ms != 40 && duration_ms != 60) {
+        ESP_LOGW(TAG, "Unsupported frame duration %d ms", duration_ms);
+        duration_ms = OPUS_FRAME_DURATION_MS;
+    }
+    duration_ms = std::max(duration_ms, OPUS_MIN_FRAME_DURATION_MS);
+    if (frame_duration_ms_.exchange(duration_ms) == duration_ms) {
+        return;
+    }
+    ESP_LOGI(TAG, "Uplink frame duration %d ms", duration_ms);
+    // 处理器在帧边界切换帧长，之前排队的帧按原帧长编码
+    if (audio_processor_initialized_) {
+        audio_processor_->SetFrameDuration(duration_ms);
     }
 }
 
-void AudioService::PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm) {
-    auto task = std::make_unique<AudioTask>();
+void AudioService::PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm, uint32_t timestamp, bool wait) {
+    auto task = audio_task_pool_.Acquire();
     task->type = type;
-    task->pcm = std::move(pcm);
-    
-    /* Push the task to the encode queue */
-    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-
-    /* If the task is to send queue, we need to set the timestamp */
-    if (type == kAudioTaskTypeEncodeToSendQueue && !timestamp_queue_.empty()) {
-        if (timestamp_queue_.size() <= MAX_TIMESTAMPS_IN_QUEUE) {
-            task->timestamp = timestamp_queue_.front();
-        } else {
-            ESP_LOGW(TAG, "Timestamp queue (%u) is full, dropping timestamp", timestamp_queue_.size());
+    task->timestamp = timestamp;
+    task->time_us = esp_timer_get_time();
+    task->origin_time_us = task->time_us;
+    task->pcm.swap(pcm);
+
+    if (!wait) {
+        /* Blocking here would stall the AFE fetch and overrun its ring, drop a frame and tell the tuner instead */
+        if (audio_encode_queue_.size() < MAX_ENCODE_TASKS_IN_QUEUE && audio_encode_queue_.Push(std::move(task))) {
+            NotifyTask(opus_encoder_task_handle_);
+            return;
         }
-        timestamp_queue_.pop_front();
+        static auto& dropped = SystemMetrics::GetInstance().Counter("uplink_frames_dropped");
+        debug_statistics_.encode_dropped_count++;
+        dropped++;
+        BlackBox::GetInstance().Record(kBlackBoxQueueFull, kBlackBoxQueueEncode, audio_encode_queue_.size());
+        EnterCriticalWindow();
+#if CONFIG_AUDIO_ENCODE_OVERFLOW_DROP_OLDEST
+        // 先放进空闲槽再丢最旧的，被丢的槽要等编码任务下一次 Pop() 才释放
+        if (audio_encode_queue_.Push(std::move(task))) {
+            audio_encode_queue_.DropOldest();
+            NotifyTask(opus_encoder_task_handle_);
+        }
+#endif
+        return;
     }
 
-    audio_queue_cv_.wait(lock, [this]() { return audio_encode_queue_.size() < MAX_ENCODE_TASKS_IN_QUEUE; });
-    audio_encode_queue_.push_back(std::move(task));
-    audio_queue_cv_.notify_all();
+    /* Push the task to the encode queue, the codec task sets the bit after it takes a task out */
+    xEventGroupClearBits(event_group_, AS_EVENT_ENCODE_QUEUE_AVAILABLE);
+    while (audio_encode_queue_.size() >= MAX_ENCODE_TASKS_IN_QUEUE || !audio_encode_queue_.Push(std::move(task))) {
+        if (service_stopped_) {
+            return;
+        }
+        // 编码跟不上采集
+        EnterCriticalWindow();
+        xEventGroupWaitBits(event_group_, AS_EVENT_ENCODE_QUEUE_AVAILABLE, pdTRUE, pdFALSE, portMAX_DELAY);
+    }
+    NotifyTask(opus_encoder_task_handle_);
 }
 
-bool AudioService::PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait) {
-    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-    if (audio_decode_queue_.size() >= MAX_DECODE_PACKETS_IN_QUEUE) {
-        if (wait) {
-            audio_queue_cv_.wait(lock, [this]() { return audio_decode_queue_.size() < MAX_DECODE_PACKETS_IN_QUEUE; });
-        } else {
+bool AudioService::PushPacketToDecodeQueue(AudioStreamPacketPtr packet, bool wait) {
+    int frame_ms = packet->frame_duration;
+    xEventGroupClearBits(event_group_, AS_EVENT_DECODE_QUEUE_AVAILABLE);
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(decode_producer_mutex_);
+            if (audio_decode_queue_.size() * frame_ms < AUDIO_DECODE_QUEUE_MS && audio_decode_queue_.Push(std::move(packet))) {
+                break;
+            }
+        }
+        if (!wait || service_stopped_) {
+            BlackBox::GetInstance().Record(kBlackBoxQueueFull, kBlackBoxQueueDecode, audio_decode_queue_.size());
+            UpdateDecodeBufferLevel(frame_ms, true);
             return false;
         }
+        xEventGroupWaitBits(event_group_, AS_EVENT_DECODE_QUEUE_AVAILABLE, pdTRUE, pdFALSE, portMAX_DELAY);
     }
-    audio_decode_queue_.push_back(std::move(packet));
-    audio_queue_cv_.notify_all();
+    NotifyTask(opus_decoder_task_handle_);
+    UpdateDecodeBufferLevel(frame_ms, false);
     return true;
 }
 
-std::unique_ptr<AudioStreamPacket> AudioService::PopPacketFromSendQueue() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    if (audio_send_queue_.empty()) {
+/*
+ * Reports the decode queue level when it crosses a watermark, so the server can burst until the high one and then
+ * send at the playback rate. The first drop after the level reached the high zone is reported as an overflow.
+ * The producer and the decoder both call this, the zone only changes for the one that wins the exchange.
+ */
+void AudioService::UpdateDecodeBufferLevel(int frame_ms, bool overflow) {
+    if (!callbacks_.on_decode_buffer_level) {
+        return;
+    }
+    int buffered_ms = audio_decode_queue_.size() * frame_ms;
+    int previous = decode_buffer_zone_.load();
+    int zone = previous;
+    if (buffered_ms >= AUDIO_DECODE_HIGH_WATERMARK_MS) {
+        zone = 2;
+    } else if (buffered_ms <= AUDIO_DECODE_LOW_WATERMARK_MS) {
+        zone = 0;
+    } else if ((previous == 2 && buffered_ms < AUDIO_DECODE_HIGH_WATERMARK_MS - AUDIO_DECODE_WATERMARK_HYSTERESIS_MS) ||
+        (previous == 0 && buffered_ms > AUDIO_DECODE_LOW_WATERMARK_MS + AUDIO_DECODE_WATERMARK_HYSTERESIS_MS)) {
+        zone = 1;
+    }
+
+    bool report = zone != previous && decode_buffer_zone_.compare_exchange_strong(previous, zone);
+    if (report && zone != 2) {
+        decode_overflow_reported_ = false;
+    }
+    if (overflow && !decode_overflow_reported_.exchange(true)) {
+        report = true;
+    } else {
+        overflow = false;
+    }
+    if (report) {
+        callbacks_.on_decode_buffer_level(buffered_ms, overflow);
+    }
+}
+
+AudioStreamPacketPtr AudioService::PopPacketFromSendQueue() {
+    AudioStreamPacketPtr packet;
+    if (!audio_send_queue_.Pop(packet)) {
         return nullptr;
     }
-    auto packet = std::move(audio_send_queue_.front());
-    audio_send_queue_.pop_front();
-    audio_queue_cv_.notify_all();
+    latency_tracer_.Record(kAudioStageSendQueue, esp_timer_get_time() - packet->time_us);
+    NotifyTask(opus_encoder_task_handle_);
     return packet;
 }
 
@@ -460,8 +1295,8 @@ const std::string& AudioService::GetLastWakeWord() const {
     return wake_word_->GetLastDetectedWakeWord();
 }
 
-std::unique_ptr<AudioStreamPacket> AudioService::PopWakeWordPacket() {
-    auto packet = std::make_unique<AudioStreamPacket>();
+AudioStreamPacketPtr AudioService::PopWakeWordPacket() {
+    auto packet = AcquireAudioStreamPacket();
     if (wake_word_->GetWakeWordOpus(packet->payload)) {
         return packet;
     }
@@ -483,6 +1318,7 @@ void AudioService::EnableWakeWordDetection(bool enable) {
             wake_word_initialized_ = true;
         }
         wake_word_->Start();
+        standby_gate_.Reset();
         xEventGroupSetBits(event_group_, AS_EVENT_WAKE_WORD_RUNNING);
     } else {
         wake_word_->Stop();
@@ -490,23 +1326,108 @@ void AudioService::EnableWakeWordDetection(bool enable) {
     }
 }
 
+bool AudioService::SwitchWakeWordModel(const std::string& model, bool* applied) {
+    *applied = false;
+    if (!ModelManager::GetInstance().SetWakeWordModel(model)) {
+        return false;
+    }
+    // 还没初始化时下次初始化直接用新的选择
+    *applied = wake_word_ != nullptr && (!wake_word_initialized_ || wake_word_->SwitchModel(model));
+    return true;
+}
+
+/*
+ * Voice processing only starts once the main loop has run StartListening(), and the input needs to settle
+ * after that, so what the user said since the button went down would be lost. The wake word detection
+ * keeps the last 2 seconds of its audio all along; copy the part since the press before the processor starts.
+ */
+void AudioService::TakeCaptureBackfill() {
+    int64_t since_us = capture_backfill_since_us_.exchange(0);
+    capture_backfill_.clear();
+    capture_backfill_pending_ = false;
+    if (since_us == 0 || !wake_word_ || !wake_word_initialized_ || CONFIG_AUDIO_PTT_PREROLL_MS <= 0) {
+        return;
+    }
+    int64_t elapsed_ms = (esp_timer_get_time() - since_us) / 1000;
+    if (elapsed_ms > AUDIO_PTT_BACKFILL_MAX_AGE_MS) {
+        return;
+    }
+    // One frame more than the time since the press, the detection itself lags behind the microphone
+    int frame_duration = frame_duration_ms_;
+    const size_t frame_samples = 16000 / 1000 * frame_duration;
+    size_t frames = std::min<int64_t>(elapsed_ms, CONFIG_AUDIO_PTT_PREROLL_MS) / frame_duration + 1;
+    capture_backfill_.resize(frames * frame_samples);
+    size_t samples = wake_word_->ReadRecentAudio(capture_backfill_.data(), capture_backfill_.size());
+    capture_backfill_.resize(samples / frame_samples * frame_samples);
+    if (!capture_backfill_.empty()) {
+        ESP_LOGI(TAG, "Backfill %u ms of audio captured since the press", capture_backfill_.size() / 16);
+        capture_backfill_pending_.store(true, std::memory_order_release);
+    }
+}
+
 void AudioService::EnableVoiceProcessing(bool enable) {
     ESP_LOGD(TAG, "%s voice processing", enable ? "Enabling" : "Disabling");
     if (enable) {
-        if (!audio_processor_initialized_) {
-            audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS);
-            audio_processor_initialized_ = true;
-        }
+        InitializeAudioProcessor();
 
         /* We should make sure no audio is playing */
         ResetDecoder();
+        processor_fed_samples_ = 0;
+        processor_output_samples_ = 0;
+        uplink_preroll_count_ = 0;
+        uplink_hangover_frames_ = 0;
+        TakeCaptureBackfill();
         audio_input_need_warmup_ = true;
+        power_governor_.SetActive(kAudioPowerVoice, true);
         audio_processor_->Start();
         xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_PROCESSOR_RUNNING);
     } else {
         audio_processor_->Stop();
         xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_PROCESSOR_RUNNING);
+        power_governor_.SetActive(kAudioPowerVoice, false);
+#if CONFIG_USE_SPEECH_COMMANDS
+        if (speech_commands_) {
+            speech_commands_->Stop();
+        }
+#endif
+    }
+}
+
+// 后台预初始化正在进行时等它完成
+void AudioService::InitializeAudioProcessor() {
+    std::lock_guard<std::mutex> lock(audio_processor_init_mutex_);
+    if (audio_processor_initialized_) {
+        return;
+    }
+    int64_t start_time = esp_timer_get_time();
+    int frame_duration = frame_duration_ms_;
+    audio_processor_->Initialize(codec_, frame_duration);
+    audio_processor_initialized_ = true;
+    // 初始化期间 SetFrameDuration() 还不能转给处理器
+    if (frame_duration_ms_ != frame_duration) {
+        audio_processor_->SetFrameDuration(frame_duration_ms_);
     }
+    ESP_LOGI(TAG, "Audio processor initialized in %d ms", (int)((esp_timer_get_time() - start_time) / 1000));
+}
+
+void AudioService::PreinitializeVoiceProcessing() {
+#if CONFIG_AUDIO_PREINIT_VOICE_PROCESSING
+    if (audio_processor_initialized_) {
+        return;
+    }
+    xTaskCreate([](void* arg) {
+        static_cast<AudioService*>(arg)->InitializeAudioProcessor();
+        vTaskDelete(NULL);
+    }, "audio_preinit", 6144, this, 1, nullptr);
+#endif
+}
+
+void AudioService::StartSpeechCommands() {
+#if CONFIG_USE_SPEECH_COMMANDS
+    if (speech_commands_) {
+        speech_commands_->Start();
+    }
+#endif
 }
 
 void AudioService::EnableAudioTesting(bool enable) {
@@ -515,20 +1436,25 @@ void AudioService::EnableAudioTesting(bool enable) {
         xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
     } else {
         xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
-        /* Copy audio_testing_queue_ to audio_decode_queue_ */
-        std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-        audio_decode_queue_ = std::move(audio_testing_queue_);
-        audio_queue_cv_.notify_all();
+        /* Move the recorded packets to the decode queue for playback */
+        {
+            std::lock_guard<std::mutex> lock(decode_producer_mutex_);
+            AudioStreamPacketPtr packet;
+            while (audio_testing_queue_.Pop(packet)) {
+                if (!audio_decode_queue_.Push(std::move(packet))) {
+                    ESP_LOGW(TAG, "Decode queue is full, dropping audio testing packets");
+                    audio_testing_queue_.Clear();
+                    break;
+                }
+            }
+        }
+        NotifyTask(opus_decoder_task_handle_);
     }
 }
 
 void AudioService::EnableDeviceAec(bool enable) {
     ESP_LOGI(TAG, "%s device AEC", enable ? "Enabling" : "Disabling");
-    if (!audio_processor_initialized_) {
-        audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS);
-        audio_processor_initialized_ = true;
-    }
-
+    InitializeAudioProcessor();
     audio_processor_->EnableDeviceAec(enable);
 }
 
@@ -537,18 +1463,43 @@ void AudioService::SetCallbacks(AudioServiceCallbacks& callbacks) {
 }
 
 void AudioService::PlaySound(const std::string_view& sound) {
-    const char* data = sound.data();
-    size_t size = sound.size();
+    // 提示音只放在资源分区而分区缺失时为空
+    if (sound.empty()) {
+        return;
+    }
+    auto variant = SoundAsset::Select(sound, codec_->output_sample_rate());
+    const char* data = variant.packets.data();
+    size_t size = variant.packets.size();
+#if CONFIG_AUDIO_SOUND_CACHE
+    // 原始 PCM / ADPCM 版本已经是输出采样率，解码开销很小，不需要缓存
+    std::shared_ptr<CachedSound> cached_sound;
+    if (variant.codec == kAudioPayloadOpus) {
+        size_t frame_count = 0;
+        for (const char* p = data; p < data + size; frame_count++) {
+            p += sizeof(BinaryProtocol3) + ntohs(((BinaryProtocol3*)p)->payload_size);
+        }
+        cached_sound = sound_cache_.Get(variant.packets, codec_->output_sample_rate(), frame_count);
+    }
+    size_t frame_index = 0;
+#endif
     for (const char* p = data; p < data + size; ) {
         auto p3 = (BinaryProtocol3*)p;
         p += sizeof(BinaryProtocol3);
 
         auto payload_size = ntohs(p3->payload_size);
-        auto packet = std::make_unique<AudioStreamPacket>();
-        packet->sample_rate = 16000;
-        packet->frame_duration = 60;
-        packet->payload.resize(payload_size);
-        memcpy(packet->payload.data(), p3->payload, payload_size);
+        auto packet = AcquireAudioStreamPacket();
+        packet->sample_rate = variant.sample_rate;
+        packet->frame_duration = variant.frame_duration;
+        packet->timestamp = 0;
+        packet->sequence = 0;
+        packet->time_us = esp_timer_get_time();
+        packet->payload.clear();
+        packet->borrowed_payload = std::string_view((const char*)p3->payload, payload_size);
+        packet->codec = variant.codec;
+#if CONFIG_AUDIO_SOUND_CACHE
+        packet->cached_sound = cached_sound;
+        packet->cached_frame = frame_index++;
+#endif
         p += payload_size;
 
         PushPacketToDecodeQueue(std::move(packet), true);
@@ -556,33 +1507,101 @@ void AudioService::PlaySound(const std::string_view& sound) {
 }
 
 bool AudioService::IsIdle() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
     return audio_encode_queue_.empty() && audio_decode_queue_.empty() && audio_playback_queue_.empty() && audio_testing_queue_.empty();
 }
 
+/*
+ * The queues are cleared right away, the output task fades out the chunk it is about to write and returns, so what
+ * is still heard is at most the DMA buffers (AUDIO_CODEC_DMA_DESC_NUM x AUDIO_CODEC_DMA_FRAME_NUM frames).
+ */
+void AudioService::InterruptPlayback() {
+    playback_interrupted_ = true;
+    ResetDecoder();
+}
+
 void AudioService::ResetDecoder() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    opus_decoder_->ResetState();
-    timestamp_queue_.clear();
-    audio_decode_queue_.clear();
-    audio_playback_queue_.clear();
-    audio_testing_queue_.clear();
-    audio_queue_cv_.notify_all();
+    playout_clock_.Reset();
+    audio_decode_queue_.Clear();
+    // The next stream starts from an empty queue, the server bursts by default so it is not reported
+    decode_buffer_zone_ = 0;
+    decode_overflow_reported_ = false;
+    audio_playback_queue_.Clear();
+    audio_testing_queue_.Clear();
+    decoder_reset_ = true;
+    playback_reset_ = true;
+
+    /* The consumers release the cleared slots on their next pop */
+    xEventGroupSetBits(event_group_, AS_EVENT_DECODE_QUEUE_AVAILABLE);
+    NotifyTask(audio_output_task_handle_);
+    NotifyTask(opus_decoder_task_handle_);
 }
 
 void AudioService::CheckAndUpdateAudioPowerState() {
     auto now = std::chrono::steady_clock::now();
     auto input_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_input_time_).count();
     auto output_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_output_time_).count();
-    if (input_elapsed > AUDIO_POWER_TIMEOUT_MS && codec_->input_enabled()) {
+    if (input_elapsed > input_power_timeout_ms_ && codec_->input_enabled()) {
         codec_->EnableInput(false);
     }
-    if (output_elapsed > AUDIO_POWER_TIMEOUT_MS && codec_->output_enabled()) {
+    if (output_elapsed > output_power_timeout_ms_ && codec_->output_enabled()) {
         codec_->EnableOutput(false);
+        power_governor_.SetActive(kAudioPowerPlayback, false);
     }
     if (!codec_->input_enabled() && !codec_->output_enabled()) {
-        esp_timer_stop(audio_power_timer_);
+        TickService::GetInstance().SetEnabled(audio_power_tick_id_, false);
+    }
+}
+
+void AudioService::EnableCodecOutput() {
+    if (!codec_->output_enabled()) {
+        power_governor_.SetActive(kAudioPowerPlayback, true);
+        codec_->EnableOutput(true);
+        TickService::GetInstance().SetEnabled(audio_power_tick_id_, true);
+    }
+}
+
+/* Power up the output ahead of the first frame, e.g. on wake word or tts start, the output task does the switch */
+void AudioService::PrepareOutput() {
+    output_warmup_requested_ = true;
+    NotifyTask(audio_output_task_handle_);
+}
+
+void AudioService::SetPowerTimeouts(int input_timeout_ms, int output_timeout_ms) {
+    input_power_timeout_ms_ = input_timeout_ms;
+    output_power_timeout_ms_ = output_timeout_ms;
+}
+
+/* Called by the music and sing players, blocks while the mixer is full so the caller is paced by the playback */
+bool AudioService::WriteMusicData(const int16_t* pcm, size_t samples) {
+    if (audio_mixer_.music_capacity() == 0) {
+        return false;
+    }
+    int stalled_ms = 0;
+    while (samples > 0 && !service_stopped_) {
+        size_t written = audio_mixer_.WriteMusic(pcm, samples, AUDIO_MIXER_WRITE_TIMEOUT_MS);
+        if (written == 0) {
+            // 输出任务一直没有取走音乐，丢掉这一块，不让播放线程卡在这里
+            stalled_ms += AUDIO_MIXER_WRITE_TIMEOUT_MS;
+            if (stalled_ms >= AUDIO_MIXER_WRITE_STALL_MS) {
+                ESP_LOGW(TAG, "Music mixer not drained for %d ms, dropping %u samples", stalled_ms, samples);
+                return false;
+            }
+            continue;
+        }
+        stalled_ms = 0;
+        pcm += written;
+        samples -= written;
+        NotifyTask(audio_output_task_handle_);
+    }
+    return samples == 0;
+}
+
+int64_t AudioService::music_latency_us() {
+    int sample_rate = codec_->output_sample_rate();
+    if (sample_rate <= 0) {
+        return 0;
     }
+    return (int64_t)audio_mixer_.music_available() * 1000000 / sample_rate + codec_->output_latency_us();
 }
 
 void AudioService::UpdateOutputTimestamp() {
@@ -2,10 +2,11 @@
 #define AUDIO_SERVICE_H
 
 #include <memory>
+#include <array>
 #include <deque>
-#include <condition_variable>
 #include <chrono>
 #include <mutex>
+#include <atomic>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -18,9 +19,22 @@
 
 #include "audio_codec.h"
 #include "audio_processor.h"
+#include "spsc_queue.h"
+#include "latency_tracer.h"
+#include "jitter_buffer.h"
+#include "sound_cache.h"
+#include "audio_mixer.h"
+#include "loopback_probe.h"
+#include "audio_power_governor.h"
+#include "playout_clock.h"
+#include "opus_fec.h"
 #include "processors/audio_debugger.h"
 #include "wake_word.h"
+#include "standby_energy_gate.h"
 #include "protocol.h"
+#if CONFIG_USE_SPEECH_COMMANDS
+#include "speech_command_recognizer.h"
+#endif
 
 
 /*
@@ -28,21 +42,84 @@
  * 1. (MIC) -> [Processors] -> {Encode Queue} -> [Opus Encoder] -> {Send Queue} -> (Server)
  * 2. (Server) -> {Decode Queue} -> [Opus Decoder] -> {Playback Queue} -> (Speaker)
  *
- * We use one task for MIC / Speaker / Processors, and one task for Opus Encoder / Opus Decoder.
+ * We use one task for MIC / Speaker / Processors. Opus Encoder and Opus Decoder run in separate tasks
+ * on dual-core targets (CONFIG_AUDIO_SPLIT_OPUS_CODEC_TASK), or share one task otherwise.
  * 
  * Decode Queue and Send Queue are the main queues, because Opus packets are quite smaller than PCM packets.
- * 
+ *
+ * Every queue is a lock-free SPSC ring. The consuming task is woken by a direct task notification,
+ * and producers that wait for free space block on an event group bit set by the consumer.
  */
 
+// Uplink frame duration until the hello has negotiated another one, sounds and audio testing always use it
 #define OPUS_FRAME_DURATION_MS 60
+// Shortest uplink frame the build can negotiate, the packet queues are sized for it
+#if CONFIG_AUDIO_REALTIME_FRAME_DURATION_MS < OPUS_FRAME_DURATION_MS
+#define OPUS_MIN_FRAME_DURATION_MS CONFIG_AUDIO_REALTIME_FRAME_DURATION_MS
+#else
+#define OPUS_MIN_FRAME_DURATION_MS OPUS_FRAME_DURATION_MS
+#endif
 #define MAX_ENCODE_TASKS_IN_QUEUE 2
+// Spare encode queue slots hold frames that replaced the oldest one until the encoder frees them on its next Pop(),
+// so a stalled encoder can take this many drops in a row before new frames are lost as well
+#define ENCODE_QUEUE_SPARE_SLOTS 6
+#define ENCODE_QUEUE_SLOTS (MAX_ENCODE_TASKS_IN_QUEUE + ENCODE_QUEUE_SPARE_SLOTS)
 #define MAX_PLAYBACK_TASKS_IN_QUEUE 2
-#define MAX_DECODE_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
-#define MAX_SEND_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
+// The decode and send queues hold this much audio whatever the frame duration
+#define AUDIO_DECODE_QUEUE_MS 2400
+#define AUDIO_SEND_QUEUE_MS 2400
+#define MAX_DECODE_PACKETS_IN_QUEUE (AUDIO_DECODE_QUEUE_MS / OPUS_MIN_FRAME_DURATION_MS)
+// Decode queue watermarks reported to servers that negotiated flow control, a level has to move back by the hysteresis to leave its zone
+#define AUDIO_DECODE_HIGH_WATERMARK_MS (AUDIO_DECODE_QUEUE_MS * 3 / 4)
+#define AUDIO_DECODE_LOW_WATERMARK_MS (AUDIO_DECODE_QUEUE_MS / 4)
+#define AUDIO_DECODE_WATERMARK_HYSTERESIS_MS (AUDIO_DECODE_QUEUE_MS / 10)
+#define MAX_SEND_PACKETS_IN_QUEUE (AUDIO_SEND_QUEUE_MS / OPUS_MIN_FRAME_DURATION_MS)
 #define AUDIO_TESTING_MAX_DURATION_MS 10000
-#define MAX_TIMESTAMPS_IN_QUEUE 3
+#define MAX_AUDIO_TESTING_PACKETS (AUDIO_TESTING_MAX_DURATION_MS / OPUS_FRAME_DURATION_MS)
+#define MAX_OPUS_DECODERS 3
+// Music PCM buffered in the mixer, and how much is written at once when no voice is playing
+#define AUDIO_MIXER_MUSIC_BUFFER_MS 200
+#define AUDIO_MIXER_MUSIC_CHUNK_MS 20
+// A music write waits this long for space at a time, and gives up when the output has not drained for AUDIO_MIXER_WRITE_STALL_MS
+#define AUDIO_MIXER_WRITE_TIMEOUT_MS 100
+#define AUDIO_MIXER_WRITE_STALL_MS 1000
+// Enough for full encode and playback queues, plus one task in flight at each end
+#define AUDIO_TASK_POOL_SIZE (ENCODE_QUEUE_SLOTS + MAX_PLAYBACK_TASKS_IN_QUEUE + 4)
+
+#define OPUS_CODEC_TASK_STACK_SIZE (2048 * 13)
+#define OPUS_ENCODER_TASK_STACK_SIZE (2048 * 12)
+#define OPUS_DECODER_TASK_STACK_SIZE (2048 * 5)
+
+// Playback prebuffering, the watermark is raised after an underrun and restored after a calm period
+#define AUDIO_PREBUFFER_STEP_MS 60
+#define AUDIO_PREBUFFER_MAX_MS 600
+#define AUDIO_UNDERRUN_WINDOW_MS 500
+#define AUDIO_PREBUFFER_RESTORE_MS 30000
+
+// Jitter buffer floor while NetworkMonitor reports a poor link
+#define AUDIO_POOR_NETWORK_JITTER_DEPTH 3
+
+// Opus in-band FEC thresholds on the measured loss rate, and the highest loss the encoder plans for
+#define OPUS_FEC_ENABLE_PERMILLE 20
+#define OPUS_FEC_DISABLE_PERMILLE 10
+#define OPUS_FEC_MAX_LOSS_PERCENT 20
+
+// Encoder auto tuning, evaluated once per window, load is the opus CPU time per frame duration
+#define OPUS_ENCODER_TUNE_WINDOW_FRAMES 16
+#define OPUS_ENCODER_TUNE_RAISE_LOAD_PERCENT 20
+#define OPUS_ENCODER_TUNE_LOWER_LOAD_PERCENT 50
+
+#define AUDIO_UPLINK_GATE_MAX_PREROLL_FRAMES (480 / OPUS_MIN_FRAME_DURATION_MS)
+// A push-to-talk press older than this did not lead to the voice processing, the wake word ring holds 2 s
+#define AUDIO_PTT_BACKFILL_MAX_AGE_MS 2000
+
+// Loopback benchmark capture length, the probe is played right after the capture started
+#define AUDIO_LOOPBACK_CAPTURE_MS 1000
+#define AUDIO_LOOPBACK_MIN_SCORE 0.3f
 
-#define AUDIO_POWER_TIMEOUT_MS 15000
+#define AUDIO_INPUT_WARMUP_MS 120
+// 断流或编码积压后，显示降帧保持的时间
+#define AUDIO_CRITICAL_HOLD_MS 2000
 #define AUDIO_POWER_CHECK_INTERVAL_MS 1000
 
 
@@ -50,12 +127,25 @@
 #define AS_EVENT_WAKE_WORD_RUNNING          (1 << 1)
 #define AS_EVENT_AUDIO_PROCESSOR_RUNNING    (1 << 2)
 #define AS_EVENT_PLAYBACK_NOT_EMPTY         (1 << 3)
+#define AS_EVENT_ENCODE_QUEUE_AVAILABLE     (1 << 4)
+#define AS_EVENT_DECODE_QUEUE_AVAILABLE     (1 << 5)
+#define AS_EVENT_LOOPBACK_RUNNING           (1 << 6)
+#define AS_EVENT_LOOPBACK_DONE              (1 << 7)
 
 struct AudioServiceCallbacks {
     std::function<void(void)> on_send_queue_available;
     std::function<void(const std::string&)> on_wake_word_detected;
     std::function<void(bool)> on_vad_change;
     std::function<void(void)> on_audio_testing_queue_full;
+    // 本地识别到的命令词对应的 MCP 工具和参数
+    std::function<void(const std::string& tool, const std::string& arguments)> on_speech_command;
+    // 唤醒词超出 CPU 预算时的降载等级，0 为正常，在采集或检测任务上调用
+    std::function<void(int level)> on_wake_word_degrade;
+    // 音频快要跟不上（播放断流、编码排队）时为 true，AUDIO_CRITICAL_HOLD_MS 内没有再出现为 false，
+    // 在音频任务或定时器任务上调用
+    std::function<void(bool critical)> on_critical_window;
+    // 下行解码队列跨过高低水位或者满了丢包，在网络接收任务或解码任务上调用
+    std::function<void(int buffered_ms, bool overflow)> on_decode_buffer_level;
 };
 
 
@@ -69,6 +159,8 @@ struct AudioTask {
     AudioTaskType type;
     std::vector<int16_t> pcm;
     uint32_t timestamp;
+    int64_t time_us;    // Local time of the last pipeline stage, for latency tracing
+    int64_t origin_time_us;     // Local time the audio entered the pipeline
 };
 
 struct DebugStatistics {
@@ -76,6 +168,30 @@ struct DebugStatistics {
     uint32_t decode_count = 0;
     uint32_t encode_count = 0;
     uint32_t playback_count = 0;
+    // Time spent in the Opus stages, in microseconds
+    uint64_t decode_time_us = 0;
+    uint32_t decode_max_us = 0;
+    uint64_t encode_time_us = 0;
+    uint32_t encode_max_us = 0;
+    // Lost downlink packets replaced by opus packet loss concealment
+    uint32_t conceal_count = 0;
+    // Lost downlink packets rebuilt from the in-band FEC of the next packet
+    uint32_t fec_recovered_count = 0;
+    // Playback ran dry while the stream was still going
+    uint32_t underrun_count = 0;
+    // Silent uplink frames not sent because of the VAD gate
+    uint32_t uplink_gated_count = 0;
+    // Silent standby chunks not fed to the wake word detection
+    uint32_t standby_gated_count = 0;
+    // Uplink frames dropped because the encoder fell behind the audio processor
+    uint32_t encode_dropped_count = 0;
+};
+
+struct OpusEncoderProfile {
+    int complexity = 0;
+    int max_complexity = 0;     // Upper bound for auto tuning
+    bool auto_tune = false;     // Follow the opus_codec CPU load and the send queue depth
+    bool dtx = true;            // Enabled during VAD silence only, so speech onsets are never cut
 };
 
 class AudioService {
@@ -87,7 +203,7 @@ public:
     void Start();
     void Stop();
     void EncodeWakeWord();
-    std::unique_ptr<AudioStreamPacket> PopWakeWordPacket();
+    AudioStreamPacketPtr PopWakeWordPacket();
     const std::string& GetLastWakeWord() const;
     bool IsVoiceDetected() const { return voice_detected_; }
     bool IsIdle();
@@ -95,65 +211,239 @@ public:
     bool IsAudioProcessorRunning() const { return xEventGroupGetBits(event_group_) & AS_EVENT_AUDIO_PROCESSOR_RUNNING; }
 
     void EnableWakeWordDetection(bool enable);
+    // Saves the WakeNet choice, false when the model is unknown; *applied says whether it is in use without a restart
+    bool SwitchWakeWordModel(const std::string& model, bool* applied);
     void EnableVoiceProcessing(bool enable);
+    // Builds the voice processing pipeline on a low priority task after boot, the first conversation then starts as fast as later ones
+    void PreinitializeVoiceProcessing();
+    // Push-to-talk: the next EnableVoiceProcessing(true) first sends what the wake word ring captured since since_us
+    void BackfillCaptureFrom(int64_t since_us) { capture_backfill_since_us_ = since_us; }
     void EnableAudioTesting(bool enable);
     void EnableDeviceAec(bool enable);
+    // Listens for offline command words on the uplink audio for a few seconds, needs CONFIG_USE_SPEECH_COMMANDS
+    void StartSpeechCommands();
 
     void SetCallbacks(AudioServiceCallbacks& callbacks);
 
-    bool PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait = false);
-    std::unique_ptr<AudioStreamPacket> PopPacketFromSendQueue();
+    bool PushPacketToDecodeQueue(AudioStreamPacketPtr packet, bool wait = false);
+    AudioStreamPacketPtr PopPacketFromSendQueue();
+    size_t GetSendQueueSize() const { return audio_send_queue_.size(); }
+    void ClearSendQueue() { audio_send_queue_.Clear(); }
+    // The sound is decoded in place, it must stay valid until played (embedded or mmapped assets)
     void PlaySound(const std::string_view& sound);
     bool ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples);
     void ResetDecoder();
+    // Barge-in: fade out the voice frame being written and drop everything decoded or queued behind it
+    void InterruptPlayback();
     
+    // Music PCM at the codec output sample rate, mixed with the voice playback
+    bool WriteMusicData(const int16_t* pcm, size_t samples);
+    // Music written but not heard yet: queued in the mixer plus the samples already in the I2S DMA
+    int64_t music_latency_us();
     void UpdateOutputTimestamp();
+    // Power hints from the application, so the codec is not switched on in front of the first frame
+    void PrepareOutput();
+    void SetPowerTimeouts(int input_timeout_ms, int output_timeout_ms);
+    // Drop silent uplink frames before encoding, needs CONFIG_AUDIO_UPLINK_VAD_GATE
+    void EnableUplinkGate(bool enable);
+    // Uplink frame duration negotiated in the hello, 20, 40 or 60 ms, takes effect at the next processor frame
+    void SetFrameDuration(int duration_ms);
+    int frame_duration_ms() const { return frame_duration_ms_; }
+    // Plays a chirp, captures it with the microphone and returns the measured latencies as json, blocks about 1.5 s
+    std::string RunLoopbackBenchmark();
+    void SetEncoderProfile(const OpusEncoderProfile& profile);
+    OpusEncoderProfile GetEncoderProfile();
+    // Low battery: lowest Opus complexity without auto tuning, the previous profile comes back afterwards
+    void SetBatterySaver(bool enable);
+    // 0 restores the configured maximum, needs CONFIG_PM_ENABLE
+    void SetCpuFrequencyCap(int mhz) { power_governor_.SetMaxFrequency(mhz); }
+    const DebugStatistics& debug_statistics() const { return debug_statistics_; }
+    LatencyTracer& latency_tracer() { return latency_tracer_; }
 
 private:
     AudioCodec* codec_ = nullptr;
     AudioServiceCallbacks callbacks_;
     std::unique_ptr<AudioProcessor> audio_processor_;
     std::unique_ptr<WakeWord> wake_word_;
+#if CONFIG_USE_SPEECH_COMMANDS
+    std::unique_ptr<SpeechCommandRecognizer> speech_commands_;
+#endif
     std::unique_ptr<AudioDebugger> audio_debugger_;
-    std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
-    std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
+    std::unique_ptr<OpusFecEncoder> opus_encoder_;
     OpusResampler input_resampler_;
+    // config.h 与 codec 的输入采样率不一致时仍然走运行时重采样
+    bool input_resample_fallback_ = false;
     OpusResampler reference_resampler_;
-    OpusResampler output_resampler_;
+    // Channels after the first two of a multi-mic capture
+    std::vector<std::unique_ptr<OpusResampler>> extra_input_resamplers_;
+    // Live decoders keyed by sample rate and frame duration, so alternating local sounds and TTS costs nothing
+    struct OpusDecoderSlot {
+        std::unique_ptr<OpusFecDecoder> decoder;    // Runs at the output sample rate if opus supports it
+        std::unique_ptr<OpusResampler> resampler;   // Null if the decoder runs at the output sample rate
+        int stream_sample_rate = 0;                 // Sample rate the packets declare
+        uint32_t last_used = 0;
+    };
+    std::array<OpusDecoderSlot, MAX_OPUS_DECODERS> opus_decoders_;
+    uint32_t opus_decoder_uses_ = 0;
+    // The current slot, only touched by the decoder task
+    OpusFecDecoder* opus_decoder_ = nullptr;
+    int opus_stream_sample_rate_ = 0;
+    OpusResampler* output_resampler_ = nullptr;
     DebugStatistics debug_statistics_;
+    LatencyTracer latency_tracer_;
+    AudioPowerGovernor power_governor_;
+    // Mono samples fed to and received from the audio processor, the difference is its buffering delay
+    uint32_t processor_fed_samples_ = 0;
+    uint32_t processor_output_samples_ = 0;
+
+    // Scratch buffers of ReadAudioData(), reserved for a full frame so reads never allocate
+    std::vector<int16_t> input_raw_buffer_;
+    std::vector<int16_t> input_split_buffer_;
+    std::vector<int16_t> input_resampled_buffer_;
+    // Batched codec reads, consumers take their own chunk sizes from here
+    size_t input_batch_samples_ = 0;
+    std::vector<int16_t> input_batch_buffer_;
+    size_t input_batch_offset_ = 0;
+    // Wake word input when it shares the capture with the audio processor
+    std::vector<int16_t> wake_word_feed_buffer_;
+    std::vector<int16_t> wake_word_feed_chunk_;
+    StandbyEnergyGate standby_gate_;
 
     EventGroupHandle_t event_group_;
 
     // Audio encode / decode
     TaskHandle_t audio_input_task_handle_ = nullptr;
     TaskHandle_t audio_output_task_handle_ = nullptr;
-    TaskHandle_t opus_codec_task_handle_ = nullptr;
-    std::mutex audio_queue_mutex_;
-    std::condition_variable audio_queue_cv_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_decode_queue_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_send_queue_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_testing_queue_;
-    std::deque<std::unique_ptr<AudioTask>> audio_encode_queue_;
-    std::deque<std::unique_ptr<AudioTask>> audio_playback_queue_;
+    // Both handles point to the same task when encoder and decoder share one task
+    TaskHandle_t opus_encoder_task_handle_ = nullptr;
+    TaskHandle_t opus_decoder_task_handle_ = nullptr;
+    // The decode queue is sized for audio testing playback, normal pushes stop at MAX_DECODE_PACKETS_IN_QUEUE
+    SpscQueue<AudioStreamPacketPtr, MAX_AUDIO_TESTING_PACKETS> audio_decode_queue_;
+    SpscQueue<AudioStreamPacketPtr, MAX_SEND_PACKETS_IN_QUEUE> audio_send_queue_;
+    SpscQueue<AudioStreamPacketPtr, MAX_AUDIO_TESTING_PACKETS> audio_testing_queue_;
+    SpscQueue<PooledPtr<AudioTask>, ENCODE_QUEUE_SLOTS> audio_encode_queue_;
+    SpscQueue<PooledPtr<AudioTask>, MAX_PLAYBACK_TASKS_IN_QUEUE> audio_playback_queue_;
+    ObjectPool<AudioTask, AUDIO_TASK_POOL_SIZE> audio_task_pool_;
+    // Scratch buffer of the codec task, swapped with the decoded PCM so both keep their capacity
+    std::vector<int16_t> output_resample_buffer_;
+#if CONFIG_AUDIO_SOUND_CACHE
+    SoundCache sound_cache_{CONFIG_AUDIO_SOUND_CACHE_SIZE_KB * 1024};
+#endif
+    // Owned by the decoder task, other tasks only request a reset of it and the decoders
+    JitterBuffer jitter_buffer_;
+    std::atomic<bool> decoder_reset_{false};
+    // Watermark zone of the decode queue: 0 low, 1 normal, 2 high
+    std::atomic<int> decode_buffer_zone_{0};
+    std::atomic<bool> decode_overflow_reported_{false};
+    AudioMixer audio_mixer_;
+    std::vector<int16_t> music_output_buffer_;
+    // Playback prebuffer state, owned by the output task
+    std::atomic<bool> playback_reset_{false};
+    std::atomic<bool> playback_interrupted_{false};
+    std::vector<int16_t> fade_buffer_;
+    bool playback_primed_ = false;
+    int prebuffer_ms_ = CONFIG_AUDIO_PLAYBACK_PREBUFFER_MS;
+    int64_t playback_drained_time_us_ = 0;
+    int64_t last_underrun_time_us_ = 0;
+    // The decode queue is fed by the network, PlaySound() and audio testing, so its producers take turns
+    std::mutex decode_producer_mutex_;
+    std::mutex encoder_profile_mutex_;
+    OpusEncoderProfile encoder_profile_;
+    std::atomic<bool> encoder_profile_changed_{false};
+    bool battery_saver_ = false;
+    OpusEncoderProfile saved_encoder_profile_;
+    // Encoder task only
+    int encoder_complexity_ = 0;
+    bool encoder_auto_tune_ = false;
+    int encoder_max_complexity_ = 0;
+    uint32_t tune_start_encode_count_ = 0;
+    uint64_t tune_start_opus_time_us_ = 0;
+    uint32_t tune_start_encode_dropped_ = 0;
     // For server AEC
-    std::deque<uint32_t> timestamp_queue_;
+    PlayoutClock playout_clock_;
+
+    struct UplinkFrame {
+        std::vector<int16_t> pcm;
+        uint32_t timestamp = 0;
+    };
+    std::mutex loopback_mutex_;
+    std::vector<int16_t> loopback_probe_pcm_;
+    std::vector<int16_t> loopback_capture_;
+    size_t loopback_capture_samples_ = 0;
+    int64_t loopback_capture_start_us_ = 0;
+    std::atomic<bool> loopback_probe_requested_{false};
+    std::atomic<int64_t> loopback_probe_time_us_{0};
+    std::atomic<int64_t> loopback_output_latency_us_{0};
+
+    std::atomic<int> frame_duration_ms_{OPUS_FRAME_DURATION_MS};
+    std::atomic<bool> uplink_gate_enabled_{false};
+    std::array<UplinkFrame, AUDIO_UPLINK_GATE_MAX_PREROLL_FRAMES> uplink_preroll_;
+    size_t uplink_preroll_start_ = 0;
+    size_t uplink_preroll_count_ = 0;
+    int uplink_hangover_frames_ = 0;
+
+    std::atomic<int64_t> capture_backfill_since_us_{0};
+    // Filled before the processor starts, sent by the processor output task ahead of its first frame
+    std::vector<int16_t> capture_backfill_;
+    std::atomic<bool> capture_backfill_pending_{false};
 
     bool wake_word_initialized_ = false;
-    bool audio_processor_initialized_ = false;
+    // Set once the processor is built, by the first conversation or PreinitializeVoiceProcessing()
+    std::atomic<bool> audio_processor_initialized_{false};
+    std::mutex audio_processor_init_mutex_;
     bool voice_detected_ = false;
     bool service_stopped_ = true;
     bool audio_input_need_warmup_ = false;
 
-    esp_timer_handle_t audio_power_timer_ = nullptr;
+    int audio_power_tick_id_ = 0;
+    esp_timer_handle_t critical_timer_ = nullptr;
+    std::atomic<bool> critical_window_{false};
+    std::atomic<bool> output_warmup_requested_{false};
+    std::atomic<int> input_power_timeout_ms_{CONFIG_AUDIO_POWER_IDLE_TIMEOUT_MS};
+    std::atomic<int> output_power_timeout_ms_{CONFIG_AUDIO_POWER_IDLE_TIMEOUT_MS};
+    int64_t input_enabled_time_us_ = 0;
     std::chrono::steady_clock::time_point last_input_time_;
     std::chrono::steady_clock::time_point last_output_time_;
 
+    bool ReadCodecInput(std::vector<int16_t>& data, size_t samples);
+    void FeedWakeWord(const std::vector<int16_t>& data, size_t feed_size);
     void AudioInputTask();
     void AudioOutputTask();
     void OpusCodecTask();
-    void PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm);
+    void OpusEncoderTask();
+    void OpusDecoderTask();
+    bool DecodeNextPacket();
+    void UpdateDecodeBufferLevel(int frame_ms, bool overflow);
+    bool EncodeNextTask();
+    void InitializeAudioProcessor();
+    // wait is for bursts (backfill, pre-roll, testing), live frames from the processor never block it
+    void PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm, uint32_t timestamp = 0, bool wait = true);
+    void TakeCaptureBackfill();
+    bool PassUplinkGate(std::vector<int16_t>& pcm, uint32_t timestamp);
+    bool SendQueueFull() const {
+        return audio_send_queue_.full() || audio_send_queue_.size() * frame_duration_ms_ >= AUDIO_SEND_QUEUE_MS;
+    }
     void SetDecodeSampleRate(int sample_rate, int frame_duration);
+    void ApplyEncoderProfile();
+    void UpdateEncoderPacketLoss();
+    void TuneEncoder();
     void CheckAndUpdateAudioPowerState();
+    void EnableCodecOutput();
+    void WriteOutput(const std::vector<int16_t>& pcm, bool interruptible = false);
+    bool IsPlaybackPrebuffered(const AudioTask& first_task, int64_t waited_us);
+    void OnPlaybackRestart(int64_t now_us);
+    void EnterCriticalWindow();
+
+    // Packets held by the jitter buffer are released by time, so the decoder must wake up on its own
+    TickType_t DecodeWaitTicks() const {
+        return jitter_buffer_.empty() ? portMAX_DELAY : pdMS_TO_TICKS(10);
+    }
+
+    static inline void NotifyTask(TaskHandle_t task_handle) {
+        if (task_handle != nullptr) {
+            xTaskNotifyGive(task_handle);
+        }
+    }
 };
 
 #endif
\ No newline at end of file
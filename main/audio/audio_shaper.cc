@@ -0,0 +1,80 @@
+#include "audio_shaper.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+// 限幅的上限约 -1 dBFS，开启时先提升约 4 dB 的响度
+#define SHAPER_LIMITER_CEILING 29200
+#define SHAPER_LIMITER_MAKEUP_Q15 52000
+#define SHAPER_LIMITER_RELEASE_SHIFT 11
+
+void AudioShaper::Configure(AudioEqProfile profile, bool limiter) {
+    profile_ = profile;
+    limiter_ = limiter;
+    sample_rate_ = 0;
+    limiter_gain_q15_ = 1 << 15;
+}
+
+void AudioShaper::UpdateCoefficients(int sample_rate, int channels) {
+    sample_rate_ = sample_rate;
+    channels_ = std::min(channels, kMaxChannels);
+    for (auto& state : state_) {
+        state = {};
+    }
+
+    // RBJ cookbook 二阶高通，Q = 0.707
+    float cutoff = profile_ == kAudioEqVoice ? 300.0f : 150.0f;
+    float w0 = 2.0f * (float)M_PI * cutoff / sample_rate;
+    float alpha = sinf(w0) / (2.0f * 0.7071f);
+    float cos_w0 = cosf(w0);
+    float a0 = 1.0f + alpha;
+    auto q14 = [a0](float v) { return (int32_t)lrintf(v / a0 * (1 << 14)); };
+    b0_ = q14((1.0f + cos_w0) / 2.0f);
+    b1_ = q14(-(1.0f + cos_w0));
+    b2_ = b0_;
+    a1_ = q14(-2.0f * cos_w0);
+    a2_ = q14(1.0f - alpha);
+}
+
+void AudioShaper::Process(int16_t* pcm, size_t samples, int sample_rate, int channels) {
+    if (!active() || sample_rate <= 0 || channels <= 0) {
+        return;
+    }
+    if (sample_rate != sample_rate_ || std::min(channels, kMaxChannels) != channels_) {
+        UpdateCoefficients(sample_rate, channels);
+    }
+
+    if (profile_ != kAudioEqFlat) {
+        for (int ch = 0; ch < channels_; ch++) {
+            BiquadState& s = state_[ch];
+            for (size_t i = ch; i < samples; i += channels) {
+                int32_t x = pcm[i];
+                int64_t acc = (int64_t)b0_ * x + (int64_t)b1_ * s.x1 + (int64_t)b2_ * s.x2
+                    - (int64_t)a1_ * s.y1 - (int64_t)a2_ * s.y2;
+                int32_t y = (int32_t)(acc >> 14);
+                s.x2 = s.x1;
+                s.x1 = x;
+                s.y2 = s.y1;
+                s.y1 = y;
+                pcm[i] = std::clamp<int32_t>(y, INT16_MIN, INT16_MAX);
+            }
+        }
+    }
+
+    if (limiter_) {
+        // 各声道共用一个增益，避免声像漂移
+        int32_t gain = limiter_gain_q15_;
+        for (size_t i = 0; i < samples; i++) {
+            int32_t v = (pcm[i] * SHAPER_LIMITER_MAKEUP_Q15) >> 15;
+            int32_t peak = std::abs(v);
+            if (((peak * gain) >> 15) > SHAPER_LIMITER_CEILING) {
+                gain = (SHAPER_LIMITER_CEILING << 15) / peak;
+            } else {
+                gain += ((1 << 15) - gain + (1 << SHAPER_LIMITER_RELEASE_SHIFT) - 1) >> SHAPER_LIMITER_RELEASE_SHIFT;
+            }
+            pcm[i] = std::clamp<int32_t>((v * gain) >> 15, INT16_MIN, INT16_MAX);
+        }
+        limiter_gain_q15_ = gain;
+    }
+}
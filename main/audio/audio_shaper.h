@@ -0,0 +1,44 @@
+#ifndef AUDIO_SHAPER_H
+#define AUDIO_SHAPER_H
+
+#include <cstddef>
+#include <cstdint>
+
+enum AudioEqProfile {
+    kAudioEqFlat = 0,
+    kAudioEqSmallSpeaker,   // 切掉小喇叭放不出来的低频，把余量留给中高频
+    kAudioEqVoice,          // 更高的截止频率，只保留人声频段
+};
+
+/*
+ * Software fallback for codecs without DAC EQ / DRC, applied to the output PCM in place.
+ *
+ * The EQ profile is a single high-pass biquad (Q14 coefficients, int64 accumulator, one state per channel),
+ * the limiter applies a few dB of makeup gain and pulls the gain down instantly on peaks above the ceiling,
+ * releasing over ~2048 samples. Coefficients are recomputed when the sample rate or channel count changes.
+ */
+class AudioShaper {
+public:
+    void Configure(AudioEqProfile profile, bool limiter);
+    bool active() const { return profile_ != kAudioEqFlat || limiter_; }
+    void Process(int16_t* pcm, size_t samples, int sample_rate, int channels);
+
+private:
+    static constexpr int kMaxChannels = 2;
+
+    struct BiquadState {
+        int32_t x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+    };
+
+    AudioEqProfile profile_ = kAudioEqFlat;
+    bool limiter_ = false;
+    int sample_rate_ = 0;
+    int channels_ = 0;
+    int32_t b0_ = 0, b1_ = 0, b2_ = 0, a1_ = 0, a2_ = 0;
+    BiquadState state_[kMaxChannels];
+    int32_t limiter_gain_q15_ = 1 << 15;
+
+    void UpdateCoefficients(int sample_rate, int channels);
+};
+
+#endif // AUDIO_SHAPER_H
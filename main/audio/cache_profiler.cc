@@ -0,0 +1,120 @@
+#include "cache_profiler.h"
+
+#if CONFIG_AUDIO_CACHE_PROFILE
+#include <esp_log.h>
+#include <esp_cpu.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <xtensa_perfmon_access.h>
+#include <xtensa_perfmon_masks.h>
+#if !CONFIG_FREERTOS_UNICORE
+#include <esp_ipc.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+
+#define TAG "CacheProfiler"
+
+#define CACHE_COUNTER_ICACHE_STALL  0
+#define CACHE_COUNTER_DCACHE_STALL  1
+
+CacheProfiler::CacheProfiler() {
+    // 性能计数器是每个核独立的寄存器，需要在各自的核上配置
+#if CONFIG_FREERTOS_UNICORE
+    ConfigureCore(nullptr);
+#else
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        esp_ipc_call_blocking(core, ConfigureCore, nullptr);
+    }
+#endif
+}
+
+void CacheProfiler::ConfigureCore(void* arg) {
+    xtensa_perfmon_stop();
+    xtensa_perfmon_init(CACHE_COUNTER_ICACHE_STALL, XTPERF_CNT_I_STALL, XTPERF_MASK_I_STALL_CACHE_MISS, 0, -1);
+    xtensa_perfmon_init(CACHE_COUNTER_DCACHE_STALL, XTPERF_CNT_D_STALL, XTPERF_MASK_D_STALL_CACHE_MISS, 0, -1);
+    xtensa_perfmon_reset(CACHE_COUNTER_ICACHE_STALL);
+    xtensa_perfmon_reset(CACHE_COUNTER_DCACHE_STALL);
+    xtensa_perfmon_start();
+}
+
+CacheProfiler::Sample CacheProfiler::Begin() const {
+    Sample sample;
+    // 关中断保证核号和计数器来自同一个核
+    portDISABLE_INTERRUPTS();
+    sample.core = esp_cpu_get_core_id();
+    sample.cycles = esp_cpu_get_cycle_count();
+    sample.icache_stall = xtensa_perfmon_value(CACHE_COUNTER_ICACHE_STALL);
+    sample.dcache_stall = xtensa_perfmon_value(CACHE_COUNTER_DCACHE_STALL);
+    portENABLE_INTERRUPTS();
+    sample.time_us = esp_timer_get_time();
+    return sample;
+}
+
+void CacheProfiler::End(CacheProfileRegion region, const Sample& begin) {
+    Sample end = Begin();
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& stats = stats_[region];
+    if (end.core != begin.core) {
+        stats.migrated++;
+        return;
+    }
+    uint32_t elapsed_us = end.time_us - begin.time_us;
+    stats.count++;
+    stats.time_us += elapsed_us;
+    stats.max_us = std::max(stats.max_us, elapsed_us);
+    // 32 位计数器回绕时无符号相减仍然正确
+    stats.cycles += end.cycles - begin.cycles;
+    stats.icache_stall += end.icache_stall - begin.icache_stall;
+    stats.dcache_stall += end.dcache_stall - begin.dcache_stall;
+}
+
+void CacheProfiler::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_ = {};
+}
+
+std::string CacheProfiler::ToJson() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string json = "{";
+    for (int i = 0; i < kCacheRegionCount; i++) {
+        const auto& stats = stats_[i];
+        float cycles = std::max<uint64_t>(stats.cycles, 1);
+        char buffer[192];
+        snprintf(buffer, sizeof(buffer), "%s\"%s\":{\"count\":%lu,\"avg_us\":%lu,\"max_us\":%lu,"
+            "\"icache_stall_pct\":%.1f,\"dcache_stall_pct\":%.1f,\"migrated\":%lu}",
+            i == 0 ? "" : ",", RegionName((CacheProfileRegion)i), (unsigned long)stats.count,
+            (unsigned long)(stats.count > 0 ? stats.time_us / stats.count : 0), (unsigned long)stats.max_us,
+            stats.icache_stall * 100.0f / cycles, stats.dcache_stall * 100.0f / cycles, (unsigned long)stats.migrated);
+        json += buffer;
+    }
+    json += "}";
+    return json;
+}
+
+void CacheProfiler::Print() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i = 0; i < kCacheRegionCount; i++) {
+        const auto& stats = stats_[i];
+        if (stats.count == 0) {
+            continue;
+        }
+        float cycles = std::max<uint64_t>(stats.cycles, 1);
+        ESP_LOGI(TAG, "%-12s count: %6lu avg: %5lu us max: %6lu us icache stall: %4.1f%% dcache stall: %4.1f%%",
+            RegionName((CacheProfileRegion)i), (unsigned long)stats.count, (unsigned long)(stats.time_us / stats.count),
+            (unsigned long)stats.max_us, stats.icache_stall * 100.0f / cycles, stats.dcache_stall * 100.0f / cycles);
+    }
+}
+
+const char* CacheProfiler::RegionName(CacheProfileRegion region) {
+    switch (region) {
+        case kCacheRegionAudioInput: return "audio_input";
+        case kCacheRegionOpusEncode: return "opus_encode";
+        case kCacheRegionDecode: return "decode";
+        case kCacheRegionAudioOutput: return "audio_output";
+        case kCacheRegionMp3Decode: return "mp3_decode";
+        default: return "unknown";
+    }
+}
+#endif
@@ -0,0 +1,93 @@
+#ifndef CACHE_PROFILER_H
+#define CACHE_PROFILER_H
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include <sdkconfig.h>
+
+enum CacheProfileRegion {
+    kCacheRegionAudioInput,     // AudioService::ReadAudioData, I2S read and input resampling
+    kCacheRegionOpusEncode,
+    kCacheRegionDecode,         // Opus / raw sound decode and output resampling
+    kCacheRegionAudioOutput,    // Write to the codec
+    kCacheRegionMp3Decode,
+    kCacheRegionCount,
+};
+
+/*
+ * Cache stall measurement of the audio hot paths (CONFIG_AUDIO_CACHE_PROFILE).
+ *
+ * The two Xtensa performance counters of every core count instruction and data cache miss stall cycles.
+ * A region reads them together with the cycle counter at entry and exit, so the result is the share of
+ * its cycles spent waiting for flash / PSRAM. The counters are per core and not per task: a region that
+ * is preempted also counts the other task, one that migrates to the other core is dropped.
+ */
+class CacheProfiler {
+public:
+    struct Sample {
+        int core;
+        uint32_t cycles;
+        uint32_t icache_stall;
+        uint32_t dcache_stall;
+        int64_t time_us;
+    };
+
+    static CacheProfiler& GetInstance() {
+        static CacheProfiler instance;
+        return instance;
+    }
+    CacheProfiler(const CacheProfiler&) = delete;
+    CacheProfiler& operator=(const CacheProfiler&) = delete;
+
+    Sample Begin() const;
+    void End(CacheProfileRegion region, const Sample& begin);
+    void Reset();
+
+    // {"decode":{"count":..,"avg_us":..,"max_us":..,"icache_stall_pct":..,"dcache_stall_pct":..,"migrated":..}, ...}
+    std::string ToJson() const;
+    void Print() const;
+
+    static const char* RegionName(CacheProfileRegion region);
+
+private:
+    struct Stats {
+        uint32_t count = 0;
+        uint32_t migrated = 0;
+        uint32_t max_us = 0;
+        uint64_t time_us = 0;
+        uint64_t cycles = 0;
+        uint64_t icache_stall = 0;
+        uint64_t dcache_stall = 0;
+    };
+
+    CacheProfiler();
+    static void ConfigureCore(void* arg);
+
+    mutable std::mutex mutex_;
+    std::array<Stats, kCacheRegionCount> stats_;
+};
+
+class CacheProfileScope {
+public:
+    explicit CacheProfileScope(CacheProfileRegion region)
+        : region_(region), begin_(CacheProfiler::GetInstance().Begin()) {}
+    ~CacheProfileScope() { CacheProfiler::GetInstance().End(region_, begin_); }
+    CacheProfileScope(const CacheProfileScope&) = delete;
+    CacheProfileScope& operator=(const CacheProfileScope&) = delete;
+
+private:
+    CacheProfileRegion region_;
+    CacheProfiler::Sample begin_;
+};
+
+// Measures the rest of the enclosing block, compiles to nothing without CONFIG_AUDIO_CACHE_PROFILE
+#if CONFIG_AUDIO_CACHE_PROFILE
+#define AUDIO_CACHE_PROFILE_SCOPE(region) CacheProfileScope cache_profile_scope_(region)
+#else
+#define AUDIO_CACHE_PROFILE_SCOPE(region)
+#endif
+
+#endif // CACHE_PROFILER_H
@@ -1,4 +1,5 @@
 #include "box_audio_codec.h"
+#include "es8311_audio_codec.h"
 
 #include <esp_log.h>
 #include <driver/i2c_master.h>
@@ -12,6 +13,11 @@ BoxAudioCodec::BoxAudioCodec(void* i2c_master_handle, int input_sample_rate, int
     duplex_ = true; // 是否双工
     input_reference_ = input_reference; // 是否使用参考输入，实现回声消除
     input_channels_ = input_reference_ ? 2 : 1; // 输入通道数
+#if CONFIG_AUDIO_INPUT_MULTI_MIC
+    // ES7210 的通道 2 接第二个麦克风，通道 1 为回采
+    input_channels_ += 1;
+    input_format_ = input_reference_ ? "MRM" : "MNM";
+#endif
     input_sample_rate_ = input_sample_rate;
     output_sample_rate_ = output_sample_rate;
 
@@ -195,11 +201,16 @@ void BoxAudioCodec::EnableInput(bool enable) {
             .sample_rate = (uint32_t)output_sample_rate_,
             .mclk_multiple = 0,
         };
+        uint16_t mic_mask = ESP_CODEC_DEV_MAKE_CHANNEL_MASK(0);
+#if CONFIG_AUDIO_INPUT_MULTI_MIC
+        mic_mask |= ESP_CODEC_DEV_MAKE_CHANNEL_MASK(2);
+        fs.channel_mask |= ESP_CODEC_DEV_MAKE_CHANNEL_MASK(1) | mic_mask;
+#endif
         if (input_reference_) {
             fs.channel_mask |= ESP_CODEC_DEV_MAKE_CHANNEL_MASK(1);
         }
         ESP_ERROR_CHECK(esp_codec_dev_open(input_dev_, &fs));
-        ESP_ERROR_CHECK(esp_codec_dev_set_in_channel_gain(input_dev_, ESP_CODEC_DEV_MAKE_CHANNEL_MASK(0), AUDIO_CODEC_DEFAULT_MIC_GAIN));
+        ESP_ERROR_CHECK(esp_codec_dev_set_in_channel_gain(input_dev_, mic_mask, AUDIO_CODEC_DEFAULT_MIC_GAIN));
     } else {
         ESP_ERROR_CHECK(esp_codec_dev_close(input_dev_));
     }
@@ -221,12 +232,18 @@ void BoxAudioCodec::EnableOutput(bool enable) {
         };
         ESP_ERROR_CHECK(esp_codec_dev_open(output_dev_, &fs));
         ESP_ERROR_CHECK(esp_codec_dev_set_out_vol(output_dev_, output_volume_));
+        Es8311AudioCodec::SetDacDrc(out_codec_if_, limiter_enabled_);
     } else {
         ESP_ERROR_CHECK(esp_codec_dev_close(output_dev_));
     }
     AudioCodec::EnableOutput(enable);
 }
 
+bool BoxAudioCodec::ApplyHardwareLimiter(bool enable) {
+    // 输出关闭时寄存器写入无效，打开时会按 limiter_enabled_ 设置
+    return !output_enabled_ || Es8311AudioCodec::SetDacDrc(out_codec_if_, enable);
+}
+
 int BoxAudioCodec::Read(int16_t* dest, int samples) {
     if (input_enabled_) {
         ESP_ERROR_CHECK_WITHOUT_ABORT(esp_codec_dev_read(input_dev_, (void*)dest, samples * sizeof(int16_t)));
@@ -22,6 +22,7 @@ private:
 
     virtual int Read(int16_t* dest, int samples) override;
     virtual int Write(const int16_t* data, int samples) override;
+    virtual bool ApplyHardwareLimiter(bool enable) override;
 
 public:
     BoxAudioCodec(void* i2c_master_handle, int input_sample_rate, int output_sample_rate,
@@ -32,6 +33,7 @@ public:
     virtual void SetOutputVolume(int volume) override;
     virtual void EnableInput(bool enable) override;
     virtual void EnableOutput(bool enable) override;
+    virtual bool SupportsHardwareLimiter() const override { return true; }
 };
 
 #endif // _BOX_AUDIO_CODEC_H
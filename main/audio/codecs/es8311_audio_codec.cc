@@ -4,6 +4,13 @@
 
 #define TAG "Es8311AudioCodec"
 
+// DAC DRC 寄存器：0x34 bit7 使能、低 4 位窗口长度；0x35 高 4 位上限、低 4 位下限
+#define ES8311_DAC_DRC_REG 0x34
+#define ES8311_DAC_DRC_LEVEL_REG 0x35
+#define ES8311_DAC_DRC_ENABLE 0x80
+#define ES8311_DAC_DRC_WINSIZE 0x04
+#define ES8311_DAC_DRC_LEVELS 0xEA
+
 Es8311AudioCodec::Es8311AudioCodec(void* i2c_master_handle, i2c_port_t i2c_port, int input_sample_rate, int output_sample_rate,
     gpio_num_t mclk, gpio_num_t bclk, gpio_num_t ws, gpio_num_t dout, gpio_num_t din,
     gpio_num_t pa_pin, uint8_t es8311_addr, bool use_mclk, bool pa_inverted) {
@@ -83,6 +90,8 @@ void Es8311AudioCodec::UpdateDeviceState() {
         ESP_ERROR_CHECK(esp_codec_dev_open(dev_, &fs));
         ESP_ERROR_CHECK(esp_codec_dev_set_in_gain(dev_, AUDIO_CODEC_DEFAULT_MIC_GAIN));
         ESP_ERROR_CHECK(esp_codec_dev_set_out_vol(dev_, output_volume_));
+        // 打开设备会复位寄存器，DRC 需要重新设置
+        SetDacDrc(codec_if_, limiter_enabled_);
     } else if (!input_enabled_ && !output_enabled_ && dev_ != nullptr) {
         esp_codec_dev_close(dev_);
         dev_ = nullptr;
@@ -154,6 +163,21 @@ void Es8311AudioCodec::SetOutputVolume(int volume) {
     AudioCodec::SetOutputVolume(volume);
 }
 
+bool Es8311AudioCodec::SetDacDrc(const audio_codec_if_t* codec_if, bool enable) {
+    int ret = codec_if->set_reg(codec_if, ES8311_DAC_DRC_LEVEL_REG, ES8311_DAC_DRC_LEVELS);
+    ret |= codec_if->set_reg(codec_if, ES8311_DAC_DRC_REG, enable ? (ES8311_DAC_DRC_ENABLE | ES8311_DAC_DRC_WINSIZE) : 0);
+    if (ret != 0) {
+        ESP_LOGW(TAG, "Failed to set DAC DRC: %d", ret);
+        return false;
+    }
+    return true;
+}
+
+bool Es8311AudioCodec::ApplyHardwareLimiter(bool enable) {
+    // 设备未打开时寄存器写入无效，打开时会按 limiter_enabled_ 设置
+    return dev_ == nullptr || SetDacDrc(codec_if_, enable);
+}
+
 void Es8311AudioCodec::EnableInput(bool enable) {
     if (enable == input_enabled_) {
         return;
@@ -24,6 +24,7 @@ private:
 
     virtual int Read(int16_t* dest, int samples) override;
     virtual int Write(const int16_t* data, int samples) override;
+    virtual bool ApplyHardwareLimiter(bool enable) override;
 
 public:
     Es8311AudioCodec(void* i2c_master_handle, i2c_port_t i2c_port, int input_sample_rate, int output_sample_rate,
@@ -34,6 +35,10 @@ public:
     virtual void SetOutputVolume(int volume) override;
     virtual void EnableInput(bool enable) override;
     virtual void EnableOutput(bool enable) override;
+    virtual bool SupportsHardwareLimiter() const override { return true; }
+
+    // ES8311 DAC 自带 DRC，BoxAudioCodec 的输出同样是 ES8311
+    static bool SetDacDrc(const audio_codec_if_t* codec_if, bool enable);
 };
 
 #endif // _ES8311_AUDIO_CODEC_H
\ No newline at end of file
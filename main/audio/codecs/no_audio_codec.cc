@@ -1,11 +1,16 @@
 #include "no_audio_codec.h"
 
 #include <esp_log.h>
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 
 #define TAG "NoAudioCodec"
 
+// 约 10ms（24kHz），足够消除拉链噪声，旋钮转动时听起来仍然跟手
+#define NO_AUDIO_CODEC_VOLUME_RAMP_SAMPLES 256
+#define NO_AUDIO_CODEC_VOLUME_RAMP_STEP (65536 / NO_AUDIO_CODEC_VOLUME_RAMP_SAMPLES)
+
 NoAudioCodec::~NoAudioCodec() {
     if (rx_handle_ != nullptr) {
         ESP_ERROR_CHECK(i2s_channel_disable(rx_handle_));
@@ -279,32 +284,49 @@ NoAudioCodecSimplexPdm::NoAudioCodecSimplexPdm(int input_sample_rate, int output
 }
 
 int NoAudioCodec::Write(const int16_t* data, int samples) {
-    std::vector<int32_t> buffer(samples);
+    if (write_buffer_.size() < (size_t)samples) {
+        write_buffer_.resize(samples);
+    }
+    int32_t* buffer = write_buffer_.data();
 
     // output_volume_: 0-100
-    // volume_factor_: 0-65536
-    int32_t volume_factor = pow(double(output_volume_) / 100.0, 2) * 65536;
-    for (int i = 0; i < samples; i++) {
-        int64_t temp = int64_t(data[i]) * volume_factor; // 使用 int64_t 进行乘法运算
-        if (temp > INT32_MAX) {
-            buffer[i] = INT32_MAX;
-        } else if (temp < INT32_MIN) {
-            buffer[i] = INT32_MIN;
-        } else {
-            buffer[i] = static_cast<int32_t>(temp);
+    // volume_factor_: 0-65536，只在音量变化时重新计算
+    if (output_volume_ != cached_volume_) {
+        cached_volume_ = output_volume_;
+        volume_factor_ = pow(double(output_volume_) / 100.0, 2) * 65536;
+    }
+    // int16 乘以 65536 的结果落在 [-2^31, 2^31 - 65536]，int32 放得下，无需 64 位乘法和饱和
+    const int32_t volume_factor = volume_factor_;
+    int i = 0;
+    if (applied_factor_ < 0) {
+        applied_factor_ = volume_factor;
+    }
+    if (applied_factor_ != volume_factor) {
+        // 满量程的变化用 NO_AUDIO_CODEC_VOLUME_RAMP_SAMPLES 个样本完成，可以跨越多次 Write
+        int32_t factor = applied_factor_;
+        for (; i < samples && factor != volume_factor; i++) {
+            factor += std::clamp(volume_factor - factor, -NO_AUDIO_CODEC_VOLUME_RAMP_STEP, NO_AUDIO_CODEC_VOLUME_RAMP_STEP);
+            buffer[i] = int32_t(data[i]) * factor;
         }
+        applied_factor_ = factor;
+    }
+    for (; i < samples; i++) {
+        buffer[i] = int32_t(data[i]) * volume_factor;
     }
 
     size_t bytes_written;
-    ESP_ERROR_CHECK(i2s_channel_write(tx_handle_, buffer.data(), samples * sizeof(int32_t), &bytes_written, portMAX_DELAY));
+    ESP_ERROR_CHECK(i2s_channel_write(tx_handle_, buffer, samples * sizeof(int32_t), &bytes_written, portMAX_DELAY));
     return bytes_written / sizeof(int32_t);
 }
 
 int NoAudioCodec::Read(int16_t* dest, int samples) {
     size_t bytes_read;
 
-    std::vector<int32_t> bit32_buffer(samples);
-    if (i2s_channel_read(rx_handle_, bit32_buffer.data(), samples * sizeof(int32_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
+    if (read_buffer_.size() < (size_t)samples) {
+        read_buffer_.resize(samples);
+    }
+    const int32_t* bit32_buffer = read_buffer_.data();
+    if (i2s_channel_read(rx_handle_, read_buffer_.data(), samples * sizeof(int32_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
         ESP_LOGE(TAG, "Read Failed!");
         return 0;
     }
@@ -312,7 +334,7 @@ int NoAudioCodec::Read(int16_t* dest, int samples) {
     samples = bytes_read / sizeof(int32_t);
     for (int i = 0; i < samples; i++) {
         int32_t value = bit32_buffer[i] >> 12;
-        dest[i] = (value > INT16_MAX) ? INT16_MAX : (value < -INT16_MAX) ? -INT16_MAX : (int16_t)value;
+        dest[i] = std::clamp<int32_t>(value, -INT16_MAX, INT16_MAX);
     }
     return samples;
 }
@@ -8,6 +8,14 @@
 
 class NoAudioCodec : public AudioCodec {
 private:
+    // 32 位 I2S 帧的转换缓冲区只增不减，读写分别在不同任务里使用
+    std::vector<int32_t> write_buffer_;
+    std::vector<int32_t> read_buffer_;
+    int cached_volume_ = -1;
+    int32_t volume_factor_ = 0;
+    // 实际使用的系数，按样本逐步追上 volume_factor_，音量变化时没有阶跃噪声
+    int32_t applied_factor_ = -1;
+
     virtual int Write(const int16_t* data, int samples) override;
     virtual int Read(int16_t* dest, int samples) override;
 
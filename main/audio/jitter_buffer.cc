@@ -0,0 +1,131 @@
+#include "jitter_buffer.h"
+
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "JitterBuffer"
+
+static bool SequenceBefore(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+void JitterBuffer::Push(AudioStreamPacketPtr packet, int64_t now_us) {
+    uint32_t sequence = packet->sequence;
+    if (started_ && SequenceBefore(sequence, next_sequence_)) {
+        // Arrived after its slot was already concealed or skipped
+        late_packets_++;
+        return;
+    }
+
+    // RFC 3550 style jitter estimate, only late arrivals count because bursts are harmless
+    int64_t frame_us = packet->frame_duration * 1000;
+    if (last_arrival_us_ != 0) {
+        // Reordered packets count as late relative to the newest one
+        int64_t delay = (now_us - last_arrival_us_) - (int64_t)(int32_t)(sequence - last_sequence_) * frame_us;
+        jitter_us_ += (std::max<int64_t>(delay, 0) - jitter_us_) / 16;
+    }
+    if (last_arrival_us_ == 0 || SequenceBefore(last_sequence_, sequence)) {
+        last_arrival_us_ = now_us;
+        last_sequence_ = sequence;
+    }
+    if (frame_us > 0) {
+        int depth = 1 + (int)((2 * jitter_us_ + frame_us - 1) / frame_us);
+        target_depth_ = std::clamp(depth, min_depth_, JITTER_BUFFER_MAX_DEPTH);
+    }
+
+    // Insert sorted, the common in-order case appends at the end
+    int index = count_;
+    while (index > 0 && SequenceBefore(sequence, entries_[index - 1].packet->sequence)) {
+        index--;
+    }
+    if (index > 0 && entries_[index - 1].packet->sequence == sequence) {
+        return;
+    }
+    if (full()) {
+        ESP_LOGW(TAG, "Jitter buffer full, drop packet %lu", (unsigned long)sequence);
+        return;
+    }
+    for (int i = count_; i > index; i--) {
+        entries_[i] = std::move(entries_[i - 1]);
+    }
+    entries_[index].packet = std::move(packet);
+    entries_[index].arrival_us = now_us;
+    count_++;
+}
+
+// Hold the head until the buffer has reached the target depth, but never longer than that depth in time
+bool JitterBuffer::ShouldWait(int64_t now_us, int depth) const {
+    const auto& head = entries_[0];
+    int64_t max_wait_us = (int64_t)target_depth_ * head.packet->frame_duration * 1000;
+    return count_ < depth && now_us - head.arrival_us < max_wait_us;
+}
+
+JitterBuffer::Result JitterBuffer::Pop(int64_t now_us, AudioStreamPacketPtr& packet) {
+    if (count_ == 0) {
+        return kResultNone;
+    }
+
+    uint32_t sequence = entries_[0].packet->sequence;
+    if (!started_) {
+        if (ShouldWait(now_us, target_depth_)) {
+            return kResultNone;
+        }
+        started_ = true;
+        next_sequence_ = sequence;
+    }
+
+    if (sequence != next_sequence_) {
+        // Give a missing packet the chance to arrive before concealing it
+        if (ShouldWait(now_us, target_depth_ + 1)) {
+            return kResultNone;
+        }
+        if (concealed_run_ < JITTER_BUFFER_MAX_CONCEALED_FRAMES) {
+            concealed_run_++;
+            concealed_frames_++;
+            next_sequence_++;
+            return kResultConceal;
+        }
+        ESP_LOGW(TAG, "Lost %lu packets, resync", (unsigned long)(sequence - next_sequence_ + concealed_run_));
+        next_sequence_ = sequence;
+    }
+
+    packet = std::move(entries_[0].packet);
+    RemoveHead();
+    next_sequence_++;
+    concealed_run_ = 0;
+    return kResultPacket;
+}
+
+const AudioStreamPacket* JitterBuffer::PeekNext() const {
+    if (count_ == 0 || entries_[0].packet->sequence != next_sequence_) {
+        return nullptr;
+    }
+    return entries_[0].packet.get();
+}
+
+void JitterBuffer::RemoveHead() {
+    for (int i = 1; i < count_; i++) {
+        entries_[i - 1] = std::move(entries_[i]);
+    }
+    count_--;
+    entries_[count_].packet.reset();
+}
+
+void JitterBuffer::Reset() {
+    for (int i = 0; i < count_; i++) {
+        entries_[i].packet.reset();
+    }
+    count_ = 0;
+    started_ = false;
+    next_sequence_ = 0;
+    last_sequence_ = 0;
+    last_arrival_us_ = 0;
+    jitter_us_ = 0;
+    target_depth_ = min_depth_;
+    concealed_run_ = 0;
+}
+
+void JitterBuffer::SetMinDepth(int depth) {
+    min_depth_ = std::clamp(depth, JITTER_BUFFER_MIN_DEPTH, JITTER_BUFFER_MAX_DEPTH);
+    target_depth_ = std::max(target_depth_, min_depth_);
+}
@@ -0,0 +1,68 @@
+#ifndef JITTER_BUFFER_H
+#define JITTER_BUFFER_H
+
+#include <array>
+#include <cstdint>
+
+#include "protocol.h"
+
+#define JITTER_BUFFER_MAX_PACKETS 16
+#define JITTER_BUFFER_MIN_DEPTH 1
+#define JITTER_BUFFER_MAX_DEPTH 8
+#define JITTER_BUFFER_MAX_CONCEALED_FRAMES 3
+
+/*
+ * Reorders sequenced packets (e.g. the MQTT UDP channel) before decoding.
+ *
+ * The target depth follows the measured late-arrival jitter. A missing packet is given up once
+ * more than the target depth is buffered behind it or the next packet has waited that long, and is then replaced
+ * by a concealment frame, up to JITTER_BUFFER_MAX_CONCEALED_FRAMES in a row before resyncing.
+ *
+ * Only used by the decoder task, so it needs no locking.
+ */
+class JitterBuffer {
+public:
+    enum Result {
+        kResultNone,        // Nothing to decode yet
+        kResultPacket,      // Decode the returned packet
+        kResultConceal,     // A packet is lost, decode a concealment frame
+    };
+
+    void Push(AudioStreamPacketPtr packet, int64_t now_us);
+    Result Pop(int64_t now_us, AudioStreamPacketPtr& packet);
+    void Reset();
+    // Floor of the adaptive depth, raised while the link is poor
+    void SetMinDepth(int depth);
+    // The packet after a concealed one if it is already here, it carries the FEC data of the lost one
+    const AudioStreamPacket* PeekNext() const;
+
+    bool empty() const { return count_ == 0; }
+    bool full() const { return count_ >= JITTER_BUFFER_MAX_PACKETS; }
+    int target_depth() const { return target_depth_; }
+    uint32_t concealed_frames() const { return concealed_frames_; }
+    uint32_t late_packets() const { return late_packets_; }
+
+private:
+    struct Entry {
+        AudioStreamPacketPtr packet;
+        int64_t arrival_us = 0;
+    };
+
+    std::array<Entry, JITTER_BUFFER_MAX_PACKETS> entries_;    // Sorted by sequence
+    int count_ = 0;
+    bool started_ = false;
+    uint32_t next_sequence_ = 0;
+    uint32_t last_sequence_ = 0;
+    int64_t last_arrival_us_ = 0;
+    int64_t jitter_us_ = 0;
+    int min_depth_ = JITTER_BUFFER_MIN_DEPTH;
+    int target_depth_ = JITTER_BUFFER_MIN_DEPTH;
+    int concealed_run_ = 0;
+    uint32_t concealed_frames_ = 0;
+    uint32_t late_packets_ = 0;
+
+    bool ShouldWait(int64_t now_us, int depth) const;
+    void RemoveHead();
+};
+
+#endif // JITTER_BUFFER_H
@@ -0,0 +1,110 @@
+#include "latency_tracer.h"
+
+#include <esp_log.h>
+#include <cstdio>
+#include <algorithm>
+
+#define TAG "LatencyTracer"
+
+int LatencyHistogram::BucketIndex(uint32_t latency_us) {
+    if (latency_us < kLinearLimitUs) {
+        return latency_us / (kLinearLimitUs / kLinearBuckets);
+    }
+    uint32_t octave = 31 - __builtin_clz(latency_us / kLinearLimitUs);
+    if (octave >= kOctaves) {
+        return kBucketCount - 1;
+    }
+    uint32_t base = kLinearLimitUs << octave;
+    uint32_t sub_bucket = (latency_us - base) / (base / kSubBuckets);
+    return kLinearBuckets + octave * kSubBuckets + sub_bucket;
+}
+
+uint32_t LatencyHistogram::BucketUpperBound(int index) {
+    if (index < (int)kLinearBuckets) {
+        return (index + 1) * (kLinearLimitUs / kLinearBuckets);
+    }
+    index -= kLinearBuckets;
+    uint32_t octave = index / kSubBuckets;
+    if (octave >= kOctaves) {
+        return UINT32_MAX;
+    }
+    uint32_t base = kLinearLimitUs << octave;
+    return base + (index % kSubBuckets + 1) * (base / kSubBuckets);
+}
+
+void LatencyHistogram::Record(uint32_t latency_us) {
+    buckets_[BucketIndex(latency_us)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    uint32_t max_us = max_us_.load(std::memory_order_relaxed);
+    while (latency_us > max_us && !max_us_.compare_exchange_weak(max_us, latency_us, std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::Reset() {
+    for (auto& bucket : buckets_) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    count_.store(0, std::memory_order_relaxed);
+    max_us_.store(0, std::memory_order_relaxed);
+}
+
+uint32_t LatencyHistogram::Percentile(int percentile) const {
+    uint32_t total = count();
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t target = ((uint64_t)total * percentile + 99) / 100;
+    uint64_t cumulative = 0;
+    for (int i = 0; i < (int)kBucketCount; i++) {
+        cumulative += buckets_[i].load(std::memory_order_relaxed);
+        if (cumulative >= target) {
+            // The last bucket is open ended, the maximum is the best bound we have
+            return i == (int)kBucketCount - 1 ? max_us() : std::min(BucketUpperBound(i), max_us());
+        }
+    }
+    return max_us();
+}
+
+void LatencyTracer::Reset() {
+    for (auto& histogram : histograms_) {
+        histogram.Reset();
+    }
+}
+
+const char* LatencyTracer::StageName(AudioLatencyStage stage) {
+    switch (stage) {
+        case kAudioStageProcessor: return "processor";
+        case kAudioStageEncode: return "encode";
+        case kAudioStageSendQueue: return "send_queue";
+        case kAudioStageDecode: return "decode";
+        case kAudioStagePlayback: return "playback";
+        case kAudioStageDownlink: return "downlink";
+        default: return "unknown";
+    }
+}
+
+std::string LatencyTracer::ToJson() const {
+    std::string json = "{";
+    for (int i = 0; i < kAudioStageCount; i++) {
+        const auto& histogram = histograms_[i];
+        char buffer[128];
+        snprintf(buffer, sizeof(buffer), "%s\"%s\":{\"count\":%lu,\"p50_ms\":%.1f,\"p99_ms\":%.1f,\"max_ms\":%.1f}",
+            i == 0 ? "" : ",", StageName((AudioLatencyStage)i), (unsigned long)histogram.count(),
+            histogram.Percentile(50) / 1000.0f, histogram.Percentile(99) / 1000.0f, histogram.max_us() / 1000.0f);
+        json += buffer;
+    }
+    json += "}";
+    return json;
+}
+
+void LatencyTracer::Print() const {
+    for (int i = 0; i < kAudioStageCount; i++) {
+        const auto& histogram = histograms_[i];
+        if (histogram.count() == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "%-10s count: %6lu p50: %6.1f ms p99: %6.1f ms max: %6.1f ms", StageName((AudioLatencyStage)i),
+            (unsigned long)histogram.count(), histogram.Percentile(50) / 1000.0f, histogram.Percentile(99) / 1000.0f,
+            histogram.max_us() / 1000.0f);
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef LATENCY_TRACER_H
+#define LATENCY_TRACER_H
+
+#include <atomic>
+#include <array>
+#include <string>
+#include <cstdint>
+
+enum AudioLatencyStage {
+    kAudioStageProcessor,       // Samples buffered inside the audio processor (AFE)
+    kAudioStageEncode,          // Processor output -> encoded, including the encode queue
+    kAudioStageSendQueue,       // Encoded -> taken by the network layer
+    kAudioStageDecode,          // Received -> decoded, including the decode queue
+    kAudioStagePlayback,        // Decoded -> written to I2S, including the playback queue
+    kAudioStageDownlink,        // Received -> written to I2S
+    kAudioStageCount,
+};
+
+/*
+ * Semi-logarithmic latency histogram.
+ * Below 4 ms the buckets are 0.5 ms wide, above that every octave up to ~1 s is split into 4 buckets,
+ * so percentiles are accurate to about 25% with a fixed 164 bytes per histogram.
+ */
+class LatencyHistogram {
+public:
+    void Record(uint32_t latency_us);
+    void Reset();
+
+    uint32_t count() const { return count_.load(std::memory_order_relaxed); }
+    uint32_t max_us() const { return max_us_.load(std::memory_order_relaxed); }
+    // Upper bound of the bucket that holds the given percentile (0-100)
+    uint32_t Percentile(int percentile) const;
+
+private:
+    static constexpr uint32_t kLinearLimitUs = 4000;
+    static constexpr uint32_t kLinearBuckets = 8;
+    static constexpr uint32_t kOctaves = 8;
+    static constexpr uint32_t kSubBuckets = 4;
+    static constexpr uint32_t kBucketCount = kLinearBuckets + kOctaves * kSubBuckets + 1;
+
+    static int BucketIndex(uint32_t latency_us);
+    static uint32_t BucketUpperBound(int index);
+
+    std::array<std::atomic<uint32_t>, kBucketCount> buckets_{};
+    std::atomic<uint32_t> count_{0};
+    std::atomic<uint32_t> max_us_{0};
+};
+
+class LatencyTracer {
+public:
+    void Record(AudioLatencyStage stage, uint32_t latency_us) {
+        histograms_[stage].Record(latency_us);
+    }
+    void Reset();
+
+    // {"decode":{"count":..,"p50_ms":..,"p99_ms":..,"max_ms":..}, ...}
+    std::string ToJson() const;
+    void Print() const;
+
+    static const char* StageName(AudioLatencyStage stage);
+    const LatencyHistogram& histogram(AudioLatencyStage stage) const { return histograms_[stage]; }
+
+private:
+    std::array<LatencyHistogram, kAudioStageCount> histograms_;
+};
+
+#endif // LATENCY_TRACER_H
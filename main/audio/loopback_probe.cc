@@ -0,0 +1,65 @@
+#include "loopback_probe.h"
+
+#include <algorithm>
+#include <cmath>
+
+LoopbackProbe::LoopbackProbe(int sample_rate) : sample_rate_(sample_rate) {
+    int samples = sample_rate * kDurationMs / 1000;
+    double duration = (double)samples / sample_rate;
+    double sweep = (kEndHz - kStartHz) / duration;
+    // 5 ms raised cosine fades, so the speaker does not click
+    int fade = sample_rate * 5 / 1000;
+    pcm_.resize(samples);
+    for (int i = 0; i < samples; i++) {
+        double t = (double)i / sample_rate;
+        double value = std::sin(2 * M_PI * (kStartHz * t + 0.5 * sweep * t * t));
+        int edge = std::min(i, samples - 1 - i);
+        if (edge < fade) {
+            value *= 0.5 - 0.5 * std::cos(M_PI * edge / fade);
+        }
+        // About -6 dBFS
+        pcm_[i] = (int16_t)std::lround(value * 16384);
+        energy_ += (double)pcm_[i] * pcm_[i];
+    }
+}
+
+int LoopbackProbe::Find(const int16_t* capture, size_t samples, float min_score, float* score) const {
+    size_t length = pcm_.size();
+    if (samples < length || energy_ == 0) {
+        return -1;
+    }
+
+    // Energy of the capture window under the probe, slid along with the lag
+    double window_energy = 0;
+    for (size_t i = 0; i < length; i++) {
+        window_energy += (double)capture[i] * capture[i];
+    }
+
+    int best_lag = -1;
+    double best_score = 0;
+    for (size_t lag = 0; lag + length <= samples; lag++) {
+        if (lag > 0) {
+            double removed = capture[lag - 1];
+            double added = capture[lag + length - 1];
+            window_energy += added * added - removed * removed;
+        }
+        int64_t acc = 0;
+        const int16_t* x = capture + lag;
+        for (size_t k = 0; k < length; k++) {
+            acc += (int32_t)x[k] * pcm_[k];
+        }
+        if (acc <= 0 || window_energy <= 0) {
+            continue;
+        }
+        double value = acc / std::sqrt(energy_ * window_energy);
+        if (value > best_score) {
+            best_score = value;
+            best_lag = lag;
+        }
+    }
+
+    if (score != nullptr) {
+        *score = best_score;
+    }
+    return best_score >= min_score ? best_lag : -1;
+}
@@ -0,0 +1,34 @@
+#ifndef LOOPBACK_PROBE_H
+#define LOOPBACK_PROBE_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Linear chirp used to measure the acoustic round trip (speaker -> microphone).
+ *
+ * The same chirp is generated at the playback and at the capture sample rate, and located in the
+ * captured audio by normalized cross-correlation, which is robust against the room and the gain.
+ */
+class LoopbackProbe {
+public:
+    static constexpr int kDurationMs = 100;
+    static constexpr int kStartHz = 500;
+    static constexpr int kEndHz = 4000;
+
+    explicit LoopbackProbe(int sample_rate);
+
+    const std::vector<int16_t>& pcm() const { return pcm_; }
+    int sample_rate() const { return sample_rate_; }
+
+    // Sample offset of the probe in the capture, or -1 if the correlation peak is below min_score (0-1)
+    int Find(const int16_t* capture, size_t samples, float min_score, float* score = nullptr) const;
+
+private:
+    int sample_rate_;
+    std::vector<int16_t> pcm_;
+    double energy_ = 0;
+};
+
+#endif // LOOPBACK_PROBE_H
@@ -0,0 +1,145 @@
+#include "model_manager.h"
+#include "assets.h"
+#include "settings.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_wn_models.h>
+#include <algorithm>
+#include <cstring>
+
+#define TAG "ModelManager"
+
+srmodel_list_t* ModelManager::models() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return LoadListLocked();
+}
+
+// esp-sr 只能建一次列表，两个来源只取其一
+srmodel_list_t* ModelManager::LoadListLocked() {
+    if (list_loaded_) {
+        return models_;
+    }
+    list_loaded_ = true;
+
+    auto& assets = Assets::GetInstance();
+    const void* data = nullptr;
+    size_t size = 0;
+    if (assets.available() && assets.GetAssetData("srmodels.bin", data, size)) {
+        models_ = srmodel_load(data);
+        source_ = "assets";
+    } else {
+        models_ = esp_srmodel_init("model");
+        source_ = "model";
+    }
+    if (models_ == nullptr || models_->num <= 0) {
+        ESP_LOGE(TAG, "No models found in the %s partition", source_);
+        models_ = nullptr;
+        return nullptr;
+    }
+    for (int i = 0; i < models_->num; i++) {
+        ESP_LOGI(TAG, "Model %d: %s", i, models_->model_name[i]);
+    }
+    ESP_LOGI(TAG, "%d models from the %s partition", models_->num, source_);
+    return models_;
+}
+
+std::vector<std::string> ModelManager::List(const char* prefix) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::string> names;
+    auto models = LoadListLocked();
+    if (models == nullptr) {
+        return names;
+    }
+    for (int i = 0; i < models->num; i++) {
+        if (prefix == nullptr || strncmp(models->model_name[i], prefix, strlen(prefix)) == 0) {
+            names.push_back(models->model_name[i]);
+        }
+    }
+    return names;
+}
+
+std::string ModelManager::GetWakeWordModel() {
+    auto wakenets = List(ESP_WN_PREFIX);
+    if (wakenets.empty()) {
+        return "";
+    }
+    Settings settings("wake_word");
+    auto selected = settings.GetString("model");
+    for (auto& name : wakenets) {
+        if (name == selected) {
+            return name;
+        }
+    }
+    return wakenets.front();
+}
+
+bool ModelManager::SetWakeWordModel(const std::string& model) {
+    auto wakenets = List(ESP_WN_PREFIX);
+    if (std::find(wakenets.begin(), wakenets.end(), model) == wakenets.end()) {
+        ESP_LOGW(TAG, "No wake word model named %s", model.c_str());
+        return false;
+    }
+    Settings settings("wake_word", true);
+    settings.SetString("model", model);
+    return true;
+}
+
+ModelManager::HeapSnapshot ModelManager::Snapshot() {
+    return {
+        .internal_free = heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+        .psram_free = heap_caps_get_free_size(MALLOC_CAP_SPIRAM),
+    };
+}
+
+void ModelManager::Book(const char* slot, const std::string& model, const HeapSnapshot& start) {
+    auto end = Snapshot();
+    Usage usage = {
+        .model = model,
+        .internal_bytes = (int)start.internal_free - (int)end.internal_free,
+        .psram_bytes = (int)start.psram_free - (int)end.psram_free,
+    };
+    ESP_LOGI(TAG, "Loaded %s %s: %d KB internal, %d KB PSRAM", slot, model.c_str(),
+        usage.internal_bytes / 1024, usage.psram_bytes / 1024);
+    std::lock_guard<std::mutex> lock(mutex_);
+    usage_[slot] = std::move(usage);
+}
+
+void ModelManager::Unload(const char* slot) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = usage_.find(slot);
+    if (it == usage_.end()) {
+        return;
+    }
+    ESP_LOGI(TAG, "Unloaded %s %s", slot, it->second.model.c_str());
+    usage_.erase(it);
+}
+
+std::string ModelManager::ToJson() {
+    auto wake_word = GetWakeWordModel();
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto models = LoadListLocked();
+    std::string json = "{\"source\":\"";
+    json += source_;
+    json += "\",\"models\":[";
+    for (int i = 0; models != nullptr && i < models->num; i++) {
+        json += i == 0 ? "\"" : ",\"";
+        json += models->model_name[i];
+        json += "\"";
+    }
+    json += "],\"wake_word\":\"" + wake_word + "\",\"loaded\":[";
+    int internal_total = 0;
+    int psram_total = 0;
+    bool first = true;
+    for (auto& [slot, usage] : usage_) {
+        char buffer[160];
+        snprintf(buffer, sizeof(buffer), "%s{\"slot\":\"%s\",\"model\":\"%s\",\"internal_bytes\":%d,\"psram_bytes\":%d}",
+            first ? "" : ",", slot.c_str(), usage.model.c_str(), usage.internal_bytes, usage.psram_bytes);
+        json += buffer;
+        internal_total += usage.internal_bytes;
+        psram_total += usage.psram_bytes;
+        first = false;
+    }
+    json += "],\"internal_bytes\":" + std::to_string(internal_total) + ",\"psram_bytes\":" + std::to_string(psram_total) + "}";
+    return json;
+}
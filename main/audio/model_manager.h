@@ -0,0 +1,76 @@
+#ifndef MODEL_MANAGER_H
+#define MODEL_MANAGER_H
+
+#include <model_path.h>
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * The srmodel list of the firmware and the memory the models created from it take.
+ *
+ * esp-sr keeps one static list, every esp_srmodel_init() returns the same pointer and a second
+ * esp_srmodel_deinit() frees it twice, so the wake word, the AFE and MultiNet all get it here and
+ * nobody frees it. A srmodels.bin in the assets partition wins over the model partition, so a wake
+ * word pack can be flashed or upgraded together with the assets. The list only points into mapped
+ * flash; the cost is in the instances, Load() books what their creation took from the heap under a
+ * slot and Unload() drops it when the instance is destroyed.
+ */
+class ModelManager {
+public:
+    static ModelManager& GetInstance() {
+        static ModelManager instance;
+        return instance;
+    }
+    ModelManager(const ModelManager&) = delete;
+    ModelManager& operator=(const ModelManager&) = delete;
+
+    // nullptr when neither the assets nor the model partition holds any model
+    srmodel_list_t* models();
+    // 按名称前缀列出，例如 ESP_WN_PREFIX
+    std::vector<std::string> List(const char* prefix);
+
+    // 选中的 WakeNet，没有设置或当前模型包里没有时为第一个 WakeNet，都没有时为空
+    std::string GetWakeWordModel();
+    bool SetWakeWordModel(const std::string& model);
+
+    // Runs create() and books the heap it took, other tasks allocating at the same time make it approximate
+    template <typename Create>
+    auto Load(const char* slot, const std::string& model, Create&& create) {
+        auto start = Snapshot();
+        auto result = create();
+        Book(slot, model, start);
+        return result;
+    }
+    void Unload(const char* slot);
+
+    std::string ToJson();
+
+private:
+    struct Usage {
+        std::string model;
+        int internal_bytes;
+        int psram_bytes;
+    };
+    struct HeapSnapshot {
+        size_t internal_free;
+        size_t psram_free;
+    };
+
+    ModelManager() = default;
+
+    HeapSnapshot Snapshot();
+    void Book(const char* slot, const std::string& model, const HeapSnapshot& start);
+    srmodel_list_t* LoadListLocked();
+
+    std::mutex mutex_;
+    bool list_loaded_ = false;
+    srmodel_list_t* models_ = nullptr;
+    const char* source_ = "none";
+    std::map<std::string, Usage> usage_;
+};
+
+#endif // MODEL_MANAGER_H
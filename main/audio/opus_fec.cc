@@ -0,0 +1,142 @@
+#include "opus_fec.h"
+
+#include <esp_log.h>
+
+#define TAG "OpusFec"
+
+#define OPUS_FEC_MAX_PACKET_SIZE 1000
+
+OpusFecEncoder::OpusFecEncoder(int sample_rate, int channels, int duration_ms)
+    : sample_rate_(sample_rate), duration_ms_(duration_ms), channels_(channels) {
+    int error;
+    encoder_ = opus_encoder_create(sample_rate, channels, OPUS_APPLICATION_VOIP, &error);
+    if (encoder_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create audio encoder, error code: %d", error);
+        return;
+    }
+    opus_encoder_ctl(encoder_, OPUS_SET_DTX(1));
+    opus_encoder_ctl(encoder_, OPUS_SET_COMPLEXITY(0));
+    frame_size_ = sample_rate / 1000 * channels * duration_ms;
+}
+
+OpusFecEncoder::~OpusFecEncoder() {
+    if (encoder_ != nullptr) {
+        opus_encoder_destroy(encoder_);
+    }
+}
+
+void OpusFecEncoder::SetDuration(int duration_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    duration_ms_ = duration_ms;
+    frame_size_ = sample_rate_ / 1000 * channels_ * duration_ms;
+}
+
+void OpusFecEncoder::SetDtx(bool enable) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_DTX(enable ? 1 : 0));
+    }
+}
+
+void OpusFecEncoder::SetComplexity(int complexity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_COMPLEXITY(complexity));
+    }
+}
+
+void OpusFecEncoder::SetPacketLoss(int percent) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoder_ == nullptr || percent == packet_loss_) {
+        return;
+    }
+    // 丢包率决定 FEC 副本的码率，不设置时 opus 不会真正写入 FEC 数据
+    opus_encoder_ctl(encoder_, OPUS_SET_INBAND_FEC(percent > 0 ? 1 : 0));
+    opus_encoder_ctl(encoder_, OPUS_SET_PACKET_LOSS_PERC(percent));
+    packet_loss_ = percent;
+}
+
+bool OpusFecEncoder::Encode(std::vector<int16_t>&& pcm, std::vector<uint8_t>& opus) {
+    if (encoder_ == nullptr) {
+        ESP_LOGE(TAG, "Audio encoder is not configured");
+        return false;
+    }
+    if ((int)pcm.size() != frame_size_) {
+        ESP_LOGE(TAG, "Audio data size is not equal to frame size, size: %u, frame size: %d", pcm.size(), frame_size_);
+        return false;
+    }
+
+    uint8_t buffer[OPUS_FEC_MAX_PACKET_SIZE];
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto ret = opus_encode(encoder_, pcm.data(), frame_size_, buffer, sizeof(buffer));
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to encode audio, error code: %ld", (long)ret);
+        return false;
+    }
+    opus.assign(buffer, buffer + ret);
+    return true;
+}
+
+void OpusFecEncoder::ResetState() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_RESET_STATE);
+    }
+}
+
+OpusFecDecoder::OpusFecDecoder(int sample_rate, int channels, int duration_ms)
+    : sample_rate_(sample_rate), duration_ms_(duration_ms) {
+    int error;
+    decoder_ = opus_decoder_create(sample_rate, channels, &error);
+    if (decoder_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create audio decoder, error code: %d", error);
+        return;
+    }
+    frame_size_ = sample_rate / 1000 * channels * duration_ms;
+}
+
+OpusFecDecoder::~OpusFecDecoder() {
+    if (decoder_ != nullptr) {
+        opus_decoder_destroy(decoder_);
+    }
+}
+
+bool OpusFecDecoder::Decode(std::vector<uint8_t>&& opus, std::vector<int16_t>& pcm) {
+    return Decode(opus.data(), opus.size(), pcm);
+}
+
+bool OpusFecDecoder::Decode(const uint8_t* opus, size_t size, std::vector<int16_t>& pcm) {
+    if (decoder_ == nullptr) {
+        ESP_LOGE(TAG, "Audio decoder is not configured");
+        return false;
+    }
+    pcm.resize(frame_size_);
+    auto ret = opus_decode(decoder_, size == 0 ? nullptr : opus, size, pcm.data(), frame_size_, 0);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to decode audio, error code: %d", ret);
+        return false;
+    }
+    pcm.resize(ret);
+    return true;
+}
+
+bool OpusFecDecoder::DecodeFec(const std::vector<uint8_t>& next, std::vector<int16_t>& pcm) {
+    if (decoder_ == nullptr || opus_packet_has_lbrr(next.data(), next.size()) <= 0) {
+        return false;
+    }
+    // 帧长必须是整帧，opus 从下一包里取出 FEC 数据，next 本身之后照常解码
+    pcm.resize(frame_size_);
+    auto ret = opus_decode(decoder_, next.data(), next.size(), pcm.data(), frame_size_, 1);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to decode FEC, error code: %d", ret);
+        return false;
+    }
+    pcm.resize(ret);
+    return true;
+}
+
+void OpusFecDecoder::ResetState() {
+    if (decoder_ != nullptr) {
+        opus_decoder_ctl(decoder_, OPUS_RESET_STATE);
+    }
+}
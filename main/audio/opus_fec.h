@@ -0,0 +1,68 @@
+#ifndef OPUS_FEC_H
+#define OPUS_FEC_H
+
+#include <vector>
+#include <cstdint>
+#include <mutex>
+
+#include "opus.h"
+
+/*
+ * Opus encoder and decoder of the voice path with in-band FEC, which the esp-opus-encoder wrappers do
+ * not expose. With FEC on, each packet also carries a low bitrate copy of the previous frame (SILK
+ * only, which is what 16 kHz VOIP speech uses), so one lost packet is rebuilt from the next one
+ * instead of being concealed. It costs bitrate, so the encoder only turns it on at the loss rate the
+ * network monitor measures.
+ */
+class OpusFecEncoder {
+public:
+    OpusFecEncoder(int sample_rate, int channels, int duration_ms);
+    ~OpusFecEncoder();
+
+    int sample_rate() const { return sample_rate_; }
+    int duration_ms() const { return duration_ms_; }
+
+    // The opus state does not depend on the frame size, so the duration changes between two frames
+    void SetDuration(int duration_ms);
+    void SetDtx(bool enable);
+    void SetComplexity(int complexity);
+    // 预期丢包率，0 关闭 FEC
+    void SetPacketLoss(int percent);
+    int packet_loss() const { return packet_loss_; }
+    bool Encode(std::vector<int16_t>&& pcm, std::vector<uint8_t>& opus);
+    void ResetState();
+
+private:
+    std::mutex mutex_;
+    OpusEncoder* encoder_ = nullptr;
+    int sample_rate_;
+    int duration_ms_;
+    int channels_;
+    int frame_size_;
+    int packet_loss_ = 0;
+};
+
+class OpusFecDecoder {
+public:
+    OpusFecDecoder(int sample_rate, int channels, int duration_ms);
+    ~OpusFecDecoder();
+
+    int sample_rate() const { return sample_rate_; }
+    int duration_ms() const { return duration_ms_; }
+
+    // An empty packet runs packet loss concealment
+    bool Decode(std::vector<uint8_t>&& opus, std::vector<int16_t>& pcm);
+    // Decodes straight from memory the caller keeps valid for the call, e.g. a borrowed embedded frame
+    bool Decode(const uint8_t* opus, size_t size, std::vector<int16_t>& pcm);
+    // Rebuild the lost frame before next from the FEC data in next, false if next carries none
+    bool DecodeFec(const std::vector<uint8_t>& next, std::vector<int16_t>& pcm);
+    void ResetState();
+
+private:
+    OpusDecoder* decoder_ = nullptr;
+    int sample_rate_;
+    int duration_ms_;
+    int frame_size_;
+};
+
+#endif // OPUS_FEC_H
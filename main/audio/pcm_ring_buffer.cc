@@ -0,0 +1,49 @@
+#include "pcm_ring_buffer.h"
+
+#include <esp_log.h>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "PcmRingBuffer"
+
+PcmRingBuffer::PcmRingBuffer(AudioMemoryOwner owner, size_t capacity) : owner_(owner), capacity_(capacity) {
+}
+
+void PcmRingBuffer::Write(const int16_t* data, size_t samples) {
+    if (!buffer_) {
+        buffer_ = AudioBuffer(owner_, capacity_ * sizeof(int16_t));
+        if (!buffer_) {
+            buffer_ = AudioBuffer(owner_, capacity_ * sizeof(int16_t), MALLOC_CAP_8BIT);
+        }
+        if (!buffer_) {
+            ESP_LOGE(TAG, "Failed to allocate %u samples", capacity_);
+            return;
+        }
+    }
+
+    written_ += samples;
+    // 只保留最后 capacity_ 个采样
+    if (samples > capacity_) {
+        data += samples - capacity_;
+        samples = capacity_;
+    }
+    auto pcm = buffer_.data<int16_t>();
+    size_t first = std::min(samples, capacity_ - head_);
+    memcpy(pcm + head_, data, first * sizeof(int16_t));
+    memcpy(pcm, data + first, (samples - first) * sizeof(int16_t));
+    head_ = (head_ + samples) % capacity_;
+    size_ = std::min(size_ + samples, capacity_);
+}
+
+size_t PcmRingBuffer::Read(size_t offset, int16_t* out, size_t samples) const {
+    if (offset >= size_) {
+        return 0;
+    }
+    samples = std::min(samples, size_ - offset);
+    auto pcm = buffer_.data<int16_t>();
+    size_t start = (head_ + capacity_ - size_ + offset) % capacity_;
+    size_t first = std::min(samples, capacity_ - start);
+    memcpy(out, pcm + start, first * sizeof(int16_t));
+    memcpy(out + first, pcm, (samples - first) * sizeof(int16_t));
+    return samples;
+}
@@ -0,0 +1,37 @@
+#ifndef PCM_RING_BUFFER_H
+#define PCM_RING_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "audio_memory.h"
+
+/*
+ * Fixed-size ring of the most recent PCM samples, e.g. the wake word pre-roll.
+ *
+ * The storage is allocated once on the first write, in PSRAM when available, and the oldest samples
+ * are overwritten afterwards, so keeping the history costs no allocation per frame. Not locked: the
+ * writer must be stopped while the samples are read, as the wake word detection is after a detection.
+ */
+class PcmRingBuffer {
+public:
+    PcmRingBuffer(AudioMemoryOwner owner, size_t capacity);
+
+    void Write(const int16_t* data, size_t samples);
+    // Copies up to samples starting at offset, counted from the oldest sample, returns the count
+    size_t Read(size_t offset, int16_t* out, size_t samples) const;
+    void Clear() { head_ = 0; size_ = 0; }
+    size_t size() const { return size_; }
+    // Samples written since the creation, for readers that follow the writer
+    uint64_t written() const { return written_; }
+
+private:
+    AudioMemoryOwner owner_;
+    size_t capacity_;
+    AudioBuffer buffer_;
+    size_t head_ = 0;       // Next sample to write
+    size_t size_ = 0;
+    uint64_t written_ = 0;
+};
+
+#endif // PCM_RING_BUFFER_H
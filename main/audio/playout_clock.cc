@@ -0,0 +1,31 @@
+#include "playout_clock.h"
+
+void PlayoutClock::Record(uint32_t timestamp, int64_t start_us, int64_t duration_us) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_[next_] = {start_us, start_us + duration_us, timestamp};
+    next_ = (next_ + 1) % kEntries;
+    if (count_ < kEntries) {
+        count_++;
+    }
+}
+
+uint32_t PlayoutClock::Lookup(int64_t time_us) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // 从最新的一帧往前找
+    for (size_t i = 1; i <= count_; i++) {
+        const Entry& entry = entries_[(next_ + kEntries - i) % kEntries];
+        if (time_us >= entry.end_us) {
+            return 0;
+        }
+        if (time_us >= entry.start_us) {
+            return entry.timestamp + (uint32_t)((time_us - entry.start_us) / 1000);
+        }
+    }
+    return 0;
+}
+
+void PlayoutClock::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    next_ = 0;
+    count_ = 0;
+}
@@ -0,0 +1,38 @@
+#ifndef PLAYOUT_CLOCK_H
+#define PLAYOUT_CLOCK_H
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+
+/*
+ * Maps local time to the stream timestamp of the audio that was coming out of the speaker.
+ *
+ * The output task records, for every played frame, when its first sample leaves the DMA buffers and
+ * for how long it plays. A captured frame then looks up the timestamp that was audible at its capture
+ * time, interpolated inside the frame, instead of taking the next queued timestamp. The alignment
+ * therefore no longer depends on how many frames are waiting in the playback path.
+ */
+class PlayoutClock {
+public:
+    void Record(uint32_t timestamp, int64_t start_us, int64_t duration_us);
+    // 0 if nothing with a timestamp was playing at that time
+    uint32_t Lookup(int64_t time_us);
+    void Reset();
+
+private:
+    struct Entry {
+        int64_t start_us;
+        int64_t end_us;
+        uint32_t timestamp;
+    };
+    // 覆盖 DMA 缓冲和处理器的延迟即可
+    static constexpr size_t kEntries = 16;
+
+    std::mutex mutex_;
+    std::array<Entry, kEntries> entries_;
+    size_t next_ = 0;
+    size_t count_ = 0;
+};
+
+#endif // PLAYOUT_CLOCK_H
@@ -0,0 +1,93 @@
+#include "polyphase_resampler.h"
+
+#include <esp_log.h>
+#include <algorithm>
+#include <cmath>
+
+#define TAG "PolyphaseResampler"
+
+void PolyphaseResampler::Configure(int input_sample_rate, int output_sample_rate) {
+    if (input_sample_rate <= 0 || output_sample_rate <= 0) {
+        ESP_LOGE(TAG, "Invalid sample rates: %d -> %d", input_sample_rate, output_sample_rate);
+        return;
+    }
+    input_sample_rate_ = input_sample_rate;
+    output_sample_rate_ = output_sample_rate;
+    step_ = ((uint64_t)input_sample_rate << 32) / output_sample_rate;
+
+    // Cutoff relative to the input rate, a little below Nyquist to leave room for the transition band
+    double cutoff = 0.45 * std::min(1.0, (double)output_sample_rate / input_sample_rate);
+    // One extra phase at a fraction of 1.0, so every phase has a right neighbour to interpolate with
+    coefficients_.resize((kPhases + 1) * kTaps);
+    for (int phase = 0; phase <= kPhases; phase++) {
+        double fraction = (double)phase / kPhases;
+        double taps[kTaps];
+        double sum = 0;
+        for (int k = 0; k < kTaps; k++) {
+            // Distance of this tap from the interpolated sample, in input samples
+            double x = k - (kTaps / 2 - 1) - fraction;
+            double sinc = x == 0 ? 1.0 : std::sin(2 * M_PI * cutoff * x) / (2 * M_PI * cutoff * x);
+            // Blackman window over the filter span
+            double w = (x + kTaps / 2.0) / kTaps;
+            double window = w <= 0 || w >= 1 ? 0 : 0.42 - 0.5 * std::cos(2 * M_PI * w) + 0.08 * std::cos(4 * M_PI * w);
+            taps[k] = sinc * window;
+            sum += taps[k];
+        }
+        // Normalize every phase to unity gain so there is no ripple between phases
+        for (int k = 0; k < kTaps; k++) {
+            coefficients_[phase * kTaps + k] = (int16_t)std::lround(taps[k] / sum * (1 << 14));
+        }
+    }
+    Reset();
+}
+
+void PolyphaseResampler::Reset() {
+    history_.assign(kTaps - 1, 0);
+    position_ = 0;
+}
+
+size_t PolyphaseResampler::GetMaxOutputSamples(size_t input_samples) const {
+    if (input_sample_rate_ == 0) {
+        return 0;
+    }
+    return (history_.size() + input_samples) * (uint64_t)output_sample_rate_ / input_sample_rate_ + 2;
+}
+
+void PolyphaseResampler::Process(const int16_t* input, size_t samples, std::vector<int16_t>& output) {
+    output.clear();
+    if (step_ == 0) {
+        return;
+    }
+    output.reserve(GetMaxOutputSamples(samples));
+    history_.insert(history_.end(), input, input + samples);
+
+    const size_t available = history_.size();
+    const int16_t* data = history_.data();
+    while (true) {
+        size_t index = position_ >> 32;
+        if (index + kTaps > available) {
+            break;
+        }
+        uint32_t fraction = (uint32_t)position_;
+        int phase = fraction >> (32 - kPhaseBits);
+        // Blend the two nearest phases by the remaining fraction, Q15
+        int32_t blend = (fraction >> (32 - kPhaseBits - 15)) & 0x7fff;
+        const int16_t* c0 = &coefficients_[phase * kTaps];
+        const int16_t* c1 = c0 + kTaps;
+        const int16_t* x = data + index;
+        int32_t acc0 = 0;
+        int32_t acc1 = 0;
+        for (int k = 0; k < kTaps; k++) {
+            acc0 += x[k] * c0[k];
+            acc1 += x[k] * c1[k];
+        }
+        int32_t sample = (acc0 + (int32_t)(((int64_t)(acc1 - acc0) * blend) >> 15) + (1 << 13)) >> 14;
+        output.push_back(std::clamp<int32_t>(sample, INT16_MIN, INT16_MAX));
+        position_ += step_;
+    }
+
+    // Keep the samples the next output still needs
+    size_t consumed = std::min<size_t>(position_ >> 32, available);
+    history_.erase(history_.begin(), history_.begin() + consumed);
+    position_ -= (uint64_t)consumed << 32;
+}
@@ -0,0 +1,41 @@
+#ifndef POLYPHASE_RESAMPLER_H
+#define POLYPHASE_RESAMPLER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Fixed-point polyphase resampler for arbitrary ratios (e.g. 22050 / 44100 Hz music to the codec rate).
+ *
+ * A windowed-sinc filter is precomputed for kPhases sub-sample phases, with the cutoff at the lower
+ * of the two Nyquist frequencies, and the two nearest phases are blended for each output sample.
+ * The read position is a 32.32 fixed-point input index, so any ratio is handled without drift.
+ * Mono int16 in and out, streaming across calls.
+ */
+class PolyphaseResampler {
+public:
+    static constexpr int kTaps = 24;
+    static constexpr int kPhaseBits = 7;
+    static constexpr int kPhases = 1 << kPhaseBits;
+
+    void Configure(int input_sample_rate, int output_sample_rate);
+    void Reset();
+
+    // Output is resized to the produced samples, its capacity is kept across calls
+    void Process(const int16_t* input, size_t samples, std::vector<int16_t>& output);
+    size_t GetMaxOutputSamples(size_t input_samples) const;
+
+    int input_sample_rate() const { return input_sample_rate_; }
+    int output_sample_rate() const { return output_sample_rate_; }
+
+private:
+    int input_sample_rate_ = 0;
+    int output_sample_rate_ = 0;
+    uint64_t step_ = 0;         // Input samples per output sample, Q32
+    uint64_t position_ = 0;     // Read position in history_, Q32
+    std::vector<int16_t> coefficients_;     // (kPhases + 1) x kTaps, Q14
+    std::vector<int16_t> history_;          // Unconsumed input, starts with the filter history
+};
+
+#endif // POLYPHASE_RESAMPLER_H
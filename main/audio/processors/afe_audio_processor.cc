@@ -1,10 +1,19 @@
 #include "afe_audio_processor.h"
+#include "model_manager.h"
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+#if CONFIG_USE_SHARED_AFE
+#include "shared_afe.h"
+#endif
 
 #define PROCESSOR_RUNNING 0x01
 
 #define TAG "AfeAudioProcessor"
 
+// 运行时每隔 10 秒打印一次 AFE 的 CPU 占用
+#define AFE_LOAD_REPORT_INTERVAL_US (10 * 1000 * 1000)
+
 AfeAudioProcessor::AfeAudioProcessor()
     : afe_data_(nullptr) {
     event_group_ = xEventGroupCreate();
@@ -13,21 +22,25 @@ AfeAudioProcessor::AfeAudioProcessor()
 void AfeAudioProcessor::Initialize(AudioCodec* codec, int frame_duration_ms) {
     codec_ = codec;
     frame_samples_ = frame_duration_ms * 16000 / 1000;
+    pending_frame_samples_ = frame_samples_;
 
-    // Pre-allocate output buffer capacity
-    output_buffer_.reserve(frame_samples_);
-
-    int ref_num = codec_->input_reference() ? 1 : 0;
+    output_buffer_.resize(frame_samples_);
+    output_fill_ = 0;
 
-    std::string input_format;
-    for (int i = 0; i < codec_->input_channels() - ref_num; i++) {
-        input_format.push_back('M');
-    }
-    for (int i = 0; i < ref_num; i++) {
-        input_format.push_back('R');
+#if CONFIG_USE_SHARED_AFE
+    auto& shared_afe = SharedAfe::GetInstance();
+    if (!shared_afe.Initialize(codec_)) {
+        return;
     }
+    afe_iface_ = shared_afe.iface();
+    afe_data_ = shared_afe.data();
+    shared_afe.OnFetch(SharedAfe::kClientVoice, [this](afe_fetch_result_t* res) {
+        ProcessFetchResult(res);
+    });
+#else
+    std::string input_format = codec_->input_format();
 
-    srmodel_list_t *models = esp_srmodel_init("model");
+    srmodel_list_t *models = ModelManager::GetInstance().models();
     char* ns_model_name = esp_srmodel_filter(models, ESP_NSNET_PREFIX, NULL);
     char* vad_model_name = esp_srmodel_filter(models, ESP_VADN_PREFIX, NULL);
     
@@ -51,6 +64,8 @@ void AfeAudioProcessor::Initialize(AudioCodec* codec, int frame_duration_ms) {
     afe_config->afe_perferred_priority = 1;
     afe_config->agc_init = false;
     afe_config->memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM;
+    // 多个麦克风时用 BSS 分离声源，再由 MISO 选出语音最清晰的一路
+    afe_config->se_init = codec_->input_mics() > 1;
 
 #ifdef CONFIG_USE_DEVICE_AEC
     afe_config->aec_init = true;
@@ -61,22 +76,34 @@ void AfeAudioProcessor::Initialize(AudioCodec* codec, int frame_duration_ms) {
 #endif
 
     afe_iface_ = esp_afe_handle_from_config(afe_config);
-    afe_data_ = afe_iface_->create_from_config(afe_config);
+    afe_data_ = ModelManager::GetInstance().Load("voice_afe", ns_model_name != nullptr ? ns_model_name : "afe", [&]() {
+        return afe_iface_->create_from_config(afe_config);
+    });
+    ESP_LOGI(TAG, "Input format: %s, %d mic(s)", input_format.c_str(), codec_->input_mics());
+    afe_iface_->print_pipeline(afe_data_);
     
     xTaskCreate([](void* arg) {
         auto this_ = (AfeAudioProcessor*)arg;
         this_->AudioProcessorTask();
         vTaskDelete(NULL);
     }, "audio_communication", 4096, this, 3, NULL);
+#endif
 }
 
 AfeAudioProcessor::~AfeAudioProcessor() {
+#if !CONFIG_USE_SHARED_AFE
     if (afe_data_ != nullptr) {
         afe_iface_->destroy(afe_data_);
+        ModelManager::GetInstance().Unload("voice_afe");
     }
+#endif
     vEventGroupDelete(event_group_);
 }
 
+void AfeAudioProcessor::SetFrameDuration(int frame_duration_ms) {
+    pending_frame_samples_ = frame_duration_ms * 16000 / 1000;
+}
+
 size_t AfeAudioProcessor::GetFeedSize() {
     if (afe_data_ == nullptr) {
         return 0;
@@ -88,22 +115,36 @@ void AfeAudioProcessor::Feed(std::vector<int16_t>&& data) {
     if (afe_data_ == nullptr) {
         return;
     }
+    int64_t start_time = esp_timer_get_time();
     afe_iface_->feed(afe_data_, data.data());
+    feed_time_us_ += esp_timer_get_time() - start_time;
 }
 
 void AfeAudioProcessor::Start() {
+#if CONFIG_USE_SHARED_AFE
+    SharedAfe::GetInstance().Start(SharedAfe::kClientVoice);
+#else
     xEventGroupSetBits(event_group_, PROCESSOR_RUNNING);
+#endif
 }
 
 void AfeAudioProcessor::Stop() {
+#if CONFIG_USE_SHARED_AFE
+    SharedAfe::GetInstance().Stop(SharedAfe::kClientVoice);
+#else
     xEventGroupClearBits(event_group_, PROCESSOR_RUNNING);
     if (afe_data_ != nullptr) {
         afe_iface_->reset_buffer(afe_data_);
     }
+#endif
 }
 
 bool AfeAudioProcessor::IsRunning() {
+#if CONFIG_USE_SHARED_AFE
+    return SharedAfe::GetInstance().IsRunning(SharedAfe::kClientVoice);
+#else
     return xEventGroupGetBits(event_group_) & PROCESSOR_RUNNING;
+#endif
 }
 
 void AfeAudioProcessor::OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) {
@@ -134,40 +175,72 @@ void AfeAudioProcessor::AudioProcessorTask() {
             continue;
         }
 
-        // VAD state change
-        if (vad_state_change_callback_) {
-            if (res->vad_state == VAD_SPEECH && !is_speaking_) {
-                is_speaking_ = true;
-                vad_state_change_callback_(true);
-            } else if (res->vad_state == VAD_SILENCE && is_speaking_) {
-                is_speaking_ = false;
-                vad_state_change_callback_(false);
-            }
+        ProcessFetchResult(res);
+    }
+}
+
+void AfeAudioProcessor::ProcessFetchResult(afe_fetch_result_t* res) {
+    ReportCpuLoad();
+
+    // VAD state change
+    if (vad_state_change_callback_) {
+        if (res->vad_state == VAD_SPEECH && !is_speaking_) {
+            is_speaking_ = true;
+            vad_state_change_callback_(true);
+        } else if (res->vad_state == VAD_SILENCE && is_speaking_) {
+            is_speaking_ = false;
+            vad_state_change_callback_(false);
         }
+    }
 
-        if (output_callback_) {
-            size_t samples = res->data_size / sizeof(int16_t);
-            
-            // Add data to buffer
-            output_buffer_.insert(output_buffer_.end(), res->data, res->data + samples);
-            
-            // Output complete frames when buffer has enough data
-            while (output_buffer_.size() >= frame_samples_) {
-                if (output_buffer_.size() == frame_samples_) {
-                    // If buffer size equals frame size, move the entire buffer
-                    output_callback_(std::move(output_buffer_));
-                    output_buffer_.clear();
-                    output_buffer_.reserve(frame_samples_);
-                } else {
-                    // If buffer size exceeds frame size, copy one frame and remove it
-                    output_callback_(std::vector<int16_t>(output_buffer_.begin(), output_buffer_.begin() + frame_samples_));
-                    output_buffer_.erase(output_buffer_.begin(), output_buffer_.begin() + frame_samples_);
-                }
+    if (output_callback_) {
+        const int16_t* data = res->data;
+        size_t samples = res->data_size / sizeof(int16_t);
+
+        // Copy straight into the pending frame and hand it over once full. The encode queue swaps in the
+        // buffer of a recycled task, so the next frame is usually filled without any allocation.
+        while (samples > 0) {
+            if (output_fill_ == 0) {
+                frame_samples_ = pending_frame_samples_;
+            }
+            if (output_buffer_.size() != frame_samples_) {
+                output_buffer_.resize(frame_samples_);
+            }
+            size_t n = std::min(samples, frame_samples_ - output_fill_);
+            std::copy(data, data + n, output_buffer_.begin() + output_fill_);
+            output_fill_ += n;
+            data += n;
+            samples -= n;
+            if (output_fill_ == frame_samples_) {
+                output_fill_ = 0;
+                output_callback_(std::move(output_buffer_));
             }
         }
     }
 }
 
+/* AEC runs in feed() on the input task, the rest of the pipeline in fetch() on this task */
+void AfeAudioProcessor::ReportCpuLoad() {
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    int64_t now = esp_timer_get_time();
+    int64_t elapsed = now - load_report_time_us_;
+    if (load_report_time_us_ != 0 && elapsed < AFE_LOAD_REPORT_INTERVAL_US) {
+        return;
+    }
+    uint32_t feed_time_us = feed_time_us_;
+    uint32_t task_time = ulTaskGetRunTimeCounter(xTaskGetCurrentTaskHandle());
+    // 停止期间的间隔不计入
+    if (load_report_time_us_ != 0 && elapsed < AFE_LOAD_REPORT_INTERVAL_US * 2) {
+        ESP_LOGI(TAG, "CPU load with %d mic(s): feed %.1f%%, fetch %.1f%%", codec_->input_mics(),
+            (uint32_t)(feed_time_us - last_feed_time_us_) * 100.0f / elapsed,
+            (uint32_t)(task_time - last_task_time_) * 100.0f / elapsed);
+    }
+    load_report_time_us_ = now;
+    last_feed_time_us_ = feed_time_us;
+    last_task_time_ = task_time;
+#endif
+}
+
 void AfeAudioProcessor::EnableDeviceAec(bool enable) {
     if (enable) {
 #if CONFIG_USE_DEVICE_AEC
@@ -177,7 +250,14 @@ void AfeAudioProcessor::EnableDeviceAec(bool enable) {
         ESP_LOGE(TAG, "Device AEC is not supported");
 #endif
     } else {
+#if CONFIG_USE_SHARED_AFE
+        // 共享实例的 AEC 也服务于唤醒词，有回采时保持开启
+        if (!codec_->input_reference()) {
+            afe_iface_->disable_aec(afe_data_);
+        }
+#else
         afe_iface_->disable_aec(afe_data_);
+#endif
         afe_iface_->enable_vad(afe_data_);
     }
 }
@@ -6,6 +6,7 @@
 #include <freertos/task.h>
 #include <freertos/event_groups.h>
 
+#include <atomic>
 #include <string>
 #include <vector>
 #include <functional>
@@ -19,6 +20,7 @@ public:
     ~AfeAudioProcessor();
 
     void Initialize(AudioCodec* codec, int frame_duration_ms) override;
+    void SetFrameDuration(int frame_duration_ms) override;
     void Feed(std::vector<int16_t>&& data) override;
     void Start() override;
     void Stop() override;
@@ -35,11 +37,21 @@ private:
     std::function<void(std::vector<int16_t>&& data)> output_callback_;
     std::function<void(bool speaking)> vad_state_change_callback_;
     AudioCodec* codec_ = nullptr;
-    int frame_samples_ = 0;
+    size_t frame_samples_ = 0;
+    // Picked up by the fetch task at the next frame boundary
+    std::atomic<size_t> pending_frame_samples_{0};
     bool is_speaking_ = false;
     std::vector<int16_t> output_buffer_;
+    size_t output_fill_ = 0;
+    // CPU 占用统计，单位为微秒
+    std::atomic<uint32_t> feed_time_us_{0};
+    uint32_t last_feed_time_us_ = 0;
+    uint32_t last_task_time_ = 0;
+    int64_t load_report_time_us_ = 0;
 
     void AudioProcessorTask();
+    void ProcessFetchResult(afe_fetch_result_t* res);
+    void ReportCpuLoad();
 };
 
 #endif 
\ No newline at end of file
@@ -3,47 +3,123 @@
 
 #if CONFIG_USE_AUDIO_DEBUGGER
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <errno.h>
 #include <cstring>
 #include <string>
+#include <algorithm>
 #endif
 
 #define TAG "AudioDebugger"
 
+#define AUDIO_DEBUG_MAGIC 0x44415a58  // "XZAD"
+#define AUDIO_DEBUG_VERSION 1
+#define AUDIO_DEBUG_DROP_LOG_INTERVAL_MS 5000
+
+#if CONFIG_USE_AUDIO_DEBUGGER
+static const int16_t kAdpcmStepTable[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97,
+    107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871,
+    5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623,
+    27086, 29794, 32767,
+};
+static const int8_t kAdpcmIndexTable[16] = {-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8};
+
+static uint8_t EncodeAdpcmSample(int16_t sample, int16_t& predictor, uint8_t& step_index) {
+    int step = kAdpcmStepTable[step_index];
+    int diff = sample - predictor;
+    uint8_t code = 0;
+    if (diff < 0) {
+        code = 8;
+        diff = -diff;
+    }
+    int delta = step >> 3;
+    if (diff >= step) {
+        code |= 4;
+        diff -= step;
+        delta += step;
+    }
+    step >>= 1;
+    if (diff >= step) {
+        code |= 2;
+        diff -= step;
+        delta += step;
+    }
+    step >>= 1;
+    if (diff >= step) {
+        code |= 1;
+        delta += step;
+    }
+    predictor = std::clamp<int>((code & 8) ? predictor - delta : predictor + delta, INT16_MIN, INT16_MAX);
+    step_index = std::clamp<int>(step_index + kAdpcmIndexTable[code], 0, 88);
+    return code;
+}
+#endif
 
 AudioDebugger::AudioDebugger() {
 #if CONFIG_USE_AUDIO_DEBUGGER
-    udp_sockfd_ = socket(AF_INET, SOCK_DGRAM, 0);
-    if (udp_sockfd_ >= 0) {
-        // 解析配置的服务器地址 "IP:PORT"
-        std::string server_addr = CONFIG_AUDIO_DEBUG_UDP_SERVER;
-        size_t colon_pos = server_addr.find(':');
-        
-        if (colon_pos != std::string::npos) {
-            std::string ip = server_addr.substr(0, colon_pos);
-            int port = std::stoi(server_addr.substr(colon_pos + 1));
-            
-            memset(&udp_server_addr_, 0, sizeof(udp_server_addr_));
-            udp_server_addr_.sin_family = AF_INET;
-            udp_server_addr_.sin_port = htons(port);
-            inet_pton(AF_INET, ip.c_str(), &udp_server_addr_.sin_addr);
-            
-            ESP_LOGI(TAG, "Initialized server address: %s", CONFIG_AUDIO_DEBUG_UDP_SERVER);
-        } else {
-            ESP_LOGW(TAG, "Invalid server address: %s, should be IP:PORT", CONFIG_AUDIO_DEBUG_UDP_SERVER);
-            close(udp_sockfd_);
-            udp_sockfd_ = -1;
-        }
-    } else {
-        ESP_LOGW(TAG, "Failed to create UDP socket: %d", errno);
+    // 解析配置的服务器地址 "IP:PORT"
+    std::string server_addr = CONFIG_AUDIO_DEBUG_UDP_SERVER;
+    size_t colon_pos = server_addr.find(':');
+    if (colon_pos == std::string::npos) {
+        ESP_LOGW(TAG, "Invalid server address: %s, should be IP:PORT", CONFIG_AUDIO_DEBUG_UDP_SERVER);
+        return;
     }
+    std::string ip = server_addr.substr(0, colon_pos);
+    int port = std::stoi(server_addr.substr(colon_pos + 1));
+    memset(&udp_server_addr_, 0, sizeof(udp_server_addr_));
+    udp_server_addr_.sin_family = AF_INET;
+    udp_server_addr_.sin_port = htons(port);
+    inet_pton(AF_INET, ip.c_str(), &udp_server_addr_.sin_addr);
+
+#if CONFIG_AUDIO_DEBUG_MIC_INPUT
+    point_mask_ |= 1 << kAudioDebugMicInput;
+#endif
+#if CONFIG_AUDIO_DEBUG_REFERENCE
+    point_mask_ |= 1 << kAudioDebugReference;
+#endif
+#if CONFIG_AUDIO_DEBUG_PROCESSOR_OUTPUT
+    point_mask_ |= 1 << kAudioDebugProcessorOutput;
+#endif
+#if CONFIG_AUDIO_DEBUG_DECODED
+    point_mask_ |= 1 << kAudioDebugDecoded;
+#endif
+#if CONFIG_AUDIO_DEBUG_OUTPUT
+    point_mask_ |= 1 << kAudioDebugOutput;
+#endif
+
+#if CONFIG_SPIRAM
+    ring_ = xRingbufferCreateWithCaps(CONFIG_AUDIO_DEBUG_RING_KB * 1024, RINGBUF_TYPE_NOSPLIT, MALLOC_CAP_SPIRAM);
+#else
+    ring_ = xRingbufferCreate(CONFIG_AUDIO_DEBUG_RING_KB * 1024, RINGBUF_TYPE_NOSPLIT);
+#endif
+    if (ring_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create %d KB ring buffer", CONFIG_AUDIO_DEBUG_RING_KB);
+        return;
+    }
+    xTaskCreate([](void* arg) {
+        static_cast<AudioDebugger*>(arg)->SenderTask();
+    }, "audio_debugger", 4096, this, 1, &sender_task_);
+    ESP_LOGI(TAG, "Sending points 0x%02lx to %s", point_mask_, CONFIG_AUDIO_DEBUG_UDP_SERVER);
 #endif
 }
 
 AudioDebugger::~AudioDebugger() {
 #if CONFIG_USE_AUDIO_DEBUGGER
+    if (sender_task_ != nullptr) {
+        vTaskDelete(sender_task_);
+    }
+    if (ring_ != nullptr) {
+#if CONFIG_SPIRAM
+        vRingbufferDeleteWithCaps(ring_);
+#else
+        vRingbufferDelete(ring_);
+#endif
+    }
     if (udp_sockfd_ >= 0) {
         close(udp_sockfd_);
         ESP_LOGI(TAG, "Closed UDP socket");
@@ -51,18 +127,112 @@ AudioDebugger::~AudioDebugger() {
 #endif
 }
 
-void AudioDebugger::Feed(const std::vector<int16_t>& data) {
+void AudioDebugger::Feed(AudioDebugPoint point, const int16_t* pcm, size_t frames, int sample_rate, int channels, int channel) {
 #if CONFIG_USE_AUDIO_DEBUGGER
+    if (!enabled(point) || frames == 0 || channel < 0 || channel >= channels) {
+        return;
+    }
+    uint32_t sequence = frame_sequence_[point]++;
+    Frame* frame = nullptr;
+    if (xRingbufferSendAcquire(ring_, reinterpret_cast<void**>(&frame), sizeof(Frame) + frames * sizeof(int16_t), 0) != pdTRUE) {
+        dropped_frames_++;
+        return;
+    }
+    frame->point = point;
+    frame->sample_rate = sample_rate;
+    frame->sequence = sequence;
+    frame->time_ms = esp_timer_get_time() / 1000;
+    frame->samples = frames;
+    if (channels == 1) {
+        memcpy(frame->pcm, pcm, frames * sizeof(int16_t));
+    } else {
+        for (size_t i = 0; i < frames; i++) {
+            frame->pcm[i] = pcm[i * channels + channel];
+        }
+    }
+    xRingbufferSendComplete(ring_, frame);
+#endif
+}
+
+#if CONFIG_USE_AUDIO_DEBUGGER
+bool AudioDebugger::OpenSocket() {
     if (udp_sockfd_ >= 0) {
-        ssize_t sent = sendto(udp_sockfd_, data.data(), data.size() * sizeof(int16_t), 0,
+        return true;
+    }
+    // 网络起来之前创建会失败，下一帧再试
+    udp_sockfd_ = socket(AF_INET, SOCK_DGRAM, 0);
+    if (udp_sockfd_ < 0) {
+        return false;
+    }
+    ESP_LOGI(TAG, "Opened UDP socket to %s", CONFIG_AUDIO_DEBUG_UDP_SERVER);
+    return true;
+}
+
+void AudioDebugger::SendFrame(const Frame* frame) {
+    uint8_t packet[sizeof(AudioDebugPacketHeader) + AUDIO_DEBUG_PACKET_SAMPLES * sizeof(int16_t)];
+    auto header = reinterpret_cast<AudioDebugPacketHeader*>(packet);
+    uint8_t* payload = packet + sizeof(AudioDebugPacketHeader);
+    int16_t& predictor = adpcm_predictor_[frame->point];
+    uint8_t& step_index = adpcm_step_index_[frame->point];
+
+    for (uint32_t offset = 0; offset < frame->samples; offset += AUDIO_DEBUG_PACKET_SAMPLES) {
+        uint32_t samples = std::min<uint32_t>(AUDIO_DEBUG_PACKET_SAMPLES, frame->samples - offset);
+        const int16_t* pcm = frame->pcm + offset;
+        header->magic = AUDIO_DEBUG_MAGIC;
+        header->version = AUDIO_DEBUG_VERSION;
+        header->point = frame->point;
+        header->samples = samples;
+        header->sample_rate = frame->sample_rate;
+        header->offset = offset;
+        header->frame_sequence = frame->sequence;
+        header->time_ms = frame->time_ms;
+        header->predictor = predictor;
+        header->step_index = step_index;
+
+        size_t payload_size;
+#if CONFIG_AUDIO_DEBUG_ADPCM
+        header->codec = kAudioDebugCodecImaAdpcm;
+        payload_size = (samples + 1) / 2;
+        memset(payload, 0, payload_size);
+        for (uint32_t i = 0; i < samples; i++) {
+            uint8_t code = EncodeAdpcmSample(pcm[i], predictor, step_index);
+            payload[i / 2] |= (i & 1) ? code << 4 : code;
+        }
+#else
+        header->codec = kAudioDebugCodecPcm16;
+        payload_size = samples * sizeof(int16_t);
+        memcpy(payload, pcm, payload_size);
+#endif
+        ssize_t sent = sendto(udp_sockfd_, packet, sizeof(AudioDebugPacketHeader) + payload_size, 0,
                              (struct sockaddr*)&udp_server_addr_, sizeof(udp_server_addr_));
         if (sent < 0) {
-            ESP_LOGW(TAG, "Failed to send audio data to %s: %d", CONFIG_AUDIO_DEBUG_UDP_SERVER, errno);
-        } else {
-            ESP_LOGD(TAG, "Sent %d bytes audio data to %s", sent, CONFIG_AUDIO_DEBUG_UDP_SERVER);
+            ESP_LOGD(TAG, "Failed to send audio data to %s: %d", CONFIG_AUDIO_DEBUG_UDP_SERVER, errno);
         }
     }
-#endif
 }
 
- 
\ No newline at end of file
+void AudioDebugger::SenderTask() {
+    uint32_t reported_drops = 0;
+    int64_t last_report_us = esp_timer_get_time();
+    while (true) {
+        size_t size = 0;
+        auto frame = static_cast<Frame*>(xRingbufferReceive(ring_, &size, pdMS_TO_TICKS(AUDIO_DEBUG_DROP_LOG_INTERVAL_MS)));
+        if (frame != nullptr) {
+            if (OpenSocket()) {
+                SendFrame(frame);
+            }
+            vRingbufferReturnItem(ring_, frame);
+        }
+
+        int64_t now_us = esp_timer_get_time();
+        if (now_us - last_report_us >= AUDIO_DEBUG_DROP_LOG_INTERVAL_MS * 1000) {
+            uint32_t dropped = dropped_frames_.load();
+            if (dropped != reported_drops) {
+                ESP_LOGW(TAG, "Ring buffer full, %lu frames dropped", dropped - reported_drops);
+                reported_drops = dropped;
+            }
+            last_report_us = now_us;
+        }
+    }
+}
+#endif
@@ -2,21 +2,88 @@
 #define AUDIO_DEBUGGER_H
 
 #include <vector>
+#include <atomic>
 #include <cstdint>
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/ringbuf.h>
+#include <freertos/task.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 
+#define AUDIO_DEBUG_PACKET_SAMPLES 640
+
+enum AudioDebugPoint : uint8_t {
+    kAudioDebugMicInput,        // 第一个麦克风，重采样后送进 AFE 之前
+    kAudioDebugReference,       // 回采通道
+    kAudioDebugProcessorOutput, // AFE 输出，即上行编码前
+    kAudioDebugDecoded,         // 下行解码后，重采样前
+    kAudioDebugOutput,          // 混音后写入 codec 的第一个声道
+    kAudioDebugPointCount,
+};
+
+enum AudioDebugCodec : uint8_t {
+    kAudioDebugCodecPcm16,
+    kAudioDebugCodecImaAdpcm,   // 每字节两个样本，低 4 位在前，首样本前的状态在包头里
+};
+
+struct __attribute__((packed)) AudioDebugPacketHeader {
+    uint32_t magic;             // "XZAD"
+    uint8_t version;
+    uint8_t point;
+    uint8_t codec;
+    uint8_t step_index;
+    int16_t predictor;
+    uint16_t samples;
+    uint16_t sample_rate;
+    uint16_t offset;            // 本包第一个样本在帧内的位置
+    uint32_t frame_sequence;
+    uint32_t time_ms;           // Feed() 时的 esp_timer 时间，用于对齐各采集点
+};
+
+/*
+ * Multi point audio capture to CONFIG_AUDIO_DEBUG_UDP_SERVER. Feed() only copies one channel of the frame
+ * into a ring buffer and returns, frames that do not fit are dropped, so the audio tasks keep their timing.
+ * A low priority task takes the frames out, optionally compresses them to IMA ADPCM and sends them in UDP
+ * packets of at most AUDIO_DEBUG_PACKET_SAMPLES samples, each with an AudioDebugPacketHeader. The frame
+ * sequence counts dropped frames too, so gaps in it show where the ring overflowed.
+ */
 class AudioDebugger {
 public:
     AudioDebugger();
     ~AudioDebugger();
 
-    void Feed(const std::vector<int16_t>& data);
+    inline bool enabled(AudioDebugPoint point) const { return ring_ != nullptr && (point_mask_ & (1 << point)); }
+    // Takes channel of the interleaved pcm, frames is the number of samples per channel
+    void Feed(AudioDebugPoint point, const int16_t* pcm, size_t frames, int sample_rate, int channels = 1, int channel = 0);
+    inline void Feed(AudioDebugPoint point, const std::vector<int16_t>& pcm, int sample_rate, int channels = 1, int channel = 0) {
+        Feed(point, pcm.data(), pcm.size() / channels, sample_rate, channels, channel);
+    }
 
 private:
+    struct Frame {
+        uint8_t point;
+        uint16_t sample_rate;
+        uint32_t sequence;
+        uint32_t time_ms;
+        uint32_t samples;
+        int16_t pcm[];
+    };
+
+    RingbufHandle_t ring_ = nullptr;
+    TaskHandle_t sender_task_ = nullptr;
+    uint32_t point_mask_ = 0;
+    uint32_t frame_sequence_[kAudioDebugPointCount] = {};
+    std::atomic<uint32_t> dropped_frames_ = 0;
     int udp_sockfd_ = -1;
     struct sockaddr_in udp_server_addr_;
+    // ADPCM 状态跨帧延续，接收端按包头里的状态解码也不受丢包影响
+    int16_t adpcm_predictor_[kAudioDebugPointCount] = {};
+    uint8_t adpcm_step_index_[kAudioDebugPointCount] = {};
+
+    bool OpenSocket();
+    void SendFrame(const Frame* frame);
+    void SenderTask();
 };
 
-#endif 
\ No newline at end of file
+#endif
@@ -0,0 +1,154 @@
+#include "shared_afe.h"
+#include "model_manager.h"
+
+#include <esp_log.h>
+#include <string>
+
+#define TAG "SharedAfe"
+
+#define SHARED_AFE_CLIENTS (SharedAfe::kClientWakeWord | SharedAfe::kClientVoice)
+
+SharedAfe::SharedAfe() {
+    event_group_ = xEventGroupCreate();
+}
+
+SharedAfe::~SharedAfe() {
+    if (afe_data_ != nullptr) {
+        afe_iface_->destroy(afe_data_);
+        ModelManager::GetInstance().Unload("shared_afe");
+    }
+    vEventGroupDelete(event_group_);
+}
+
+bool SharedAfe::Initialize(AudioCodec* codec) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (afe_data_ != nullptr) {
+        return true;
+    }
+
+    auto& model_manager = ModelManager::GetInstance();
+    models_ = model_manager.models();
+    if (models_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to initialize wakenet model");
+        return false;
+    }
+
+    std::string input_format = codec->input_format();
+
+    char* ns_model_name = esp_srmodel_filter(models_, ESP_NSNET_PREFIX, NULL);
+    char* vad_model_name = esp_srmodel_filter(models_, ESP_VADN_PREFIX, NULL);
+
+    // 唤醒词需要 SR 类型的流水线；语音通话直接使用其经过 AEC/NS 的输出
+    afe_config_t* afe_config = afe_config_init(input_format.c_str(), models_, AFE_TYPE_SR, AFE_MODE_HIGH_PERF);
+    afe_config->aec_mode = AEC_MODE_SR_HIGH_PERF;
+#ifdef CONFIG_USE_DEVICE_AEC
+    afe_config->aec_init = true;
+#else
+    afe_config->aec_init = codec->input_reference();
+#endif
+    // 共用流水线里的 WakeNet 只在启动时选定，切换要等重启
+    char* wakenet_model_name = esp_srmodel_filter(models_, model_manager.GetWakeWordModel().c_str(), NULL);
+    if (wakenet_model_name != nullptr) {
+        afe_config->wakenet_model_name = wakenet_model_name;
+    }
+    afe_config->vad_init = true;
+    afe_config->vad_mode = VAD_MODE_0;
+    afe_config->vad_min_noise_ms = 100;
+    if (vad_model_name != nullptr) {
+        afe_config->vad_model_name = vad_model_name;
+    }
+    if (ns_model_name != nullptr) {
+        afe_config->ns_init = true;
+        afe_config->ns_model_name = ns_model_name;
+        afe_config->afe_ns_mode = AFE_NS_MODE_NET;
+    }
+    afe_config->agc_init = false;
+    afe_config->se_init = codec->input_mics() > 1;
+    afe_config->afe_perferred_core = 1;
+    afe_config->afe_perferred_priority = 1;
+    afe_config->memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM;
+
+    afe_iface_ = esp_afe_handle_from_config(afe_config);
+    afe_data_ = model_manager.Load("shared_afe", afe_config->wakenet_model_name != nullptr ?
+        afe_config->wakenet_model_name : "afe", [&]() {
+        return afe_iface_->create_from_config(afe_config);
+    });
+    if (afe_data_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create AFE");
+        return false;
+    }
+    ESP_LOGI(TAG, "Input format: %s, %d mic(s)", input_format.c_str(), codec->input_mics());
+    afe_iface_->print_pipeline(afe_data_);
+    afe_iface_->disable_wakenet(afe_data_);
+
+    xTaskCreate([](void* arg) {
+        auto this_ = (SharedAfe*)arg;
+        this_->FetchTask();
+        vTaskDelete(NULL);
+    }, "audio_afe", 4096, this, 3, nullptr);
+    return true;
+}
+
+void SharedAfe::OnFetch(Client client, std::function<void(afe_fetch_result_t* res)> callback) {
+    if (client == kClientWakeWord) {
+        wake_word_callback_ = callback;
+    } else {
+        voice_callback_ = callback;
+    }
+}
+
+void SharedAfe::Start(Client client) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (afe_data_ == nullptr) {
+        return;
+    }
+    if (client == kClientWakeWord && !(xEventGroupGetBits(event_group_) & kClientWakeWord)) {
+        afe_iface_->enable_wakenet(afe_data_);
+    }
+    xEventGroupSetBits(event_group_, client);
+}
+
+void SharedAfe::Stop(Client client) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto bits = xEventGroupClearBits(event_group_, client);
+    if (afe_data_ == nullptr) {
+        return;
+    }
+    if (client == kClientWakeWord && (bits & kClientWakeWord)) {
+        afe_iface_->disable_wakenet(afe_data_);
+    }
+    // 另一个客户端仍在使用时保留缓冲的音频
+    if ((bits & SHARED_AFE_CLIENTS & ~client) == 0) {
+        afe_iface_->reset_buffer(afe_data_);
+    }
+}
+
+bool SharedAfe::IsRunning(Client client) {
+    return xEventGroupGetBits(event_group_) & client;
+}
+
+void SharedAfe::FetchTask() {
+    auto fetch_size = afe_iface_->get_fetch_chunksize(afe_data_);
+    auto feed_size = afe_iface_->get_feed_chunksize(afe_data_);
+    ESP_LOGI(TAG, "Shared AFE task started, feed size: %d fetch size: %d", feed_size, fetch_size);
+
+    while (true) {
+        xEventGroupWaitBits(event_group_, SHARED_AFE_CLIENTS, pdFALSE, pdFALSE, portMAX_DELAY);
+
+        auto res = afe_iface_->fetch_with_delay(afe_data_, portMAX_DELAY);
+        if (res == nullptr || res->ret_value == ESP_FAIL) {
+            if (res != nullptr) {
+                ESP_LOGI(TAG, "Error code: %d", res->ret_value);
+            }
+            continue;
+        }
+
+        auto bits = xEventGroupGetBits(event_group_);
+        if ((bits & kClientVoice) && voice_callback_) {
+            voice_callback_(res);
+        }
+        if ((bits & kClientWakeWord) && wake_word_callback_) {
+            wake_word_callback_(res);
+        }
+    }
+}
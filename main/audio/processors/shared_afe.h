@@ -0,0 +1,62 @@
+#ifndef SHARED_AFE_H
+#define SHARED_AFE_H
+
+#include <esp_afe_sr_models.h>
+#include <model_path.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/event_groups.h>
+
+#include <functional>
+#include <mutex>
+
+#include "audio_codec.h"
+
+/*
+ * One AFE instance shared by the wake word and the voice processor.
+ *
+ * Running a separate SR and VC pipeline costs two copies of the AEC/NS state in PSRAM and two fetch
+ * tasks, although the wake word and the conversation mostly run one after the other. SharedAfe owns a
+ * single SR pipeline (AEC + NS + VAD + WakeNet) and one fetch task that hands every result to the
+ * clients that are currently started. WakeNet is only enabled while the wake word client runs.
+ */
+class SharedAfe {
+public:
+    enum Client {
+        kClientWakeWord = 0x01,
+        kClientVoice = 0x02,
+    };
+
+    static SharedAfe& GetInstance() {
+        static SharedAfe instance;
+        return instance;
+    }
+    SharedAfe(const SharedAfe&) = delete;
+    SharedAfe& operator=(const SharedAfe&) = delete;
+
+    bool Initialize(AudioCodec* codec);
+    void OnFetch(Client client, std::function<void(afe_fetch_result_t* res)> callback);
+    void Start(Client client);
+    void Stop(Client client);
+    bool IsRunning(Client client);
+
+    srmodel_list_t* models() const { return models_; }
+    esp_afe_sr_iface_t* iface() const { return afe_iface_; }
+    esp_afe_sr_data_t* data() const { return afe_data_; }
+
+private:
+    SharedAfe();
+    ~SharedAfe();
+
+    std::mutex mutex_;
+    EventGroupHandle_t event_group_ = nullptr;
+    srmodel_list_t* models_ = nullptr;
+    esp_afe_sr_iface_t* afe_iface_ = nullptr;
+    esp_afe_sr_data_t* afe_data_ = nullptr;
+    std::function<void(afe_fetch_result_t* res)> wake_word_callback_;
+    std::function<void(afe_fetch_result_t* res)> voice_callback_;
+
+    void FetchTask();
+};
+
+#endif // SHARED_AFE_H
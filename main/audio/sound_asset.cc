@@ -0,0 +1,105 @@
+#include "sound_asset.h"
+#include "audio_placement.h"
+
+#include <esp_log.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <cstring>
+
+#define TAG "SoundAsset"
+
+SoundVariant SoundAsset::Select(const std::string_view& sound, int output_sample_rate) {
+    SoundVariant opus;
+    opus.packets = sound;
+    auto first = (const BinaryProtocol3*)sound.data();
+    if (sound.size() < sizeof(BinaryProtocol3) || first->type != P3_TYPE_VARIANT) {
+        return opus;
+    }
+
+    SoundVariant raw;
+    bool has_opus = false, has_raw = false;
+    size_t offset = 0;
+    while (offset + sizeof(BinaryProtocol3) + sizeof(SoundVariantHeader) <= sound.size()) {
+        auto p3 = (const BinaryProtocol3*)(sound.data() + offset);
+        size_t payload_size = ntohs(p3->payload_size);
+        if (p3->type != P3_TYPE_VARIANT || payload_size < sizeof(SoundVariantHeader)) {
+            ESP_LOGW(TAG, "Invalid variant header at %u", offset);
+            break;
+        }
+        SoundVariantHeader header;
+        memcpy(&header, p3->payload, sizeof(header));
+        offset += sizeof(BinaryProtocol3) + payload_size;
+        size_t length = std::min<size_t>(ntohl(header.length), sound.size() - offset);
+
+        SoundVariant variant;
+        variant.codec = (AudioPayloadCodec)header.codec;
+        variant.sample_rate = ntohl(header.sample_rate);
+        variant.frame_duration = header.frame_duration;
+        variant.packets = sound.substr(offset, length);
+        offset += length;
+
+        if (variant.codec == kAudioPayloadOpus && !has_opus) {
+            opus = variant;
+            has_opus = true;
+        } else if (variant.codec != kAudioPayloadOpus && variant.sample_rate == output_sample_rate && !has_raw) {
+            raw = variant;
+            has_raw = true;
+        }
+    }
+    if (has_raw) {
+        return raw;
+    }
+    if (!has_opus) {
+        ESP_LOGW(TAG, "No playable variant for %d Hz", output_sample_rate);
+        opus.packets = {};
+    }
+    return opus;
+}
+
+static const int16_t AUDIO_HOT_DATA kImaStepTable[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97,
+    107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871,
+    5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623,
+    27086, 29794, 32767,
+};
+static const int8_t AUDIO_HOT_DATA kImaIndexTable[16] = { -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8 };
+
+bool AUDIO_HOT_FUNC SoundAsset::DecodeRawFrame(AudioPayloadCodec codec, const std::string_view& payload, std::vector<int16_t>& pcm) {
+    if (codec == kAudioPayloadPcm16) {
+        pcm.resize(payload.size() / sizeof(int16_t));
+        memcpy(pcm.data(), payload.data(), pcm.size() * sizeof(int16_t));
+        return !pcm.empty();
+    }
+    if (codec != kAudioPayloadImaAdpcm || payload.size() < 4) {
+        return false;
+    }
+
+    auto data = (const uint8_t*)payload.data();
+    int predictor = (int16_t)(data[0] | (data[1] << 8));
+    int index = std::min<int>(data[2], 88);
+    size_t samples = 1 + (payload.size() - 4) * 2 - (data[3] & 1);
+    pcm.resize(samples);
+    pcm[0] = predictor;
+    size_t out = 1;
+    for (size_t i = 4; i < payload.size(); i++) {
+        for (int shift = 0; shift <= 4 && out < samples; shift += 4) {
+            int nibble = (data[i] >> shift) & 0x0F;
+            int step = kImaStepTable[index];
+            int diff = step >> 3;
+            if (nibble & 4) {
+                diff += step;
+            }
+            if (nibble & 2) {
+                diff += step >> 1;
+            }
+            if (nibble & 1) {
+                diff += step >> 2;
+            }
+            predictor = std::clamp(nibble & 8 ? predictor - diff : predictor + diff, -32768, 32767);
+            index = std::clamp(index + kImaIndexTable[nibble], 0, 88);
+            pcm[out++] = predictor;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,44 @@
+#ifndef SOUND_ASSET_H
+#define SOUND_ASSET_H
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "protocol.h"
+
+/*
+ * Embedded sound assets (P3 files).
+ *
+ * A plain P3 file is a sequence of BinaryProtocol3 packets carrying 60 ms Opus frames at 16 kHz. Files built by
+ * scripts/p3_tools/p3_variants.py contain one or more variants instead, each introduced by a P3_TYPE_VARIANT
+ * packet (see SoundVariantHeader) followed by the packets of that variant. Short UI sounds can then carry raw
+ * PCM or IMA ADPCM frames already at 24 / 48 kHz next to the Opus fallback, and skip the decoder and resampler.
+ */
+#define P3_TYPE_VARIANT 0x10
+
+// P3_TYPE_VARIANT 负载，多字节字段为大端，与 BinaryProtocol3 的 payload_size 一致
+struct SoundVariantHeader {
+    uint8_t codec;              // AudioPayloadCodec
+    uint8_t frame_duration;     // ms
+    uint16_t reserved;
+    uint32_t sample_rate;
+    uint32_t length;            // 后面属于这个版本的数据包总字节数
+} __attribute__((packed));
+
+struct SoundVariant {
+    AudioPayloadCodec codec = kAudioPayloadOpus;
+    int sample_rate = 16000;
+    int frame_duration = 60;
+    std::string_view packets;
+};
+
+class SoundAsset {
+public:
+    // 优先选择与输出采样率相同的原始 PCM / ADPCM 版本，否则使用 Opus 版本
+    static SoundVariant Select(const std::string_view& sound, int output_sample_rate);
+    // 解码一帧原始数据；ADPCM 帧以 IMA 块头开始（首样本 int16 小端、步长索引、最后半字节是否为填充），随后每字节两个样本，低 4 位在前
+    static bool DecodeRawFrame(AudioPayloadCodec codec, const std::string_view& payload, std::vector<int16_t>& pcm);
+};
+
+#endif // SOUND_ASSET_H
@@ -0,0 +1,76 @@
+#include "sound_cache.h"
+#include "audio_memory.h"
+
+#include <esp_log.h>
+#include <cstring>
+
+#define TAG "SoundCache"
+
+CachedSound::~CachedSound() {
+    if (pcm_ != nullptr) {
+        AudioMemory::Free(pcm_);
+    }
+}
+
+void CachedSound::Record(size_t index, const std::vector<int16_t>& frame) {
+    if (failed_ || complete() || index != recorded_frames_) {
+        // Frames were dropped (e.g. the decoder was reset), this entry will be recorded again
+        failed_ = true;
+        return;
+    }
+    if (pcm_ == nullptr) {
+        frame_samples_ = frame.size();
+        pcm_ = (int16_t*)AudioMemory::Allocate(kAudioMemorySoundCache, frame_count_ * frame_samples_ * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+        if (pcm_ == nullptr) {
+            ESP_LOGW(TAG, "Failed to allocate %u bytes", frame_count_ * frame_samples_ * sizeof(int16_t));
+            failed_ = true;
+            return;
+        }
+    }
+    if (frame.size() != frame_samples_) {
+        failed_ = true;
+        return;
+    }
+    memcpy(pcm_ + index * frame_samples_, frame.data(), frame_samples_ * sizeof(int16_t));
+    if (++recorded_frames_ == frame_count_) {
+        complete_.store(true, std::memory_order_release);
+    }
+}
+
+bool CachedSound::ReadFrame(size_t index, std::vector<int16_t>& frame) const {
+    if (!complete() || index >= frame_count_) {
+        return false;
+    }
+    auto begin = pcm_ + index * frame_samples_;
+    frame.assign(begin, begin + frame_samples_);
+    return true;
+}
+
+std::shared_ptr<CachedSound> SoundCache::Get(const std::string_view& sound, int sample_rate, size_t frame_count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        if ((*it)->Matches(sound.data(), sample_rate)) {
+            if ((*it)->complete()) {
+                entries_.splice(entries_.begin(), entries_, it);
+                return entries_.front();
+            }
+            // The last recording was interrupted, start over
+            entries_.erase(it);
+            break;
+        }
+    }
+
+    entries_.push_front(std::make_shared<CachedSound>(sound.data(), sample_rate, frame_count));
+
+    size_t total_bytes = 0;
+    for (auto it = entries_.begin(); it != entries_.end(); ) {
+        total_bytes += (*it)->bytes();
+        if (total_bytes > capacity_bytes_) {
+            total_bytes -= (*it)->bytes();
+            it = entries_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    return entries_.front();
+}
@@ -0,0 +1,61 @@
+#ifndef SOUND_CACHE_H
+#define SOUND_CACHE_H
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+/*
+ * Decoded and resampled PCM of one embedded sound, stored in PSRAM.
+ * Frames are recorded by the decoder task the first time the sound is played,
+ * later plays copy them out instead of running the Opus decoder.
+ */
+class CachedSound {
+public:
+    CachedSound(const char* key, int sample_rate, size_t frame_count)
+        : key_(key), sample_rate_(sample_rate), frame_count_(frame_count) {}
+    ~CachedSound();
+
+    CachedSound(const CachedSound&) = delete;
+    CachedSound& operator=(const CachedSound&) = delete;
+
+    // Decoder task only
+    void Record(size_t index, const std::vector<int16_t>& frame);
+    bool ReadFrame(size_t index, std::vector<int16_t>& frame) const;
+
+    bool complete() const { return complete_.load(std::memory_order_acquire); }
+    bool Matches(const char* key, int sample_rate) const { return key_ == key && sample_rate_ == sample_rate; }
+    size_t bytes() const { return complete() ? frame_count_ * frame_samples_ * sizeof(int16_t) : 0; }
+
+private:
+    const char* key_;
+    int sample_rate_;
+    size_t frame_count_;
+    size_t frame_samples_ = 0;
+    size_t recorded_frames_ = 0;
+    bool failed_ = false;
+    int16_t* pcm_ = nullptr;
+    std::atomic<bool> complete_{false};
+};
+
+/*
+ * LRU cache of CachedSound keyed by the asset data pointer and the output sample rate.
+ */
+class SoundCache {
+public:
+    explicit SoundCache(size_t capacity_bytes) : capacity_bytes_(capacity_bytes) {}
+
+    // Returns the cached sound, or a new entry to be recorded while it plays
+    std::shared_ptr<CachedSound> Get(const std::string_view& sound, int sample_rate, size_t frame_count);
+
+private:
+    std::mutex mutex_;
+    std::list<std::shared_ptr<CachedSound>> entries_;   // Most recently used first
+    size_t capacity_bytes_;
+};
+
+#endif // SOUND_CACHE_H
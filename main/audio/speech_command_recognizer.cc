@@ -0,0 +1,159 @@
+#include "speech_command_recognizer.h"
+#include "board.h"
+#include "audio_codec.h"
+#include "model_manager.h"
+
+#include <esp_log.h>
+#include <esp_mn_speech_commands.h>
+#include <algorithm>
+#include <sstream>
+
+#define TAG "SpeechCommands"
+
+// 唤醒后等待命令词的时长
+#define SPEECH_COMMAND_TIMEOUT_MS 3000
+#define SPEECH_COMMAND_VOLUME_STEP 10
+
+SpeechCommandRecognizer::SpeechCommandRecognizer() {
+}
+
+SpeechCommandRecognizer::~SpeechCommandRecognizer() {
+    if (model_data_ != nullptr) {
+        multinet_->destroy(model_data_);
+        ModelManager::GetInstance().Unload("speech_commands");
+    }
+}
+
+bool SpeechCommandRecognizer::Initialize() {
+    models_ = ModelManager::GetInstance().models();
+    if (models_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to initialize models");
+        return false;
+    }
+
+    char* mn_name = esp_srmodel_filter(models_, ESP_MN_PREFIX, ESP_MN_CHINESE);
+    if (mn_name == nullptr) {
+        ESP_LOGE(TAG, "No multinet model found, please select one in ESP Speech Recognition");
+        return false;
+    }
+    multinet_ = esp_mn_handle_from_name(mn_name);
+    model_data_ = ModelManager::GetInstance().Load("speech_commands", mn_name, [&]() {
+        return multinet_->create(mn_name, SPEECH_COMMAND_TIMEOUT_MS);
+    });
+    if (model_data_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create multinet %s", mn_name);
+        return false;
+    }
+    chunk_samples_ = multinet_->get_samp_chunksize(model_data_);
+    buffer_.reserve(chunk_samples_);
+
+    AddDefaultCommands();
+    AddConfiguredCommands();
+
+    // 命令 id 为 commands_ 的下标加一
+    esp_mn_commands_alloc(multinet_, model_data_);
+    esp_mn_commands_clear();
+    for (size_t i = 0; i < commands_.size(); i++) {
+        esp_mn_commands_add(i + 1, commands_[i].phrase.c_str());
+    }
+    auto errors = esp_mn_commands_update();
+    if (errors != nullptr) {
+        for (int i = 0; i < errors->num; i++) {
+            ESP_LOGW(TAG, "Invalid command: %s", errors->phrases[i]->string);
+        }
+    }
+    ESP_LOGI(TAG, "multinet: %s, %u commands, chunk size: %u", mn_name, commands_.size(), chunk_samples_);
+    return true;
+}
+
+void SpeechCommandRecognizer::AddDefaultCommands() {
+    auto volume = [](int delta) {
+        return [delta]() {
+            auto codec = Board::GetInstance().GetAudioCodec();
+            int volume = std::clamp(codec->output_volume() + delta, 0, 100);
+            return "{\"volume\": " + std::to_string(volume) + "}";
+        };
+    };
+    commands_.push_back({"tiao da yin liang", "self.audio_speaker.set_volume", volume(SPEECH_COMMAND_VOLUME_STEP)});
+    commands_.push_back({"da sheng yi dian", "self.audio_speaker.set_volume", volume(SPEECH_COMMAND_VOLUME_STEP)});
+    commands_.push_back({"tiao xiao yin liang", "self.audio_speaker.set_volume", volume(-SPEECH_COMMAND_VOLUME_STEP)});
+    commands_.push_back({"xiao sheng yi dian", "self.audio_speaker.set_volume", volume(-SPEECH_COMMAND_VOLUME_STEP)});
+    commands_.push_back({"xia yi shou", "self.music.next_song", nullptr});
+    commands_.push_back({"qie ge", "self.music.next_song", nullptr});
+}
+
+// CONFIG_SPEECH_COMMANDS_EXTRA: "da kai deng=self.lamp.turn_on;guan deng=self.lamp.turn_off"
+void SpeechCommandRecognizer::AddConfiguredCommands() {
+    std::stringstream ss(CONFIG_SPEECH_COMMANDS_EXTRA);
+    std::string item;
+    while (std::getline(ss, item, ';')) {
+        auto pos = item.find('=');
+        if (pos == std::string::npos || pos == 0 || pos + 1 == item.size()) {
+            if (!item.empty()) {
+                ESP_LOGW(TAG, "Invalid command config: %s", item.c_str());
+            }
+            continue;
+        }
+        commands_.push_back({item.substr(0, pos), item.substr(pos + 1), nullptr});
+    }
+}
+
+void SpeechCommandRecognizer::OnCommand(std::function<void(const SpeechCommand& command)> callback) {
+    command_callback_ = callback;
+}
+
+void SpeechCommandRecognizer::Start() {
+    if (model_data_ == nullptr) {
+        return;
+    }
+    // 由 Feed 所在的任务清理上一轮的状态
+    reset_ = true;
+    running_ = true;
+}
+
+void SpeechCommandRecognizer::Stop() {
+    running_ = false;
+}
+
+void SpeechCommandRecognizer::Feed(const std::vector<int16_t>& data) {
+    if (!running_) {
+        return;
+    }
+    if (reset_) {
+        reset_ = false;
+        buffer_.clear();
+        multinet_->clean(model_data_);
+    }
+
+    size_t offset = 0;
+    if (buffer_.empty()) {
+        for (; running_ && data.size() - offset >= chunk_samples_; offset += chunk_samples_) {
+            Detect(data.data() + offset);
+        }
+    }
+    while (running_ && offset < data.size()) {
+        size_t n = std::min(chunk_samples_ - buffer_.size(), data.size() - offset);
+        buffer_.insert(buffer_.end(), data.begin() + offset, data.begin() + offset + n);
+        offset += n;
+        if (buffer_.size() == chunk_samples_) {
+            Detect(buffer_.data());
+            buffer_.clear();
+        }
+    }
+}
+
+void SpeechCommandRecognizer::Detect(const int16_t* chunk) {
+    auto state = multinet_->detect(model_data_, const_cast<int16_t*>(chunk));
+    if (state == ESP_MN_STATE_DETECTED) {
+        running_ = false;
+        auto result = multinet_->get_results(model_data_);
+        int id = result->command_id[0];
+        ESP_LOGI(TAG, "Command detected: id=%d, string=%s, prob=%f", id, result->string, result->prob[0]);
+        if (id >= 1 && id <= (int)commands_.size() && command_callback_) {
+            command_callback_(commands_[id - 1]);
+        }
+    } else if (state == ESP_MN_STATE_TIMEOUT) {
+        ESP_LOGD(TAG, "No command, leave it to the server");
+        running_ = false;
+    }
+}
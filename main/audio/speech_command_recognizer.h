@@ -0,0 +1,57 @@
+#ifndef SPEECH_COMMAND_RECOGNIZER_H
+#define SPEECH_COMMAND_RECOGNIZER_H
+
+#include <esp_mn_iface.h>
+#include <esp_mn_models.h>
+#include <model_path.h>
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct SpeechCommand {
+    std::string phrase;     // MultiNet 命令词，中文模型用拼音
+    std::string tool;       // 要调用的 MCP 工具
+    // 识别到时生成工具参数（JSON 对象），为空时不带参数
+    std::function<std::string()> arguments;
+};
+
+/*
+ * Offline command words on top of MultiNet.
+ *
+ * After a wake word the recognizer listens to the processed uplink audio for a few seconds. A matched
+ * phrase is reported through OnCommand() so the caller can run the MCP tool on the device instead of
+ * the cloud round trip; anything else times out and the conversation goes on as usual.
+ * Feed() must be called from a single task, Start() / Stop() may be called from any task.
+ */
+class SpeechCommandRecognizer {
+public:
+    SpeechCommandRecognizer();
+    ~SpeechCommandRecognizer();
+
+    bool Initialize();
+    void OnCommand(std::function<void(const SpeechCommand& command)> callback);
+    void Start();
+    void Stop();
+    bool IsRunning() const { return running_; }
+    // 16kHz 单声道
+    void Feed(const std::vector<int16_t>& data);
+
+private:
+    esp_mn_iface_t* multinet_ = nullptr;
+    model_iface_data_t* model_data_ = nullptr;
+    srmodel_list_t* models_ = nullptr;
+    std::vector<SpeechCommand> commands_;
+    std::function<void(const SpeechCommand& command)> command_callback_;
+    std::atomic<bool> running_ = false;
+    std::atomic<bool> reset_ = false;
+    std::vector<int16_t> buffer_;
+    size_t chunk_samples_ = 0;
+
+    void AddDefaultCommands();
+    void AddConfiguredCommands();
+    void Detect(const int16_t* chunk);
+};
+
+#endif // SPEECH_COMMAND_RECOGNIZER_H
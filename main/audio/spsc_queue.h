@@ -0,0 +1,115 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <type_traits>
+
+/*
+ * Fixed-capacity, lock-free single-producer / single-consumer queue.
+ *
+ * Push() must only be called by one producer task and Pop() by one consumer task.
+ * Clear() may be called from any task: it marks everything pushed so far as discarded,
+ * and the consumer releases those slots on its next Pop(), so no lock is needed.
+ */
+template <typename T, size_t Capacity>
+class SpscQueue {
+public:
+    static_assert(Capacity > 0, "Capacity must be greater than 0");
+
+    // The item is only moved from when Push() succeeds
+    bool Push(T&& item) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) >= Capacity) {
+            return false;
+        }
+        slots_[head & kMask] = std::move(item);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Pop(T& item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t head = head_.load(std::memory_order_acquire);
+        size_t discard = discard_.load(std::memory_order_acquire);
+        while (tail != head && Before(tail, discard)) {
+            slots_[tail & kMask] = T();
+            ++tail;
+        }
+        if (tail == head) {
+            tail_.store(tail, std::memory_order_release);
+            return false;
+        }
+        item = std::move(slots_[tail & kMask]);
+        slots_[tail & kMask] = T();
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    void Clear() {
+        size_t head = head_.load(std::memory_order_acquire);
+        size_t discard = discard_.load(std::memory_order_relaxed);
+        while (Before(discard, head) &&
+            !discard_.compare_exchange_weak(discard, head, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+    }
+
+    // Producer only: discard the oldest item that would still be delivered, its slot is freed on the next Pop().
+    // If the consumer takes that item at the same moment it is delivered and nothing is dropped.
+    bool DropOldest() {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t discard = discard_.load(std::memory_order_relaxed);
+        while (true) {
+            size_t tail = tail_.load(std::memory_order_acquire);
+            size_t oldest = Before(tail, discard) ? discard : tail;
+            if (oldest == head) {
+                return false;
+            }
+            if (discard_.compare_exchange_weak(discard, oldest + 1, std::memory_order_release, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+    }
+
+    // Number of items that will still be delivered by Pop()
+    size_t size() const {
+        size_t discard = discard_.load(std::memory_order_acquire);
+        size_t tail = tail_.load(std::memory_order_acquire);
+        size_t head = head_.load(std::memory_order_acquire);
+        return head - (Before(tail, discard) ? discard : tail);
+    }
+
+    bool empty() const { return size() == 0; }
+
+    // True when no slot is free, including slots still held by discarded items
+    bool full() const {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire) >= Capacity;
+    }
+
+    static constexpr size_t capacity() { return Capacity; }
+
+private:
+    static constexpr size_t RoundUpPowerOfTwo(size_t n) {
+        size_t value = 1;
+        while (value < n) {
+            value <<= 1;
+        }
+        return value;
+    }
+
+    static bool Before(size_t a, size_t b) {
+        return static_cast<std::make_signed_t<size_t>>(a - b) < 0;
+    }
+
+    static constexpr size_t kSlots = RoundUpPowerOfTwo(Capacity);
+    static constexpr size_t kMask = kSlots - 1;
+
+    std::array<T, kSlots> slots_{};
+    std::atomic<size_t> head_{0};
+    std::atomic<size_t> tail_{0};
+    std::atomic<size_t> discard_{0};
+};
+
+#endif // SPSC_QUEUE_H
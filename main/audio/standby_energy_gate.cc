@@ -0,0 +1,82 @@
+#include "standby_energy_gate.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <algorithm>
+#include <cmath>
+
+#define TAG "StandbyEnergyGate"
+
+// 噪声基底上升很慢，持续的说话声不会被当成噪声
+#define STANDBY_GATE_FLOOR_RISE 0.002f
+// 全静音时的基底下限，均方值
+#define STANDBY_GATE_MIN_FLOOR 4.0f
+
+StandbyEnergyGate::StandbyEnergyGate() {
+#if CONFIG_WAKE_WORD_ENERGY_GATE
+    threshold_ = std::pow(10.0f, CONFIG_WAKE_WORD_ENERGY_GATE_THRESHOLD_DB / 10.0f);
+    hangover_us_ = CONFIG_WAKE_WORD_ENERGY_GATE_HANGOVER_MS * 1000LL;
+#endif
+}
+
+bool StandbyEnergyGate::Process(const std::vector<int16_t>& data, const AudioChannelView& mic,
+    const std::function<void(const std::vector<int16_t>&)>& feed_held) {
+    if (mic.empty()) {
+        return true;
+    }
+    int64_t now_us = esp_timer_get_time();
+    if (reset_requested_.exchange(false)) {
+        open_ = true;
+        noise_floor_ = 0;
+        held_count_ = 0;
+        last_loud_us_ = now_us;
+#if CONFIG_WAKE_WORD_ENERGY_GATE
+        // 按块长换算保留的块数，块长由唤醒词决定
+        int chunk_ms = std::max<int>(mic.size() / 16, 1);
+        hold_chunks_ = std::min<size_t>((CONFIG_WAKE_WORD_ENERGY_GATE_PREROLL_MS + chunk_ms - 1) / chunk_ms, kMaxHeldChunks);
+#endif
+    }
+
+    int64_t sum = 0;
+    for (size_t i = 0; i < mic.size(); i++) {
+        int32_t sample = mic[i];
+        sum += sample * sample;
+    }
+    float energy = (float)sum / mic.size();
+    if (noise_floor_ == 0 || energy < noise_floor_) {
+        noise_floor_ = std::max(energy, STANDBY_GATE_MIN_FLOOR);
+    } else {
+        noise_floor_ += (energy - noise_floor_) * STANDBY_GATE_FLOOR_RISE;
+    }
+
+    if (energy > noise_floor_ * threshold_) {
+        last_loud_us_ = now_us;
+        if (!open_) {
+            open_ = true;
+            ESP_LOGD(TAG, "Open, feeding %u held chunks", (unsigned)held_count_);
+            for (; held_count_ > 0; held_count_--) {
+                feed_held(held_[held_start_]);
+                held_start_ = (held_start_ + 1) % kMaxHeldChunks;
+            }
+        }
+        return true;
+    }
+    if (open_ && now_us - last_loud_us_ < hangover_us_) {
+        return true;
+    }
+    if (open_) {
+        open_ = false;
+        ESP_LOGD(TAG, "Closed, noise floor %.0f", noise_floor_);
+    }
+
+    if (hold_chunks_ > 0) {
+        if (held_count_ == hold_chunks_) {
+            held_start_ = (held_start_ + 1) % kMaxHeldChunks;
+            held_count_--;
+        }
+        held_[(held_start_ + held_count_) % kMaxHeldChunks].assign(data.begin(), data.end());
+        held_count_++;
+    }
+    return false;
+}
@@ -0,0 +1,49 @@
+#ifndef STANDBY_ENERGY_GATE_H
+#define STANDBY_ENERGY_GATE_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "audio_codec.h"
+
+/*
+ * Keeps the wake word detection (AFE and WakeNet) from running on silence in standby.
+ *
+ * The microphone energy of every feed chunk is compared with a noise floor that drops at once and
+ * rises slowly. While it stays below the floor plus the threshold the chunks are only copied into a short
+ * hold ring, so the AFE task waits in fetch and DFS can drop the CPU to its minimum clock. The first loud
+ * chunk opens the gate: the held chunks are fed first, so the start of the wake word is not cut, and the
+ * gate stays open for the hangover time after the last loud chunk. Input task only, Reset() may be
+ * called from any task.
+ */
+class StandbyEnergyGate {
+public:
+    StandbyEnergyGate();
+
+    // Returns false if the chunk was held back. feed_held gets the held chunks, oldest first, when it opens.
+    bool Process(const std::vector<int16_t>& data, const AudioChannelView& mic,
+        const std::function<void(const std::vector<int16_t>&)>& feed_held);
+    // Opens the gate and learns the noise floor again, e.g. when the detection restarts
+    void Reset() { reset_requested_ = true; }
+
+    inline bool open() const { return open_; }
+
+private:
+    static constexpr size_t kMaxHeldChunks = 16;
+
+    std::atomic<bool> reset_requested_{true};
+    bool open_ = true;
+    float noise_floor_ = 0;
+    float threshold_ = 1;
+    int64_t last_loud_us_ = 0;
+    int64_t hangover_us_ = 0;
+    size_t hold_chunks_ = 0;
+    std::array<std::vector<int16_t>, kMaxHeldChunks> held_;
+    size_t held_start_ = 0;
+    size_t held_count_ = 0;
+};
+
+#endif // STANDBY_ENERGY_GATE_H
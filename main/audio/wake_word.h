@@ -7,6 +7,8 @@
 
 #include "audio_codec.h"
 
+class WakeWordBudget;
+
 class WakeWord {
 public:
     virtual ~WakeWord() = default;
@@ -19,7 +21,15 @@ public:
     virtual size_t GetFeedSize() = 0;
     virtual void EncodeWakeWordData() = 0;
     virtual bool GetWakeWordOpus(std::vector<uint8_t>& opus) = 0;
+    // The last samples of 16 kHz mono audio seen by the detection, 0 if the implementation keeps none
+    virtual size_t ReadRecentAudio(int16_t* out, size_t samples) { return 0; }
     virtual const std::string& GetLastDetectedWakeWord() const = 0;
+    // nullptr when the implementation does not measure its CPU use
+    virtual WakeWordBudget* budget() { return nullptr; }
+    // Follows the budget degrade level, an implementation turns off its optional processing at the higher levels
+    virtual void SetDegradeLevel(int level) {}
+    // Swaps in another WakeNet model of the model list, false when the change only takes effect after a restart
+    virtual bool SwitchModel(const std::string& model) { return false; }
 };
 
 #endif
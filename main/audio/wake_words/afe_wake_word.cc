@@ -1,113 +1,223 @@
 #include "afe_wake_word.h"
 #include "audio_service.h"
+#include "model_manager.h"
+#if CONFIG_USE_SHARED_AFE
+#include "processors/shared_afe.h"
+#endif
 
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <sstream>
+#include <cstring>
+#include <algorithm>
 
 #define DETECTION_RUNNING_EVENT 1
+#define DETECTION_SWITCH_EVENT 2
+// 取结果超时后回到循环开头，停止检测后仍能处理切换模型
+#define DETECTION_FETCH_TIMEOUT_MS 200
 
 #define TAG "AfeWakeWord"
 
 AfeWakeWord::AfeWakeWord()
     : afe_data_(nullptr),
-      wake_word_pcm_(),
-      wake_word_opus_() {
+      pre_roll_() {
 
     event_group_ = xEventGroupCreate();
 }
 
 AfeWakeWord::~AfeWakeWord() {
+#if !CONFIG_USE_SHARED_AFE
     if (afe_data_ != nullptr) {
         afe_iface_->destroy(afe_data_);
+        ModelManager::GetInstance().Unload("wake_word");
     }
-
-    if (wake_word_encode_task_stack_ != nullptr) {
-        heap_caps_free(wake_word_encode_task_stack_);
-    }
-
-    if (wake_word_encode_task_buffer_ != nullptr) {
-        heap_caps_free(wake_word_encode_task_buffer_);
-    }
-
-    if (models_ != nullptr) {
-        esp_srmodel_deinit(models_);
-    }
+#endif
 
     vEventGroupDelete(event_group_);
 }
 
 bool AfeWakeWord::Initialize(AudioCodec* codec) {
     codec_ = codec;
-    int ref_num = codec_->input_reference() ? 1 : 0;
 
-    models_ = esp_srmodel_init("model");
-    if (models_ == nullptr || models_->num == -1) {
+#if CONFIG_USE_SHARED_AFE
+    auto& shared_afe = SharedAfe::GetInstance();
+    if (!shared_afe.Initialize(codec_)) {
+        return false;
+    }
+    models_ = shared_afe.models();
+#else
+    models_ = ModelManager::GetInstance().models();
+#endif
+    if (models_ == nullptr) {
         ESP_LOGE(TAG, "Failed to initialize wakenet model");
         return false;
     }
-    for (int i = 0; i < models_->num; i++) {
-        ESP_LOGI(TAG, "Model %d: %s", i, models_->model_name[i]);
-        if (strstr(models_->model_name[i], ESP_WN_PREFIX) != NULL) {
-            wakenet_model_ = models_->model_name[i];
-            auto words = esp_srmodel_get_wake_words(models_, wakenet_model_);
-            // split by ";" to get all wake words
-            std::stringstream ss(words);
-            std::string word;
-            while (std::getline(ss, word, ';')) {
-                wake_words_.push_back(word);
-            }
-        }
+    SelectModel(ModelManager::GetInstance().GetWakeWordModel());
+
+#if CONFIG_USE_SHARED_AFE
+    afe_iface_ = shared_afe.iface();
+    afe_data_ = shared_afe.data();
+    shared_afe.OnFetch(SharedAfe::kClientWakeWord, [this](afe_fetch_result_t* res) {
+        ProcessFetchResult(res);
+    });
+    return true;
+#else
+    afe_data_ = CreateAfe();
+    if (afe_data_ == nullptr) {
+        return false;
     }
 
-    std::string input_format;
-    for (int i = 0; i < codec_->input_channels() - ref_num; i++) {
-        input_format.push_back('M');
+    // 切换模型时在这个任务里重建 AFE，栈和后台预初始化语音处理的任务一样大
+    xTaskCreate([](void* arg) {
+        auto this_ = (AfeWakeWord*)arg;
+        this_->AudioDetectionTask();
+        vTaskDelete(NULL);
+    }, "audio_detection", 6144, this, 3, nullptr);
+
+    return true;
+#endif
+}
+
+// wake_words_ 按 AFE 报告的下标取词，必须来自 AFE 里的同一个 WakeNet
+void AfeWakeWord::SelectModel(const std::string& model) {
+    wakenet_model_ = esp_srmodel_filter(models_, model.c_str(), NULL);
+    wake_words_.clear();
+    if (wakenet_model_ == nullptr) {
+        return;
+    }
+    char* words = esp_srmodel_get_wake_words(models_, wakenet_model_);
+    if (words == nullptr) {
+        return;
     }
-    for (int i = 0; i < ref_num; i++) {
-        input_format.push_back('R');
+    // split by ";" to get all wake words
+    std::stringstream ss(words);
+    std::string word;
+    while (std::getline(ss, word, ';')) {
+        wake_words_.push_back(word);
     }
+    free(words);
+    ESP_LOGI(TAG, "Wake word model: %s", wakenet_model_);
+}
+
+#if !CONFIG_USE_SHARED_AFE
+esp_afe_sr_data_t* AfeWakeWord::CreateAfe() {
+    std::string input_format = codec_->input_format();
     afe_config_t* afe_config = afe_config_init(input_format.c_str(), models_, AFE_TYPE_SR, AFE_MODE_HIGH_PERF);
     afe_config->aec_init = codec_->input_reference();
     afe_config->aec_mode = AEC_MODE_SR_HIGH_PERF;
     afe_config->afe_perferred_core = 1;
     afe_config->afe_perferred_priority = 1;
     afe_config->memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM;
-    
-    afe_iface_ = esp_afe_handle_from_config(afe_config);
-    afe_data_ = afe_iface_->create_from_config(afe_config);
+    if (wakenet_model_ != nullptr) {
+        afe_config->wakenet_model_name = wakenet_model_;
+    }
 
-    xTaskCreate([](void* arg) {
-        auto this_ = (AfeWakeWord*)arg;
-        this_->AudioDetectionTask();
-        vTaskDelete(NULL);
-    }, "audio_detection", 4096, this, 3, nullptr);
+    ns_enabled_ = afe_config->ns_init;
+
+    afe_iface_ = esp_afe_handle_from_config(afe_config);
+    auto afe_data = ModelManager::GetInstance().Load("wake_word", wakenet_model_ != nullptr ? wakenet_model_ : "afe", [&]() {
+        return afe_iface_->create_from_config(afe_config);
+    });
+    afe_config_free(afe_config);
+    if (afe_data == nullptr) {
+        ESP_LOGE(TAG, "Failed to create AFE");
+        return nullptr;
+    }
+    budget_.SetChunkDuration(afe_iface_->get_fetch_chunksize(afe_data) * 1000000LL / 16000);
+    return afe_data;
+}
 
+bool AfeWakeWord::SwitchModel(const std::string& model) {
+    if (afe_data_ == nullptr) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        pending_model_ = model;
+    }
+    xEventGroupSetBits(event_group_, DETECTION_SWITCH_EVENT);
     return true;
 }
 
+// 检测任务里执行，取结果和重建不会并行；先释放旧的 AFE，内存峰值只有一份
+void AfeWakeWord::ApplyPendingModel() {
+    std::string model;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        model.swap(pending_model_);
+    }
+    if (model.empty() || (wakenet_model_ != nullptr && model == wakenet_model_)) {
+        return;
+    }
+    std::string previous = wakenet_model_ != nullptr ? wakenet_model_ : "";
+    int64_t start_us = esp_timer_get_time();
+    std::lock_guard<std::mutex> lock(afe_mutex_);
+    afe_iface_->destroy(afe_data_);
+    afe_data_ = nullptr;
+    ModelManager::GetInstance().Unload("wake_word");
+
+    SelectModel(model);
+    afe_data_ = CreateAfe();
+    if (afe_data_ == nullptr && !previous.empty()) {
+        SelectModel(previous);
+        afe_data_ = CreateAfe();
+    }
+    fed_samples_ = 0;
+    fetched_samples_ = 0;
+    ESP_LOGI(TAG, "Switched to %s in %d ms", wakenet_model_ != nullptr ? wakenet_model_ : "none",
+        (int)((esp_timer_get_time() - start_us) / 1000));
+}
+#endif
+
 void AfeWakeWord::OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback) {
     wake_word_detected_callback_ = callback;
 }
 
 void AfeWakeWord::Start() {
+#if CONFIG_USE_SHARED_AFE
+    SharedAfe::GetInstance().Start(SharedAfe::kClientWakeWord);
+#else
     xEventGroupSetBits(event_group_, DETECTION_RUNNING_EVENT);
+#endif
 }
 
 void AfeWakeWord::Stop() {
+#if CONFIG_USE_SHARED_AFE
+    SharedAfe::GetInstance().Stop(SharedAfe::kClientWakeWord);
+#else
     xEventGroupClearBits(event_group_, DETECTION_RUNNING_EVENT);
+    std::lock_guard<std::mutex> lock(afe_mutex_);
     if (afe_data_ != nullptr) {
         afe_iface_->reset_buffer(afe_data_);
     }
+    fed_samples_ = 0;
+    fetched_samples_ = 0;
+#endif
 }
 
 void AfeWakeWord::Feed(const std::vector<int16_t>& data) {
+#if !CONFIG_USE_SHARED_AFE
+    std::lock_guard<std::mutex> lock(afe_mutex_);
+#endif
     if (afe_data_ == nullptr) {
         return;
     }
+#if CONFIG_USE_SHARED_AFE
+    // 语音处理运行时由它喂同一个实例，避免重复喂入
+    if (SharedAfe::GetInstance().IsRunning(SharedAfe::kClientVoice)) {
+        return;
+    }
+#endif
     afe_iface_->feed(afe_data_, data.data());
+#if !CONFIG_USE_SHARED_AFE
+    fed_samples_ += afe_iface_->get_feed_chunksize(afe_data_);
+#endif
 }
 
 size_t AfeWakeWord::GetFeedSize() {
+#if !CONFIG_USE_SHARED_AFE
+    std::lock_guard<std::mutex> lock(afe_mutex_);
+#endif
     if (afe_data_ == nullptr) {
         return 0;
     }
@@ -121,83 +231,68 @@ void AfeWakeWord::AudioDetectionTask() {
         feed_size, fetch_size);
 
     while (true) {
-        xEventGroupWaitBits(event_group_, DETECTION_RUNNING_EVENT, pdFALSE, pdTRUE, portMAX_DELAY);
+        auto bits = xEventGroupWaitBits(event_group_, DETECTION_RUNNING_EVENT | DETECTION_SWITCH_EVENT, pdFALSE, pdFALSE,
+            portMAX_DELAY);
+        if (bits & DETECTION_SWITCH_EVENT) {
+            xEventGroupClearBits(event_group_, DETECTION_SWITCH_EVENT);
+            ApplyPendingModel();
+            continue;
+        }
+        if (afe_data_ == nullptr) {
+            xEventGroupClearBits(event_group_, DETECTION_RUNNING_EVENT);
+            continue;
+        }
 
-        auto res = afe_iface_->fetch_with_delay(afe_data_, portMAX_DELAY);
+        auto res = afe_iface_->fetch_with_delay(afe_data_, pdMS_TO_TICKS(DETECTION_FETCH_TIMEOUT_MS));
         if (res == nullptr || res->ret_value == ESP_FAIL) {
             continue;;
         }
 
-        // Store the wake word data for voice recognition, like who is speaking
-        StoreWakeWordData(res->data, res->data_size / sizeof(int16_t));
+        fetched_samples_ += res->data_size / sizeof(int16_t);
+        int32_t backlog = fed_samples_ - fetched_samples_;
+        budget_.AddBacklog(std::max<int32_t>(backlog, 0) * 1000000LL / 16000);
+        ProcessFetchResult(res);
+    }
+}
+
+#if !CONFIG_USE_SHARED_AFE
+// 第 2 级关闭降噪，唤醒词模型本身对噪声有一定容忍
+void AfeWakeWord::SetDegradeLevel(int level) {
+    std::lock_guard<std::mutex> lock(afe_mutex_);
+    if (!ns_enabled_ || afe_data_ == nullptr) {
+        return;
+    }
+    if (level >= 2) {
+        afe_iface_->disable_ns(afe_data_);
+    } else {
+        afe_iface_->enable_ns(afe_data_);
+    }
+    ESP_LOGI(TAG, "Noise suppression %s", level >= 2 ? "disabled" : "enabled");
+}
+#endif
+
+void AfeWakeWord::ProcessFetchResult(afe_fetch_result_t* res) {
+    // Store the wake word data for voice recognition, like who is speaking
+    StoreWakeWordData(res->data, res->data_size / sizeof(int16_t));
 
-        if (res->wakeup_state == WAKENET_DETECTED) {
-            Stop();
-            last_detected_wake_word_ = wake_words_[res->wakenet_model_index - 1];
+    if (res->wakeup_state == WAKENET_DETECTED) {
+        Stop();
+        last_detected_wake_word_ = wake_words_[res->wakenet_model_index - 1];
 
-            if (wake_word_detected_callback_) {
-                wake_word_detected_callback_(last_detected_wake_word_);
-            }
+        if (wake_word_detected_callback_) {
+            wake_word_detected_callback_(last_detected_wake_word_);
         }
     }
 }
 
 void AfeWakeWord::StoreWakeWordData(const int16_t* data, size_t samples) {
-    // store audio data to wake_word_pcm_
-    wake_word_pcm_.emplace_back(std::vector<int16_t>(data, data + samples));
-    // keep about 2 seconds of data, detect duration is 30ms (sample_rate == 16000, chunksize == 512)
-    while (wake_word_pcm_.size() > 2000 / 30) {
-        wake_word_pcm_.pop_front();
-    }
+    pre_roll_.Store(data, samples);
 }
 
 void AfeWakeWord::EncodeWakeWordData() {
-    const size_t stack_size = 4096 * 7;
-    wake_word_opus_.clear();
-    if (wake_word_encode_task_stack_ == nullptr) {
-        wake_word_encode_task_stack_ = (StackType_t*)heap_caps_malloc(stack_size, MALLOC_CAP_SPIRAM);
-        assert(wake_word_encode_task_stack_ != nullptr);
-    }
-    if (wake_word_encode_task_buffer_ == nullptr) {
-        wake_word_encode_task_buffer_ = (StaticTask_t*)heap_caps_malloc(sizeof(StaticTask_t), MALLOC_CAP_INTERNAL);
-        assert(wake_word_encode_task_buffer_ != nullptr);
-    }
-
-    wake_word_encode_task_ = xTaskCreateStatic([](void* arg) {
-        auto this_ = (AfeWakeWord*)arg;
-        {
-            auto start_time = esp_timer_get_time();
-            auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
-            encoder->SetComplexity(0); // 0 is the fastest
-
-            int packets = 0;
-            for (auto& pcm: this_->wake_word_pcm_) {
-                encoder->Encode(std::move(pcm), [this_](std::vector<uint8_t>&& opus) {
-                    std::lock_guard<std::mutex> lock(this_->wake_word_mutex_);
-                    this_->wake_word_opus_.emplace_back(std::move(opus));
-                    this_->wake_word_cv_.notify_all();
-                });
-                packets++;
-            }
-            this_->wake_word_pcm_.clear();
-
-            auto end_time = esp_timer_get_time();
-            ESP_LOGI(TAG, "Encode wake word opus %d packets in %ld ms", packets, (long)((end_time - start_time) / 1000));
-
-            std::lock_guard<std::mutex> lock(this_->wake_word_mutex_);
-            this_->wake_word_opus_.push_back(std::vector<uint8_t>());
-            this_->wake_word_cv_.notify_all();
-        }
-        vTaskDelete(NULL);
-    }, "encode_wake_word", stack_size, this, 2, wake_word_encode_task_stack_, wake_word_encode_task_buffer_);
+    pre_roll_.Encode();
 }
 
 bool AfeWakeWord::GetWakeWordOpus(std::vector<uint8_t>& opus) {
-    std::unique_lock<std::mutex> lock(wake_word_mutex_);
-    wake_word_cv_.wait(lock, [this]() {
-        return !wake_word_opus_.empty();
-    });
-    opus.swap(wake_word_opus_.front());
-    wake_word_opus_.pop_front();
-    return !opus.empty();
+    return pre_roll_.GetOpus(opus);
 }
@@ -13,11 +13,14 @@
 #include <string>
 #include <vector>
 #include <functional>
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
 
 #include "audio_codec.h"
 #include "wake_word.h"
+#include "wake_word_budget.h"
+#include "wake_word_pre_roll.h"
 
 class AfeWakeWord : public WakeWord {
 public:
@@ -32,7 +35,15 @@ public:
     size_t GetFeedSize();
     void EncodeWakeWordData();
     bool GetWakeWordOpus(std::vector<uint8_t>& opus);
+    size_t ReadRecentAudio(int16_t* out, size_t samples) { return pre_roll_.ReadRecent(out, samples); }
     const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
+#if !CONFIG_USE_SHARED_AFE
+    // 共用 AFE 时检测由语音处理喂入，积压无法归到唤醒词上，不做统计
+    WakeWordBudget* budget() { return &budget_; }
+    void SetDegradeLevel(int level);
+    // 在检测任务里重建 AFE，共用 AFE 时另一个客户端还在用，只能重启后生效
+    bool SwitchModel(const std::string& model);
+#endif
 
 private:
     srmodel_list_t *models_ = nullptr;
@@ -45,16 +56,26 @@ private:
     AudioCodec* codec_ = nullptr;
     std::string last_detected_wake_word_;
 
-    TaskHandle_t wake_word_encode_task_ = nullptr;
-    StaticTask_t* wake_word_encode_task_buffer_ = nullptr;
-    StackType_t* wake_word_encode_task_stack_ = nullptr;
-    std::deque<std::vector<int16_t>> wake_word_pcm_;
-    std::deque<std::vector<uint8_t>> wake_word_opus_;
-    std::mutex wake_word_mutex_;
-    std::condition_variable wake_word_cv_;
+    WakeWordPreRoll pre_roll_;
+    WakeWordBudget budget_;
+    // 已喂入和已取出的单声道样本数，差值是检测任务的积压
+    std::atomic<uint32_t> fed_samples_{0};
+    std::atomic<uint32_t> fetched_samples_{0};
+    bool ns_enabled_ = false;
+#if !CONFIG_USE_SHARED_AFE
+    std::mutex afe_mutex_;          // 重建 AFE 时挡住 Feed
+    std::mutex pending_mutex_;
+    std::string pending_model_;
+#endif
 
+    void SelectModel(const std::string& model);
+#if !CONFIG_USE_SHARED_AFE
+    esp_afe_sr_data_t* CreateAfe();
+    void ApplyPendingModel();
+#endif
     void StoreWakeWordData(const int16_t* data, size_t size);
     void AudioDetectionTask();
+    void ProcessFetchResult(afe_fetch_result_t* res);
 };
 
 #endif
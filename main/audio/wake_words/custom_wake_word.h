@@ -16,6 +16,8 @@
 
 #include "audio_codec.h"
 #include "wake_word.h"
+#include "wake_word_budget.h"
+#include "wake_word_pre_roll.h"
 
 class CustomWakeWord : public WakeWord {
 public:
@@ -30,7 +32,9 @@ public:
     size_t GetFeedSize();
     void EncodeWakeWordData();
     bool GetWakeWordOpus(std::vector<uint8_t>& opus);
+    size_t ReadRecentAudio(int16_t* out, size_t samples) { return pre_roll_.ReadRecent(out, samples); }
     const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
+    WakeWordBudget* budget() { return &budget_; }
 
 private:
     // multinet 相关成员变量
@@ -42,15 +46,11 @@ private:
     std::function<void(const std::string& wake_word)> wake_word_detected_callback_;
     AudioCodec* codec_ = nullptr;
     std::string last_detected_wake_word_;
+    WakeWordBudget budget_;
     std::atomic<bool> running_ = false;
 
-    TaskHandle_t wake_word_encode_task_ = nullptr;
-    StaticTask_t* wake_word_encode_task_buffer_ = nullptr;
-    StackType_t* wake_word_encode_task_stack_ = nullptr;
-    std::deque<std::vector<int16_t>> wake_word_pcm_;
-    std::deque<std::vector<uint8_t>> wake_word_opus_;
-    std::mutex wake_word_mutex_;
-    std::condition_variable wake_word_cv_;
+    WakeWordPreRoll pre_roll_;
+    std::vector<int16_t> mono_buffer_;
 
     void StoreWakeWordData(const std::vector<int16_t>& data);
 };
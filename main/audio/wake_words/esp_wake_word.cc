@@ -1,5 +1,7 @@
 #include "esp_wake_word.h"
+#include "model_manager.h"
 #include <esp_log.h>
+#include <esp_timer.h>
 
 
 #define TAG "EspWakeWord"
@@ -8,37 +10,75 @@ EspWakeWord::EspWakeWord() {
 }
 
 EspWakeWord::~EspWakeWord() {
-    if (wakenet_data_ != nullptr) {
-        wakenet_iface_->destroy(wakenet_data_);
-        esp_srmodel_deinit(wakenet_model_);
-    }
+    DestroyWakeNet();
 }
 
 bool EspWakeWord::Initialize(AudioCodec* codec) {
     codec_ = codec;
 
-    wakenet_model_ = esp_srmodel_init("model");
-    if (wakenet_model_ == nullptr || wakenet_model_->num == -1) {
+    auto& model_manager = ModelManager::GetInstance();
+    models_ = model_manager.models();
+    if (models_ == nullptr) {
         ESP_LOGE(TAG, "Failed to initialize wakenet model");
         return false;
     }
-    if(wakenet_model_->num > 1) {
-        ESP_LOGW(TAG, "More than one model found, using the first one");
-    } else if (wakenet_model_->num == 0) {
-        ESP_LOGE(TAG, "No model found");
+    auto model = model_manager.GetWakeWordModel();
+    if (model.empty()) {
+        ESP_LOGE(TAG, "No wakenet model found");
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(wakenet_mutex_);
+    return CreateWakeNet(model);
+}
+
+bool EspWakeWord::CreateWakeNet(const std::string& model) {
+    // 名称要用列表里的字符串，create 之后 esp-sr 还会引用
+    char* model_name = esp_srmodel_filter(models_, model.c_str(), NULL);
+    if (model_name == nullptr) {
         return false;
     }
-    char *model_name = wakenet_model_->model_name[0];
     wakenet_iface_ = (esp_wn_iface_t*)esp_wn_handle_from_name(model_name);
-    wakenet_data_ = wakenet_iface_->create(model_name, DET_MODE_95);
+    wakenet_data_ = ModelManager::GetInstance().Load("wake_word", model_name, [&]() {
+        return wakenet_iface_->create(model_name, DET_MODE_95);
+    });
+    if (wakenet_data_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create wakenet %s", model_name);
+        return false;
+    }
+    model_name_ = model_name;
 
     int frequency = wakenet_iface_->get_samp_rate(wakenet_data_);
     int audio_chunksize = wakenet_iface_->get_samp_chunksize(wakenet_data_);
     ESP_LOGI(TAG, "Wake word(%s),freq: %d, chunksize: %d", model_name, frequency, audio_chunksize);
-
+    budget_.SetChunkDuration(audio_chunksize * 1000000LL / frequency);
     return true;
 }
 
+void EspWakeWord::DestroyWakeNet() {
+    if (wakenet_data_ != nullptr) {
+        wakenet_iface_->destroy(wakenet_data_);
+        wakenet_data_ = nullptr;
+        ModelManager::GetInstance().Unload("wake_word");
+    }
+}
+
+// 先释放旧模型再建新的，内存峰值只有一份；新模型建不出来时退回原来的
+bool EspWakeWord::SwitchModel(const std::string& model) {
+    std::lock_guard<std::mutex> lock(wakenet_mutex_);
+    if (models_ == nullptr) {
+        return false;
+    }
+    std::string previous = wakenet_data_ != nullptr ? model_name_ : "";
+    DestroyWakeNet();
+    if (CreateWakeNet(model)) {
+        return true;
+    }
+    if (!previous.empty()) {
+        CreateWakeNet(previous);
+    }
+    return false;
+}
+
 void EspWakeWord::OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback) {
     wake_word_detected_callback_ = callback;
 }
@@ -52,11 +92,17 @@ void EspWakeWord::Stop() {
 }
 
 void EspWakeWord::Feed(const std::vector<int16_t>& data) {
-    if (wakenet_data_ == nullptr || !running_) {
+    if (!running_) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(wakenet_mutex_);
+    if (wakenet_data_ == nullptr) {
         return;
     }
 
+    int64_t start_us = esp_timer_get_time();
     int res = wakenet_iface_->detect(wakenet_data_, (int16_t *)data.data());
+    budget_.AddChunk(esp_timer_get_time() - start_us);
     if (res > 0) {
         last_detected_wake_word_ = wakenet_iface_->get_word_name(wakenet_data_, res);
         running_ = false;
@@ -68,6 +114,7 @@ void EspWakeWord::Feed(const std::vector<int16_t>& data) {
 }
 
 size_t EspWakeWord::GetFeedSize() {
+    std::lock_guard<std::mutex> lock(wakenet_mutex_);
     if (wakenet_data_ == nullptr) {
         return 0;
     }
@@ -9,9 +9,11 @@
 #include <vector>
 #include <functional>
 #include <atomic>
+#include <mutex>
 
 #include "audio_codec.h"
 #include "wake_word.h"
+#include "wake_word_budget.h"
 
 class EspWakeWord : public WakeWord {
 public:
@@ -27,16 +29,24 @@ public:
     void EncodeWakeWordData();
     bool GetWakeWordOpus(std::vector<uint8_t>& opus);
     const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
+    WakeWordBudget* budget() { return &budget_; }
+    bool SwitchModel(const std::string& model);
 
 private:
     esp_wn_iface_t *wakenet_iface_ = nullptr;
     model_iface_data_t *wakenet_data_ = nullptr;
-    srmodel_list_t *wakenet_model_ = nullptr;
+    srmodel_list_t *models_ = nullptr;
+    std::string model_name_;
+    std::mutex wakenet_mutex_;      // 切换模型和检测不能并行
     AudioCodec* codec_ = nullptr;
     std::atomic<bool> running_ = false;
 
     std::function<void(const std::string& wake_word)> wake_word_detected_callback_;
     std::string last_detected_wake_word_;
+    WakeWordBudget budget_;
+
+    bool CreateWakeNet(const std::string& model);
+    void DestroyWakeNet();
 };
 
 #endif
@@ -0,0 +1,61 @@
+#include "wake_word_budget.h"
+
+#include <esp_log.h>
+#include <sdkconfig.h>
+
+#define TAG "WakeWordBudget"
+
+// 超过这么多块还没处理就算超时，AFE 的环形缓冲区默认只能放下几块
+#define WAKE_WORD_BUDGET_BACKLOG_CHUNKS 4
+// 一个窗口内超时的块超过这个比例就算过载
+#define WAKE_WORD_BUDGET_OVERRUN_PERCENT 5
+#define WAKE_WORD_BUDGET_OVER_WINDOWS 2
+#define WAKE_WORD_BUDGET_CALM_WINDOWS 20
+
+void WakeWordBudget::AddChunk(int used_us) {
+    used_us_ += used_us;
+    FinishChunk(used_us > chunk_us_);
+}
+
+void WakeWordBudget::AddBacklog(int backlog_us) {
+    FinishChunk(backlog_us > chunk_us_ * WAKE_WORD_BUDGET_BACKLOG_CHUNKS);
+}
+
+void WakeWordBudget::FinishChunk(bool overrun) {
+    if (overrun) {
+        overruns_++;
+    }
+    if (++chunks_ < WAKE_WORD_BUDGET_WINDOW_CHUNKS) {
+        return;
+    }
+
+    int load = used_us_ * 100 / ((int64_t)chunks_ * chunk_us_);
+    load_ = load;
+    bool over = load > CONFIG_WAKE_WORD_CPU_BUDGET_PERCENT ||
+        overruns_ * 100 >= chunks_ * WAKE_WORD_BUDGET_OVERRUN_PERCENT;
+    bool calm = load < CONFIG_WAKE_WORD_CPU_BUDGET_PERCENT / 2 && overruns_ == 0;
+    over_windows_ = over ? over_windows_ + 1 : 0;
+    calm_windows_ = calm ? calm_windows_ + 1 : 0;
+
+    int level = level_;
+    if (over_windows_ >= WAKE_WORD_BUDGET_OVER_WINDOWS && level < WAKE_WORD_BUDGET_MAX_LEVEL) {
+        ESP_LOGW(TAG, "Over budget: load %d%%, %d/%d chunks overrun, degrade to level %d", load, overruns_, chunks_, level + 1);
+        over_windows_ = 0;
+        SetLevel(level + 1);
+    } else if (calm_windows_ >= WAKE_WORD_BUDGET_CALM_WINDOWS && level > 0) {
+        ESP_LOGI(TAG, "Back within budget: load %d%%, restore to level %d", load, level - 1);
+        calm_windows_ = 0;
+        SetLevel(level - 1);
+    }
+
+    chunks_ = 0;
+    overruns_ = 0;
+    used_us_ = 0;
+}
+
+void WakeWordBudget::SetLevel(int level) {
+    level_ = level;
+    if (level_callback_) {
+        level_callback_(level);
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef WAKE_WORD_BUDGET_H
+#define WAKE_WORD_BUDGET_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+// 统计窗口约 3 秒（30ms 一块）
+#define WAKE_WORD_BUDGET_WINDOW_CHUNKS 100
+#define WAKE_WORD_BUDGET_MAX_LEVEL 2
+
+/*
+ * CPU budget of a wake word engine, measured per input chunk.
+ *
+ * Engines that detect inside Feed() report the time of every detection with AddChunk(), a chunk that
+ * takes longer than the audio it holds is an overrun. Engines with their own detection task report how
+ * much fed audio is still waiting with AddBacklog(), a backlog of more than a few chunks is an overrun
+ * and means the AFE ring is about to overflow. Two windows in a row over CONFIG_WAKE_WORD_CPU_BUDGET_PERCENT
+ * or with overruns raise the degrade level by one, a minute without pressure lowers it again. The
+ * callback runs on the reporting task.
+ */
+class WakeWordBudget {
+public:
+    void SetChunkDuration(int chunk_us) { chunk_us_ = chunk_us; }
+    void AddChunk(int used_us);
+    void AddBacklog(int backlog_us);
+    void OnLevelChange(std::function<void(int level)> callback) { level_callback_ = callback; }
+
+    int level() const { return level_.load(); }
+    // 上一个窗口检测耗时占音频时长的百分比
+    int load() const { return load_.load(); }
+
+private:
+    void FinishChunk(bool overrun);
+    void SetLevel(int level);
+
+    int chunk_us_ = 30000;
+    int chunks_ = 0;
+    int overruns_ = 0;
+    int64_t used_us_ = 0;
+    int over_windows_ = 0;
+    int calm_windows_ = 0;
+    std::atomic<int> level_{0};
+    std::atomic<int> load_{0};
+    std::function<void(int level)> level_callback_;
+};
+
+#endif // WAKE_WORD_BUDGET_H
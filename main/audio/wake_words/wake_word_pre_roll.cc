@@ -0,0 +1,188 @@
+#include "wake_word_pre_roll.h"
+#include "audio_service.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cassert>
+#include <algorithm>
+
+#define TAG "WakeWordPreRoll"
+
+#define WAKE_WORD_ENCODE_STACK_SIZE (4096 * 7)
+
+static const size_t kFrameSamples = 16000 / 1000 * OPUS_FRAME_DURATION_MS;
+
+WakeWordPreRoll::WakeWordPreRoll() : pcm_(kAudioMemoryWakeWord, WAKE_WORD_PRE_ROLL_SAMPLES) {
+}
+
+WakeWordPreRoll::~WakeWordPreRoll() {
+    if (encode_task_stack_ != nullptr) {
+        heap_caps_free(encode_task_stack_);
+    }
+    if (encode_task_buffer_ != nullptr) {
+        heap_caps_free(encode_task_buffer_);
+    }
+}
+
+bool WakeWordPreRoll::StartEncodeTask(TaskFunction_t function) {
+    if (encode_task_stack_ == nullptr) {
+        encode_task_stack_ = (StackType_t*)heap_caps_malloc(WAKE_WORD_ENCODE_STACK_SIZE, MALLOC_CAP_SPIRAM);
+        assert(encode_task_stack_ != nullptr);
+    }
+    if (encode_task_buffer_ == nullptr) {
+        encode_task_buffer_ = (StaticTask_t*)heap_caps_malloc(sizeof(StaticTask_t), MALLOC_CAP_INTERNAL);
+        assert(encode_task_buffer_ != nullptr);
+    }
+    encode_task_ = xTaskCreateStatic(function, "encode_wake_word", WAKE_WORD_ENCODE_STACK_SIZE, this, 2,
+        encode_task_stack_, encode_task_buffer_);
+    return encode_task_ != nullptr;
+}
+
+void WakeWordPreRoll::Store(const int16_t* data, size_t samples) {
+    std::lock_guard<std::mutex> lock(pcm_mutex_);
+#if CONFIG_WAKE_WORD_ROLLING_OPUS
+    // 检测重新开始，之前的音频已经交出或过期
+    if (paused_) {
+        paused_ = false;
+        pcm_.Clear();
+        packet_head_ = 0;
+        packet_count_ = 0;
+        encoded_samples_ = pcm_.written();
+    }
+#endif
+    pcm_.Write(data, samples);
+#if CONFIG_WAKE_WORD_ROLLING_OPUS
+    if (encode_task_ == nullptr) {
+        StartEncodeTask([](void* arg) {
+            ((WakeWordPreRoll*)arg)->RollingEncodeTask();
+        });
+    }
+    if (pcm_.written() - encoded_samples_ >= kFrameSamples) {
+        xTaskNotifyGive(encode_task_);
+    }
+#endif
+}
+
+void WakeWordPreRoll::Encode() {
+#if CONFIG_WAKE_WORD_ROLLING_OPUS
+    std::lock_guard<std::mutex> lock(pcm_mutex_);
+    paused_ = true;
+    {
+        std::lock_guard<std::mutex> opus_lock(opus_mutex_);
+        opus_.clear();
+        for (size_t i = 0; i < packet_count_; i++) {
+            auto& packet = packets_[(packet_head_ + i) % packets_.size()];
+            // 空包表示结束，编码失败的槽位跳过
+            if (!packet.empty()) {
+                opus_.emplace_back(std::move(packet));
+            }
+        }
+        opus_.push_back(std::vector<uint8_t>());
+    }
+    ESP_LOGI(TAG, "Wake word opus %u packets ready", packet_count_);
+    packet_head_ = 0;
+    packet_count_ = 0;
+    opus_cv_.notify_all();
+#else
+    {
+        std::lock_guard<std::mutex> lock(opus_mutex_);
+        opus_.clear();
+    }
+    StartEncodeTask([](void* arg) {
+        ((WakeWordPreRoll*)arg)->BurstEncode();
+        vTaskDelete(NULL);
+    });
+#endif
+}
+
+// 检测到唤醒词后一次性编码，检测已停止，缓冲区不会再被写入
+void WakeWordPreRoll::BurstEncode() {
+    auto start_time = esp_timer_get_time();
+    auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+    encoder->SetComplexity(0); // 0 is the fastest
+
+    int packets = 0;
+    for (size_t offset = 0; offset < pcm_.size(); offset += kFrameSamples) {
+        std::vector<int16_t> pcm(kFrameSamples);
+        {
+            std::lock_guard<std::mutex> lock(pcm_mutex_);
+            pcm.resize(pcm_.Read(offset, pcm.data(), kFrameSamples));
+        }
+        encoder->Encode(std::move(pcm), [this](std::vector<uint8_t>&& opus) {
+            std::lock_guard<std::mutex> lock(opus_mutex_);
+            opus_.emplace_back(std::move(opus));
+            opus_cv_.notify_all();
+        });
+        packets++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(pcm_mutex_);
+        pcm_.Clear();
+    }
+
+    auto end_time = esp_timer_get_time();
+    ESP_LOGI(TAG, "Encode wake word opus %d packets in %ld ms", packets, (long)((end_time - start_time) / 1000));
+
+    std::lock_guard<std::mutex> lock(opus_mutex_);
+    opus_.push_back(std::vector<uint8_t>());
+    opus_cv_.notify_all();
+}
+
+#if CONFIG_WAKE_WORD_ROLLING_OPUS
+void WakeWordPreRoll::RollingEncodeTask() {
+    auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+    encoder->SetComplexity(0);
+    {
+        std::lock_guard<std::mutex> lock(pcm_mutex_);
+        packets_.resize(WAKE_WORD_PRE_ROLL_SAMPLES / kFrameSamples);
+    }
+
+    std::vector<int16_t> frame(kFrameSamples);
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        // 编码期间持有锁，交出数据时不会漏掉正在编码的一帧
+        std::lock_guard<std::mutex> lock(pcm_mutex_);
+        while (!paused_ && pcm_.written() - encoded_samples_ >= kFrameSamples) {
+            uint64_t pending = pcm_.written() - encoded_samples_;
+            if (pending > pcm_.size()) {
+                // 落后超过缓冲区长度，从最旧的采样继续
+                encoded_samples_ = pcm_.written() - pcm_.size();
+                pending = pcm_.size();
+                if (pending < kFrameSamples) {
+                    break;
+                }
+            }
+            pcm_.Read(pcm_.size() - pending, frame.data(), kFrameSamples);
+            encoded_samples_ += kFrameSamples;
+
+            std::vector<uint8_t>* slot;
+            if (packet_count_ < packets_.size()) {
+                slot = &packets_[(packet_head_ + packet_count_++) % packets_.size()];
+            } else {
+                slot = &packets_[packet_head_];
+                packet_head_ = (packet_head_ + 1) % packets_.size();
+            }
+            // Encode() 只读取 frame，不会移走其中的数据
+            if (!encoder->Encode(std::move(frame), *slot)) {
+                slot->clear();
+            }
+        }
+    }
+}
+#endif
+
+size_t WakeWordPreRoll::ReadRecent(int16_t* out, size_t samples) {
+    std::lock_guard<std::mutex> lock(pcm_mutex_);
+    samples = std::min(samples, pcm_.size());
+    return pcm_.Read(pcm_.size() - samples, out, samples);
+}
+
+bool WakeWordPreRoll::GetOpus(std::vector<uint8_t>& opus) {
+    std::unique_lock<std::mutex> lock(opus_mutex_);
+    opus_cv_.wait(lock, [this]() {
+        return !opus_.empty();
+    });
+    opus.swap(opus_.front());
+    opus_.pop_front();
+    return !opus.empty();
+}
@@ -0,0 +1,63 @@
+#ifndef WAKE_WORD_PRE_ROLL_H
+#define WAKE_WORD_PRE_ROLL_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include "pcm_ring_buffer.h"
+
+// About 2 seconds of 16kHz mono audio before the wake word
+#define WAKE_WORD_PRE_ROLL_SAMPLES (16000 * 2)
+
+/*
+ * The audio before and including the wake word, sent to the server for voice recognition.
+ *
+ * Store() keeps the last WAKE_WORD_PRE_ROLL_SAMPLES from the detection task. By default Encode()
+ * encodes them in a burst after the detection, while the audio channel opens. With
+ * CONFIG_WAKE_WORD_ROLLING_OPUS an encoder task keeps a ring of Opus packets up to date all along at
+ * the lowest complexity, so Encode() only hands over the packets. GetOpus() blocks until the next
+ * packet is ready and returns false after the last one.
+ */
+class WakeWordPreRoll {
+public:
+    WakeWordPreRoll();
+    ~WakeWordPreRoll();
+
+    void Store(const int16_t* data, size_t samples);
+    void Encode();
+    bool GetOpus(std::vector<uint8_t>& opus);
+    // Copies the last samples stored, e.g. push-to-talk speech from before the voice processing started
+    size_t ReadRecent(int16_t* out, size_t samples);
+
+private:
+    TaskHandle_t encode_task_ = nullptr;
+    StaticTask_t* encode_task_buffer_ = nullptr;
+    StackType_t* encode_task_stack_ = nullptr;
+    std::mutex pcm_mutex_;
+    PcmRingBuffer pcm_;
+    std::deque<std::vector<uint8_t>> opus_;
+    std::mutex opus_mutex_;
+    std::condition_variable opus_cv_;
+
+#if CONFIG_WAKE_WORD_ROLLING_OPUS
+    // 预先编码好的最近 2 秒 Opus 包，槽位的 vector 循环复用
+    std::vector<std::vector<uint8_t>> packets_;
+    size_t packet_head_ = 0;
+    size_t packet_count_ = 0;
+    uint64_t encoded_samples_ = 0;
+    bool paused_ = false;
+
+    void RollingEncodeTask();
+#endif
+
+    bool StartEncodeTask(TaskFunction_t function);
+    void BurstEncode();
+};
+
+#endif // WAKE_WORD_PRE_ROLL_H
@@ -0,0 +1,443 @@
+#include "benchmark.h"
+#include "protocol.h"
+#include "json_writer.h"
+#include "jitter_buffer.h"
+#include "polyphase_resampler.h"
+#include "audio_dsp.h"
+#include "audio_shaper.h"
+#include "display.h"
+#include "settings.h"
+#include "audio_service.h"
+
+#include <opus_encoder.h>
+#include <opus_decoder.h>
+#include <mp3dec.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <esp_attr.h>
+#include <esp_partition.h>
+#include <esp_ota_ops.h>
+#include <esp_app_desc.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <arpa/inet.h>
+#include <dl_rfft.h>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+#define TAG "Benchmark"
+
+#define BENCHMARK_SAMPLE_RATE 16000
+#define BENCHMARK_FRAME_MS 60
+#define BENCHMARK_FRAME_SAMPLES (BENCHMARK_SAMPLE_RATE * BENCHMARK_FRAME_MS / 1000)
+#define BENCHMARK_OPUS_PACKET_SIZE 120
+#define BENCHMARK_FFT_SIZE 512
+#define BENCHMARK_TASK_STACK_SIZE (2048 * 12)   // Same as the Opus encoder task
+#define BENCHMARK_SRAM_COPY_SIZE (16 * 1024)
+#define BENCHMARK_PSRAM_COPY_SIZE (256 * 1024)
+#define BENCHMARK_FLASH_READ_SIZE (64 * 1024)
+#define BENCHMARK_FLASH_CHUNK_SIZE 4096
+
+static std::atomic<TaskHandle_t> s_counted_task{nullptr};
+static std::atomic<uint32_t> s_alloc_count{0};
+
+#if CONFIG_HEAP_USE_HOOKS
+// 所有任务的分配都会进来，只统计正在跑基准的任务
+extern "C" IRAM_ATTR void esp_heap_trace_alloc_hook(void* ptr, size_t size, uint32_t caps) {
+    if (s_counted_task.load(std::memory_order_relaxed) == xTaskGetCurrentTaskHandle()) {
+        s_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+extern "C" IRAM_ATTR void esp_heap_trace_free_hook(void* ptr) {
+}
+#endif
+
+// 语音频段的合成信号，避免全零输入走捷径
+static void FillTestSignal(int16_t* pcm, size_t samples, int sample_rate) {
+    for (size_t i = 0; i < samples; i++) {
+        float t = (float)i / sample_rate;
+        pcm[i] = (int16_t)(8000.0f * sinf(2 * M_PI * 440 * t) + 3000.0f * sinf(2 * M_PI * 1870 * t));
+    }
+}
+
+BenchmarkResult Benchmark::Run(const char* name, const std::function<void()>& body, float units, const char* unit,
+    int min_iterations, int min_time_ms) {
+    // 第一次运行会分配缓冲区、预热 cache，不计入结果
+    body();
+
+    s_alloc_count.store(0, std::memory_order_relaxed);
+    s_counted_task.store(xTaskGetCurrentTaskHandle(), std::memory_order_relaxed);
+    int iterations = 0;
+    int64_t start_us = esp_timer_get_time();
+    int64_t elapsed_us = 0;
+    do {
+        body();
+        iterations++;
+        elapsed_us = esp_timer_get_time() - start_us;
+    } while (iterations < min_iterations || elapsed_us < min_time_ms * 1000);
+    s_counted_task.store(nullptr, std::memory_order_relaxed);
+
+    BenchmarkResult result;
+    result.name = name;
+    result.iterations = iterations;
+    result.us_per_iteration = (float)elapsed_us / iterations;
+#if CONFIG_HEAP_USE_HOOKS
+    result.allocs_per_iteration = (float)s_alloc_count.load(std::memory_order_relaxed) / iterations;
+#endif
+    if (units > 0 && elapsed_us > 0) {
+        result.units_per_second = units * iterations * 1000000.0f / elapsed_us;
+    }
+    result.unit = unit;
+    return result;
+}
+
+std::vector<BenchmarkResult> Benchmark::RunCoreSuite() {
+    std::vector<BenchmarkResult> results;
+    std::vector<int16_t> pcm(BENCHMARK_FRAME_SAMPLES);
+    FillTestSignal(pcm.data(), pcm.size(), BENCHMARK_SAMPLE_RATE);
+    std::vector<uint8_t> opus(BENCHMARK_OPUS_PACKET_SIZE, 0x5A);
+
+    // 解码队列、发送队列的每帧开销：取池化数据包并填入一帧 Opus
+    results.push_back(Run("packet_pool", [&]() {
+        auto packet = AcquireAudioStreamPacket();
+        packet->payload.assign(opus.begin(), opus.end());
+    }));
+
+    // 与 WebsocketProtocol::SendAudio 相同，协议头插入到数据包缓冲区前面
+    auto packet = AcquireAudioStreamPacket();
+    results.push_back(Run("binary_protocol3", [&]() {
+        packet->payload.assign(opus.begin(), opus.end());
+        packet->payload.insert(packet->payload.begin(), sizeof(BinaryProtocol3), 0);
+        auto bp3 = (BinaryProtocol3*)packet->payload.data();
+        bp3->type = 0;
+        bp3->reserved = 0;
+        bp3->payload_size = htons(opus.size());
+    }, BENCHMARK_OPUS_PACKET_SIZE, "B"));
+    packet.reset();
+
+    std::string json;
+    results.push_back(Run("json_message", [&]() {
+        json.clear();
+        JsonWriter writer(json);
+        writer.Raw("{\"session_id\":").String("2f6a0c1e-5d3b-4a8f-9c21-7e4b6d8a9f03")
+            .Raw(",\"type\":\"listen\",\"state\":").String("detect")
+            .Raw(",\"text\":").String("你好小智").Raw("}");
+    }));
+
+    // 顺序到达的 UDP 包，每次进一个出一个
+    JitterBuffer jitter_buffer;
+    uint32_t sequence = 0;
+    int64_t now_us = 0;
+    results.push_back(Run("jitter_buffer", [&]() {
+        auto in = AcquireAudioStreamPacket();
+        in->sequence = ++sequence;
+        in->payload.assign(opus.begin(), opus.end());
+        now_us += BENCHMARK_FRAME_MS * 1000;
+        jitter_buffer.Push(std::move(in), now_us);
+        AudioStreamPacketPtr out;
+        jitter_buffer.Pop(now_us, out);
+    }));
+    jitter_buffer.Reset();
+
+    std::vector<int16_t> resampled;
+    PolyphaseResampler resampler;
+    for (int output_rate : {24000, 48000}) {
+        resampler.Configure(BENCHMARK_SAMPLE_RATE, output_rate);
+        results.push_back(Run(output_rate == 24000 ? "resample_16k_24k" : "resample_16k_48k", [&]() {
+            resampler.Process(pcm.data(), pcm.size(), resampled);
+        }, BENCHMARK_FRAME_SAMPLES, "samples"));
+    }
+
+    std::vector<int16_t> mixed(pcm);
+    results.push_back(Run("mix_ramp", [&]() {
+        AudioDsp::MixRamp(mixed.data(), pcm.data(), pcm.size(), 1 << 14, 1 << 15);
+    }, BENCHMARK_FRAME_SAMPLES, "samples"));
+
+    AudioShaper shaper;
+    shaper.Configure(kAudioEqSmallSpeaker, true);
+    std::vector<int16_t> shaped(pcm);
+    results.push_back(Run("shaper", [&]() {
+        shaper.Process(shaped.data(), shaped.size(), BENCHMARK_SAMPLE_RATE, 1);
+    }, BENCHMARK_FRAME_SAMPLES, "samples"));
+
+    // 与 LcdDisplay 频谱相同：加窗、实数 FFT、功率谱
+    auto fft_handle = dl_rfft_f32_init(BENCHMARK_FFT_SIZE, MALLOC_CAP_8BIT);
+    auto fft_data = (float*)heap_caps_aligned_alloc(16, BENCHMARK_FFT_SIZE * sizeof(float), MALLOC_CAP_8BIT);
+    std::vector<float> window(BENCHMARK_FFT_SIZE), power(BENCHMARK_FFT_SIZE / 2);
+    if (fft_handle != nullptr && fft_data != nullptr) {
+        for (int i = 0; i < BENCHMARK_FFT_SIZE; i++) {
+            window[i] = 0.5f * (1 - cosf(2 * M_PI * i / (BENCHMARK_FFT_SIZE - 1)));
+        }
+        results.push_back(Run("spectrum_fft", [&]() {
+            for (int i = 0; i < BENCHMARK_FFT_SIZE; i++) {
+                fft_data[i] = pcm[i] * window[i];
+            }
+            dl_rfft_f32_run(fft_handle, fft_data);
+            power[0] = fft_data[0] * fft_data[0];
+            for (int i = 1; i < BENCHMARK_FFT_SIZE / 2; i++) {
+                power[i] = fft_data[2 * i] * fft_data[2 * i] + fft_data[2 * i + 1] * fft_data[2 * i + 1];
+            }
+        }, BENCHMARK_FFT_SIZE, "samples"));
+    }
+    if (fft_handle != nullptr) {
+        dl_rfft_f32_deinit(fft_handle);
+    }
+    heap_caps_free(fft_data);
+
+    return results;
+}
+
+// 静音的 MPEG-1 Layer III 帧（128 kbps、44.1 kHz、单声道），哈夫曼部分为空，但反量化、IMDCT 和合成滤波照常运行，
+// 所以耗时略低于真实音乐
+static std::vector<uint8_t> MakeSilentMp3Frame() {
+    std::vector<uint8_t> frame(144 * 128000 / 44100, 0);
+    frame[0] = 0xFF;
+    frame[1] = 0xFB;
+    frame[2] = 0x90;
+    frame[3] = 0xC0;
+    return frame;
+}
+
+static const BenchmarkResult* FindResult(const std::vector<BenchmarkResult>& results, const char* name) {
+    for (auto& result : results) {
+        if (strcmp(result.name, name) == 0) {
+            return &result;
+        }
+    }
+    return nullptr;
+}
+
+static const char* const kOpusComplexityCases[] = {
+    "opus_encode", "opus_encode_c1", "opus_encode_c2", "opus_encode_c3", "opus_encode_c4", "opus_encode_c5",
+    "opus_encode_c6", "opus_encode_c7", "opus_encode_c8", "opus_encode_c9", "opus_encode_c10",
+};
+
+/*
+ * Every encoder complexity on the same synthetic frame, the 16 kHz uplink decode and the 24 kHz TTS decode.
+ * Complexity 0 is the same as the wake word encoder and the lower bound, it keeps the opus_encode name.
+ * Returns the stack high water mark of the calling task, the Opus cases are the deepest ones it runs.
+ */
+static int RunOpusCases(std::vector<BenchmarkResult>& results) {
+    std::vector<int16_t> pcm(BENCHMARK_FRAME_SAMPLES);
+    FillTestSignal(pcm.data(), pcm.size(), BENCHMARK_SAMPLE_RATE);
+
+    std::vector<uint8_t> opus;
+    {
+        OpusEncoderWrapper encoder(BENCHMARK_SAMPLE_RATE, 1, BENCHMARK_FRAME_MS);
+        for (int complexity = 10; complexity >= 0; complexity--) {
+            encoder.SetComplexity(complexity);
+            results.push_back(Benchmark::Run(kOpusComplexityCases[complexity], [&]() {
+                encoder.Encode(std::vector<int16_t>(pcm), opus);
+            }, BENCHMARK_FRAME_SAMPLES, "samples", 10));
+        }
+    }
+    {
+        OpusDecoderWrapper decoder(BENCHMARK_SAMPLE_RATE, 1, BENCHMARK_FRAME_MS);
+        std::vector<int16_t> decoded;
+        results.push_back(Benchmark::Run("opus_decode", [&]() {
+            decoder.Decode(std::vector<uint8_t>(opus), decoded);
+        }, BENCHMARK_FRAME_SAMPLES, "samples", 10));
+    }
+
+    const int tts_sample_rate = 24000;
+    const int tts_samples = tts_sample_rate * BENCHMARK_FRAME_MS / 1000;
+    std::vector<int16_t> tts_pcm(tts_samples);
+    FillTestSignal(tts_pcm.data(), tts_pcm.size(), tts_sample_rate);
+    {
+        OpusEncoderWrapper encoder(tts_sample_rate, 1, BENCHMARK_FRAME_MS);
+        encoder.SetComplexity(0);
+        encoder.Encode(std::move(tts_pcm), opus);
+        OpusDecoderWrapper decoder(tts_sample_rate, 1, BENCHMARK_FRAME_MS);
+        std::vector<int16_t> decoded;
+        results.push_back(Benchmark::Run("opus_decode_24k", [&]() {
+            decoder.Decode(std::vector<uint8_t>(opus), decoded);
+        }, tts_samples, "samples", 10));
+    }
+    return BENCHMARK_TASK_STACK_SIZE - uxTaskGetStackHighWaterMark(nullptr);
+}
+
+static void RunDeviceCases(std::vector<BenchmarkResult>& results, Display* display) {
+    auto mp3_decoder = MP3InitDecoder();
+    if (mp3_decoder != nullptr) {
+        auto frame = MakeSilentMp3Frame();
+        std::vector<int16_t> output(1152 * 2);
+        auto decode = [&]() {
+            unsigned char* read_ptr = frame.data();
+            int bytes_left = frame.size();
+            return MP3Decode(mp3_decoder, &read_ptr, &bytes_left, output.data(), 0);
+        };
+        if (decode() == ERR_MP3_NONE) {
+            results.push_back(Benchmark::Run("mp3_decode", [&]() { decode(); }, 1152, "samples", 10));
+        } else {
+            ESP_LOGW(TAG, "MP3 test frame rejected by the decoder");
+        }
+        MP3FreeDecoder(mp3_decoder);
+    }
+
+    auto sram = (uint8_t*)heap_caps_malloc(BENCHMARK_SRAM_COPY_SIZE * 2, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (sram != nullptr) {
+        memset(sram, 0x5A, BENCHMARK_SRAM_COPY_SIZE * 2);
+        results.push_back(Benchmark::Run("sram_memcpy", [&]() {
+            memcpy(sram + BENCHMARK_SRAM_COPY_SIZE, sram, BENCHMARK_SRAM_COPY_SIZE);
+        }, BENCHMARK_SRAM_COPY_SIZE / 1024, "KB"));
+        heap_caps_free(sram);
+    }
+
+    // 拷贝量远大于 cache，测的是 PSRAM 本身的带宽
+    auto psram = (uint8_t*)heap_caps_malloc(BENCHMARK_PSRAM_COPY_SIZE * 2, MALLOC_CAP_SPIRAM);
+    if (psram != nullptr) {
+        memset(psram, 0x5A, BENCHMARK_PSRAM_COPY_SIZE * 2);
+        results.push_back(Benchmark::Run("psram_memcpy", [&]() {
+            memcpy(psram + BENCHMARK_PSRAM_COPY_SIZE, psram, BENCHMARK_PSRAM_COPY_SIZE);
+        }, BENCHMARK_PSRAM_COPY_SIZE / 1024, "KB", 5));
+        heap_caps_free(psram);
+    }
+
+    auto partition = esp_ota_get_running_partition();
+    std::vector<uint8_t> chunk(BENCHMARK_FLASH_CHUNK_SIZE);
+    if (partition != nullptr && partition->size >= BENCHMARK_FLASH_READ_SIZE) {
+        results.push_back(Benchmark::Run("flash_read", [&]() {
+            for (size_t offset = 0; offset < BENCHMARK_FLASH_READ_SIZE; offset += chunk.size()) {
+                esp_partition_read(partition, offset, chunk.data(), chunk.size());
+            }
+        }, BENCHMARK_FLASH_READ_SIZE / 1024, "KB", 5));
+    }
+
+    if (display != nullptr && display->RenderFullFrame()) {
+        results.push_back(Benchmark::Run("lvgl_render", [&]() {
+            display->RenderFullFrame();
+        }, display->width() * display->height(), "pixels", 5));
+    }
+}
+
+std::string Benchmark::RunDeviceSuite(Display* display) {
+    struct Job {
+        Display* display;
+        std::vector<BenchmarkResult> results;
+        int opus_stack_bytes;
+        SemaphoreHandle_t done;
+    } job = { display, {}, 0, xSemaphoreCreateBinary() };
+    if (job.done == nullptr) {
+        return "{\"success\": false, \"message\": \"Out of memory\"}";
+    }
+
+    // Opus 编码器需要很大的栈，工具调用任务的栈不够
+    BaseType_t created = xTaskCreate([](void* arg) {
+        auto job = static_cast<Job*>(arg);
+        job->results = RunCoreSuite();
+        job->opus_stack_bytes = RunOpusCases(job->results);
+        RunDeviceCases(job->results, job->display);
+        xSemaphoreGive(job->done);
+        vTaskDelete(nullptr);
+    }, "benchmark", BENCHMARK_TASK_STACK_SIZE, &job, 1, nullptr);
+    if (created != pdPASS) {
+        vSemaphoreDelete(job.done);
+        return "{\"success\": false, \"message\": \"Failed to create benchmark task\"}";
+    }
+    xSemaphoreTake(job.done, portMAX_DELAY);
+    vSemaphoreDelete(job.done);
+    Log(job.results);
+
+    PerformanceProfile profile;
+    auto us = [&](const char* name) {
+        auto result = FindResult(job.results, name);
+        return result != nullptr ? (int)(result->us_per_iteration + 0.5f) : 0;
+    };
+    auto kbps = [&](const char* name) {
+        auto result = FindResult(job.results, name);
+        return result != nullptr ? (int)result->units_per_second : 0;
+    };
+    profile.opus_encode_us = us("opus_encode");
+    profile.opus_decode_us = us("opus_decode");
+    // 实时预算按自动调节降复杂度的负载上限，编码和上行解码在同一帧时间内完成
+    int frame_budget_us = BENCHMARK_FRAME_MS * 1000 * OPUS_ENCODER_TUNE_LOWER_LOAD_PERCENT / 100;
+    for (int complexity = 0; complexity <= 10; complexity++) {
+        int encode_us = us(kOpusComplexityCases[complexity]);
+        if (encode_us == 0 || encode_us + profile.opus_decode_us > frame_budget_us) {
+            break;
+        }
+        profile.opus_max_complexity = complexity;
+    }
+    profile.mp3_decode_us = us("mp3_decode");
+    profile.resample_us = us("resample_16k_48k");
+    profile.fft_us = us("spectrum_fft");
+    profile.sram_kbps = kbps("sram_memcpy");
+    profile.psram_kbps = kbps("psram_memcpy");
+    profile.flash_kbps = kbps("flash_read");
+    profile.render_us = us("lvgl_render");
+    profile.firmware = esp_app_get_description()->version;
+    profile.Save();
+
+    ESP_LOGI(TAG, "Opus: max realtime complexity %d, stack peak %d bytes of %d", profile.opus_max_complexity,
+        job.opus_stack_bytes, BENCHMARK_TASK_STACK_SIZE);
+    return "{\"success\": true, \"firmware\": \"" + profile.firmware + "\", \"target\": \"" CONFIG_IDF_TARGET "\"" +
+        ", \"opus_max_complexity\": " + std::to_string(profile.opus_max_complexity) +
+        ", \"opus_stack_bytes\": " + std::to_string(job.opus_stack_bytes) + ", \"results\": " + ToJson(job.results) + "}";
+}
+
+PerformanceProfile PerformanceProfile::Load() {
+    Settings settings("benchmark");
+    PerformanceProfile profile;
+    profile.opus_encode_us = settings.GetInt("opus_enc_us");
+    profile.opus_decode_us = settings.GetInt("opus_dec_us");
+    profile.opus_max_complexity = settings.GetInt("opus_max_cx", -1);
+    profile.mp3_decode_us = settings.GetInt("mp3_dec_us");
+    profile.resample_us = settings.GetInt("resample_us");
+    profile.fft_us = settings.GetInt("fft_us");
+    profile.sram_kbps = settings.GetInt("sram_kbps");
+    profile.psram_kbps = settings.GetInt("psram_kbps");
+    profile.flash_kbps = settings.GetInt("flash_kbps");
+    profile.render_us = settings.GetInt("render_us");
+    profile.firmware = settings.GetString("firmware");
+    return profile;
+}
+
+void PerformanceProfile::Save() const {
+    Settings settings("benchmark", true);
+    settings.SetInt("opus_enc_us", opus_encode_us);
+    settings.SetInt("opus_dec_us", opus_decode_us);
+    settings.SetInt("opus_max_cx", opus_max_complexity);
+    settings.SetInt("mp3_dec_us", mp3_decode_us);
+    settings.SetInt("resample_us", resample_us);
+    settings.SetInt("fft_us", fft_us);
+    settings.SetInt("sram_kbps", sram_kbps);
+    settings.SetInt("psram_kbps", psram_kbps);
+    settings.SetInt("flash_kbps", flash_kbps);
+    settings.SetInt("render_us", render_us);
+    settings.SetString("firmware", firmware);
+}
+
+void Benchmark::Log(const std::vector<BenchmarkResult>& results) {
+    for (auto& result : results) {
+        if (result.units_per_second > 0) {
+            ESP_LOGI(TAG, "%-18s %9.1f us  %5.2f allocs  %10.0f %s/s  (%d runs)", result.name, result.us_per_iteration,
+                result.allocs_per_iteration, result.units_per_second, result.unit, result.iterations);
+        } else {
+            ESP_LOGI(TAG, "%-18s %9.1f us  %5.2f allocs  (%d runs)", result.name, result.us_per_iteration,
+                result.allocs_per_iteration, result.iterations);
+        }
+    }
+}
+
+std::string Benchmark::ToJson(const std::vector<BenchmarkResult>& results) {
+    char buffer[160];
+    std::string json = "{";
+    for (size_t i = 0; i < results.size(); i++) {
+        auto& result = results[i];
+        snprintf(buffer, sizeof(buffer), "%s\"%s\":{\"us\":%.1f,\"allocs\":%.2f,\"iterations\":%d", i == 0 ? "" : ",",
+            result.name, result.us_per_iteration, result.allocs_per_iteration, result.iterations);
+        json += buffer;
+        if (result.units_per_second > 0) {
+            snprintf(buffer, sizeof(buffer), ",\"%s_per_s\":%.0f", result.unit, result.units_per_second);
+            json += buffer;
+        }
+        json += "}";
+    }
+    json += "}";
+    return json;
+}
@@ -0,0 +1,65 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct BenchmarkResult {
+    const char* name = nullptr;
+    int iterations = 0;
+    float us_per_iteration = 0;
+    // Heap allocations per iteration, -1 without CONFIG_HEAP_USE_HOOKS
+    float allocs_per_iteration = -1;
+    // Work units (samples, bytes, pixels) per second, 0 if the case has none
+    float units_per_second = 0;
+    const char* unit = "";
+};
+
+class Display;
+
+// Per board numbers measured by Benchmark::RunDeviceSuite() and kept in Settings, 0 when not measured
+struct PerformanceProfile {
+    int opus_encode_us = 0;     // One 60 ms frame at 16 kHz
+    int opus_decode_us = 0;
+    // Highest encoder complexity whose encode plus decode stays within the auto tune load limit, -1 when not measured
+    int opus_max_complexity = -1;
+    int mp3_decode_us = 0;      // One 1152 sample frame
+    int resample_us = 0;        // One 60 ms frame, 16 kHz to 48 kHz
+    int fft_us = 0;             // 512 point spectrum
+    int sram_kbps = 0;          // memcpy bandwidth
+    int psram_kbps = 0;
+    int flash_kbps = 0;         // esp_partition_read of the running app
+    int render_us = 0;          // LVGL full screen render and flush
+    std::string firmware;       // Version that measured it, the numbers change with the build
+
+    bool valid() const { return opus_encode_us > 0; }
+    static PerformanceProfile Load();
+    void Save() const;
+};
+
+/*
+ * Micro benchmarks of the per frame hot paths: packet pool, protocol headers and JSON, jitter buffer,
+ * resampler, mixer DSP, shaper and the spectrum FFT. They run standalone on the device without codec or
+ * network, so a build can be profiled before it goes out. Run() warms up each case once, then repeats it
+ * until both the minimum iterations and time are reached; allocations are counted for the calling task
+ * only through the heap hooks.
+ */
+class Benchmark {
+public:
+    // Body runs one iteration, units is how many work units it processes
+    static BenchmarkResult Run(const char* name, const std::function<void()>& body, float units = 0, const char* unit = "",
+        int min_iterations = 20, int min_time_ms = 200);
+
+    static std::vector<BenchmarkResult> RunCoreSuite();
+    // Core suite plus Opus, MP3, memory and flash bandwidth and the display render, on a task of its own with
+    // enough stack for the Opus encoder. Opus runs at every encoder complexity and reports the stack it peaked at.
+    // Saves the PerformanceProfile and returns the results as JSON.
+    static std::string RunDeviceSuite(Display* display);
+
+    static void Log(const std::vector<BenchmarkResult>& results);
+    static std::string ToJson(const std::vector<BenchmarkResult>& results);
+};
+
+#endif // BENCHMARK_H
@@ -0,0 +1,154 @@
+#include "black_box.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+
+#include <memory>
+
+#define TAG "BlackBox"
+
+#define BLACK_BOX_MAGIC 0x58424258  // "XBBX"
+
+struct BlackBoxEvent {
+    uint32_t time_ms;
+    uint8_t type;
+    uint8_t boot;       // 低 8 位的启动次数
+    uint16_t arg;
+    uint32_t value;
+};
+
+struct BlackBoxLog {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t boot_count;
+    uint16_t head;
+    uint16_t count;
+    BlackBoxEvent events[BLACK_BOX_CAPACITY];
+};
+
+// 软件复位、看门狗和 panic 后保持原样，上电时是随机内容
+static RTC_NOINIT_ATTR BlackBoxLog black_box_log;
+static portMUX_TYPE black_box_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool black_box_ready = false;
+
+static const char* const kEventTypeNames[kBlackBoxEventTypeCount] = {
+    "boot",
+    "state_change",
+    "underrun",
+    "queue_full",
+    "decode_error",
+    "alloc_failure",
+    "task_watchdog",
+    "heap_fragmented",
+};
+
+static void IRAM_ATTR RecordEvent(BlackBoxEventType type, uint16_t arg, uint32_t value) {
+    if (!black_box_ready) {
+        return;
+    }
+    uint32_t time_ms = esp_timer_get_time() / 1000;
+    portENTER_CRITICAL_SAFE(&black_box_lock);
+    auto& event = black_box_log.events[black_box_log.head];
+    event.time_ms = time_ms;
+    event.type = type;
+    event.boot = black_box_log.boot_count;
+    event.arg = arg;
+    event.value = value;
+    black_box_log.head = (black_box_log.head + 1) % BLACK_BOX_CAPACITY;
+    if (black_box_log.count < BLACK_BOX_CAPACITY) {
+        black_box_log.count++;
+    }
+    portEXIT_CRITICAL_SAFE(&black_box_lock);
+}
+
+static void AllocFailedCallback(size_t size, uint32_t caps, const char* function_name) {
+    RecordEvent(kBlackBoxAllocFailure, caps & 0xFFFF, size);
+}
+
+// Called from the task watchdog ISR before it prints or panics
+extern "C" void IRAM_ATTR esp_task_wdt_isr_user_handler(void) {
+    RecordEvent(kBlackBoxTaskWatchdog, 0, 0);
+}
+
+void BlackBox::Initialize() {
+    if (black_box_ready) {
+        return;
+    }
+    reset_reason_ = esp_reset_reason();
+    auto& trace = black_box_log;
+    if (reset_reason_ == ESP_RST_POWERON || trace.magic != BLACK_BOX_MAGIC || trace.version != BLACK_BOX_VERSION ||
+        trace.head >= BLACK_BOX_CAPACITY || trace.count > BLACK_BOX_CAPACITY) {
+        trace = {};
+        trace.magic = BLACK_BOX_MAGIC;
+        trace.version = BLACK_BOX_VERSION;
+    }
+    trace.boot_count++;
+    black_box_ready = true;
+
+    RecordEvent(kBlackBoxBoot, reset_reason_, heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+    heap_caps_register_failed_alloc_callback(AllocFailedCallback);
+    ESP_LOGI(TAG, "Boot %u, reset reason %d, %u events kept", trace.boot_count, reset_reason_, trace.count);
+}
+
+void BlackBox::Record(BlackBoxEventType type, uint16_t arg, uint32_t value) {
+    RecordEvent(type, arg, value);
+}
+
+void BlackBox::Clear() {
+    portENTER_CRITICAL(&black_box_lock);
+    black_box_log.head = 0;
+    black_box_log.count = 0;
+    portEXIT_CRITICAL(&black_box_lock);
+}
+
+uint16_t BlackBox::boot_count() const {
+    return black_box_log.boot_count;
+}
+
+bool BlackBox::HasIncident() const {
+    switch (reset_reason_) {
+    case ESP_RST_PANIC:
+    case ESP_RST_INT_WDT:
+    case ESP_RST_TASK_WDT:
+    case ESP_RST_WDT:
+    case ESP_RST_BROWNOUT:
+        return true;
+    default:
+        return false;
+    }
+}
+
+const char* BlackBox::EventTypeName(BlackBoxEventType type) {
+    return type < kBlackBoxEventTypeCount ? kEventTypeNames[type] : "unknown";
+}
+
+std::string BlackBox::ToJson() const {
+    // 先拷贝出来，不在临界区里拼字符串
+    auto copy = std::make_unique<BlackBoxLog>();
+    portENTER_CRITICAL(&black_box_lock);
+    *copy = black_box_log;
+    portEXIT_CRITICAL(&black_box_lock);
+    const auto& snapshot = *copy;
+
+    std::string json = "{\"boot\":" + std::to_string(snapshot.boot_count);
+    json += ",\"reset_reason\":" + std::to_string(reset_reason_);
+    json += ",\"events\":[";
+    size_t start = (snapshot.head + BLACK_BOX_CAPACITY - snapshot.count) % BLACK_BOX_CAPACITY;
+    for (size_t i = 0; i < snapshot.count; i++) {
+        const auto& event = snapshot.events[(start + i) % BLACK_BOX_CAPACITY];
+        int boot = (int8_t)(event.boot - (uint8_t)snapshot.boot_count);
+        if (i > 0) {
+            json += ",";
+        }
+        json += "{\"boot\":" + std::to_string(boot);
+        json += ",\"t\":" + std::to_string(event.time_ms);
+        json += ",\"type\":\"";
+        json += EventTypeName((BlackBoxEventType)event.type);
+        json += "\",\"arg\":" + std::to_string(event.arg);
+        json += ",\"value\":" + std::to_string(event.value) + "}";
+    }
+    json += "]}";
+    return json;
+}
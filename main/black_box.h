@@ -0,0 +1,72 @@
+#ifndef _BLACK_BOX_H_
+#define _BLACK_BOX_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <esp_attr.h>
+#include <esp_system.h>
+
+#define BLACK_BOX_CAPACITY 128
+#define BLACK_BOX_VERSION  1
+
+enum BlackBoxEventType : uint8_t {
+    kBlackBoxBoot,          // arg: esp_reset_reason_t, value: free internal heap
+    kBlackBoxStateChange,   // arg: previous << 8 | new DeviceState
+    kBlackBoxUnderrun,      // arg: BlackBoxSource, value: buffered bytes or ms
+    kBlackBoxQueueFull,     // arg: BlackBoxQueue, value: queue depth
+    kBlackBoxDecodeError,   // arg: BlackBoxSource, value: decoder error code
+    kBlackBoxAllocFailure,  // arg: low 16 bits of the caps, value: requested size
+    kBlackBoxTaskWatchdog,
+    kBlackBoxHeapFragmented, // arg: largest internal block in KB, value: free internal bytes
+    kBlackBoxEventTypeCount,
+};
+
+enum BlackBoxSource : uint16_t {
+    kBlackBoxSourceVoice,
+    kBlackBoxSourceMusic,
+};
+
+enum BlackBoxQueue : uint16_t {
+    kBlackBoxQueueDecode,
+    kBlackBoxQueueMainTask,
+    kBlackBoxQueueEncode,
+};
+
+/*
+ * Small ring of structured events in RTC memory that is not cleared on reset, so the trace of what led
+ * to a panic, watchdog or brownout reboot is still there after it. Record() is safe from ISRs and keeps
+ * the cost of a log line out of hot paths: 12 bytes, a spinlock and the timer read. Allocation failures
+ * and task watchdog hits are recorded by themselves once Initialize() has run. A power cycle loses the
+ * ring, it is detected by the magic and started over.
+ */
+class BlackBox {
+public:
+    static BlackBox& GetInstance() {
+        static BlackBox instance;
+        return instance;
+    }
+    BlackBox(const BlackBox&) = delete;
+    BlackBox& operator=(const BlackBox&) = delete;
+
+    void Initialize();
+    void Record(BlackBoxEventType type, uint16_t arg = 0, uint32_t value = 0);
+    void Clear();
+
+    uint16_t boot_count() const;
+    inline esp_reset_reason_t reset_reason() const { return reset_reason_; }
+    // The last reboot was a panic, watchdog or brownout, worth uploading the trace
+    bool HasIncident() const;
+    // Events oldest first, time in ms since the boot they belong to, boot relative to the current one
+    std::string ToJson() const;
+
+    static const char* EventTypeName(BlackBoxEventType type);
+
+private:
+    BlackBox() = default;
+
+    esp_reset_reason_t reset_reason_ = ESP_RST_UNKNOWN;
+};
+
+#endif // _BLACK_BOX_H_
@@ -1,4 +1,5 @@
 #include "adc_battery_monitor.h"
+#include "tick_service.h"
 
 AdcBatteryMonitor::AdcBatteryMonitor(adc_unit_t adc_unit, adc_channel_t adc_channel, float upper_resistor, float lower_resistor, gpio_num_t charging_pin)
     : charging_pin_(charging_pin) {
@@ -31,20 +32,14 @@ AdcBatteryMonitor::AdcBatteryMonitor(adc_unit_t adc_unit, adc_channel_t adc_chan
     adc_cfg.charging_detect_user_data = this;
     adc_battery_estimation_handle_ = adc_battery_estimation_create(&adc_cfg);
 
-    // Initialize timer
-    esp_timer_create_args_t timer_cfg = {
-        .callback = [](void *arg) {
-            AdcBatteryMonitor *self = (AdcBatteryMonitor *)arg;
-            self->CheckBatteryStatus();
-        },
-        .arg = this,
-        .name = "adc_battery_monitor",
-    };
-    ESP_ERROR_CHECK(esp_timer_create(&timer_cfg, &timer_handle_));
-    ESP_ERROR_CHECK(esp_timer_start_periodic(timer_handle_, 1000000));
+    // 电量变化很慢，和其他整秒任务一起检查
+    tick_id_ = TickService::GetInstance().Add("battery", 1000, 500, [this]() {
+        CheckBatteryStatus();
+    });
 }
 
 AdcBatteryMonitor::~AdcBatteryMonitor() {
+    TickService::GetInstance().Remove(tick_id_);
     if (adc_battery_estimation_handle_) {
         ESP_ERROR_CHECK(adc_battery_estimation_destroy(adc_battery_estimation_handle_));
     }
@@ -20,7 +20,7 @@ public:
 private:
     gpio_num_t charging_pin_;
     adc_battery_estimation_handle_t adc_battery_estimation_handle_ = nullptr;
-    esp_timer_handle_t timer_handle_ = nullptr;
+    int tick_id_ = 0;
     bool is_charging_ = false;
     std::function<void(bool)> on_charging_status_changed_;
 
@@ -3,6 +3,9 @@
 #include <algorithm>
 #include "esp_log.h"
 #include "display.h"
+#include "audio_dsp.h"
+#include "mfsk_demod.h"
+#include <dsps_dotprod.h>
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -12,6 +15,29 @@ namespace audio_wifi_config
 {
     static const char *kLogTag = "AUDIO_WIFI_CONFIG";
 
+    static void ApplyWifiCredentials(WifiConfigurationAp *wifi_ap, Display *display, const std::string &text)
+    {
+        ESP_LOGI(kLogTag, "Received text data: %s", text.c_str());
+        display->SetChatMessage("system", text.c_str());
+
+        // Split SSID and password by newline character
+        size_t newline_position = text.find('\n');
+        if (newline_position == std::string::npos) {
+            ESP_LOGE(kLogTag, "Invalid data format, no newline character found");
+            return;
+        }
+        std::string wifi_ssid = text.substr(0, newline_position);
+        std::string wifi_password = text.substr(newline_position + 1);
+        ESP_LOGI(kLogTag, "WiFi SSID: %s, Password: %s", wifi_ssid.c_str(), wifi_password.c_str());
+
+        if (wifi_ap->ConnectToWifi(wifi_ssid, wifi_password)) {
+            wifi_ap->Save(wifi_ssid, wifi_password);  // Save WiFi credentials
+            esp_restart();                            // Restart device to apply new WiFi configuration
+        } else {
+            ESP_LOGE(kLogTag, "Failed to connect to WiFi with received credentials");
+        }
+    }
+
     void ReceiveWifiCredentialsFromAudio(Application *app,
                                         WifiConfigurationAp *wifi_ap,
                                         Display *display,
@@ -21,8 +47,13 @@ namespace audio_wifi_config
         const int kInputSampleRate = 16000;                                    // Input sampling rate
         const float kDownsampleStep = static_cast<float>(kInputSampleRate) / static_cast<float>(kAudioSampleRate); // Downsampling step
         std::vector<int16_t> audio_data;
-        AudioSignalProcessor signal_processor(kAudioSampleRate, kMarkFrequency, kSpaceFrequency, kBitRate, kWindowSize);
+        std::vector<float> probabilities;
+        auto signal_processor = std::make_unique<AudioSignalProcessor>(kAudioSampleRate, kMarkFrequency, kSpaceFrequency,
+                                                                       kBitRate, kWindowSize);
         AudioDataBuffer data_buffer;
+#if CONFIG_ACOUSTIC_WIFI_PROVISIONING_MFSK
+        auto mfsk_receiver = std::make_unique<MfskReceiver>();
+#endif
 
         while (true)
         {
@@ -40,65 +71,44 @@ namespace audio_wifi_config
                 continue;
             }
 
-            if (input_channels == 2) { // 如果是双声道输入，转换为单声道
-                auto mono_data = std::vector<int16_t>(audio_data.size() / 2);
-                for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
-                    mono_data[i] = audio_data[j];
-                }
-                audio_data = std::move(mono_data);
+            size_t frames = audio_data.size() / input_channels;
+            if (input_channels > 1) { // 多声道输入只取第一个声道
+                AudioDsp::ExtractChannel(audio_data.data(), static_cast<int>(input_channels), 0, audio_data.data(), frames);
             }
-            
-            // Downsample the audio data
-            std::vector<float> downsampled_data;
-            size_t last_index = 0;
 
+            // Downsample the audio data in place
+            size_t downsampled_count = 0;
+            size_t last_index = 0;
             if (kDownsampleStep > 1.0f) {
-                downsampled_data.reserve(audio_data.size() / static_cast<size_t>(kDownsampleStep));
-                for (size_t i = 0; i < audio_data.size(); ++i) {
+                for (size_t i = 0; i < frames; ++i) {
                     size_t sample_index = static_cast<size_t>(i / kDownsampleStep);
                     if ((sample_index + 1) > last_index) {
-                        downsampled_data.push_back(static_cast<float>(audio_data[i]));
+                        audio_data[downsampled_count++] = audio_data[i];
                         last_index = sample_index + 1;
                     }
                 }
             } else {
-                downsampled_data.reserve(audio_data.size());
-                for (int16_t sample : audio_data) {
-                    downsampled_data.push_back(static_cast<float>(sample));
-                }
+                downsampled_count = frames;
             }
-            
+
             // Process audio samples to get probability data
-            auto probabilities = signal_processor.ProcessAudioSamples(downsampled_data);
-            
+            signal_processor->ProcessAudioSamples(audio_data.data(), downsampled_count, probabilities);
+
             // Feed probability data to the data buffer
-            if (data_buffer.ProcessProbabilityData(probabilities, 0.5f)) {
+            if (data_buffer.ProcessProbabilityData(probabilities, 0.5f) && data_buffer.decoded_text.has_value()) {
                 // If complete data was received, extract WiFi credentials
-                if (data_buffer.decoded_text.has_value()) {
-                    ESP_LOGI(kLogTag, "Received text data: %s", data_buffer.decoded_text->c_str());
-                    display->SetChatMessage("system", data_buffer.decoded_text->c_str());
-                    
-                    // Split SSID and password by newline character
-                    std::string wifi_ssid, wifi_password;
-                    size_t newline_position = data_buffer.decoded_text->find('\n');
-                    if (newline_position != std::string::npos) {
-                        wifi_ssid = data_buffer.decoded_text->substr(0, newline_position);
-                        wifi_password = data_buffer.decoded_text->substr(newline_position + 1);
-                        ESP_LOGI(kLogTag, "WiFi SSID: %s, Password: %s", wifi_ssid.c_str(), wifi_password.c_str());
-                    } else {
-                        ESP_LOGE(kLogTag, "Invalid data format, no newline character found");
-                        continue;
-                    }
-                    
-                    if (wifi_ap->ConnectToWifi(wifi_ssid, wifi_password)) {
-                        wifi_ap->Save(wifi_ssid, wifi_password);  // Save WiFi credentials
-                        esp_restart();                            // Restart device to apply new WiFi configuration
-                    } else {
-                        ESP_LOGE(kLogTag, "Failed to connect to WiFi with received credentials");
-                    }
-                    data_buffer.decoded_text.reset();  // Clear processed data
-                }
+                ApplyWifiCredentials(wifi_ap, display, *data_buffer.decoded_text);
+                data_buffer.decoded_text.reset();  // Clear processed data
+            }
+
+#if CONFIG_ACOUSTIC_WIFI_PROVISIONING_MFSK
+            // 同一段音频也交给 MFSK 接收器，发送端使用哪种调制都可以
+            if (mfsk_receiver->ProcessAudioSamples(audio_data.data(), downsampled_count) &&
+                mfsk_receiver->decoded_text.has_value()) {
+                ApplyWifiCredentials(wifi_ap, display, *mfsk_receiver->decoded_text);
+                mfsk_receiver->decoded_text.reset();
             }
+#endif
             vTaskDelay(pdMS_TO_TICKS(1));  // 1ms delay
         }
     }
@@ -112,110 +122,81 @@ namespace audio_wifi_config
     const std::vector<uint8_t> kDefaultEndTransmissionPattern = {
         0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 1, 0, 0};
 
-    // FrequencyDetector implementation
-    FrequencyDetector::FrequencyDetector(float frequency, size_t window_size)
-        : frequency_(frequency), window_size_(window_size) {
-        frequency_bin_ = std::floor(frequency_ * static_cast<float>(window_size_));
-        angular_frequency_ = 2.0f * M_PI * frequency_;
-        cos_coefficient_ = std::cos(angular_frequency_);
-        sin_coefficient_ = std::sin(angular_frequency_);
-        filter_coefficient_ = 2.0f * cos_coefficient_;
-
-        // Initialize state buffer
-        state_buffer_.push_back(0.0f);
-        state_buffer_.push_back(0.0f);
-    }
-
-    void FrequencyDetector::Reset() {
-        state_buffer_.clear();
-        state_buffer_.push_back(0.0f);
-        state_buffer_.push_back(0.0f);
-    }
-
-    void FrequencyDetector::ProcessSample(float sample) {
-        if (state_buffer_.size() < 2) {
-            return;
+    // ToneFilterBank implementation
+    ToneFilterBank::ToneFilterBank(float mark_frequency, float space_frequency, size_t window_size)
+        : window_size_(std::min(window_size, kMaxWindowSize)) {
+        float mark_angular_frequency = 2.0f * M_PI * mark_frequency;
+        float space_angular_frequency = 2.0f * M_PI * space_frequency;
+        for (size_t i = 0; i < window_size_; ++i) {
+            mark_cos_[i] = std::cos(mark_angular_frequency * i);
+            mark_sin_[i] = std::sin(mark_angular_frequency * i);
+            space_cos_[i] = std::cos(space_angular_frequency * i);
+            space_sin_[i] = std::sin(space_angular_frequency * i);
         }
-
-        float s_minus_2 = state_buffer_.front();  // S[-2]
-        state_buffer_.pop_front();
-        float s_minus_1 = state_buffer_.front();  // S[-1]
-        state_buffer_.pop_front();
-
-        float s_current = sample + filter_coefficient_ * s_minus_1 - s_minus_2;
-
-        state_buffer_.push_back(s_minus_1);  // Put S[-1] back
-        state_buffer_.push_back(s_current);  // Add new S[0]
     }
 
-    float FrequencyDetector::GetAmplitude() const {
-        if (state_buffer_.size() < 2) {
-            return 0.0f;
-        }
-
-        float s_minus_1 = state_buffer_[1];                      // S[-1]
-        float s_minus_2 = state_buffer_[0];                      // S[-2]
-        float real_part = cos_coefficient_ * s_minus_1 - s_minus_2;  // Real part
-        float imaginary_part = sin_coefficient_ * s_minus_1;         // Imaginary part
-
-        return std::sqrt(real_part * real_part + imaginary_part * imaginary_part) / 
-               (static_cast<float>(window_size_) / 2.0f);
+    void ToneFilterBank::Process(const float *window, float &mark_amplitude, float &space_amplitude) const {
+        int length = static_cast<int>(window_size_);
+        float mark_real = 0.0f, mark_imaginary = 0.0f;
+        float space_real = 0.0f, space_imaginary = 0.0f;
+        dsps_dotprod_f32(window, mark_cos_, &mark_real, length);
+        dsps_dotprod_f32(window, mark_sin_, &mark_imaginary, length);
+        dsps_dotprod_f32(window, space_cos_, &space_real, length);
+        dsps_dotprod_f32(window, space_sin_, &space_imaginary, length);
+
+        float scale = static_cast<float>(window_size_) / 2.0f;
+        mark_amplitude = std::sqrt(mark_real * mark_real + mark_imaginary * mark_imaginary) / scale;
+        space_amplitude = std::sqrt(space_real * space_real + space_imaginary * space_imaginary) / scale;
     }
 
     // AudioSignalProcessor implementation
     AudioSignalProcessor::AudioSignalProcessor(size_t sample_rate, size_t mark_frequency, size_t space_frequency,
                                              size_t bit_rate, size_t window_size)
-        : input_buffer_size_(window_size), output_sample_count_(0) {
+        : window_size_(std::min(window_size, kMaxWindowSize)), write_index_(0), filled_(0), output_sample_count_(0),
+          filter_bank_(static_cast<float>(mark_frequency) / static_cast<float>(sample_rate),
+                       static_cast<float>(space_frequency) / static_cast<float>(sample_rate), window_size) {
         if (sample_rate % bit_rate != 0) {
             // On ESP32 we can continue execution, but log the error
             ESP_LOGW(kLogTag, "Sample rate %zu is not divisible by bit rate %zu", sample_rate, bit_rate);
         }
-
-        float normalized_mark_freq = static_cast<float>(mark_frequency) / static_cast<float>(sample_rate);
-        float normalized_space_freq = static_cast<float>(space_frequency) / static_cast<float>(sample_rate);
-
-        mark_detector_ = std::make_unique<FrequencyDetector>(normalized_mark_freq, window_size);
-        space_detector_ = std::make_unique<FrequencyDetector>(normalized_space_freq, window_size);
+        if (window_size > kMaxWindowSize) {
+            ESP_LOGW(kLogTag, "Window size %zu exceeds %zu, truncated", window_size, kMaxWindowSize);
+        }
 
         samples_per_bit_ = sample_rate / bit_rate;  // Number of samples per bit
     }
 
-    std::vector<float> AudioSignalProcessor::ProcessAudioSamples(const std::vector<float> &samples) {
-        std::vector<float> result;
+    void AudioSignalProcessor::ProcessAudioSamples(const int16_t *samples, size_t count,
+                                                   std::vector<float> &probabilities) {
+        probabilities.clear();
 
-        for (float sample : samples) {
-            if (input_buffer_.size() < input_buffer_size_) {
-                input_buffer_.push_back(sample);  // Just add, don't process yet
-            } else {
-                // Input buffer is full, process the data
-                input_buffer_.pop_front();   // Remove oldest sample
-                input_buffer_.push_back(sample);  // Add new sample
-                output_sample_count_++;
-
-                if (output_sample_count_ >= samples_per_bit_) {
-                    // Process all samples in the window using Goertzel algorithm
-                    for (float window_sample : input_buffer_) {
-                        mark_detector_->ProcessSample(window_sample);
-                        space_detector_->ProcessSample(window_sample);
-                    }
+        for (size_t i = 0; i < count; ++i) {
+            ring_buffer_[write_index_] = static_cast<float>(samples[i]);
+            write_index_ = (write_index_ + 1) % window_size_;
+            if (filled_ < window_size_) {
+                filled_++;  // Just add, don't process yet
+                continue;
+            }
 
-                    float mark_amplitude = mark_detector_->GetAmplitude();   // Mark amplitude
-                    float space_amplitude = space_detector_->GetAmplitude(); // Space amplitude
+            output_sample_count_++;
+            if (output_sample_count_ < samples_per_bit_) {
+                continue;
+            }
 
-                    // Avoid division by zero
-                    float mark_probability = mark_amplitude / 
-                                           (space_amplitude + mark_amplitude + std::numeric_limits<float>::epsilon());
-                    result.push_back(mark_probability);
+            // 环形缓冲区展开为按时间排列的对齐窗口，再一次算出两个频率的幅度
+            size_t tail = window_size_ - write_index_;
+            memcpy(window_buffer_, ring_buffer_ + write_index_, tail * sizeof(float));
+            memcpy(window_buffer_ + tail, ring_buffer_, write_index_ * sizeof(float));
 
-                    // Reset detector windows
-                    mark_detector_->Reset();
-                    space_detector_->Reset();
-                    output_sample_count_ = 0;  // Reset output counter
-                }
-            }
-        }
+            float mark_amplitude = 0.0f, space_amplitude = 0.0f;
+            filter_bank_.Process(window_buffer_, mark_amplitude, space_amplitude);
 
-        return result;
+            // Avoid division by zero
+            float mark_probability = mark_amplitude /
+                                   (space_amplitude + mark_amplitude + std::numeric_limits<float>::epsilon());
+            probabilities.push_back(mark_probability);
+            output_sample_count_ = 0;  // Reset output counter
+        }
     }
 
     // AudioDataBuffer implementation
@@ -13,8 +13,14 @@
 const size_t kAudioSampleRate = 6400;
 const size_t kMarkFrequency = 1800;
 const size_t kSpaceFrequency = 1500;
+// 比特率需与发送端一致，窗口取一个比特的长度
+#ifdef CONFIG_ACOUSTIC_WIFI_PROVISIONING_BIT_RATE
+const size_t kBitRate = CONFIG_ACOUSTIC_WIFI_PROVISIONING_BIT_RATE;
+#else
 const size_t kBitRate = 100;
-const size_t kWindowSize = 64;
+#endif
+const size_t kWindowSize = kAudioSampleRate / kBitRate;
+const size_t kMaxWindowSize = 64;
 
 namespace audio_wifi_config
 {
@@ -23,45 +29,37 @@ namespace audio_wifi_config
                                          size_t input_channels = 1);
 
     /**
-     * Goertzel algorithm implementation for single frequency detection
-     * Used to detect specific audio frequencies in the AFSK demodulation process
+     * Mark/Space filter bank
+     * Evaluates the DFT terms of both tones over a whole analysis window in one pass, which gives
+     * the same magnitude as running a Goertzel filter per tone. The window is correlated with
+     * precomputed cos/sin tables through esp-dsp, which uses the S3 SIMD dot product when the
+     * window length is a multiple of 4.
      */
-    class FrequencyDetector
+    class ToneFilterBank
     {
     private:
-        float frequency_;              // Target frequency (normalized, i.e., f / fs)
-        size_t window_size_;           // Window size for analysis
-        float frequency_bin_;          // Frequency bin
-        float angular_frequency_;      // Angular frequency
-        float cos_coefficient_;        // cos(w)
-        float sin_coefficient_;        // sin(w)
-        float filter_coefficient_;     // 2 * cos(w)
-        std::deque<float> state_buffer_;  // Circular buffer for storing S[-1] and S[-2]
+        size_t window_size_;                            // Window size for analysis
+        alignas(16) float mark_cos_[kMaxWindowSize];    // cos(w * n) for Mark frequency
+        alignas(16) float mark_sin_[kMaxWindowSize];    // sin(w * n) for Mark frequency
+        alignas(16) float space_cos_[kMaxWindowSize];   // cos(w * n) for Space frequency
+        alignas(16) float space_sin_[kMaxWindowSize];   // sin(w * n) for Space frequency
 
     public:
         /**
          * Constructor
-         * @param frequency Normalized frequency (f / fs)
-         * @param window_size Window size for analysis
+         * @param mark_frequency Normalized Mark frequency (f / fs)
+         * @param space_frequency Normalized Space frequency (f / fs)
+         * @param window_size Window size for analysis, at most kMaxWindowSize
          */
-        FrequencyDetector(float frequency, size_t window_size);
+        ToneFilterBank(float mark_frequency, float space_frequency, size_t window_size);
 
         /**
-         * Reset the detector state
+         * Calculate the amplitude of both tones
+         * @param window window_size samples in time order, 16-byte aligned
+         * @param mark_amplitude Mark amplitude output
+         * @param space_amplitude Space amplitude output
          */
-        void Reset();
-
-        /**
-         * Process one audio sample
-         * @param sample Input audio sample
-         */
-        void ProcessSample(float sample);
-
-        /**
-         * Calculate current amplitude
-         * @return Amplitude value
-         */
-        float GetAmplitude() const;
+        void Process(const float *window, float &mark_amplitude, float &space_amplitude) const;
     };
 
     /**
@@ -71,12 +69,14 @@ namespace audio_wifi_config
     class AudioSignalProcessor
     {
     private:
-        std::deque<float> input_buffer_;             // Input sample buffer
-        size_t input_buffer_size_;                   // Input buffer size = window size
-        size_t output_sample_count_;                 // Output sample counter
-        size_t samples_per_bit_;                     // Samples per bit threshold
-        std::unique_ptr<FrequencyDetector> mark_detector_;   // Mark frequency detector
-        std::unique_ptr<FrequencyDetector> space_detector_;  // Space frequency detector
+        float ring_buffer_[kMaxWindowSize];              // Input sample ring buffer
+        alignas(16) float window_buffer_[kMaxWindowSize]; // Analysis window in time order
+        size_t window_size_;                             // Input buffer size = window size
+        size_t write_index_;                             // Next write position in ring buffer
+        size_t filled_;                                  // Samples stored in ring buffer
+        size_t output_sample_count_;                     // Output sample counter
+        size_t samples_per_bit_;                         // Samples per bit threshold
+        ToneFilterBank filter_bank_;                     // Mark/Space filter bank
 
     public:
         /**
@@ -85,17 +85,18 @@ namespace audio_wifi_config
          * @param mark_frequency Mark frequency for digital '1'
          * @param space_frequency Space frequency for digital '0'
          * @param bit_rate Data transmission bit rate
-         * @param window_size Analysis window size
+         * @param window_size Analysis window size, at most kMaxWindowSize
          */
         AudioSignalProcessor(size_t sample_rate, size_t mark_frequency, size_t space_frequency,
                            size_t bit_rate, size_t window_size);
 
         /**
          * Process input audio samples
-         * @param samples Input audio sample vector
-         * @return Vector of Mark probability values (0.0 to 1.0)
+         * @param samples Input audio samples
+         * @param count Number of samples
+         * @param probabilities Output vector of Mark probability values (0.0 to 1.0), cleared first
          */
-        std::vector<float> ProcessAudioSamples(const std::vector<float> &samples);
+        void ProcessAudioSamples(const int16_t *samples, size_t count, std::vector<float> &probabilities);
     };
 
     /**
@@ -6,10 +6,20 @@
 
 #define TAG "Axp2101"
 
+// 状态栏每次刷新会连续调用几个状态接口，共用一次读取
+#define AXP2101_STATUS_MAX_AGE_MS 200
+
 Axp2101::Axp2101(i2c_master_bus_handle_t i2c_bus, uint8_t addr) : I2cDevice(i2c_bus, addr) {
 }
 
+// 充电状态、电量和温度寄存器一起读取，0xA4 与 0xA5 合并为一次连续读
+void Axp2101::PrefetchStatus() {
+    static const uint8_t kStatusRegs[] = {0x01, 0xA4, 0xA5};
+    Prefetch(kStatusRegs, sizeof(kStatusRegs), AXP2101_STATUS_MAX_AGE_MS);
+}
+
 int Axp2101::GetBatteryCurrentDirection() {
+    PrefetchStatus();
     return (ReadReg(0x01) & 0b01100000) >> 5;
 }
 
@@ -22,15 +32,18 @@ bool Axp2101::IsDischarging() {
 }
 
 bool Axp2101::IsChargingDone() {
+    PrefetchStatus();
     uint8_t value = ReadReg(0x01);
     return (value & 0b00000111) == 0b00000100;
 }
 
 int Axp2101::GetBatteryLevel() {
+    PrefetchStatus();
     return ReadReg(0xA4);
 }
 
 float Axp2101::GetTemperature() {
+    PrefetchStatus();
     return ReadReg(0xA5);
 }
 
@@ -15,6 +15,7 @@ public:
 
 private:
     int GetBatteryCurrentDirection();
+    void PrefetchStatus();
 };
 
 #endif
@@ -1,11 +1,22 @@
 #include "backlight.h"
 #include "settings.h"
+#include "board.h"
+#include "display.h"
 
 #include <esp_log.h>
 #include <driver/ledc.h>
+#include <soc/soc_caps.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
 
 #define TAG "Backlight"
 
+// 每级亮度的渐变时间，硬件渐变的总时长与软件逐级调整相同
+#define BACKLIGHT_STEP_MS 5
+// 亮度百分比按感知亮度映射到占空比
+#define BACKLIGHT_GAMMA 2.2f
+
 
 Backlight::Backlight() {
     // 创建背光渐变定时器
@@ -48,36 +59,63 @@ void Backlight::SetBrightness(uint8_t brightness, bool permanent) {
         brightness = 100;
     }
 
-    if (brightness_ == brightness) {
-        return;
-    }
-
     if (permanent) {
         Settings settings("display", true);
         settings.SetInt("brightness", brightness);
     }
+    requested_brightness_ = brightness;
+    brightness = std::min(brightness, brightness_limit_);
+
+    if (brightness_ == brightness) {
+        return;
+    }
 
+    int duration_ms = std::abs(brightness - brightness_) * BACKLIGHT_STEP_MS;
     target_brightness_ = brightness;
     step_ = (target_brightness_ > brightness_) ? 1 : -1;
 
+    // 背光亮起前先恢复渲染，避免渐亮时看到旧画面
+    if (rendering_paused_ && target_brightness_ > 0) {
+        rendering_paused_ = false;
+        Board::GetInstance().GetDisplay()->SetRenderingPaused(false);
+    }
+
     if (transition_timer_ != nullptr) {
-        // 启动定时器，每 5ms 更新一次
-        esp_timer_start_periodic(transition_timer_, 5 * 1000);
+        esp_timer_stop(transition_timer_);
+        if (StartFade(target_brightness_, duration_ms)) {
+            // 渐变由硬件完成，定时器只在结束时触发一次
+            brightness_ = target_brightness_;
+            esp_timer_start_once(transition_timer_, duration_ms * 1000);
+        } else {
+            // 启动定时器，每 5ms 更新一次
+            esp_timer_start_periodic(transition_timer_, BACKLIGHT_STEP_MS * 1000);
+        }
     }
     ESP_LOGI(TAG, "Set brightness to %d", brightness);
 }
 
-void Backlight::OnTransitionTimer() {
-    if (brightness_ == target_brightness_) {
-        esp_timer_stop(transition_timer_);
-        return;
+void Backlight::SetBrightnessLimit(uint8_t limit) {
+    brightness_limit_ = std::min<uint8_t>(limit, 100);
+    // 还没有设置过亮度时只记下限制
+    if (requested_brightness_ >= 0) {
+        SetBrightness(requested_brightness_);
     }
+}
 
-    brightness_ += step_;
-    SetBrightnessImpl(brightness_);
+void Backlight::OnTransitionTimer() {
+    if (brightness_ != target_brightness_) {
+        brightness_ += step_;
+        SetBrightnessImpl(brightness_);
+        if (brightness_ != target_brightness_) {
+            return;
+        }
+    }
 
-    if (brightness_ == target_brightness_) {
-        esp_timer_stop(transition_timer_);
+    esp_timer_stop(transition_timer_);
+    // 背光关闭后画面不可见，暂停 LVGL 渲染
+    if (brightness_ == 0 && !rendering_paused_) {
+        rendering_paused_ = true;
+        Board::GetInstance().GetDisplay()->SetRenderingPaused(true);
     }
 }
 
@@ -106,16 +144,38 @@ PwmBacklight::PwmBacklight(gpio_num_t pin, bool output_invert, uint32_t freq_hz)
         }
     };
     ESP_ERROR_CHECK(ledc_channel_config(&backlight_channel));
+    ledc_fade_func_install(0);
 }
 
 PwmBacklight::~PwmBacklight() {
     ledc_stop(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, 0);
 }
 
+// LEDC resolution set to 10bits, thus: 100% = 1023
+static uint32_t BrightnessToDuty(uint8_t brightness) {
+    if (brightness == 0) {
+        return 0;
+    }
+    uint32_t duty = lroundf(1023 * powf(brightness / 100.0f, BACKLIGHT_GAMMA));
+    return std::max<uint32_t>(duty, 1);
+}
+
 void PwmBacklight::SetBrightnessImpl(uint8_t brightness) {
-    // LEDC resolution set to 10bits, thus: 100% = 1023
-    uint32_t duty_cycle = (1023 * brightness) / 100;
-    ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, duty_cycle);
+    ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, BrightnessToDuty(brightness));
     ledc_update_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0);
 }
 
+bool PwmBacklight::StartFade(uint8_t brightness, int duration_ms) {
+#if SOC_LEDC_SUPPORT_FADE_STOP
+    // 打断还在进行的渐变，从当前占空比开始新的渐变
+    ledc_fade_stop(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0);
+#endif
+    esp_err_t err = ledc_set_fade_time_and_start(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, BrightnessToDuty(brightness),
+        duration_ms, LEDC_FADE_NO_WAIT);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Hardware fade failed: %s", esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+
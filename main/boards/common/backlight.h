@@ -15,15 +15,22 @@ public:
     void RestoreBrightness();
     void SetBrightness(uint8_t brightness, bool permanent = false);
     inline uint8_t brightness() const { return brightness_; }
+    // 电量低时限制最高亮度，之后设置的亮度同样受限，恢复为 100 后回到原先设置的亮度
+    void SetBrightnessLimit(uint8_t limit);
 
 protected:
     void OnTransitionTimer();
     virtual void SetBrightnessImpl(uint8_t brightness) = 0;
+    // 硬件渐变到目标亮度，返回 false 时按软件定时器逐级调整
+    virtual bool StartFade(uint8_t brightness, int duration_ms) { return false; }
 
     esp_timer_handle_t transition_timer_ = nullptr;
     uint8_t brightness_ = 0;
     uint8_t target_brightness_ = 0;
     uint8_t step_ = 1;
+    uint8_t brightness_limit_ = 100;
+    int requested_brightness_ = -1;
+    bool rendering_paused_ = false;
 };
 
 
@@ -33,4 +40,7 @@ public:
     ~PwmBacklight();
 
     void SetBrightnessImpl(uint8_t brightness) override;
+
+protected:
+    bool StartFade(uint8_t brightness, int duration_ms) override;
 };
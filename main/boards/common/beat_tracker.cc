@@ -0,0 +1,153 @@
+#include "beat_tracker.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <cmath>
+#include <cstdlib>
+
+#define TAG "BeatTracker"
+
+// 自相关峰值与零延迟能量之比低于此值时认为没有稳定的节拍
+#define BEAT_MIN_CONFIDENCE 0.2f
+// 超过这个时间没有新的估计（暂停、停止播放）就不再对外提供节拍
+#define BEAT_STALE_MS 3000
+
+void BeatTracker::Reset() {
+    head_ = 0;
+    hop_filled_ = 0;
+    hop_energy_ = 0;
+    last_log_energy_ = 0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    period_ms_ = 0;
+    confidence_ = 0;
+}
+
+void BeatTracker::Feed(const int16_t* pcm, size_t samples, int sample_rate, int64_t play_time_ms) {
+    // 换曲、拖动或采样率变化后旧的包络没有意义
+    if (sample_rate != sample_rate_ || play_time_ms < last_play_time_ms_) {
+        Reset();
+        sample_rate_ = sample_rate;
+        hop_samples_ = sample_rate * kHopMs / 1000;
+    }
+    last_play_time_ms_ = play_time_ms;
+    if (hop_samples_ <= 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < samples; i++) {
+        int32_t s = pcm[i];
+        hop_energy_ += s * s;
+        if (++hop_filled_ == hop_samples_) {
+            EndHop();
+        }
+    }
+}
+
+void BeatTracker::EndHop() {
+    float log_energy = logf(1.0f + (float)hop_energy_ / hop_samples_);
+    float onset = log_energy - last_log_energy_;
+    last_log_energy_ = log_energy;
+    hop_energy_ = 0;
+    hop_filled_ = 0;
+
+    envelope_[head_ % kEnvelopeSize] = onset > 0 ? onset : 0;
+    head_++;
+    last_hop_ms_ = esp_timer_get_time() / 1000;
+    if (head_ >= kWindow + kMaxLag && head_ % kEstimateHops == 0) {
+        Estimate();
+    }
+}
+
+void BeatTracker::Estimate() {
+    // x(0) 是最新的一跳
+    auto x = [this](int i) { return envelope_[(head_ - 1 - i) % kEnvelopeSize]; };
+    const int span = kWindow + kMaxLag;
+    float mean = 0;
+    for (int i = 0; i < span; i++) {
+        mean += x(i);
+    }
+    mean /= span;
+
+    float energy = 0;
+    for (int i = 0; i < kWindow; i++) {
+        float v = x(i) - mean;
+        energy += v * v;
+    }
+    if (energy <= 0) {
+        return;
+    }
+
+    int best_lag = 0;
+    float best_score = 0, best_acf = 0;
+    for (int lag = kMinLag; lag <= kMaxLag; lag++) {
+        float acf = 0;
+        for (int i = 0; i < kWindow; i++) {
+            acf += (x(i) - mean) * (x(i + lag) - mean);
+        }
+        // 以 120 BPM 为中心的对数高斯先验，抑制倍频和半频
+        float octave = log2f(lag / 50.0f);
+        float score = acf * expf(-octave * octave * 2.0f);
+        if (score > best_score) {
+            best_score = score;
+            best_acf = acf;
+            best_lag = lag;
+        }
+    }
+    if (best_lag == 0) {
+        return;
+    }
+
+    // 梳状求和找相位：最近一拍距离现在 phase 跳
+    int best_phase = 0;
+    float best_sum = -1;
+    for (int phase = 0; phase < best_lag; phase++) {
+        float sum = 0;
+        for (int i = phase; i < span; i += best_lag) {
+            sum += x(i);
+        }
+        if (sum > best_sum) {
+            best_sum = sum;
+            best_phase = phase;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    period_ms_ = best_lag * kHopMs;
+    confidence_ = best_acf / energy;
+    beat_ms_ = last_hop_ms_ - best_phase * kHopMs;
+    updated_ms_ = last_hop_ms_;
+    ESP_LOGD(TAG, "Tempo %d BPM, confidence %.2f", 60000 / period_ms_, confidence_);
+}
+
+bool BeatTracker::GetBeat(int* period_ms, int64_t* next_beat_ms) {
+    int64_t now_ms = esp_timer_get_time() / 1000;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (period_ms_ == 0 || confidence_ < BEAT_MIN_CONFIDENCE || now_ms - updated_ms_ > BEAT_STALE_MS) {
+        return false;
+    }
+    int64_t beats = (now_ms - beat_ms_ + period_ms_ - 1) / period_ms_;
+    *period_ms = period_ms_;
+    *next_beat_ms = beat_ms_ + beats * period_ms_;
+    return true;
+}
+
+int BeatTracker::AlignToBeat(int period_ms) {
+    int beat_ms;
+    int64_t next_beat_ms;
+    if (!GetBeat(&beat_ms, &next_beat_ms)) {
+        return period_ms;
+    }
+    int aligned = beat_ms;
+    for (int multiple : {2, 4}) {
+        if (std::abs(beat_ms * multiple - period_ms) < std::abs(aligned - period_ms)) {
+            aligned = beat_ms * multiple;
+        }
+    }
+    int64_t wait_ms = next_beat_ms - esp_timer_get_time() / 1000;
+    if (wait_ms > 0) {
+        vTaskDelay(pdMS_TO_TICKS(wait_ms));
+    }
+    return aligned;
+}
@@ -0,0 +1,55 @@
+#ifndef BEAT_TRACKER_H
+#define BEAT_TRACKER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+/*
+ * Lightweight tempo and beat phase tracker for the music stream.
+ *
+ * Fed with every decoded PCM frame on the player thread. Energy is taken over 10 ms hops, the rectified
+ * rise of log energy forms an onset envelope, and once per second the envelope is autocorrelated over
+ * 60-180 BPM (weighted towards 120 BPM) to pick the tempo, then comb-filtered to find the beat phase.
+ * Cost is a multiply-add per sample plus about 30k multiply-adds per second for the estimate.
+ */
+class BeatTracker {
+public:
+    void Feed(const int16_t* pcm, size_t samples, int sample_rate, int64_t play_time_ms);
+    void Reset();
+
+    // 节拍可信时返回节拍周期和下一拍的时间（esp_timer 毫秒）
+    bool GetBeat(int* period_ms, int64_t* next_beat_ms);
+    // 把动作周期对齐到最接近的 1/2/4 拍，并等到下一拍再返回；没有可信节拍时原样返回
+    int AlignToBeat(int period_ms);
+
+private:
+    static constexpr int kHopMs = 10;
+    static constexpr int kEnvelopeSize = 512;
+    static constexpr int kWindow = 384;
+    static constexpr int kMinLag = 33;      // 180 BPM
+    static constexpr int kMaxLag = 100;     // 60 BPM
+    static constexpr int kEstimateHops = 100;
+
+    void EndHop();
+    void Estimate();
+
+    // 只由播放线程访问
+    float envelope_[kEnvelopeSize] = {};
+    uint32_t head_ = 0;
+    int sample_rate_ = 0;
+    int hop_samples_ = 0;
+    int hop_filled_ = 0;
+    int64_t hop_energy_ = 0;
+    float last_log_energy_ = 0;
+    int64_t last_play_time_ms_ = 0;
+    int64_t last_hop_ms_ = 0;
+
+    std::mutex mutex_;
+    int period_ms_ = 0;
+    float confidence_ = 0;
+    int64_t beat_ms_ = 0;
+    int64_t updated_ms_ = 0;
+};
+
+#endif // BEAT_TRACKER_H
@@ -1,6 +1,7 @@
 #include "board.h"
 #include "system_info.h"
 #include "settings.h"
+#include "black_box.h"
 #include "display/display.h"
 #include "assets/lang_config.h"
 #include "esp32_music.h"
@@ -10,6 +11,7 @@
 #include <esp_ota_ops.h>
 #include <esp_chip_info.h>
 #include <esp_random.h>
+#include <esp_sleep.h>
 
 #define TAG "Board"
 
@@ -44,6 +46,12 @@ Board::~Board() {
     }
 }
 
+void Board::EnterDeepSleep() {
+    // 设置的写回缓存只在定时器或 esp_restart() 时提交，深度睡眠不会触发 shutdown handler
+    Settings::Flush();
+    esp_deep_sleep_start();
+}
+
 std::string Board::GenerateUuid() {
     // UUID v4 需要 16 字节的随机数据
     uint8_t uuid[16];
@@ -185,6 +193,12 @@ std::string Board::GetJson() {
     json += R"("label":")" + std::string(ota_partition->label) + R"(")";
     json += R"(},)";
 
+    // 上次是崩溃、看门狗或掉电重启时，把黑匣子记录随版本检查上传
+    auto& black_box = BlackBox::GetInstance();
+    if (black_box.HasIncident()) {
+        json += R"("black_box":)" + black_box.ToJson() + R"(,)";
+    }
+
     json += R"("board":)" + GetBoardJson();
 
     // Close the JSON object
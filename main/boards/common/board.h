@@ -6,6 +6,7 @@
 #include <mqtt.h>
 #include <udp.h>
 #include <string>
+#include <functional>
 #include <network_interface.h>
 
 #include "led/led.h"
@@ -54,11 +55,16 @@ public:
     virtual NetworkInterface* GetNetwork() = 0;
     virtual void StartNetwork() = 0;
     virtual const char* GetNetworkStateIcon() = 0;
+    // 当前网络失效时切换到备用网络，返回 true 表示正在切换，完成后在主循环中调用 on_switched
+    virtual bool FailoverNetwork(std::function<void()> on_switched) { return false; }
     virtual bool GetBatteryLevel(int &level, bool& charging, bool& discharging);
     virtual std::string GetJson();
     virtual void SetPowerSaveMode(bool enabled) = 0;
     virtual std::string GetBoardJson() = 0;
     virtual std::string GetDeviceStatusJson() = 0;
+
+    // 写入待保存的设置后进入深度睡眠，不会返回；关机和休眠都走这里，不要直接调用 esp_deep_sleep_start()
+    static void EnterDeepSleep();
 };
 
 #define DECLARE_BOARD(BOARD_CLASS_NAME) \
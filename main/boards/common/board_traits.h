@@ -0,0 +1,37 @@
+#ifndef BOARD_TRAITS_H
+#define BOARD_TRAITS_H
+
+#include <sdkconfig.h>
+
+// 由 CMake 指向所选板子的 config.h，板子在编译时就确定了
+#ifdef BOARD_CONFIG_HEADER
+#include BOARD_CONFIG_HEADER
+#endif
+
+/*
+ * Compile time properties of the selected board, taken from its config.h, so hot paths can drop branches
+ * with if constexpr instead of testing the codec on every frame. A value that is unknown (0) keeps the
+ * runtime path. Only include this where a trait is used, config.h brings the board's pin macros along.
+ */
+struct BoardTraits {
+#ifdef AUDIO_INPUT_SAMPLE_RATE
+    static constexpr int kInputSampleRate = AUDIO_INPUT_SAMPLE_RATE;
+#else
+    static constexpr int kInputSampleRate = 0;
+#endif
+#ifdef AUDIO_OUTPUT_SAMPLE_RATE
+    static constexpr int kOutputSampleRate = AUDIO_OUTPUT_SAMPLE_RATE;
+#else
+    static constexpr int kOutputSampleRate = 0;
+#endif
+#if CONFIG_SPIRAM
+    static constexpr bool kHasPsram = true;
+#else
+    static constexpr bool kHasPsram = false;
+#endif
+
+    // 上行固定是 16 kHz，codec 也是 16 kHz 时不需要输入重采样
+    static constexpr bool kInputNeedsResample = kInputSampleRate != 16000;
+};
+
+#endif // BOARD_TRAITS_H
@@ -2,6 +2,7 @@
 
 #include <button_gpio.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 
 #define TAG "Button"
 
@@ -18,7 +19,8 @@ AdcButton::AdcButton(const button_adc_config_t& adc_config) : Button(nullptr) {
 Button::Button(button_handle_t button_handle) : button_handle_(button_handle) {
 }
 
-Button::Button(gpio_num_t gpio_num, bool active_high, uint16_t long_press_time, uint16_t short_press_time, bool enable_power_save) : gpio_num_(gpio_num) {
+Button::Button(gpio_num_t gpio_num, bool active_high, uint16_t long_press_time, uint16_t short_press_time, bool enable_power_save)
+    : gpio_num_(gpio_num), active_high_(active_high), power_save_(enable_power_save) {
     if (gpio_num == GPIO_NUM_NC) {
         return;
     }
@@ -36,18 +38,45 @@ Button::Button(gpio_num_t gpio_num, bool active_high, uint16_t long_press_time,
 }
 
 Button::~Button() {
+    edge_input_.reset();
     if (button_handle_ != NULL) {
         iot_button_delete(button_handle_);
     }
 }
 
+// 省电模式下按键组件自己使用 GPIO 中断唤醒，这时仍走按键组件的回调
+bool Button::UseEdgeInput() {
+#if CONFIG_BUTTON_EDGE_INPUT
+    if (gpio_num_ == GPIO_NUM_NC || power_save_) {
+        return false;
+    }
+    if (!edge_input_) {
+        edge_input_ = std::make_unique<EdgeInput>(gpio_num_, active_high_, CONFIG_BUTTON_EDGE_DEBOUNCE_MS);
+        edge_input_->OnEdge([this](bool pressed, int64_t time_us) {
+            edge_time_us_ = time_us;
+            auto& callback = pressed ? on_press_down_ : on_press_up_;
+            if (callback) {
+                callback();
+            }
+        });
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
 void Button::OnPressDown(std::function<void()> callback) {
     if (button_handle_ == nullptr) {
         return;
     }
     on_press_down_ = callback;
+    if (UseEdgeInput()) {
+        return;
+    }
     iot_button_register_cb(button_handle_, BUTTON_PRESS_DOWN, nullptr, [](void* handle, void* usr_data) {
         Button* button = static_cast<Button*>(usr_data);
+        button->edge_time_us_ = esp_timer_get_time();
         if (button->on_press_down_) {
             button->on_press_down_();
         }
@@ -59,8 +88,12 @@ void Button::OnPressUp(std::function<void()> callback) {
         return;
     }
     on_press_up_ = callback;
+    if (UseEdgeInput()) {
+        return;
+    }
     iot_button_register_cb(button_handle_, BUTTON_PRESS_UP, nullptr, [](void* handle, void* usr_data) {
         Button* button = static_cast<Button*>(usr_data);
+        button->edge_time_us_ = esp_timer_get_time();
         if (button->on_press_up_) {
             button->on_press_up_();
         }
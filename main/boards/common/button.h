@@ -7,6 +7,9 @@
 #include <button_adc.h>
 #include <button_gpio.h>
 #include <functional>
+#include <memory>
+
+#include "edge_input.h"
 
 class Button {
 public:
@@ -21,9 +24,17 @@ public:
     void OnDoubleClick(std::function<void()> callback);
     void OnMultipleClick(std::function<void()> callback, uint8_t click_count = 3);
 
+    // Time of the last press down or up edge, esp_timer_get_time() in the ISR when the edge input is used
+    inline int64_t edge_time_us() const { return edge_time_us_; }
+
 protected:
-    gpio_num_t gpio_num_;
+    gpio_num_t gpio_num_ = GPIO_NUM_NC;
+    bool active_high_ = false;
+    bool power_save_ = false;
     button_handle_t button_handle_ = nullptr;
+    // Press down/up bypass the button component poll, clicks and long press still go through it
+    std::unique_ptr<EdgeInput> edge_input_;
+    int64_t edge_time_us_ = 0;
 
     std::function<void()> on_press_down_;
     std::function<void()> on_press_up_;
@@ -31,6 +42,8 @@ protected:
     std::function<void()> on_click_;
     std::function<void()> on_double_click_;
     std::function<void()> on_multiple_click_;
+
+    bool UseEdgeInput();
 };
 
 #if CONFIG_SOC_ADC_SUPPORTED
@@ -3,13 +3,31 @@
 
 #include <string>
 
+// 单次拍照的参数，0 表示使用默认值
+struct CameraPhotoOptions {
+    int max_width = 0;          // 上传图像的最大宽度，传感器只在需要时才切换分辨率
+    int quality = 0;            // JPEG 质量 1-100，0 使用 Kconfig 预设
+    // 裁剪区域，按画面宽高的百分比
+    int crop_x = 0;
+    int crop_y = 0;
+    int crop_width = 100;
+    int crop_height = 100;
+};
+
 class Camera {
 public:
     virtual void SetExplainUrl(const std::string& url, const std::string& token) = 0;
+    // 对下一次 Capture()/Explain() 生效
+    virtual void SetPhotoOptions(const CameraPhotoOptions& options) {}
     virtual bool Capture() = 0;
     virtual bool SetHMirror(bool enabled) = 0;
     virtual bool SetVFlip(bool enabled) = 0;
     virtual std::string Explain(const std::string& question) = 0;
+    // 会话中按固定帧率把画面有变化的帧通过音频通道发给服务器
+    virtual bool StartStreaming(int fps) { return false; }
+    virtual void StopStreaming() {}
+    // 对话期间保持传感器出帧，拍照时直接取最新一帧
+    virtual void KeepWarm(bool enabled) {}
 };
 
 #endif // CAMERA_H
@@ -0,0 +1,330 @@
+#include "cover_art.h"
+#include "board.h"
+#include "display/display.h"
+#include "song_cache.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <soc/soc_caps.h>
+#include <algorithm>
+#include <cstring>
+
+#if SOC_JPEG_DECODE_SUPPORTED
+#include <driver/jpeg_decode.h>
+#endif
+#include <jpeg_decoder.h>
+
+#define TAG "CoverArt"
+
+#define COVER_ART_TASK_STACK_SIZE 6144
+#define COVER_ART_TASK_PRIORITY 1
+// 解码后的整图（缩放之前）不超过这个大小，防止超大封面耗尽 PSRAM
+#define COVER_ART_MAX_DECODE_SIZE (2 * 1024 * 1024)
+#define COVER_ART_CACHE_PREFIX "cover:"
+
+struct CoverCacheHeader {
+    uint16_t width;
+    uint16_t height;
+};
+
+// 取中间的正方形，最近邻缩放到 side x side
+static void CropScale(const uint16_t* src, int width, int height, int stride, int side, uint16_t* dst) {
+    int crop = std::min(width, height);
+    int x0 = (width - crop) / 2;
+    int y0 = (height - crop) / 2;
+    for (int y = 0; y < side; y++) {
+        const uint16_t* row = src + (size_t)(y0 + y * crop / side) * stride + x0;
+        for (int x = 0; x < side; x++) {
+            dst[x] = row[x * crop / side];
+        }
+        dst += side;
+    }
+}
+
+#if SOC_JPEG_DECODE_SUPPORTED
+static bool DecodeHardware(const uint8_t* jpeg, size_t size, int side, uint16_t* pixels) {
+    static jpeg_decoder_handle_t engine = nullptr;
+    if (engine == nullptr) {
+        jpeg_decode_engine_cfg_t engine_config = {
+            .intr_priority = 0,
+            .timeout_ms = 1000,
+        };
+        esp_err_t err = jpeg_new_decoder_engine(&engine_config, &engine);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to create JPEG decoder engine: %s", esp_err_to_name(err));
+            engine = nullptr;
+            return false;
+        }
+    }
+
+    jpeg_decode_picture_info_t info;
+    if (jpeg_decoder_get_info(jpeg, size, &info) != ESP_OK || info.width == 0 || info.height == 0) {
+        return false;
+    }
+    // 输出按 MCU 对齐：4:2:0 为 16x16，4:2:2 为 16x8，其余为 8x8
+    int align_w = info.sample_method == JPEG_DOWN_SAMPLING_YUV420 || info.sample_method == JPEG_DOWN_SAMPLING_YUV422 ? 16 : 8;
+    int align_h = info.sample_method == JPEG_DOWN_SAMPLING_YUV420 ? 16 : 8;
+    int stride = (info.width + align_w - 1) / align_w * align_w;
+    int rows = (info.height + align_h - 1) / align_h * align_h;
+    size_t output_size = (size_t)stride * rows * 2;
+    if (output_size > COVER_ART_MAX_DECODE_SIZE) {
+        ESP_LOGW(TAG, "Cover too large: %lux%lu", (unsigned long)info.width, (unsigned long)info.height);
+        return false;
+    }
+
+    // DMA 需要对齐的输入和输出缓冲区
+    size_t input_capacity = 0, output_capacity = 0;
+    jpeg_decode_memory_alloc_cfg_t input_config = { .buffer_direction = JPEG_DEC_ALLOC_INPUT_BUFFER };
+    jpeg_decode_memory_alloc_cfg_t output_config = { .buffer_direction = JPEG_DEC_ALLOC_OUTPUT_BUFFER };
+    auto input = (uint8_t*)jpeg_alloc_decoder_mem(size, &input_config, &input_capacity);
+    auto output = (uint8_t*)jpeg_alloc_decoder_mem(output_size, &output_config, &output_capacity);
+    if (input == nullptr || output == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate JPEG decoder buffers");
+        free(input);
+        free(output);
+        return false;
+    }
+    memcpy(input, jpeg, size);
+
+    jpeg_decode_cfg_t decode_config = {
+        .output_format = JPEG_DECODE_OUT_FORMAT_RGB565,
+        .rgb_order = JPEG_DEC_RGB_ELEMENT_ORDER_BGR,
+        .conv_std = JPEG_YUV_RGB_CONV_STD_BT601,
+    };
+    uint32_t decoded_size = 0;
+    esp_err_t err = jpeg_decoder_process(engine, &decode_config, input, size, output, output_capacity, &decoded_size);
+    if (err == ESP_OK) {
+        CropScale((const uint16_t*)output, info.width, info.height, stride, side, pixels);
+    } else {
+        ESP_LOGW(TAG, "Hardware JPEG decode failed: %s", esp_err_to_name(err));
+    }
+    free(input);
+    free(output);
+    return err == ESP_OK;
+}
+#endif
+
+// tjpgd 只支持 baseline JPEG，解码时直接按 1/2、1/4、1/8 缩小到不小于目标尺寸
+static bool DecodeSoftware(const uint8_t* jpeg, size_t size, int side, uint16_t* pixels) {
+    esp_jpeg_image_cfg_t config = {};
+    config.indata = const_cast<uint8_t*>(jpeg);
+    config.indata_size = size;
+    config.out_format = JPEG_IMAGE_FORMAT_RGB565;
+    esp_jpeg_image_output_t info;
+    if (esp_jpeg_get_image_info(&config, &info) != ESP_OK || info.width == 0 || info.height == 0) {
+        ESP_LOGW(TAG, "Unsupported cover JPEG (progressive?)");
+        return false;
+    }
+    int scale = 0;
+#if CONFIG_JD_USE_SCALE
+    int crop = std::min(info.width, info.height);
+    while (scale < 3 && (crop >> (scale + 1)) >= side) {
+        scale++;
+    }
+#endif
+    config.out_scale = (esp_jpeg_image_scale_t)scale;
+    if (esp_jpeg_get_image_info(&config, &info) != ESP_OK || info.output_len > COVER_ART_MAX_DECODE_SIZE) {
+        ESP_LOGW(TAG, "Cover too large: %ux%u", info.width, info.height);
+        return false;
+    }
+    config.outbuf_size = info.output_len;
+    config.outbuf = (uint8_t*)heap_caps_malloc(config.outbuf_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (config.outbuf == nullptr) {
+        config.outbuf = (uint8_t*)heap_caps_malloc(config.outbuf_size, MALLOC_CAP_8BIT);
+    }
+    if (config.outbuf == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes for cover", (unsigned int)config.outbuf_size);
+        return false;
+    }
+    esp_jpeg_image_output_t output;
+    esp_err_t err = esp_jpeg_decode(&config, &output);
+    if (err == ESP_OK) {
+        CropScale((const uint16_t*)config.outbuf, output.width, output.height, output.width, side, pixels);
+    } else {
+        ESP_LOGW(TAG, "JPEG decode failed: %s", esp_err_to_name(err));
+    }
+    heap_caps_free(config.outbuf);
+    return err == ESP_OK;
+}
+
+static bool DecodeCover(const uint8_t* jpeg, size_t size, int side, uint16_t* pixels) {
+#if SOC_JPEG_DECODE_SUPPORTED
+    if (DecodeHardware(jpeg, size, side, pixels)) {
+        return true;
+    }
+#endif
+    return DecodeSoftware(jpeg, size, side, pixels);
+}
+
+void CoverArt::Submit(const std::string& key, std::vector<uint8_t>&& tag, TagCallback on_tag) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // 只保留最新的一首，切歌太快时跳过中间的
+        pending_ = std::make_unique<Request>(Request{key, std::move(tag), std::move(on_tag), ++generation_});
+        if (task_running_) {
+            return;
+        }
+        task_running_ = true;
+    }
+    BaseType_t created = xTaskCreatePinnedToCore([](void* arg) {
+        ((CoverArt*)arg)->Task();
+        vTaskDelete(NULL);
+    }, "cover_art", COVER_ART_TASK_STACK_SIZE, this, COVER_ART_TASK_PRIORITY, nullptr,
+        DISPLAY_TASK_AFFINITY < 0 ? tskNO_AFFINITY : DISPLAY_TASK_AFFINITY);
+    if (created != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create cover art task");
+        std::lock_guard<std::mutex> lock(mutex_);
+        task_running_ = false;
+        pending_.reset();
+    }
+}
+
+void CoverArt::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    generation_++;
+    pending_.reset();
+    HideLocked();
+}
+
+void CoverArt::HideLocked() {
+    if (shown_ < 0) {
+        return;
+    }
+    auto display = Board::GetInstance().GetDisplay();
+    if (display != nullptr) {
+        display->SetMusicCover(nullptr);
+    }
+    FreeCover(&covers_[shown_]);
+    shown_ = -1;
+}
+
+void CoverArt::FreeCover(Cover* cover) {
+    heap_caps_free(cover->buffer);
+    cover->buffer = nullptr;
+    cover->buffer_size = 0;
+    cover->key.clear();
+}
+
+void CoverArt::Task() {
+    while (true) {
+        std::unique_ptr<Request> request;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            request = std::move(pending_);
+            if (request == nullptr) {
+                // 退出前释放不在屏幕上的那一块
+                for (int i = 0; i < 2; i++) {
+                    if (i != shown_) {
+                        FreeCover(&covers_[i]);
+                    }
+                }
+                task_running_ = false;
+                return;
+            }
+        }
+        Process(*request);
+    }
+}
+
+void CoverArt::Process(Request& request) {
+    Id3Tag tag;
+    if (!Id3ParseTag(request.tag.data(), request.tag.size(), &tag)) {
+        ESP_LOGI(TAG, "No usable ID3 tag for %s", request.key.c_str());
+        return;
+    }
+    ESP_LOGI(TAG, "Tag: %s / %s, cover %u bytes", tag.title.c_str(), tag.artist.c_str(), (unsigned int)tag.picture_size);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (request.generation != generation_) {
+            return;
+        }
+    }
+    if (request.on_tag) {
+        request.on_tag(tag);
+    }
+
+    auto display = Board::GetInstance().GetDisplay();
+    int side = display != nullptr ? display->GetMusicCoverSize() : 0;
+    if (side <= 0) {
+        return;
+    }
+
+    int back;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (request.generation != generation_) {
+            return;
+        }
+        if (tag.picture == nullptr) {
+            HideLocked();
+            return;
+        }
+        // 同一首歌再次播放，屏幕上的封面还在
+        if (shown_ >= 0 && covers_[shown_].key == request.key && covers_[shown_].image.header.w == side) {
+            display->SetMusicCover(&covers_[shown_].image);
+            return;
+        }
+        back = shown_ == 0 ? 1 : 0;
+    }
+
+    auto& cover = covers_[back];
+    if (!LoadCover(request.key, tag, side, &cover)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (request.generation != generation_) {
+        return;
+    }
+    display->SetMusicCover(&cover.image);
+    if (shown_ >= 0) {
+        FreeCover(&covers_[shown_]);
+    }
+    shown_ = back;
+}
+
+bool CoverArt::LoadCover(const std::string& key, const Id3Tag& tag, int side, Cover* cover) {
+    size_t pixels_size = (size_t)side * side * 2;
+    size_t buffer_size = sizeof(CoverCacheHeader) + pixels_size;
+    if (cover->buffer_size != buffer_size) {
+        FreeCover(cover);
+        cover->buffer = (uint8_t*)heap_caps_malloc(buffer_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (cover->buffer == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate %u bytes for cover", (unsigned int)buffer_size);
+            return false;
+        }
+        cover->buffer_size = buffer_size;
+    }
+    auto header = (CoverCacheHeader*)cover->buffer;
+    auto pixels = (uint16_t*)(cover->buffer + sizeof(CoverCacheHeader));
+
+    // 缓存里的封面尺寸和屏幕一致时直接使用
+    auto& cache = SongCache::GetInstance();
+    std::string cache_key = COVER_ART_CACHE_PREFIX + key;
+    if (cache.Get(cache_key, cover->buffer, buffer_size) && header->width == side && header->height == side) {
+        ESP_LOGI(TAG, "Cover loaded from cache");
+    } else {
+        int64_t start_us = esp_timer_get_time();
+        if (!DecodeCover(tag.picture, tag.picture_size, side, pixels)) {
+            return false;
+        }
+        ESP_LOGI(TAG, "Cover decoded to %dx%d in %d ms", side, side, (int)((esp_timer_get_time() - start_us) / 1000));
+        header->width = side;
+        header->height = side;
+        cache.Put(cache_key, cover->buffer, buffer_size);
+    }
+
+    memset(&cover->image, 0, sizeof(cover->image));
+    cover->image.header.magic = LV_IMAGE_HEADER_MAGIC;
+    cover->image.header.cf = LV_COLOR_FORMAT_RGB565;
+    cover->image.header.w = side;
+    cover->image.header.h = side;
+    cover->image.header.stride = side * 2;
+    cover->image.data_size = pixels_size;
+    cover->image.data = (const uint8_t*)pixels;
+    cover->key = key;
+    return true;
+}
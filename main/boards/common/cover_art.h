@@ -0,0 +1,70 @@
+#ifndef COVER_ART_H
+#define COVER_ART_H
+
+#include <lvgl.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+#include "id3_tag.h"
+
+/*
+ * Title, artist and cover art of the playing song, taken from its ID3v2 tag.
+ *
+ * The play thread only hands over the raw tag. A low-priority task, started on demand and gone once
+ * idle, parses it, decodes the embedded JPEG (hardware decoder on P4, esp_jpeg with its built-in
+ * 1/2 - 1/8 scaling elsewhere), crops and scales it to the square the display reserves for the cover
+ * and shows it. The decoded cover is stored in the song cache next to the song, so playing it again
+ * skips the decode. Two cover buffers are used in turn, the one on screen stays valid until replaced.
+ */
+class CoverArt {
+public:
+    using TagCallback = std::function<void(const Id3Tag& tag)>;
+
+    static CoverArt& GetInstance() {
+        static CoverArt instance;
+        return instance;
+    }
+    CoverArt(const CoverArt&) = delete;
+    CoverArt& operator=(const CoverArt&) = delete;
+
+    // 在播放线程中调用，key 为歌曲的缓存键；on_tag 在后台任务中、显示封面之前调用
+    void Submit(const std::string& key, std::vector<uint8_t>&& tag, TagCallback on_tag);
+    // 停止播放时隐藏封面，还没处理的标签丢弃
+    void Clear();
+
+private:
+    struct Request {
+        std::string key;
+        std::vector<uint8_t> tag;
+        TagCallback on_tag;
+        uint32_t generation;
+    };
+
+    struct Cover {
+        lv_img_dsc_t image;
+        uint8_t* buffer = nullptr;      // 缓存文件头 + 像素
+        size_t buffer_size = 0;
+        std::string key;
+    };
+
+    CoverArt() = default;
+
+    void Task();
+    void Process(Request& request);
+    bool LoadCover(const std::string& key, const Id3Tag& tag, int side, Cover* cover);
+    void HideLocked();
+    void FreeCover(Cover* cover);
+
+    std::mutex mutex_;
+    std::unique_ptr<Request> pending_;
+    bool task_running_ = false;
+    uint32_t generation_ = 0;       // Submit 和 Clear 时递增，显示之前核对
+    Cover covers_[2];
+    int shown_ = -1;
+};
+
+#endif // COVER_ART_H
@@ -4,9 +4,13 @@
 #include "assets/lang_config.h"
 #include "settings.h"
 #include <esp_log.h>
+#include <wifi_station.h>
 
 static const char *TAG = "DualNetworkBoard";
 
+// 备用 4G 网络在后台启动的最长时间，超时后放弃，留在 WiFi 上等待重连
+#define ML307_STANDBY_TIMEOUT_MS 90000
+
 DualNetworkBoard::DualNetworkBoard(gpio_num_t ml307_tx_pin, gpio_num_t ml307_rx_pin, gpio_num_t ml307_dtr_pin, int32_t default_net_type) 
     : Board(), 
       ml307_tx_pin_(ml307_tx_pin), 
@@ -76,6 +80,59 @@ NetworkInterface* DualNetworkBoard::GetNetwork() {
     return current_board_->GetNetwork();
 }
 
+bool DualNetworkBoard::FailoverNetwork(std::function<void()> on_switched) {
+    // 只从 WiFi 切到 4G，重启后按设置恢复
+    if (network_type_ != NetworkType::WIFI || failed_over_) {
+        return false;
+    }
+    // 协议或服务器错误时 WiFi 仍然连着，切到 4G 也无济于事
+    if (WifiStation::GetInstance().IsConnected()) {
+        return false;
+    }
+    on_failover_ = std::move(on_switched);
+    if (!standby_starting_) {
+        StartStandbyBoard();
+    }
+    return true;
+}
+
+void DualNetworkBoard::StartStandbyBoard() {
+    ESP_LOGW(TAG, "WiFi failed, starting standby ML307 network");
+    standby_starting_ = true;
+    standby_board_ = std::make_unique<Ml307Board>(ml307_tx_pin_, ml307_rx_pin_, ml307_dtr_pin_);
+    // 模组检测和注网可能需要数十秒，不能阻塞主循环；接管网络之前不碰界面
+    xTaskCreate([](void* arg) {
+        auto self = (DualNetworkBoard*)arg;
+        auto ml307_board = static_cast<Ml307Board*>(self->standby_board_.get());
+        bool ready = ml307_board->StartStandbyNetwork(ML307_STANDBY_TIMEOUT_MS, []() {
+            return WifiStation::GetInstance().IsConnected();
+        });
+        if (!ready) {
+            Application::GetInstance().Schedule([self]() {
+                ESP_LOGW(TAG, "Standby ML307 network unavailable, staying on WiFi");
+                self->standby_board_.reset();
+                self->standby_starting_ = false;
+                self->on_failover_ = nullptr;
+            });
+            vTaskDelete(NULL);
+            return;
+        }
+        Application::GetInstance().Schedule([self, ml307_board]() {
+            ESP_LOGI(TAG, "Switched to ML307 network");
+            ml307_board->SetActive(true);
+            std::swap(self->current_board_, self->standby_board_);
+            self->network_type_ = NetworkType::ML307;
+            self->failed_over_ = true;
+            self->standby_starting_ = false;
+            if (self->on_failover_) {
+                self->on_failover_();
+                self->on_failover_ = nullptr;
+            }
+        });
+        vTaskDelete(NULL);
+    }, "ml307_standby", 4096, this, 2, nullptr);
+}
+
 const char* DualNetworkBoard::GetNetworkStateIcon() {
     return current_board_->GetNetworkStateIcon();
 }
@@ -5,6 +5,7 @@
 #include "wifi_board.h"
 #include "ml307_board.h"
 #include <memory>
+#include <functional>
 
 //enum NetworkType
 enum class NetworkType {
@@ -32,6 +33,14 @@ private:
 
     // 初始化当前网络类型对应的板卡
     void InitializeCurrentBoard();
+
+    // WiFi 失效时在后台启动的 4G 板卡，启动完成后与当前板卡互换，WiFi 板卡保留为备用
+    std::unique_ptr<Board> standby_board_;
+    bool standby_starting_ = false;
+    bool failed_over_ = false;
+    std::function<void()> on_failover_;
+
+    void StartStandbyBoard();
  
 public:
     DualNetworkBoard(gpio_num_t ml307_tx_pin, gpio_num_t ml307_rx_pin, gpio_num_t ml307_dtr_pin = GPIO_NUM_NC, int32_t default_net_type = 1);
@@ -51,6 +60,7 @@ public:
     virtual void StartNetwork() override;
     virtual NetworkInterface* GetNetwork() override;
     virtual const char* GetNetworkStateIcon() override;
+    virtual bool FailoverNetwork(std::function<void()> on_switched) override;
     virtual void SetPowerSaveMode(bool enabled) override;
     virtual std::string GetBoardJson() override;
     virtual std::string GetDeviceStatusJson() override;
@@ -0,0 +1,110 @@
+#include "edge_input.h"
+
+#include <esp_log.h>
+#include <esp_attr.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#define TAG "EdgeInput"
+
+namespace {
+
+struct Edge {
+    EdgeInput* input;
+    int64_t time_us;
+};
+
+QueueHandle_t edge_queue = nullptr;
+
+}
+
+EdgeInput::EdgeInput(gpio_num_t gpio_num, bool active_high, int debounce_ms)
+    : gpio_num_(gpio_num), active_high_(active_high), debounce_ms_(debounce_ms) {
+    if (edge_queue == nullptr) {
+        edge_queue = xQueueCreate(8, sizeof(Edge));
+        // 按键直接触发录音开始/结束，优先级高于主循环
+        xTaskCreate(InputTask, "edge_input", 4096, nullptr, 6, nullptr);
+    }
+
+    esp_timer_create_args_t timer_args = {
+        .callback = OnDebounceDone,
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "edge_debounce",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &debounce_timer_));
+
+    // The ISR service may already be installed by another driver
+    esp_err_t err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "Failed to install GPIO ISR service: %s", esp_err_to_name(err));
+        return;
+    }
+    reported_pressed_ = ReadPressed();
+    gpio_set_intr_type(gpio_num_, GPIO_INTR_ANYEDGE);
+    ESP_ERROR_CHECK(gpio_isr_handler_add(gpio_num_, IsrHandler, this));
+    gpio_intr_enable(gpio_num_);
+}
+
+EdgeInput::~EdgeInput() {
+    gpio_isr_handler_remove(gpio_num_);
+    gpio_set_intr_type(gpio_num_, GPIO_INTR_DISABLE);
+    if (debounce_timer_ != nullptr) {
+        esp_timer_stop(debounce_timer_);
+        esp_timer_delete(debounce_timer_);
+    }
+}
+
+bool EdgeInput::ReadPressed() const {
+    return gpio_get_level(gpio_num_) == (active_high_ ? 1 : 0);
+}
+
+void IRAM_ATTR EdgeInput::IsrHandler(void* arg) {
+    auto input = static_cast<EdgeInput*>(arg);
+    if (input->debouncing_) {
+        return;
+    }
+    input->debouncing_ = true;
+    Edge edge = {input, esp_timer_get_time()};
+    BaseType_t woken = pdFALSE;
+    if (xQueueSendFromISR(edge_queue, &edge, &woken) != pdTRUE) {
+        input->debouncing_ = false;
+    }
+    portYIELD_FROM_ISR(woken);
+}
+
+// Runs on the input task for the first edge and for a level change found when the debounce time ends
+void EdgeInput::HandleEdge(int64_t time_us) {
+    bool pressed = ReadPressed();
+    if (pressed != reported_pressed_) {
+        reported_pressed_ = pressed;
+        if (on_edge_) {
+            on_edge_(pressed, time_us);
+        }
+    }
+    esp_timer_start_once(debounce_timer_, debounce_ms_ * 1000);
+}
+
+void EdgeInput::OnDebounceDone(void* arg) {
+    auto input = static_cast<EdgeInput*>(arg);
+    input->debouncing_ = false;
+    // 抖动期间松开或按下的边沿被忽略了，补发一次
+    if (input->ReadPressed() != input->reported_pressed_) {
+        input->debouncing_ = true;
+        Edge edge = {input, esp_timer_get_time()};
+        if (xQueueSend(edge_queue, &edge, 0) != pdTRUE) {
+            input->debouncing_ = false;
+        }
+    }
+}
+
+void EdgeInput::InputTask(void* arg) {
+    Edge edge;
+    while (true) {
+        if (xQueueReceive(edge_queue, &edge, portMAX_DELAY) == pdTRUE) {
+            edge.input->HandleEdge(edge.time_us);
+        }
+    }
+}
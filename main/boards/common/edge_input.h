@@ -0,0 +1,44 @@
+#ifndef EDGE_INPUT_H_
+#define EDGE_INPUT_H_
+
+#include <driver/gpio.h>
+#include <esp_timer.h>
+
+#include <functional>
+
+/*
+ * Press and release edges of a GPIO taken straight from the pin interrupt, instead of the 5 ms poll and
+ * debounce ticks of the button component. The first edge is reported at once with the time stamped in the
+ * ISR, further edges are ignored for the debounce time and the level is sampled again by a one-shot
+ * esp_timer when it ends, so the bounces cost no latency. Callbacks of all pins run on one shared task.
+ */
+class EdgeInput {
+public:
+    EdgeInput(gpio_num_t gpio_num, bool active_high, int debounce_ms);
+    ~EdgeInput();
+    EdgeInput(const EdgeInput&) = delete;
+    EdgeInput& operator=(const EdgeInput&) = delete;
+
+    // pressed, esp_timer_get_time() of the edge
+    void OnEdge(std::function<void(bool, int64_t)> callback) { on_edge_ = callback; }
+    inline bool pressed() const { return reported_pressed_; }
+
+private:
+    gpio_num_t gpio_num_;
+    bool active_high_;
+    int debounce_ms_;
+    esp_timer_handle_t debounce_timer_ = nullptr;
+    // Set by the ISR on the first edge, cleared when the debounce timer fires
+    volatile bool debouncing_ = false;
+    // Only used on the input task
+    bool reported_pressed_ = false;
+    std::function<void(bool, int64_t)> on_edge_;
+
+    bool ReadPressed() const;
+    void HandleEdge(int64_t time_us);
+    static void IsrHandler(void* arg);
+    static void OnDebounceDone(void* arg);
+    static void InputTask(void* arg);
+};
+
+#endif // EDGE_INPUT_H_
@@ -1,18 +1,116 @@
 #include "esp32_camera.h"
 #include "mcp_server.h"
+#include "application.h"
 #include "display.h"
+#include "display_surface_pool.h"
 #include "board.h"
 #include "system_info.h"
+#include "memory_guard.h"
+#include "transfer_manager.h"
 
 #include <esp_log.h>
 #include <esp_heap_caps.h>
+#include <esp_timer.h>
 #include <img_converters.h>
+#include <algorithm>
+#include <cinttypes>
+#include <cstdlib>
 #include <cstring>
 
 #define TAG "Esp32Camera"
 
+// 上传给视觉模型的图像预设，缩小只作用于宽度超过 QVGA 的画面
+#if CONFIG_CAMERA_EXPLAIN_PRESET_FAST
+#define EXPLAIN_JPEG_QUALITY    60
+#define EXPLAIN_IMAGE_HALF_SIZE 1
+#elif CONFIG_CAMERA_EXPLAIN_PRESET_QUALITY
+#define EXPLAIN_JPEG_QUALITY    92
+#define EXPLAIN_IMAGE_HALF_SIZE 0
+#else
+#define EXPLAIN_JPEG_QUALITY    80
+#define EXPLAIN_IMAGE_HALF_SIZE 0
+#endif
+#define EXPLAIN_HALF_SIZE_MIN_WIDTH 320
+
+// 视频流：缩小到不超过这个宽度，画面变化小于阈值的帧不发送，但至少每隔一段时间发送一帧
+#define CAMERA_STREAM_MAX_FPS           5
+#define CAMERA_STREAM_MAX_WIDTH         320
+#define CAMERA_STREAM_JPEG_QUALITY      50
+#define CAMERA_STREAM_DIFF_THRESHOLD    8
+#define CAMERA_STREAM_KEYFRAME_US       (10 * 1000 * 1000)
+// 拍照后保留帧给 Explain() 使用的时间，超时后视频流可以收回
+#define CAMERA_STREAM_PHOTO_HOLD_US     (10 * 1000 * 1000)
+// 保持预热时的取帧间隔，以及 Capture() 可以直接使用的最旧帧
+#define CAMERA_WARM_INTERVAL_MS         200
+#define CAMERA_WARM_MAX_AGE_US          (500 * 1000)
+
+// 大端 RGB565 按 scale x scale 取平均缩小，stride 为源图每行的像素数
+static void DownscaleRgb565(const uint8_t* src, int width, int height, int stride, int scale, uint8_t* dst) {
+    int count = scale * scale;
+    for (int y = 0; y < height / scale; y++) {
+        for (int x = 0; x < width / scale; x++) {
+            int r = 0, g = 0, b = 0;
+            for (int dy = 0; dy < scale; dy++) {
+                const uint8_t* p = src + ((size_t)(y * scale + dy) * stride + x * scale) * 2;
+                for (int dx = 0; dx < scale; dx++, p += 2) {
+                    uint16_t value = (p[0] << 8) | p[1];
+                    r += value >> 11;
+                    g += (value >> 5) & 0x3F;
+                    b += value & 0x1F;
+                }
+            }
+            uint16_t value = ((r / count) << 11) | ((g / count) << 5) | (b / count);
+            *dst++ = value >> 8;
+            *dst++ = value & 0xFF;
+        }
+    }
+}
+
+// 在网格上取点生成亮度缩略图，用来判断画面是否变化
+static void BuildThumbnail(const uint8_t* src, int width, int height, uint8_t* thumbnail) {
+    for (int ty = 0; ty < CAMERA_STREAM_THUMBNAIL_HEIGHT; ty++) {
+        int y = (ty * 2 + 1) * height / (CAMERA_STREAM_THUMBNAIL_HEIGHT * 2);
+        for (int tx = 0; tx < CAMERA_STREAM_THUMBNAIL_WIDTH; tx++) {
+            int x = (tx * 2 + 1) * width / (CAMERA_STREAM_THUMBNAIL_WIDTH * 2);
+            const uint8_t* p = src + ((size_t)y * width + x) * 2;
+            uint16_t value = (p[0] << 8) | p[1];
+            int r = (value >> 8) & 0xF8;
+            int g = (value >> 3) & 0xFC;
+            int b = (value << 3) & 0xF8;
+            *thumbnail++ = (77 * r + 150 * g + 29 * b) >> 8;
+        }
+    }
+}
+
+// 摄像头输出大端 RGB565，按整数倍抽点缩小并交换字节。不缩小时每次处理两个像素
+static void ScalePreview(const uint8_t* src, int width, int height, int scale, uint16_t* dst) {
+    if (scale == 1) {
+        auto in = (const uint32_t*)src;
+        auto out = (uint32_t*)dst;
+        size_t words = (size_t)width * height / 2;
+        for (size_t i = 0; i < words; i++) {
+            uint32_t value = in[i];
+            out[i] = ((value & 0xFF00FF00) >> 8) | ((value & 0x00FF00FF) << 8);
+        }
+        if ((width * height) & 1) {
+            dst[width * height - 1] = __builtin_bswap16(((const uint16_t*)src)[width * height - 1]);
+        }
+        return;
+    }
+
+    int dst_width = width / scale;
+    int dst_height = height / scale;
+    for (int y = 0; y < dst_height; y++) {
+        auto row = (const uint16_t*)src + (size_t)y * scale * width;
+        for (int x = 0; x < dst_width; x++) {
+            *dst++ = __builtin_bswap16(row[x * scale]);
+        }
+    }
+}
+
 Esp32Camera::Esp32Camera(const camera_config_t& config) {
     // camera init
+    MemoryReservation reservation(kMemoryReserveCamera);
     esp_err_t err = esp_camera_init(&config); // 配置上面定义的参数
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Camera init failed with error 0x%x", err);
@@ -23,57 +121,43 @@ Esp32Camera::Esp32Camera(const camera_config_t& config) {
     if (s->id.PID == GC0308_PID) {
         s->set_hmirror(s, 0);  // 这里控制摄像头镜像 写1镜像 写0不镜像
     }
+    init_framesize_ = framesize_ = s->status.framesize;
+    init_sensor_quality_ = sensor_quality_ = config.jpeg_quality;
+
+    if (config.pixel_format == PIXFORMAT_RGB565) {
+        jpeg_encoder_ = JpegEncoder::Create();
+        ESP_LOGI(TAG, "Using %s JPEG encoder", jpeg_encoder_->name());
+    }
 
-    // 初始化预览图片的内存
+    // 预览图片的内存在第一次拍照时按显示屏大小分配
     memset(&preview_image_, 0, sizeof(preview_image_));
     preview_image_.header.magic = LV_IMAGE_HEADER_MAGIC;
     preview_image_.header.cf = LV_COLOR_FORMAT_RGB565;
     preview_image_.header.flags = LV_IMAGE_FLAGS_ALLOCATED | LV_IMAGE_FLAGS_MODIFIABLE;
-
-    switch (config.frame_size) {
-        case FRAMESIZE_SVGA:
-            preview_image_.header.w = 800;
-            preview_image_.header.h = 600;
-            break;
-        case FRAMESIZE_VGA:
-            preview_image_.header.w = 640;
-            preview_image_.header.h = 480;
-            break;
-        case FRAMESIZE_QVGA:
-            preview_image_.header.w = 320;
-            preview_image_.header.h = 240;
-            break;
-        case FRAMESIZE_128X128:
-            preview_image_.header.w = 128;
-            preview_image_.header.h = 128;
-            break;
-        case FRAMESIZE_240X240:
-            preview_image_.header.w = 240;
-            preview_image_.header.h = 240;
-            break;
-        default:
-            ESP_LOGE(TAG, "Unsupported frame size: %d, image preview will not be shown", config.frame_size);
-            preview_image_.data_size = 0;
-            preview_image_.data = nullptr;
-            return;
-    }
-
-    preview_image_.header.stride = preview_image_.header.w * 2;
-    preview_image_.data_size = preview_image_.header.w * preview_image_.header.h * 2;
-    preview_image_.data = (uint8_t*)heap_caps_malloc(preview_image_.data_size, MALLOC_CAP_SPIRAM);
-    if (preview_image_.data == nullptr) {
-        ESP_LOGE(TAG, "Failed to allocate memory for preview image");
-        return;
-    }
 }
 
 Esp32Camera::~Esp32Camera() {
+    StopStreaming();
+    KeepWarm(false);
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(service_mutex_);
+            if (service_task_ == nullptr) {
+                break;
+            }
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    if (stream_buffer_) {
+        heap_caps_free(stream_buffer_);
+        stream_buffer_ = nullptr;
+    }
     if (fb_) {
         esp_camera_fb_return(fb_);
         fb_ = nullptr;
     }
     if (preview_image_.data) {
-        heap_caps_free((void*)preview_image_.data);
+        DisplaySurfacePool::GetInstance().Return((void*)preview_image_.data);
         preview_image_.data = nullptr;
     }
     esp_camera_deinit();
@@ -84,48 +168,146 @@ void Esp32Camera::SetExplainUrl(const std::string& url, const std::string& token
     explain_token_ = token;
 }
 
+void Esp32Camera::SetPhotoOptions(const CameraPhotoOptions& options) {
+    std::lock_guard<std::mutex> lock(frame_mutex_);
+    photo_options_ = options;
+    auto& o = photo_options_;
+    o.crop_x = std::clamp(o.crop_x, 0, 99);
+    o.crop_y = std::clamp(o.crop_y, 0, 99);
+    o.crop_width = std::clamp(o.crop_width, 1, 100 - o.crop_x);
+    o.crop_height = std::clamp(o.crop_height, 1, 100 - o.crop_y);
+    o.quality = std::clamp(o.quality, 0, 100);
+    o.max_width = o.max_width > 0 ? std::max(o.max_width, 32) : 0;
+}
+
+// 选能满足上传宽度的最小的同比例分辨率，不超过初始化时的分辨率，帧缓冲是按它分配的。
+// JPEG 传感器的压缩质量也在这里设置。返回 true 表示传感器配置有变化
+bool Esp32Camera::ApplySensorOptions(sensor_t* sensor) {
+    const auto& options = photo_options_;
+    framesize_t framesize = init_framesize_;
+    if (options.max_width > 0) {
+        const auto& init = resolution[init_framesize_];
+        // 裁剪之后仍要有 max_width 宽
+        int needed_width = options.max_width * 100 / options.crop_width;
+        for (int i = 0; i < init_framesize_; i++) {
+            const auto& r = resolution[i];
+            if (r.aspect_ratio == init.aspect_ratio && r.width >= needed_width && r.width < init.width &&
+                r.height < init.height && r.width < resolution[framesize].width) {
+                framesize = (framesize_t)i;
+            }
+        }
+    }
+
+    bool changed = false;
+    if (framesize != framesize_) {
+        if (sensor->set_framesize(sensor, framesize) == 0) {
+            ESP_LOGI(TAG, "Sensor frame size set to %dx%d", resolution[framesize].width, resolution[framesize].height);
+            framesize_ = framesize;
+            changed = true;
+        } else {
+            ESP_LOGW(TAG, "Failed to set sensor frame size to %dx%d", resolution[framesize].width, resolution[framesize].height);
+        }
+    }
+    if (sensor->pixformat == PIXFORMAT_JPEG) {
+        // 传感器的质量参数 0-63，越小越好
+        int quality = options.quality > 0 ? 63 - options.quality * 53 / 100 : init_sensor_quality_;
+        if (quality != sensor_quality_ && sensor->set_quality(sensor, quality) == 0) {
+            sensor_quality_ = quality;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
 bool Esp32Camera::Capture() {
     if (encoder_thread_.joinable()) {
         encoder_thread_.join();
     }
+    std::lock_guard<std::mutex> lock(frame_mutex_);
 
-    int frames_to_get = 2;
-    // Try to get a stable frame
-    for (int i = 0; i < frames_to_get; i++) {
-        if (fb_ != nullptr) {
-            esp_camera_fb_return(fb_);
+    if (fb_ != nullptr) {
+        esp_camera_fb_return(fb_);
+        fb_ = nullptr;
+    }
+    // 传感器重新配置后，预热中的帧还是旧的尺寸
+    sensor_t* sensor = esp_camera_sensor_get();
+    if (sensor != nullptr && ApplySensorOptions(sensor) && warm_fb_ != nullptr) {
+        esp_camera_fb_return(warm_fb_);
+        warm_fb_ = nullptr;
+    }
+    // 预热中的帧足够新时直接使用，传感器已经稳定
+    if (warm_fb_ != nullptr) {
+        if (esp_timer_get_time() - warm_fb_time_us_ < CAMERA_WARM_MAX_AGE_US) {
+            fb_ = warm_fb_;
+        } else {
+            esp_camera_fb_return(warm_fb_);
         }
-        fb_ = esp_camera_fb_get();
-        if (fb_ == nullptr) {
-            ESP_LOGE(TAG, "Camera capture failed");
-            return false;
+        warm_fb_ = nullptr;
+    }
+
+    if (fb_ == nullptr) {
+        int frames_to_get = 2;
+        // Try to get a stable frame
+        for (int i = 0; i < frames_to_get; i++) {
+            if (fb_ != nullptr) {
+                esp_camera_fb_return(fb_);
+            }
+            fb_ = esp_camera_fb_get();
+            if (fb_ == nullptr) {
+                ESP_LOGE(TAG, "Camera capture failed");
+                return false;
+            }
         }
     }
+    fb_time_us_ = esp_timer_get_time();
 
-    // 如果预览图片 buffer 为空，则跳过预览
-    // 但仍返回 true，因为此时图像可以上传至服务器
-    if (preview_image_.data_size == 0) {
-        ESP_LOGW(TAG, "Skip preview because of unsupported frame size");
+    // 显示预览图片
+    auto display = Board::GetInstance().GetDisplay();
+    if (display == nullptr || fb_->format != PIXFORMAT_RGB565) {
         return true;
     }
-    if (preview_image_.data == nullptr) {
-        ESP_LOGE(TAG, "Preview image data is not initialized");
+    if (!UpdatePreviewBuffer(display)) {
+        // 预览失败仍返回 true，因为此时图像可以上传至服务器
         return true;
     }
-    // 显示预览图片
-    auto display = Board::GetInstance().GetDisplay();
-    if (display != nullptr) {
-        auto src = (uint16_t*)fb_->buf;
-        auto dst = (uint16_t*)preview_image_.data;
-        size_t pixel_count = fb_->len / 2;
-        for (size_t i = 0; i < pixel_count; i++) {
-            // 交换每个16位字内的字节
-            dst[i] = __builtin_bswap16(src[i]);
-        }
-        display->SetPreviewImage(&preview_image_);
+    ScalePreview(fb_->buf, fb_->width, fb_->height, preview_scale_, (uint16_t*)preview_image_.data);
+    display->SetPreviewImage(&preview_image_);
+    return true;
+}
+
+bool Esp32Camera::UpdatePreviewBuffer(Display* display) {
+    // 按整数倍缩小到不超过屏幕宽度，LVGL 不用再缩放整帧
+    int scale = 1;
+    if (display->width() > 0 && fb_->width > display->width()) {
+        scale = (fb_->width + display->width() - 1) / display->width();
+    }
+    uint32_t width = fb_->width / scale;
+    uint32_t height = fb_->height / scale;
+    preview_scale_ = scale;
+    if (preview_image_.data != nullptr && preview_image_.header.w == width && preview_image_.header.h == height) {
+        return true;
+    }
+
+    if (preview_image_.data != nullptr) {
+        display->SetPreviewImage(nullptr);
+        DisplaySurfacePool::GetInstance().Return((void*)preview_image_.data);
+        preview_image_.data = nullptr;
+        preview_image_.data_size = 0;
     }
+    preview_image_.header.w = width;
+    preview_image_.header.h = height;
+    preview_image_.header.stride = width * 2;
+    // 和频谱画布共用显示缓冲池，不再每次换尺寸都重新分配
+    preview_image_.data = (uint8_t*)DisplaySurfacePool::GetInstance().Lease(width * height * 2);
+    if (preview_image_.data == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate memory for preview image");
+        return false;
+    }
+    preview_image_.data_size = width * height * 2;
+    ESP_LOGI(TAG, "Preview image %" PRIu32 "x%" PRIu32 " for %dx%d frames", width, height, fb_->width, fb_->height);
     return true;
 }
+
 bool Esp32Camera::SetHMirror(bool enabled) {
     sensor_t *s = esp_camera_sensor_get();
     if (s == nullptr) {
@@ -160,6 +342,90 @@ bool Esp32Camera::SetVFlip(bool enabled) {
     return true;
 }
 
+void Esp32Camera::EncodeJpeg(QueueHandle_t jpeg_queue, const CameraPhotoOptions& options) {
+    int64_t start_time = esp_timer_get_time();
+    size_t encoded_size = 0;
+    auto send_chunk = [jpeg_queue, &encoded_size](const uint8_t* data, size_t len) {
+        JpegChunk chunk = {
+            .data = (uint8_t*)heap_caps_aligned_alloc(16, len, MALLOC_CAP_SPIRAM),
+            .len = len
+        };
+        memcpy(chunk.data, data, len);
+        xQueueSend(jpeg_queue, &chunk, portMAX_DELAY);
+        encoded_size += len;
+    };
+    auto software_chunk = [](void* arg, size_t index, const void* data, size_t len) -> size_t {
+        if (data != nullptr && len > 0) {
+            (*static_cast<decltype(send_chunk)*>(arg))(static_cast<const uint8_t*>(data), len);
+        }
+        return len;
+    };
+
+    int quality = options.quality > 0 ? options.quality : EXPLAIN_JPEG_QUALITY;
+    int width = fb_->width;
+    int height = fb_->height;
+    const char* backend = "software";
+    if (fb_->format == PIXFORMAT_RGB565) {
+        // 裁剪区域按两个像素对齐
+        int frame_width = fb_->width;
+        int frame_height = fb_->height;
+        int x = (frame_width * options.crop_x / 100) & ~1;
+        int y = (frame_height * options.crop_y / 100) & ~1;
+        width = std::clamp((frame_width * options.crop_width / 100) & ~1, 2, frame_width - x);
+        height = std::clamp((frame_height * options.crop_height / 100) & ~1, 2, frame_height - y);
+        int scale = 1;
+        if (options.max_width > 0) {
+            scale = (width + options.max_width - 1) / options.max_width;
+        } else if (EXPLAIN_IMAGE_HALF_SIZE && width > EXPLAIN_HALF_SIZE_MIN_WIDTH) {
+            scale = 2;
+        }
+        // 缩小后的宽度保持偶数
+        width -= width % (scale * 2);
+
+        // 只裁掉底部时行还是连续的，不用复制
+        const uint8_t* image = fb_->buf + ((size_t)y * frame_width + x) * 2;
+        uint8_t* buffer = nullptr;
+        if (scale > 1 || image != fb_->buf || width != frame_width) {
+            buffer = (uint8_t*)heap_caps_aligned_alloc(16, (width / scale) * (height / scale) * 2, MALLOC_CAP_SPIRAM);
+            if (buffer != nullptr) {
+                DownscaleRgb565(image, width, height, frame_width, scale, buffer);
+                image = buffer;
+                width /= scale;
+                height /= scale;
+            } else {
+                ESP_LOGW(TAG, "No memory to crop the photo, uploading the whole frame");
+                image = fb_->buf;
+                width = fb_->width;
+                height = fb_->height;
+            }
+        }
+
+        bool encoded = false;
+        if (jpeg_encoder_) {
+            backend = jpeg_encoder_->name();
+            encoded = jpeg_encoder_->Encode(image, width, height, quality, send_chunk);
+            if (!encoded && encoded_size > 0) {
+                encoded = true; // 已经发出部分数据，无法再换用软件编码
+            }
+        }
+        if (!encoded) {
+            backend = "software";
+            fmt2jpg_cb(const_cast<uint8_t*>(image), (size_t)width * height * 2, width, height, PIXFORMAT_RGB565,
+                quality, software_chunk, &send_chunk);
+        }
+        heap_caps_free(buffer);
+    } else {
+        // 其他格式不能裁剪缩小，JPEG 传感器的质量在拍照前已经设置
+        frame2jpg_cb(fb_, quality, software_chunk, &send_chunk);
+    }
+    ESP_LOGI(TAG, "JPEG %dx%d q%d encoded by %s encoder in %d ms, size=%u", width, height, quality, backend,
+        (int)((esp_timer_get_time() - start_time) / 1000), (unsigned)encoded_size);
+
+    // 空块表示结束
+    JpegChunk last_chunk = { .data = nullptr, .len = 0 };
+    xQueueSend(jpeg_queue, &last_chunk, portMAX_DELAY);
+}
+
 /**
  * @brief 将摄像头捕获的图像发送到远程服务器进行AI分析和解释
  * 
@@ -188,6 +454,11 @@ std::string Esp32Camera::Explain(const std::string& question) {
         return "{\"success\": false, \"message\": \"Image explain URL or token is not set\"}";
     }
 
+    std::lock_guard<std::mutex> lock(frame_mutex_);
+    if (fb_ == nullptr) {
+        return "{\"success\": false, \"message\": \"No photo captured\"}";
+    }
+
     // 创建局部的 JPEG 队列, 40 entries is about to store 512 * 40 = 20480 bytes of JPEG data
     QueueHandle_t jpeg_queue = xQueueCreate(40, sizeof(JpegChunk));
     if (jpeg_queue == nullptr) {
@@ -196,19 +467,11 @@ std::string Esp32Camera::Explain(const std::string& question) {
     }
 
     // We spawn a thread to encode the image to JPEG
-    encoder_thread_ = std::thread([this, jpeg_queue]() {
-        frame2jpg_cb(fb_, 80, [](void* arg, size_t index, const void* data, size_t len) -> unsigned int {
-            auto jpeg_queue = (QueueHandle_t)arg;
-            JpegChunk chunk = {
-                .data = (uint8_t*)heap_caps_aligned_alloc(16, len, MALLOC_CAP_SPIRAM),
-                .len = len
-            };
-            memcpy(chunk.data, data, len);
-            xQueueSend(jpeg_queue, &chunk, portMAX_DELAY);
-            return len;
-        }, jpeg_queue);
+    encoder_thread_ = std::thread([this, jpeg_queue, options = photo_options_]() {
+        EncodeJpeg(jpeg_queue, options);
     });
 
+    TransferScope transfer(kTransferInteractive);
     auto network = Board::GetInstance().GetNetwork();
     auto http = network->CreateHttp(3);
     // 构造multipart/form-data请求体
@@ -224,8 +487,7 @@ std::string Esp32Camera::Explain(const std::string& question) {
     http->SetHeader("Transfer-Encoding", "chunked");
     if (!http->Open("POST", explain_url_)) {
         ESP_LOGE(TAG, "Failed to connect to explain URL");
-        // Clear the queue
-        encoder_thread_.join();
+        // 先取空队列再等待编码线程，否则编码线程可能阻塞在满队列上
         JpegChunk chunk;
         while (xQueueReceive(jpeg_queue, &chunk, portMAX_DELAY) == pdPASS) {
             if (chunk.data != nullptr) {
@@ -234,6 +496,7 @@ std::string Esp32Camera::Explain(const std::string& question) {
                 break;
             }
         }
+        encoder_thread_.join();
         vQueueDelete(jpeg_queue);
         return "{\"success\": false, \"message\": \"Failed to connect to explain URL\"}";
     }
@@ -269,6 +532,7 @@ std::string Esp32Camera::Explain(const std::string& question) {
             break; // The last chunk
         }
         http->Write((const char*)chunk.data, chunk.len);
+        transfer.Account(chunk.len);
         total_sent += chunk.len;
         heap_caps_free(chunk.data);
     }
@@ -300,3 +564,180 @@ std::string Esp32Camera::Explain(const std::string& question) {
         fb_->width, fb_->height, total_sent, remain_stack_size, question.c_str(), result.c_str());
     return result;
 }
+
+bool Esp32Camera::StartServiceTask() {
+    std::lock_guard<std::mutex> lock(service_mutex_);
+    if (service_task_ != nullptr) {
+        return true;
+    }
+    BaseType_t ret = xTaskCreate([](void* arg) {
+        static_cast<Esp32Camera*>(arg)->ServiceLoop();
+    }, "camera_service", 8192, this, 2, &service_task_);
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create camera service task");
+        service_task_ = nullptr;
+        return false;
+    }
+    return true;
+}
+
+bool Esp32Camera::StartStreaming(int fps) {
+    if (!jpeg_encoder_) {
+        ESP_LOGW(TAG, "Streaming requires RGB565 frames");
+        return false;
+    }
+    fps = std::clamp(fps, 1, CAMERA_STREAM_MAX_FPS);
+    if (stream_fps_.exchange(fps) == 0) {
+        has_stream_thumbnail_ = false;
+    }
+    if (!StartServiceTask()) {
+        stream_fps_ = 0;
+        return false;
+    }
+    ESP_LOGI(TAG, "Camera streaming at %d fps", fps);
+    return true;
+}
+
+void Esp32Camera::StopStreaming() {
+    if (stream_fps_.exchange(0) != 0) {
+        ESP_LOGI(TAG, "Camera streaming stopped");
+    }
+}
+
+void Esp32Camera::KeepWarm(bool enabled) {
+    keep_warm_ = enabled;
+    if (enabled) {
+        StartServiceTask();
+    }
+}
+
+void Esp32Camera::ServiceLoop() {
+    TickType_t last_wake_time = xTaskGetTickCount();
+    while (true) {
+        int fps;
+        {
+            std::lock_guard<std::mutex> lock(service_mutex_);
+            fps = stream_fps_;
+            if (fps == 0 && !keep_warm_) {
+                service_task_ = nullptr;
+                break;
+            }
+        }
+        ServiceTick();
+        vTaskDelayUntil(&last_wake_time, pdMS_TO_TICKS(fps > 0 ? 1000 / fps : CAMERA_WARM_INTERVAL_MS));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(frame_mutex_);
+        if (warm_fb_ != nullptr) {
+            esp_camera_fb_return(warm_fb_);
+            warm_fb_ = nullptr;
+        }
+    }
+    stream_jpeg_.clear();
+    stream_jpeg_.shrink_to_fit();
+    vTaskDelete(nullptr);
+}
+
+void Esp32Camera::ServiceTick() {
+    // 拍照上传期间跳过
+    std::unique_lock<std::mutex> lock(frame_mutex_, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return;
+    }
+    if (fb_ != nullptr) {
+        if (esp_timer_get_time() - fb_time_us_ < CAMERA_STREAM_PHOTO_HOLD_US) {
+            return;
+        }
+        esp_camera_fb_return(fb_);
+        fb_ = nullptr;
+    }
+    // 只有一个帧缓冲时必须先归还才能取到新帧
+    if (warm_fb_ != nullptr) {
+        esp_camera_fb_return(warm_fb_);
+        warm_fb_ = nullptr;
+    }
+
+    camera_fb_t* frame = esp_camera_fb_get();
+    if (frame == nullptr) {
+        ESP_LOGE(TAG, "Camera capture failed");
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+
+    // 只在对话中发送视频流
+    bool stream = false;
+    if (stream_fps_ > 0 && frame->format == PIXFORMAT_RGB565) {
+        auto state = Application::GetInstance().GetDeviceState();
+        if (state == kDeviceStateListening || state == kDeviceStateSpeaking) {
+            stream = PrepareStreamFrame(frame, now);
+        }
+    }
+
+    if (keep_warm_) {
+        warm_fb_ = frame;
+        warm_fb_time_us_ = now;
+    } else {
+        esp_camera_fb_return(frame);
+    }
+    lock.unlock();
+
+    if (stream) {
+        SendStreamFrame(now);
+    }
+}
+
+// 画面变化足够大或到了关键帧间隔时，把缩小后的画面复制到 stream_buffer_
+bool Esp32Camera::PrepareStreamFrame(const camera_fb_t* frame, int64_t now) {
+    BuildThumbnail(frame->buf, frame->width, frame->height, pending_thumbnail_);
+    bool send = !has_stream_thumbnail_ || now - last_stream_frame_us_ >= CAMERA_STREAM_KEYFRAME_US;
+    if (!send) {
+        int diff = 0;
+        for (size_t i = 0; i < sizeof(pending_thumbnail_); i++) {
+            diff += std::abs(pending_thumbnail_[i] - stream_thumbnail_[i]);
+        }
+        send = diff >= CAMERA_STREAM_DIFF_THRESHOLD * (int)sizeof(pending_thumbnail_);
+    }
+    if (!send) {
+        return false;
+    }
+
+    int scale = (frame->width + CAMERA_STREAM_MAX_WIDTH - 1) / CAMERA_STREAM_MAX_WIDTH;
+    stream_width_ = frame->width / scale;
+    stream_height_ = frame->height / scale;
+    size_t size = stream_width_ * stream_height_ * 2;
+    if (stream_buffer_size_ < size) {
+        heap_caps_free(stream_buffer_);
+        stream_buffer_ = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+        stream_buffer_size_ = stream_buffer_ ? size : 0;
+    }
+    if (stream_buffer_ == nullptr) {
+        return false;
+    }
+    if (scale == 1) {
+        memcpy(stream_buffer_, frame->buf, size);
+    } else {
+        DownscaleRgb565(frame->buf, frame->width, frame->height, frame->width, scale, stream_buffer_);
+    }
+    return true;
+}
+
+void Esp32Camera::SendStreamFrame(int64_t frame_time) {
+    stream_jpeg_.clear();
+    bool encoded = jpeg_encoder_->Encode(stream_buffer_, stream_width_, stream_height_, CAMERA_STREAM_JPEG_QUALITY,
+        [this](const uint8_t* data, size_t len) {
+            stream_jpeg_.insert(stream_jpeg_.end(), data, data + len);
+        });
+    if (!encoded || stream_jpeg_.empty()) {
+        ESP_LOGW(TAG, "Failed to encode stream frame");
+        return;
+    }
+
+    if (Application::GetInstance().SendVideoFrame(stream_jpeg_.data(), stream_jpeg_.size())) {
+        memcpy(stream_thumbnail_, pending_thumbnail_, sizeof(stream_thumbnail_));
+        has_stream_thumbnail_ = true;
+        last_stream_frame_us_ = frame_time;
+        ESP_LOGD(TAG, "Stream frame %dx%d, %u bytes, encoded in %d ms", stream_width_, stream_height_,
+            (unsigned)stream_jpeg_.size(), (int)((esp_timer_get_time() - frame_time) / 1000));
+    }
+}
@@ -5,11 +5,21 @@
 #include <lvgl.h>
 #include <thread>
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <vector>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
+#include <freertos/task.h>
 
 #include "camera.h"
+#include "display.h"
+#include "jpeg_encoder.h"
+
+// 变化检测用的亮度缩略图
+#define CAMERA_STREAM_THUMBNAIL_WIDTH  32
+#define CAMERA_STREAM_THUMBNAIL_HEIGHT 24
 
 struct JpegChunk {
     uint8_t* data;
@@ -19,21 +29,63 @@ struct JpegChunk {
 class Esp32Camera : public Camera {
 private:
     camera_fb_t* fb_ = nullptr;
+    int64_t fb_time_us_ = 0;
+    // 拍照与视频流共用摄像头帧，Capture()/Explain() 期间持有
+    std::mutex frame_mutex_;
     lv_img_dsc_t preview_image_;
+    int preview_scale_ = 1;
     std::string explain_url_;
     std::string explain_token_;
     std::thread encoder_thread_;
+    std::unique_ptr<JpegEncoder> jpeg_encoder_;
+
+    // 拍照参数。传感器分辨率和 JPEG 质量切换后保持，相同参数的下一次拍照不用重新配置
+    CameraPhotoOptions photo_options_;
+    framesize_t init_framesize_ = FRAMESIZE_INVALID;
+    framesize_t framesize_ = FRAMESIZE_INVALID;
+    int init_sensor_quality_ = 0;
+    int sensor_quality_ = 0;
+
+    // 对话中后台任务持续取帧，保留最新一帧供 Capture() 直接使用，同时负责视频流
+    std::mutex service_mutex_;
+    TaskHandle_t service_task_ = nullptr;
+    std::atomic<int> stream_fps_ = 0;
+    std::atomic<bool> keep_warm_ = false;
+    camera_fb_t* warm_fb_ = nullptr;
+    int64_t warm_fb_time_us_ = 0;
+    uint8_t stream_thumbnail_[CAMERA_STREAM_THUMBNAIL_WIDTH * CAMERA_STREAM_THUMBNAIL_HEIGHT];
+    uint8_t pending_thumbnail_[CAMERA_STREAM_THUMBNAIL_WIDTH * CAMERA_STREAM_THUMBNAIL_HEIGHT];
+    bool has_stream_thumbnail_ = false;
+    int64_t last_stream_frame_us_ = 0;
+    uint8_t* stream_buffer_ = nullptr;
+    size_t stream_buffer_size_ = 0;
+    int stream_width_ = 0;
+    int stream_height_ = 0;
+    std::vector<uint8_t> stream_jpeg_;
+
+    void EncodeJpeg(QueueHandle_t jpeg_queue, const CameraPhotoOptions& options);
+    bool ApplySensorOptions(sensor_t* sensor);
+    bool UpdatePreviewBuffer(Display* display);
+    bool StartServiceTask();
+    void ServiceLoop();
+    void ServiceTick();
+    bool PrepareStreamFrame(const camera_fb_t* frame, int64_t now);
+    void SendStreamFrame(int64_t frame_time);
 
 public:
     Esp32Camera(const camera_config_t& config);
     ~Esp32Camera();
 
     virtual void SetExplainUrl(const std::string& url, const std::string& token);
+    virtual void SetPhotoOptions(const CameraPhotoOptions& options) override;
     virtual bool Capture();
     // 翻转控制函数
     virtual bool SetHMirror(bool enabled) override;
     virtual bool SetVFlip(bool enabled) override;
     virtual std::string Explain(const std::string& question);
+    virtual bool StartStreaming(int fps) override;
+    virtual void StopStreaming() override;
+    virtual void KeepWarm(bool enabled) override;
 };
 
 #endif // ESP32_CAMERA_H
\ No newline at end of file
@@ -1,108 +1,27 @@
 #include "esp32_music.h"
 #include "board.h"
-#include "system_info.h"
 #include "audio/audio_codec.h"
 #include "application.h"
-#include "protocols/protocol.h"
 #include "display/display.h"
+#include "song_cache.h"
+#include "song_lookup_cache.h"
+#include "local_media_library.h"
+#include "cover_art.h"
+#include "task_stack.h"
 
 #include <esp_log.h>
-#include <esp_heap_caps.h>
 #include <esp_pthread.h>
-#include <esp_timer.h>
-#include <mbedtls/sha256.h>
+#include <esp_heap_caps.h>
 #include <cJSON.h>
 #include <cstring>
 #include <chrono>
-#include <sstream>
 #include <algorithm>
-#include <cctype>  // 为isdigit函数
 #include <thread>   // 为线程ID比较
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 
 #define TAG "Esp32Music"
 
-// ========== 简单的ESP32认证函数 ==========
-
-/**
- * @brief 获取设备MAC地址
- * @return MAC地址字符串
- */
-static std::string get_device_mac() {
-    return SystemInfo::GetMacAddress();
-}
-
-/**
- * @brief 获取设备芯片ID
- * @return 芯片ID字符串
- */
-static std::string get_device_chip_id() {
-    // 使用MAC地址作为芯片ID，去除冒号分隔符
-    std::string mac = SystemInfo::GetMacAddress();
-    // 去除所有冒号
-    mac.erase(std::remove(mac.begin(), mac.end(), ':'), mac.end());
-    return mac;
-}
-
-/**
- * @brief 生成动态密钥
- * @param timestamp 时间戳
- * @return 动态密钥字符串
- */
-static std::string generate_dynamic_key(int64_t timestamp) {
-    // 密钥（请修改为与服务端一致）
-    const std::string secret_key = "your-esp32-secret-key-2024";
-    
-    // 获取设备信息
-    std::string mac = get_device_mac();
-    std::string chip_id = get_device_chip_id();
-    
-    // 组合数据：MAC:芯片ID:时间戳:密钥
-    std::string data = mac + ":" + chip_id + ":" + std::to_string(timestamp) + ":" + secret_key;
-    
-    // SHA256哈希
-    unsigned char hash[32];
-    mbedtls_sha256((unsigned char*)data.c_str(), data.length(), hash, 0);
-    
-    // 转换为十六进制字符串（前16字节）
-    std::string key;
-    for (int i = 0; i < 16; i++) {
-        char hex[3];
-        snprintf(hex, sizeof(hex), "%02X", hash[i]);
-        key += hex;
-    }
-    
-    return key;
-}
-
-/**
- * @brief 为HTTP请求添加认证头
- * @param http HTTP客户端指针
- */
-static void add_auth_headers(Http* http) {
-    // 获取当前时间戳
-    int64_t timestamp = esp_timer_get_time() / 1000000;  // 转换为秒
-    
-    // 生成动态密钥
-    std::string dynamic_key = generate_dynamic_key(timestamp);
-    
-    // 获取设备信息
-    std::string mac = get_device_mac();
-    std::string chip_id = get_device_chip_id();
-    
-    // 添加认证头
-    if (http) {
-        http->SetHeader("X-MAC-Address", mac);
-        http->SetHeader("X-Chip-ID", chip_id);
-        http->SetHeader("X-Timestamp", std::to_string(timestamp));
-        http->SetHeader("X-Dynamic-Key", dynamic_key);
-        
-        ESP_LOGI(TAG, "Added auth headers - MAC: %s, ChipID: %s, Timestamp: %lld", 
-                 mac.c_str(), chip_id.c_str(), timestamp);
-    }
-}
-
 // URL编码函数
 static std::string url_encode(const std::string& str) {
     std::string encoded;
@@ -165,107 +84,16 @@ static std::string buildUrlWithParams(const std::string& base_url, const std::st
 Esp32Music::Esp32Music() : last_downloaded_data_(), current_music_url_(), current_song_name_(),
                          song_name_displayed_(false), current_lyric_url_(), lyrics_(), 
                          current_lyric_index_(-1), lyric_thread_(), is_lyric_running_(false),
-                         display_mode_(DISPLAY_MODE_LYRICS), is_playing_(false), is_downloading_(false), 
-                         play_thread_(), download_thread_(), audio_buffer_(), buffer_mutex_(), 
-                         buffer_cv_(), buffer_size_(0), mp3_decoder_(nullptr), mp3_frame_info_(), 
-                         mp3_decoder_initialized_(false) {
+                         lyric_reload_(false), display_mode_(DISPLAY_MODE_LYRICS), current_play_time_ms_(0),
+                         total_frames_decoded_(0) {
     ESP_LOGI(TAG, "Music player initialized with default spectrum display mode");
-    InitializeMp3Decoder();
 }
 
 Esp32Music::~Esp32Music() {
     ESP_LOGI(TAG, "Destroying music player - stopping all operations");
     
-    // 停止所有操作
-    is_downloading_ = false;
-    is_playing_ = false;
     is_lyric_running_ = false;
-    
-    // 通知所有等待的线程
-    {
-        std::lock_guard<std::mutex> lock(buffer_mutex_);
-        buffer_cv_.notify_all();
-    }
-    
-    // 等待下载线程结束，设置5秒超时
-    if (download_thread_.joinable()) {
-        ESP_LOGI(TAG, "Waiting for download thread to finish (timeout: 5s)");
-        auto start_time = std::chrono::steady_clock::now();
-        
-        // 等待线程结束
-        bool thread_finished = false;
-        while (!thread_finished) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
-                std::chrono::steady_clock::now() - start_time).count();
-            
-            if (elapsed >= 5) {
-                ESP_LOGW(TAG, "Download thread join timeout after 5 seconds");
-                break;
-            }
-            
-            // 再次设置停止标志，确保线程能够检测到
-            is_downloading_ = false;
-            
-            // 通知条件变量
-            {
-                std::lock_guard<std::mutex> lock(buffer_mutex_);
-                buffer_cv_.notify_all();
-            }
-            
-            // 检查线程是否已经结束
-            if (!download_thread_.joinable()) {
-                thread_finished = true;
-            }
-            
-            // 定期打印等待信息
-            if (elapsed > 0 && elapsed % 1 == 0) {
-                ESP_LOGI(TAG, "Still waiting for download thread to finish... (%ds)", (int)elapsed);
-            }
-        }
-        
-        if (download_thread_.joinable()) {
-            download_thread_.join();
-        }
-        ESP_LOGI(TAG, "Download thread finished");
-    }
-    
-    // 等待播放线程结束，设置3秒超时
-    if (play_thread_.joinable()) {
-        ESP_LOGI(TAG, "Waiting for playback thread to finish (timeout: 3s)");
-        auto start_time = std::chrono::steady_clock::now();
-        
-        bool thread_finished = false;
-        while (!thread_finished) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(50));
-            auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
-                std::chrono::steady_clock::now() - start_time).count();
-            
-            if (elapsed >= 3) {
-                ESP_LOGW(TAG, "Playback thread join timeout after 3 seconds");
-                break;
-            }
-            
-            // 再次设置停止标志
-            is_playing_ = false;
-            
-            // 通知条件变量
-            {
-                std::lock_guard<std::mutex> lock(buffer_mutex_);
-                buffer_cv_.notify_all();
-            }
-            
-            // 检查线程是否已经结束
-            if (!play_thread_.joinable()) {
-                thread_finished = true;
-            }
-        }
-        
-        if (play_thread_.joinable()) {
-            play_thread_.join();
-        }
-        ESP_LOGI(TAG, "Playback thread finished");
-    }
+    StopStreaming();
     
     // 等待歌词线程结束
     if (lyric_thread_.joinable()) {
@@ -274,22 +102,47 @@ Esp32Music::~Esp32Music() {
         ESP_LOGI(TAG, "Lyric thread finished");
     }
     
-    // 清理缓冲区和MP3解码器
-    ClearAudioBuffer();
-    CleanupMp3Decoder();
-    
     ESP_LOGI(TAG, "Music player destroyed successfully");
 }
 
+
 bool Esp32Music::Download(const std::string& song_name, const std::string& artist_name) {
     ESP_LOGI(TAG, "小智开源音乐固件qq交流群:826072986");
+    PlaylistEntry entry;
+    if (!ResolveSong(song_name, artist_name, &entry)) {
+        return false;
+    }
+    ESP_LOGI(TAG, "Starting streaming playback for: %s", song_name.c_str());
+    return PlayEntry(entry);
+}
+
+// 请求stream_pcm接口，得到音频和歌词的完整URL
+bool Esp32Music::ResolveSong(const std::string& song_name, const std::string& artist_name, PlaylistEntry* entry) {
     ESP_LOGI(TAG, "Starting to get music details for: %s", song_name.c_str());
     
     // 清空之前的下载数据
     last_downloaded_data_.clear();
-    
-    // 保存歌名用于后续显示
-    current_song_name_ = song_name;
+    entry->song_name = song_name;
+
+    // SD 卡上有这首歌时直接播放本地文件，本地歌曲没有歌词
+    LocalSong local;
+    if (LocalMediaLibrary::GetInstance().Find(song_name, artist_name, &local)) {
+        ESP_LOGI(TAG, "Playing from local library: %s", local.path.c_str());
+        entry->audio_url = LOCAL_MEDIA_URL_PREFIX + local.path;
+        entry->lyric_url.clear();
+        last_downloaded_data_ = "{\"local\":true,\"duration\":" + std::to_string(local.duration_s) + "}";
+        return true;
+    }
+
+    // 最近搜索过的歌曲直接使用上次的结果，省掉一次搜索请求
+    ResolvedSong resolved;
+    if (SongLookupCache::GetInstance().Get(song_name, artist_name, &resolved)) {
+        ESP_LOGI(TAG, "Using cached lookup for: %s", song_name.c_str());
+        entry->audio_url = resolved.audio_url;
+        entry->lyric_url = resolved.lyric_url;
+        last_downloaded_data_ = "{\"cached\":true}";
+        return true;
+    }
     
     // 第一步：请求stream_pcm接口获取音频信息
     std::string base_url = "http://www.xiaozhishop.xyz:5005";
@@ -298,6 +151,7 @@ bool Esp32Music::Download(const std::string& song_name, const std::string& artis
     ESP_LOGI(TAG, "Request URL: %s", full_url.c_str());
     
     // 使用Board提供的HTTP客户端
+    TransferScope transfer(kTransferInteractive);
     auto network = Board::GetInstance().GetNetwork();
     auto http = network->CreateHttp(0);
     
@@ -306,7 +160,7 @@ bool Esp32Music::Download(const std::string& song_name, const std::string& artis
     http->SetHeader("Accept", "application/json");
     
     // 添加ESP32认证头
-    add_auth_headers(http.get());
+    AddStreamAuthHeaders(http.get());
     
     // 打开GET连接
     if (!http->Open("GET", full_url)) {
@@ -325,6 +179,7 @@ bool Esp32Music::Download(const std::string& song_name, const std::string& artis
     // 读取响应数据
     last_downloaded_data_ = http->ReadAll();
     http->Close();
+    transfer.Account(last_downloaded_data_.size());
     
     ESP_LOGI(TAG, "HTTP GET Status = %d, content_length = %d", status_code, last_downloaded_data_.length());
     ESP_LOGD(TAG, "Complete music details response: %s", last_downloaded_data_.c_str());
@@ -335,104 +190,178 @@ bool Esp32Music::Download(const std::string& song_name, const std::string& artis
         return false;
     }
     
-    if (!last_downloaded_data_.empty()) {
-        // 解析响应JSON以提取音频URL
-        cJSON* response_json = cJSON_Parse(last_downloaded_data_.c_str());
-        if (response_json) {
-            // 提取关键信息
-            cJSON* artist = cJSON_GetObjectItem(response_json, "artist");
-            cJSON* title = cJSON_GetObjectItem(response_json, "title");
-            cJSON* audio_url = cJSON_GetObjectItem(response_json, "audio_url");
-            cJSON* lyric_url = cJSON_GetObjectItem(response_json, "lyric_url");
-            
-            if (cJSON_IsString(artist)) {
-                ESP_LOGI(TAG, "Artist: %s", artist->valuestring);
-            }
-            if (cJSON_IsString(title)) {
-                ESP_LOGI(TAG, "Title: %s", title->valuestring);
-            }
+    if (last_downloaded_data_.empty()) {
+        ESP_LOGE(TAG, "Empty response from music API");
+        return false;
+    }
+
+    // 解析响应JSON以提取音频URL
+    cJSON* response_json = cJSON_Parse(last_downloaded_data_.c_str());
+    if (!response_json) {
+        ESP_LOGE(TAG, "Failed to parse JSON response");
+        return false;
+    }
+
+    // 提取关键信息
+    cJSON* artist = cJSON_GetObjectItem(response_json, "artist");
+    cJSON* title = cJSON_GetObjectItem(response_json, "title");
+    cJSON* audio_url = cJSON_GetObjectItem(response_json, "audio_url");
+    cJSON* lyric_url = cJSON_GetObjectItem(response_json, "lyric_url");
+    cJSON* duration = cJSON_GetObjectItem(response_json, "duration");
+    
+    if (cJSON_IsString(artist)) {
+        ESP_LOGI(TAG, "Artist: %s", artist->valuestring);
+    }
+    if (cJSON_IsString(title)) {
+        ESP_LOGI(TAG, "Title: %s", title->valuestring);
+    }
+    
+    // 检查audio_url是否有效
+    if (!cJSON_IsString(audio_url) || !audio_url->valuestring || strlen(audio_url->valuestring) == 0) {
+        // audio_url为空或无效
+        ESP_LOGE(TAG, "Audio URL not found or empty for song: %s", song_name.c_str());
+        ESP_LOGE(TAG, "Failed to find music: 没有找到歌曲 '%s'", song_name.c_str());
+        cJSON_Delete(response_json);
+        return false;
+    }
+    ESP_LOGI(TAG, "Audio URL path: %s", audio_url->valuestring);
+    
+    // 第二步：拼接完整的音频下载URL，确保对audio_url进行URL编码
+    std::string audio_path = audio_url->valuestring;
+    
+    // 使用统一的URL构建功能
+    if (audio_path.find("?") != std::string::npos) {
+        size_t query_pos = audio_path.find("?");
+        std::string path = audio_path.substr(0, query_pos);
+        std::string query = audio_path.substr(query_pos + 1);
+        
+        entry->audio_url = buildUrlWithParams(base_url, path, query);
+    } else {
+        entry->audio_url = base_url + audio_path;
+    }
+    
+    // 处理歌词URL
+    if (cJSON_IsString(lyric_url) && lyric_url->valuestring && strlen(lyric_url->valuestring) > 0) {
+        // 拼接完整的歌词下载URL，使用相同的URL构建逻辑
+        std::string lyric_path = lyric_url->valuestring;
+        if (lyric_path.find("?") != std::string::npos) {
+            size_t query_pos = lyric_path.find("?");
+            std::string path = lyric_path.substr(0, query_pos);
+            std::string query = lyric_path.substr(query_pos + 1);
             
-            // 检查audio_url是否有效
-            if (cJSON_IsString(audio_url) && audio_url->valuestring && strlen(audio_url->valuestring) > 0) {
-                ESP_LOGI(TAG, "Audio URL path: %s", audio_url->valuestring);
-                
-                // 第二步：拼接完整的音频下载URL，确保对audio_url进行URL编码
-                std::string audio_path = audio_url->valuestring;
-                
-                // 使用统一的URL构建功能
-                if (audio_path.find("?") != std::string::npos) {
-                    size_t query_pos = audio_path.find("?");
-                    std::string path = audio_path.substr(0, query_pos);
-                    std::string query = audio_path.substr(query_pos + 1);
-                    
-                    current_music_url_ = buildUrlWithParams(base_url, path, query);
-                } else {
-                    current_music_url_ = base_url + audio_path;
-                }
-                
-                ESP_LOGI(TAG, "小智开源音乐固件qq交流群:826072986");
-                ESP_LOGI(TAG, "Starting streaming playback for: %s", song_name.c_str());
-                song_name_displayed_ = false;  // 重置歌名显示标志
-                StartStreaming(current_music_url_);
-                
-                // 处理歌词URL - 只有在歌词显示模式下才启动歌词
-                if (cJSON_IsString(lyric_url) && lyric_url->valuestring && strlen(lyric_url->valuestring) > 0) {
-                    // 拼接完整的歌词下载URL，使用相同的URL构建逻辑
-                    std::string lyric_path = lyric_url->valuestring;
-                    if (lyric_path.find("?") != std::string::npos) {
-                        size_t query_pos = lyric_path.find("?");
-                        std::string path = lyric_path.substr(0, query_pos);
-                        std::string query = lyric_path.substr(query_pos + 1);
-                        
-                        current_lyric_url_ = buildUrlWithParams(base_url, path, query);
-                    } else {
-                        current_lyric_url_ = base_url + lyric_path;
-                    }
-                    
-                    // 根据显示模式决定是否启动歌词
-                    if (display_mode_ == DISPLAY_MODE_LYRICS) {
-                        ESP_LOGI(TAG, "Loading lyrics for: %s (lyrics display mode)", song_name.c_str());
-                        
-                        // 启动歌词下载和显示
-                        if (is_lyric_running_) {
-                            is_lyric_running_ = false;
-                            if (lyric_thread_.joinable()) {
-                                lyric_thread_.join();
-                            }
-                        }
-                        
-                        is_lyric_running_ = true;
-                        current_lyric_index_ = -1;
-                        lyrics_.clear();
-                        
-                        lyric_thread_ = std::thread(&Esp32Music::LyricDisplayThread, this);
-                    } else {
-                        ESP_LOGI(TAG, "Lyric URL found but spectrum display mode is active, skipping lyrics");
-                    }
-                } else {
-                    ESP_LOGW(TAG, "No lyric URL found for this song");
-                }
-                
-                cJSON_Delete(response_json);
-                return true;
-            } else {
-                // audio_url为空或无效
-                ESP_LOGE(TAG, "Audio URL not found or empty for song: %s", song_name.c_str());
-                ESP_LOGE(TAG, "Failed to find music: 没有找到歌曲 '%s'", song_name.c_str());
-                cJSON_Delete(response_json);
-                return false;
-            }
+            entry->lyric_url = buildUrlWithParams(base_url, path, query);
         } else {
-            ESP_LOGE(TAG, "Failed to parse JSON response");
+            entry->lyric_url = base_url + lyric_path;
         }
     } else {
-        ESP_LOGE(TAG, "Empty response from music API");
+        ESP_LOGW(TAG, "No lyric URL found for this song");
     }
+
+    resolved.audio_url = entry->audio_url;
+    resolved.lyric_url = entry->lyric_url;
+    resolved.duration_s = cJSON_IsNumber(duration) ? duration->valueint : 0;
+    SongLookupCache::GetInstance().Put(song_name, artist_name, resolved);
     
-    return false;
+    cJSON_Delete(response_json);
+    return true;
 }
 
+// 立即播放，打断当前歌曲
+bool Esp32Music::PlayEntry(const PlaylistEntry& entry) {
+    // 先停止旧的歌词线程，再切换歌曲信息
+    if (lyric_thread_.joinable()) {
+        is_lyric_running_ = false;
+        lyric_thread_.join();
+    }
+
+    current_song_name_ = entry.song_name;
+    current_music_url_ = entry.audio_url;
+    {
+        std::lock_guard<std::mutex> lock(lyrics_mutex_);
+        current_lyric_url_ = entry.lyric_url;
+        SetLyricsLocked(nullptr);
+    }
+    current_lyric_index_ = -1;
+    song_name_displayed_ = false;  // 重置歌名显示标志
+    if (!StartStreaming(current_music_url_)) {
+        return false;
+    }
+
+    // 根据显示模式决定是否启动歌词，后续曲目的歌词由同一个线程加载
+    if (display_mode_ == DISPLAY_MODE_LYRICS) {
+        ESP_LOGI(TAG, "Loading lyrics for: %s (lyrics display mode)", entry.song_name.c_str());
+        is_lyric_running_ = true;
+        lyric_reload_ = true;
+        // 沿用 StartStreaming() 刚设置的线程配置，只换名字和栈的位置
+        esp_pthread_cfg_t cfg;
+        if (esp_pthread_get_cfg(&cfg) != ESP_OK) {
+            cfg = esp_pthread_get_default_config();
+        }
+        esp_pthread_cfg_t previous = cfg;
+        cfg.thread_name = "music_lyric";
+        TaskStacks::GetInstance().ConfigureThread(cfg);
+        esp_pthread_set_cfg(&cfg);
+        lyric_thread_ = std::thread(&Esp32Music::LyricDisplayThread, this);
+        esp_pthread_set_cfg(&previous);
+    } else {
+        ESP_LOGI(TAG, "Spectrum display mode is active, skipping lyrics");
+    }
+    return true;
+}
+
+bool Esp32Music::Enqueue(const std::string& song_name, const std::string& artist_name) {
+    PlaylistEntry entry;
+    if (!ResolveSong(song_name, artist_name, &entry)) {
+        return false;
+    }
+    if (!StreamPlayer::GetInstance().IsActive(this)) {
+        ESP_LOGI(TAG, "Nothing playing, starting: %s", song_name.c_str());
+        return PlayEntry(entry);
+    }
+    std::lock_guard<std::mutex> lock(playlist_mutex_);
+    playlist_.push_back(std::move(entry));
+    ESP_LOGI(TAG, "Queued: %s, playlist size: %u", song_name.c_str(), (unsigned int)playlist_.size());
+    return true;
+}
+
+bool Esp32Music::Next() {
+    StopStreaming();
+    PlaylistEntry entry;
+    {
+        std::lock_guard<std::mutex> lock(playlist_mutex_);
+        if (playlist_.empty()) {
+            ESP_LOGW(TAG, "Playlist is empty");
+            return false;
+        }
+        entry = std::move(playlist_.front());
+        playlist_.pop_front();
+    }
+    return PlayEntry(entry);
+}
+
+bool Esp32Music::Seek(int64_t time_ms) {
+    if (!StreamPlayer::GetInstance().Seek(this, time_ms)) {
+        return false;
+    }
+    // 歌词从头重新查找
+    current_play_time_ms_ = time_ms;
+    current_lyric_index_ = -1;
+    return true;
+}
 
+size_t Esp32Music::GetPlaylistSize() {
+    std::lock_guard<std::mutex> lock(playlist_mutex_);
+    return playlist_.size();
+}
+
+// 已经预取但还没开始播放的曲目放回播放列表
+void Esp32Music::RequeueUpcoming() {
+    std::lock_guard<std::mutex> lock(playlist_mutex_);
+    while (!upcoming_.empty()) {
+        playlist_.push_front(std::move(upcoming_.back()));
+        upcoming_.pop_back();
+    }
+}
 
 std::string Esp32Music::GetDownloadResult() {
     return last_downloaded_data_;
@@ -445,668 +374,207 @@ bool Esp32Music::StartStreaming(const std::string& music_url) {
         return false;
     }
     
+    // 验证URL有效性
+    if (music_url.find("http") != 0) {
+        ESP_LOGE(TAG, "Invalid URL format: %s", music_url.c_str());
+        return false;
+    }
+    
     ESP_LOGD(TAG, "Starting streaming for URL: %s", music_url.c_str());
     
-    // 停止之前的播放和下载
-    is_downloading_ = false;
-    is_playing_ = false;
+    current_play_time_ms_ = 0;
+    total_frames_decoded_ = 0;
     
-    // 等待之前的线程完全结束
-    if (download_thread_.joinable()) {
+    StreamPlayerConfig config;
+    config.owner = this;
+    config.buffer_size = MAX_BUFFER_SIZE;
+    config.start_threshold = MIN_BUFFER_SIZE;
+    config.on_start = [this]() {
+        ESP_LOGI(TAG, "小智开源音乐固件qq交流群:826072986");
+        // 设备状态检查通过，显示当前播放的歌名
+        if (song_name_displayed_ || current_song_name_.empty()) {
+            return;
+        }
+        auto display = Board::GetInstance().GetDisplay();
+        if (!display) {
+            return;
+        }
+        // 格式化歌名显示为《歌名》播放中...
+        std::string formatted_song_name = "《" + current_song_name_ + "》播放中...";
+        display->SetMusicInfo(formatted_song_name.c_str());
+        ESP_LOGI(TAG, "Displaying song name: %s", formatted_song_name.c_str());
+        song_name_displayed_ = true;
+
+        // 根据显示模式启动相应的显示功能
+        if (display_mode_ == DISPLAY_MODE_SPECTRUM) {
+            display->start();
+            ESP_LOGI(TAG, "Display start() called for spectrum visualization");
+        } else {
+            ESP_LOGI(TAG, "Lyrics display mode active, FFT visualization disabled");
+        }
+    };
+    config.on_pcm = [this](const int16_t* pcm, size_t samples, int64_t play_time_ms) {
+        current_play_time_ms_ = play_time_ms;
+        total_frames_decoded_++;
+        
+        // 按实际听到的位置更新歌词：减去混音器和I2S DMA中还没播放的部分
+        auto& audio_service = Application::GetInstance().GetAudioService();
+        UpdateLyricDisplay(play_time_ms - audio_service.music_latency_us() / 1000);
+    };
+    // 播放列表：当前歌曲下载完成后预取下一首，接在同一个缓冲区后面
+    config.next_source = [this]() -> std::unique_ptr<StreamSource> {
+        std::lock_guard<std::mutex> lock(playlist_mutex_);
+        if (playlist_.empty()) {
+            return nullptr;
+        }
+        upcoming_.push_back(std::move(playlist_.front()));
+        playlist_.pop_front();
+        ESP_LOGI(TAG, "Prefetching next song: %s", upcoming_.back().song_name.c_str());
+        return CreateSongSource(upcoming_.back().audio_url);
+    };
+    config.on_fetch_error = [this](int status_code) {
+        // 预取的歌曲打不开，从待播放中去掉；缓存的搜索结果可能已经失效，下次重新搜索
+        std::lock_guard<std::mutex> lock(playlist_mutex_);
+        if (!upcoming_.empty()) {
+            ESP_LOGW(TAG, "Skipping song: %s, status: %d", upcoming_.back().song_name.c_str(), status_code);
+            SongLookupCache::GetInstance().RemoveAudioUrl(upcoming_.back().audio_url);
+            upcoming_.pop_back();
+        } else if (status_code != 0) {
+            SongLookupCache::GetInstance().RemoveAudioUrl(current_music_url_);
+        }
+    };
+    config.on_track_start = [this](size_t track) {
+        PlaylistEntry entry;
         {
-            std::lock_guard<std::mutex> lock(buffer_mutex_);
-            buffer_cv_.notify_all();  // 通知线程退出
+            std::lock_guard<std::mutex> lock(playlist_mutex_);
+            if (upcoming_.empty()) {
+                return;
+            }
+            entry = std::move(upcoming_.front());
+            upcoming_.pop_front();
         }
-        download_thread_.join();
-    }
-    if (play_thread_.joinable()) {
+        ESP_LOGI(TAG, "Now playing track %u: %s", (unsigned int)track, entry.song_name.c_str());
+        current_song_name_ = entry.song_name;
+        current_music_url_ = entry.audio_url;
+        current_play_time_ms_ = 0;
         {
-            std::lock_guard<std::mutex> lock(buffer_mutex_);
-            buffer_cv_.notify_all();  // 通知线程退出
+            std::lock_guard<std::mutex> lock(lyrics_mutex_);
+            current_lyric_url_ = entry.lyric_url;
+            SetLyricsLocked(entry.lyrics);
+            // 歌词已随音频预取时不再下载
+            lyric_reload_ = entry.lyrics == nullptr;
         }
-        play_thread_.join();
-    }
-    
-    // 清空缓冲区
-    ClearAudioBuffer();
-    
-    // 配置线程栈大小以避免栈溢出
-    esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
-    cfg.stack_size = 8192;  // 8KB栈大小
-    cfg.prio = 5;           // 中等优先级
-    cfg.thread_name = "audio_stream";
-    esp_pthread_set_cfg(&cfg);
-    
-    // 开始下载线程
-    is_downloading_ = true;
-    download_thread_ = std::thread(&Esp32Music::DownloadAudioStream, this, music_url);
+        current_lyric_index_ = -1;
+
+        auto display = Board::GetInstance().GetDisplay();
+        if (display) {
+            std::string formatted_song_name = "《" + current_song_name_ + "》播放中...";
+            display->SetMusicInfo(formatted_song_name.c_str());
+            if (display_mode_ == DISPLAY_MODE_LYRICS) {
+                display->SetChatMessage("lyric", "");
+            }
+        }
+    };
+    config.on_id3_tag = [this](std::vector<uint8_t>&& tag) {
+        // 解析和解码封面都在后台任务中，标签里的歌名和歌手换掉搜索用的歌名
+        CoverArt::GetInstance().Submit(current_music_url_, std::move(tag), [](const Id3Tag& id3) {
+            auto display = Board::GetInstance().GetDisplay();
+            if (display == nullptr || id3.title.empty()) {
+                return;
+            }
+            std::string text = "《" + id3.title + "》" + (id3.artist.empty() ? "" : id3.artist + " ") + "播放中...";
+            display->SetMusicInfo(text.c_str());
+        });
+    };
+    config.on_finished = [this]() {
+        RequeueUpcoming();
+        CoverArt::GetInstance().Clear();
+        // 只在频谱显示模式下才停止FFT显示
+        if (display_mode_ == DISPLAY_MODE_SPECTRUM) {
+            auto display = Board::GetInstance().GetDisplay();
+            if (display) {
+                display->stopFft();
+                ESP_LOGI(TAG, "Stopped FFT display from play thread (spectrum mode)");
+            }
+        }
+    };
     
-    // 开始播放线程（会等待缓冲区有足够数据）
-    is_playing_ = true;
-    play_thread_ = std::thread(&Esp32Music::PlayAudioStream, this);
+    if (!StreamPlayer::GetInstance().Start(CreateSongSource(music_url), std::move(config))) {
+        ESP_LOGE(TAG, "Failed to start streaming");
+        return false;
+    }
     
     ESP_LOGI(TAG, "Streaming threads started successfully");
-    
     return true;
 }
 
+// 本地缓存命中时不再联网下载，否则边播放边缓存
+std::unique_ptr<StreamSource> Esp32Music::CreateSongSource(const std::string& music_url) {
+    if (LocalMediaLibrary::IsLocalUrl(music_url)) {
+        return LocalMediaLibrary::GetInstance().Open(music_url);
+    }
+    auto& cache = SongCache::GetInstance();
+    std::string cache_key = "music:" + music_url;
+    auto source = cache.Open(cache_key);
+    if (source) {
+        return source;
+    }
+    return cache.Wrap(cache_key, std::make_unique<HttpStreamSource>(music_url, "ESP32-Music-Player/1.0"));
+}
+
 // 停止流式播放
 bool Esp32Music::StopStreaming() {
-    ESP_LOGI(TAG, "Stopping music streaming - current state: downloading=%d, playing=%d", 
-            is_downloading_.load(), is_playing_.load());
-
-    // 重置采样率到原始值
-    ResetSampleRate();
+    auto& player = StreamPlayer::GetInstance();
     
     // 检查是否有流式播放正在进行
-    if (!is_playing_ && !is_downloading_) {
+    if (!player.IsActive(this)) {
         ESP_LOGW(TAG, "No streaming in progress");
         return true;
     }
     
-    // 停止下载和播放标志
-    is_downloading_ = false;
-    is_playing_ = false;
+    ESP_LOGI(TAG, "Stopping music streaming");
+    player.Stop();
+    RequeueUpcoming();
     
     // 清空歌名显示
-    auto& board = Board::GetInstance();
-    auto display = board.GetDisplay();
+    auto display = Board::GetInstance().GetDisplay();
     if (display) {
         display->SetMusicInfo("");  // 清空歌名显示
+        CoverArt::GetInstance().Clear();
         ESP_LOGI(TAG, "Cleared song name display");
     }
     
-    // 通知所有等待的线程
-    {
-        std::lock_guard<std::mutex> lock(buffer_mutex_);
-        buffer_cv_.notify_all();
-    }
-    
-    // 等待线程结束（避免重复代码，让StopStreaming也能等待线程完全停止）
-    if (download_thread_.joinable()) {
-        download_thread_.join();
-        ESP_LOGI(TAG, "Download thread joined in StopStreaming");
-    }
-    
-    // 等待播放线程结束，使用更安全的方式
-    if (play_thread_.joinable()) {
-        // 先设置停止标志
-        is_playing_ = false;
-        
-        // 通知条件变量，确保线程能够退出
-        {
-            std::lock_guard<std::mutex> lock(buffer_mutex_);
-            buffer_cv_.notify_all();
-        }
-        
-        // 使用超时机制等待线程结束，避免死锁
-        bool thread_finished = false;
-        int wait_count = 0;
-        const int max_wait = 100; // 最多等待1秒
-        
-        while (!thread_finished && wait_count < max_wait) {
-            vTaskDelay(pdMS_TO_TICKS(10));
-            wait_count++;
-            
-            // 检查线程是否仍然可join
-            if (!play_thread_.joinable()) {
-                thread_finished = true;
-                break;
-            }
-        }
-        
-        if (play_thread_.joinable()) {
-            if (wait_count >= max_wait) {
-                ESP_LOGW(TAG, "Play thread join timeout, detaching thread");
-                play_thread_.detach();
-            } else {
-                play_thread_.join();
-                ESP_LOGI(TAG, "Play thread joined in StopStreaming");
-            }
-        }
-    }
-    
     // 在线程完全结束后，只在频谱模式下停止FFT显示
     if (display && display_mode_ == DISPLAY_MODE_SPECTRUM) {
         display->stopFft();
         ESP_LOGI(TAG, "Stopped FFT display in StopStreaming (spectrum mode)");
-    } else if (display) {
-        ESP_LOGI(TAG, "Not in spectrum mode, skipping FFT stop in StopStreaming");
     }
     
-    ESP_LOGI(TAG, "Music streaming stop signal sent");
+    ESP_LOGI(TAG, "Music streaming stopped");
     return true;
 }
 
-// 流式下载音频数据
-void Esp32Music::DownloadAudioStream(const std::string& music_url) {
-    ESP_LOGD(TAG, "Starting audio stream download from: %s", music_url.c_str());
-    
-    // 验证URL有效性
-    if (music_url.empty() || music_url.find("http") != 0) {
-        ESP_LOGE(TAG, "Invalid URL format: %s", music_url.c_str());
-        is_downloading_ = false;
-        return;
-    }
-    
-    auto network = Board::GetInstance().GetNetwork();
-    auto http = network->CreateHttp(0);
-    
-    // 设置基本请求头
-    http->SetHeader("User-Agent", "ESP32-Music-Player/1.0");
-    http->SetHeader("Accept", "*/*");
-    http->SetHeader("Range", "bytes=0-");  // 支持断点续传
-    
-    // 添加ESP32认证头
-    add_auth_headers(http.get());
-    
-    if (!http->Open("GET", music_url)) {
-        ESP_LOGE(TAG, "Failed to connect to music stream URL");
-        is_downloading_ = false;
-        return;
-    }
-    
-    int status_code = http->GetStatusCode();
-    if (status_code != 200 && status_code != 206) {  // 206 for partial content
-        ESP_LOGE(TAG, "HTTP GET failed with status code: %d", status_code);
-        http->Close();
-        is_downloading_ = false;
-        return;
-    }
-    
-    ESP_LOGI(TAG, "Started downloading audio stream, status: %d", status_code);
-    
-    // 分块读取音频数据
-    const size_t chunk_size = 4096;  // 4KB每块
-    char buffer[chunk_size];
-    size_t total_downloaded = 0;
-    
-    while (is_downloading_ && is_playing_) {
-        int bytes_read = http->Read(buffer, chunk_size);
-        if (bytes_read < 0) {
-            ESP_LOGE(TAG, "Failed to read audio data: error code %d", bytes_read);
-            break;
-        }
-        if (bytes_read == 0) {
-            ESP_LOGI(TAG, "Audio stream download completed, total: %d bytes", total_downloaded);
-            break;
-        }
-        
-        // 打印数据块信息
-        // ESP_LOGI(TAG, "Downloaded chunk: %d bytes at offset %d", bytes_read, total_downloaded);
-        
-        // 安全地打印数据块的十六进制内容（前16字节）
-        if (bytes_read >= 16) {
-            // ESP_LOGI(TAG, "Data: %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X ...", 
-            //         (unsigned char)buffer[0], (unsigned char)buffer[1], (unsigned char)buffer[2], (unsigned char)buffer[3],
-            //         (unsigned char)buffer[4], (unsigned char)buffer[5], (unsigned char)buffer[6], (unsigned char)buffer[7],
-            //         (unsigned char)buffer[8], (unsigned char)buffer[9], (unsigned char)buffer[10], (unsigned char)buffer[11],
-            //         (unsigned char)buffer[12], (unsigned char)buffer[13], (unsigned char)buffer[14], (unsigned char)buffer[15]);
-        } else {
-            ESP_LOGI(TAG, "Data chunk too small: %d bytes", bytes_read);
-        }
-        
-        // 尝试检测文件格式（检查文件头）
-        if (total_downloaded == 0 && bytes_read >= 4) {
-            if (memcmp(buffer, "ID3", 3) == 0) {
-                ESP_LOGI(TAG, "Detected MP3 file with ID3 tag");
-            } else if (buffer[0] == 0xFF && (buffer[1] & 0xE0) == 0xE0) {
-                ESP_LOGI(TAG, "Detected MP3 file header");
-            } else if (memcmp(buffer, "RIFF", 4) == 0) {
-                ESP_LOGI(TAG, "Detected WAV file");
-            } else if (memcmp(buffer, "fLaC", 4) == 0) {
-                ESP_LOGI(TAG, "Detected FLAC file");
-            } else if (memcmp(buffer, "OggS", 4) == 0) {
-                ESP_LOGI(TAG, "Detected OGG file");
-            } else {
-                ESP_LOGI(TAG, "Unknown audio format, first 4 bytes: %02X %02X %02X %02X", 
-                        (unsigned char)buffer[0], (unsigned char)buffer[1], 
-                        (unsigned char)buffer[2], (unsigned char)buffer[3]);
-            }
-        }
-        
-        // 创建音频数据块
-        uint8_t* chunk_data = (uint8_t*)heap_caps_malloc(bytes_read, MALLOC_CAP_SPIRAM);
-        if (!chunk_data) {
-            ESP_LOGE(TAG, "Failed to allocate memory for audio chunk");
-            break;
-        }
-        memcpy(chunk_data, buffer, bytes_read);
-        
-        // 等待缓冲区有空间
-        {
-            std::unique_lock<std::mutex> lock(buffer_mutex_);
-            buffer_cv_.wait(lock, [this] { return buffer_size_ < MAX_BUFFER_SIZE || !is_downloading_; });
-            
-            if (is_downloading_) {
-                audio_buffer_.push(AudioChunk(chunk_data, bytes_read));
-                buffer_size_ += bytes_read;
-                total_downloaded += bytes_read;
-                
-                // 通知播放线程有新数据
-                buffer_cv_.notify_one();
-                
-                if (total_downloaded % (256 * 1024) == 0) {  // 每256KB打印一次进度
-                    ESP_LOGI(TAG, "Downloaded %d bytes, buffer size: %d", total_downloaded, buffer_size_);
-                }
-            } else {
-                heap_caps_free(chunk_data);
-                break;
-            }
-        }
-    }
-    
-    http->Close();
-    is_downloading_ = false;
-    
-    // 通知播放线程下载完成
-    {
-        std::lock_guard<std::mutex> lock(buffer_mutex_);
-        buffer_cv_.notify_all();
-    }
-    
-    ESP_LOGI(TAG, "Audio stream download thread finished");
-}
-
-// 流式播放音频数据
-void Esp32Music::PlayAudioStream() {
-    ESP_LOGI(TAG, "Starting audio stream playback");
-    
-    // 初始化时间跟踪变量
-    current_play_time_ms_ = 0;
-    last_frame_time_ms_ = 0;
-    total_frames_decoded_ = 0;
-    
-    auto codec = Board::GetInstance().GetAudioCodec();
-    if (!codec || !codec->output_enabled()) {
-        ESP_LOGE(TAG, "Audio codec not available or not enabled");
-        is_playing_ = false;
-        return;
-    }
-    
-    if (!mp3_decoder_initialized_) {
-        ESP_LOGE(TAG, "MP3 decoder not initialized");
-        is_playing_ = false;
-        return;
-    }
-    
-    
-    // 等待缓冲区有足够数据开始播放
-    {
-        std::unique_lock<std::mutex> lock(buffer_mutex_);
-        buffer_cv_.wait(lock, [this] { 
-            return buffer_size_ >= MIN_BUFFER_SIZE || (!is_downloading_ && !audio_buffer_.empty()); 
-        });
-    }
-    
-    ESP_LOGI(TAG, "小智开源音乐固件qq交流群:826072986");
-    ESP_LOGI(TAG, "Starting playback with buffer size: %d", buffer_size_);
-    
-    size_t total_played = 0;
-    uint8_t* mp3_input_buffer = nullptr;
-    int bytes_left = 0;
-    uint8_t* read_ptr = nullptr;
-    
-    // 分配MP3输入缓冲区
-    mp3_input_buffer = (uint8_t*)heap_caps_malloc(8192, MALLOC_CAP_SPIRAM);
-    if (!mp3_input_buffer) {
-        ESP_LOGE(TAG, "Failed to allocate MP3 input buffer");
-        is_playing_ = false;
-        return;
-    }
-    
-    // 标记是否已经处理过ID3标签
-    bool id3_processed = false;
-    
-    while (is_playing_) {
-        // 检查设备状态，只有在空闲状态才播放音乐
-        auto& app = Application::GetInstance();
-        DeviceState current_state = app.GetDeviceState();
-        
-        // 状态转换：说话中-》聆听中-》待机状态-》播放音乐
-        if (current_state == kDeviceStateListening || current_state == kDeviceStateSpeaking) {
-            if (current_state == kDeviceStateSpeaking) {
-                ESP_LOGI(TAG, "Device is in speaking state, switching to listening state for music playback");
-            }
-            if (current_state == kDeviceStateListening) {
-                ESP_LOGI(TAG, "Device is in listening state, switching to idle state for music playback");
-            }
-            // 切换状态
-            app.ToggleChatState(); // 变成待机状态
-            vTaskDelay(pdMS_TO_TICKS(300));
-            continue;
-        } else if (current_state != kDeviceStateIdle) { // 不是待机状态，就一直卡在这里，不让播放音乐
-            ESP_LOGD(TAG, "Device state is %d, pausing music playback", current_state);
-            // 如果不是空闲状态，暂停播放
-            vTaskDelay(pdMS_TO_TICKS(50));
-            continue;
-        }
-        
-        // 设备状态检查通过，显示当前播放的歌名
-        if (!song_name_displayed_ && !current_song_name_.empty()) {
-            auto& board = Board::GetInstance();
-            auto display = board.GetDisplay();
-            if (display) {
-                // 格式化歌名显示为《歌名》播放中...
-                std::string formatted_song_name = "《" + current_song_name_ + "》播放中...";
-                display->SetMusicInfo(formatted_song_name.c_str());
-                ESP_LOGI(TAG, "Displaying song name: %s", formatted_song_name.c_str());
-                song_name_displayed_ = true;
-            }
-
-            // 根据显示模式启动相应的显示功能
-            if (display) {
-                if (display_mode_ == DISPLAY_MODE_SPECTRUM) {
-                    display->start();
-                    ESP_LOGI(TAG, "Display start() called for spectrum visualization");
-                } else {
-                    ESP_LOGI(TAG, "Lyrics display mode active, FFT visualization disabled");
-                }
-            }
-        }
-        
-        // 如果需要更多MP3数据，从缓冲区读取
-        if (bytes_left < 4096) {  // 保持至少4KB数据用于解码
-            AudioChunk chunk;
-            
-            // 从缓冲区获取音频数据
-            {
-                std::unique_lock<std::mutex> lock(buffer_mutex_);
-                if (audio_buffer_.empty()) {
-                    if (!is_downloading_) {
-                        // 下载完成且缓冲区为空，播放结束
-                        ESP_LOGI(TAG, "Playback finished, total played: %d bytes", total_played);
-                        break;
-                    }
-                    // 等待新数据
-                    buffer_cv_.wait(lock, [this] { return !audio_buffer_.empty() || !is_downloading_; });
-                    if (audio_buffer_.empty()) {
-                        continue;
-                    }
-                }
-                
-                chunk = audio_buffer_.front();
-                audio_buffer_.pop();
-                buffer_size_ -= chunk.size;
-                
-                // 通知下载线程缓冲区有空间
-                buffer_cv_.notify_one();
-            }
-            
-            // 将新数据添加到MP3输入缓冲区
-            if (chunk.data && chunk.size > 0) {
-                // 移动剩余数据到缓冲区开头
-                if (bytes_left > 0 && read_ptr != mp3_input_buffer) {
-                    memmove(mp3_input_buffer, read_ptr, bytes_left);
-                }
-                
-                // 检查缓冲区空间
-                size_t space_available = 8192 - bytes_left;
-                size_t copy_size = std::min(chunk.size, space_available);
-                
-                // 复制新数据
-                memcpy(mp3_input_buffer + bytes_left, chunk.data, copy_size);
-                bytes_left += copy_size;
-                read_ptr = mp3_input_buffer;
-                
-                // 检查并跳过ID3标签（仅在开始时处理一次）
-                if (!id3_processed && bytes_left >= 10) {
-                    size_t id3_skip = SkipId3Tag(read_ptr, bytes_left);
-                    if (id3_skip > 0) {
-                        read_ptr += id3_skip;
-                        bytes_left -= id3_skip;
-                        ESP_LOGI(TAG, "Skipped ID3 tag: %u bytes", (unsigned int)id3_skip);
-                    }
-                    id3_processed = true;
-                }
-                
-                // 释放chunk内存
-                heap_caps_free(chunk.data);
-            }
-        }
-        
-        // 尝试找到MP3帧同步
-        int sync_offset = MP3FindSyncWord(read_ptr, bytes_left);
-        if (sync_offset < 0) {
-            ESP_LOGW(TAG, "No MP3 sync word found, skipping %d bytes", bytes_left);
-            bytes_left = 0;
-            continue;
-        }
-        
-        // 跳过到同步位置
-        if (sync_offset > 0) {
-            read_ptr += sync_offset;
-            bytes_left -= sync_offset;
-        }
-        
-        // 解码MP3帧
-        int16_t pcm_buffer[2304];
-        int decode_result = MP3Decode(mp3_decoder_, &read_ptr, &bytes_left, pcm_buffer, 0);
-        
-        if (decode_result == 0) {
-            // 解码成功，获取帧信息
-            MP3GetLastFrameInfo(mp3_decoder_, &mp3_frame_info_);
-            total_frames_decoded_++;
-            
-            // 基本的帧信息有效性检查，防止除零错误
-            if (mp3_frame_info_.samprate == 0 || mp3_frame_info_.nChans == 0) {
-                ESP_LOGW(TAG, "Invalid frame info: rate=%d, channels=%d, skipping", 
-                        mp3_frame_info_.samprate, mp3_frame_info_.nChans);
-                continue;
-            }
-            
-            // 计算当前帧的持续时间(毫秒)
-            int frame_duration_ms = (mp3_frame_info_.outputSamps * 1000) / 
-                                  (mp3_frame_info_.samprate * mp3_frame_info_.nChans);
-            
-            // 更新当前播放时间
-            current_play_time_ms_ += frame_duration_ms;
-            
-            ESP_LOGD(TAG, "Frame %d: time=%lldms, duration=%dms, rate=%d, ch=%d", 
-                    total_frames_decoded_, current_play_time_ms_, frame_duration_ms,
-                    mp3_frame_info_.samprate, mp3_frame_info_.nChans);
-            
-            // 更新歌词显示
-            int buffer_latency_ms = 600; // 实测调整值
-            UpdateLyricDisplay(current_play_time_ms_ + buffer_latency_ms);
-            
-            // 将PCM数据发送到Application的音频解码队列
-            if (mp3_frame_info_.outputSamps > 0) {
-                int16_t* final_pcm_data = pcm_buffer;
-                int final_sample_count = mp3_frame_info_.outputSamps;
-                std::vector<int16_t> mono_buffer;
-                
-                // 如果是双通道，转换为单通道混合
-                if (mp3_frame_info_.nChans == 2) {
-                    // 双通道转单通道：将左右声道混合
-                    int stereo_samples = mp3_frame_info_.outputSamps;  // 包含左右声道的总样本数
-                    int mono_samples = stereo_samples / 2;  // 实际的单声道样本数
-                    
-                    mono_buffer.resize(mono_samples);
-                    
-                    for (int i = 0; i < mono_samples; ++i) {
-                        // 混合左右声道 (L + R) / 2
-                        int left = pcm_buffer[i * 2];      // 左声道
-                        int right = pcm_buffer[i * 2 + 1]; // 右声道
-                        mono_buffer[i] = (int16_t)((left + right) / 2);
-                    }
-                    
-                    final_pcm_data = mono_buffer.data();
-                    final_sample_count = mono_samples;
-
-                    ESP_LOGD(TAG, "Converted stereo to mono: %d -> %d samples", 
-                            stereo_samples, mono_samples);
-                } else if (mp3_frame_info_.nChans == 1) {
-                    // 已经是单声道，无需转换
-                    ESP_LOGD(TAG, "Already mono audio: %d samples", final_sample_count);
-                } else {
-                    ESP_LOGW(TAG, "Unsupported channel count: %d, treating as mono", 
-                            mp3_frame_info_.nChans);
-                }
-                
-                // 创建AudioStreamPacket
-                AudioStreamPacket packet;
-                packet.sample_rate = mp3_frame_info_.samprate;
-                packet.frame_duration = 60;  // 使用Application默认的帧时长
-                packet.timestamp = 0;
-                
-                // 将int16_t PCM数据转换为uint8_t字节数组
-                size_t pcm_size_bytes = final_sample_count * sizeof(int16_t);
-                packet.payload.resize(pcm_size_bytes);
-                memcpy(packet.payload.data(), final_pcm_data, pcm_size_bytes);
-
-                if (final_pcm_data_fft == nullptr) {
-                    final_pcm_data_fft = (int16_t*)heap_caps_malloc(
-                        final_sample_count * sizeof(int16_t),
-                        MALLOC_CAP_SPIRAM
-                    );
-                }
-                
-                memcpy(
-                    final_pcm_data_fft,
-                    final_pcm_data,
-                    final_sample_count * sizeof(int16_t)
-                );
-                
-                ESP_LOGD(TAG, "Sending %d PCM samples (%d bytes, rate=%d, channels=%d->1) to Application", 
-                        final_sample_count, pcm_size_bytes, mp3_frame_info_.samprate, mp3_frame_info_.nChans);
-                
-                // 发送到Application的音频解码队列
-                app.AddAudioData(std::move(packet));
-                total_played += pcm_size_bytes;
-                
-                // 打印播放进度
-                if (total_played % (128 * 1024) == 0) {
-                    ESP_LOGI(TAG, "Played %d bytes, buffer size: %d", total_played, buffer_size_);
-                }
-            }
-            
-        } else {
-            // 解码失败
-            ESP_LOGW(TAG, "MP3 decode failed with error: %d", decode_result);
-            
-            // 跳过一些字节继续尝试
-            if (bytes_left > 1) {
-                read_ptr++;
-                bytes_left--;
-            } else {
-                bytes_left = 0;
-            }
-        }
-    }
-    
-    // 清理
-    if (mp3_input_buffer) {
-        heap_caps_free(mp3_input_buffer);
-    }
-    
-    // 播放结束时进行基本清理，但不调用StopStreaming避免线程自我等待
-    ESP_LOGI(TAG, "Audio stream playback finished, total played: %d bytes", total_played);
-    ESP_LOGI(TAG, "Performing basic cleanup from play thread");
-    
-    // 停止播放标志
-    is_playing_ = false;
-    
-    // 只在频谱显示模式下才停止FFT显示
-    if (display_mode_ == DISPLAY_MODE_SPECTRUM) {
-        auto& board = Board::GetInstance();
-        auto display = board.GetDisplay();
-        if (display) {
-            display->stopFft();
-            ESP_LOGI(TAG, "Stopped FFT display from play thread (spectrum mode)");
-        }
-    } else {
-        ESP_LOGI(TAG, "Not in spectrum mode, skipping FFT stop");
-    }
-}
-
-// 清空音频缓冲区
-void Esp32Music::ClearAudioBuffer() {
-    std::lock_guard<std::mutex> lock(buffer_mutex_);
-    
-    while (!audio_buffer_.empty()) {
-        AudioChunk chunk = audio_buffer_.front();
-        audio_buffer_.pop();
-        if (chunk.data) {
-            heap_caps_free(chunk.data);
-        }
-    }
-    
-    buffer_size_ = 0;
-    ESP_LOGI(TAG, "Audio buffer cleared");
+// 对话期间暂停，歌名、封面和歌词显示保留
+bool Esp32Music::SuspendStreaming() {
+    return StreamPlayer::GetInstance().Suspend(this);
 }
 
-// 初始化MP3解码器
-bool Esp32Music::InitializeMp3Decoder() {
-    mp3_decoder_ = MP3InitDecoder();
-    if (mp3_decoder_ == nullptr) {
-        ESP_LOGE(TAG, "Failed to initialize MP3 decoder");
-        mp3_decoder_initialized_ = false;
-        return false;
-    }
-    
-    mp3_decoder_initialized_ = true;
-    ESP_LOGI(TAG, "MP3 decoder initialized successfully");
-    return true;
+bool Esp32Music::ResumeStreaming(bool under_voice) {
+    return StreamPlayer::GetInstance().Resume(this, under_voice);
 }
 
-// 清理MP3解码器
-void Esp32Music::CleanupMp3Decoder() {
-    if (mp3_decoder_ != nullptr) {
-        MP3FreeDecoder(mp3_decoder_);
-        mp3_decoder_ = nullptr;
-    }
-    mp3_decoder_initialized_ = false;
-    ESP_LOGI(TAG, "MP3 decoder cleaned up");
+size_t Esp32Music::GetBufferSize() const {
+    auto& player = StreamPlayer::GetInstance();
+    return player.IsActive(this) ? player.buffered_bytes() : 0;
 }
 
-// 重置采样率到原始值
-void Esp32Music::ResetSampleRate() {
-    auto& board = Board::GetInstance();
-    auto codec = board.GetAudioCodec();
-    if (codec && codec->original_output_sample_rate() > 0 && 
-        codec->output_sample_rate() != codec->original_output_sample_rate()) {
-        ESP_LOGI(TAG, "重置采样率：从 %d Hz 重置到原始值 %d Hz", 
-                codec->output_sample_rate(), codec->original_output_sample_rate());
-        if (codec->SetOutputSampleRate(-1)) {  // -1 表示重置到原始值
-            ESP_LOGI(TAG, "成功重置采样率到原始值: %d Hz", codec->output_sample_rate());
-        } else {
-            ESP_LOGW(TAG, "无法重置采样率到原始值");
-        }
-    }
+bool Esp32Music::IsDownloading() const {
+    return StreamPlayer::GetInstance().IsDownloading(this);
 }
 
-// 跳过MP3文件开头的ID3标签
-size_t Esp32Music::SkipId3Tag(uint8_t* data, size_t size) {
-    if (!data || size < 10) {
-        return 0;
-    }
-    
-    // 检查ID3v2标签头 "ID3"
-    if (memcmp(data, "ID3", 3) != 0) {
-        return 0;
-    }
-    
-    // 计算标签大小（synchsafe integer格式）
-    uint32_t tag_size = ((uint32_t)(data[6] & 0x7F) << 21) |
-                        ((uint32_t)(data[7] & 0x7F) << 14) |
-                        ((uint32_t)(data[8] & 0x7F) << 7)  |
-                        ((uint32_t)(data[9] & 0x7F));
-    
-    // ID3v2头部(10字节) + 标签内容
-    size_t total_skip = 10 + tag_size;
-    
-    // 确保不超过可用数据大小
-    if (total_skip > size) {
-        total_skip = size;
-    }
-    
-    ESP_LOGI(TAG, "Found ID3v2 tag, skipping %u bytes", (unsigned int)total_skip);
-    return total_skip;
-}
 
 // 下载歌词
-bool Esp32Music::DownloadLyrics(const std::string& lyric_url) {
+bool Esp32Music::DownloadLyrics(const std::string& lyric_url, std::shared_ptr<const LyricTimeline>* lyrics, bool publish_partial) {
     ESP_LOGI(TAG, "Downloading lyrics from: %s", lyric_url.c_str());
     
     // 检查URL是否为空
@@ -1119,16 +587,24 @@ bool Esp32Music::DownloadLyrics(const std::string& lyric_url) {
     const int max_retries = 3;
     int retry_count = 0;
     bool success = false;
-    std::string lyric_content;
+    // 边读边解析，不保存完整的歌词文件
+    LrcParser parser;
+    int total_read = 0;
     std::string current_url = lyric_url;
     int redirect_count = 0;
     const int max_redirects = 5;  // 最多允许5次重定向
     
-    while (retry_count < max_retries && !success && redirect_count < max_redirects) {
+    // 当前歌曲的歌词边下边显示，预取的放到后台
+    TransferScope transfer(publish_partial ? kTransferInteractive : kTransferBackground, &is_lyric_running_);
+    // 切歌或停止时尽快退出，PlayEntry 要等本线程结束才能开始下一首
+    while (is_lyric_running_ && retry_count < max_retries && !success && redirect_count < max_redirects) {
         if (retry_count > 0) {
             ESP_LOGI(TAG, "Retrying lyric download (attempt %d of %d)", retry_count + 1, max_retries);
             // 重试前暂停一下
             std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            if (!is_lyric_running_) {
+                break;
+            }
         }
         
         // 使用Board提供的HTTP客户端
@@ -1145,7 +621,7 @@ bool Esp32Music::DownloadLyrics(const std::string& lyric_url) {
         http->SetHeader("Accept", "text/plain");
         
         // 添加ESP32认证头
-        add_auth_headers(http.get());
+        AddStreamAuthHeaders(http.get());
         
         // 打开GET连接
         ESP_LOGI(TAG, "小智开源音乐固件qq交流群:826072986");
@@ -1178,23 +654,34 @@ bool Esp32Music::DownloadLyrics(const std::string& lyric_url) {
         }
         
         // 读取响应
-        lyric_content.clear();
+        parser.Reset();
+        size_t published_lines = 0;
         char buffer[1024];
         int bytes_read;
         bool read_error = false;
-        int total_read = 0;
+        total_read = 0;
         
         // 由于无法获取Content-Length和Content-Type头，我们不知道预期大小和内容类型
         ESP_LOGD(TAG, "Starting to read lyric content");
         
-        while (true) {
-            bytes_read = http->Read(buffer, sizeof(buffer) - 1);
+        while (is_lyric_running_) {
+            bytes_read = http->Read(buffer, sizeof(buffer));
             // ESP_LOGD(TAG, "Lyric HTTP read returned %d bytes", bytes_read); // 注释掉以减少日志输出
             
             if (bytes_read > 0) {
-                buffer[bytes_read] = '\0';
-                lyric_content += buffer;
+                transfer.Account(bytes_read);
+                parser.Feed(buffer, bytes_read);
                 total_read += bytes_read;
+
+                // 已经解析出的歌词先显示出来，不等整个文件下载完
+                if (publish_partial && parser.line_count() > published_lines) {
+                    published_lines = parser.line_count();
+                    auto partial = parser.Build();
+                    std::lock_guard<std::mutex> lock(lyrics_mutex_);
+                    if (lyric_url == current_lyric_url_) {
+                        SetLyricsLocked(std::move(partial));
+                    }
+                }
                 
                 // 定期打印下载进度 - 改为DEBUG级别减少输出
                 if (total_read % 4096 == 0) {
@@ -1208,8 +695,8 @@ bool Esp32Music::DownloadLyrics(const std::string& lyric_url) {
             } else {
                 // bytes_read < 0，可能是ESP-IDF的已知问题
                 // 如果已经读取到了一些数据，则认为下载成功
-                if (!lyric_content.empty()) {
-                    ESP_LOGW(TAG, "HTTP read returned %d, but we have data (%d bytes), continuing", bytes_read, lyric_content.length());
+                if (total_read > 0) {
+                    ESP_LOGW(TAG, "HTTP read returned %d, but we have data (%d bytes), continuing", bytes_read, total_read);
                     success = true;
                     break;
                 } else {
@@ -1233,184 +720,136 @@ bool Esp32Music::DownloadLyrics(const std::string& lyric_url) {
         }
     }
     
+    if (!success && !is_lyric_running_) {
+        ESP_LOGI(TAG, "Lyric download cancelled");
+        return false;
+    }
+
     // 检查是否超过了最大重试次数
     if (retry_count >= max_retries) {
         ESP_LOGE(TAG, "Failed to download lyrics after %d attempts", max_retries);
         return false;
     }
     
-    // 记录前几个字节的数据，帮助调试
-    if (!lyric_content.empty()) {
-        size_t preview_size = std::min(lyric_content.size(), size_t(50));
-        std::string preview = lyric_content.substr(0, preview_size);
-        ESP_LOGD(TAG, "Lyric content preview (%d bytes): %s", lyric_content.length(), preview.c_str());
-    } else {
+    if (total_read == 0) {
         ESP_LOGE(TAG, "Failed to download lyrics or lyrics are empty");
         return false;
     }
-    
-    ESP_LOGI(TAG, "Lyrics downloaded successfully, size: %d bytes", lyric_content.length());
-    return ParseLyrics(lyric_content);
+
+    parser.Finish();
+    *lyrics = parser.Build();
+    ESP_LOGI(TAG, "Lyrics downloaded successfully, size: %d bytes, %u lines", total_read, (unsigned int)(*lyrics)->size());
+    return !(*lyrics)->empty();
 }
 
-// 解析歌词
-bool Esp32Music::ParseLyrics(const std::string& lyric_content) {
-    ESP_LOGI(TAG, "Parsing lyrics content");
-    
-    // 使用锁保护lyrics_数组访问
-    std::lock_guard<std::mutex> lock(lyrics_mutex_);
-    
-    lyrics_.clear();
-    
-    // 按行分割歌词内容
-    std::istringstream stream(lyric_content);
-    std::string line;
-    
-    while (std::getline(stream, line)) {
-        // 去除行尾的回车符
-        if (!line.empty() && line.back() == '\r') {
-            line.pop_back();
-        }
-        
-        // 跳过空行
-        if (line.empty()) {
-            continue;
-        }
-        
-        // 解析LRC格式: [mm:ss.xx]歌词文本
-        if (line.length() > 10 && line[0] == '[') {
-            size_t close_bracket = line.find(']');
-            if (close_bracket != std::string::npos) {
-                std::string tag_or_time = line.substr(1, close_bracket - 1);
-                std::string content = line.substr(close_bracket + 1);
-                
-                // 检查是否是元数据标签而不是时间戳
-                // 元数据标签通常是 [ti:标题], [ar:艺术家], [al:专辑] 等
-                size_t colon_pos = tag_or_time.find(':');
-                if (colon_pos != std::string::npos) {
-                    std::string left_part = tag_or_time.substr(0, colon_pos);
-                    
-                    // 检查冒号左边是否是时间（数字）
-                    bool is_time_format = true;
-                    for (char c : left_part) {
-                        if (!isdigit(c)) {
-                            is_time_format = false;
-                            break;
-                        }
-                    }
-                    
-                    // 如果不是时间格式，跳过这一行（元数据标签）
-                    if (!is_time_format) {
-                        // 可以在这里处理元数据，例如提取标题、艺术家等信息
-                        ESP_LOGD(TAG, "Skipping metadata tag: [%s]", tag_or_time.c_str());
-                        continue;
-                    }
-                    
-                    // 是时间格式，解析时间戳
-                    try {
-                        int minutes = std::stoi(tag_or_time.substr(0, colon_pos));
-                        float seconds = std::stof(tag_or_time.substr(colon_pos + 1));
-                        int timestamp_ms = minutes * 60 * 1000 + (int)(seconds * 1000);
-                        
-                        // 安全处理歌词文本，确保UTF-8编码正确
-                        std::string safe_lyric_text;
-                        if (!content.empty()) {
-                            // 创建安全副本并验证字符串
-                            safe_lyric_text = content;
-                            // 确保字符串以null结尾
-                            safe_lyric_text.shrink_to_fit();
-                        }
-                        
-                        lyrics_.push_back(std::make_pair(timestamp_ms, safe_lyric_text));
-                        
-                        if (!safe_lyric_text.empty()) {
-                            // 限制日志输出长度，避免中文字符截断问题
-                            size_t log_len = std::min(safe_lyric_text.length(), size_t(50));
-                            std::string log_text = safe_lyric_text.substr(0, log_len);
-                            ESP_LOGD(TAG, "Parsed lyric: [%d ms] %s", timestamp_ms, log_text.c_str());
-                        } else {
-                            ESP_LOGD(TAG, "Parsed lyric: [%d ms] (empty)", timestamp_ms);
-                        }
-                    } catch (const std::exception& e) {
-                        ESP_LOGW(TAG, "Failed to parse time: %s", tag_or_time.c_str());
-                    }
-                }
-            }
-        }
-    }
-    
-    // 按时间戳排序
-    std::sort(lyrics_.begin(), lyrics_.end());
-    
-    ESP_LOGI(TAG, "Parsed %d lyric lines", lyrics_.size());
-    return !lyrics_.empty();
+void Esp32Music::SetLyricsLocked(std::shared_ptr<const LyricTimeline> lyrics) {
+    lyrics_ = std::move(lyrics);
+    lyrics_version_++;
 }
 
 // 歌词显示线程
 void Esp32Music::LyricDisplayThread() {
     ESP_LOGI(TAG, "Lyric display thread started");
     
-    if (!DownloadLyrics(current_lyric_url_)) {
-        ESP_LOGE(TAG, "Failed to download or parse lyrics");
-        is_lyric_running_ = false;
-        return;
-    }
-    
-    // 定期检查是否需要更新显示(频率可以降低)
-    while (is_lyric_running_ && is_playing_) {
+    // 播放列表切歌时在这里重新下载歌词，不重新创建线程
+    while (is_lyric_running_ && StreamPlayer::GetInstance().IsActive(this)) {
+        if (lyric_reload_.exchange(false)) {
+            std::string lyric_url;
+            {
+                std::lock_guard<std::mutex> lock(lyrics_mutex_);
+                lyric_url = current_lyric_url_;
+            }
+            std::shared_ptr<const LyricTimeline> lyrics;
+            if (lyric_url.empty()) {
+                ESP_LOGW(TAG, "No lyric URL for this song");
+            } else if (!DownloadLyrics(lyric_url, &lyrics, true)) {
+                ESP_LOGE(TAG, "Failed to download or parse lyrics");
+            }
+            std::lock_guard<std::mutex> lock(lyrics_mutex_);
+            // 下载期间又切了歌，结果作废，等下一轮重新加载
+            if (lyric_url == current_lyric_url_ && lyrics) {
+                SetLyricsLocked(std::move(lyrics));
+            }
+        } else {
+            PrefetchUpcomingLyrics();
+        }
         std::this_thread::sleep_for(std::chrono::milliseconds(50));
     }
     
     ESP_LOGI(TAG, "Lyric display thread finished");
 }
 
-void Esp32Music::UpdateLyricDisplay(int64_t current_time_ms) {
+// 下一首的音频开始预取时同时下载它的歌词，切歌时不用等歌词下载
+void Esp32Music::PrefetchUpcomingLyrics() {
+    std::string lyric_url;
+    {
+        std::lock_guard<std::mutex> lock(playlist_mutex_);
+        for (auto& entry : upcoming_) {
+            if (!entry.lyrics_requested && !entry.lyric_url.empty()) {
+                entry.lyrics_requested = true;
+                lyric_url = entry.lyric_url;
+                break;
+            }
+        }
+    }
+    if (lyric_url.empty()) {
+        return;
+    }
+
+    ESP_LOGI(TAG, "Prefetching lyrics of the next song");
+    std::shared_ptr<const LyricTimeline> lyrics;
+    if (!DownloadLyrics(lyric_url, &lyrics, false)) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(playlist_mutex_);
+        for (auto& entry : upcoming_) {
+            if (entry.lyric_url == lyric_url) {
+                entry.lyrics = lyrics;
+                return;
+            }
+        }
+    }
+    // 下载完成前已经切到这首歌
     std::lock_guard<std::mutex> lock(lyrics_mutex_);
-    
-    if (lyrics_.empty()) {
+    if (lyric_url == current_lyric_url_ && lyric_reload_.exchange(false)) {
+        SetLyricsLocked(std::move(lyrics));
+    }
+}
+
+void Esp32Music::UpdateLyricDisplay(int64_t current_time_ms) {
+    // 每帧都会调用，只有歌词被替换后才加锁取一次新的副本
+    uint32_t version = lyrics_version_.load();
+    if (version != playing_lyrics_version_) {
+        std::lock_guard<std::mutex> lock(lyrics_mutex_);
+        playing_lyrics_ = lyrics_;
+        playing_lyrics_version_ = version;
+    }
+    if (!playing_lyrics_ || playing_lyrics_->empty()) {
         return;
     }
+    const auto& lyrics = *playing_lyrics_;
+    int count = lyrics.size();
     
-    // 查找当前应该显示的歌词
-    int new_lyric_index = -1;
-    
-    // 从当前歌词索引开始查找，提高效率
-    int start_index = (current_lyric_index_.load() >= 0) ? current_lyric_index_.load() : 0;
-    
-    // 正向查找：找到最后一个时间戳小于等于当前时间的歌词
-    for (int i = start_index; i < (int)lyrics_.size(); i++) {
-        if (lyrics_[i].first <= current_time_ms) {
-            new_lyric_index = i;
-        } else {
-            break;  // 时间戳已超过当前时间
-        }
+    // 大多数帧仍在当前这一句内
+    int index = current_lyric_index_.load();
+    if (index >= 0 && index < count && lyrics.time_ms(index) <= current_time_ms &&
+        (index + 1 == count || lyrics.time_ms(index + 1) > current_time_ms)) {
+        return;
     }
     
-    // 如果没有找到(可能当前时间比第一句歌词还早)，显示空
-    if (new_lyric_index == -1) {
-        new_lyric_index = -1;
+    // 二分查找最后一个时间戳小于等于当前时间的歌词，比第一句还早时为-1
+    int new_lyric_index = lyrics.Find(current_time_ms);
+    if (new_lyric_index == index) {
+        return;
     }
+    current_lyric_index_ = new_lyric_index;
     
-    // 如果歌词索引发生变化，更新显示
-    if (new_lyric_index != current_lyric_index_) {
-        current_lyric_index_ = new_lyric_index;
-        
-        auto& board = Board::GetInstance();
-        auto display = board.GetDisplay();
-        if (display) {
-            std::string lyric_text;
-            
-            if (current_lyric_index_ >= 0 && current_lyric_index_ < (int)lyrics_.size()) {
-                lyric_text = lyrics_[current_lyric_index_].second;
-            }
-            
-            // 显示歌词
-            display->SetChatMessage("lyric", lyric_text.c_str());
-            
-            ESP_LOGD(TAG, "Lyric update at %lldms: %s", 
-                    current_time_ms, 
-                    lyric_text.empty() ? "(no lyric)" : lyric_text.c_str());
-        }
+    auto display = Board::GetInstance().GetDisplay();
+    if (display) {
+        const char* lyric_text = new_lyric_index >= 0 ? lyrics.text(new_lyric_index) : "";
+        display->SetChatMessage("lyric", lyric_text);
+        ESP_LOGD(TAG, "Lyric update at %lldms: %s", current_time_ms, lyric_text[0] ? lyric_text : "(no lyric)");
     }
 }
 
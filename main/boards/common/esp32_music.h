@@ -4,26 +4,14 @@
 #include <string>
 #include <thread>
 #include <atomic>
-#include <queue>
 #include <mutex>
-#include <condition_variable>
 #include <vector>
+#include <deque>
+#include <memory>
 
 #include "music.h"
-
-// MP3解码器支持
-extern "C" {
-#include "mp3dec.h"
-}
-
-// 音频数据块结构
-struct AudioChunk {
-    uint8_t* data;
-    size_t size;
-    
-    AudioChunk() : data(nullptr), size(0) {}
-    AudioChunk(uint8_t* d, size_t s) : data(d), size(s) {}
-};
+#include "stream_player.h"
+#include "lyric_timeline.h"
 
 class Esp32Music : public Music {
 public:
@@ -34,6 +22,15 @@ public:
     };
 
 private:
+    struct PlaylistEntry {
+        std::string song_name;
+        std::string audio_url;
+        std::string lyric_url;
+        // 预取下一首音频时由歌词线程同时下载，开始播放时直接使用
+        std::shared_ptr<const LyricTimeline> lyrics;
+        bool lyrics_requested = false;
+    };
+
     std::string last_downloaded_data_;
     std::string current_music_url_;
     std::string current_song_name_;
@@ -41,52 +38,43 @@ private:
     
     // 歌词相关
     std::string current_lyric_url_;
-    std::vector<std::pair<int, std::string>> lyrics_;  // 时间戳和歌词文本
-    std::mutex lyrics_mutex_;  // 保护lyrics_数组的互斥锁
+    // 按时间戳排序的歌词，生成后不再修改，整体替换
+    std::shared_ptr<const LyricTimeline> lyrics_;
+    std::mutex lyrics_mutex_;  // 保护lyrics_指针和歌词URL
     std::atomic<int> current_lyric_index_;
     std::thread lyric_thread_;
     std::atomic<bool> is_lyric_running_;
+    std::atomic<bool> lyric_reload_;    // 切到下一首时通知歌词线程重新下载
+    std::atomic<uint32_t> lyrics_version_{0};
+    // 播放线程持有的歌词副本，版本变化时才加锁更新
+    std::shared_ptr<const LyricTimeline> playing_lyrics_;
+    uint32_t playing_lyrics_version_ = 0;
     
     std::atomic<DisplayMode> display_mode_;
-    std::atomic<bool> is_playing_;
-    std::atomic<bool> is_downloading_;
-    std::thread play_thread_;
-    std::thread download_thread_;
     int64_t current_play_time_ms_;  // 当前播放时间(毫秒)
-    int64_t last_frame_time_ms_;    // 上一帧的时间戳
     int total_frames_decoded_;      // 已解码的帧数
 
-    // 音频缓冲区
-    std::queue<AudioChunk> audio_buffer_;
-    std::mutex buffer_mutex_;
-    std::condition_variable buffer_cv_;
-    size_t buffer_size_;
+    // 播放列表：playlist_ 为等待播放的歌曲，upcoming_ 为已经预取到缓冲区、还没开始播放的歌曲
+    std::mutex playlist_mutex_;
+    std::deque<PlaylistEntry> playlist_;
+    std::deque<PlaylistEntry> upcoming_;
+
+    // 下载、解码和播放由 StreamPlayer 完成，这里只配置缓冲大小
     static constexpr size_t MAX_BUFFER_SIZE = 192 * 1024;  // 256KB缓冲区（降低以减少brownout风险）
-    static constexpr size_t MIN_BUFFER_SIZE = 32 * 1024;   // 32KB最小播放缓冲（降低以减少brownout风险）
-    
-    // MP3解码器相关
-    HMP3Decoder mp3_decoder_;
-    MP3FrameInfo mp3_frame_info_;
-    bool mp3_decoder_initialized_;
-    
-    // 私有方法
-    void DownloadAudioStream(const std::string& music_url);
-    void PlayAudioStream();
-    void ClearAudioBuffer();
-    bool InitializeMp3Decoder();
-    void CleanupMp3Decoder();
-    void ResetSampleRate();  // 重置采样率到原始值
+    static constexpr size_t MIN_BUFFER_SIZE = 32 * 1024;   // 测出下载速度之前的播放启动门槛（降低以减少brownout风险）
     
+    bool ResolveSong(const std::string& song_name, const std::string& artist_name, PlaylistEntry* entry);
+    bool PlayEntry(const PlaylistEntry& entry);
+    void RequeueUpcoming();
+    std::unique_ptr<StreamSource> CreateSongSource(const std::string& music_url);
+
     // 歌词相关私有方法
-    bool DownloadLyrics(const std::string& lyric_url);
-    bool ParseLyrics(const std::string& lyric_content);
+    // publish_partial 为真时边下载边替换当前歌曲的歌词
+    bool DownloadLyrics(const std::string& lyric_url, std::shared_ptr<const LyricTimeline>* lyrics, bool publish_partial);
+    void PrefetchUpcomingLyrics();
+    void SetLyricsLocked(std::shared_ptr<const LyricTimeline> lyrics);
     void LyricDisplayThread();
     void UpdateLyricDisplay(int64_t current_time_ms);
-    
-    // ID3标签处理
-    size_t SkipId3Tag(uint8_t* data, size_t size);
-
-    int16_t* final_pcm_data_fft = nullptr;
 
 public:
     Esp32Music();
@@ -99,9 +87,17 @@ public:
     // 新增方法
     virtual bool StartStreaming(const std::string& music_url) override;
     virtual bool StopStreaming() override;  // 停止流式播放
-    virtual size_t GetBufferSize() const override { return buffer_size_; }
-    virtual bool IsDownloading() const override { return is_downloading_; }
-    virtual int16_t* GetAudioData() override { return final_pcm_data_fft; }
+    virtual bool SuspendStreaming() override;
+    virtual bool ResumeStreaming(bool under_voice) override;
+    virtual size_t GetBufferSize() const override;
+    virtual bool IsDownloading() const override;
+    
+    // 播放列表：正在播放时加入队尾，当前歌曲结束后无缝播放；Next 立即切到下一首
+    bool Enqueue(const std::string& song_name, const std::string& artist_name = "");
+    bool Next();
+    size_t GetPlaylistSize();
+    // 跳转到当前歌曲的 time_ms 处
+    bool Seek(int64_t time_ms);
     
     // 显示模式控制方法
     void SetDisplayMode(DisplayMode mode);
@@ -1,25 +1,12 @@
 #pragma once
 
 #include <string>
-#include <queue>
+#include <thread>
 #include <vector>
 #include <atomic>
-#include <mutex>
-#include <condition_variable>
 
 #include "music.h"
-
-// MP3解码器支持（与 Esp32Music 保持一致）
-extern "C" {
-#include "mp3dec.h"
-}
-
-struct SingAudioChunk {
-    uint8_t* data;
-    size_t size;
-    SingAudioChunk() : data(nullptr), size(0) {}
-    SingAudioChunk(uint8_t* d, size_t s) : data(d), size(s) {}
-};
+#include "stream_player.h"
 
 enum DisplayMode {
     DISPLAY_MODE_SPECTRUM = 0,
@@ -36,11 +23,12 @@ public:
 
     bool StartStreaming(const std::string& music_url) override; // 为兼容，允许URL直连
     bool StopStreaming() override;
+    bool SuspendStreaming() override;
+    bool ResumeStreaming(bool under_voice) override;
 
     // 对齐基类接口的必要覆写
-    virtual size_t GetBufferSize() const override { return buffer_size_; }
-    virtual bool IsDownloading() const override { return is_downloading_; }
-    virtual int16_t* GetAudioData() override { return nullptr; }
+    virtual size_t GetBufferSize() const override;
+    virtual bool IsDownloading() const override;
 
     // Sing 专属：通过 ID 启动流式播放
     bool StartStreamingById(const std::string& song_id);
@@ -48,6 +36,11 @@ public:
     // 显示控制
     void SetDisplayMode(DisplayMode mode);
 
+    // 升降调（半音）和速度（百分比），正在唱的歌立即生效，之后的歌沿用
+    bool SetKeyAndTempo(int semitones, int tempo_percent);
+    inline int key() const { return key_; }
+    inline int tempo_percent() const { return tempo_percent_; }
+
     // 配置 sing 服务端参数
     inline void SetBaseHost(const std::string& host) { base_host_ = host; }
     inline void SetOpenTimeoutMs(int ms) { open_timeout_ms_ = ms; }
@@ -57,15 +50,8 @@ public:
     std::string LookupSongId(const std::string& song_name, const std::string& artist_name);
 
 private:
-    void DownloadAudioStreamById(const std::string& song_id);
-    void DownloadAudioStreamFromUrl();
-    void PlayAudioStream();
-
-    bool InitializeMp3Decoder();
-    void CleanupMp3Decoder();
-    void ClearAudioBuffer();
-    void ResetSampleRate();
-    size_t SkipId3Tag(uint8_t* data, size_t size);
+    // 用 current_stream_url_ 启动 StreamPlayer
+    bool StartStream();
 
     // 歌词相关（占位）
     bool DownloadLyrics(const std::string& lyric_url);
@@ -92,40 +78,13 @@ private:
     std::thread lyric_thread_;
     std::atomic<bool> is_lyric_running_;
     std::atomic<DisplayMode> display_mode_;
+    std::atomic<int> key_{0};
+    std::atomic<int> tempo_percent_{100};
 
-    // 下载与播放状态
-    std::atomic<bool> is_playing_;
-    std::atomic<bool> is_downloading_;
-    std::thread play_thread_;
-    std::thread download_thread_;
-
-    // 时间与统计
-    std::atomic<int64_t> current_play_time_ms_;
-    std::atomic<int64_t> last_frame_time_ms_;
-    std::atomic<uint64_t> total_frames_decoded_;
-
-    // 音频缓冲
-    std::queue<SingAudioChunk> audio_buffer_;
-    std::mutex buffer_mutex_;
-    std::condition_variable buffer_cv_;
-    size_t buffer_size_;
-
-    // MP3 解码器
-    HMP3Decoder mp3_decoder_;
-    MP3FrameInfo mp3_frame_info_;
-    bool mp3_decoder_initialized_;
-
-    // WAV 解析状态
-    bool wav_mode_ = false;
-    bool wav_header_parsed_ = false;
-    int wav_channels_ = 1;
-    int wav_sample_rate_ = 16000;
-    int wav_bits_per_sample_ = 16;
+    // 与 esp32_music 接口一致的缓冲配置（从头文件可见）
+    static constexpr size_t MAX_BUFFER_SIZE = 128 * 1024; // 可根据内存调优
+    static constexpr size_t MIN_BUFFER_SIZE = 16 * 1024;  // 测出下载速度之前的播放启动门槛
 
     // 最近一次下载结果（用于兼容 Download 返回值）
     std::string last_downloaded_data_;
-
-    // 与 esp32_music 接口一致的缓冲配置（从头文件可见）
-    static constexpr size_t MAX_BUFFER_SIZE = 128 * 1024; // 可根据内存调优
-    static constexpr size_t MIN_BUFFER_SIZE = 16 * 1024;  // 播放启动门槛
 };
\ No newline at end of file
@@ -1,6 +1,8 @@
 #include "i2c_device.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
 
 #define TAG "I2cDevice"
 
@@ -22,9 +24,27 @@ I2cDevice::I2cDevice(i2c_master_bus_handle_t i2c_bus, uint8_t addr) {
 void I2cDevice::WriteReg(uint8_t reg, uint8_t value) {
     uint8_t buffer[2] = {reg, value};
     ESP_ERROR_CHECK(i2c_master_transmit(i2c_device_, buffer, 2, 100));
+
+    // 写入的值同步到影子寄存器，读改写不会读到旧值
+    std::lock_guard<std::mutex> lock(shadow_mutex_);
+    for (size_t i = 0; i < shadow_count_; i++) {
+        if (shadow_[i].reg == reg) {
+            shadow_[i].value = value;
+        }
+    }
 }
 
 uint8_t I2cDevice::ReadReg(uint8_t reg) {
+    {
+        std::lock_guard<std::mutex> lock(shadow_mutex_);
+        if (shadow_count_ > 0 && esp_timer_get_time() < shadow_expire_us_) {
+            for (size_t i = 0; i < shadow_count_; i++) {
+                if (shadow_[i].reg == reg) {
+                    return shadow_[i].value;
+                }
+            }
+        }
+    }
     uint8_t buffer[1];
     ESP_ERROR_CHECK(i2c_master_transmit_receive(i2c_device_, &reg, 1, buffer, 1, 100));
     return buffer[0];
@@ -32,4 +52,38 @@ uint8_t I2cDevice::ReadReg(uint8_t reg) {
 
 void I2cDevice::ReadRegs(uint8_t reg, uint8_t* buffer, size_t length) {
     ESP_ERROR_CHECK(i2c_master_transmit_receive(i2c_device_, &reg, 1, buffer, length, 100));
-}
\ No newline at end of file
+}
+
+void I2cDevice::ReadRegs(const uint8_t* regs, uint8_t* values, size_t count) {
+    uint8_t burst[I2C_DEVICE_BURST_GAP * I2C_DEVICE_SHADOW_SIZE];
+    size_t i = 0;
+    while (i < count) {
+        // Extend the burst while the next register is close enough and still fits
+        size_t end = i + 1;
+        while (end < count && regs[end] > regs[end - 1] && regs[end] - regs[end - 1] <= I2C_DEVICE_BURST_GAP &&
+               regs[end] - regs[i] < (int)sizeof(burst)) {
+            end++;
+        }
+        size_t length = regs[end - 1] - regs[i] + 1;
+        ReadRegs(regs[i], burst, length);
+        for (size_t j = i; j < end; j++) {
+            values[j] = burst[regs[j] - regs[i]];
+        }
+        i = end;
+    }
+}
+
+void I2cDevice::Prefetch(const uint8_t* regs, size_t count, int max_age_ms) {
+    count = std::min<size_t>(count, I2C_DEVICE_SHADOW_SIZE);
+    std::lock_guard<std::mutex> lock(shadow_mutex_);
+    if (esp_timer_get_time() < shadow_expire_us_) {
+        return;
+    }
+    uint8_t values[I2C_DEVICE_SHADOW_SIZE];
+    ReadRegs(regs, values, count);
+    for (size_t i = 0; i < count; i++) {
+        shadow_[i] = {regs[i], values[i]};
+    }
+    shadow_count_ = count;
+    shadow_expire_us_ = esp_timer_get_time() + max_age_ms * 1000LL;
+}
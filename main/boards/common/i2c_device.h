@@ -3,6 +3,14 @@
 
 #include <driver/i2c_master.h>
 
+#include <array>
+#include <mutex>
+
+// Registers at most this far apart are fetched by one burst read in a scatter read, the registers in
+// between are read too, so devices with read-to-clear registers there must read them separately
+#define I2C_DEVICE_BURST_GAP 4
+#define I2C_DEVICE_SHADOW_SIZE 8
+
 class I2cDevice {
 public:
     I2cDevice(i2c_master_bus_handle_t i2c_bus, uint8_t addr);
@@ -13,6 +21,21 @@ protected:
     void WriteReg(uint8_t reg, uint8_t value);
     uint8_t ReadReg(uint8_t reg);
     void ReadRegs(uint8_t reg, uint8_t* buffer, size_t length);
+    // Scatter read of registers in ascending order, neighbours share one transaction
+    void ReadRegs(const uint8_t* regs, uint8_t* values, size_t count);
+    // Reads the registers with a scatter read, ReadReg() then answers them from the shadow for max_age_ms.
+    // Status getters polled together (charging, level, temperature) cost one bus round instead of one each.
+    void Prefetch(const uint8_t* regs, size_t count, int max_age_ms);
+
+private:
+    struct ShadowEntry {
+        uint8_t reg;
+        uint8_t value;
+    };
+    std::mutex shadow_mutex_;
+    std::array<ShadowEntry, I2C_DEVICE_SHADOW_SIZE> shadow_;
+    size_t shadow_count_ = 0;
+    int64_t shadow_expire_us_ = 0;
 };
 
 #endif // I2C_DEVICE_H
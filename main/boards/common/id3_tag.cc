@@ -0,0 +1,190 @@
+#include "id3_tag.h"
+
+#include <algorithm>
+#include <cstring>
+
+#define ID3_PICTURE_FRONT_COVER 3
+
+static uint32_t ReadBe32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint32_t ReadSyncsafe32(const uint8_t* p) {
+    return ((uint32_t)(p[0] & 0x7F) << 21) | ((uint32_t)(p[1] & 0x7F) << 14) | ((uint32_t)(p[2] & 0x7F) << 7) | (p[3] & 0x7F);
+}
+
+static void AppendUtf8(std::string* out, uint32_t c) {
+    if (c < 0x80) {
+        out->push_back(c);
+    } else if (c < 0x800) {
+        out->push_back(0xC0 | (c >> 6));
+        out->push_back(0x80 | (c & 0x3F));
+    } else if (c < 0x10000) {
+        out->push_back(0xE0 | (c >> 12));
+        out->push_back(0x80 | ((c >> 6) & 0x3F));
+        out->push_back(0x80 | (c & 0x3F));
+    } else {
+        out->push_back(0xF0 | (c >> 18));
+        out->push_back(0x80 | ((c >> 12) & 0x3F));
+        out->push_back(0x80 | ((c >> 6) & 0x3F));
+        out->push_back(0x80 | (c & 0x3F));
+    }
+}
+
+// 0 ISO-8859-1，1 带 BOM 的 UTF-16，2 UTF-16BE，3 UTF-8
+std::string Id3DecodeText(uint8_t encoding, const uint8_t* data, size_t size) {
+    std::string text;
+    if (encoding == 0 || encoding == 3) {
+        for (size_t i = 0; i < size && data[i] != 0; i++) {
+            if (encoding == 3 || data[i] < 0x80) {
+                text.push_back(data[i]);
+            } else {
+                AppendUtf8(&text, data[i]);
+            }
+        }
+    } else {
+        bool big_endian = encoding == 2;
+        size_t i = 0;
+        if (encoding == 1 && size >= 2) {
+            if (data[0] == 0xFE && data[1] == 0xFF) {
+                big_endian = true;
+                i = 2;
+            } else if (data[0] == 0xFF && data[1] == 0xFE) {
+                i = 2;
+            }
+        }
+        for (; i + 1 < size; i += 2) {
+            uint32_t c = big_endian ? (data[i] << 8) | data[i + 1] : (data[i + 1] << 8) | data[i];
+            if (c == 0) {
+                break;
+            }
+            if (c >= 0xD800 && c < 0xDC00 && i + 3 < size) {
+                uint32_t low = big_endian ? (data[i + 2] << 8) | data[i + 3] : (data[i + 3] << 8) | data[i + 2];
+                if (low >= 0xDC00 && low < 0xE000) {
+                    c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                    i += 2;
+                }
+            }
+            AppendUtf8(&text, c);
+        }
+    }
+
+    size_t start = 0;
+    while (start < text.size() && (unsigned char)text[start] <= ' ') {
+        start++;
+    }
+    size_t end = text.size();
+    while (end > start && (unsigned char)text[end - 1] <= ' ') {
+        end--;
+    }
+    return text.substr(start, end - start);
+}
+
+// APIC：编码、MIME、图片类型、描述、图片数据，只接受 JPEG
+static bool ParsePicture(const uint8_t* body, size_t size, const uint8_t** picture, size_t* picture_size, int* type) {
+    if (size < 4) {
+        return false;
+    }
+    uint8_t encoding = body[0];
+    size_t pos = 1;
+    while (pos < size && body[pos] != 0) {
+        pos++;
+    }
+    pos++;
+    if (pos >= size) {
+        return false;
+    }
+    *type = body[pos++];
+    // 描述以0结束，UTF-16 以两个0结束
+    if (encoding == 1 || encoding == 2) {
+        while (pos + 1 < size && (body[pos] != 0 || body[pos + 1] != 0)) {
+            pos += 2;
+        }
+        pos += 2;
+    } else {
+        while (pos < size && body[pos] != 0) {
+            pos++;
+        }
+        pos++;
+    }
+    if (pos + 2 > size || body[pos] != 0xFF || body[pos + 1] != 0xD8) {
+        return false;
+    }
+    *picture = body + pos;
+    *picture_size = size - pos;
+    return true;
+}
+
+bool Id3ParseTag(const uint8_t* data, size_t size, Id3Tag* tag) {
+    if (size < 10 || memcmp(data, "ID3", 3) != 0) {
+        return false;
+    }
+    int major = data[3];
+    uint8_t flags = data[5];
+    // 整体 unsynchronisation 的标签不解析
+    if (major < 3 || major > 4 || (flags & 0x80)) {
+        return false;
+    }
+    size_t tag_end = std::min<size_t>(size, 10 + ReadSyncsafe32(data + 6));
+    size_t pos = 10;
+    if (flags & 0x40) {
+        if (pos + 4 > tag_end) {
+            return false;
+        }
+        // v2.3 的扩展头长度不含自身的 4 字节
+        pos += major == 4 ? ReadSyncsafe32(data + pos) : ReadBe32(data + pos) + 4;
+    }
+
+    int picture_type = -1;
+    while (pos + 10 <= tag_end) {
+        const uint8_t* frame = data + pos;
+        if (frame[0] == 0) {
+            break;  // 填充区
+        }
+        size_t frame_size = major == 4 ? ReadSyncsafe32(frame + 4) : ReadBe32(frame + 4);
+        uint8_t format = frame[9];
+        pos += 10;
+        if (frame_size > tag_end - pos) {
+            break;
+        }
+        const uint8_t* body = data + pos;
+        size_t body_size = frame_size;
+        pos += frame_size;
+
+        // 压缩、加密和单独 unsynchronisation 的帧跳过，分组标识和数据长度前缀去掉
+        size_t prefix = 0;
+        if (major == 4) {
+            if (format & 0x0E) {
+                continue;
+            }
+            prefix = ((format & 0x40) ? 1 : 0) + ((format & 0x01) ? 4 : 0);
+        } else {
+            if (format & 0xC0) {
+                continue;
+            }
+            prefix = (format & 0x20) ? 1 : 0;
+        }
+        if (body_size <= prefix + 1) {
+            continue;
+        }
+        body += prefix;
+        body_size -= prefix;
+
+        if (memcmp(frame, "TIT2", 4) == 0 && tag->title.empty()) {
+            tag->title = Id3DecodeText(body[0], body + 1, body_size - 1);
+        } else if (memcmp(frame, "TPE1", 4) == 0 && tag->artist.empty()) {
+            tag->artist = Id3DecodeText(body[0], body + 1, body_size - 1);
+        } else if (memcmp(frame, "APIC", 4) == 0 && picture_type != ID3_PICTURE_FRONT_COVER) {
+            const uint8_t* picture;
+            size_t picture_size;
+            int type;
+            if (ParsePicture(body, body_size, &picture, &picture_size, &type) &&
+                (tag->picture == nullptr || type == ID3_PICTURE_FRONT_COVER)) {
+                tag->picture = picture;
+                tag->picture_size = picture_size;
+                picture_type = type;
+            }
+        }
+    }
+    return !tag->title.empty() || !tag->artist.empty() || tag->picture != nullptr;
+}
@@ -0,0 +1,21 @@
+#ifndef ID3_TAG_H
+#define ID3_TAG_H
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+struct Id3Tag {
+    std::string title;
+    std::string artist;
+    // 指向标签数据中的 JPEG 封面，没有时为空
+    const uint8_t* picture = nullptr;
+    size_t picture_size = 0;
+};
+
+// 解析内存中的完整 ID3v2.3 / v2.4 标签，只取歌名、歌手和封面（优先 front cover）
+bool Id3ParseTag(const uint8_t* data, size_t size, Id3Tag* tag);
+// ID3v2 文本帧内容转 UTF-8，encoding 为帧的第一个字节
+std::string Id3DecodeText(uint8_t encoding, const uint8_t* data, size_t size);
+
+#endif // ID3_TAG_H
@@ -0,0 +1,196 @@
+#include "jpeg_encoder.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <img_converters.h>
+#include <soc/soc_caps.h>
+#include <algorithm>
+#include <cstdlib>
+
+#if SOC_JPEG_ENCODE_SUPPORTED
+#include <driver/jpeg_encode.h>
+#elif CONFIG_IDF_TARGET_ESP32S3
+#include <esp_jpeg_enc.h>
+#endif
+
+#define TAG "JpegEncoder"
+
+// 整块输出的后端按这个大小分段回调
+#define JPEG_OUTPUT_CHUNK_SIZE 4096
+
+static void EmitChunks(const uint8_t* data, size_t len, const JpegEncoder::OutputCallback& callback) {
+    for (size_t offset = 0; offset < len; offset += JPEG_OUTPUT_CHUNK_SIZE) {
+        callback(data + offset, std::min<size_t>(JPEG_OUTPUT_CHUNK_SIZE, len - offset));
+    }
+}
+
+class SoftwareJpegEncoder : public JpegEncoder {
+public:
+    const char* name() const override { return "software"; }
+
+    bool Encode(const uint8_t* rgb565, int width, int height, int quality, const OutputCallback& callback) override {
+        return fmt2jpg_cb(const_cast<uint8_t*>(rgb565), width * height * 2, width, height, PIXFORMAT_RGB565, quality,
+            [](void* arg, size_t index, const void* data, size_t len) -> size_t {
+                // 结束时会以 nullptr 调用一次
+                if (data != nullptr && len > 0) {
+                    (*static_cast<const OutputCallback*>(arg))(static_cast<const uint8_t*>(data), len);
+                }
+                return len;
+            }, const_cast<OutputCallback*>(&callback));
+    }
+};
+
+#if SOC_JPEG_ENCODE_SUPPORTED
+class HardwareJpegEncoder : public JpegEncoder {
+private:
+    jpeg_encoder_handle_t engine_ = nullptr;
+
+public:
+    ~HardwareJpegEncoder() {
+        if (engine_ != nullptr) {
+            jpeg_del_encoder_engine(engine_);
+        }
+    }
+
+    bool Initialize() {
+        jpeg_encode_engine_cfg_t engine_config = {
+            .intr_priority = 0,
+            .timeout_ms = 1000,
+        };
+        esp_err_t err = jpeg_new_encoder_engine(&engine_config, &engine_);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to create JPEG encoder engine: %s", esp_err_to_name(err));
+            engine_ = nullptr;
+            return false;
+        }
+        return true;
+    }
+
+    const char* name() const override { return "hardware"; }
+
+    bool Encode(const uint8_t* rgb565, int width, int height, int quality, const OutputCallback& callback) override {
+        size_t input_size = width * height * 2;
+        size_t input_capacity = 0, output_capacity = 0;
+        jpeg_encode_memory_alloc_cfg_t input_config = { .buffer_direction = JPEG_ENC_ALLOC_INPUT_BUFFER };
+        jpeg_encode_memory_alloc_cfg_t output_config = { .buffer_direction = JPEG_ENC_ALLOC_OUTPUT_BUFFER };
+        auto input = (uint8_t*)jpeg_alloc_encoder_mem(input_size, &input_config, &input_capacity);
+        auto output = (uint8_t*)jpeg_alloc_encoder_mem(width * height, &output_config, &output_capacity);
+        if (input == nullptr || output == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate JPEG encoder buffers");
+            free(input);
+            free(output);
+            return false;
+        }
+
+        // DMA 需要对齐的缓冲区，拷贝时顺便把摄像头的大端 RGB565 转成小端
+        auto src = (const uint16_t*)rgb565;
+        auto dst = (uint16_t*)input;
+        for (size_t i = 0; i < input_size / 2; i++) {
+            dst[i] = __builtin_bswap16(src[i]);
+        }
+
+        jpeg_encode_cfg_t encode_config = {
+            .height = (uint32_t)height,
+            .width = (uint32_t)width,
+            .src_type = JPEG_ENCODE_IN_FORMAT_RGB565,
+            .sub_sample = JPEG_DOWN_SAMPLING_YUV420,
+            .image_quality = (uint32_t)quality,
+        };
+        uint32_t output_size = 0;
+        esp_err_t err = jpeg_encoder_process(engine_, &encode_config, input, input_size, output, output_capacity, &output_size);
+        if (err == ESP_OK) {
+            EmitChunks(output, output_size, callback);
+        } else {
+            ESP_LOGE(TAG, "JPEG encode failed: %s", esp_err_to_name(err));
+        }
+        free(input);
+        free(output);
+        return err == ESP_OK;
+    }
+};
+#elif CONFIG_IDF_TARGET_ESP32S3
+class SimdJpegEncoder : public JpegEncoder {
+private:
+    // JFIF 的 BT.601 全范围转换，两个像素共用一组平均后的色度
+    static void ConvertToYuv422(const uint8_t* rgb565, uint8_t* yuv, size_t pixel_count) {
+        for (size_t i = 0; i + 1 < pixel_count; i += 2) {
+            int r[2], g[2], b[2];
+            for (int j = 0; j < 2; j++) {
+                uint16_t pixel = (rgb565[0] << 8) | rgb565[1];
+                rgb565 += 2;
+                r[j] = ((pixel >> 8) & 0xF8) | (pixel >> 13);
+                g[j] = ((pixel >> 3) & 0xFC) | ((pixel >> 9) & 0x03);
+                b[j] = ((pixel << 3) & 0xF8) | ((pixel >> 2) & 0x07);
+            }
+            int r_avg = (r[0] + r[1]) >> 1;
+            int g_avg = (g[0] + g[1]) >> 1;
+            int b_avg = (b[0] + b[1]) >> 1;
+            int cb = ((-43 * r_avg - 85 * g_avg + 128 * b_avg + 128) >> 8) + 128;
+            int cr = ((128 * r_avg - 107 * g_avg - 21 * b_avg + 128) >> 8) + 128;
+            yuv[0] = (77 * r[0] + 150 * g[0] + 29 * b[0] + 128) >> 8;
+            yuv[1] = std::clamp(cb, 0, 255);
+            yuv[2] = (77 * r[1] + 150 * g[1] + 29 * b[1] + 128) >> 8;
+            yuv[3] = std::clamp(cr, 0, 255);
+            yuv += 4;
+        }
+    }
+
+public:
+    const char* name() const override { return "simd"; }
+
+    bool Encode(const uint8_t* rgb565, int width, int height, int quality, const OutputCallback& callback) override {
+        // esp_jpeg_simd 不支持 RGB565 输入，先转成 YCbYCr
+        size_t yuv_size = width * height * 2;
+        size_t output_capacity = width * height;
+        auto yuv = (uint8_t*)heap_caps_aligned_alloc(16, yuv_size, MALLOC_CAP_SPIRAM);
+        auto output = (uint8_t*)heap_caps_malloc(output_capacity, MALLOC_CAP_SPIRAM);
+        if (yuv == nullptr || output == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate JPEG encoder buffers");
+            heap_caps_free(yuv);
+            heap_caps_free(output);
+            return false;
+        }
+        ConvertToYuv422(rgb565, yuv, width * height);
+
+        jpeg_enc_info_t info = DEFAULT_JPEG_ENC_CONFIG();
+        info.width = width;
+        info.height = height;
+        info.src_type = JPEG_RAW_TYPE_YCbYCr;
+        info.subsampling = JPEG_SUB_SAMPLE_YUV420;
+        info.quality = quality;
+        void* encoder = jpeg_enc_open(&info);
+        bool success = false;
+        if (encoder == nullptr) {
+            ESP_LOGE(TAG, "Failed to open JPEG encoder");
+        } else {
+            int output_size = 0;
+            jpeg_error_t err = jpeg_enc_process(encoder, yuv, yuv_size, output, output_capacity, &output_size);
+            jpeg_enc_close(encoder);
+            if (err == JPEG_ERR_OK) {
+                EmitChunks(output, output_size, callback);
+                success = true;
+            } else {
+                ESP_LOGE(TAG, "JPEG encode failed: %d", err);
+            }
+        }
+        heap_caps_free(yuv);
+        heap_caps_free(output);
+        return success;
+    }
+};
+#endif
+
+std::unique_ptr<JpegEncoder> JpegEncoder::Create() {
+#if SOC_JPEG_ENCODE_SUPPORTED
+    auto hardware = std::make_unique<HardwareJpegEncoder>();
+    if (hardware->Initialize()) {
+        return hardware;
+    }
+    ESP_LOGW(TAG, "Hardware JPEG encoder unavailable, using software encoder");
+#elif CONFIG_IDF_TARGET_ESP32S3
+    if (heap_caps_get_total_size(MALLOC_CAP_SPIRAM) > 0) {
+        return std::make_unique<SimdJpegEncoder>();
+    }
+#endif
+    return std::make_unique<SoftwareJpegEncoder>();
+}
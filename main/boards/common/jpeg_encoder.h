@@ -0,0 +1,29 @@
+#ifndef JPEG_ENCODER_H
+#define JPEG_ENCODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+/*
+ * JPEG encoder backend for camera uploads.
+ *
+ * Create() picks the hardware JPEG codec on targets that have one (P4), the esp_jpeg_simd encoder on
+ * S3 and the esp32-camera software encoder everywhere else, falling back to software if a backend
+ * cannot be set up. Input is the big-endian RGB565 frame produced by esp32-camera. The output callback
+ * may be called any number of times with consecutive pieces of the JPEG file.
+ */
+class JpegEncoder {
+public:
+    using OutputCallback = std::function<void(const uint8_t* data, size_t len)>;
+
+    virtual ~JpegEncoder() = default;
+
+    virtual const char* name() const = 0;
+    virtual bool Encode(const uint8_t* rgb565, int width, int height, int quality, const OutputCallback& callback) = 0;
+
+    static std::unique_ptr<JpegEncoder> Create();
+};
+
+#endif // JPEG_ENCODER_H
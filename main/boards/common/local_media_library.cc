@@ -0,0 +1,633 @@
+#include "local_media_library.h"
+#include "id3_tag.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+
+#define TAG "LocalMedia"
+
+#define LOCAL_MEDIA_INDEX_NAME "/.media_index.bin"
+#define LOCAL_MEDIA_INDEX_MAGIC 0x58444D4C  // "LMDX"
+#define LOCAL_MEDIA_INDEX_VERSION 1
+#define LOCAL_MEDIA_MAX_DEPTH 4
+// SD 卡顺序读，一次读满环形缓冲区的一大块
+#define LOCAL_MEDIA_READ_SIZE (32 * 1024)
+// 在标签后面这个范围内找第一帧
+#define LOCAL_MEDIA_PROBE_SIZE 4096
+#define LOCAL_MEDIA_OGG_TAIL_SIZE (16 * 1024)
+#define LOCAL_MEDIA_TAG_TEXT_MAX 256
+
+#ifdef CONFIG_LOCAL_MEDIA_LIBRARY
+#define LOCAL_MEDIA_MAX_SONGS CONFIG_LOCAL_MEDIA_MAX_SONGS
+#else
+#define LOCAL_MEDIA_MAX_SONGS 0
+#endif
+
+struct LocalMediaIndexHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+};
+
+struct LocalMediaIndexRecord {
+    uint32_t size;
+    uint32_t mtime;
+    uint32_t data_offset;
+    uint32_t duration_s;
+    uint16_t path_length;
+    uint8_t title_length;
+    uint8_t artist_length;
+};
+
+// 从第一帧音频开始顺序读取，length() 和 OpenAt() 的位置都不含跳过的标签
+class LocalFileSource : public StreamSource {
+public:
+    LocalFileSource(const std::string& path, uint32_t data_offset) : path_(path), data_offset_(data_offset) {}
+    ~LocalFileSource() { Close(); }
+
+    int Open() override {
+        return OpenAt(0) == 206 ? 200 : 0;
+    }
+
+    int OpenAt(size_t offset) override {
+        if (file_ == nullptr) {
+            file_ = fopen(path_.c_str(), "rb");
+            if (file_ == nullptr) {
+                ESP_LOGE(TAG, "Failed to open %s", path_.c_str());
+                return 0;
+            }
+            // 大块读取直接写进环形缓冲区，不经过 stdio 缓冲
+            setvbuf(file_, nullptr, _IONBF, 0);
+            struct stat st;
+            size_t size = fstat(fileno(file_), &st) == 0 ? st.st_size : 0;
+            length_ = size > data_offset_ ? size - data_offset_ : 0;
+            ESP_LOGI(TAG, "Playing local file: %s, %u bytes", path_.c_str(), (unsigned int)length_);
+        }
+        if (offset > length_) {
+            return 416;
+        }
+        if (fseek(file_, data_offset_ + offset, SEEK_SET) != 0) {
+            return 0;
+        }
+        return 206;
+    }
+
+    int Read(uint8_t* buffer, size_t size) override {
+        if (file_ == nullptr) {
+            return -1;
+        }
+        size_t n = fread(buffer, 1, size, file_);
+        if (n == 0 && ferror(file_)) {
+            return -1;
+        }
+        return n;
+    }
+
+    void Close() override {
+        if (file_ != nullptr) {
+            fclose(file_);
+            file_ = nullptr;
+        }
+    }
+
+    size_t length() const override { return length_; }
+    size_t read_size() const override { return LOCAL_MEDIA_READ_SIZE; }
+
+private:
+    std::string path_;
+    uint32_t data_offset_;
+    size_t length_ = 0;
+    FILE* file_ = nullptr;
+};
+
+static uint32_t ReadBe32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint32_t ReadSyncsafe32(const uint8_t* p) {
+    return ((uint32_t)(p[0] & 0x7F) << 21) | ((uint32_t)(p[1] & 0x7F) << 14) | ((uint32_t)(p[2] & 0x7F) << 7) | (p[3] & 0x7F);
+}
+
+static uint32_t ReadLe32(const uint8_t* p) {
+    return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void TrimText(std::string* text) {
+    while (!text->empty() && ((unsigned char)text->back() <= ' ')) {
+        text->pop_back();
+    }
+    size_t start = 0;
+    while (start < text->size() && (unsigned char)(*text)[start] <= ' ') {
+        start++;
+    }
+    text->erase(0, start);
+}
+
+// 截断到 max_size 字节以内，不拆开 UTF-8 字符
+static void TruncateUtf8(std::string* text, size_t max_size) {
+    if (text->size() <= max_size) {
+        return;
+    }
+    size_t size = max_size;
+    while (size > 0 && ((unsigned char)(*text)[size] & 0xC0) == 0x80) {
+        size--;
+    }
+    text->resize(size);
+}
+
+// 读取 v2.3 / v2.4 标签里的歌名和歌手，返回整个标签的长度，没有标签返回 0
+static size_t ReadId3v2(FILE* file, std::string* title, std::string* artist) {
+    uint8_t header[10];
+    if (fseek(file, 0, SEEK_SET) != 0 || fread(header, 1, sizeof(header), file) != sizeof(header) ||
+        memcmp(header, "ID3", 3) != 0) {
+        return 0;
+    }
+    int major = header[3];
+    uint8_t flags = header[5];
+    size_t tag_end = 10 + ReadSyncsafe32(header + 6);
+    size_t total = tag_end + ((flags & 0x10) ? 10 : 0);
+    // v2.2 和整体 unsynchronisation 的标签只跳过，不解析
+    if (major < 3 || major > 4 || (flags & 0x80)) {
+        return total;
+    }
+
+    size_t pos = 10;
+    if (flags & 0x40) {
+        uint8_t size[4];
+        if (fread(size, 1, sizeof(size), file) != sizeof(size)) {
+            return total;
+        }
+        // v2.3 的扩展头长度不含自身的 4 字节
+        pos += major == 4 ? ReadSyncsafe32(size) : ReadBe32(size) + 4;
+    }
+    while (pos + 10 <= tag_end && (title->empty() || artist->empty())) {
+        uint8_t frame[10];
+        if (fseek(file, pos, SEEK_SET) != 0 || fread(frame, 1, sizeof(frame), file) != sizeof(frame) || frame[0] == 0) {
+            break;  // 填充区
+        }
+        size_t size = major == 4 ? ReadSyncsafe32(frame + 4) : ReadBe32(frame + 4);
+        pos += 10;
+        if (size == 0 || pos + size > tag_end) {
+            break;
+        }
+        bool is_title = memcmp(frame, "TIT2", 4) == 0;
+        bool is_artist = memcmp(frame, "TPE1", 4) == 0;
+        if ((is_title || is_artist) && size > 1) {
+            uint8_t text[LOCAL_MEDIA_TAG_TEXT_MAX];
+            size_t n = fread(text, 1, std::min(size, sizeof(text)), file);
+            if (n > 1) {
+                *(is_title ? title : artist) = Id3DecodeText(text[0], text + 1, n - 1);
+            }
+        }
+        pos += size;
+    }
+    return total;
+}
+
+// ID3v1 的文本没有声明编码，只采用纯 ASCII 的字段
+static void ReadId3v1Field(const uint8_t* data, size_t size, std::string* field) {
+    if (!field->empty()) {
+        return;
+    }
+    std::string text;
+    for (size_t i = 0; i < size && data[i] != 0; i++) {
+        if (data[i] >= 0x80) {
+            return;
+        }
+        text.push_back(data[i]);
+    }
+    TrimText(&text);
+    *field = text;
+}
+
+struct Mp3FrameHeader {
+    int bitrate_kbps;
+    int sample_rate;
+    int samples;            // 每帧样本数
+    int side_info_size;
+};
+
+// 只识别 Layer III，其他层 helix 也解不了
+static bool ParseMp3FrameHeader(const uint8_t* p, Mp3FrameHeader* header) {
+    static const int kBitratesV1[] = {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320};
+    static const int kBitratesV2[] = {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160};
+    static const int kSampleRates[] = {44100, 48000, 32000};
+
+    if (p[0] != 0xFF || (p[1] & 0xE0) != 0xE0) {
+        return false;
+    }
+    int version = (p[1] >> 3) & 3;      // 0: MPEG2.5, 1: 保留, 2: MPEG2, 3: MPEG1
+    int layer = (p[1] >> 1) & 3;        // 1: Layer III
+    int bitrate_index = p[2] >> 4;
+    int rate_index = (p[2] >> 2) & 3;
+    if (version == 1 || layer != 1 || bitrate_index == 0 || bitrate_index == 15 || rate_index == 3) {
+        return false;
+    }
+    bool mpeg1 = version == 3;
+    bool mono = (p[3] >> 6) == 3;
+    header->bitrate_kbps = (mpeg1 ? kBitratesV1 : kBitratesV2)[bitrate_index];
+    header->sample_rate = kSampleRates[rate_index] >> (mpeg1 ? 0 : version == 2 ? 1 : 2);
+    header->samples = mpeg1 ? 1152 : 576;
+    header->side_info_size = mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17);
+    return true;
+}
+
+// 找到标签后的第一帧，时长取 Xing/Info 或 VBRI 头里的帧数，没有时按 CBR 估算
+static bool ReadMp3Info(FILE* file, size_t tag_size, size_t audio_end, uint32_t* data_offset, uint32_t* duration_s) {
+    std::vector<uint8_t> probe(LOCAL_MEDIA_PROBE_SIZE);
+    if (fseek(file, tag_size, SEEK_SET) != 0) {
+        return false;
+    }
+    size_t n = fread(probe.data(), 1, probe.size(), file);
+    for (size_t i = 0; i + 4 <= n; i++) {
+        Mp3FrameHeader header;
+        if (!ParseMp3FrameHeader(&probe[i], &header)) {
+            continue;
+        }
+        *data_offset = tag_size + i;
+        uint64_t frames = 0;
+        size_t xing = i + 4 + header.side_info_size;
+        size_t vbri = i + 4 + 32;
+        if (xing + 12 <= n && (memcmp(&probe[xing], "Xing", 4) == 0 || memcmp(&probe[xing], "Info", 4) == 0) &&
+            (ReadBe32(&probe[xing + 4]) & 1)) {
+            frames = ReadBe32(&probe[xing + 8]);
+        } else if (vbri + 18 <= n && memcmp(&probe[vbri], "VBRI", 4) == 0) {
+            frames = ReadBe32(&probe[vbri + 14]);
+        }
+        if (frames > 0) {
+            *duration_s = frames * header.samples / header.sample_rate;
+        } else if (audio_end > *data_offset) {
+            *duration_s = (uint64_t)(audio_end - *data_offset) * 8 / (header.bitrate_kbps * 1000);
+        }
+        return true;
+    }
+    return false;
+}
+
+static bool ReadWavInfo(FILE* file, uint32_t* duration_s) {
+    uint8_t riff[12];
+    if (fseek(file, 0, SEEK_SET) != 0 || fread(riff, 1, sizeof(riff), file) != sizeof(riff) ||
+        memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) {
+        return false;
+    }
+    uint32_t byte_rate = 0;
+    long pos = sizeof(riff);
+    for (int i = 0; i < 16; i++) {
+        uint8_t chunk[16];
+        if (fseek(file, pos, SEEK_SET) != 0 || fread(chunk, 1, 8, file) != 8) {
+            return false;
+        }
+        uint32_t size = ReadLe32(chunk + 4);
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+            if (fread(chunk, 1, 16, file) != 16) {
+                return false;
+            }
+            byte_rate = ReadLe32(chunk + 8);
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            *duration_s = byte_rate > 0 ? size / byte_rate : 0;
+            return byte_rate > 0;
+        }
+        pos += 8 + size + (size & 1);
+    }
+    return false;
+}
+
+// 只收录 Ogg Opus，时长为最后一页的 granule position 减去 pre-skip
+static bool ReadOggOpusInfo(FILE* file, size_t file_size, uint32_t* duration_s) {
+    uint8_t head[47];
+    if (fseek(file, 0, SEEK_SET) != 0 || fread(head, 1, sizeof(head), file) != sizeof(head) ||
+        memcmp(head, "OggS", 4) != 0 || memcmp(head + 28, "OpusHead", 8) != 0) {
+        return false;
+    }
+    uint32_t pre_skip = head[38] | (head[39] << 8);
+
+    size_t tail_size = std::min<size_t>(file_size, LOCAL_MEDIA_OGG_TAIL_SIZE);
+    std::vector<uint8_t> tail(tail_size);
+    if (fseek(file, file_size - tail_size, SEEK_SET) != 0 || fread(tail.data(), 1, tail_size, file) != tail_size) {
+        return true;
+    }
+    for (size_t i = tail_size >= 14 ? tail_size - 14 : 0; i-- > 0;) {
+        if (memcmp(&tail[i], "OggS", 4) == 0) {
+            uint64_t granule = ReadLe32(&tail[i + 6]) | ((uint64_t)ReadLe32(&tail[i + 10]) << 32);
+            *duration_s = granule > pre_skip ? (granule - pre_skip) / 48000 : 0;
+            break;
+        }
+    }
+    return true;
+}
+
+// 只保留 ASCII 字母数字（转小写）和非 ASCII 字符，忽略空格和标点
+static std::string NormalizeForMatch(const std::string& text) {
+    std::string out;
+    for (unsigned char c : text) {
+        if (c >= 0x80) {
+            out.push_back(c);
+        } else if (isalnum(c)) {
+            out.push_back(tolower(c));
+        }
+    }
+    return out;
+}
+
+static std::string LowerExtension(const std::string& name) {
+    size_t dot = name.rfind('.');
+    if (dot == std::string::npos) {
+        return "";
+    }
+    std::string ext = name.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext;
+}
+
+bool LocalMediaLibrary::IsLocalUrl(const std::string& url) {
+    return url.compare(0, strlen(LOCAL_MEDIA_URL_PREFIX), LOCAL_MEDIA_URL_PREFIX) == 0;
+}
+
+bool LocalMediaLibrary::ReadEntry(const std::string& path, Entry* entry) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    std::string ext = LowerExtension(path);
+    bool ok = false;
+    if (ext == "mp3") {
+        size_t tag_size = ReadId3v2(file, &entry->title, &entry->artist);
+        size_t audio_end = entry->size;
+        uint8_t v1[128];
+        if (entry->size >= sizeof(v1) && fseek(file, entry->size - sizeof(v1), SEEK_SET) == 0 &&
+            fread(v1, 1, sizeof(v1), file) == sizeof(v1) && memcmp(v1, "TAG", 3) == 0) {
+            audio_end -= sizeof(v1);
+            ReadId3v1Field(v1 + 3, 30, &entry->title);
+            ReadId3v1Field(v1 + 33, 30, &entry->artist);
+        }
+        ok = ReadMp3Info(file, tag_size, audio_end, &entry->data_offset, &entry->duration_s);
+    } else if (ext == "wav") {
+        ok = ReadWavInfo(file, &entry->duration_s);
+    } else if (ext == "ogg" || ext == "opus") {
+        ok = ReadOggOpusInfo(file, entry->size, &entry->duration_s);
+    }
+    fclose(file);
+    if (!ok) {
+        ESP_LOGW(TAG, "Skipping unsupported file: %s", path.c_str());
+        return false;
+    }
+
+    // 没有标签时用文件名，"歌手 - 歌名" 的形式拆开
+    if (entry->title.empty()) {
+        size_t slash = entry->path.rfind('/');
+        std::string name = entry->path.substr(slash == std::string::npos ? 0 : slash + 1);
+        name = name.substr(0, name.rfind('.'));
+        size_t dash = name.find(" - ");
+        if (dash != std::string::npos) {
+            if (entry->artist.empty()) {
+                entry->artist = name.substr(0, dash);
+            }
+            name = name.substr(dash + 3);
+        }
+        entry->title = name;
+        TrimText(&entry->title);
+        TrimText(&entry->artist);
+    }
+    TruncateUtf8(&entry->title, UINT8_MAX);
+    TruncateUtf8(&entry->artist, UINT8_MAX);
+    return true;
+}
+
+void LocalMediaLibrary::ScanDirLocked(const std::string& relative_dir, int depth, std::vector<Entry>& previous, bool* changed) {
+    std::string dir_path = relative_dir.empty() ? base_path_ : base_path_ + "/" + relative_dir;
+    DIR* dir = opendir(dir_path.c_str());
+    if (dir == nullptr) {
+        return;
+    }
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != nullptr) {
+        // 隐藏文件、系统目录和索引文件
+        if (ent->d_name[0] == '.') {
+            continue;
+        }
+        std::string relative = relative_dir.empty() ? ent->d_name : relative_dir + "/" + ent->d_name;
+        if (ent->d_type == DT_DIR) {
+            if (depth < LOCAL_MEDIA_MAX_DEPTH) {
+                ScanDirLocked(relative, depth + 1, previous, changed);
+            }
+            continue;
+        }
+        std::string ext = LowerExtension(ent->d_name);
+        if (ext != "mp3" && ext != "wav" && ext != "ogg" && ext != "opus") {
+            continue;
+        }
+        if (entries_.size() >= LOCAL_MEDIA_MAX_SONGS || relative.size() > UINT16_MAX) {
+            continue;
+        }
+        struct stat st;
+        std::string path = base_path_ + "/" + relative;
+        if (stat(path.c_str(), &st) != 0) {
+            continue;
+        }
+
+        // 大小和修改时间都没变的直接用索引里的信息
+        auto it = std::lower_bound(previous.begin(), previous.end(), relative, [](const Entry& entry, const std::string& key) {
+            return entry.path < key;
+        });
+        if (it != previous.end() && it->path == relative && it->size == (uint32_t)st.st_size &&
+            it->mtime == (uint32_t)st.st_mtime) {
+            entries_.push_back(*it);
+            continue;
+        }
+        Entry entry;
+        entry.path = relative;
+        entry.size = st.st_size;
+        entry.mtime = st.st_mtime;
+        *changed = true;
+        if (ReadEntry(path, &entry)) {
+            entries_.push_back(std::move(entry));
+        }
+    }
+    closedir(dir);
+}
+
+void LocalMediaLibrary::LoadIndexLocked(std::vector<Entry>* entries) {
+    entries->clear();
+    FILE* file = fopen((base_path_ + LOCAL_MEDIA_INDEX_NAME).c_str(), "rb");
+    if (file == nullptr) {
+        return;
+    }
+    LocalMediaIndexHeader header;
+    if (fread(&header, sizeof(header), 1, file) == 1 && header.magic == LOCAL_MEDIA_INDEX_MAGIC &&
+        header.version == LOCAL_MEDIA_INDEX_VERSION) {
+        entries->reserve(header.count);
+        for (int i = 0; i < header.count; i++) {
+            LocalMediaIndexRecord record;
+            if (fread(&record, sizeof(record), 1, file) != 1) {
+                break;
+            }
+            Entry entry;
+            entry.size = record.size;
+            entry.mtime = record.mtime;
+            entry.data_offset = record.data_offset;
+            entry.duration_s = record.duration_s;
+            entry.path.resize(record.path_length);
+            entry.title.resize(record.title_length);
+            entry.artist.resize(record.artist_length);
+            if (fread(entry.path.data(), 1, record.path_length, file) != record.path_length ||
+                fread(entry.title.data(), 1, record.title_length, file) != record.title_length ||
+                fread(entry.artist.data(), 1, record.artist_length, file) != record.artist_length) {
+                break;
+            }
+            entries->push_back(std::move(entry));
+        }
+        if (entries->size() != header.count) {
+            ESP_LOGW(TAG, "Index truncated, rescanning all files");
+            entries->clear();
+        }
+    }
+    fclose(file);
+}
+
+void LocalMediaLibrary::SaveIndexLocked() {
+    std::string index_path = base_path_ + LOCAL_MEDIA_INDEX_NAME;
+    FILE* file = fopen(index_path.c_str(), "wb");
+    if (file == nullptr) {
+        ESP_LOGE(TAG, "Failed to write %s", index_path.c_str());
+        return;
+    }
+    LocalMediaIndexHeader header = {LOCAL_MEDIA_INDEX_MAGIC, LOCAL_MEDIA_INDEX_VERSION, (uint16_t)entries_.size()};
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (const auto& entry : entries_) {
+        if (!ok) {
+            break;
+        }
+        LocalMediaIndexRecord record = {
+            entry.size, entry.mtime, entry.data_offset, entry.duration_s,
+            (uint16_t)entry.path.size(), (uint8_t)entry.title.size(), (uint8_t)entry.artist.size(),
+        };
+        ok = fwrite(&record, sizeof(record), 1, file) == 1 &&
+            fwrite(entry.path.data(), 1, entry.path.size(), file) == entry.path.size() &&
+            fwrite(entry.title.data(), 1, entry.title.size(), file) == entry.title.size() &&
+            fwrite(entry.artist.data(), 1, entry.artist.size(), file) == entry.artist.size();
+    }
+    fclose(file);
+    if (!ok) {
+        // 写了一半的索引下次加载时会被丢弃，这里直接删掉
+        ESP_LOGE(TAG, "Failed to write %s", index_path.c_str());
+        remove(index_path.c_str());
+    }
+}
+
+bool LocalMediaLibrary::EnsureScannedLocked() {
+#ifdef CONFIG_LOCAL_MEDIA_LIBRARY
+    if (scanned_) {
+        return !entries_.empty();
+    }
+    base_path_ = CONFIG_LOCAL_MEDIA_PATH;
+    struct stat st;
+    if (stat(base_path_.c_str(), &st) != 0) {
+        // 卡可能稍后才插入，下次查找时再试
+        ESP_LOGW(TAG, "Media path %s is not mounted", base_path_.c_str());
+        return false;
+    }
+    scanned_ = true;
+
+    int64_t start_us = esp_timer_get_time();
+    std::vector<Entry> previous;
+    LoadIndexLocked(&previous);
+    std::sort(previous.begin(), previous.end(), [](const Entry& a, const Entry& b) {
+        return a.path < b.path;
+    });
+    entries_.clear();
+    bool changed = false;
+    ScanDirLocked("", 0, previous, &changed);
+    // 有文件被删除时条目数会变少
+    if (changed || entries_.size() != previous.size()) {
+        SaveIndexLocked();
+    }
+    ESP_LOGI(TAG, "%u songs in %s, %u indexed before, scan took %d ms", (unsigned int)entries_.size(),
+             base_path_.c_str(), (unsigned int)previous.size(), (int)((esp_timer_get_time() - start_us) / 1000));
+    return !entries_.empty();
+#else
+    return false;
+#endif
+}
+
+const LocalMediaLibrary::Entry* LocalMediaLibrary::FindEntryLocked(const std::string& path) const {
+    for (const auto& entry : entries_) {
+        if (entry.path == path) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+bool LocalMediaLibrary::Find(const std::string& song_name, const std::string& artist_name, LocalSong* song) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!EnsureScannedLocked()) {
+        return false;
+    }
+    std::string name = NormalizeForMatch(song_name);
+    std::string artist = NormalizeForMatch(artist_name);
+    if (name.empty()) {
+        return false;
+    }
+
+    // 歌名完全相同 > 互相包含 > 只在路径里出现；指定了歌手时歌手也要对上
+    const Entry* best = nullptr;
+    int best_score = 0;
+    for (const auto& entry : entries_) {
+        std::string title = NormalizeForMatch(entry.title);
+        std::string path = NormalizeForMatch(entry.path);
+        int score = 0;
+        if (title == name) {
+            score = 3;
+        } else if (!title.empty() && (title.find(name) != std::string::npos ||
+                   (title.size() >= 4 && name.find(title) != std::string::npos))) {
+            score = 2;
+        } else if (path.find(name) != std::string::npos) {
+            score = 1;
+        }
+        if (score <= best_score) {
+            continue;
+        }
+        if (!artist.empty()) {
+            std::string entry_artist = NormalizeForMatch(entry.artist);
+            bool artist_match = entry_artist.empty() ? path.find(artist) != std::string::npos :
+                entry_artist.find(artist) != std::string::npos || artist.find(entry_artist) != std::string::npos;
+            if (!artist_match) {
+                continue;
+            }
+        }
+        best = &entry;
+        best_score = score;
+    }
+    if (best == nullptr) {
+        return false;
+    }
+    song->path = base_path_ + "/" + best->path;
+    song->title = best->title;
+    song->artist = best->artist;
+    song->duration_s = best->duration_s;
+    return true;
+}
+
+std::unique_ptr<StreamSource> LocalMediaLibrary::Open(const std::string& url) {
+    if (!IsLocalUrl(url)) {
+        return nullptr;
+    }
+    std::string path = url.substr(strlen(LOCAL_MEDIA_URL_PREFIX));
+    uint32_t data_offset = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (path.compare(0, base_path_.size() + 1, base_path_ + "/") == 0) {
+            auto entry = FindEntryLocked(path.substr(base_path_.size() + 1));
+            if (entry != nullptr) {
+                data_offset = entry->data_offset;
+            }
+        }
+    }
+    // 文件打不开时由 Open() 返回 0，按打开失败处理
+    return std::make_unique<LocalFileSource>(path, data_offset);
+}
@@ -0,0 +1,73 @@
+#ifndef LOCAL_MEDIA_LIBRARY_H
+#define LOCAL_MEDIA_LIBRARY_H
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+#include "stream_player.h"
+
+// 播放列表中本地歌曲的地址前缀
+#define LOCAL_MEDIA_URL_PREFIX "file://"
+
+struct LocalSong {
+    std::string path;
+    std::string title;
+    std::string artist;
+    int duration_s = 0;     // 0: 无法估算
+};
+
+/*
+ * Songs on an SD card mounted by the board at CONFIG_LOCAL_MEDIA_PATH, searched before the online lookup.
+ *
+ * The first search walks the directory tree once and reads the title and artist (ID3v2, ID3v1, or
+ * "Artist - Title" from the file name), the offset of the first MP3 frame and the duration of every
+ * MP3 / WAV / Ogg Opus file, and keeps them in a compact index file on the card. Later boots only stat
+ * the files and re-read those whose size or mtime changed. Playback starts at the first audio frame, so
+ * an ID3 tag with a large cover image is never read, and reads the card in large sequential blocks.
+ */
+class LocalMediaLibrary {
+public:
+    static LocalMediaLibrary& GetInstance() {
+        static LocalMediaLibrary instance;
+        return instance;
+    }
+    LocalMediaLibrary(const LocalMediaLibrary&) = delete;
+    LocalMediaLibrary& operator=(const LocalMediaLibrary&) = delete;
+
+    // 按歌名（和歌手）查找，没有启用、没有挂载或找不到时返回 false
+    bool Find(const std::string& song_name, const std::string& artist_name, LocalSong* song);
+    // 打开 LOCAL_MEDIA_URL_PREFIX 开头的地址，其他地址返回空
+    std::unique_ptr<StreamSource> Open(const std::string& url);
+
+    static bool IsLocalUrl(const std::string& url);
+
+private:
+    struct Entry {
+        std::string path;       // 相对 CONFIG_LOCAL_MEDIA_PATH
+        std::string title;
+        std::string artist;
+        uint32_t size = 0;
+        uint32_t mtime = 0;
+        uint32_t data_offset = 0;   // 第一帧音频的位置
+        uint32_t duration_s = 0;
+    };
+
+    LocalMediaLibrary() = default;
+
+    bool EnsureScannedLocked();
+    void ScanDirLocked(const std::string& relative_dir, int depth, std::vector<Entry>& previous, bool* changed);
+    bool ReadEntry(const std::string& path, Entry* entry);
+    void LoadIndexLocked(std::vector<Entry>* entries);
+    void SaveIndexLocked();
+    const Entry* FindEntryLocked(const std::string& path) const;
+
+    std::mutex mutex_;
+    bool scanned_ = false;
+    std::string base_path_;
+    std::vector<Entry> entries_;
+};
+
+#endif // LOCAL_MEDIA_LIBRARY_H
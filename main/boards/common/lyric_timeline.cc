@@ -0,0 +1,164 @@
+#include "lyric_timeline.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <algorithm>
+#include <cstring>
+
+#define TAG "LyricTimeline"
+
+static void* AllocateLyricBlock(size_t size) {
+    void* block = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (block == nullptr) {
+        block = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+    }
+    return block;
+}
+
+LyricTimeline::~LyricTimeline() {
+    heap_caps_free(lines_);
+    heap_caps_free(pool_);
+}
+
+int LyricTimeline::Find(int64_t time_ms) const {
+    auto next = std::upper_bound(lines_, lines_ + count_, time_ms,
+        [](int64_t time_ms, const Line& line) { return time_ms < line.time_ms; });
+    return (int)(next - lines_) - 1;
+}
+
+void LrcParser::Feed(const char* data, size_t size) {
+    while (size > 0) {
+        auto newline = (const char*)memchr(data, '\n', size);
+        if (newline == nullptr) {
+            partial_.append(data, size);
+            return;
+        }
+        size_t length = newline - data;
+        if (partial_.empty()) {
+            ParseLine(data, length);
+        } else {
+            partial_.append(data, length);
+            ParseLine(partial_.data(), partial_.size());
+            partial_.clear();
+        }
+        data += length + 1;
+        size -= length + 1;
+    }
+}
+
+void LrcParser::Finish() {
+    // 最后一行可能没有换行符
+    if (!partial_.empty()) {
+        std::string line;
+        line.swap(partial_);
+        ParseLine(line.data(), line.size());
+    }
+}
+
+std::shared_ptr<const LyricTimeline> LrcParser::Build() const {
+    std::shared_ptr<LyricTimeline> timeline(new LyricTimeline());
+    if (lines_.empty()) {
+        return timeline;
+    }
+    auto lines = (LyricTimeline::Line*)AllocateLyricBlock(lines_.size() * sizeof(LyricTimeline::Line));
+    auto pool = (char*)AllocateLyricBlock(pool_.size());
+    if (lines == nullptr || pool == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %u lyric lines", (unsigned int)lines_.size());
+        heap_caps_free(lines);
+        heap_caps_free(pool);
+        return timeline;
+    }
+    std::copy(lines_.begin(), lines_.end(), lines);
+    // 同一时间的歌词保持原来的顺序
+    std::stable_sort(lines, lines + lines_.size(), [](const auto& a, const auto& b) {
+        return a.time_ms < b.time_ms;
+    });
+    memcpy(pool, pool_.data(), pool_.size());
+    timeline->lines_ = lines;
+    timeline->count_ = lines_.size();
+    timeline->pool_ = pool;
+    return timeline;
+}
+
+void LrcParser::Reset() {
+    partial_.clear();
+    lines_.clear();
+    pool_.clear();
+}
+
+// 解析LRC格式: [mm:ss.xx]歌词文本
+void LrcParser::ParseLine(const char* line, size_t length) {
+    // 去除行尾的回车符
+    if (length > 0 && line[length - 1] == '\r') {
+        length--;
+    }
+
+    size_t first_line = lines_.size();
+    size_t position = 0;
+    while (position < length && line[position] == '[') {
+        auto close_bracket = (const char*)memchr(line + position, ']', length - position);
+        if (close_bracket == nullptr) {
+            break;
+        }
+        int time_ms;
+        const char* tag = line + position + 1;
+        size_t tag_length = close_bracket - tag;
+        if (!ParseTimestamp(tag, tag_length, &time_ms)) {
+            // 元数据标签，例如 [ti:标题], [ar:艺术家]，或者格式不对的时间
+            ESP_LOGD(TAG, "Skipping tag: [%.*s]", (int)tag_length, tag);
+            break;
+        }
+        lines_.push_back({time_ms, 0});
+        position = close_bracket - line + 1;
+    }
+    if (lines_.size() == first_line) {
+        return;
+    }
+
+    // 一行有多个时间戳时共用同一段文本
+    uint32_t text_offset = pool_.size();
+    pool_.append(line + position, length - position);
+    pool_.push_back('\0');
+    for (size_t i = first_line; i < lines_.size(); i++) {
+        lines_[i].text_offset = text_offset;
+    }
+}
+
+bool LrcParser::ParseTimestamp(const char* tag, size_t length, int* time_ms) {
+    auto colon = (const char*)memchr(tag, ':', length);
+    if (colon == nullptr || colon == tag) {
+        return false;
+    }
+    int minutes = 0;
+    for (const char* p = tag; p < colon; p++) {
+        if (*p < '0' || *p > '9') {
+            return false;
+        }
+        minutes = minutes * 10 + (*p - '0');
+    }
+
+    // 秒可以带 1-3 位小数，例如 12、12.5、12.50、12.500
+    const char* end = tag + length;
+    const char* p = colon + 1;
+    int seconds = 0;
+    int digits = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+        seconds = seconds * 10 + (*p - '0');
+    }
+    if (digits == 0) {
+        return false;
+    }
+    int fraction_ms = 0;
+    if (p < end && (*p == '.' || *p == ':')) {
+        int scale = 100;
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+            fraction_ms += (*p - '0') * scale;
+            scale /= 10;
+        }
+    }
+    if (p != end) {
+        return false;
+    }
+    *time_ms = minutes * 60 * 1000 + seconds * 1000 + fraction_ms;
+    return true;
+}
@@ -0,0 +1,69 @@
+#ifndef LYRIC_TIMELINE_H
+#define LYRIC_TIMELINE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Immutable lyric timeline: one block of (time, text offset) entries sorted by time and one pool of NUL
+ * terminated texts, both allocated in PSRAM when the board has it. It is replaced as a whole and read
+ * without a lock by the playback thread.
+ */
+class LyricTimeline {
+public:
+    ~LyricTimeline();
+    LyricTimeline(const LyricTimeline&) = delete;
+    LyricTimeline& operator=(const LyricTimeline&) = delete;
+
+    size_t size() const { return count_; }
+    bool empty() const { return count_ == 0; }
+    int time_ms(size_t index) const { return lines_[index].time_ms; }
+    const char* text(size_t index) const { return pool_ + lines_[index].text_offset; }
+
+    // 最后一个时间戳小于等于 time_ms 的行，比第一行还早时返回 -1
+    int Find(int64_t time_ms) const;
+
+private:
+    friend class LrcParser;
+
+    struct Line {
+        int32_t time_ms;
+        uint32_t text_offset;
+    };
+
+    LyricTimeline() = default;
+
+    Line* lines_ = nullptr;
+    size_t count_ = 0;
+    char* pool_ = nullptr;
+};
+
+/*
+ * Incremental LRC parser fed straight from the HTTP read loop, so the raw file is never held in full.
+ * Only the unfinished last line is kept between Feed() calls. Lines may carry several timestamps
+ * ("[00:12.00][01:30.50]text"), metadata tags like [ti:...] are skipped.
+ */
+class LrcParser {
+public:
+    void Feed(const char* data, size_t size);
+    // 数据结束，解析没有换行符的最后一行
+    void Finish();
+    // 当前已解析的行按时间排序后生成时间轴，下载过程中也可以调用，用于提前显示
+    std::shared_ptr<const LyricTimeline> Build() const;
+    void Reset();
+
+    size_t line_count() const { return lines_.size(); }
+
+private:
+    void ParseLine(const char* line, size_t length);
+    static bool ParseTimestamp(const char* tag, size_t length, int* time_ms);
+
+    std::string partial_;
+    std::vector<LyricTimeline::Line> lines_;
+    std::string pool_;
+};
+
+#endif // LYRIC_TIMELINE_H
@@ -0,0 +1,410 @@
+#include "mfsk_demod.h"
+#include "afsk_demod.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include "esp_log.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+namespace audio_wifi_config
+{
+    static const char *kLogTag = "AUDIO_WIFI_MFSK";
+
+    static const uint8_t kPreamble[] = {0x0, 0xF, 0x0, 0xF, 0x3, 0xC, 0x5, 0xA};
+    // 按置信度从低到高依次擦除的字节数，0 表示只用硬判决
+    static const size_t kErasureSteps[] = {0, 2, 4, 6, 8, 10, 12, 14, kMfskParityBytes};
+
+    /**
+     * Reed-Solomon decoder over GF(256), errors and erasures
+     * Polynomials are stored highest degree first, the same order as the codeword bytes
+     */
+    class ReedSolomon
+    {
+    private:
+        using Poly = std::vector<uint8_t>;
+
+        uint8_t exp_[512];
+        uint8_t log_[256];
+
+        uint8_t Mul(uint8_t a, uint8_t b) const {
+            return (a == 0 || b == 0) ? 0 : exp_[log_[a] + log_[b]];
+        }
+
+        uint8_t Div(uint8_t a, uint8_t b) const {
+            return a == 0 ? 0 : exp_[(log_[a] + 255 - log_[b]) % 255];
+        }
+
+        uint8_t Pow(uint8_t a, int power) const {
+            int e = (log_[a] * power) % 255;
+            return exp_[e < 0 ? e + 255 : e];
+        }
+
+        uint8_t Inverse(uint8_t a) const {
+            return exp_[255 - log_[a]];
+        }
+
+        Poly Scale(const Poly &p, uint8_t x) const {
+            Poly result(p.size());
+            for (size_t i = 0; i < p.size(); ++i) {
+                result[i] = Mul(p[i], x);
+            }
+            return result;
+        }
+
+        static Poly Add(const Poly &p, const Poly &q) {
+            Poly result(std::max(p.size(), q.size()), 0);
+            for (size_t i = 0; i < p.size(); ++i) {
+                result[i + result.size() - p.size()] = p[i];
+            }
+            for (size_t i = 0; i < q.size(); ++i) {
+                result[i + result.size() - q.size()] ^= q[i];
+            }
+            return result;
+        }
+
+        Poly Multiply(const Poly &p, const Poly &q) const {
+            Poly result(p.size() + q.size() - 1, 0);
+            for (size_t j = 0; j < q.size(); ++j) {
+                for (size_t i = 0; i < p.size(); ++i) {
+                    result[i + j] ^= Mul(p[i], q[j]);
+                }
+            }
+            return result;
+        }
+
+        uint8_t Evaluate(const Poly &p, uint8_t x) const {
+            uint8_t y = p.empty() ? 0 : p[0];
+            for (size_t i = 1; i < p.size(); ++i) {
+                y = Mul(y, x) ^ p[i];
+            }
+            return y;
+        }
+
+        // 擦除/错误定位多项式，positions 为系数次数
+        Poly Locator(const std::vector<int> &coefficient_positions) const {
+            Poly locator = {1};
+            for (int position : coefficient_positions) {
+                locator = Multiply(locator, Add({1}, {Pow(2, position), 0}));
+            }
+            return locator;
+        }
+
+        // Forney 算法求错误值并修正
+        void CorrectErrata(Poly &message, const Poly &syndromes, const std::vector<int> &positions) const {
+            std::vector<int> coefficient_positions;
+            for (int position : positions) {
+                coefficient_positions.push_back(static_cast<int>(message.size()) - 1 - position);
+            }
+            Poly locator = Locator(coefficient_positions);
+
+            // Omega(x) = S(x) * Lambda(x) mod x^(n + 1)
+            Poly reversed_syndromes(syndromes.rbegin(), syndromes.rend());
+            Poly product = Multiply(reversed_syndromes, locator);
+            size_t keep = locator.size();
+            Poly evaluator(product.end() - std::min(keep, product.size()), product.end());
+            std::reverse(evaluator.begin(), evaluator.end());
+
+            std::vector<uint8_t> x(coefficient_positions.size());
+            for (size_t i = 0; i < coefficient_positions.size(); ++i) {
+                x[i] = Pow(2, coefficient_positions[i]);
+            }
+
+            for (size_t i = 0; i < x.size(); ++i) {
+                uint8_t x_inverse = Inverse(x[i]);
+                uint8_t locator_prime = 1;
+                for (size_t j = 0; j < x.size(); ++j) {
+                    if (j != i) {
+                        locator_prime = Mul(locator_prime, 1 ^ Mul(x_inverse, x[j]));
+                    }
+                }
+                Poly evaluator_reversed(evaluator.rbegin(), evaluator.rend());
+                uint8_t y = Mul(x[i], Evaluate(evaluator_reversed, x_inverse));
+                message[positions[i]] ^= Div(y, locator_prime);
+            }
+        }
+
+        // Berlekamp-Massey，syndromes 已经过 Forney 变换去除擦除
+        bool FindErrorLocator(const Poly &syndromes, size_t erase_count, Poly &locator) const {
+            locator = {1};
+            Poly old_locator = {1};
+            for (size_t i = 0; i < kMfskParityBytes - erase_count; ++i) {
+                uint8_t delta = syndromes[i];
+                for (size_t j = 1; j < locator.size() && j <= i; ++j) {
+                    delta ^= Mul(locator[locator.size() - 1 - j], syndromes[i - j]);
+                }
+                old_locator.push_back(0);
+                if (delta != 0) {
+                    if (old_locator.size() > locator.size()) {
+                        Poly new_locator = Scale(old_locator, delta);
+                        old_locator = Scale(locator, Inverse(delta));
+                        locator = new_locator;
+                    }
+                    locator = Add(locator, Scale(old_locator, delta));
+                }
+            }
+            while (!locator.empty() && locator[0] == 0) {
+                locator.erase(locator.begin());
+            }
+            size_t errors = locator.size() - 1;
+            return (errors * 2 + erase_count) <= kMfskParityBytes;
+        }
+
+    public:
+        ReedSolomon() {
+            int x = 1;
+            for (int i = 0; i < 255; ++i) {
+                exp_[i] = static_cast<uint8_t>(x);
+                log_[x] = static_cast<uint8_t>(i);
+                x <<= 1;
+                if (x & 0x100) {
+                    x ^= 0x11D;
+                }
+            }
+            for (int i = 255; i < 512; ++i) {
+                exp_[i] = exp_[i - 255];
+            }
+            log_[0] = 0;
+        }
+
+        /**
+         * Correct a codeword in place
+         * @param message Data followed by kMfskParityBytes parity bytes
+         * @param erasures Known bad byte positions
+         * @return true if the codeword is valid after correction
+         */
+        bool Correct(Poly &message, const std::vector<int> &erasures) const {
+            for (int position : erasures) {
+                message[position] = 0;
+            }
+
+            Poly syndromes(kMfskParityBytes);
+            bool has_error = false;
+            for (size_t i = 0; i < kMfskParityBytes; ++i) {
+                syndromes[i] = Evaluate(message, Pow(2, static_cast<int>(i)));
+                has_error |= syndromes[i] != 0;
+            }
+            if (!has_error) {
+                return true;
+            }
+
+            // Forney syndromes
+            Poly forney_syndromes = syndromes;
+            for (int position : erasures) {
+                uint8_t x = Pow(2, static_cast<int>(message.size()) - 1 - position);
+                for (size_t j = 0; j + 1 < forney_syndromes.size(); ++j) {
+                    forney_syndromes[j] = Mul(forney_syndromes[j], x) ^ forney_syndromes[j + 1];
+                }
+            }
+
+            Poly locator;
+            if (!FindErrorLocator(forney_syndromes, erasures.size(), locator)) {
+                return false;
+            }
+
+            // Chien search
+            std::reverse(locator.begin(), locator.end());
+            std::vector<int> positions = erasures;
+            int n = static_cast<int>(message.size());
+            size_t found = 0;
+            for (int i = 0; i < n; ++i) {
+                if (Evaluate(locator, Pow(2, i)) == 0) {
+                    positions.push_back(n - 1 - i);
+                    found++;
+                }
+            }
+            if (found != locator.size() - 1) {
+                return false;
+            }
+
+            // 校正子要求 S(x) 最低位在后，并在前面补一个 0
+            Poly padded_syndromes = {0};
+            padded_syndromes.insert(padded_syndromes.end(), syndromes.begin(), syndromes.end());
+            CorrectErrata(message, padded_syndromes, positions);
+
+            for (size_t i = 0; i < kMfskParityBytes; ++i) {
+                if (Evaluate(message, Pow(2, static_cast<int>(i))) != 0) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+
+    static uint16_t Crc16(const uint8_t *data, size_t length) {
+        uint16_t crc = 0xFFFF;
+        for (size_t i = 0; i < length; ++i) {
+            crc ^= static_cast<uint16_t>(data[i]) << 8;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+            }
+        }
+        return crc;
+    }
+
+    MfskReceiver::MfskReceiver() {
+        for (size_t i = 0; i < kMfskToneCount; ++i) {
+            float frequency = static_cast<float>(kMfskFirstToneFrequency + kMfskToneSpacing * i) / kAudioSampleRate;
+            coefficients_[i] = 2.0f * std::cos(2.0f * M_PI * frequency);
+        }
+    }
+
+    void MfskReceiver::Reset() {
+        for (auto &decoder : decoders_) {
+            decoder = PhaseDecoder();
+        }
+    }
+
+    bool MfskReceiver::ProcessAudioSamples(const int16_t *samples, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            ring_buffer_[write_index_] = static_cast<float>(samples[i]);
+            write_index_ = (write_index_ + 1) % kMfskSymbolSize;
+            if (filled_ < kMfskSymbolSize) {
+                filled_++;
+                continue;
+            }
+
+            // 每 1/4 个符号评估一次，轮流送给 4 个符号定时相位的解码器
+            if (++step_count_ < kMfskSymbolSize / kPhaseCount) {
+                continue;
+            }
+            step_count_ = 0;
+
+            uint8_t symbol;
+            float confidence;
+            DetectSymbol(symbol, confidence);
+            auto &decoder = decoders_[next_phase_];
+            next_phase_ = (next_phase_ + 1) % kPhaseCount;
+            if (ProcessSymbol(decoder, symbol, confidence)) {
+                Reset();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void MfskReceiver::DetectSymbol(uint8_t &symbol, float &confidence) const {
+        // 所有音调都落在 64 点 DFT 的整数频点上，循环移位不影响幅度，可以直接按环形缓冲区顺序计算
+        float best = 0.0f, second = 0.0f;
+        symbol = 0;
+        for (size_t tone = 0; tone < kMfskToneCount; ++tone) {
+            float coefficient = coefficients_[tone];
+            float s1 = 0.0f, s2 = 0.0f;
+            for (size_t n = 0; n < kMfskSymbolSize; ++n) {
+                float s0 = ring_buffer_[n] + coefficient * s1 - s2;
+                s2 = s1;
+                s1 = s0;
+            }
+            float power = s1 * s1 + s2 * s2 - coefficient * s1 * s2;
+            if (power > best) {
+                second = best;
+                best = power;
+                symbol = static_cast<uint8_t>(tone);
+            } else if (power > second) {
+                second = power;
+            }
+        }
+        confidence = best > 0.0f ? 1.0f - second / best : 0.0f;
+    }
+
+    bool MfskReceiver::ProcessSymbol(PhaseDecoder &decoder, uint8_t symbol, float confidence) {
+        switch (decoder.state) {
+        case State::kSearching: {
+            std::copy(decoder.history.begin() + 1, decoder.history.end(), decoder.history.begin());
+            decoder.history.back() = symbol;
+            if (decoder.history_count < kPreambleLength) {
+                decoder.history_count++;
+                break;
+            }
+            size_t mismatches = 0;
+            for (size_t i = 0; i < kPreambleLength; ++i) {
+                mismatches += decoder.history[i] != kPreamble[i];
+            }
+            if (mismatches <= 1) {
+                decoder.state = State::kLength;
+                decoder.symbols.clear();
+                decoder.confidences.clear();
+            }
+            break;
+        }
+
+        case State::kLength:
+            decoder.symbols.push_back(symbol);
+            if (decoder.symbols.size() == kLengthCopies * 2) {
+                uint8_t copies[kLengthCopies];
+                for (size_t i = 0; i < kLengthCopies; ++i) {
+                    copies[i] = (decoder.symbols[i * 2] << 4) | decoder.symbols[i * 2 + 1];
+                }
+                // 至少两份一致才接受
+                size_t length = 0;
+                if (copies[0] == copies[1] || copies[0] == copies[2]) {
+                    length = copies[0];
+                } else if (copies[1] == copies[2]) {
+                    length = copies[1];
+                }
+                if (length == 0 || length > kMfskMaxPayload) {
+                    decoder = PhaseDecoder();
+                    break;
+                }
+                ESP_LOGI(kLogTag, "Preamble detected, payload length %zu", length);
+                decoder.payload_length = length;
+                decoder.state = State::kCodeword;
+                decoder.symbols.clear();
+                decoder.symbols.reserve((length + 2 + kMfskParityBytes) * 2);
+                decoder.confidences.reserve((length + 2 + kMfskParityBytes) * 2);
+            }
+            break;
+
+        case State::kCodeword:
+            decoder.symbols.push_back(symbol);
+            decoder.confidences.push_back(confidence);
+            if (decoder.symbols.size() == (decoder.payload_length + 2 + kMfskParityBytes) * 2) {
+                bool decoded = DecodeCodeword(decoder);
+                decoder = PhaseDecoder();
+                return decoded;
+            }
+            break;
+        }
+        return false;
+    }
+
+    bool MfskReceiver::DecodeCodeword(const PhaseDecoder &decoder) {
+        static const ReedSolomon reed_solomon;
+
+        size_t byte_count = decoder.symbols.size() / 2;
+        std::vector<uint8_t> received(byte_count);
+        std::vector<float> reliability(byte_count);
+        for (size_t i = 0; i < byte_count; ++i) {
+            received[i] = (decoder.symbols[i * 2] << 4) | decoder.symbols[i * 2 + 1];
+            reliability[i] = std::min(decoder.confidences[i * 2], decoder.confidences[i * 2 + 1]);
+        }
+
+        std::vector<int> order(byte_count);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&reliability](int a, int b) {
+            return reliability[a] < reliability[b];
+        });
+
+        for (size_t erasure_count : kErasureSteps) {
+            std::vector<uint8_t> message = received;
+            std::vector<int> erasures(order.begin(), order.begin() + std::min(erasure_count, byte_count));
+            if (!reed_solomon.Correct(message, erasures)) {
+                continue;
+            }
+
+            size_t length = decoder.payload_length;
+            uint16_t crc = (message[length] << 8) | message[length + 1];
+            if (Crc16(message.data(), length) != crc) {
+                continue;
+            }
+            ESP_LOGI(kLogTag, "Frame decoded with %zu erasures", erasure_count);
+            decoded_text = std::string(message.begin(), message.begin() + length);
+            return true;
+        }
+
+        ESP_LOGW(kLogTag, "Failed to decode frame of %zu bytes", decoder.payload_length);
+        return false;
+    }
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+/*
+ * MFSK frame format for acoustic WiFi provisioning, sampled at kAudioSampleRate (6400 Hz):
+ *   - every symbol is 64 samples (100 symbols/s) carrying one of 16 tones, tone n is (1000 + 100 * n) Hz,
+ *     so each symbol carries 4 bits, bytes are sent high nibble first
+ *   - preamble: symbols 0 F 0 F 3 C 5 A
+ *   - length: the payload length byte, sent 3 times
+ *   - codeword: payload + CRC-16/CCITT-FALSE (big endian) + 16 Reed-Solomon parity bytes
+ * Reed-Solomon works over GF(256) with polynomial 0x11D and generator roots a^0 .. a^15, parity follows the data.
+ */
+const size_t kMfskSymbolSize = 64;
+const size_t kMfskToneCount = 16;
+const size_t kMfskFirstToneFrequency = 1000;
+const size_t kMfskToneSpacing = 100;
+const size_t kMfskParityBytes = 16;
+const size_t kMfskMaxPayload = 255 - 2 - kMfskParityBytes;
+
+namespace audio_wifi_config
+{
+    /**
+     * MFSK receiver with Reed-Solomon error correction
+     * Decodes the frame at 4 symbol timing offsets in parallel, bytes with the least confident tone
+     * decisions are treated as erasures when the hard decisions alone cannot be corrected
+     */
+    class MfskReceiver
+    {
+    private:
+        static const size_t kPhaseCount = 4;       // Symbol timing candidates per symbol
+        static const size_t kPreambleLength = 8;
+        static const size_t kLengthCopies = 3;
+
+        enum class State
+        {
+            kSearching,  // Waiting for preamble
+            kLength,     // Receiving payload length
+            kCodeword    // Receiving codeword
+        };
+
+        struct PhaseDecoder
+        {
+            State state = State::kSearching;
+            std::array<uint8_t, kPreambleLength> history = {};  // Last symbols for preamble detection
+            size_t history_count = 0;
+            std::vector<uint8_t> symbols;                        // Received length / codeword symbols
+            std::vector<float> confidences;                      // Confidence of each symbol (0.0 to 1.0)
+            size_t payload_length = 0;
+        };
+
+        float ring_buffer_[kMfskSymbolSize];                 // Last symbol worth of samples
+        size_t write_index_ = 0;
+        size_t filled_ = 0;
+        size_t step_count_ = 0;                              // Samples since last evaluation
+        size_t next_phase_ = 0;                              // Decoder fed by next evaluation
+        float coefficients_[kMfskToneCount];                 // Goertzel coefficients 2 * cos(w)
+        std::array<PhaseDecoder, kPhaseCount> decoders_;
+
+        void DetectSymbol(uint8_t &symbol, float &confidence) const;
+        bool ProcessSymbol(PhaseDecoder &decoder, uint8_t symbol, float confidence);
+        bool DecodeCodeword(const PhaseDecoder &decoder);
+
+    public:
+        std::optional<std::string> decoded_text;  // Successfully decoded text data
+
+        MfskReceiver();
+
+        /**
+         * Process input audio samples at kAudioSampleRate
+         * @param samples Input audio samples
+         * @param count Number of samples
+         * @return true if a complete frame was received and decoded
+         */
+        bool ProcessAudioSamples(const int16_t *samples, size_t count);
+
+        /**
+         * Drop all partially received frames
+         */
+        void Reset();
+    };
+}
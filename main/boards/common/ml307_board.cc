@@ -3,14 +3,21 @@
 #include "application.h"
 #include "display.h"
 #include "font_awesome_symbols.h"
+#include "stream_player.h"
+#include "network_monitor.h"
+#include "assets.h"
 #include "assets/lang_config.h"
 
 #include <esp_log.h>
 #include <esp_timer.h>
+#include <algorithm>
 #include <opus_encoder.h>
 
 static const char *TAG = "Ml307Board";
 
+// 备用网络启动时每次等待注网的时长，之间检查是否取消
+#define ML307_STANDBY_POLL_MS 2000
+
 Ml307Board::Ml307Board(gpio_num_t tx_pin, gpio_num_t rx_pin, gpio_num_t dtr_pin) : tx_pin_(tx_pin), rx_pin_(rx_pin), dtr_pin_(dtr_pin) {
 }
 
@@ -18,7 +25,29 @@ std::string Ml307Board::GetBoardType() {
     return "ml307";
 }
 
+void Ml307Board::HandleNetworkStateChanged(bool network_ready) {
+    if (network_ready) {
+        ESP_LOGI(TAG, "Network is ready");
+        return;
+    }
+    ESP_LOGE(TAG, "Network is down");
+    if (!active_) {
+        return;
+    }
+    auto& application = Application::GetInstance();
+    auto device_state = application.GetDeviceState();
+    if (device_state == kDeviceStateListening || device_state == kDeviceStateSpeaking) {
+        application.Schedule([&application]() {
+            application.SetDeviceState(kDeviceStateIdle);
+        });
+    }
+}
+
 void Ml307Board::StartNetwork() {
+#if CONFIG_ML307_PPP_MODE
+    StartPppNetwork();
+    return;
+#endif
     auto& application = Application::GetInstance();
     auto display = Board::GetInstance().GetDisplay();
     display->SetStatus(Lang::Strings::DETECTING_MODULE);
@@ -31,18 +60,8 @@ void Ml307Board::StartNetwork() {
         vTaskDelay(pdMS_TO_TICKS(1000));
     }
 
-    modem_->OnNetworkStateChanged([this, &application](bool network_ready) {
-        if (network_ready) {
-            ESP_LOGI(TAG, "Network is ready");
-        } else {
-            ESP_LOGE(TAG, "Network is down");
-            auto device_state = application.GetDeviceState();
-            if (device_state == kDeviceStateListening || device_state == kDeviceStateSpeaking) {
-                application.Schedule([this, &application]() {
-                    application.SetDeviceState(kDeviceStateIdle);
-                });
-            }
-        }
+    modem_->OnNetworkStateChanged([this](bool network_ready) {
+        HandleNetworkStateChanged(network_ready);
     });
 
     // Wait for network ready
@@ -50,9 +69,9 @@ void Ml307Board::StartNetwork() {
     while (true) {
         auto result = modem_->WaitForNetworkReady();
         if (result == NetworkStatus::ErrorInsertPin) {
-            application.Alert(Lang::Strings::ERROR, Lang::Strings::PIN_ERROR, "sad", Lang::Sounds::P3_ERR_PIN);
+            application.Alert(Lang::Strings::ERROR, Lang::Strings::PIN_ERROR, "sad", Assets::GetInstance().GetSound("err_pin", Lang::Sounds::P3_ERR_PIN));
         } else if (result == NetworkStatus::ErrorRegistrationDenied) {
-            application.Alert(Lang::Strings::ERROR, Lang::Strings::REG_ERROR, "sad", Lang::Sounds::P3_ERR_REG);
+            application.Alert(Lang::Strings::ERROR, Lang::Strings::REG_ERROR, "sad", Assets::GetInstance().GetSound("err_reg", Lang::Sounds::P3_ERR_REG));
         } else {
             break;
         }
@@ -68,15 +87,150 @@ void Ml307Board::StartNetwork() {
     ESP_LOGI(TAG, "ML307 ICCID: %s", iccid.c_str());
 }
 
+#if CONFIG_ML307_PPP_MODE
+void Ml307Board::StartPppNetwork() {
+    auto& application = Application::GetInstance();
+    auto display = Board::GetInstance().GetDisplay();
+    display->SetStatus(Lang::Strings::DETECTING_MODULE);
+
+    ppp_modem_ = std::make_unique<PppModem>(tx_pin_, rx_pin_, dtr_pin_, 921600);
+    ppp_modem_->OnNetworkStateChanged([this](bool network_ready) {
+        HandleNetworkStateChanged(network_ready);
+    });
+
+    display->SetStatus(Lang::Strings::REGISTERING_NETWORK);
+    while (true) {
+        auto result = ppp_modem_->WaitForNetworkReady();
+        if (result == NetworkStatus::ErrorInsertPin) {
+            application.Alert(Lang::Strings::ERROR, Lang::Strings::PIN_ERROR, "sad", Assets::GetInstance().GetSound("err_pin", Lang::Sounds::P3_ERR_PIN));
+        } else if (result == NetworkStatus::ErrorRegistrationDenied) {
+            application.Alert(Lang::Strings::ERROR, Lang::Strings::REG_ERROR, "sad", Assets::GetInstance().GetSound("err_reg", Lang::Sounds::P3_ERR_REG));
+        } else if (result == NetworkStatus::Ready) {
+            break;
+        }
+        vTaskDelay(pdMS_TO_TICKS(result == NetworkStatus::Error ? 1000 : 10000));
+    }
+
+    // 拨号失败时 PPP 任务在后台重拨
+    while (!ppp_modem_->Connect()) {
+        ESP_LOGW(TAG, "PPP link not up yet, waiting");
+    }
+
+    ESP_LOGI(TAG, "ML307 Revision: %s", ppp_modem_->module_revision().c_str());
+    ESP_LOGI(TAG, "ML307 IMEI: %s", ppp_modem_->imei().c_str());
+    ESP_LOGI(TAG, "ML307 ICCID: %s", ppp_modem_->iccid().c_str());
+    ESP_LOGI(TAG, "PPP IP: %s", ppp_modem_->ip_address().c_str());
+}
+#endif
+
+bool Ml307Board::StartStandbyNetwork(int timeout_ms, const std::function<bool()>& cancelled) {
+    active_ = false;
+    int64_t deadline = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+    auto remaining_ms = [deadline]() {
+        return (int)std::max<int64_t>((deadline - esp_timer_get_time()) / 1000, 0);
+    };
+    auto should_stop = [&]() {
+        return cancelled() || remaining_ms() == 0;
+    };
+
+#if CONFIG_ML307_PPP_MODE
+    ppp_modem_ = std::make_unique<PppModem>(tx_pin_, rx_pin_, dtr_pin_, 921600);
+    ppp_modem_->OnNetworkStateChanged([this](bool network_ready) {
+        HandleNetworkStateChanged(network_ready);
+    });
+    auto wait_ready = [this](int ms) { return ppp_modem_->WaitForNetworkReady(ms); };
+#else
+    while (modem_ == nullptr) {
+        if (should_stop()) {
+            ESP_LOGW(TAG, "Standby: no modem detected");
+            return false;
+        }
+        modem_ = AtModem::Detect(tx_pin_, rx_pin_, dtr_pin_, 921600);
+        if (modem_ == nullptr) {
+            vTaskDelay(pdMS_TO_TICKS(1000));
+        }
+    }
+    modem_->OnNetworkStateChanged([this](bool network_ready) {
+        HandleNetworkStateChanged(network_ready);
+    });
+    auto wait_ready = [this](int ms) { return modem_->WaitForNetworkReady(ms); };
+#endif
+
+    // 分段等待，中途可以取消
+    while (true) {
+        if (should_stop()) {
+            ESP_LOGW(TAG, "Standby: network not ready in time or cancelled");
+            return false;
+        }
+        auto result = wait_ready(std::min(remaining_ms(), ML307_STANDBY_POLL_MS));
+        if (result == NetworkStatus::Ready) {
+            break;
+        }
+        if (result == NetworkStatus::ErrorInsertPin || result == NetworkStatus::ErrorRegistrationDenied) {
+            ESP_LOGE(TAG, "Standby: %s", result == NetworkStatus::ErrorInsertPin ? "SIM PIN error" : "registration denied");
+            return false;
+        }
+        if (result == NetworkStatus::Error) {
+            vTaskDelay(pdMS_TO_TICKS(1000));
+        }
+    }
+
+#if CONFIG_ML307_PPP_MODE
+    while (!ppp_modem_->Connect()) {
+        if (should_stop()) {
+            ESP_LOGW(TAG, "Standby: PPP link not up in time or cancelled");
+            return false;
+        }
+    }
+#endif
+    ESP_LOGI(TAG, "Standby network ready");
+    return true;
+}
+
+bool Ml307Board::IsNetworkReady() {
+#if CONFIG_ML307_PPP_MODE
+    return ppp_modem_ != nullptr && ppp_modem_->network_ready();
+#else
+    return modem_ != nullptr && modem_->network_ready();
+#endif
+}
+
+int Ml307Board::GetCsq() {
+#if CONFIG_ML307_PPP_MODE
+    return ppp_modem_ != nullptr ? ppp_modem_->csq() : -1;
+#else
+    return modem_->GetCsq();
+#endif
+}
+
+std::string Ml307Board::GetCarrierName() {
+#if CONFIG_ML307_PPP_MODE
+    return ppp_modem_ != nullptr ? ppp_modem_->carrier_name() : "";
+#else
+    return modem_->GetCarrierName();
+#endif
+}
+
 NetworkInterface* Ml307Board::GetNetwork() {
+#if CONFIG_ML307_PPP_MODE
+    return ppp_modem_ != nullptr ? ppp_modem_->network() : nullptr;
+#else
     return modem_.get();
+#endif
 }
 
 const char* Ml307Board::GetNetworkStateIcon() {
-    if (modem_ == nullptr || !modem_->network_ready()) {
+    if (!IsNetworkReady()) {
+        NetworkMonitor::GetInstance().ReportSignal(-1);
         return FONT_AWESOME_SIGNAL_OFF;
     }
-    int csq = modem_->GetCsq();
+    int csq = GetCsq();
+    // CSQ 0-31，99 表示未知
+    if (csq >= 0 && csq <= 31) {
+        NetworkMonitor::GetInstance().ReportSignal(csq * 100 / 31);
+    } else if (csq == -1) {
+        NetworkMonitor::GetInstance().ReportSignal(-1);
+    }
     if (csq == -1) {
         return FONT_AWESOME_SIGNAL_OFF;
     } else if (csq >= 0 && csq <= 14) {
@@ -97,12 +251,21 @@ std::string Ml307Board::GetBoardJson() {
     // Set the board type for OTA
     std::string board_json = std::string("{\"type\":\"" BOARD_TYPE "\",");
     board_json += "\"name\":\"" BOARD_NAME "\",";
+#if CONFIG_ML307_PPP_MODE
+    board_json += "\"revision\":\"" + ppp_modem_->module_revision() + "\",";
+    board_json += "\"carrier\":\"" + ppp_modem_->carrier_name() + "\",";
+    board_json += "\"csq\":\"" + std::to_string(ppp_modem_->csq()) + "\",";
+    board_json += "\"imei\":\"" + ppp_modem_->imei() + "\",";
+    board_json += "\"iccid\":\"" + ppp_modem_->iccid() + "\",";
+    board_json += "\"ip\":\"" + ppp_modem_->ip_address() + "\"}";
+#else
     board_json += "\"revision\":\"" + modem_->GetModuleRevision() + "\",";
     board_json += "\"carrier\":\"" + modem_->GetCarrierName() + "\",";
     board_json += "\"csq\":\"" + std::to_string(modem_->GetCsq()) + "\",";
     board_json += "\"imei\":\"" + modem_->GetImei() + "\",";
     board_json += "\"iccid\":\"" + modem_->GetIccid() + "\",";
     board_json += "\"cereg\":" + modem_->GetRegistrationState().ToString() + "}";
+#endif
     return board_json;
 }
 
@@ -119,6 +282,14 @@ std::string Ml307Board::GetDeviceStatusJson() {
      *     "audio_speaker": {
      *         "volume": 70
      *     },
+     *     "music": {                  // 仅在播放时
+     *         "buffered": 65536,
+     *         "buffer_size": 196608,
+     *         "start_threshold": 32768,
+     *         "download_rate": 48000,
+     *         "bitrate": 16000,
+     *         "underruns": 0
+     *     },
      *     "screen": {
      *         "brightness": 100,
      *         "theme": "light"
@@ -145,6 +316,9 @@ std::string Ml307Board::GetDeviceStatusJson() {
     }
     cJSON_AddItemToObject(root, "audio_speaker", audio_speaker);
 
+    // Music stream buffering
+    AddStreamStatusJson(root);
+
     // Screen brightness
     auto backlight = board.GetBacklight();
     auto screen = cJSON_CreateObject();
@@ -171,8 +345,8 @@ std::string Ml307Board::GetDeviceStatusJson() {
     // Network
     auto network = cJSON_CreateObject();
     cJSON_AddStringToObject(network, "type", "cellular");
-    cJSON_AddStringToObject(network, "carrier", modem_->GetCarrierName().c_str());
-    int csq = modem_->GetCsq();
+    cJSON_AddStringToObject(network, "carrier", GetCarrierName().c_str());
+    int csq = GetCsq();
     if (csq == -1) {
         cJSON_AddStringToObject(network, "signal", "unknown");
     } else if (csq >= 0 && csq <= 14) {
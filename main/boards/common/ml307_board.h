@@ -2,8 +2,11 @@
 #define ML307_BOARD_H
 
 #include <memory>
+#include <atomic>
+#include <functional>
 #include <at_modem.h>
 #include "board.h"
+#include "ppp_modem.h"
 
 
 class Ml307Board : public Board {
@@ -12,13 +15,29 @@ protected:
     gpio_num_t tx_pin_;
     gpio_num_t rx_pin_;
     gpio_num_t dtr_pin_;
+#if CONFIG_ML307_PPP_MODE
+    // PPP 数据模式下不创建 AtModem，modem_ 为空
+    std::unique_ptr<PppModem> ppp_modem_;
+    void StartPppNetwork();
+#endif
+
+    // 作为备用网络启动时为 false，接管网络之前网络状态变化不影响设备状态
+    std::atomic<bool> active_ = true;
+    void HandleNetworkStateChanged(bool network_ready);
 
     virtual std::string GetBoardJson() override;
+    bool IsNetworkReady();
+    int GetCsq();
+    std::string GetCarrierName();
 
 public:
     Ml307Board(gpio_num_t tx_pin, gpio_num_t rx_pin, gpio_num_t dtr_pin = GPIO_NUM_NC);
     virtual std::string GetBoardType() override;
     virtual void StartNetwork() override;
+    // 作为备用网络在后台启动：不更新界面也不提示，模组缺失、PIN 或注网错误、超过 timeout_ms 或 cancelled()
+    // 返回 true 时放弃并返回 false。成功后要由接管网络的一方调用 SetActive(true)
+    bool StartStandbyNetwork(int timeout_ms, const std::function<bool()>& cancelled);
+    void SetActive(bool active) { active_ = active; }
     virtual NetworkInterface* GetNetwork() override;
     virtual const char* GetNetworkStateIcon() override;
     virtual void SetPowerSaveMode(bool enabled) override;
@@ -13,9 +13,12 @@ public:
     // 新增流式播放相关方法
     virtual bool StartStreaming(const std::string& music_url) = 0;
     virtual bool StopStreaming() = 0;  // 停止流式播放
+    // 对话期间暂停，保留播放位置和已缓冲的数据，不支持暂停的实现直接停止
+    virtual bool SuspendStreaming() { return StopStreaming(); }
+    // 从暂停的位置继续，under_voice 为真时在 TTS 下方压低音量播放
+    virtual bool ResumeStreaming(bool under_voice = false) { return false; }
     virtual size_t GetBufferSize() const = 0;
     virtual bool IsDownloading() const = 0;
-    virtual int16_t* GetAudioData() = 0;
 };
 
 #endif // MUSIC_H 
\ No newline at end of file
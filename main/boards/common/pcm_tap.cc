@@ -0,0 +1,87 @@
+#include "pcm_tap.h"
+#include "audio_memory.h"
+
+#include <esp_log.h>
+#include <algorithm>
+#include <cstring>
+
+#define TAG "PcmTap"
+
+PcmTap::PcmTap(size_t max_samples) : max_samples_(max_samples) {
+    ready_ = xSemaphoreCreateBinary();
+}
+
+PcmTap::~PcmTap() {
+    for (auto& slot : slots_) {
+        AudioMemory::Free(slot.pcm);
+    }
+    vSemaphoreDelete(ready_);
+}
+
+void PcmTap::Publish(const int16_t* pcm, size_t samples, int sample_rate, int64_t play_time_ms) {
+    if (!attached_.load(std::memory_order_acquire)) {
+        return;
+    }
+    Slot& slot = slots_[write_index_];
+    slot.samples = std::min(samples, max_samples_);
+    slot.sample_rate = sample_rate;
+    slot.play_time_ms = play_time_ms;
+    memcpy(slot.pcm, pcm, slot.samples * sizeof(int16_t));
+
+    uint8_t previous = middle_.exchange(write_index_ | kFresh, std::memory_order_acq_rel);
+    write_index_ = previous & kIndexMask;
+    xSemaphoreGive(ready_);
+}
+
+bool PcmTap::Attach() {
+    std::lock_guard<std::mutex> lock(slots_mutex_);
+    if (attached_.load(std::memory_order_relaxed)) {
+        return true;
+    }
+    // Detach 时播放线程可能仍在写入，缓冲区只在播放停止后由 Release 释放
+    for (auto& slot : slots_) {
+        if (slot.pcm == nullptr) {
+            slot.pcm = (int16_t*)AudioMemory::Allocate(kAudioMemoryMusic, max_samples_ * sizeof(int16_t));
+            if (slot.pcm == nullptr) {
+                ESP_LOGE(TAG, "Failed to allocate PCM tap buffer");
+                return false;
+            }
+        }
+    }
+    middle_.fetch_and(kIndexMask, std::memory_order_relaxed);
+    xSemaphoreTake(ready_, 0);
+    attached_.store(true, std::memory_order_release);
+    return true;
+}
+
+void PcmTap::Release() {
+    std::lock_guard<std::mutex> lock(slots_mutex_);
+    if (attached_.load(std::memory_order_relaxed)) {
+        return;
+    }
+    for (auto& slot : slots_) {
+        AudioMemory::Free(slot.pcm);
+        slot.pcm = nullptr;
+    }
+}
+
+void PcmTap::Detach() {
+    attached_.store(false, std::memory_order_release);
+}
+
+bool PcmTap::Read(Frame* frame, int timeout_ms) {
+    while (!(middle_.load(std::memory_order_acquire) & kFresh)) {
+        if (xSemaphoreTake(ready_, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+            return false;
+        }
+    }
+    uint8_t previous = middle_.exchange(read_index_, std::memory_order_acq_rel);
+    read_index_ = previous & kIndexMask;
+
+    const Slot& slot = slots_[read_index_];
+    frame->pcm = slot.pcm;
+    frame->samples = slot.samples;
+    frame->sample_rate = slot.sample_rate;
+    frame->play_time_ms = slot.play_time_ms;
+    return true;
+}
@@ -0,0 +1,64 @@
+#ifndef PCM_TAP_H
+#define PCM_TAP_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+/*
+ * Triple-buffered copy of the latest decoded PCM frame, one writer (player) and one reader (visualizer).
+ *
+ * The writer fills its own slot and swaps it with the shared middle slot, the reader swaps the middle slot
+ * with its own when it is marked fresh, so neither side ever blocks or sees a half written frame. Frames
+ * the reader does not pick up in time are overwritten. Nothing is copied until a reader has attached.
+ */
+class PcmTap {
+public:
+    struct Frame {
+        const int16_t* pcm;
+        size_t samples;
+        int sample_rate;
+        int64_t play_time_ms;
+    };
+
+    explicit PcmTap(size_t max_samples);
+    ~PcmTap();
+
+    // Writer side, never blocks; frames longer than max_samples are truncated
+    void Publish(const int16_t* pcm, size_t samples, int sample_rate, int64_t play_time_ms);
+
+    // Frees the slots while no reader is attached, the writer must be stopped; Attach() allocates them again
+    void Release();
+
+    // Reader side
+    bool Attach();
+    void Detach();
+    // Waits up to timeout_ms for a frame newer than the last one read, the frame stays valid until the next Read
+    bool Read(Frame* frame, int timeout_ms);
+
+private:
+    static constexpr uint8_t kFresh = 0x4;
+    static constexpr uint8_t kIndexMask = 0x3;
+
+    struct Slot {
+        int16_t* pcm = nullptr;
+        size_t samples = 0;
+        int sample_rate = 0;
+        int64_t play_time_ms = 0;
+    };
+
+    size_t max_samples_;
+    Slot slots_[3];
+    std::atomic<uint8_t> middle_{1};
+    std::atomic<bool> attached_{false};
+    uint8_t write_index_ = 0;
+    uint8_t read_index_ = 2;
+    SemaphoreHandle_t ready_ = nullptr;
+    std::mutex slots_mutex_;
+};
+
+#endif // PCM_TAP_H
@@ -1,5 +1,6 @@
 #include "power_save_timer.h"
 #include "application.h"
+#include "tick_service.h"
 
 #include <esp_log.h>
 
@@ -8,32 +9,23 @@
 
 PowerSaveTimer::PowerSaveTimer(int cpu_max_freq, int seconds_to_sleep, int seconds_to_shutdown)
     : cpu_max_freq_(cpu_max_freq), seconds_to_sleep_(seconds_to_sleep), seconds_to_shutdown_(seconds_to_shutdown) {
-    esp_timer_create_args_t timer_args = {
-        .callback = [](void* arg) {
-            auto self = static_cast<PowerSaveTimer*>(arg);
-            self->PowerSaveCheck();
-        },
-        .arg = this,
-        .dispatch_method = ESP_TIMER_TASK,
-        .name = "power_save_timer",
-        .skip_unhandled_events = true,
-    };
-    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &power_save_timer_));
+    tick_id_ = TickService::GetInstance().Add("power_save", 1000, 200, [this]() {
+        PowerSaveCheck();
+    }, false);
 }
 
 PowerSaveTimer::~PowerSaveTimer() {
-    esp_timer_stop(power_save_timer_);
-    esp_timer_delete(power_save_timer_);
+    TickService::GetInstance().Remove(tick_id_);
 }
 
 void PowerSaveTimer::SetEnabled(bool enabled) {
     if (enabled && !enabled_) {
         ticks_ = 0;
         enabled_ = enabled;
-        ESP_ERROR_CHECK(esp_timer_start_periodic(power_save_timer_, 1000000));
+        TickService::GetInstance().SetEnabled(tick_id_, true);
         ESP_LOGI(TAG, "Power save timer enabled");
     } else if (!enabled && enabled_) {
-        ESP_ERROR_CHECK(esp_timer_stop(power_save_timer_));
+        TickService::GetInstance().SetEnabled(tick_id_, false);
         enabled_ = enabled;
         WakeUp();
         ESP_LOGI(TAG, "Power save timer disabled");
@@ -108,6 +100,10 @@ void PowerSaveTimer::WakeUp() {
                 .min_freq_mhz = cpu_max_freq_,
                 .light_sleep_enable = false,
             };
+#if CONFIG_AUDIO_POWER_GOVERNOR
+            // 由音频负载决定何时升频
+            pm_config.min_freq_mhz = CONFIG_AUDIO_POWER_GOVERNOR_MIN_FREQ_MHZ;
+#endif
             esp_pm_configure(&pm_config);
 
             // Enable wake word detection
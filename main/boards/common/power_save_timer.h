@@ -19,7 +19,7 @@ public:
 private:
     void PowerSaveCheck();
 
-    esp_timer_handle_t power_save_timer_ = nullptr;
+    int tick_id_ = 0;
     bool enabled_ = false;
     bool in_sleep_mode_ = false;
     bool is_wake_word_running_ = false;
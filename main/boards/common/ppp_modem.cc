@@ -0,0 +1,356 @@
+#include "ppp_modem.h"
+
+#if CONFIG_ML307_PPP_MODE
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_netif_ppp.h>
+#include "system_metrics.h"
+#include <freertos/task.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#define TAG "PppModem"
+
+#define PPP_UART_NUM            UART_NUM_1
+#define PPP_RX_BUFFER_SIZE      1536
+#define PPP_UART_RX_RING_SIZE   16384
+#define PPP_UART_TX_RING_SIZE   8192
+// 921600 下 128 字节的 FIFO 1.4 ms 就满，默认 120 字节阈值只剩 87 us 余量，提前取走
+#define PPP_UART_RX_FULL_THRESH 64
+#define PPP_EVENT_GOT_IP        BIT0
+#define PPP_EVENT_LOST          BIT1
+
+// "+CSQ: 20,99" 中前缀之后第 index 个字段，去掉引号
+static std::string Field(const std::string& response, const char* prefix, int index) {
+    auto pos = response.find(prefix);
+    if (pos == std::string::npos) {
+        return "";
+    }
+    pos += strlen(prefix);
+    auto end = response.find('\n', pos);
+    std::string line = response.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+    for (int i = 0; i < index; i++) {
+        auto comma = line.find(',');
+        if (comma == std::string::npos) {
+            return "";
+        }
+        line.erase(0, comma + 1);
+    }
+    line = line.substr(0, line.find(','));
+    if (line.size() >= 2 && line.front() == '"' && line.back() == '"') {
+        line = line.substr(1, line.size() - 2);
+    }
+    return line;
+}
+
+PppModem::PppModem(gpio_num_t tx_pin, gpio_num_t rx_pin, gpio_num_t dtr_pin, int baud_rate)
+    : tx_pin_(tx_pin), rx_pin_(rx_pin), dtr_pin_(dtr_pin), baud_rate_(baud_rate) {
+    event_group_ = xEventGroupCreate();
+}
+
+PppModem::~PppModem() {
+    if (task_ != nullptr) {
+        vTaskDelete(task_);
+    }
+    if (ip_event_handler_ != nullptr) {
+        esp_event_handler_instance_unregister(IP_EVENT, ESP_EVENT_ANY_ID, ip_event_handler_);
+        esp_event_handler_unregister(NETIF_PPP_STATUS, ESP_EVENT_ANY_ID, &PppModem::IpEventHandler);
+    }
+    if (netif_ != nullptr) {
+        esp_netif_action_stop(netif_, nullptr, 0, nullptr);
+        esp_netif_destroy(netif_);
+    }
+    if (uart_installed_) {
+        uart_driver_delete(PPP_UART_NUM);
+    }
+    vEventGroupDelete(event_group_);
+}
+
+bool PppModem::Command(const std::string& command, std::string* response, int timeout_ms, const char* expect) {
+    uart_flush_input(PPP_UART_NUM);
+    std::string line = command + "\r\n";
+    uart_write_bytes(PPP_UART_NUM, line.data(), line.size());
+    line.clear();
+
+    int64_t deadline = esp_timer_get_time() + timeout_ms * 1000LL;
+    while (esp_timer_get_time() < deadline) {
+        char c;
+        if (uart_read_bytes(PPP_UART_NUM, &c, 1, pdMS_TO_TICKS(10)) != 1) {
+            continue;
+        }
+        if (c != '\n') {
+            if (c != '\r') {
+                line += c;
+            }
+            continue;
+        }
+        // 跳过空行和命令回显
+        if (line.empty() || line == command) {
+            line.clear();
+            continue;
+        }
+        if (line.rfind(expect, 0) == 0) {
+            return true;
+        }
+        if (line == "ERROR" || line == "NO CARRIER" || line.rfind("+CME ERROR", 0) == 0) {
+            ESP_LOGW(TAG, "%s: %s", command.c_str(), line.c_str());
+            return false;
+        }
+        if (response != nullptr) {
+            if (!response->empty()) {
+                *response += '\n';
+            }
+            *response += line;
+        }
+        line.clear();
+    }
+    return false;
+}
+
+bool PppModem::DetectBaudRate() {
+    if (!uart_installed_) {
+        uart_config_t uart_config = {};
+        uart_config.baud_rate = baud_rate_;
+        uart_config.data_bits = UART_DATA_8_BITS;
+        uart_config.parity = UART_PARITY_DISABLE;
+        uart_config.stop_bits = UART_STOP_BITS_1;
+        uart_config.source_clk = UART_SCLK_DEFAULT;
+        ESP_ERROR_CHECK(uart_driver_install(PPP_UART_NUM, PPP_UART_RX_RING_SIZE, PPP_UART_TX_RING_SIZE, 32, &uart_queue_, ESP_INTR_FLAG_IRAM));
+        ESP_ERROR_CHECK(uart_param_config(PPP_UART_NUM, &uart_config));
+        ESP_ERROR_CHECK(uart_set_pin(PPP_UART_NUM, tx_pin_, rx_pin_, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+        uart_set_rx_full_threshold(PPP_UART_NUM, PPP_UART_RX_FULL_THRESH);
+        if (dtr_pin_ != GPIO_NUM_NC) {
+            gpio_config_t config = {};
+            config.pin_bit_mask = (1ULL << dtr_pin_);
+            config.mode = GPIO_MODE_OUTPUT;
+            gpio_config(&config);
+            gpio_set_level(dtr_pin_, 0);
+        }
+        uart_installed_ = true;
+    }
+
+    int baud_rates[] = {baud_rate_, 115200, 921600, 460800, 230400};
+    for (int rate : baud_rates) {
+        uart_set_baudrate(PPP_UART_NUM, rate);
+        if (!Command("AT", nullptr, 100)) {
+            continue;
+        }
+        if (rate != baud_rate_) {
+            if (!Command("AT+IPR=" + std::to_string(baud_rate_))) {
+                return false;
+            }
+            uart_set_baudrate(PPP_UART_NUM, baud_rate_);
+        }
+        ESP_LOGI(TAG, "Modem detected at %d, running at %d", rate, baud_rate_);
+        return true;
+    }
+    return false;
+}
+
+NetworkStatus PppModem::WaitForNetworkReady(int timeout_ms) {
+    if (!DetectBaudRate()) {
+        return NetworkStatus::Error;
+    }
+    Command("ATE0");
+
+    bool pin_ready = false;
+    for (int i = 0; i < 10 && !pin_ready; i++) {
+        std::string response;
+        pin_ready = Command("AT+CPIN?", &response) && response.find("READY") != std::string::npos;
+        if (!pin_ready) {
+            vTaskDelay(pdMS_TO_TICKS(1000));
+        }
+    }
+    if (!pin_ready) {
+        return NetworkStatus::ErrorInsertPin;
+    }
+
+    int64_t deadline = esp_timer_get_time() + timeout_ms * 1000LL;
+    while (true) {
+        std::string response;
+        if (Command("AT+CEREG?", &response)) {
+            int stat = atoi(Field(response, "+CEREG: ", 1).c_str());
+            if (stat == 1 || stat == 5) {
+                ReadModemInfo();
+                return NetworkStatus::Ready;
+            } else if (stat == 3) {
+                return NetworkStatus::ErrorRegistrationDenied;
+            }
+        }
+        if (timeout_ms > 0 && esp_timer_get_time() > deadline) {
+            return NetworkStatus::ErrorTimeout;
+        }
+        vTaskDelay(pdMS_TO_TICKS(1000));
+    }
+}
+
+void PppModem::ReadModemInfo() {
+    std::string response;
+    if (Command("AT+CGMR", &response)) {
+        module_revision_ = response.substr(0, response.find('\n'));
+    }
+    response.clear();
+    if (Command("AT+CGSN=1", &response)) {
+        imei_ = Field(response, "+CGSN: ", 0);
+    }
+    response.clear();
+    if (Command("AT+ICCID", &response)) {
+        iccid_ = Field(response, "+ICCID: ", 0);
+    }
+    response.clear();
+    if (Command("AT+COPS?", &response)) {
+        carrier_name_ = Field(response, "+COPS: ", 2);
+    }
+    response.clear();
+    if (Command("AT+CSQ", &response)) {
+        csq_ = atoi(Field(response, "+CSQ: ", 0).c_str());
+    }
+}
+
+bool PppModem::Dial() {
+    if (strlen(CONFIG_ML307_PPP_APN) > 0) {
+        Command("AT+CGDCONT=1,\"IP\",\"" CONFIG_ML307_PPP_APN "\"");
+    }
+    return Command("ATD*99#", nullptr, 10000, "CONNECT");
+}
+
+void PppModem::HangUp() {
+    // +++ 前后各需 1 秒静默才会退回命令模式
+    vTaskDelay(pdMS_TO_TICKS(1100));
+    uart_write_bytes(PPP_UART_NUM, "+++", 3);
+    vTaskDelay(pdMS_TO_TICKS(1100));
+    Command("ATH");
+}
+
+bool PppModem::Connect(int timeout_ms) {
+    if (netif_ == nullptr) {
+        esp_netif_init();
+        esp_netif_config_t config = ESP_NETIF_DEFAULT_PPP();
+        netif_ = esp_netif_new(&config);
+        driver_.base.post_attach = &PppModem::PostAttach;
+        driver_.modem = this;
+        ESP_ERROR_CHECK(esp_netif_attach(netif_, &driver_));
+
+        esp_netif_ppp_config_t ppp_config = {};
+        ppp_config.ppp_error_event_enabled = true;
+        esp_netif_ppp_set_params(netif_, &ppp_config);
+
+        ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT, ESP_EVENT_ANY_ID, &PppModem::IpEventHandler, this, &ip_event_handler_));
+        ESP_ERROR_CHECK(esp_event_handler_register(NETIF_PPP_STATUS, ESP_EVENT_ANY_ID, &PppModem::IpEventHandler, this));
+    }
+
+    if (task_ == nullptr) {
+        xTaskCreate([](void* arg) {
+            static_cast<PppModem*>(arg)->PppTask();
+        }, "ppp_modem", 4096, this, 15, &task_);
+    }
+    auto bits = xEventGroupWaitBits(event_group_, PPP_EVENT_GOT_IP, pdFALSE, pdFALSE, pdMS_TO_TICKS(timeout_ms));
+    return (bits & PPP_EVENT_GOT_IP) != 0;
+}
+
+// 由 UART 事件驱动，有数据就把已缓冲的全部交给 PPP，不按固定长度或超时攒包
+void PppModem::ReceiveData(uint8_t* buffer) {
+    static auto& overflows = SystemMetrics::GetInstance().Counter("modem_uart_overflows");
+    xQueueReset(uart_queue_);
+    while ((xEventGroupGetBits(event_group_) & PPP_EVENT_LOST) == 0) {
+        uart_event_t event;
+        if (xQueueReceive(uart_queue_, &event, pdMS_TO_TICKS(100)) != pdTRUE) {
+            continue;
+        }
+        if (event.type == UART_FIFO_OVF || event.type == UART_BUFFER_FULL) {
+            // 丢了字节的帧 FCS 校验不过，PPP 自己会丢弃，清空后从下一个帧起重新同步
+            ESP_LOGW(TAG, "UART %s", event.type == UART_FIFO_OVF ? "FIFO overflow" : "buffer full");
+            overflows++;
+            uart_flush_input(PPP_UART_NUM);
+            xQueueReset(uart_queue_);
+            continue;
+        }
+        if (event.type != UART_DATA) {
+            continue;
+        }
+        size_t available = 0;
+        uart_get_buffered_data_len(PPP_UART_NUM, &available);
+        while (available > 0) {
+            int length = uart_read_bytes(PPP_UART_NUM, buffer, std::min<size_t>(available, PPP_RX_BUFFER_SIZE), 0);
+            if (length <= 0) {
+                break;
+            }
+            esp_netif_receive(netif_, buffer, length, nullptr);
+            available -= length;
+        }
+    }
+}
+
+void PppModem::PppTask() {
+    auto buffer = static_cast<uint8_t*>(malloc(PPP_RX_BUFFER_SIZE));
+    while (true) {
+        if (!Dial()) {
+            ESP_LOGE(TAG, "Dial failed, retry in 5 seconds");
+            vTaskDelay(pdMS_TO_TICKS(5000));
+            continue;
+        }
+        ESP_LOGI(TAG, "Entered data mode");
+        xEventGroupClearBits(event_group_, PPP_EVENT_LOST);
+        data_mode_ = true;
+        esp_netif_action_start(netif_, nullptr, 0, nullptr);
+        ReceiveData(buffer);
+        esp_netif_action_stop(netif_, nullptr, 0, nullptr);
+        data_mode_ = false;
+        HangUp();
+        ESP_LOGW(TAG, "PPP link lost, redialing");
+        vTaskDelay(pdMS_TO_TICKS(1000));
+    }
+}
+
+esp_err_t PppModem::Transmit(void* handle, void* buffer, size_t length) {
+    auto driver = static_cast<Driver*>(handle);
+    if (!driver->modem->data_mode_) {
+        return ESP_FAIL;
+    }
+    return uart_write_bytes(PPP_UART_NUM, buffer, length) < 0 ? ESP_FAIL : ESP_OK;
+}
+
+esp_err_t PppModem::PostAttach(esp_netif_t* netif, void* args) {
+    auto driver = static_cast<Driver*>(args);
+    driver->base.netif = netif;
+    esp_netif_driver_ifconfig_t ifconfig = {};
+    ifconfig.handle = driver;
+    ifconfig.transmit = &PppModem::Transmit;
+    return esp_netif_set_driver_config(netif, &ifconfig);
+}
+
+void PppModem::IpEventHandler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
+    auto this_ = static_cast<PppModem*>(arg);
+    bool lost = false;
+    if (event_base == IP_EVENT && event_id == IP_EVENT_PPP_GOT_IP) {
+        auto event = static_cast<ip_event_got_ip_t*>(event_data);
+        char ip_address[16];
+        esp_ip4addr_ntoa(&event->ip_info.ip, ip_address, sizeof(ip_address));
+        this_->ip_address_ = ip_address;
+        ESP_LOGI(TAG, "Got IP: %s", ip_address);
+        this_->network_ready_ = true;
+        xEventGroupSetBits(this_->event_group_, PPP_EVENT_GOT_IP);
+        if (this_->on_network_state_changed_) {
+            this_->on_network_state_changed_(true);
+        }
+        return;
+    } else if (event_base == IP_EVENT && event_id == IP_EVENT_PPP_LOST_IP) {
+        lost = true;
+    } else if (event_base == NETIF_PPP_STATUS && event_id > NETIF_PPP_ERRORNONE && event_id < NETIF_PP_PHASE_OFFSET) {
+        ESP_LOGW(TAG, "PPP error %d", (int)event_id);
+        lost = true;
+    }
+
+    if (lost) {
+        xEventGroupClearBits(this_->event_group_, PPP_EVENT_GOT_IP);
+        xEventGroupSetBits(this_->event_group_, PPP_EVENT_LOST);
+        if (this_->network_ready_.exchange(false) && this_->on_network_state_changed_) {
+            this_->on_network_state_changed_(false);
+        }
+    }
+}
+
+#endif // CONFIG_ML307_PPP_MODE
@@ -0,0 +1,91 @@
+#ifndef PPP_MODEM_H
+#define PPP_MODEM_H
+
+#include <string>
+#include <functional>
+#include <atomic>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/queue.h>
+#include <driver/gpio.h>
+#include <driver/uart.h>
+#include <esp_netif.h>
+#include <esp_event.h>
+#include <at_modem.h>
+
+#include "tls_session_network.h"
+
+/*
+ * 4G modem in PPP data mode: after registration the modem is dialed with ATD*99# and lwIP runs PPPoS
+ * over the UART, so TCP, TLS, UDP and MQTT are native sockets (the same EspNetwork as on WiFi) instead
+ * of AT command sockets with hex framing and a prompt round trip per packet.
+ *
+ * The UART is owned here from the start, AtUart cannot hand its port over to a data stream. The AT
+ * phase only does what the link needs: baud rate, SIM, registration, module info and dialing. Signal
+ * quality and carrier are read before dialing and stay at those values while the link is up, there is
+ * no AT channel in data mode. When the PPP link drops, the task escapes to command mode and redials.
+ */
+class PppModem {
+public:
+    PppModem(gpio_num_t tx_pin, gpio_num_t rx_pin, gpio_num_t dtr_pin = GPIO_NUM_NC, int baud_rate = 921600);
+    ~PppModem();
+
+    // Detects the modem and waits for network registration, the result follows AtModem
+    NetworkStatus WaitForNetworkReady(int timeout_ms = -1);
+    // Dials and starts the PPP task, returns once the link has an IP address or timeout
+    bool Connect(int timeout_ms = 30000);
+    void OnNetworkStateChanged(std::function<void(bool network_ready)> callback) { on_network_state_changed_ = callback; }
+
+    NetworkInterface* network() { return &network_; }
+    bool network_ready() const { return network_ready_; }
+    const std::string& imei() const { return imei_; }
+    const std::string& iccid() const { return iccid_; }
+    const std::string& module_revision() const { return module_revision_; }
+    const std::string& carrier_name() const { return carrier_name_; }
+    const std::string& ip_address() const { return ip_address_; }
+    // 拨号前读到的 CSQ，-1 表示未知
+    int csq() const { return csq_; }
+
+private:
+    struct Driver {
+        esp_netif_driver_base_t base;
+        PppModem* modem;
+    };
+
+    gpio_num_t tx_pin_;
+    gpio_num_t rx_pin_;
+    gpio_num_t dtr_pin_;
+    int baud_rate_;
+    bool uart_installed_ = false;
+    QueueHandle_t uart_queue_ = nullptr;
+    esp_netif_t* netif_ = nullptr;
+    Driver driver_ = {};
+    esp_event_handler_instance_t ip_event_handler_ = nullptr;
+    EventGroupHandle_t event_group_ = nullptr;
+    TaskHandle_t task_ = nullptr;
+    std::atomic<bool> data_mode_ = false;
+    std::atomic<bool> network_ready_ = false;
+    TlsSessionNetwork network_;
+    std::function<void(bool network_ready)> on_network_state_changed_;
+
+    std::string imei_;
+    std::string iccid_;
+    std::string module_revision_;
+    std::string carrier_name_;
+    std::string ip_address_;
+    int csq_ = -1;
+
+    bool Command(const std::string& command, std::string* response = nullptr, int timeout_ms = 1000, const char* expect = "OK");
+    bool DetectBaudRate();
+    void ReadModemInfo();
+    bool Dial();
+    void HangUp();
+    void ReceiveData(uint8_t* buffer);
+    void PppTask();
+    static esp_err_t Transmit(void* handle, void* buffer, size_t length);
+    static esp_err_t PostAttach(esp_netif_t* netif, void* args);
+    static void IpEventHandler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
+};
+
+#endif // PPP_MODEM_H
@@ -2,6 +2,8 @@
 #include "application.h"
 #include "board.h"
 #include "display.h"
+#include "tick_service.h"
+#include "warm_boot.h"
 
 #include <esp_log.h>
 #include <esp_sleep.h>
@@ -12,32 +14,23 @@
 
 SleepTimer::SleepTimer(int seconds_to_light_sleep, int seconds_to_deep_sleep)
     : seconds_to_light_sleep_(seconds_to_light_sleep), seconds_to_deep_sleep_(seconds_to_deep_sleep) {
-    esp_timer_create_args_t timer_args = {
-        .callback = [](void* arg) {
-            auto self = static_cast<SleepTimer*>(arg);
-            self->CheckTimer();
-        },
-        .arg = this,
-        .dispatch_method = ESP_TIMER_TASK,
-        .name = "sleep_timer",
-        .skip_unhandled_events = true,
-    };
-    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &sleep_timer_));
+    tick_id_ = TickService::GetInstance().Add("sleep", 1000, 200, [this]() {
+        CheckTimer();
+    }, false);
 }
 
 SleepTimer::~SleepTimer() {
-    esp_timer_stop(sleep_timer_);
-    esp_timer_delete(sleep_timer_);
+    TickService::GetInstance().Remove(tick_id_);
 }
 
 void SleepTimer::SetEnabled(bool enabled) {
     if (enabled && !enabled_) {
         ticks_ = 0;
         enabled_ = enabled;
-        ESP_ERROR_CHECK(esp_timer_start_periodic(sleep_timer_, 1000000));
+        TickService::GetInstance().SetEnabled(tick_id_, true);
         ESP_LOGI(TAG, "Sleep timer enabled");
     } else if (!enabled && enabled_) {
-        ESP_ERROR_CHECK(esp_timer_stop(sleep_timer_));
+        TickService::GetInstance().SetEnabled(tick_id_, false);
         enabled_ = enabled;
         WakeUp();
         ESP_LOGI(TAG, "Sleep timer disabled");
@@ -111,7 +104,9 @@ void SleepTimer::CheckTimer() {
             on_enter_deep_sleep_mode_();
         }
 
-        esp_deep_sleep_start();
+        // 唤醒后走热启动，跳过提示音和版本检查
+        WarmBoot::GetInstance().Save();
+        Board::EnterDeepSleep();
     }
 }
 
@@ -19,7 +19,7 @@ public:
 private:
     void CheckTimer();
 
-    esp_timer_handle_t sleep_timer_ = nullptr;
+    int tick_id_ = 0;
     bool enabled_ = false;
     int ticks_ = 0;
     int seconds_to_light_sleep_;
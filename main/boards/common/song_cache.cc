@@ -0,0 +1,532 @@
+#include "song_cache.h"
+
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+#include <esp_spiffs.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <algorithm>
+#include <cstring>
+
+#define TAG "SongCache"
+
+#define SONG_CACHE_INDEX_MAGIC 0x48435353  // "SSCH"
+#define SONG_CACHE_INDEX_VERSION 1
+
+#ifdef CONFIG_SONG_CACHE
+#define SONG_CACHE_CAPACITY (CONFIG_SONG_CACHE_SIZE_KB * 1024)
+#define SONG_CACHE_MAX_ENTRIES CONFIG_SONG_CACHE_MAX_ENTRIES
+#else
+#define SONG_CACHE_CAPACITY 0
+#define SONG_CACHE_MAX_ENTRIES 0
+#endif
+
+struct SongCacheIndexHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint32_t next_file_id;
+    uint32_t use_counter;
+};
+
+// 命中时从本地文件读取，读完时校验CRC
+class CachedFileSource : public StreamSource {
+public:
+    CachedFileSource(const std::string& path, uint64_t key_hash, uint32_t size, uint32_t crc32)
+        : path_(path), key_hash_(key_hash), size_(size), crc32_(crc32) {}
+    ~CachedFileSource() { Close(); }
+
+    int Open() override {
+        file_ = fopen(path_.c_str(), "rb");
+        if (file_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to open cached file: %s", path_.c_str());
+            SongCache::GetInstance().OnCorrupted(key_hash_);
+            return 0;
+        }
+        ESP_LOGI(TAG, "Playing from cache: %s, %u bytes", path_.c_str(), (unsigned int)size_);
+        return 200;
+    }
+
+    int OpenAt(size_t offset) override {
+        if (offset > size_) {
+            return 416;
+        }
+        if (file_ == nullptr && Open() != 200) {
+            return 0;
+        }
+        if (fseek(file_, offset, SEEK_SET) != 0) {
+            return 0;
+        }
+        // 只在完整顺序读取时校验CRC
+        verified_ = offset != 0;
+        crc_ = 0;
+        read_ = 0;
+        return 206;
+    }
+
+    int Read(uint8_t* buffer, size_t size) override {
+        if (file_ == nullptr) {
+            return -1;
+        }
+        size_t n = fread(buffer, 1, size, file_);
+        if (n > 0) {
+            crc_ = esp_rom_crc32_le(crc_, buffer, n);
+            read_ += n;
+        } else if (!verified_) {
+            verified_ = true;
+            if (read_ != size_ || crc_ != crc32_) {
+                // 这次已经播放了，下次重新下载
+                ESP_LOGE(TAG, "Cached file corrupted: %s, size %u/%u, crc %08lx/%08lx", path_.c_str(),
+                         (unsigned int)read_, (unsigned int)size_, (unsigned long)crc_, (unsigned long)crc32_);
+                SongCache::GetInstance().OnCorrupted(key_hash_);
+            }
+        }
+        return n;
+    }
+
+    void Close() override {
+        if (file_ != nullptr) {
+            fclose(file_);
+            file_ = nullptr;
+        }
+    }
+
+    size_t length() const override { return size_; }
+
+private:
+    std::string path_;
+    uint64_t key_hash_;
+    uint32_t size_;
+    uint32_t crc32_;
+    FILE* file_ = nullptr;
+    uint32_t crc_ = 0;
+    size_t read_ = 0;
+    bool verified_ = false;
+};
+
+// 未命中时透传网络数据，同时写入临时文件，完整结束后才提交
+class CacheWriteSource : public StreamSource {
+public:
+    CacheWriteSource(uint64_t key_hash, std::unique_ptr<StreamSource> source)
+        : key_hash_(key_hash), source_(std::move(source)) {}
+    ~CacheWriteSource() { Close(); }
+
+    int Open() override {
+        int status_code = source_->Open();
+        if (status_code == 200 || status_code == 206) {
+            expected_ = source_->length();
+            auto& cache = SongCache::GetInstance();
+            if (expected_ == 0 || cache.ReserveWrite(expected_)) {
+                file_ = cache.BeginWrite();
+            }
+        }
+        return status_code;
+    }
+
+    // 在已写入的位置续传时继续缓存，拖动到其他位置则放弃缓存
+    int OpenAt(size_t offset) override {
+        if (file_ != nullptr && offset != size_) {
+            Abandon("seek");
+        }
+        return source_->OpenAt(offset);
+    }
+
+    int Read(uint8_t* buffer, size_t size) override {
+        int n = source_->Read(buffer, size);
+        if (file_ == nullptr) {
+            return n;
+        }
+        if (n < 0) {
+            Abandon("read error");
+        } else if (n == 0) {
+            // 首字节之前的0字节表示还在等待，之后表示流结束
+            if (size_ > 0) {
+                complete_ = true;
+            }
+        } else if (expected_ == 0 && !SongCache::GetInstance().ReserveWrite(size_ + n)) {
+            Abandon("cache full");
+        } else if (fwrite(buffer, 1, n, file_) != (size_t)n) {
+            Abandon("write failed");
+        } else {
+            crc_ = esp_rom_crc32_le(crc_, buffer, n);
+            size_ += n;
+        }
+        return n;
+    }
+
+    void Close() override {
+        source_->Close();
+        if (file_ == nullptr) {
+            return;
+        }
+        fclose(file_);
+        file_ = nullptr;
+        auto& cache = SongCache::GetInstance();
+        if (complete_ && (expected_ == 0 || size_ == expected_)) {
+            cache.CommitWrite(key_hash_, size_, crc_);
+        } else {
+            ESP_LOGI(TAG, "Stream not complete (%u/%u bytes), not cached", (unsigned int)size_, (unsigned int)expected_);
+            cache.AbortWrite();
+        }
+    }
+
+    size_t length() const override { return source_->length(); }
+
+private:
+    void Abandon(const char* reason) {
+        ESP_LOGW(TAG, "Stop caching: %s", reason);
+        fclose(file_);
+        file_ = nullptr;
+        SongCache::GetInstance().AbortWrite();
+    }
+
+    uint64_t key_hash_;
+    std::unique_ptr<StreamSource> source_;
+    FILE* file_ = nullptr;
+    size_t expected_ = 0;
+    size_t size_ = 0;
+    uint32_t crc_ = 0;
+    bool complete_ = false;
+};
+
+uint64_t SongCache::Hash(const std::string& key) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::string SongCache::PathLocked(uint32_t file_id) const {
+    char name[16];
+    snprintf(name, sizeof(name), "/%08lx.dat", (unsigned long)file_id);
+    return base_path_ + name;
+}
+
+bool SongCache::EnsureMountedLocked() {
+#ifdef CONFIG_SONG_CACHE
+    if (mounted_ || mount_failed_) {
+        return mounted_;
+    }
+    base_path_ = CONFIG_SONG_CACHE_BASE_PATH;
+    capacity_ = SONG_CACHE_CAPACITY;
+
+    // 分区名为空时由板子负责挂载（例如SD卡），这里只使用该路径
+    const char* partition = CONFIG_SONG_CACHE_PARTITION;
+    if (partition[0] != '\0') {
+        esp_vfs_spiffs_conf_t conf = {
+            .base_path = base_path_.c_str(),
+            .partition_label = partition,
+            .max_files = 4,
+            .format_if_mount_failed = true,
+        };
+        esp_err_t ret = esp_vfs_spiffs_register(&conf);
+        if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
+            ESP_LOGE(TAG, "Failed to mount partition %s: %s", partition, esp_err_to_name(ret));
+            mount_failed_ = true;
+            return false;
+        }
+        // SPIFFS 接近写满时垃圾回收很慢，只使用85%
+        size_t total = 0, used = 0;
+        if (esp_spiffs_info(partition, &total, &used) == ESP_OK) {
+            capacity_ = std::min(capacity_, total * 85 / 100);
+        }
+    } else {
+        struct stat st;
+        if (stat(base_path_.c_str(), &st) != 0) {
+            ESP_LOGE(TAG, "Cache path %s is not mounted", base_path_.c_str());
+            mount_failed_ = true;
+            return false;
+        }
+    }
+
+    mounted_ = true;
+    LoadIndexLocked();
+    ESP_LOGI(TAG, "Song cache at %s: %u entries, %u/%u KB", base_path_.c_str(), (unsigned int)entries_.size(),
+             (unsigned int)(used_bytes_ / 1024), (unsigned int)(capacity_ / 1024));
+    return true;
+#else
+    return false;
+#endif
+}
+
+void SongCache::LoadIndexLocked() {
+    entries_.clear();
+    used_bytes_ = 0;
+
+    std::string index_path = base_path_ + "/index.bin";
+    FILE* file = fopen(index_path.c_str(), "rb");
+    if (file != nullptr) {
+        SongCacheIndexHeader header;
+        if (fread(&header, sizeof(header), 1, file) == 1 && header.magic == SONG_CACHE_INDEX_MAGIC &&
+            header.version == SONG_CACHE_INDEX_VERSION) {
+            entries_.resize(header.count);
+            if (fread(entries_.data(), sizeof(Entry), header.count, file) != header.count) {
+                ESP_LOGW(TAG, "Index truncated, dropping it");
+                entries_.clear();
+            }
+            next_file_id_ = header.next_file_id;
+            use_counter_ = header.use_counter;
+        }
+        fclose(file);
+    }
+
+    // 删除索引中没有的文件（断电时的临时文件等），并丢掉文件已丢失的条目
+    std::vector<bool> found(entries_.size(), false);
+    DIR* dir = opendir(base_path_.c_str());
+    if (dir != nullptr) {
+        struct dirent* ent;
+        while ((ent = readdir(dir)) != nullptr) {
+            if (strcmp(ent->d_name, "index.bin") == 0) {
+                continue;
+            }
+            unsigned long file_id = 0;
+            bool known = false;
+            if (sscanf(ent->d_name, "%08lx.dat", &file_id) == 1) {
+                for (size_t i = 0; i < entries_.size(); i++) {
+                    if (entries_[i].file_id == file_id) {
+                        found[i] = true;
+                        known = true;
+                    }
+                }
+            }
+            if (!known) {
+                std::string path = base_path_ + "/" + ent->d_name;
+                ESP_LOGI(TAG, "Removing stale file: %s", path.c_str());
+                remove(path.c_str());
+            }
+        }
+        closedir(dir);
+    }
+    for (size_t i = entries_.size(); i-- > 0;) {
+        if (!found[i]) {
+            entries_.erase(entries_.begin() + i);
+        } else {
+            used_bytes_ += entries_[i].size;
+        }
+    }
+    SaveIndexLocked();
+}
+
+void SongCache::SaveIndexLocked() {
+    std::string index_path = base_path_ + "/index.bin";
+    FILE* file = fopen(index_path.c_str(), "wb");
+    if (file == nullptr) {
+        ESP_LOGE(TAG, "Failed to write index");
+        return;
+    }
+    SongCacheIndexHeader header = {
+        .magic = SONG_CACHE_INDEX_MAGIC,
+        .version = SONG_CACHE_INDEX_VERSION,
+        .count = (uint16_t)entries_.size(),
+        .next_file_id = next_file_id_,
+        .use_counter = use_counter_,
+    };
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(entries_.data(), sizeof(Entry), entries_.size(), file);
+    fclose(file);
+}
+
+void SongCache::RemoveEntryLocked(size_t index) {
+    remove(PathLocked(entries_[index].file_id).c_str());
+    used_bytes_ -= entries_[index].size;
+    entries_.erase(entries_.begin() + index);
+}
+
+bool SongCache::ReserveLocked(size_t bytes) {
+    if (bytes > capacity_) {
+        return false;
+    }
+    // 按最近使用时间淘汰，直到空间和条目数都够用
+    bool changed = false;
+    while (!entries_.empty() && (used_bytes_ + bytes > capacity_ || entries_.size() >= SONG_CACHE_MAX_ENTRIES)) {
+        auto oldest = std::min_element(entries_.begin(), entries_.end(), [](const Entry& a, const Entry& b) {
+            return a.last_used < b.last_used;
+        });
+        ESP_LOGI(TAG, "Evicting %08lx.dat, %u bytes", (unsigned long)oldest->file_id, (unsigned int)oldest->size);
+        RemoveEntryLocked(oldest - entries_.begin());
+        changed = true;
+    }
+    if (changed) {
+        SaveIndexLocked();
+    }
+    return true;
+}
+
+std::unique_ptr<StreamSource> SongCache::Open(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!EnsureMountedLocked()) {
+        return nullptr;
+    }
+    uint64_t key_hash = Hash(key);
+    for (size_t i = 0; i < entries_.size(); i++) {
+        auto& entry = entries_[i];
+        if (entry.key_hash != key_hash) {
+            continue;
+        }
+        std::string path = PathLocked(entry.file_id);
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || (size_t)st.st_size != entry.size) {
+            ESP_LOGW(TAG, "Cached file missing or truncated: %s", path.c_str());
+            RemoveEntryLocked(i);
+            SaveIndexLocked();
+            return nullptr;
+        }
+        entry.last_used = ++use_counter_;
+        SaveIndexLocked();
+        return std::make_unique<CachedFileSource>(path, key_hash, entry.size, entry.crc32);
+    }
+    return nullptr;
+}
+
+std::unique_ptr<StreamSource> SongCache::Wrap(const std::string& key, std::unique_ptr<StreamSource> source) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!EnsureMountedLocked()) {
+        return source;
+    }
+    return std::make_unique<CacheWriteSource>(Hash(key), std::move(source));
+}
+
+bool SongCache::Put(const std::string& key, const uint8_t* data, size_t size) {
+    uint32_t file_id;
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!EnsureMountedLocked() || !ReserveLocked(size)) {
+            return false;
+        }
+        file_id = next_file_id_++;
+        path = PathLocked(file_id);
+    }
+    // 写文件时不持有锁，不影响正在缓存的歌曲
+    FILE* file = fopen(path.c_str(), "wb");
+    bool ok = file != nullptr && fwrite(data, 1, size, file) == size;
+    if (file != nullptr) {
+        ok = fclose(file) == 0 && ok;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to write %s", path.c_str());
+        remove(path.c_str());
+        return false;
+    }
+    AddEntryLocked(Hash(key), file_id, size, esp_rom_crc32_le(0, data, size));
+    return true;
+}
+
+bool SongCache::Get(const std::string& key, uint8_t* data, size_t size) {
+    std::string path;
+    uint64_t key_hash = Hash(key);
+    uint32_t crc32 = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!EnsureMountedLocked()) {
+            return false;
+        }
+        auto it = std::find_if(entries_.begin(), entries_.end(), [key_hash](const Entry& entry) {
+            return entry.key_hash == key_hash;
+        });
+        if (it == entries_.end() || it->size != size) {
+            return false;
+        }
+        it->last_used = ++use_counter_;
+        SaveIndexLocked();
+        path = PathLocked(it->file_id);
+        crc32 = it->crc32;
+    }
+    FILE* file = fopen(path.c_str(), "rb");
+    bool ok = file != nullptr && fread(data, 1, size, file) == size && esp_rom_crc32_le(0, data, size) == crc32;
+    if (file != nullptr) {
+        fclose(file);
+    }
+    if (!ok) {
+        ESP_LOGE(TAG, "Cached file missing or corrupted: %s", path.c_str());
+        OnCorrupted(key_hash);
+    }
+    return ok;
+}
+
+FILE* SongCache::BeginWrite() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (writing_) {
+        ESP_LOGW(TAG, "Another song is being cached");
+        return nullptr;
+    }
+    // 文件编号在开始写入时分配，写入过程中 Put() 可以使用后面的编号
+    write_file_id_ = next_file_id_++;
+    FILE* file = fopen(PathLocked(write_file_id_).c_str(), "wb");
+    if (file == nullptr) {
+        ESP_LOGE(TAG, "Failed to create cache file");
+        return nullptr;
+    }
+    writing_ = true;
+    return file;
+}
+
+bool SongCache::ReserveWrite(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ReserveLocked(bytes);
+}
+
+void SongCache::CommitWrite(uint64_t key_hash, uint32_t size, uint32_t crc32) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    writing_ = false;
+    AddEntryLocked(key_hash, write_file_id_, size, crc32);
+}
+
+void SongCache::AddEntryLocked(uint64_t key_hash, uint32_t file_id, uint32_t size, uint32_t crc32) {
+    for (size_t i = 0; i < entries_.size(); i++) {
+        if (entries_[i].key_hash == key_hash) {
+            RemoveEntryLocked(i);
+            break;
+        }
+    }
+    if (!ReserveLocked(size)) {
+        remove(PathLocked(file_id).c_str());
+        return;
+    }
+    Entry entry = {
+        .key_hash = key_hash,
+        .file_id = file_id,
+        .size = size,
+        .crc32 = crc32,
+        .last_used = ++use_counter_,
+    };
+    entries_.push_back(entry);
+    used_bytes_ += size;
+    SaveIndexLocked();
+    ESP_LOGI(TAG, "Cached %08lx.dat, %u bytes, crc %08lx, total %u KB", (unsigned long)entry.file_id,
+             (unsigned int)size, (unsigned long)crc32, (unsigned int)(used_bytes_ / 1024));
+}
+
+void SongCache::AbortWrite() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    writing_ = false;
+    remove(PathLocked(write_file_id_).c_str());
+}
+
+void SongCache::OnCorrupted(uint64_t key_hash) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < entries_.size(); i++) {
+        if (entries_[i].key_hash == key_hash) {
+            RemoveEntryLocked(i);
+            SaveIndexLocked();
+            return;
+        }
+    }
+}
+
+size_t SongCache::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!EnsureMountedLocked()) {
+        return 0;
+    }
+    size_t count = entries_.size();
+    while (!entries_.empty()) {
+        RemoveEntryLocked(entries_.size() - 1);
+    }
+    SaveIndexLocked();
+    return count;
+}
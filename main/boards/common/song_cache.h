@@ -0,0 +1,87 @@
+#ifndef SONG_CACHE_H
+#define SONG_CACHE_H
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+
+#include "stream_player.h"
+
+/*
+ * LRU cache of fully downloaded songs on a spare SPIFFS partition or an SD card mounted by the board.
+ *
+ * Songs are keyed by a caller-chosen string (sing song ID, resolved music URL) and stored as one file
+ * each, with a small binary index holding the size, CRC32 and last-use stamp of every entry. A stream
+ * that misses is teed into a temp file while it plays and only committed once it ended cleanly with the
+ * expected length; a hit plays from the file and drops the entry if its CRC no longer matches.
+ * All methods fall back to the network path when the cache is disabled or failed to mount.
+ */
+class SongCache {
+public:
+    static SongCache& GetInstance() {
+        static SongCache instance;
+        return instance;
+    }
+    SongCache(const SongCache&) = delete;
+    SongCache& operator=(const SongCache&) = delete;
+
+    // 命中时返回读取本地文件的数据源，否则返回空
+    std::unique_ptr<StreamSource> Open(const std::string& key);
+    // 未命中时包装网络数据源，边播放边写入缓存
+    std::unique_ptr<StreamSource> Wrap(const std::string& key, std::unique_ptr<StreamSource> source);
+
+    // 整块存取小文件（解码后的封面等），和歌曲共用容量和淘汰顺序；Get 的 size 必须和存入时一致
+    bool Put(const std::string& key, const uint8_t* data, size_t size);
+    bool Get(const std::string& key, uint8_t* data, size_t size);
+
+    // 返回删除的歌曲数
+    size_t Clear();
+
+private:
+    friend class CachedFileSource;
+    friend class CacheWriteSource;
+
+    struct Entry {
+        uint64_t key_hash;
+        uint32_t file_id;
+        uint32_t size;
+        uint32_t crc32;
+        uint32_t last_used;
+    };
+
+    SongCache() = default;
+
+    bool EnsureMountedLocked();
+    void LoadIndexLocked();
+    void SaveIndexLocked();
+    void RemoveEntryLocked(size_t index);
+    void AddEntryLocked(uint64_t key_hash, uint32_t file_id, uint32_t size, uint32_t crc32);
+    bool ReserveLocked(size_t bytes);
+    std::string PathLocked(uint32_t file_id) const;
+
+    // 写入临时文件，成功后提交为缓存条目
+    FILE* BeginWrite();
+    bool ReserveWrite(size_t bytes);
+    void CommitWrite(uint64_t key_hash, uint32_t size, uint32_t crc32);
+    void AbortWrite();
+    void OnCorrupted(uint64_t key_hash);
+
+    static uint64_t Hash(const std::string& key);
+
+    std::mutex mutex_;
+    bool mounted_ = false;
+    bool mount_failed_ = false;
+    std::string base_path_;
+    size_t capacity_ = 0;
+    size_t used_bytes_ = 0;
+    uint32_t next_file_id_ = 1;
+    uint32_t write_file_id_ = 0;
+    uint32_t use_counter_ = 0;
+    std::vector<Entry> entries_;
+    bool writing_ = false;
+};
+
+#endif // SONG_CACHE_H
@@ -0,0 +1,152 @@
+#include "song_lookup_cache.h"
+#include "settings.h"
+
+#include <esp_log.h>
+#include <cJSON.h>
+#include <ctime>
+
+#define TAG "SongLookupCache"
+
+#define SONG_LOOKUP_MAX_ENTRIES 8
+
+bool SongLookupCache::Get(const std::string& song_name, const std::string& artist_name, ResolvedSong* song) {
+#if CONFIG_MUSIC_LOOKUP_CACHE_TTL_HOURS > 0
+    int64_t now = Now();
+    if (now == 0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    LoadLocked();
+    auto key = Key(song_name, artist_name);
+    for (size_t i = 0; i < entries_.size(); i++) {
+        if (entries_[i].key != key) {
+            continue;
+        }
+        if (now - entries_[i].stored_at >= CONFIG_MUSIC_LOOKUP_CACHE_TTL_HOURS * 3600LL || now < entries_[i].stored_at) {
+            ESP_LOGI(TAG, "Expired: %s", song_name.c_str());
+            entries_.erase(entries_.begin() + i);
+            SaveLocked();
+            return false;
+        }
+        *song = entries_[i].song;
+        // 只在内存中调整顺序，不为一次命中写 NVS
+        if (i > 0) {
+            auto entry = std::move(entries_[i]);
+            entries_.erase(entries_.begin() + i);
+            entries_.insert(entries_.begin(), std::move(entry));
+        }
+        return true;
+    }
+#endif
+    return false;
+}
+
+void SongLookupCache::Put(const std::string& song_name, const std::string& artist_name, const ResolvedSong& song) {
+#if CONFIG_MUSIC_LOOKUP_CACHE_TTL_HOURS > 0
+    int64_t now = Now();
+    if (now == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    LoadLocked();
+    auto key = Key(song_name, artist_name);
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        if (it->key == key) {
+            entries_.erase(it);
+            break;
+        }
+    }
+    entries_.insert(entries_.begin(), Entry{key, song, now});
+    if (entries_.size() > SONG_LOOKUP_MAX_ENTRIES) {
+        entries_.resize(SONG_LOOKUP_MAX_ENTRIES);
+    }
+    SaveLocked();
+#endif
+}
+
+void SongLookupCache::RemoveAudioUrl(const std::string& audio_url) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    LoadLocked();
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        if (it->song.audio_url == audio_url) {
+            entries_.erase(it);
+            SaveLocked();
+            return;
+        }
+    }
+}
+
+void SongLookupCache::LoadLocked() {
+    if (loaded_) {
+        return;
+    }
+    loaded_ = true;
+    Settings settings("song_lookup");
+    for (int i = 0; i < SONG_LOOKUP_MAX_ENTRIES; i++) {
+        auto value = settings.GetString("e" + std::to_string(i));
+        if (value.empty()) {
+            break;
+        }
+        cJSON* root = cJSON_Parse(value.c_str());
+        if (root == nullptr) {
+            continue;
+        }
+        cJSON* key = cJSON_GetObjectItem(root, "k");
+        cJSON* audio_url = cJSON_GetObjectItem(root, "a");
+        cJSON* lyric_url = cJSON_GetObjectItem(root, "l");
+        cJSON* duration = cJSON_GetObjectItem(root, "d");
+        cJSON* stored_at = cJSON_GetObjectItem(root, "t");
+        if (cJSON_IsString(key) && cJSON_IsString(audio_url) && cJSON_IsNumber(stored_at)) {
+            Entry entry;
+            entry.key = key->valuestring;
+            entry.song.audio_url = audio_url->valuestring;
+            if (cJSON_IsString(lyric_url)) {
+                entry.song.lyric_url = lyric_url->valuestring;
+            }
+            if (cJSON_IsNumber(duration)) {
+                entry.song.duration_s = duration->valueint;
+            }
+            entry.stored_at = (int64_t)stored_at->valuedouble;
+            entries_.push_back(std::move(entry));
+        }
+        cJSON_Delete(root);
+    }
+    ESP_LOGI(TAG, "Loaded %u cached lookups", (unsigned int)entries_.size());
+}
+
+void SongLookupCache::SaveLocked() {
+    Settings settings("song_lookup", true);
+    for (int i = 0; i < SONG_LOOKUP_MAX_ENTRIES; i++) {
+        auto key = "e" + std::to_string(i);
+        if (i >= (int)entries_.size()) {
+            settings.EraseKey(key);
+            continue;
+        }
+        const auto& entry = entries_[i];
+        cJSON* root = cJSON_CreateObject();
+        cJSON_AddStringToObject(root, "k", entry.key.c_str());
+        cJSON_AddStringToObject(root, "a", entry.song.audio_url.c_str());
+        cJSON_AddStringToObject(root, "l", entry.song.lyric_url.c_str());
+        cJSON_AddNumberToObject(root, "d", entry.song.duration_s);
+        cJSON_AddNumberToObject(root, "t", (double)entry.stored_at);
+        char* json = cJSON_PrintUnformatted(root);
+        settings.SetString(key, json);
+        cJSON_free(json);
+        cJSON_Delete(root);
+    }
+}
+
+std::string SongLookupCache::Key(const std::string& song_name, const std::string& artist_name) {
+    return song_name + "\n" + artist_name;
+}
+
+// 墙上时间还没有同步时返回 0
+int64_t SongLookupCache::Now() {
+    time_t now = time(nullptr);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    if (tm.tm_year < 2025 - 1900) {
+        return 0;
+    }
+    return now;
+}
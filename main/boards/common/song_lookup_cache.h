@@ -0,0 +1,55 @@
+#ifndef SONG_LOOKUP_CACHE_H
+#define SONG_LOOKUP_CACHE_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+
+struct ResolvedSong {
+    std::string audio_url;
+    std::string lyric_url;
+    int duration_s = 0;     // 0: 接口没有返回
+};
+
+/*
+ * Small LRU of music search results, (song, artist) -> resolved audio / lyric URL, kept in RAM and in the
+ * "song_lookup" NVS namespace so "play it again" skips the /stream_pcm round trip, also after a reboot.
+ * Entries expire after CONFIG_MUSIC_LOOKUP_CACHE_TTL_HOURS of wall clock time; without a valid clock
+ * (no server time yet) every lookup misses and nothing is stored.
+ */
+class SongLookupCache {
+public:
+    static SongLookupCache& GetInstance() {
+        static SongLookupCache instance;
+        return instance;
+    }
+    SongLookupCache(const SongLookupCache&) = delete;
+    SongLookupCache& operator=(const SongLookupCache&) = delete;
+
+    bool Get(const std::string& song_name, const std::string& artist_name, ResolvedSong* song);
+    void Put(const std::string& song_name, const std::string& artist_name, const ResolvedSong& song);
+    // 音频打不开时删除对应的条目，下次重新搜索
+    void RemoveAudioUrl(const std::string& audio_url);
+
+private:
+    struct Entry {
+        std::string key;
+        ResolvedSong song;
+        int64_t stored_at = 0;
+    };
+
+    SongLookupCache() = default;
+    void LoadLocked();
+    void SaveLocked();
+
+    static std::string Key(const std::string& song_name, const std::string& artist_name);
+    static int64_t Now();
+
+    std::mutex mutex_;
+    bool loaded_ = false;
+    // 最近使用的在前
+    std::vector<Entry> entries_;
+};
+
+#endif // SONG_LOOKUP_CACHE_H
@@ -0,0 +1,1406 @@
+#include "stream_player.h"
+#include "board.h"
+#include "system_info.h"
+#include "audio/audio_codec.h"
+#include "audio/audio_dsp.h"
+#include "audio/cache_profiler.h"
+#include "application.h"
+#include "network_monitor.h"
+#include "black_box.h"
+#include "hot_log.h"
+#include "task_stack.h"
+
+#include <esp_log.h>
+#include <esp_pthread.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <mbedtls/sha256.h>
+#include <cJSON.h>
+#include <cstring>
+#include <algorithm>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define TAG "StreamPlayer"
+
+// 每播放这么长的音频更新一次解码负载
+#define STREAM_DECODE_STATS_WINDOW_US (2 * 1000 * 1000)
+
+// ========== 简单的ESP32认证函数 ==========
+
+// 密钥（请修改为与服务端一致）
+#define STREAM_AUTH_SECRET_KEY ":your-esp32-secret-key-2024"
+
+/*
+ * 动态密钥 = SHA256("MAC:芯片ID:时间戳:密钥") 前16字节的大写十六进制，与服务端约定，不能换成 HMAC。
+ * MAC 和芯片ID 启动后不变，第一次使用时算好并把 "MAC:芯片ID:" 预先处理进 SHA256 上下文，
+ * 每次请求只复制上下文、处理时间戳和密钥，结果写到固定缓冲区
+ */
+struct StreamAuthIdentity {
+    std::string mac;
+    std::string chip_id;    // MAC 去掉冒号
+    mbedtls_sha256_context prefix;
+
+    StreamAuthIdentity() : mac(SystemInfo::GetMacAddress()), chip_id(mac) {
+        chip_id.erase(std::remove(chip_id.begin(), chip_id.end(), ':'), chip_id.end());
+        mbedtls_sha256_init(&prefix);
+        mbedtls_sha256_starts(&prefix, 0);
+        mbedtls_sha256_update(&prefix, (const unsigned char*)mac.data(), mac.size());
+        mbedtls_sha256_update(&prefix, (const unsigned char*)":", 1);
+        mbedtls_sha256_update(&prefix, (const unsigned char*)chip_id.data(), chip_id.size());
+        mbedtls_sha256_update(&prefix, (const unsigned char*)":", 1);
+    }
+
+    static const StreamAuthIdentity& Get() {
+        static StreamAuthIdentity identity;
+        return identity;
+    }
+
+    // key 至少 33 字节
+    void DynamicKey(const char* timestamp, size_t timestamp_length, char* key) const {
+        static const char kHex[] = "0123456789ABCDEF";
+        mbedtls_sha256_context context;
+        mbedtls_sha256_init(&context);
+        mbedtls_sha256_clone(&context, &prefix);
+        mbedtls_sha256_update(&context, (const unsigned char*)timestamp, timestamp_length);
+        mbedtls_sha256_update(&context, (const unsigned char*)STREAM_AUTH_SECRET_KEY, sizeof(STREAM_AUTH_SECRET_KEY) - 1);
+        unsigned char hash[32];
+        mbedtls_sha256_finish(&context, hash);
+        mbedtls_sha256_free(&context);
+        for (int i = 0; i < 16; i++) {
+            key[i * 2] = kHex[hash[i] >> 4];
+            key[i * 2 + 1] = kHex[hash[i] & 0x0F];
+        }
+        key[32] = '\0';
+    }
+};
+
+void AddStreamAuthHeaders(Http* http) {
+    if (!http) {
+        return;
+    }
+    const auto& identity = StreamAuthIdentity::Get();
+    int64_t timestamp = esp_timer_get_time() / 1000000;  // 转换为秒
+    char timestamp_str[24];
+    int timestamp_length = snprintf(timestamp_str, sizeof(timestamp_str), "%lld", timestamp);
+    char key[33];
+    identity.DynamicKey(timestamp_str, timestamp_length, key);
+
+    http->SetHeader("X-MAC-Address", identity.mac);
+    http->SetHeader("MAC", identity.mac);      // sing 服务端优先识别 MAC 或 X-MAC
+    http->SetHeader("X-MAC", identity.mac);
+    http->SetHeader("X-Chip-ID", identity.chip_id);
+    http->SetHeader("X-Timestamp", timestamp_str);
+    http->SetHeader("X-Dynamic-Key", key);
+    HOT_LOGD(TAG, "Added auth headers - MAC: %s, ChipID: %s, Timestamp: %lld",
+             identity.mac.c_str(), identity.chip_id.c_str(), timestamp);
+}
+
+// ========== HttpStreamSource ==========
+
+HttpStreamSource::HttpStreamSource(const std::string& url, const std::string& user_agent) : url_(url) {
+    headers_.emplace_back("User-Agent", user_agent);
+    // 告诉服务端可以直接发送体积更小的 Ogg Opus
+    headers_.emplace_back("Accept", "audio/ogg; codecs=opus, audio/mpeg, audio/wav, */*;q=0.5");
+    headers_.emplace_back("Range", "bytes=0-");  // 支持断点续传
+}
+
+void HttpStreamSource::SetHeader(const std::string& key, const std::string& value) {
+    headers_.emplace_back(key, value);
+}
+
+void HttpStreamSource::SetFormField(const std::string& name, const std::string& value) {
+    form_name_ = name;
+    form_value_ = value;
+}
+
+int HttpStreamSource::OpenAt(size_t offset) {
+    Close();
+    auto network = Board::GetInstance().GetNetwork();
+    http_ = network->CreateHttp(0);
+    for (auto& header : headers_) {
+        if (offset > 0 && header.first == "Range") {
+            continue;
+        }
+        http_->SetHeader(header.first, header.second);
+    }
+    if (offset > 0) {
+        http_->SetHeader("Range", "bytes=" + std::to_string(offset) + "-");
+    }
+    AddStreamAuthHeaders(http_.get());
+
+    const std::string boundary = "----ESP32_SING_BOUNDARY";
+    const char* method = "GET";
+    if (!form_name_.empty()) {
+        method = "POST";
+        http_->SetHeader("Content-Type", "multipart/form-data; boundary=" + boundary);
+        http_->SetHeader("Transfer-Encoding", "chunked");
+    }
+
+    ESP_LOGI(TAG, "Opening HTTP %s: %s, offset %u", method, url_.c_str(), (unsigned int)offset);
+    bool opened = http_->Open(method, url_);
+    for (int i = 0; !opened && i < open_retries_; i++) {
+        ESP_LOGW(TAG, "Open failed, retrying: %s", url_.c_str());
+        vTaskDelay(pdMS_TO_TICKS(500));
+        opened = http_->Open(method, url_);
+    }
+    if (!opened) {
+        ESP_LOGE(TAG, "Failed to connect to: %s", url_.c_str());
+        return 0;
+    }
+    transfer_ = std::make_unique<TransferScope>(kTransferRealtime);
+
+    if (!form_name_.empty()) {
+        std::string field = "--" + boundary + "\r\n";
+        field += "Content-Disposition: form-data; name=\"" + form_name_ + "\"\r\n\r\n";
+        field += form_value_ + "\r\n";
+        field += "--" + boundary + "--\r\n";
+        http_->Write(field.c_str(), field.size());
+        // 结束块
+        http_->Write("", 0);
+    }
+    int status_code = http_->GetStatusCode();
+    // 206时 Content-Length 为剩余长度
+    size_t body_length = http_->GetBodyLength();
+    length_ = body_length > 0 ? offset + body_length : 0;
+    return status_code;
+}
+
+int HttpStreamSource::Read(uint8_t* buffer, size_t size) {
+    int ret = http_->Read((char*)buffer, size);
+    if (ret > 0) {
+        transfer_->Account(ret);
+    }
+    return ret;
+}
+
+void HttpStreamSource::Close() {
+    if (http_) {
+        http_->Close();
+        http_.reset();
+    }
+    transfer_.reset();
+}
+
+// ========== 解码器 ==========
+
+Mp3StreamDecoder::~Mp3StreamDecoder() {
+    if (decoder_ != nullptr) {
+        MP3FreeDecoder(decoder_);
+    }
+}
+
+void Mp3StreamDecoder::Release() {
+    if (decoder_ != nullptr) {
+        MP3FreeDecoder(decoder_);
+        decoder_ = nullptr;
+    }
+}
+
+bool Mp3StreamDecoder::Probe(const uint8_t* data, size_t size, size_t* header_size) {
+    // 解码器在第一次需要时创建，随后一直复用
+    if (decoder_ == nullptr) {
+#if CONFIG_SPIRAM_USE_MALLOC
+        // helix 直接 malloc 七块状态（共约 23KB），低于常驻内部 RAM 门限的几块会占用内部 RAM，创建时临时把门限放开
+        heap_caps_malloc_extmem_enable(0);
+        decoder_ = MP3InitDecoder();
+        heap_caps_malloc_extmem_enable(CONFIG_SPIRAM_MALLOC_ALWAYSINTERNAL);
+#else
+        decoder_ = MP3InitDecoder();
+#endif
+        if (decoder_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to initialize MP3 decoder");
+            return false;
+        }
+    }
+
+    // 跳过ID3v2标签，标签大小为synchsafe integer格式
+    *header_size = 0;
+    if (size >= 10 && memcmp(data, "ID3", 3) == 0) {
+        uint32_t tag_size = ((uint32_t)(data[6] & 0x7F) << 21) |
+                            ((uint32_t)(data[7] & 0x7F) << 14) |
+                            ((uint32_t)(data[8] & 0x7F) << 7)  |
+                            ((uint32_t)(data[9] & 0x7F));
+        *header_size = 10 + tag_size;
+    }
+    return true;
+}
+
+int Mp3StreamDecoder::Decode(const uint8_t* data, size_t size, size_t* consumed, int16_t* pcm, int* sample_rate) {
+    unsigned char* read_ptr = const_cast<unsigned char*>(data);
+    int sync_offset = MP3FindSyncWord(read_ptr, size);
+    if (sync_offset < 0) {
+        HOT_LOGW(TAG, "No MP3 sync word found, skipping %u bytes", (unsigned int)size);
+        *consumed = size;
+        return 0;
+    }
+
+    read_ptr += sync_offset;
+    int bytes_left = size - sync_offset;
+    AUDIO_CACHE_PROFILE_SCOPE(kCacheRegionMp3Decode);
+    int result = MP3Decode(decoder_, &read_ptr, &bytes_left, pcm, 0);
+    if (result != 0) {
+        // 跳过一个字节继续寻找下一帧
+        *consumed = read_ptr - data + 1;
+        return -1;
+    }
+    *consumed = read_ptr - data;
+
+    MP3GetLastFrameInfo(decoder_, &frame_info_);
+    if (frame_info_.samprate == 0 || frame_info_.nChans == 0) {
+        HOT_LOGW(TAG, "Invalid frame info: rate=%d, channels=%d, skipping",
+                frame_info_.samprate, frame_info_.nChans);
+        return 0;
+    }
+
+    int samples = frame_info_.outputSamps;
+    if (frame_info_.nChans == 2) {
+        // 双通道转单通道：将左右声道混合
+        samples /= 2;
+        AudioDsp::DownmixStereo(pcm, pcm, samples);
+    }
+    *sample_rate = frame_info_.samprate;
+    return samples;
+}
+
+bool WavStreamDecoder::Probe(const uint8_t* data, size_t size, size_t* header_size) {
+    if (size < 44 || memcmp(data, "RIFF", 4) != 0 || memcmp(data + 8, "WAVE", 4) != 0) {
+        return false;
+    }
+    channels_ = 1;
+    sample_rate_ = 16000;
+    bits_per_sample_ = 16;
+    is_float_ = false;
+
+    // 查找fmt块和data块，data之后为PCM
+    size_t pos = 12;  // RIFF(12字节)后开始
+    while (pos + 8 <= size) {
+        uint32_t chunk_size;
+        memcpy(&chunk_size, data + pos + 4, sizeof(chunk_size));
+        if (memcmp(data + pos, "fmt ", 4) == 0 && pos + 8 + 16 <= size) {
+            uint16_t audio_format, num_channels, bits_per_sample;
+            uint32_t sample_rate;
+            memcpy(&audio_format, data + pos + 8, sizeof(audio_format));
+            memcpy(&num_channels, data + pos + 10, sizeof(num_channels));
+            memcpy(&sample_rate, data + pos + 12, sizeof(sample_rate));
+            memcpy(&bits_per_sample, data + pos + 22, sizeof(bits_per_sample));
+            if (audio_format == 0xFFFE && chunk_size >= 40 && pos + 8 + 26 <= size) {
+                // WAVE_FORMAT_EXTENSIBLE，真实格式在子格式 GUID 的前两个字节
+                memcpy(&audio_format, data + pos + 8 + 24, sizeof(audio_format));
+            }
+            channels_ = std::max<int>(num_channels, 1);
+            sample_rate_ = (int)sample_rate;
+            bits_per_sample_ = bits_per_sample;
+            is_float_ = audio_format == 3;
+            ESP_LOGI(TAG, "Detected WAV: fmt audio_format=%d, channels=%d, rate=%d, bps=%d",
+                     audio_format, channels_, sample_rate_, bits_per_sample_);
+            bool supported = (audio_format == 1 && (bits_per_sample_ == 8 || bits_per_sample_ == 16 ||
+                                                    bits_per_sample_ == 24 || bits_per_sample_ == 32)) ||
+                             (is_float_ && bits_per_sample_ == 32);
+            if (!supported || sample_rate_ <= 0) {
+                ESP_LOGE(TAG, "Unsupported WAV format %d with %d bits", audio_format, bits_per_sample_);
+                return false;
+            }
+        }
+        if (memcmp(data + pos, "data", 4) == 0) {
+            *header_size = pos + 8;
+            return true;
+        }
+        pos += 8 + chunk_size;
+    }
+
+    // 头部过长，按标准44字节头处理
+    ESP_LOGW(TAG, "WAV data chunk not found in first %u bytes", (unsigned int)size);
+    *header_size = 44;
+    return true;
+}
+
+int WavStreamDecoder::Decode(const uint8_t* data, size_t size, size_t* consumed, int16_t* pcm, int* sample_rate) {
+    // 按整帧消费，多声道取平均降为单声道
+    size_t frame_bytes = block_align();
+    size_t frames = std::min(size / frame_bytes, (size_t)kMaxFrameSamples);
+    if (frames == 0) {
+        // 流末尾不足一帧
+        *consumed = size;
+        return 0;
+    }
+    AudioDsp::PcmToMono(data, bits_per_sample_, is_float_, channels_, pcm, frames);
+    *consumed = frames * frame_bytes;
+    *sample_rate = sample_rate_;
+    return frames;
+}
+
+OggOpusStreamDecoder::~OggOpusStreamDecoder() {
+    if (decoder_ != nullptr) {
+        opus_decoder_destroy(decoder_);
+    }
+}
+
+bool OggOpusStreamDecoder::Probe(const uint8_t* data, size_t size, size_t* header_size) {
+    // 第一个分页只包含 OpusHead
+    if (size < 27 || memcmp(data, "OggS", 4) != 0) {
+        return false;
+    }
+    const uint8_t* head = data + 27 + data[26];
+    if (size < (size_t)(head - data) + 19 || memcmp(head, "OpusHead", 8) != 0) {
+        return false;
+    }
+    int channels = head[9];
+    int mapping_family = head[18];
+    if (channels < 1 || channels > 2 || mapping_family != 0) {
+        ESP_LOGW(TAG, "Unsupported Opus stream: channels=%d, mapping family=%d", channels, mapping_family);
+        return false;
+    }
+
+    // 直接按编解码器的输出采样率解码为单声道，省去降混和重采样
+    auto codec = Board::GetInstance().GetAudioCodec();
+    int rate = codec ? codec->output_sample_rate() : 48000;
+    if (rate != 8000 && rate != 12000 && rate != 16000 && rate != 24000) {
+        rate = 48000;
+    }
+    if (decoder_ != nullptr && rate != decode_rate_) {
+        opus_decoder_destroy(decoder_);
+        decoder_ = nullptr;
+    }
+    if (decoder_ == nullptr) {
+        int error = 0;
+        decoder_ = opus_decoder_create(rate, 1, &error);
+        if (decoder_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to create Opus decoder: %d", error);
+            return false;
+        }
+        decode_rate_ = rate;
+    } else {
+        opus_decoder_ctl(decoder_, OPUS_RESET_STATE);
+    }
+    // 输出增益为Q7.8格式的dB值
+    opus_decoder_ctl(decoder_, OPUS_SET_GAIN((int16_t)(head[16] | (head[17] << 8))));
+
+    channels_ = channels;
+    pre_skip_ = (int64_t)(head[10] | (head[11] << 8)) * decode_rate_ / 48000;
+    packets_ = 0;
+    bytes_per_second_ = 0;
+    Reset();
+    ESP_LOGI(TAG, "Detected Ogg Opus: channels=%d, decode rate=%d", channels_, decode_rate_);
+    *header_size = 0;
+    return true;
+}
+
+void OggOpusStreamDecoder::Reset() {
+    segment_count_ = 0;
+    segment_index_ = 0;
+    segment_filled_ = 0;
+    drop_packet_ = false;
+    packet_.clear();
+    decoded_size_ = 0;
+    decoded_pos_ = 0;
+    if (decoder_ != nullptr && packets_ > 2) {
+        opus_decoder_ctl(decoder_, OPUS_RESET_STATE);
+    }
+}
+
+void OggOpusStreamDecoder::Release() {
+    if (decoder_ != nullptr) {
+        opus_decoder_destroy(decoder_);
+        decoder_ = nullptr;
+    }
+    packets_ = 0;
+    Reset();
+    std::vector<uint8_t>().swap(packet_);
+    std::vector<int16_t>().swap(decoded_);
+}
+
+int OggOpusStreamDecoder::ParsePageHeader(const uint8_t* data, size_t size) {
+    if (size < 27) {
+        return size >= 4 && memcmp(data, "OggS", 4) != 0 ? -1 : 0;
+    }
+    if (memcmp(data, "OggS", 4) != 0 || data[4] != 0) {
+        return -1;
+    }
+    int segments = data[26];
+    if (size < 27 + (size_t)segments) {
+        return 0;
+    }
+    memcpy(lacing_, data + 27, segments);
+    segment_count_ = segments;
+    segment_index_ = 0;
+    segment_filled_ = 0;
+
+    bool continued = data[5] & 0x01;
+    if (continued && packet_.empty()) {
+        // 前一半在上一个分页中，已经丢失
+        drop_packet_ = true;
+    } else if (!continued && !packet_.empty()) {
+        packet_.clear();
+    }
+    return 27 + segments;
+}
+
+int OggOpusStreamDecoder::DecodePacket(int16_t* pcm) {
+    int samples = opus_packet_get_nb_samples(packet_.data(), packet_.size(), decode_rate_);
+    if (samples <= 0) {
+        HOT_LOGW(TAG, "Invalid Opus packet, %u bytes", (unsigned int)packet_.size());
+        return -1;
+    }
+    // 常见的20ms帧直接解到输出缓冲区
+    int16_t* output = pcm;
+    if (samples > kMaxFrameSamples) {
+        if (decoded_.size() < (size_t)samples) {
+            decoded_.resize(samples);
+        }
+        output = decoded_.data();
+    }
+    samples = opus_decode(decoder_, packet_.data(), packet_.size(), output, samples, 0);
+    if (samples < 0) {
+        HOT_LOGW(TAG, "Opus decode failed: %d", samples);
+        return -1;
+    }
+    bytes_per_second_ = (int64_t)packet_.size() * decode_rate_ / std::max(samples, 1);
+
+    int skip = std::min(pre_skip_, samples);
+    pre_skip_ -= skip;
+    if (output == pcm) {
+        if (skip > 0) {
+            memmove(pcm, pcm + skip, (samples - skip) * sizeof(int16_t));
+        }
+        return samples - skip;
+    }
+    decoded_pos_ = skip;
+    decoded_size_ = samples;
+    return 0;
+}
+
+int OggOpusStreamDecoder::TakeDecoded(int16_t* pcm) {
+    size_t samples = std::min(decoded_size_ - decoded_pos_, (size_t)kMaxFrameSamples);
+    memcpy(pcm, decoded_.data() + decoded_pos_, samples * sizeof(int16_t));
+    decoded_pos_ += samples;
+    return samples;
+}
+
+int OggOpusStreamDecoder::Decode(const uint8_t* data, size_t size, size_t* consumed, int16_t* pcm, int* sample_rate) {
+    *sample_rate = decode_rate_;
+    size_t pos = 0;
+    while (decoded_pos_ >= decoded_size_) {
+        if (segment_index_ >= segment_count_) {
+            int header = ParsePageHeader(data + pos, size - pos);
+            if (header == 0) {
+                // 分页头不完整，缓冲区里不足一个分页头只会出现在流末尾
+                *consumed = pos > 0 ? pos : size;
+                return 0;
+            }
+            if (header < 0) {
+                // 失去同步（拖动后），跳到下一个 "OggS"
+                size_t next = pos + 1;
+                while (next + 4 <= size && memcmp(data + next, "OggS", 4) != 0) {
+                    next++;
+                }
+                pos = std::min(next, size);
+                continue;
+            }
+            pos += header;
+            continue;
+        }
+
+        size_t lacing = lacing_[segment_index_];
+        size_t take = std::min(lacing - segment_filled_, size - pos);
+        if (take == 0 && lacing > 0) {
+            *consumed = pos;
+            return 0;
+        }
+        if (!drop_packet_ && packet_.size() + take <= kMaxPacketSize) {
+            packet_.insert(packet_.end(), data + pos, data + pos + take);
+        } else {
+            // 超长的包（如带封面的 OpusTags）直接跳过
+            drop_packet_ = true;
+            packet_.clear();
+        }
+        pos += take;
+        segment_filled_ += take;
+        if (segment_filled_ < lacing) {
+            continue;
+        }
+        segment_filled_ = 0;
+        segment_index_++;
+        if (lacing == 255) {
+            // 包没有结束，继续下一个段
+            continue;
+        }
+
+        packets_++;
+        // OpusHead 已在 Probe 中解析，OpusTags 不需要，空包表示丢包
+        bool drop = drop_packet_ || packets_ <= 2 || packet_.empty();
+        drop_packet_ = false;
+        int samples = drop ? 0 : DecodePacket(pcm);
+        packet_.clear();
+        if (samples != 0) {
+            *consumed = pos;
+            return samples;
+        }
+    }
+    *consumed = pos;
+    return TakeDecoded(pcm);
+}
+
+// ========== StreamPlayer ==========
+
+StreamPlayer::StreamPlayer() : buffer_(kAudioMemoryStream, kBufferSize, kReadGuardSize) {
+}
+
+StreamPlayer::~StreamPlayer() {
+    Stop();
+}
+
+bool StreamPlayer::Start(std::unique_ptr<StreamSource> source, StreamPlayerConfig config) {
+    std::lock_guard<std::mutex> control_lock(control_mutex_);
+    // 停止之前的播放和下载，不论属于哪个播放器
+    is_downloading_ = false;
+    is_playing_ = false;
+    {
+        std::lock_guard<std::mutex> lock(buffer_mutex_);
+        buffer_cv_.notify_all();
+    }
+    if (fetch_thread_.joinable()) {
+        fetch_thread_.join();
+    }
+    if (play_thread_.joinable()) {
+        play_thread_.join();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(buffer_mutex_);
+        if (!buffer_.Allocate()) {
+            return false;
+        }
+        buffer_.Clear();
+        written_bytes_ = 0;
+        consumed_bytes_ = 0;
+        track_starts_.clear();
+        fetch_done_ = false;
+        opening_next_ = false;
+        seek_pending_ = false;
+        suspended_ = false;
+        data_offset_ = 0;
+        play_offset_ = 0;
+        bytes_per_second_ = 0;
+        download_rate_ = 0;
+        download_remaining_ = 0;
+        source_length_ = 0;
+        start_threshold_ = 0;
+        underruns_ = 0;
+        decode_load_ = 0;
+        decode_max_us_ = 0;
+        rate_window_bytes_ = 0;
+        rate_window_us_ = 0;
+    }
+    source_ = std::move(source);
+    config_ = std::move(config);
+    config_.buffer_size = std::min(config_.buffer_size, buffer_.capacity());
+    owner_ = config_.owner;
+    under_voice_ = false;
+    tempo_percent_ = config_.tempo_percent;
+    semitones_ = config_.semitones;
+
+    // 配置线程栈大小以避免栈溢出
+    esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+    cfg.stack_size = 8192;  // 8KB栈大小
+    cfg.prio = 5;           // 中等优先级
+    cfg.thread_name = "stream_fetch";
+    TaskStacks::GetInstance().ConfigureThread(cfg);
+    esp_pthread_set_cfg(&cfg);
+    is_downloading_ = true;
+    is_playing_ = true;
+    released_ = false;
+    running_threads_ = 2;
+    fetch_thread_ = std::thread([this]() {
+        FetchThread();
+        running_threads_--;
+    });
+
+    // 播放线程会等待缓冲区有足够数据
+    cfg.thread_name = "stream_play";
+#if defined(CONFIG_STREAM_PLAY_TASK_CORE) && CONFIG_STREAM_PLAY_TASK_CORE >= 0
+    // 与 AFE 所在核心分开，音乐和唤醒词同时运行时互不抢占
+    cfg.pin_to_core = CONFIG_STREAM_PLAY_TASK_CORE;
+#endif
+    TaskStacks::GetInstance().ConfigureThread(cfg);
+    esp_pthread_set_cfg(&cfg);
+    play_thread_ = std::thread([this]() {
+        PlayThread();
+        running_threads_--;
+    });
+#if defined(CONFIG_STREAM_PLAY_TASK_CORE) && CONFIG_STREAM_PLAY_TASK_CORE >= 0
+    // 调用者之后创建的线程不继承固定核心
+    cfg.pin_to_core = tskNO_AFFINITY;
+    esp_pthread_set_cfg(&cfg);
+#endif
+
+    ESP_LOGI(TAG, "Streaming threads started");
+    return true;
+}
+
+void StreamPlayer::Stop() {
+    std::lock_guard<std::mutex> control_lock(control_mutex_);
+    ResetSampleRate();
+    is_downloading_ = false;
+    is_playing_ = false;
+    under_voice_ = false;
+    {
+        std::lock_guard<std::mutex> lock(buffer_mutex_);
+        suspended_ = false;
+        buffer_cv_.notify_all();
+    }
+    if (fetch_thread_.joinable()) {
+        fetch_thread_.join();
+    }
+    if (play_thread_.joinable()) {
+        play_thread_.join();
+    }
+    source_.reset();
+    std::lock_guard<std::mutex> lock(buffer_mutex_);
+    buffer_.Clear();
+    track_starts_.clear();
+}
+
+bool StreamPlayer::Suspend(const void* owner) {
+    // 在主循环中调用，不等待 control_mutex_，以免 Start/Stop 等线程退出时卡住状态切换
+    std::lock_guard<std::mutex> lock(buffer_mutex_);
+    if (!IsActive(owner)) {
+        return false;
+    }
+    if (!suspended_) {
+        suspended_ = true;
+        suspended_since_us_ = esp_timer_get_time();
+        ESP_LOGI(TAG, "Playback suspended at %lld ms, %u bytes buffered",
+                 play_time_ms_.load(), (unsigned int)buffer_.size());
+    }
+    under_voice_ = false;
+    return true;
+}
+
+bool StreamPlayer::Resume(const void* owner, bool under_voice) {
+    std::lock_guard<std::mutex> lock(buffer_mutex_);
+    if (!IsActive(owner)) {
+        return false;
+    }
+    under_voice_ = under_voice;
+    if (suspended_) {
+        suspended_ = false;
+        ESP_LOGI(TAG, "Playback resumed at %lld ms after %lld ms",
+                 play_time_ms_.load(), (esp_timer_get_time() - suspended_since_us_) / 1000);
+        buffer_cv_.notify_all();
+    }
+    return true;
+}
+
+int64_t StreamPlayer::suspended_ms() {
+    std::lock_guard<std::mutex> lock(buffer_mutex_);
+    return suspended_ ? (esp_timer_get_time() - suspended_since_us_) / 1000 : 0;
+}
+
+void StreamPlayer::ReleaseIdle() {
+    // 正在启动或停止时下一轮再看
+    std::unique_lock<std::mutex> control_lock(control_mutex_, std::try_to_lock);
+    if (!control_lock.owns_lock() || released_) {
+        return;
+    }
+    if (running_threads_ > 0) {
+        idle_since_us_ = 0;
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    if (idle_since_us_ == 0) {
+        idle_since_us_ = now;
+    }
+    if (now - idle_since_us_ < CONFIG_STREAM_IDLE_RELEASE_S * 1000000LL) {
+        return;
+    }
+
+    // 两个线程都已经返回，join 不会等待
+    if (fetch_thread_.joinable()) {
+        fetch_thread_.join();
+    }
+    if (play_thread_.joinable()) {
+        play_thread_.join();
+    }
+    source_.reset();
+    {
+        std::lock_guard<std::mutex> lock(buffer_mutex_);
+        buffer_.Release();
+        track_starts_.clear();
+    }
+    mp3_decoder_.Release();
+    wav_decoder_.Release();
+    opus_decoder_.Release();
+    pcm_tap_.Release();
+    time_pitch_.Release();
+    time_pitch_pcm_ = std::vector<int16_t>();
+    released_ = true;
+    idle_since_us_ = 0;
+    ESP_LOGI(TAG, "Idle for %d s, stream buffer and decoders released", CONFIG_STREAM_IDLE_RELEASE_S);
+}
+
+bool StreamPlayer::SetTimePitch(const void* owner, int tempo_percent, int semitones) {
+    if (!IsActive(owner)) {
+        return false;
+    }
+    tempo_percent_ = std::clamp(tempo_percent, TimePitchShifter::kMinTempoPercent, TimePitchShifter::kMaxTempoPercent);
+    semitones_ = std::clamp(semitones, -TimePitchShifter::kMaxSemitones, TimePitchShifter::kMaxSemitones);
+    return true;
+}
+
+bool StreamPlayer::IsActive(const void* owner) const {
+    return owner_ == owner && (is_playing_ || is_downloading_);
+}
+
+bool StreamPlayer::IsDownloading(const void* owner) const {
+    return owner_ == owner && is_downloading_;
+}
+
+size_t StreamPlayer::buffered_bytes() {
+    std::lock_guard<std::mutex> lock(buffer_mutex_);
+    return buffer_.size();
+}
+
+void StreamPlayer::ResetSampleRate() {
+    auto codec = Board::GetInstance().GetAudioCodec();
+    if (codec && codec->original_output_sample_rate() > 0 &&
+        codec->output_sample_rate() != codec->original_output_sample_rate()) {
+        ESP_LOGI(TAG, "重置采样率：从 %d Hz 重置到原始值 %d Hz",
+                codec->output_sample_rate(), codec->original_output_sample_rate());
+        if (codec->SetOutputSampleRate(-1)) {  // -1 表示重置到原始值
+            ESP_LOGI(TAG, "成功重置采样率到原始值: %d Hz", codec->output_sample_rate());
+        } else {
+            ESP_LOGW(TAG, "无法重置采样率到原始值");
+        }
+    }
+}
+
+void StreamPlayer::AbortFetch(int status_code) {
+    // 给网络栈一点时间释放旧连接，避免后续Open卡住
+    vTaskDelay(pdMS_TO_TICKS(100));
+    is_downloading_ = false;
+    is_playing_ = false;
+    {
+        std::lock_guard<std::mutex> lock(buffer_mutex_);
+        buffer_cv_.notify_all();
+    }
+    if (config_.on_fetch_error) {
+        config_.on_fetch_error(status_code);
+    }
+}
+
+void StreamPlayer::FetchThread() {
+    int status_code = source_->Open();
+    if (status_code != 200 && status_code != 206) {
+        ESP_LOGE(TAG, "HTTP GET failed with status code: %d", status_code);
+        source_->Close();
+        {
+            std::lock_guard<std::mutex> lock(buffer_mutex_);
+            fetch_done_ = true;
+        }
+        AbortFetch(status_code);
+        return;
+    }
+    ESP_LOGI(TAG, "Started downloading audio stream, status: %d", status_code);
+
+    bool first_track = true;
+    while (true) {
+        bool first_byte_timeout = false;
+        bool completed = FetchSource(&first_byte_timeout);
+        source_->Close();
+        if (first_byte_timeout && first_track) {
+            {
+                std::lock_guard<std::mutex> lock(buffer_mutex_);
+                fetch_done_ = true;
+            }
+            AbortFetch(0);
+            return;
+        }
+        if (!completed) {
+            break;
+        }
+
+        // 当前曲目下载完成，接着下载下一首，提前连接并填充缓冲区
+        if (config_.next_source) {
+            std::lock_guard<std::mutex> lock(buffer_mutex_);
+            opening_next_ = true;
+        }
+        if (OpenNextSource()) {
+            first_track = false;
+            continue;
+        }
+
+        // 没有下一首：下载结束，但在播放结束前仍然可以拖动
+        std::unique_lock<std::mutex> lock(buffer_mutex_);
+        opening_next_ = false;
+        is_downloading_ = false;
+        buffer_cv_.notify_all();
+        buffer_cv_.wait(lock, [this] { return seek_pending_ || !is_playing_; });
+        if (!seek_pending_) {
+            fetch_done_ = true;
+            return;
+        }
+        is_downloading_ = true;
+    }
+
+    // 通知播放线程下载结束
+    std::lock_guard<std::mutex> lock(buffer_mutex_);
+    fetch_done_ = true;
+    is_downloading_ = false;
+    buffer_cv_.notify_all();
+}
+
+bool StreamPlayer::FetchSource(bool* first_byte_timeout) {
+    // 分块读取音频数据，直接写入环形缓冲区
+    const size_t chunk_size = std::min(source_->read_size(), config_.buffer_size / 4);
+    size_t total_downloaded = 0;
+    int64_t open_time_ms = esp_timer_get_time() / 1000;
+
+    while (is_downloading_ && is_playing_) {
+        // 等待缓冲区有空间
+        uint8_t* buffer = nullptr;
+        size_t contiguous = 0;
+        bool seek = false;
+        {
+            std::unique_lock<std::mutex> lock(buffer_mutex_);
+            buffer_cv_.wait(lock, [this, chunk_size] {
+                return buffer_.size() + chunk_size <= config_.buffer_size || seek_pending_ || !is_downloading_ || !is_playing_;
+            });
+            if (!is_downloading_ || !is_playing_) {
+                return false;
+            }
+            if (seek_pending_) {
+                // 丢弃缓冲区中的旧数据，播放线程根据 generation_ 重新同步
+                seek_pending_ = false;
+                seek = true;
+                buffer_.Clear();
+                written_bytes_ = 0;
+                consumed_bytes_ = 0;
+                play_offset_ = seek_offset_;
+                generation_++;
+                total_downloaded = seek_offset_;
+                buffer_cv_.notify_all();
+            } else {
+                buffer = buffer_.write_pointer(&contiguous);
+            }
+        }
+        if (seek) {
+            ESP_LOGI(TAG, "Seeking to byte %u", (unsigned int)total_downloaded);
+            if (!ResumeSource(total_downloaded, false)) {
+                return false;
+            }
+            continue;
+        }
+
+        int64_t read_start_us = esp_timer_get_time();
+        int bytes_read = source_->Read(buffer, std::min(contiguous, chunk_size));
+        int64_t read_us = esp_timer_get_time() - read_start_us;
+        if (bytes_read == 0 && total_downloaded == 0 && config_.first_byte_timeout_ms > 0) {
+            if (esp_timer_get_time() / 1000 - open_time_ms >= config_.first_byte_timeout_ms) {
+                ESP_LOGE(TAG, "Timeout waiting for first byte after %d ms", config_.first_byte_timeout_ms);
+                *first_byte_timeout = true;
+                return false;
+            }
+            vTaskDelay(pdMS_TO_TICKS(50));
+            continue;
+        }
+        size_t expected = source_->length();
+        if (bytes_read < 0 || (bytes_read == 0 && total_downloaded < expected)) {
+            // 连接中断，从已下载的位置续传
+            ESP_LOGW(TAG, "Stream interrupted at %u/%u bytes, error code %d",
+                     (unsigned int)total_downloaded, (unsigned int)expected, bytes_read);
+            if (total_downloaded == 0 || !ResumeSource(total_downloaded, true)) {
+                return false;
+            }
+            continue;
+        }
+        if (bytes_read == 0) {
+            ESP_LOGI(TAG, "Audio stream download completed, total: %u bytes", (unsigned int)total_downloaded);
+            return true;
+        }
+
+        // 尝试检测文件格式（检查文件头），仅用于日志
+        if (total_downloaded == 0 && bytes_read >= 4) {
+            ESP_LOGI(TAG, "Stream starts with: %02X %02X %02X %02X",
+                     buffer[0], buffer[1], buffer[2], buffer[3]);
+        }
+
+        std::lock_guard<std::mutex> lock(buffer_mutex_);
+        if (!is_downloading_) {
+            return false;
+        }
+        buffer_.Commit(bytes_read);
+        written_bytes_ += bytes_read;
+        total_downloaded += bytes_read;
+        download_remaining_ = expected > total_downloaded ? expected - total_downloaded : 0;
+        source_length_ = expected;
+        UpdateDownloadRate(bytes_read, read_us);
+
+        // 通知播放线程有新数据
+        buffer_cv_.notify_one();
+
+        if (total_downloaded % (256 * 1024) == 0) {  // 每256KB打印一次进度
+            ESP_LOGI(TAG, "Downloaded %u bytes, buffer size: %u",
+                     (unsigned int)total_downloaded, (unsigned int)buffer_.size());
+        }
+    }
+    return false;
+}
+
+// 只统计 Read() 中的时间，缓冲区满时的等待不算，反映的是链路速度而不是播放速度
+void StreamPlayer::UpdateDownloadRate(size_t bytes, int64_t elapsed_us) {
+    rate_window_bytes_ += bytes;
+    rate_window_us_ += elapsed_us;
+    if (rate_window_us_ < 500 * 1000) {
+        return;
+    }
+    int rate = (int)(rate_window_bytes_ * 1000000 / rate_window_us_);
+    download_rate_ = download_rate_ == 0 ? rate : (download_rate_ * 3 + rate) / 4;
+    rate_window_bytes_ = 0;
+    rate_window_us_ = 0;
+}
+
+bool StreamPlayer::ResumeSource(size_t offset, bool backoff) {
+    int delay_ms = 500;
+    for (int attempt = 0; attempt < kResumeRetries; attempt++) {
+        if (backoff || attempt > 0) {
+            std::unique_lock<std::mutex> lock(buffer_mutex_);
+            buffer_cv_.wait_for(lock, std::chrono::milliseconds(delay_ms), [this] {
+                return seek_pending_ || !is_playing_;
+            });
+            if (!is_playing_) {
+                return false;
+            }
+            if (seek_pending_) {
+                // 新的拖动请求优先，回到下载循环中处理
+                return true;
+            }
+            delay_ms *= 2;
+        }
+        int status_code = source_->OpenAt(offset);
+        if (status_code == 206 || (offset == 0 && status_code == 200)) {
+            ESP_LOGI(TAG, "Stream reopened at %u bytes", (unsigned int)offset);
+            return true;
+        }
+        if (status_code == 200 || status_code == 416) {
+            // 服务端不支持Range或位置超出文件
+            ESP_LOGE(TAG, "Cannot reopen stream at %u bytes, status: %d", (unsigned int)offset, status_code);
+            return false;
+        }
+        ESP_LOGW(TAG, "Reopen at %u bytes failed, status: %d, attempt %d", (unsigned int)offset, status_code, attempt + 1);
+    }
+    return false;
+}
+
+bool StreamPlayer::OpenNextSource() {
+    while (config_.next_source && is_downloading_ && is_playing_) {
+        auto source = config_.next_source();
+        if (!source) {
+            return false;
+        }
+        int status_code = source->Open();
+        if (status_code != 200 && status_code != 206) {
+            // 跳过打不开的曲目
+            ESP_LOGE(TAG, "Failed to open next track, status: %d", status_code);
+            source->Close();
+            if (config_.on_fetch_error) {
+                config_.on_fetch_error(status_code);
+            }
+            continue;
+        }
+        ESP_LOGI(TAG, "Prefetching next track, status: %d", status_code);
+        std::lock_guard<std::mutex> lock(buffer_mutex_);
+        track_starts_.push_back(written_bytes_);
+        source_ = std::move(source);
+        opening_next_ = false;
+        return true;
+    }
+    return false;
+}
+
+// 下载剩余 D 字节、下载速度 r 低于码率 c 时，需要预先缓冲 D * (c / r - 1) 字节才不会中途断流
+size_t StreamPlayer::StartThresholdLocked() const {
+    size_t max_threshold = config_.buffer_size - kReadGuardSize;
+    int bitrate = bytes_per_second_ > 0 ? bytes_per_second_ : config_.nominal_bitrate;
+    if (download_rate_ == 0 || bitrate <= 0) {
+        // 还没测出下载速度
+        return std::min(config_.start_threshold, max_threshold);
+    }
+    if (download_rate_ >= bitrate * 3 / 2 && !NetworkMonitor::GetInstance().IsPoor()) {
+        return kMinStartThreshold;
+    }
+    if (download_rate_ >= bitrate) {
+        // 速度刚够或网络质量差，保留默认余量应对波动
+        return std::min(config_.start_threshold, max_threshold);
+    }
+    if (download_remaining_ == 0) {
+        // 长度未知，能缓冲多少就缓冲多少
+        return max_threshold;
+    }
+    uint64_t need = (uint64_t)download_remaining_ * (bitrate - download_rate_) / download_rate_;
+    return std::clamp<uint64_t>(need + kMinStartThreshold, kMinStartThreshold, max_threshold);
+}
+
+void StreamPlayer::WaitForBuffer() {
+    int64_t start_time = esp_timer_get_time();
+    std::unique_lock<std::mutex> lock(buffer_mutex_);
+    // 下载速度和剩余长度在缓冲过程中变化，定期重新计算门槛
+    while (is_downloading_ && is_playing_) {
+        if (bytes_per_second_ == 0 && buffer_.size() >= kReadGuardSize) {
+            // WAV文件头中有准确的码率
+            size_t contiguous, header_size;
+            uint8_t* data = buffer_.read_pointer(&contiguous);
+            if (wav_decoder_.Probe(data, std::min(contiguous, kReadGuardSize), &header_size)) {
+                bytes_per_second_ = wav_decoder_.bytes_per_second();
+                block_align_ = std::max(wav_decoder_.block_align(), 1);
+            }
+        }
+        start_threshold_ = StartThresholdLocked();
+        if (buffer_.size() >= start_threshold_ || !track_starts_.empty()) {
+            break;
+        }
+        buffer_cv_.wait_for(lock, std::chrono::milliseconds(100));
+    }
+    ESP_LOGI(TAG, "Buffered %u bytes in %lld ms, threshold %u, download %d B/s, bitrate %d B/s",
+             (unsigned int)buffer_.size(), (esp_timer_get_time() - start_time) / 1000,
+             (unsigned int)start_threshold_, download_rate_, bytes_per_second_);
+}
+
+bool StreamPlayer::GetStatus(const void* owner, StreamPlayerStatus* status) {
+    std::lock_guard<std::mutex> lock(buffer_mutex_);
+    if (owner_ != owner || !is_playing_) {
+        return false;
+    }
+    status->buffered_bytes = buffer_.size();
+    status->buffer_size = config_.buffer_size;
+    status->start_threshold = start_threshold_;
+    status->download_rate = download_rate_;
+    status->bitrate = bytes_per_second_;
+    status->underruns = underruns_;
+    status->decode_load = decode_load_;
+    status->decode_max_us = decode_max_us_;
+    status->suspended = suspended_;
+    return true;
+}
+
+void AddStreamStatusJson(cJSON* root) {
+    auto& board = Board::GetInstance();
+    auto& player = StreamPlayer::GetInstance();
+    StreamPlayerStatus status;
+    if (!player.GetStatus(board.GetMusic(), &status) && !player.GetStatus(board.GetSing(), &status)) {
+        return;
+    }
+    auto music = cJSON_CreateObject();
+    cJSON_AddNumberToObject(music, "buffered", status.buffered_bytes);
+    cJSON_AddNumberToObject(music, "buffer_size", status.buffer_size);
+    cJSON_AddNumberToObject(music, "start_threshold", status.start_threshold);
+    cJSON_AddNumberToObject(music, "download_rate", status.download_rate);
+    cJSON_AddNumberToObject(music, "bitrate", status.bitrate);
+    cJSON_AddNumberToObject(music, "underruns", status.underruns);
+    cJSON_AddNumberToObject(music, "decode_load", status.decode_load);
+    cJSON_AddNumberToObject(music, "decode_max_us", status.decode_max_us);
+    cJSON_AddBoolToObject(music, "suspended", status.suspended);
+    cJSON_AddItemToObject(root, "music", music);
+}
+
+bool StreamPlayer::ConsumeBuffer(size_t bytes, uint32_t generation) {
+    std::lock_guard<std::mutex> lock(buffer_mutex_);
+    if (generation != generation_) {
+        // 拖动后缓冲区已经清空，丢弃这次读到的数据
+        return false;
+    }
+    bytes = std::min(bytes, buffer_.size());
+    buffer_.Consume(bytes);
+    consumed_bytes_ += bytes;
+    play_offset_ += bytes;
+    // 通知下载线程缓冲区有空间
+    buffer_cv_.notify_one();
+    return true;
+}
+
+bool StreamPlayer::Seek(const void* owner, int64_t time_ms) {
+    std::lock_guard<std::mutex> control_lock(control_mutex_);
+    std::lock_guard<std::mutex> lock(buffer_mutex_);
+    if (owner_ != owner || !is_playing_ || fetch_done_ || opening_next_ || !track_starts_.empty() ||
+        bytes_per_second_ <= 0) {
+        ESP_LOGW(TAG, "Stream is not seekable now");
+        return false;
+    }
+
+    // 按已播放部分的平均码率估算字节位置（VBR时比单帧码率准确），WAV码率固定，直接计算
+    int64_t bytes_per_second = bytes_per_second_;
+    int64_t played_ms = play_time_ms_.load();
+    if (block_align_ == 1 && played_ms >= 1000 && play_offset_ > data_offset_) {
+        bytes_per_second = (int64_t)(play_offset_ - data_offset_) * 1000 / played_ms;
+    }
+    time_ms = std::max<int64_t>(time_ms, 0);
+    size_t delta = time_ms * bytes_per_second / 1000;
+    delta -= delta % block_align_;
+    if (source_length_ > 0 && data_offset_ + delta >= source_length_) {
+        ESP_LOGW(TAG, "Seek position %lld ms is beyond the end", time_ms);
+        return false;
+    }
+
+    seek_pending_ = true;
+    seek_offset_ = data_offset_ + delta;
+    seek_time_ms_ = time_ms;
+    is_downloading_ = true;
+    buffer_cv_.notify_all();
+    ESP_LOGI(TAG, "Seek to %lld ms, byte %u", time_ms, (unsigned int)seek_offset_);
+    return true;
+}
+
+void StreamPlayer::PlayThread() {
+    ESP_LOGI(TAG, "Starting audio stream playback");
+    play_time_ms_ = 0;
+
+    auto codec = Board::GetInstance().GetAudioCodec();
+    if (codec && !codec->output_enabled()) {
+        // 自动开启输出，避免门槛导致无声
+        codec->EnableOutput(true);
+    }
+
+    // 等待缓冲区有足够数据开始播放
+    WaitForBuffer();
+
+    StreamDecoder* decoder = nullptr;
+    size_t header_left = 0;
+    std::vector<uint8_t> id3_tag;
+    bool collect_tag = false;
+    size_t track = 0;
+    uint32_t generation;
+    {
+        std::lock_guard<std::mutex> lock(buffer_mutex_);
+        generation = generation_;
+    }
+    bool started = false;
+    size_t total_played = 0;
+    int64_t played_us = 0;
+    int16_t pcm[StreamDecoder::kMaxFrameSamples];
+    auto& app = Application::GetInstance();
+    int64_t window_decode_us = 0;
+    int64_t window_audio_us = 0;
+    int window_max_us = 0;
+
+    while (is_playing_) {
+        {
+            // 对话期间停在这里，恢复后从同一帧继续解码
+            std::unique_lock<std::mutex> lock(buffer_mutex_);
+            if (suspended_) {
+                buffer_cv_.wait(lock, [this] { return !suspended_ || !is_playing_; });
+                continue;
+            }
+        }
+        // 状态转换：说话中-》聆听中-》待机状态-》播放音乐
+        DeviceState current_state = app.GetDeviceState();
+        if (current_state == kDeviceStateSpeaking && under_voice_) {
+            // 恢复到 TTS 下方继续播放，混音器负责压低音量
+        } else if (current_state == kDeviceStateListening || current_state == kDeviceStateSpeaking) {
+            ESP_LOGI(TAG, "Device is in state %d, switching to idle state for music playback", current_state);
+            app.ToggleChatState();
+            vTaskDelay(pdMS_TO_TICKS(300));
+            continue;
+        } else if (current_state != kDeviceStateIdle) {
+            // 不是待机状态，暂停播放
+            vTaskDelay(pdMS_TO_TICKS(50));
+            continue;
+        }
+        if (!started) {
+            started = true;
+            if (config_.on_start) {
+                config_.on_start();
+            }
+        }
+
+        // 从环形缓冲区原地读取，保持至少4KB数据用于解码（流结束时除外）
+        uint8_t* data;
+        size_t contiguous;
+        bool new_track = false;
+        bool seeked = false;
+        uint64_t track_left = UINT64_MAX;
+        bool underrun;
+        {
+            std::lock_guard<std::mutex> lock(buffer_mutex_);
+            underrun = buffer_.size() < kReadGuardSize && is_downloading_ && track_starts_.empty();
+            if (underrun) {
+                underruns_++;
+            }
+        }
+        if (underrun) {
+            // 下载跟不上播放，重新缓冲，而不是每来一点数据就播一点
+            ESP_LOGW(TAG, "Buffer underrun at %lld ms", played_us / 1000);
+            BlackBox::GetInstance().Record(kBlackBoxUnderrun, kBlackBoxSourceMusic, played_us / 1000);
+            WaitForBuffer();
+        }
+        {
+            std::unique_lock<std::mutex> lock(buffer_mutex_);
+            buffer_cv_.wait(lock, [this] {
+                return buffer_.size() >= kReadGuardSize || !is_downloading_ || !is_playing_;
+            });
+            if (!is_playing_) {
+                break;
+            }
+            if (buffer_.size() == 0) {
+                // 下载完成且缓冲区为空，播放结束
+                ESP_LOGI(TAG, "Playback finished, total played: %u bytes", (unsigned int)total_played);
+                break;
+            }
+            data = buffer_.read_pointer(&contiguous);
+            if (generation != generation_) {
+                generation = generation_;
+                seeked = true;
+                played_us = seek_time_ms_ * 1000;
+            }
+            // 到达下一首的起点
+            if (!track_starts_.empty() && consumed_bytes_ >= track_starts_.front()) {
+                track_starts_.pop_front();
+                new_track = true;
+                play_offset_ = 0;
+                bytes_per_second_ = 0;
+            }
+            if (!track_starts_.empty()) {
+                track_left = track_starts_.front() - consumed_bytes_;
+            }
+        }
+        // 解码不越过曲目边界
+        size_t size = std::min<uint64_t>(std::min(contiguous, kReadGuardSize), track_left);
+
+        if (seeked) {
+            // 从估算位置继续解码，MP3会重新寻找帧同步
+            ESP_LOGI(TAG, "Resuming playback at %lld ms", played_us / 1000);
+            header_left = 0;
+            collect_tag = false;
+            if (decoder != nullptr) {
+                decoder->Reset();
+            }
+            time_pitch_.Reset();
+        }
+        if (new_track) {
+            // 解码器继续运行，只重新识别格式和容器头
+            ESP_LOGI(TAG, "Track %u started, total played: %u bytes", (unsigned int)(track + 1), (unsigned int)total_played);
+            track++;
+            decoder = nullptr;
+            header_left = 0;
+            collect_tag = false;
+            played_us = 0;
+            time_pitch_.Reset();
+            if (config_.on_track_start) {
+                config_.on_track_start(track);
+            }
+        }
+
+        // 首次读到数据时识别格式，容器头可能比缓冲区中的数据长，分多次跳过
+        if (decoder == nullptr) {
+            if (wav_decoder_.Probe(data, size, &header_left)) {
+                decoder = &wav_decoder_;
+            } else if (opus_decoder_.Probe(data, size, &header_left)) {
+                decoder = &opus_decoder_;
+            } else if (mp3_decoder_.Probe(data, size, &header_left)) {
+                decoder = &mp3_decoder_;
+            } else {
+                break;
+            }
+            ESP_LOGI(TAG, "Stream format: %s, header: %u bytes", decoder->name(), (unsigned int)header_left);
+            // 内存不够时不收集，给其他分配留出同样大小的余量
+            collect_tag = decoder == &mp3_decoder_ && header_left > 0 && header_left <= kMaxId3TagSize &&
+                config_.on_id3_tag && heap_caps_get_largest_free_block(MALLOC_CAP_8BIT) > header_left * 2;
+            if (collect_tag) {
+                id3_tag.clear();
+                id3_tag.reserve(header_left);
+            }
+            std::lock_guard<std::mutex> lock(buffer_mutex_);
+            data_offset_ = header_left;
+        }
+        if (header_left > 0) {
+            size_t skip = std::min(header_left, size);
+            if (collect_tag) {
+                id3_tag.insert(id3_tag.end(), data, data + skip);
+            }
+            if (ConsumeBuffer(skip, generation)) {
+                header_left -= skip;
+                if (collect_tag && header_left == 0) {
+                    collect_tag = false;
+                    config_.on_id3_tag(std::move(id3_tag));
+                    id3_tag = std::vector<uint8_t>();
+                }
+            }
+            continue;
+        }
+
+        size_t consumed = 0;
+        int sample_rate = 0;
+        int64_t decode_start = esp_timer_get_time();
+        int samples = decoder->Decode(data, size, &consumed, pcm, &sample_rate);
+        int decode_us = esp_timer_get_time() - decode_start;
+        window_decode_us += decode_us;
+        window_max_us = std::max(window_max_us, decode_us);
+        if (!ConsumeBuffer(consumed, generation)) {
+            continue;
+        }
+        if (samples < 0) {
+            HOT_LOGW(TAG, "%s decode failed", decoder->name());
+            BlackBox::GetInstance().Record(kBlackBoxDecodeError, kBlackBoxSourceMusic, -samples);
+            continue;
+        }
+        if (samples == 0 || sample_rate <= 0) {
+            continue;
+        }
+        if (bytes_per_second_ == 0) {
+            // 音频数据从第一帧开始，Ogg的注释页等容器头不计入码率
+            std::lock_guard<std::mutex> lock(buffer_mutex_);
+            bytes_per_second_ = decoder->bytes_per_second();
+            block_align_ = std::max(decoder->block_align(), 1);
+            data_offset_ = play_offset_ - std::min(play_offset_, consumed);
+        }
+
+        int64_t frame_us = (int64_t)samples * 1000000 / sample_rate;
+        played_us += frame_us;
+        play_time_ms_ = played_us / 1000;
+        window_audio_us += frame_us;
+        if (window_audio_us >= STREAM_DECODE_STATS_WINDOW_US) {
+            std::lock_guard<std::mutex> lock(buffer_mutex_);
+            decode_load_ = window_decode_us * 100 / window_audio_us;
+            decode_max_us_ = window_max_us;
+            window_decode_us = 0;
+            window_audio_us = 0;
+            window_max_us = 0;
+        }
+
+        // 变速变调：输出样本数随速度变化，播放位置仍按歌曲时间计算
+        const int16_t* output = pcm;
+        size_t output_samples = samples;
+        int output_rate = sample_rate;
+        time_pitch_.Configure(sample_rate, tempo_percent_, semitones_);
+        if (time_pitch_.active()) {
+            int64_t shift_start = esp_timer_get_time();
+            time_pitch_.Process(pcm, samples, time_pitch_pcm_);
+            window_decode_us += esp_timer_get_time() - shift_start;
+            output = time_pitch_pcm_.data();
+            output_samples = time_pitch_pcm_.size();
+            output_rate = time_pitch_.output_sample_rate();
+        }
+
+        // 解码缓冲区直接交给混音器，不再为每帧分配和复制 AudioStreamPacket
+        total_played += samples * sizeof(int16_t);
+        app.AddAudioData(output, output_samples, output_rate);
+        if (output_samples > 0) {
+            pcm_tap_.Publish(output, output_samples, output_rate, play_time_ms_);
+            beat_tracker_.Feed(output, output_samples, output_rate, play_time_ms_);
+        }
+        if (config_.on_pcm) {
+            config_.on_pcm(pcm, samples, play_time_ms_);
+        }
+    }
+
+    // 播放结束时进行基本清理，不调用Stop避免线程自我等待
+    is_playing_ = false;
+    {
+        std::lock_guard<std::mutex> lock(buffer_mutex_);
+        buffer_cv_.notify_all();
+    }
+    ResetSampleRate();
+    if (config_.on_finished) {
+        config_.on_finished();
+    }
+    ESP_LOGI(TAG, "Audio stream playback finished");
+}
@@ -0,0 +1,355 @@
+#ifndef STREAM_PLAYER_H
+#define STREAM_PLAYER_H
+
+#include <string>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <deque>
+
+#include <http.h>
+
+#include "stream_ring_buffer.h"
+#include "pcm_tap.h"
+#include "beat_tracker.h"
+#include "time_pitch_shifter.h"
+#include "transfer_manager.h"
+
+// MP3解码器支持
+extern "C" {
+#include "mp3dec.h"
+}
+#include "opus.h"
+
+struct cJSON;
+
+// 为音乐服务的HTTP请求添加设备认证头
+void AddStreamAuthHeaders(Http* http);
+// 正在播放音乐或唱歌时，在设备状态中添加 "music" 缓冲状态
+void AddStreamStatusJson(cJSON* root);
+
+// 拉流阶段：把网络数据写入播放缓冲区
+class StreamSource {
+public:
+    virtual ~StreamSource() = default;
+
+    // 返回HTTP状态码，连接失败返回0
+    virtual int Open() = 0;
+    // 从 offset 字节处重新打开（断点续传、拖动），会先关闭当前连接，成功返回206，不支持时返回0
+    virtual int OpenAt(size_t offset) { return offset == 0 ? Open() : 0; }
+    // 返回读取的字节数，0表示暂无数据或已结束，<0表示出错
+    virtual int Read(uint8_t* buffer, size_t size) = 0;
+    virtual void Close() = 0;
+    // Open成功后预期的总字节数，未知返回0
+    virtual size_t length() const { return 0; }
+    // 拉流线程每次读取的最大字节数，本地文件用大块顺序读
+    virtual size_t read_size() const { return 4096; }
+};
+
+class HttpStreamSource : public StreamSource {
+public:
+    HttpStreamSource(const std::string& url, const std::string& user_agent);
+
+    void SetHeader(const std::string& key, const std::string& value);
+    // 以 multipart/form-data 分块 POST 发送一个表单字段，默认使用 GET
+    void SetFormField(const std::string& name, const std::string& value);
+    void SetOpenRetries(int retries) { open_retries_ = retries; }
+
+    int Open() override { return OpenAt(0); }
+    int OpenAt(size_t offset) override;
+    int Read(uint8_t* buffer, size_t size) override;
+    void Close() override;
+    size_t length() const override { return length_; }
+
+private:
+    std::string url_;
+    std::vector<std::pair<std::string, std::string>> headers_;
+    std::string form_name_;
+    std::string form_value_;
+    int open_retries_ = 0;
+    size_t length_ = 0;
+    std::unique_ptr<Http> http_;
+    std::unique_ptr<TransferScope> transfer_;
+};
+
+// 解复用和解码阶段：识别容器头，把压缩数据解码为单声道PCM
+class StreamDecoder {
+public:
+    static constexpr int kMaxFrameSamples = 2304;
+
+    virtual ~StreamDecoder() = default;
+    virtual const char* name() const = 0;
+
+    // 检查流开头是否为本格式，header_size 为需要跳过的容器头字节数（可能超过 size）
+    virtual bool Probe(const uint8_t* data, size_t size, size_t* header_size) = 0;
+    // 解码一帧到 pcm（最多 kMaxFrameSamples 个样本），consumed 为消耗的字节数
+    // 返回输出的单声道样本数，0 表示没有输出，<0 表示解码出错
+    virtual int Decode(const uint8_t* data, size_t size, size_t* consumed, int16_t* pcm, int* sample_rate) = 0;
+
+    // 拖动后数据从任意位置开始，丢弃解到一半的帧或分页
+    virtual void Reset() {}
+    // 空闲时释放解码器状态，下次 Probe 时重新创建
+    virtual void Release() {}
+
+    // 用于按时间估算字节位置，解码出第一帧之前返回0
+    virtual int bytes_per_second() const = 0;
+    virtual int block_align() const { return 1; }
+};
+
+class Mp3StreamDecoder : public StreamDecoder {
+public:
+    ~Mp3StreamDecoder();
+
+    const char* name() const override { return "mp3"; }
+    bool Probe(const uint8_t* data, size_t size, size_t* header_size) override;
+    int Decode(const uint8_t* data, size_t size, size_t* consumed, int16_t* pcm, int* sample_rate) override;
+    void Release() override;
+    // 按当前帧的码率估算，VBR文件只是近似位置
+    int bytes_per_second() const override { return frame_info_.bitrate / 8; }
+
+private:
+    HMP3Decoder decoder_ = nullptr;
+    MP3FrameInfo frame_info_ = {};
+};
+
+// 8/16/24/32 位整数或 32 位浮点 PCM，任意声道数，解码即一遍格式转换和降为单声道
+class WavStreamDecoder : public StreamDecoder {
+public:
+    const char* name() const override { return "wav"; }
+    bool Probe(const uint8_t* data, size_t size, size_t* header_size) override;
+    int Decode(const uint8_t* data, size_t size, size_t* consumed, int16_t* pcm, int* sample_rate) override;
+    int bytes_per_second() const override { return sample_rate_ * block_align(); }
+    int block_align() const override { return channels_ * bits_per_sample_ / 8; }
+
+private:
+    int channels_ = 1;
+    int sample_rate_ = 16000;
+    int bits_per_sample_ = 16;
+    bool is_float_ = false;
+};
+
+// Ogg封装的Opus（RFC 7845），只支持单声道/立体声（映射族0），由libopus直接解码为单声道
+class OggOpusStreamDecoder : public StreamDecoder {
+public:
+    ~OggOpusStreamDecoder();
+
+    const char* name() const override { return "opus"; }
+    bool Probe(const uint8_t* data, size_t size, size_t* header_size) override;
+    int Decode(const uint8_t* data, size_t size, size_t* consumed, int16_t* pcm, int* sample_rate) override;
+    void Reset() override;
+    void Release() override;
+    int bytes_per_second() const override { return bytes_per_second_; }
+
+private:
+    static constexpr size_t kMaxPacketSize = 8 * 1024;
+
+    // 返回分页头长度，0表示数据不完整，<0表示不是分页头
+    int ParsePageHeader(const uint8_t* data, size_t size);
+    int DecodePacket(int16_t* pcm);
+    int TakeDecoded(int16_t* pcm);
+
+    OpusDecoder* decoder_ = nullptr;
+    int decode_rate_ = 48000;
+    int channels_ = 0;
+    int pre_skip_ = 0;                  // 开头需要丢弃的样本数（按 decode_rate_ 换算）
+    int packets_ = 0;                   // 已完成的包数，前两个是 OpusHead 和 OpusTags
+    int bytes_per_second_ = 0;
+
+    // 分页解析状态，一个包可以跨越多个分页
+    uint8_t lacing_[255];
+    int segment_count_ = 0;
+    int segment_index_ = 0;
+    size_t segment_filled_ = 0;
+    bool drop_packet_ = false;          // 分页从半个包开始（拖动后），丢弃这个包
+    std::vector<uint8_t> packet_;
+
+    // 超过 kMaxFrameSamples 的长帧（最长120ms）先解到这里，分多次输出
+    std::vector<int16_t> decoded_;
+    size_t decoded_size_ = 0;
+    size_t decoded_pos_ = 0;
+};
+
+struct StreamPlayerConfig {
+    const void* owner = nullptr;            // 发起播放的播放器（音乐 / 唱歌）
+    size_t buffer_size = 192 * 1024;        // 最多缓存的字节数，不超过环形缓冲区容量
+    size_t start_threshold = 32 * 1024;     // 还没测出下载速度时，开始播放前需要缓存的字节数
+    int nominal_bitrate = 16000;            // 解码之前假定的码率（字节/秒），默认128kbps MP3
+    int first_byte_timeout_ms = 0;          // 大于0时，收到首字节前读到0字节会继续等待
+    int tempo_percent = 100;                // 播放速度和升降调，见 SetTimePitch()
+    int semitones = 0;
+
+    // 以下回调在拉流线程或播放线程中调用，不能在其中调用 Stop()
+    std::function<void()> on_start;                 // 设备空闲、开始输出第一帧之前
+    // 每帧写入混音器之后调用，play_time_ms 为这一帧结束时的位置
+    std::function<void(const int16_t* pcm, size_t samples, int64_t play_time_ms)> on_pcm;
+    std::function<void(int status_code)> on_fetch_error;    // 打开失败或首字节超时（状态码为0），播放列表中打不开的曲目也会回调
+    std::function<void()> on_finished;              // 播放线程退出前
+
+    // 播放列表：当前曲目下载完成后调用，返回下一首的数据源（没有则返回空），
+    // 下一首接着写入同一个缓冲区，解码器不停止，实现无缝播放
+    std::function<std::unique_ptr<StreamSource>()> next_source;
+    std::function<void(size_t track)> on_track_start;      // 播放到第 track 首（从1开始计，不含第一首）
+    // MP3 开头的 ID3v2 标签跳过时原样收集起来交给回调，在播放线程中调用，回调里不能做耗时的解析和显示
+    std::function<void(std::vector<uint8_t>&& tag)> on_id3_tag;
+};
+
+/*
+ * Streaming engine shared by Esp32Music and Esp32Sing.
+ *
+ * A fetch thread reads the StreamSource into one PSRAM ring, the play thread probes the container
+ * (WAV, Ogg Opus, or MP3 with an optional ID3 tag), decodes in place and hands mono PCM to
+ * Application::AddAudioData.
+ * Only one stream plays at a time, starting a stream stops the previous one whoever owned it, so the
+ * ring, the MP3 decoder state and the two thread stacks exist once.
+ *
+ * Tracks from next_source are appended to the same ring as soon as the current download completes,
+ * i.e. while the last buffer_size bytes of the current track are still playing, and their start
+ * offsets are queued so the play thread re-probes the format exactly at the boundary.
+ *
+ * The start threshold adapts to the link: the fetch thread measures bytes/s over the time spent in
+ * Read(), and the play thread buffers D * (bitrate / rate - 1) bytes for the D bytes still to download,
+ * or only kMinStartThreshold when the link is clearly faster than the stream. An underrun rebuffers
+ * with the same rule.
+ *
+ * A read error or a short body reopens the source at the downloaded offset with backoff. Seek() uses
+ * the same reopen: the byte position is estimated from the bitrate, the ring is flushed and the play
+ * thread resyncs on the next frame.
+ *
+ * SetTimePitch() puts a TimePitchShifter between the decoder and the mixer, tempo and key change on the
+ * next frame from the same buffered data, play_time_ms() stays in song time.
+ */
+struct StreamPlayerStatus {
+    size_t buffered_bytes;
+    size_t buffer_size;
+    size_t start_threshold;
+    int download_rate;      // 字节/秒
+    int bitrate;            // 字节/秒，0表示还不知道
+    int underruns;
+    int decode_load;        // 解码耗时占播放时长的百分比
+    int decode_max_us;      // 最近统计窗口内最慢的一帧
+    bool suspended;         // 对话期间暂停，回到待机后继续
+};
+
+class StreamPlayer {
+public:
+    static constexpr size_t kBufferSize = 192 * 1024;
+    static constexpr size_t kReadGuardSize = 4096;     // 大于最大MP3帧，跨环尾的帧也能连续解码
+    static constexpr int kResumeRetries = 5;           // 断线后续传次数，间隔从500ms开始翻倍
+    static constexpr size_t kMinStartThreshold = 8 * 1024;
+    static constexpr size_t kMaxId3TagSize = 512 * 1024;  // 更大的标签（高清封面）只跳过不收集
+
+    static StreamPlayer& GetInstance() {
+        static StreamPlayer instance;
+        return instance;
+    }
+    StreamPlayer(const StreamPlayer&) = delete;
+    StreamPlayer& operator=(const StreamPlayer&) = delete;
+
+    bool Start(std::unique_ptr<StreamSource> source, StreamPlayerConfig config);
+    // 停止当前的流并等待线程退出
+    void Stop();
+    // 由时钟定时器调用，停止播放超过 CONFIG_STREAM_IDLE_RELEASE_S 秒后释放缓冲区和解码器
+    void ReleaseIdle();
+
+    // 在当前曲目内跳转到 time_ms，下一首已经开始预取时不支持
+    bool Seek(const void* owner, int64_t time_ms);
+
+    // 对话期间暂停：播放线程停在帧边界上，解码器状态、播放位置和缓冲区都保留，缓冲区满后拉流线程自然停下
+    bool Suspend(const void* owner);
+    // under_voice 为真时在说话状态下也继续播放，由混音器压低到 TTS 下方
+    bool Resume(const void* owner, bool under_voice = false);
+    // 暂停了多久，没有暂停时返回 0
+    int64_t suspended_ms();
+
+    // 实时改变速度（50-200%）和音调（±12 个半音），在播放线程的下一帧生效，不需要重新下载
+    bool SetTimePitch(const void* owner, int tempo_percent, int semitones);
+
+    bool IsActive(const void* owner) const;
+    bool IsDownloading(const void* owner) const;
+    size_t buffered_bytes();
+    bool GetStatus(const void* owner, StreamPlayerStatus* status);
+    int64_t play_time_ms() const { return play_time_ms_.load(); }
+    // 每一帧解码输出都发布到这里，给频谱显示读取
+    PcmTap& pcm_tap() { return pcm_tap_; }
+    // 与频谱共用同一份解码输出，给舞蹈动作提供节拍
+    BeatTracker& beat_tracker() { return beat_tracker_; }
+
+private:
+    StreamPlayer();
+    ~StreamPlayer();
+
+    void FetchThread();
+    bool FetchSource(bool* first_byte_timeout);
+    bool ResumeSource(size_t offset, bool backoff);
+    bool OpenNextSource();
+    void PlayThread();
+    void WaitForBuffer();
+    size_t StartThresholdLocked() const;
+    void UpdateDownloadRate(size_t bytes, int64_t elapsed_us);
+    bool ConsumeBuffer(size_t bytes, uint32_t generation);
+    void AbortFetch(int status_code);
+    void ResetSampleRate();
+
+    std::mutex control_mutex_;
+    std::mutex buffer_mutex_;
+    std::condition_variable buffer_cv_;
+    StreamRingBuffer buffer_;
+    uint64_t written_bytes_ = 0;            // 整个流中已写入和已消费的字节数，用于定位曲目边界
+    uint64_t consumed_bytes_ = 0;
+    std::deque<uint64_t> track_starts_;     // 后续曲目在流中的起始位置
+
+    // 拖动：由 Seek 设置，拉流线程清空缓冲区后从 seek_offset_ 重新打开，播放线程按 generation_ 丢弃旧数据
+    bool fetch_done_ = false;
+    bool opening_next_ = false;
+    bool seek_pending_ = false;
+    bool suspended_ = false;
+    int64_t suspended_since_us_ = 0;
+    size_t seek_offset_ = 0;
+    int64_t seek_time_ms_ = 0;
+    uint32_t generation_ = 0;
+    size_t data_offset_ = 0;                // 当前曲目中音频数据的起始位置和播放位置，由播放线程更新
+    size_t play_offset_ = 0;
+    int bytes_per_second_ = 0;
+    int block_align_ = 1;
+
+    // 下载速度和剩余字节数由拉流线程更新，用于计算开始播放的门槛
+    int download_rate_ = 0;
+    size_t download_remaining_ = 0;         // 0表示长度未知
+    size_t source_length_ = 0;              // 当前曲目的总字节数，0表示未知
+    size_t start_threshold_ = 0;
+    int underruns_ = 0;
+    int decode_load_ = 0;
+    int decode_max_us_ = 0;
+    size_t rate_window_bytes_ = 0;
+    int64_t rate_window_us_ = 0;
+
+    std::unique_ptr<StreamSource> source_;
+    StreamPlayerConfig config_;
+    std::atomic<const void*> owner_{nullptr};
+    std::atomic<bool> is_downloading_{false};
+    std::atomic<bool> is_playing_{false};
+    std::atomic<bool> under_voice_{false};
+    std::atomic<int64_t> play_time_ms_{0};
+    std::atomic<int> tempo_percent_{100};
+    std::atomic<int> semitones_{0};
+    std::thread fetch_thread_;
+    std::thread play_thread_;
+    std::atomic<int> running_threads_{0};   // 自然结束的线程仍是 joinable，用它判断是否已经退出
+    int64_t idle_since_us_ = 0;
+    bool released_ = true;
+
+    Mp3StreamDecoder mp3_decoder_;
+    WavStreamDecoder wav_decoder_;
+    OggOpusStreamDecoder opus_decoder_;
+    PcmTap pcm_tap_{StreamDecoder::kMaxFrameSamples};
+    BeatTracker beat_tracker_;
+    // 只由播放线程访问
+    TimePitchShifter time_pitch_;
+    std::vector<int16_t> time_pitch_pcm_;
+};
+
+#endif // STREAM_PLAYER_H
@@ -0,0 +1,64 @@
+#include "stream_ring_buffer.h"
+
+#include <esp_log.h>
+#include <algorithm>
+#include <cstring>
+
+#define TAG "StreamRingBuffer"
+
+StreamRingBuffer::StreamRingBuffer(AudioMemoryOwner owner, size_t capacity, size_t read_guard)
+    : owner_(owner), capacity_(capacity), read_guard_(std::min(read_guard, capacity)) {
+}
+
+StreamRingBuffer::~StreamRingBuffer() {
+    AudioMemory::Free(buffer_);
+}
+
+bool StreamRingBuffer::Allocate() {
+    if (buffer_ == nullptr) {
+        buffer_ = (uint8_t*)AudioMemory::Allocate(owner_, capacity_ + read_guard_, MALLOC_CAP_SPIRAM);
+        if (buffer_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate %u bytes", (unsigned)(capacity_ + read_guard_));
+            return false;
+        }
+    }
+    return true;
+}
+
+void StreamRingBuffer::Release() {
+    AudioMemory::Free(buffer_);
+    buffer_ = nullptr;
+    Clear();
+}
+
+void StreamRingBuffer::Clear() {
+    read_pos_ = 0;
+    write_pos_ = 0;
+    size_ = 0;
+}
+
+uint8_t* StreamRingBuffer::write_pointer(size_t* contiguous) {
+    *contiguous = buffer_ ? std::min(space(), capacity_ - write_pos_) : 0;
+    return buffer_ + write_pos_;
+}
+
+void StreamRingBuffer::Commit(size_t bytes) {
+    bytes = std::min(bytes, std::min(space(), capacity_ - write_pos_));
+    if (write_pos_ < read_guard_) {
+        // Mirror the start of the ring behind its end
+        memcpy(buffer_ + capacity_ + write_pos_, buffer_ + write_pos_, std::min(bytes, read_guard_ - write_pos_));
+    }
+    write_pos_ = (write_pos_ + bytes) % capacity_;
+    size_ += bytes;
+}
+
+uint8_t* StreamRingBuffer::read_pointer(size_t* contiguous) {
+    *contiguous = buffer_ ? std::min(size_, capacity_ + read_guard_ - read_pos_) : 0;
+    return buffer_ + read_pos_;
+}
+
+void StreamRingBuffer::Consume(size_t bytes) {
+    bytes = std::min(bytes, size_);
+    read_pos_ = (read_pos_ + bytes) % capacity_;
+    size_ -= bytes;
+}
@@ -0,0 +1,49 @@
+#ifndef STREAM_RING_BUFFER_H
+#define STREAM_RING_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "audio_memory.h"
+
+/*
+ * Byte ring for streamed audio files, one producer (HTTP) and one consumer (decoder).
+ *
+ * The producer reads the network straight into write_pointer() and the decoder decodes in place from
+ * read_pointer(). The first read_guard bytes are mirrored behind the end of the ring, so a frame that
+ * wraps around is still contiguous. The data is accessed outside the lock, only the index updates
+ * (Commit, Consume, Clear and the size queries) must be serialized by the caller.
+ */
+class StreamRingBuffer {
+public:
+    StreamRingBuffer(AudioMemoryOwner owner, size_t capacity, size_t read_guard);
+    ~StreamRingBuffer();
+
+    // The storage is allocated on first use and kept until Release()
+    bool Allocate();
+    void Release();
+    void Clear();
+
+    size_t capacity() const { return capacity_; }
+    size_t size() const { return size_; }
+    size_t space() const { return capacity_ - size_; }
+
+    // Contiguous free bytes at the write position
+    uint8_t* write_pointer(size_t* contiguous);
+    void Commit(size_t bytes);
+
+    // Readable bytes at the read position, at least min(size(), read_guard) of them are contiguous
+    uint8_t* read_pointer(size_t* contiguous);
+    void Consume(size_t bytes);
+
+private:
+    AudioMemoryOwner owner_;
+    size_t capacity_;
+    size_t read_guard_;
+    uint8_t* buffer_ = nullptr;
+    size_t read_pos_ = 0;
+    size_t write_pos_ = 0;
+    size_t size_ = 0;
+};
+
+#endif // STREAM_RING_BUFFER_H
@@ -0,0 +1,187 @@
+#include "time_pitch_shifter.h"
+
+#include <esp_log.h>
+#include <dsps_dotprod.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#define TAG "TimePitchShifter"
+
+// 每次最多放入的输入样本数，超过时分批处理
+#define TIME_PITCH_INPUT_CHUNK 2048
+// 粗搜索的步长，对齐到 4 个 float 才能走 SIMD 点积
+#define TIME_PITCH_COARSE_STEP 4
+
+static inline int16_t ClampSample(float value) {
+    return (int16_t)std::clamp(lrintf(value), -32768L, 32767L);
+}
+
+void TimePitchShifter::Configure(int sample_rate, int tempo_percent, int semitones) {
+    tempo_percent = std::clamp(tempo_percent, kMinTempoPercent, kMaxTempoPercent);
+    semitones = std::clamp(semitones, -kMaxSemitones, kMaxSemitones);
+    if (sample_rate == sample_rate_ && tempo_percent == tempo_percent_ && semitones == semitones_) {
+        return;
+    }
+
+    float pitch = powf(2.0f, semitones / 12.0f);
+    sample_rate_ = sample_rate;
+    tempo_percent_ = tempo_percent;
+    semitones_ = semitones;
+    output_sample_rate_ = lroundf(sample_rate * pitch);
+    // 先按音高比例拉长，以 sample_rate * pitch 播放时音高升高、时长恢复
+    speed_ = tempo_percent / 100.0 / pitch;
+
+    if (!active()) {
+        Reset();
+        return;
+    }
+    sequence_ = (sample_rate * kSequenceMs / 1000) & ~3;
+    seek_ = (sample_rate * kSeekMs / 1000) & ~3;
+    overlap_ = (sample_rate * kOverlapMs / 1000) & ~3;
+    size_t capacity = seek_ + sequence_ + TIME_PITCH_INPUT_CHUNK;
+    if (capacity != capacity_ || !memory_) {
+        memory_ = AudioBuffer(kAudioMemoryStream, (capacity + overlap_) * sizeof(float) + 16);
+        if (!memory_) {
+            ESP_LOGE(TAG, "Failed to allocate the WSOLA buffers, tempo and key change disabled");
+            capacity_ = 0;
+            tempo_percent_ = 100;
+            semitones_ = 0;
+            output_sample_rate_ = sample_rate;
+            return;
+        }
+        capacity_ = capacity;
+        input_ = (float*)(((uintptr_t)memory_.data() + 15) & ~(uintptr_t)15);
+        tail_ = input_ + capacity_;
+    }
+    Reset();
+    ESP_LOGI(TAG, "Tempo %d%%, %+d semitones at %d Hz", tempo_percent_, semitones_, sample_rate_);
+}
+
+void TimePitchShifter::Reset() {
+    input_size_ = 0;
+    pending_skip_ = 0;
+    position_fraction_ = 0;
+    has_tail_ = false;
+}
+
+void TimePitchShifter::Release() {
+    memory_ = AudioBuffer();
+    input_ = nullptr;
+    tail_ = nullptr;
+    capacity_ = 0;
+    sample_rate_ = 0;
+    Reset();
+}
+
+int TimePitchShifter::BestOffset(const float* input) const {
+    int best_offset = 0;
+    float best_score = -FLT_MAX;
+    float energy = 0;
+    dsps_dotprod_f32(input, input, &energy, overlap_);
+    for (int offset = 0; offset < seek_; offset += TIME_PITCH_COARSE_STEP) {
+        float correlation = 0;
+        dsps_dotprod_f32(input + offset, tail_, &correlation, overlap_);
+        // 保留符号的归一化相关的平方，省掉开方
+        float score = correlation * fabsf(correlation) / (std::max(energy, 0.0f) + 1.0f);
+        if (score > best_score) {
+            best_score = score;
+            best_offset = offset;
+        }
+        for (int i = 0; i < TIME_PITCH_COARSE_STEP; i++) {
+            float entering = input[offset + overlap_ + i];
+            float leaving = input[offset + i];
+            energy += entering * entering - leaving * leaving;
+        }
+    }
+
+    // 在粗搜索结果附近逐个样本细调
+    int coarse = best_offset;
+    for (int offset = std::max(coarse - TIME_PITCH_COARSE_STEP + 1, 0);
+         offset < std::min(coarse + TIME_PITCH_COARSE_STEP, seek_); offset++) {
+        if (offset == coarse) {
+            continue;
+        }
+        float correlation = 0;
+        dsps_dotprod_f32(input + offset, tail_, &correlation, overlap_);
+        dsps_dotprod_f32(input + offset, input + offset, &energy, overlap_);
+        float score = correlation * fabsf(correlation) / (energy + 1.0f);
+        if (score > best_score) {
+            best_score = score;
+            best_offset = offset;
+        }
+    }
+    return best_offset;
+}
+
+void TimePitchShifter::Step(std::vector<int16_t>& output, size_t* position) {
+    const float* segment = input_ + *position;
+    if (has_tail_) {
+        segment += BestOffset(segment);
+    }
+
+    size_t base = output.size();
+    output.resize(base + sequence_ - overlap_);
+    int16_t* out = output.data() + base;
+    if (has_tail_) {
+        // 与上一段的末尾线性交叉淡化
+        float step = 1.0f / overlap_;
+        for (int i = 0; i < overlap_; i++) {
+            out[i] = ClampSample(tail_[i] + (segment[i] - tail_[i]) * (i * step));
+        }
+    } else {
+        for (int i = 0; i < overlap_; i++) {
+            out[i] = ClampSample(segment[i]);
+        }
+    }
+    for (int i = overlap_; i < sequence_ - overlap_; i++) {
+        out[i] = ClampSample(segment[i]);
+    }
+    memcpy(tail_, segment + sequence_ - overlap_, overlap_ * sizeof(float));
+    has_tail_ = true;
+
+    // 读位置保持 4 样本对齐，余数累积到下一段
+    double advance = speed_ * (sequence_ - overlap_) + position_fraction_;
+    size_t whole = (size_t)advance & ~(size_t)3;
+    position_fraction_ = advance - whole;
+    *position += whole;
+}
+
+void TimePitchShifter::Process(const int16_t* input, size_t samples, std::vector<int16_t>& output) {
+    output.clear();
+    if (!active() || capacity_ == 0) {
+        output.assign(input, input + samples);
+        return;
+    }
+
+    while (samples > 0) {
+        if (pending_skip_ > 0) {
+            size_t skip = std::min(pending_skip_, samples);
+            input += skip;
+            samples -= skip;
+            pending_skip_ -= skip;
+            continue;
+        }
+        size_t count = std::min(samples, capacity_ - input_size_);
+        for (size_t i = 0; i < count; i++) {
+            input_[input_size_ + i] = input[i];
+        }
+        input_size_ += count;
+        input += count;
+        samples -= count;
+
+        size_t position = 0;
+        while (position < input_size_ && input_size_ - position >= (size_t)(seek_ + sequence_)) {
+            Step(output, &position);
+        }
+        if (position >= input_size_) {
+            pending_skip_ = position - input_size_;
+            input_size_ = 0;
+        } else if (position > 0) {
+            // 剩下的不到一段，移到开头保持对齐
+            memmove(input_, input_ + position, (input_size_ - position) * sizeof(float));
+            input_size_ -= position;
+        }
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef TIME_PITCH_SHIFTER_H
+#define TIME_PITCH_SHIFTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "audio_memory.h"
+
+/*
+ * Real-time tempo and key change of the decoded music stream (WSOLA), mono int16 in and out.
+ *
+ * The input is cut into kSequenceMs segments that overlap by kOverlapMs; each next segment is taken from
+ * around the nominal read position, at the offset within kSeekMs whose start best matches the tail of the
+ * previous one (normalized cross-correlation, esp-dsp dot products, the SIMD version on the S3), and cross
+ * faded into it. The read position advances speed times faster than the output, which changes the tempo
+ * without changing the pitch.
+ * The key change is a stretch by the pitch ratio whose output is declared at sample_rate * ratio, the
+ * resampler in Application::AddAudioData() then brings it back to the codec rate at the shifted pitch, so
+ * no second resampling pass is needed here. About 55 ms of input is held back, time domain only: unlike a
+ * phase vocoder it keeps transients and voices sharp and needs no FFT.
+ */
+class TimePitchShifter {
+public:
+    static constexpr int kSequenceMs = 40;
+    static constexpr int kSeekMs = 15;
+    static constexpr int kOverlapMs = 8;
+    static constexpr int kMinTempoPercent = 50;
+    static constexpr int kMaxTempoPercent = 200;
+    static constexpr int kMaxSemitones = 12;
+
+    // tempo_percent 为 100 且 semitones 为 0 时不做处理
+    void Configure(int sample_rate, int tempo_percent, int semitones);
+    // 拖动、换曲之后丢弃保留的输入
+    void Reset();
+    void Release();
+
+    bool active() const { return tempo_percent_ != 100 || semitones_ != 0; }
+    int sample_rate() const { return sample_rate_; }
+    int tempo_percent() const { return tempo_percent_; }
+    int semitones() const { return semitones_; }
+    // 输出的名义采样率，升调时高于输入
+    int output_sample_rate() const { return output_sample_rate_; }
+
+    // Output is resized to the produced samples, its capacity is kept across calls
+    void Process(const int16_t* input, size_t samples, std::vector<int16_t>& output);
+
+private:
+    int sample_rate_ = 0;
+    int output_sample_rate_ = 0;
+    int tempo_percent_ = 100;
+    int semitones_ = 0;
+    double speed_ = 1.0;            // 每输出一个样本前进的输入样本数
+    int sequence_ = 0;
+    int seek_ = 0;
+    int overlap_ = 0;
+    size_t capacity_ = 0;
+
+    // 16 字节对齐，SIMD 点积要求
+    AudioBuffer memory_;
+    float* input_ = nullptr;        // 未处理的输入
+    float* tail_ = nullptr;         // 上一段末尾 overlap_ 个样本
+    size_t input_size_ = 0;
+    size_t pending_skip_ = 0;       // 快速播放时跳过了还没收到的输入
+    double position_fraction_ = 0;
+    bool has_tail_ = false;
+
+    int BestOffset(const float* input) const;
+    void Step(std::vector<int16_t>& output, size_t* position);
+};
+
+#endif // TIME_PITCH_SHIFTER_H
@@ -0,0 +1,235 @@
+#include "tls_session_network.h"
+#include "memory_guard.h"
+
+#include <esp_log.h>
+#include <esp_tls.h>
+#include <esp_crt_bundle.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/task.h>
+#include <unistd.h>
+
+#include <list>
+#include <mutex>
+#include <string>
+
+#define TAG "TlsSession"
+
+#define TLS_SESSION_CACHE_SIZE 4
+#define TLS_RECEIVE_TASK_EXIT  (1 << 0)
+
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+// 最近使用的会话在前，超出容量时释放最旧的
+class TlsSessionCache {
+public:
+    static TlsSessionCache& GetInstance() {
+        static TlsSessionCache instance;
+        return instance;
+    }
+
+    // 取出后由调用者持有，连接成功后再用 Store() 放回新的会话
+    esp_tls_client_session_t* Take(const std::string& key) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+            if (it->key == key) {
+                auto session = it->session;
+                entries_.erase(it);
+                return session;
+            }
+        }
+        return nullptr;
+    }
+
+    void Store(const std::string& key, esp_tls_client_session_t* session) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+            if (it->key == key) {
+                esp_tls_free_client_session(it->session);
+                entries_.erase(it);
+                break;
+            }
+        }
+        entries_.push_front({key, session});
+        if (entries_.size() > TLS_SESSION_CACHE_SIZE) {
+            esp_tls_free_client_session(entries_.back().session);
+            entries_.pop_back();
+        }
+    }
+
+private:
+    struct Entry {
+        std::string key;
+        esp_tls_client_session_t* session;
+    };
+
+    std::mutex mutex_;
+    std::list<Entry> entries_;
+};
+#endif
+
+// 与 esp-ml307 的 EspSsl 相同，只是连接时带上缓存的会话
+class ResumableSsl : public Tcp {
+public:
+    ResumableSsl() {
+        event_group_ = xEventGroupCreate();
+    }
+
+    ~ResumableSsl() {
+        Disconnect();
+        vEventGroupDelete(event_group_);
+    }
+
+    bool Connect(const std::string& host, int port) override {
+        if (tls_client_ != nullptr) {
+            ESP_LOGE(TAG, "tls client has been initialized");
+            return false;
+        }
+        key_ = host + ":" + std::to_string(port);
+
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        auto session = TlsSessionCache::GetInstance().Take(key_);
+        if (session != nullptr) {
+            bool ok = Handshake(host, port, session);
+            esp_tls_free_client_session(session);
+            if (ok) {
+                ESP_LOGI(TAG, "Resumed TLS session with %s", key_.c_str());
+                return Start();
+            }
+            ESP_LOGW(TAG, "Failed to resume TLS session with %s, retry with full handshake", key_.c_str());
+        }
+#endif
+        if (!Handshake(host, port, nullptr)) {
+            ESP_LOGE(TAG, "Failed to connect to %s", key_.c_str());
+            return false;
+        }
+        return Start();
+    }
+
+    void Disconnect() override {
+        connected_ = false;
+        if (tls_client_ == nullptr) {
+            return;
+        }
+
+        int sockfd;
+        if (esp_tls_get_conn_sockfd(tls_client_, &sockfd) == ESP_OK && sockfd >= 0) {
+            close(sockfd);
+        }
+        auto bits = xEventGroupWaitBits(event_group_, TLS_RECEIVE_TASK_EXIT, pdFALSE, pdFALSE, pdMS_TO_TICKS(10000));
+        if (!(bits & TLS_RECEIVE_TASK_EXIT)) {
+            ESP_LOGE(TAG, "Failed to wait for receive task exit");
+        }
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        // TLS 1.3 的 ticket 在握手之后才下发，销毁前再保存一次；接收任务还在读同一个 ssl 上下文时不碰它
+        if (bits & TLS_RECEIVE_TASK_EXIT) {
+            SaveSession();
+        }
+#endif
+        esp_tls_conn_destroy(tls_client_);
+        tls_client_ = nullptr;
+    }
+
+    /* CONFIG_MBEDTLS_SSL_RENEGOTIATION should be disabled in sdkconfig.
+     * Otherwise, invalid memory access may be triggered.
+     */
+    int Send(const std::string& data) override {
+        if (!connected_) {
+            ESP_LOGE(TAG, "Not connected");
+            return -1;
+        }
+
+        size_t total_sent = 0;
+        while (total_sent < data.size()) {
+            int ret = esp_tls_conn_write(tls_client_, data.data() + total_sent, data.size() - total_sent);
+            if (ret == ESP_TLS_ERR_SSL_WANT_WRITE) {
+                continue;
+            }
+            if (ret <= 0) {
+                ESP_LOGE(TAG, "SSL send failed: ret=%d, errno=%d", ret, errno);
+                return ret;
+            }
+            total_sent += ret;
+        }
+        return total_sent;
+    }
+
+private:
+    esp_tls_t* tls_client_ = nullptr;
+    EventGroupHandle_t event_group_ = nullptr;
+    std::string key_;
+
+    bool Handshake(const std::string& host, int port, esp_tls_client_session_t* session) {
+        // 握手时分配的证书链和密钥交换缓冲区最大，放出预留的连续块给它们
+        MemoryReservation reservation(kMemoryReserveTls);
+        tls_client_ = esp_tls_init();
+        if (tls_client_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to initialize TLS");
+            return false;
+        }
+
+        esp_tls_cfg_t cfg = {};
+        cfg.crt_bundle_attach = esp_crt_bundle_attach;
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        cfg.client_session = session;
+#endif
+        if (esp_tls_conn_new_sync(host.c_str(), host.length(), port, &cfg, tls_client_) != 1) {
+            esp_tls_conn_destroy(tls_client_);
+            tls_client_ = nullptr;
+            return false;
+        }
+        return true;
+    }
+
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    void SaveSession() {
+        auto session = esp_tls_get_client_session(tls_client_);
+        if (session != nullptr) {
+            TlsSessionCache::GetInstance().Store(key_, session);
+        }
+    }
+#endif
+
+    bool Start() {
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        SaveSession();
+#endif
+        connected_ = true;
+        xEventGroupClearBits(event_group_, TLS_RECEIVE_TASK_EXIT);
+        xTaskCreate([](void* arg) {
+            auto ssl = (ResumableSsl*)arg;
+            ssl->ReceiveTask();
+            xEventGroupSetBits(ssl->event_group_, TLS_RECEIVE_TASK_EXIT);
+            vTaskDelete(NULL);
+        }, "ssl_receive", 4096, this, 1, nullptr);
+        return true;
+    }
+
+    void ReceiveTask() {
+        std::string data;
+        while (connected_) {
+            data.resize(1500);
+            int ret = esp_tls_conn_read(tls_client_, data.data(), data.size());
+            if (ret == ESP_TLS_ERR_SSL_WANT_READ) {
+                continue;
+            }
+            if (ret <= 0) {
+                if (ret < 0) {
+                    ESP_LOGE(TAG, "SSL receive failed: %d", ret);
+                }
+                connected_ = false;
+                if (disconnect_callback_) {
+                    disconnect_callback_();
+                }
+                break;
+            }
+            if (stream_callback_) {
+                data.resize(ret);
+                stream_callback_(data);
+            }
+        }
+    }
+};
+
+std::unique_ptr<Tcp> TlsSessionNetwork::CreateSsl(int connect_id) {
+    return std::make_unique<ResumableSsl>();
+}
@@ -0,0 +1,20 @@
+#ifndef TLS_SESSION_NETWORK_H
+#define TLS_SESSION_NETWORK_H
+
+#include <esp_network.h>
+
+/*
+ * EspNetwork whose TLS connections resume the previous session with the same host.
+ *
+ * HttpClient and WebSocket open their TLS connections through CreateSsl(), so OTA, music, camera and
+ * the websocket protocol all share one process-wide session cache keyed by host and port. A resumed
+ * handshake skips the certificate chain verification and the ECDHE key exchange, which cost more than
+ * a second of CPU on ESP32-C3. When the server refuses the cached session, the entry is dropped and
+ * the connection is retried with a full handshake.
+ */
+class TlsSessionNetwork : public EspNetwork {
+public:
+    std::unique_ptr<Tcp> CreateSsl(int connect_id = -1) override;
+};
+
+#endif // TLS_SESSION_NETWORK_H
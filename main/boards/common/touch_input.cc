@@ -0,0 +1,104 @@
+#include "touch_input.h"
+
+#include <esp_log.h>
+#include <esp_lvgl_port.h>
+
+#define TAG "TouchInput"
+
+#define TOUCH_GESTURE_SAMPLE_MS (1000 / CONFIG_TOUCH_GESTURE_SAMPLE_HZ)
+
+lv_indev_t* TouchInput::Attach(esp_lcd_touch_handle_t handle, lv_display_t* display) {
+    auto touch = new TouchInput(handle, display);
+    return touch->indev_;
+}
+
+TouchInput::TouchInput(esp_lcd_touch_handle_t handle, lv_display_t* display) : handle_(handle) {
+    event_mode_ = handle_->config.int_gpio_num != GPIO_NUM_NC;
+
+    lvgl_port_lock(0);
+    indev_ = lv_indev_create();
+    lv_indev_set_type(indev_, LV_INDEV_TYPE_POINTER);
+    lv_indev_set_read_cb(indev_, ReadCallback);
+    lv_indev_set_display(indev_, display);
+    lv_indev_set_driver_data(indev_, this);
+    lv_timer_t* timer = lv_indev_get_read_timer(indev_);
+    if (event_mode_) {
+        // 事件模式下读定时器被暂停，按下期间用它做手势采样
+        lv_timer_set_cb(timer, SampleTimerCallback);
+        lv_timer_set_period(timer, TOUCH_GESTURE_SAMPLE_MS);
+        lv_indev_set_mode(indev_, LV_INDEV_MODE_EVENT);
+    } else {
+        lv_timer_set_period(timer, CONFIG_TOUCH_IDLE_POLL_MS);
+    }
+    lvgl_port_unlock();
+
+    if (event_mode_) {
+        ESP_ERROR_CHECK(esp_lcd_touch_register_interrupt_callback_with_data(handle_, InterruptCallback, this));
+    }
+    ESP_LOGI(TAG, "Touch input in %s mode, %d Hz while pressed", event_mode_ ? "interrupt" : "polling",
+        CONFIG_TOUCH_GESTURE_SAMPLE_HZ);
+}
+
+void TouchInput::Read(lv_indev_data_t* data) {
+    bool sampling = sampling_;
+    sampling_ = false;
+    bool interrupt = interrupt_pending_.exchange(false);
+
+    // 手势中的中断只说明有新坐标，合并到下一次采样读取，不额外访问 I2C
+    if (event_mode_ && !sampling && (pressed_ || !interrupt)) {
+        data->point = point_;
+        data->state = pressed_ ? LV_INDEV_STATE_PRESSED : LV_INDEV_STATE_RELEASED;
+        return;
+    }
+
+    uint16_t x = 0;
+    uint16_t y = 0;
+    uint8_t count = 0;
+    esp_lcd_touch_read_data(handle_);
+    bool pressed = esp_lcd_touch_get_coordinates(handle_, &x, &y, nullptr, &count, 1) && count > 0;
+    if (pressed) {
+        point_.x = x;
+        point_.y = y;
+    }
+    SetPressed(pressed);
+
+    data->point = point_;
+    data->state = pressed ? LV_INDEV_STATE_PRESSED : LV_INDEV_STATE_RELEASED;
+}
+
+void TouchInput::SetPressed(bool pressed) {
+    if (pressed == pressed_) {
+        return;
+    }
+    pressed_ = pressed;
+
+    lv_timer_t* timer = lv_indev_get_read_timer(indev_);
+    if (event_mode_) {
+        if (pressed) {
+            lv_timer_reset(timer);
+            lv_timer_resume(timer);
+        } else {
+            lv_timer_pause(timer);
+        }
+    } else {
+        lv_timer_set_period(timer, pressed ? TOUCH_GESTURE_SAMPLE_MS : CONFIG_TOUCH_IDLE_POLL_MS);
+    }
+}
+
+void TouchInput::ReadCallback(lv_indev_t* indev, lv_indev_data_t* data) {
+    auto touch = static_cast<TouchInput*>(lv_indev_get_driver_data(indev));
+    touch->Read(data);
+}
+
+void TouchInput::SampleTimerCallback(lv_timer_t* timer) {
+    auto indev = static_cast<lv_indev_t*>(lv_timer_get_user_data(timer));
+    auto touch = static_cast<TouchInput*>(lv_indev_get_driver_data(indev));
+    touch->sampling_ = true;
+    lv_indev_read(indev);
+}
+
+void IRAM_ATTR TouchInput::InterruptCallback(esp_lcd_touch_handle_t handle) {
+    auto touch = static_cast<TouchInput*>(handle->config.user_data);
+    touch->interrupt_pending_ = true;
+    lvgl_port_task_wake(LVGL_PORT_EVENT_TOUCH, touch->indev_);
+}
@@ -0,0 +1,41 @@
+#ifndef TOUCH_INPUT_H_
+#define TOUCH_INPUT_H_
+
+#include <esp_lcd_touch.h>
+#include <lvgl.h>
+
+#include <atomic>
+
+/*
+ * LVGL pointer input for an esp_lcd_touch controller, in place of lvgl_port_add_touch(). With the INT pin
+ * wired the indev runs in event mode: the first interrupt wakes the LVGL task and is read at once, then the
+ * read timer samples the controller at CONFIG_TOUCH_GESTURE_SAMPLE_HZ until the finger is lifted and is
+ * paused again, so nothing is read over I2C while the screen is not touched. Interrupts during a gesture
+ * only mark new data, several of them between two samples are coalesced into one read of the latest point.
+ * Without the INT pin the read timer keeps polling, at the gesture rate while pressed and at
+ * CONFIG_TOUCH_IDLE_POLL_MS otherwise.
+ */
+class TouchInput {
+public:
+    // Attach the controller to the display, the returned indev lives as long as the board
+    static lv_indev_t* Attach(esp_lcd_touch_handle_t handle, lv_display_t* display = lv_display_get_default());
+
+private:
+    TouchInput(esp_lcd_touch_handle_t handle, lv_display_t* display);
+
+    esp_lcd_touch_handle_t handle_;
+    lv_indev_t* indev_ = nullptr;
+    bool event_mode_ = false;
+    bool sampling_ = false;
+    bool pressed_ = false;
+    lv_point_t point_ = {};
+    std::atomic<bool> interrupt_pending_ = false;
+
+    void Read(lv_indev_data_t* data);
+    void SetPressed(bool pressed);
+    static void ReadCallback(lv_indev_t* indev, lv_indev_data_t* data);
+    static void SampleTimerCallback(lv_timer_t* timer);
+    static void InterruptCallback(esp_lcd_touch_handle_t handle);
+};
+
+#endif // TOUCH_INPUT_H_
@@ -5,12 +5,24 @@
 #include "system_info.h"
 #include "font_awesome_symbols.h"
 #include "settings.h"
+#include "stream_player.h"
+#include "tls_session_network.h"
+#include "network_monitor.h"
+#include "assets.h"
 #include "assets/lang_config.h"
+#include "system_metrics.h"
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
-#include <esp_network.h>
+#include <freertos/semphr.h>
 #include <esp_log.h>
+#include <esp_wifi.h>
+#include <esp_timer.h>
+#include <esp_rom_crc.h>
+#include <mbedtls/pkcs5.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 
 #include <wifi_station.h>
 #include <wifi_configuration_ap.h>
@@ -19,6 +31,9 @@
 
 static const char *TAG = "WifiBoard";
 
+ESP_EVENT_DEFINE_BASE(WIFI_BOARD_EVENT);
+#define WIFI_BOARD_EVENT_FAST_CONNECT_STOPPED 0
+
 WifiBoard::WifiBoard() {
     Settings settings("wifi", true);
     wifi_config_mode_ = settings.GetInt("force_ap") == 1;
@@ -49,7 +64,7 @@ void WifiBoard::EnterWifiConfigMode() {
     hint += "\n\n";
     
     // 播报配置 WiFi 的提示
-    application.Alert(Lang::Strings::WIFI_CONFIG_MODE, hint.c_str(), "", Lang::Sounds::P3_WIFICONFIG);
+    application.Alert(Lang::Strings::WIFI_CONFIG_MODE, hint.c_str(), "", Assets::GetInstance().GetSound("wificonfig", Lang::Sounds::P3_WIFICONFIG));
 
     #if CONFIG_USE_ACOUSTIC_WIFI_PROVISIONING
     auto display = Board::GetInstance().GetDisplay();
@@ -87,8 +102,12 @@ void WifiBoard::StartNetwork() {
         return;
     }
 
+    int64_t start_time = esp_timer_get_time();
     auto& wifi_station = WifiStation::GetInstance();
     wifi_station.OnScanBegin([this]() {
+        if (fast_connecting_) {
+            return;
+        }
         auto display = Board::GetInstance().GetDisplay();
         display->ShowNotification(Lang::Strings::SCANNING_WIFI, 30000);
     });
@@ -102,22 +121,186 @@ void WifiBoard::StartNetwork() {
     wifi_station.OnConnected([this](const std::string& ssid) {
         auto display = Board::GetInstance().GetDisplay();
         std::string notification = Lang::Strings::CONNECTED_TO;
-        notification += ssid;
+        notification += ssid.empty() ? fast_ssid_ : ssid;
         display->ShowNotification(notification.c_str(), 30000);
     });
+#if CONFIG_WIFI_FAST_CONNECT
+    StartFastConnect(ssid_list);
+#endif
     wifi_station.Start();
 
     // Try to connect to WiFi, if failed, launch the WiFi configuration AP
-    if (!wifi_station.WaitForConnected(10 * 1000)) {
+    bool connected = wifi_station.WaitForConnected(10 * 1000);
+#if CONFIG_WIFI_FAST_CONNECT
+    // 快速连接失败后 WifiStation 先按 SSID 重连，都失败才在 10 秒后重新扫描，多等一轮
+    if (!connected && fast_connect_failed_) {
+        connected = wifi_station.WaitForConnected(10 * 1000);
+    }
+    StopFastConnect();
+#endif
+    if (!connected) {
         wifi_station.Stop();
         wifi_config_mode_ = true;
         EnterWifiConfigMode();
         return;
     }
+
+    int64_t now = esp_timer_get_time();
+    ESP_LOGI(TAG, "WiFi connected in %d ms, %d ms since boot", (int)((now - start_time) / 1000), (int)(now / 1000));
+    SystemMetrics::GetInstance().Gauge("wifi_connect_ms") = now / 1000;
+#if CONFIG_WIFI_FAST_CONNECT
+    SaveFastConnect(ssid_list);
+#endif
+}
+
+bool WifiBoard::StartFastConnect(const std::vector<SsidItem>& ssid_list) {
+    Settings settings("wifi");
+    auto ssid = settings.GetString("fast_ssid");
+    auto bssid = settings.GetString("fast_bssid");
+    int channel = settings.GetInt("fast_channel");
+    if (ssid.empty() || channel <= 0 || bssid.size() != 12) {
+        return false;
+    }
+    for (int i = 0; i < 6; i++) {
+        fast_bssid_[i] = strtoul(bssid.substr(i * 2, 2).c_str(), nullptr, 16);
+    }
+    // 密码改过（重新配网）后缓存的 PMK 失效
+    auto it = std::find_if(ssid_list.begin(), ssid_list.end(), [&ssid](const SsidItem& item) { return item.ssid == ssid; });
+    if (it == ssid_list.end() ||
+        (uint32_t)settings.GetInt("fast_pw_crc") != esp_rom_crc32_le(0, (const uint8_t*)it->password.data(), it->password.size())) {
+        return false;
+    }
+
+    fast_ssid_ = ssid;
+    fast_password_ = it->password;
+    fast_pmk_ = settings.GetString("fast_pmk");
+    fast_channel_ = channel;
+    fast_connect_failed_ = false;
+    fast_connecting_ = true;
+    // 先于 WifiStation 注册，STA_START 时先发起连接，WifiStation 随后的扫描在连接过程中会被驱动拒绝
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &WifiBoard::FastConnectEventHandler,
+        this, &fast_connect_handler_));
+    return true;
+}
+
+void WifiBoard::StopFastConnect() {
+    fast_connecting_ = false;
+    if (fast_connect_handler_ == nullptr) {
+        return;
+    }
+    esp_event_handler_instance_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, fast_connect_handler_);
+    fast_connect_handler_ = nullptr;
+
+    // 注销不等待事件任务里正在执行的回调；事件按顺序处理，标记事件处理完后回调一定已经返回，这时才能清除密码
+    auto done = xSemaphoreCreateBinary();
+    esp_event_handler_instance_t ack_handler = nullptr;
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_BOARD_EVENT, WIFI_BOARD_EVENT_FAST_CONNECT_STOPPED,
+        [](void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
+            xSemaphoreGive(static_cast<SemaphoreHandle_t>(arg));
+        }, done, &ack_handler));
+    bool posted = esp_event_post(WIFI_BOARD_EVENT, WIFI_BOARD_EVENT_FAST_CONNECT_STOPPED, nullptr, 0, pdMS_TO_TICKS(1000)) == ESP_OK;
+    if (posted) {
+        xSemaphoreTake(done, portMAX_DELAY);
+    }
+    esp_event_handler_instance_unregister(WIFI_BOARD_EVENT, WIFI_BOARD_EVENT_FAST_CONNECT_STOPPED, ack_handler);
+    vSemaphoreDelete(done);
+    if (!posted) {
+        // 回调可能还在读，宁可留着也不能清除
+        ESP_LOGW(TAG, "Failed to post fast connect stop event");
+        return;
+    }
+    fast_pmk_.clear();
+    fast_password_.clear();
+}
+
+void WifiBoard::FastConnectEventHandler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
+    auto* this_ = static_cast<WifiBoard*>(arg);
+    if (!this_->fast_connecting_) {
+        return;
+    }
+
+    wifi_config_t wifi_config = {};
+    strncpy((char*)wifi_config.sta.ssid, this_->fast_ssid_.c_str(), sizeof(wifi_config.sta.ssid));
+    if (event_id == WIFI_EVENT_STA_START) {
+        // 64 位十六进制的密码即 PSK，驱动不再做 4096 轮 PBKDF2
+        auto& password = this_->fast_pmk_.empty() ? this_->fast_password_ : this_->fast_pmk_;
+        memcpy(wifi_config.sta.password, password.data(), std::min(password.size(), sizeof(wifi_config.sta.password)));
+        memcpy(wifi_config.sta.bssid, this_->fast_bssid_, sizeof(wifi_config.sta.bssid));
+        wifi_config.sta.bssid_set = true;
+        wifi_config.sta.channel = this_->fast_channel_;
+        wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+        ESP_LOGI(TAG, "Fast connect to %s on channel %d", this_->fast_ssid_.c_str(), this_->fast_channel_);
+        esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+        esp_wifi_connect();
+    } else if (event_id == WIFI_EVENT_STA_DISCONNECTED) {
+        // AP 换了信道或不在了，改回只按 SSID 连接，WifiStation 的重连和重新扫描接手
+        auto* event = static_cast<wifi_event_sta_disconnected_t*>(event_data);
+        ESP_LOGW(TAG, "Fast connect failed, reason %d", event->reason);
+        this_->fast_connecting_ = false;
+        this_->fast_connect_failed_ = true;
+        strncpy((char*)wifi_config.sta.password, this_->fast_password_.c_str(), sizeof(wifi_config.sta.password));
+        esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    }
+}
+
+void WifiBoard::SaveFastConnect(const std::vector<SsidItem>& ssid_list) {
+    wifi_ap_record_t ap_info;
+    if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK) {
+        return;
+    }
+    std::string ssid((const char*)ap_info.ssid);
+    auto it = std::find_if(ssid_list.begin(), ssid_list.end(), [&ssid](const SsidItem& item) { return item.ssid == ssid; });
+    if (it == ssid_list.end()) {
+        return;
+    }
+    auto& password = it->password;
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*)password.data(), password.size());
+
+    char bssid[13];
+    snprintf(bssid, sizeof(bssid), "%02x%02x%02x%02x%02x%02x", ap_info.bssid[0], ap_info.bssid[1], ap_info.bssid[2],
+        ap_info.bssid[3], ap_info.bssid[4], ap_info.bssid[5]);
+
+    // wifi 命名空间不经过 Settings 缓存，每次 Set 都会写 NVS；连的还是同一个 AP 时什么都不做
+    Settings settings("wifi", true);
+    bool same_ap = settings.GetString("fast_ssid") == ssid && (uint32_t)settings.GetInt("fast_pw_crc") == crc;
+    if (same_ap && settings.GetString("fast_bssid") == bssid && settings.GetInt("fast_channel") == ap_info.primary) {
+        return;
+    }
+    settings.SetString("fast_bssid", bssid);
+    settings.SetInt("fast_channel", ap_info.primary);
+    if (same_ap) {
+        ESP_LOGI(TAG, "Updated fast connect info for %s, bssid %s, channel %d", ssid.c_str(), bssid, ap_info.primary);
+        return;
+    }
+
+    // PMK 只用于 WPA/WPA2 PSK，WPA3 SAE 每次握手都要用密码
+    std::string pmk;
+    bool psk = ap_info.authmode == WIFI_AUTH_WPA_PSK || ap_info.authmode == WIFI_AUTH_WPA2_PSK ||
+        ap_info.authmode == WIFI_AUTH_WPA_WPA2_PSK;
+    uint8_t key[32];
+    if (psk && password.size() >= 8 && password.size() < 64 &&
+        mbedtls_pkcs5_pbkdf2_hmac_ext(MBEDTLS_MD_SHA1, (const uint8_t*)password.data(), password.size(),
+            (const uint8_t*)ssid.data(), ssid.size(), 4096, sizeof(key), key) == 0) {
+        for (auto byte : key) {
+            char hex[3];
+            snprintf(hex, sizeof(hex), "%02x", byte);
+            pmk += hex;
+        }
+    }
+    settings.SetString("fast_ssid", ssid);
+    settings.SetString("fast_pmk", pmk);
+    settings.SetInt("fast_pw_crc", (int32_t)crc);
+    ESP_LOGI(TAG, "Saved fast connect info for %s, bssid %s, channel %d", ssid.c_str(), bssid, ap_info.primary);
+}
+
+std::string WifiBoard::GetConnectedSsid() {
+    auto ssid = WifiStation::GetInstance().GetSsid();
+    // 快速连接不经过 WifiStation 的扫描，它不知道连的是哪个 SSID
+    return ssid.empty() ? fast_ssid_ : ssid;
 }
 
 NetworkInterface* WifiBoard::GetNetwork() {
-    static EspNetwork network;
+    static TlsSessionNetwork network;
     return &network;
 }
 
@@ -127,9 +310,12 @@ const char* WifiBoard::GetNetworkStateIcon() {
     }
     auto& wifi_station = WifiStation::GetInstance();
     if (!wifi_station.IsConnected()) {
+        NetworkMonitor::GetInstance().ReportSignal(-1);
         return FONT_AWESOME_WIFI_OFF;
     }
     int8_t rssi = wifi_station.GetRssi();
+    // -50 dBm 及以上为满分，-90 dBm 为 0
+    NetworkMonitor::GetInstance().ReportSignal(std::clamp((rssi + 90) * 100 / 40, 0, 100));
     if (rssi >= -60) {
         return FONT_AWESOME_WIFI;
     } else if (rssi >= -70) {
@@ -146,7 +332,7 @@ std::string WifiBoard::GetBoardJson() {
     board_json += R"("type":")" + std::string(BOARD_TYPE) + R"(",)";
     board_json += R"("name":")" + std::string(BOARD_NAME) + R"(",)";
     if (!wifi_config_mode_) {
-        board_json += R"("ssid":")" + wifi_station.GetSsid() + R"(",)";
+        board_json += R"("ssid":")" + GetConnectedSsid() + R"(",)";
         board_json += R"("rssi":)" + std::to_string(wifi_station.GetRssi()) + R"(,)";
         board_json += R"("channel":)" + std::to_string(wifi_station.GetChannel()) + R"(,)";
         board_json += R"("ip":")" + wifi_station.GetIpAddress() + R"(",)";
@@ -182,6 +368,14 @@ std::string WifiBoard::GetDeviceStatusJson() {
      *     "audio_speaker": {
      *         "volume": 70
      *     },
+     *     "music": {                  // 仅在播放时
+     *         "buffered": 65536,
+     *         "buffer_size": 196608,
+     *         "start_threshold": 32768,
+     *         "download_rate": 48000,
+     *         "bitrate": 16000,
+     *         "underruns": 0
+     *     },
      *     "screen": {
      *         "brightness": 100,
      *         "theme": "light"
@@ -211,6 +405,9 @@ std::string WifiBoard::GetDeviceStatusJson() {
     }
     cJSON_AddItemToObject(root, "audio_speaker", audio_speaker);
 
+    // Music stream buffering
+    AddStreamStatusJson(root);
+
     // Screen brightness
     auto backlight = board.GetBacklight();
     auto screen = cJSON_CreateObject();
@@ -238,7 +435,7 @@ std::string WifiBoard::GetDeviceStatusJson() {
     auto network = cJSON_CreateObject();
     auto& wifi_station = WifiStation::GetInstance();
     cJSON_AddStringToObject(network, "type", "wifi");
-    cJSON_AddStringToObject(network, "ssid", wifi_station.GetSsid().c_str());
+    cJSON_AddStringToObject(network, "ssid", GetConnectedSsid().c_str());
     int rssi = wifi_station.GetRssi();
     if (rssi >= -60) {
         cJSON_AddStringToObject(network, "signal", "strong");
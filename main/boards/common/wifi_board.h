@@ -3,6 +3,15 @@
 
 #include "board.h"
 
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <esp_event.h>
+
+struct SsidItem;
+
 class WifiBoard : public Board {
 protected:
     bool wifi_config_mode_ = false;
@@ -19,6 +28,23 @@ public:
     virtual void ResetWifiConfiguration();
     virtual AudioCodec* GetAudioCodec() override { return nullptr; }
     virtual std::string GetDeviceStatusJson() override;
+
+private:
+    // 快速连接：上次连接成功的 AP，开机时跳过扫描直接连接
+    std::atomic<bool> fast_connecting_ = false;
+    std::atomic<bool> fast_connect_failed_ = false;
+    std::string fast_ssid_;
+    std::string fast_password_;
+    std::string fast_pmk_;
+    uint8_t fast_bssid_[6] = {};
+    int fast_channel_ = 0;
+    esp_event_handler_instance_t fast_connect_handler_ = nullptr;
+
+    bool StartFastConnect(const std::vector<SsidItem>& ssid_list);
+    void StopFastConnect();
+    void SaveFastConnect(const std::vector<SsidItem>& ssid_list);
+    std::string GetConnectedSsid();
+    static void FastConnectEventHandler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
 };
 
 #endif // WIFI_BOARD_H
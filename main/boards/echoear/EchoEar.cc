@@ -561,7 +561,7 @@ private:
         esp_lcd_panel_mirror(panel, DISPLAY_MIRROR_X, DISPLAY_MIRROR_Y);
 
 #if USE_LVGL_DEFAULT
-        display_ = new SpiLcdDisplay(panel_io, panel,
+        display_ = new QspiLcdDisplay(panel_io, panel,
         DISPLAY_WIDTH, DISPLAY_HEIGHT, DISPLAY_OFFSET_X, DISPLAY_OFFSET_Y, DISPLAY_MIRROR_X, DISPLAY_MIRROR_Y, DISPLAY_SWAP_XY, {
             .text_font = &font_puhui_20_4,
             .icon_font = &font_awesome_20_4,
@@ -14,9 +14,14 @@
 #include "movements.h"
 #include "sdkconfig.h"
 #include "settings.h"
+#include "stream_player.h"
+#include "task_stack.h"
 
 #define TAG "ElectronBotController"
 
+// 低于音频任务（opus_codec 为 2），舞蹈动作不再抢占 TTS 解码
+#define ACTION_TASK_PRIORITY 1
+
 struct ElectronBotActionParams {
     int action_type;
     int steps;
@@ -73,6 +78,13 @@ private:
                 ESP_LOGI(TAG, "执行动作: %d", params.action_type);
                 controller->is_action_in_progress_ = true;  // 开始执行动作
 
+                // 播放音乐时挥手、拍手和连续点头按节拍对齐周期并在拍点上开始
+                if ((params.action_type >= ACTION_HAND_LEFT_WAVE &&
+                     params.action_type <= ACTION_HAND_BOTH_FLAP) ||
+                    params.action_type == ACTION_HEAD_NOD_REPEAT) {
+                    params.speed = StreamPlayer::GetInstance().beat_tracker().AlignToBeat(params.speed);
+                }
+
                 // 执行相应的动作
                 if (params.action_type >= ACTION_HAND_LEFT_UP &&
                     params.action_type <= ACTION_HAND_BOTH_FLAP) {
@@ -112,8 +124,8 @@ private:
 
     void StartActionTaskIfNeeded() {
         if (action_task_handle_ == nullptr) {
-            xTaskCreate(ActionTask, "electron_bot_action", 1024 * 4, this, configMAX_PRIORITIES - 1,
-                        &action_task_handle_);
+            TaskStacks::GetInstance().Create(ActionTask, "electron_bot_action", 1024 * 4, this, ACTION_TASK_PRIORITY,
+                &action_task_handle_);
         }
     }
 
@@ -359,7 +371,7 @@ public:
 
     ~ElectronBotController() {
         if (action_task_handle_ != nullptr) {
-            vTaskDelete(action_task_handle_);
+            TaskStacks::GetInstance().Delete(action_task_handle_);
             action_task_handle_ = nullptr;
         }
         vQueueDelete(action_queue_);
@@ -1,8 +1,9 @@
 #pragma once
 
-#include <libs/gif/lv_gif.h>
+#include <memory>
 
 #include "display/lcd_display.h"
+#include "display/gif_player.h"
 
 // Electron Bot表情GIF声明 - 使用与Otto相同的6个表情
 LV_IMAGE_DECLARE(staticstate);  // 静态状态/中性表情
@@ -39,7 +40,7 @@ public:
 private:
     void SetupGifContainer();
 
-    lv_obj_t* emotion_gif_;  ///< GIF表情组件
+    std::unique_ptr<GifPlayer> emotion_gif_;  ///< GIF表情播放器，切换表情时复用帧缓冲
 
     // 表情映射
     struct EmotionMap {
@@ -82,22 +82,24 @@ void Otto::MoveServos(int time, int servo_target[]) {
         SetRestState(false);
     }
 
-    final_time_ = millis() + time;
-    if (time > 10) {
+    if (time > SERVO_MOTION_TICK_MS) {
+        // 固定步长，按经过的时间从起点插值，任务被抢占也不会累积误差
+        int start[SERVO_COUNT];
         for (int i = 0; i < SERVO_COUNT; i++) {
-            if (servo_pins_[i] != -1) {
-                increment_[i] = (servo_target[i] - servo_[i].GetPosition()) / (time / 10.0);
-            }
+            start[i] = servo_[i].GetPosition();
         }
-
-        for (int iteration = 1; millis() < final_time_; iteration++) {
-            partial_time_ = millis() + 10;
-            for (int i = 0; i < SERVO_COUNT; i++) {
-                if (servo_pins_[i] != -1) {
-                    servo_[i].SetPosition(servo_[i].GetPosition() + increment_[i]);
+        TickType_t last_wake_time = xTaskGetTickCount();
+        unsigned long start_time = millis();
+        for (unsigned long elapsed = 0; elapsed < (unsigned long)time; elapsed = millis() - start_time) {
+            {
+                ServoBatch batch;
+                for (int i = 0; i < SERVO_COUNT; i++) {
+                    if (servo_pins_[i] != -1) {
+                        servo_[i].SetPosition(start[i] + (servo_target[i] - start[i]) * (int)elapsed / time);
+                    }
                 }
             }
-            vTaskDelay(pdMS_TO_TICKS(10));
+            vTaskDelayUntil(&last_wake_time, pdMS_TO_TICKS(SERVO_MOTION_TICK_MS));
         }
     } else {
         for (int i = 0; i < SERVO_COUNT; i++) {
@@ -157,18 +159,20 @@ void Otto::OscillateServos(int amplitude[SERVO_COUNT], int offset[SERVO_COUNT],
         }
     }
 
-    double ref = millis();
-    double end_time = period * cycle + ref;
-
-    while (millis() < end_time) {
-        for (int i = 0; i < SERVO_COUNT; i++) {
-            if (servo_pins_[i] != -1) {
-                servo_[i].Refresh();
+    unsigned long duration = period * cycle;
+    unsigned long start_time = millis();
+    TickType_t last_wake_time = xTaskGetTickCount();
+    for (unsigned long elapsed = 0; elapsed < duration; elapsed = millis() - start_time) {
+        {
+            ServoBatch batch;
+            for (int i = 0; i < SERVO_COUNT; i++) {
+                if (servo_pins_[i] != -1) {
+                    servo_[i].Refresh(elapsed);
+                }
             }
         }
-        vTaskDelay(5);
+        vTaskDelayUntil(&last_wake_time, pdMS_TO_TICKS(SERVO_MOTION_TICK_MS));
     }
-    vTaskDelay(pdMS_TO_TICKS(10));
 }
 
 void Otto::Execute(int amplitude[SERVO_COUNT], int offset[SERVO_COUNT], int period,
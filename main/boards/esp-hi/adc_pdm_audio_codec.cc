@@ -1,19 +1,41 @@
 #include "adc_pdm_audio_codec.h"
 
 #include <esp_log.h>
+#include <esp_attr.h>
 #include <driver/i2c.h>
 #include <driver/i2c_master.h>
 #include <driver/i2s_tdm.h>
-#include "adc_mic.h"
+#include <esp_adc/adc_cali.h>
+#include <esp_adc/adc_cali_scheme.h>
 #include "driver/i2s_pdm.h"
 #include "soc/gpio_sig_map.h"
 #include "soc/io_mux_reg.h"
 #include "hal/rtc_io_hal.h"
 #include "hal/gpio_ll.h"
 #include "settings.h"
+#include "hot_log.h"
+
+#include <algorithm>
 
 static const char TAG[] = "AdcPdmAudioCodec";
 
+#define ADC_MIC_OVERSAMPLE 4            // 最高倍数，还受连续模式最高采样率限制
+#define ADC_MIC_CONV_FRAME_MS 4
+#define ADC_MIC_POOL_MS 32              // 和原来 adc_mic 的缓存时长相同
+#define ADC_MIC_READ_TIMEOUT_MS 100
+#define ADC_MIC_ATTEN ADC_ATTEN_DB_0
+#define ADC_MIC_NOMINAL_RANGE_MV 750    // 没有校准数据时 12 位满量程对应的电压
+#define ADC_MIC_DC_SHIFT 10             // 去直流时间常数 1024 个样本，16 kHz 时截止约 2.5 Hz
+
+// ESP32 和 ESP32-S2 只有 type1 能输出 12 位数据
+#if CONFIG_IDF_TARGET_ESP32 || CONFIG_IDF_TARGET_ESP32S2
+#define ADC_MIC_OUTPUT_FORMAT ADC_DIGI_OUTPUT_FORMAT_TYPE1
+#define ADC_MIC_RESULT(result) ((result).type1)
+#else
+#define ADC_MIC_OUTPUT_FORMAT ADC_DIGI_OUTPUT_FORMAT_TYPE2
+#define ADC_MIC_RESULT(result) ((result).type2)
+#endif
+
 #define BSP_I2S_GPIO_CFG(_dout)       \
     {                          \
         .clk = GPIO_NUM_NC,    \
@@ -42,29 +64,8 @@ AdcPdmAudioCodec::AdcPdmAudioCodec(int input_sample_rate, int output_sample_rate
     input_sample_rate_ = input_sample_rate;
     output_sample_rate_ = output_sample_rate;
 
-    uint8_t adc_channel[1] = {0};
-    adc_channel[0] = adc_mic_channel;
-
-    audio_codec_adc_cfg_t cfg = {
-        .handle = NULL,
-        .max_store_buf_size = 1024 * 2,
-        .conv_frame_size = 1024,
-        .unit_id = ADC_UNIT_1,
-        .adc_channel_list = adc_channel,
-        .adc_channel_num = sizeof(adc_channel) / sizeof(adc_channel[0]),
-        .sample_rate_hz = (uint32_t)input_sample_rate,
-    };
-    const audio_codec_data_if_t *adc_if = audio_codec_new_adc_data(&cfg);
-
-    esp_codec_dev_cfg_t codec_dev_cfg = {
-        .dev_type = ESP_CODEC_DEV_TYPE_IN,
-        .data_if = adc_if,
-    };
-    input_dev_ = esp_codec_dev_new(&codec_dev_cfg);
-    if (!input_dev_) {
-        ESP_LOGE(TAG, "Failed to create codec device");
-        return;
-    }
+    adc_channel_ = adc_mic_channel;
+    InitializeAdc();
 
     i2s_chan_config_t chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG(I2S_NUM_0, I2S_ROLE_MASTER);
     chan_cfg.auto_clear = true; // Auto clear the legacy data in the DMA buffer
@@ -88,9 +89,11 @@ AdcPdmAudioCodec::AdcPdmAudioCodec(int input_sample_rate, int output_sample_rate
 
     const audio_codec_data_if_t *i2s_data_if = audio_codec_new_i2s_data(&i2s_cfg);
 
-    codec_dev_cfg.dev_type = ESP_CODEC_DEV_TYPE_OUT;
-    codec_dev_cfg.codec_if = NULL;
-    codec_dev_cfg.data_if = i2s_data_if;
+    esp_codec_dev_cfg_t codec_dev_cfg = {
+        .dev_type = ESP_CODEC_DEV_TYPE_OUT,
+        .codec_if = NULL,
+        .data_if = i2s_data_if,
+    };
     output_dev_ = esp_codec_dev_new(&codec_dev_cfg);
 
     output_volume_ = 100;
@@ -118,8 +121,123 @@ AdcPdmAudioCodec::AdcPdmAudioCodec(int input_sample_rate, int output_sample_rate
 AdcPdmAudioCodec::~AdcPdmAudioCodec() {
     ESP_ERROR_CHECK(esp_codec_dev_close(output_dev_));
     esp_codec_dev_delete(output_dev_);
-    ESP_ERROR_CHECK(esp_codec_dev_close(input_dev_));
-    esp_codec_dev_delete(input_dev_);
+    if (adc_started_) {
+        ESP_ERROR_CHECK_WITHOUT_ABORT(adc_continuous_stop(adc_handle_));
+    }
+#if SOC_ADC_DIG_IIR_FILTER_SUPPORTED
+    if (adc_filter_ != nullptr) {
+        adc_continuous_iir_filter_disable(adc_filter_);
+        adc_del_continuous_iir_filter(adc_filter_);
+    }
+#endif
+    adc_continuous_deinit(adc_handle_);
+}
+
+void AdcPdmAudioCodec::InitializeAdc() {
+    oversample_ = std::clamp(SOC_ADC_SAMPLE_FREQ_THRES_HIGH / input_sample_rate_, 1, ADC_MIC_OVERSAMPLE);
+    int adc_rate = input_sample_rate_ * oversample_;
+    uint32_t frame_size = adc_rate * ADC_MIC_CONV_FRAME_MS / 1000 * SOC_ADC_DIGI_RESULT_BYTES;
+    frame_size -= frame_size % SOC_ADC_DIGI_DATA_BYTES_PER_CONV;
+
+    adc_continuous_handle_cfg_t handle_cfg = {
+        .max_store_buf_size = frame_size * (ADC_MIC_POOL_MS / ADC_MIC_CONV_FRAME_MS),
+        .conv_frame_size = frame_size,
+        .flags = { .flush_pool = true },     // 读得慢时丢最旧的数据
+    };
+    ESP_ERROR_CHECK(adc_continuous_new_handle(&handle_cfg, &adc_handle_));
+
+    adc_digi_pattern_config_t pattern = {
+        .atten = ADC_MIC_ATTEN,
+        .channel = adc_channel_,
+        .unit = ADC_UNIT_1,
+        .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH,
+    };
+    adc_continuous_config_t dig_cfg = {
+        .pattern_num = 1,
+        .adc_pattern = &pattern,
+        .sample_freq_hz = (uint32_t)adc_rate,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_MIC_OUTPUT_FORMAT,
+    };
+    ESP_ERROR_CHECK(adc_continuous_config(adc_handle_, &dig_cfg));
+
+#if SOC_ADC_DIG_IIR_FILTER_SUPPORTED
+    // 硬件 IIR 在过采样率上做抗混叠，软件抽取只需要求和
+    adc_continuous_iir_filter_config_t filter_cfg = {
+        .unit = ADC_UNIT_1,
+        .channel = (adc_channel_t)adc_channel_,
+        .coeff = ADC_DIGI_IIR_FILTER_COEFF_2,
+    };
+    if (adc_new_continuous_iir_filter(adc_handle_, &filter_cfg, &adc_filter_) == ESP_OK) {
+        adc_continuous_iir_filter_enable(adc_filter_);
+    } else {
+        ESP_LOGW(TAG, "ADC IIR filter not available");
+        adc_filter_ = nullptr;
+    }
+#endif
+
+    adc_continuous_evt_cbs_t callbacks = {
+        .on_conv_done = nullptr,
+        .on_pool_ovf = OnAdcPoolOverflow,
+    };
+    ESP_ERROR_CHECK(adc_continuous_register_event_callbacks(adc_handle_, &callbacks, this));
+    adc_buffer_.resize(frame_size);
+
+    // CONFIG_ADC_MIC_APPLY_GAIN 仍按满量程的左移位数理解，换算成每毫伏的增益后用校准斜率还原
+    int32_t slope_uv = CalibratedSlopeUv();
+    gain_q12_ = (int64_t)slope_uv * (1 << CONFIG_ADC_MIC_APPLY_GAIN) * 4096 * 4096 /
+        (1000LL * ADC_MIC_NOMINAL_RANGE_MV * oversample_);
+    ESP_LOGI(TAG, "ADC mic: %d Hz x%d, %ld uV/LSB, gain %.2f", input_sample_rate_, oversample_,
+        (long)slope_uv, gain_q12_ * oversample_ / 4096.0f);
+}
+
+// 从校准曲线取两点得到每 LSB 的电压，没有校准数据时用标称值
+int32_t AdcPdmAudioCodec::CalibratedSlopeUv() {
+    const int32_t nominal_uv = ADC_MIC_NOMINAL_RANGE_MV * 1000 / 4095;
+    const int low_raw = 512;
+    const int high_raw = 3584;
+    adc_cali_handle_t cali = nullptr;
+#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+    adc_cali_curve_fitting_config_t cali_cfg = {
+        .unit_id = ADC_UNIT_1,
+        .chan = (adc_channel_t)adc_channel_,
+        .atten = ADC_MIC_ATTEN,
+        .bitwidth = ADC_BITWIDTH_12,
+    };
+    if (adc_cali_create_scheme_curve_fitting(&cali_cfg, &cali) != ESP_OK) {
+        return nominal_uv;
+    }
+#elif ADC_CALI_SCHEME_LINE_FITTING_SUPPORTED
+    adc_cali_line_fitting_config_t cali_cfg = {
+        .unit_id = ADC_UNIT_1,
+        .atten = ADC_MIC_ATTEN,
+        .bitwidth = ADC_BITWIDTH_12,
+    };
+    if (adc_cali_create_scheme_line_fitting(&cali_cfg, &cali) != ESP_OK) {
+        return nominal_uv;
+    }
+#else
+    return nominal_uv;
+#endif
+    int low_mv = 0;
+    int high_mv = 0;
+    bool ok = adc_cali_raw_to_voltage(cali, low_raw, &low_mv) == ESP_OK &&
+        adc_cali_raw_to_voltage(cali, high_raw, &high_mv) == ESP_OK;
+#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+    adc_cali_delete_scheme_curve_fitting(cali);
+#elif ADC_CALI_SCHEME_LINE_FITTING_SUPPORTED
+    adc_cali_delete_scheme_line_fitting(cali);
+#endif
+    if (!ok || high_mv <= low_mv) {
+        return nominal_uv;
+    }
+    return (high_mv - low_mv) * 1000 / (high_raw - low_raw);
+}
+
+bool IRAM_ATTR AdcPdmAudioCodec::OnAdcPoolOverflow(adc_continuous_handle_t handle,
+    const adc_continuous_evt_data_t* data, void* arg) {
+    static_cast<AdcPdmAudioCodec*>(arg)->adc_overflows_.fetch_add(1, std::memory_order_relaxed);
+    return false;
 }
 
 void AdcPdmAudioCodec::SetOutputVolume(int volume) {
@@ -127,22 +245,17 @@ void AdcPdmAudioCodec::SetOutputVolume(int volume) {
     AudioCodec::SetOutputVolume(volume);
 }
 
+// 关闭输入时 DMA 不停：连续模式的 start 和 stop 必须在同一个任务里调用，池里的旧数据在重新打开后丢弃
 void AdcPdmAudioCodec::EnableInput(bool enable) {
     if (enable == input_enabled_) {
         return;
     }
     if (enable) {
-        esp_codec_dev_sample_info_t fs = {
-            .bits_per_sample = 16,
-            .channel = 1,
-            .channel_mask = ESP_CODEC_DEV_MAKE_CHANNEL_MASK(0),
-            .sample_rate = (uint32_t)input_sample_rate_,
-            .mclk_multiple = 0,
-        };
-        ESP_ERROR_CHECK(esp_codec_dev_open(input_dev_, &fs));
-    } else {
-        // ESP_ERROR_CHECK(esp_codec_dev_close(input_dev_));
-        return;
+        if (!adc_started_) {
+            ESP_ERROR_CHECK(adc_continuous_start(adc_handle_));
+            adc_started_ = true;
+        }
+        adc_restart_ = true;
     }
     AudioCodec::EnableInput(enable);
 }
@@ -175,9 +288,70 @@ void AdcPdmAudioCodec::EnableOutput(bool enable) {
     AudioCodec::EnableOutput(enable);
 }
 
+// 一遍完成过采样求和、去直流和增益，返回写出的样本数
+int AdcPdmAudioCodec::Decimate(const uint8_t* data, size_t size, int16_t* dest, int samples) {
+    auto results = reinterpret_cast<const adc_digi_output_data_t*>(data);
+    size_t count = size / SOC_ADC_DIGI_RESULT_BYTES;
+    int32_t sum = decimate_sum_;
+    int n = decimate_count_;
+    int32_t dc = dc_q16_;
+    int written = 0;
+    for (size_t i = 0; i < count && written < samples; i++) {
+        auto& result = ADC_MIC_RESULT(results[i]);
+        if (result.channel != adc_channel_) {
+            continue;
+        }
+        sum += result.data;
+        if (++n < oversample_) {
+            continue;
+        }
+        int32_t x = sum << 16;
+        if (!dc_primed_) {
+            dc = x;
+            dc_primed_ = true;
+        }
+        dc += (x - dc) >> ADC_MIC_DC_SHIFT;
+        int32_t pcm = ((int64_t)(x - dc) * gain_q12_) >> 28;
+        dest[written++] = std::clamp<int32_t>(pcm, INT16_MIN, INT16_MAX);
+        sum = 0;
+        n = 0;
+    }
+    decimate_sum_ = sum;
+    decimate_count_ = n;
+    dc_q16_ = dc;
+    return written;
+}
+
 int AdcPdmAudioCodec::Read(int16_t* dest, int samples) {
-    if (input_enabled_) {
-        ESP_ERROR_CHECK_WITHOUT_ABORT(esp_codec_dev_read(input_dev_, (void*)dest, samples * sizeof(int16_t)));
+    if (!input_enabled_) {
+        return samples;
+    }
+    if (adc_restart_.exchange(false)) {
+        adc_continuous_flush_pool(adc_handle_);
+        adc_overflows_ = 0;
+        dc_primed_ = false;
+        decimate_sum_ = 0;
+        decimate_count_ = 0;
+    }
+
+    int written = 0;
+    while (written < samples) {
+        // 只读凑满剩余样本需要的转换结果，不留尾巴
+        size_t wanted = ((size_t)(samples - written) * oversample_ - decimate_count_) * SOC_ADC_DIGI_RESULT_BYTES;
+        uint32_t size = 0;
+        esp_err_t ret = adc_continuous_read(adc_handle_, adc_buffer_.data(), std::min(wanted, adc_buffer_.size()),
+            &size, pdMS_TO_TICKS(ADC_MIC_READ_TIMEOUT_MS));
+        if (ret != ESP_OK) {
+            HOT_LOGW(TAG, "ADC read failed: %s", esp_err_to_name(ret));
+            std::fill(dest + written, dest + samples, 0);
+            break;
+        }
+        written += Decimate(adc_buffer_.data(), size, dest + written, samples - written);
+    }
+
+    uint32_t overflows = adc_overflows_.exchange(0, std::memory_order_relaxed);
+    if (overflows > 0) {
+        HOT_LOGW(TAG, "ADC pool overflowed %lu times, oldest samples dropped", (unsigned long)overflows);
     }
     return samples;
 }
@@ -5,13 +5,45 @@
 
 #include <esp_codec_dev.h>
 #include <esp_codec_dev_defaults.h>
+#include <esp_adc/adc_continuous.h>
+#include <soc/soc_caps.h>
+#if SOC_ADC_DIG_IIR_FILTER_SUPPORTED
+#include <esp_adc/adc_filter.h>
+#endif
 
+#include <atomic>
+#include <vector>
+
+/*
+ * 麦克风用 ADC 连续模式 DMA 采集，按 input_sample_rate 的整数倍过采样，硬件 IIR 先做抗混叠，
+ * Read() 里每块一次完成抽取、去直流和按校准斜率换算的增益。
+ */
 class AdcPdmAudioCodec : public AudioCodec {
 private:
     esp_codec_dev_handle_t output_dev_ = nullptr;
-    esp_codec_dev_handle_t input_dev_ = nullptr;
     gpio_num_t pa_ctrl_pin_ = GPIO_NUM_NC;
 
+    adc_continuous_handle_t adc_handle_ = nullptr;
+#if SOC_ADC_DIG_IIR_FILTER_SUPPORTED
+    adc_iir_filter_handle_t adc_filter_ = nullptr;
+#endif
+    uint8_t adc_channel_ = 0;
+    bool adc_started_ = false;
+    std::atomic<bool> adc_restart_{false};      // 重新打开输入后由读取任务清空旧数据
+    int oversample_ = 1;
+    int32_t gain_q12_ = 0;          // 抽取后的过采样和到 PCM 的增益
+    int32_t dc_q16_ = 0;
+    bool dc_primed_ = false;
+    int32_t decimate_sum_ = 0;      // 跨 Read 调用未凑满一个输出样本的部分
+    int decimate_count_ = 0;
+    std::vector<uint8_t> adc_buffer_;
+    std::atomic<uint32_t> adc_overflows_{0};
+
+    void InitializeAdc();
+    int32_t CalibratedSlopeUv();
+    int Decimate(const uint8_t* data, size_t size, int16_t* dest, int samples);
+    static bool OnAdcPoolOverflow(adc_continuous_handle_t handle, const adc_continuous_evt_data_t* data, void* arg);
+
     virtual int Read(int16_t* dest, int samples) override;
     virtual int Write(const int16_t* data, int samples) override;
 
@@ -20,6 +20,7 @@
 #include <driver/spi_master.h>
 #include "esp_io_expander_tca9554.h"
 #include "settings.h"
+#include "touch_input.h"
 
 #include <esp_lcd_touch_ft5x06.h>
 #include <esp_lvgl_port.h>
@@ -75,7 +76,7 @@ static const sh8601_lcd_init_cmd_t vendor_specific_init[] = {
 };
 
 // 在waveshare_amoled_1_8类之前添加新的显示类
-class CustomLcdDisplay : public SpiLcdDisplay {
+class CustomLcdDisplay : public QspiLcdDisplay {
 public:
     CustomLcdDisplay(esp_lcd_panel_io_handle_t io_handle,
                     esp_lcd_panel_handle_t panel_handle,
@@ -86,7 +87,7 @@ public:
                     bool mirror_x,
                     bool mirror_y,
                     bool swap_xy)
-        : SpiLcdDisplay(io_handle, panel_handle,
+        : QspiLcdDisplay(io_handle, panel_handle,
                     width, height, offset_x, offset_y, mirror_x, mirror_y, swap_xy,
                     {
                         .text_font = &font_puhui_30_4,
@@ -96,7 +97,8 @@ public:
 #else
                         .emoji_font = font_emoji_64_init(),
 #endif
-                    }) {
+                    },
+                    {.x_align = 2, .y_align = 2}) {
         DisplayLockGuard lock(this);
         lv_obj_set_style_pad_left(status_bar_, LV_HOR_RES * 0.1, 0);
         lv_obj_set_style_pad_right(status_bar_, LV_HOR_RES * 0.1, 0);
@@ -275,11 +277,7 @@ private:
         ESP_ERROR_CHECK(esp_lcd_new_panel_io_i2c(codec_i2c_bus_, &tp_io_config, &tp_io_handle));
         ESP_LOGI(TAG, "Initialize touch controller");
         ESP_ERROR_CHECK(esp_lcd_touch_new_i2c_ft5x06(tp_io_handle, &tp_cfg, &tp));
-        const lvgl_port_touch_cfg_t touch_cfg = {
-            .disp = lv_display_get_default(), 
-            .handle = tp,
-        };
-        lvgl_port_add_touch(&touch_cfg);
+        TouchInput::Attach(tp);
         ESP_LOGI(TAG, "Touch panel initialized successfully");
     }
 
@@ -6,6 +6,7 @@
 #include "config.h"
 #include "i2c_device.h"
 #include "esp32_camera.h"
+#include "touch_input.h"
 
 #include <esp_log.h>
 #include <esp_lcd_panel_vendor.h>
@@ -195,13 +196,7 @@ private:
         esp_lcd_touch_new_i2c_ft5x06(tp_io_handle, &tp_cfg, &tp);
         assert(tp);
 
-        /* Add touch input (for selected screen) */
-        const lvgl_port_touch_cfg_t touch_cfg = {
-            .disp = lv_display_get_default(), 
-            .handle = tp,
-        };
-
-        lvgl_port_add_touch(&touch_cfg);
+        TouchInput::Attach(tp);
     }
 
     void InitializeCamera() {
@@ -10,27 +10,47 @@ static const char* TAG = "Oscillator";
 
 extern unsigned long IRAM_ATTR millis();
 
-static ledc_channel_t next_free_channel = LEDC_CHANNEL_0;
+static Oscillator* attached_servos[SERVO_MAX_COUNT];
+static int batch_depth = 0;
+
+// 正弦表，一周 256 点，Q15，中间线性插值
+#define SINE_TABLE_BITS 8
+static int16_t sine_table[(1 << SINE_TABLE_BITS) + 1];
+
+static void InitSineTable() {
+    static bool initialized = false;
+    if (initialized) {
+        return;
+    }
+    for (int i = 0; i <= (1 << SINE_TABLE_BITS); i++) {
+        sine_table[i] = (int16_t)std::lround(32767 * std::sin(2 * M_PI * i / (1 << SINE_TABLE_BITS)));
+    }
+    initialized = true;
+}
+
+// phase 为 2^32 一周，返回 Q15
+static int32_t Sine(uint32_t phase) {
+    uint32_t index = phase >> (32 - SINE_TABLE_BITS);
+    int32_t fraction = (phase >> (16 - SINE_TABLE_BITS)) & 0xFFFF;
+    int32_t a = sine_table[index];
+    int32_t b = sine_table[index + 1];
+    return a + (((b - a) * fraction) >> 16);
+}
 
 Oscillator::Oscillator(int trim) {
     trim_ = trim;
     diff_limit_ = 0;
     is_attached_ = false;
 
-    sampling_period_ = 30;
     period_ = 2000;
-    number_samples_ = period_ / sampling_period_;
-    inc_ = 2 * M_PI / number_samples_;
-
     amplitude_ = 45;
-    phase_ = 0;
     phase0_ = 0;
     offset_ = 0;
     stop_ = false;
     rev_ = false;
 
     pos_ = 90;
-    previous_millis_ = 0;
+    InitSineTable();
 }
 
 Oscillator::~Oscillator() {
@@ -43,17 +63,6 @@ uint32_t Oscillator::AngleToCompare(int angle) {
            SERVO_MIN_PULSEWIDTH_US;
 }
 
-bool Oscillator::NextSample() {
-    current_millis_ = millis();
-
-    if (current_millis_ - previous_millis_ > sampling_period_) {
-        previous_millis_ = current_millis_;
-        return true;
-    }
-
-    return false;
-}
-
 void Oscillator::Attach(int pin, bool rev) {
     if (is_attached_) {
         Detach();
@@ -62,12 +71,17 @@ void Oscillator::Attach(int pin, bool rev) {
     pin_ = pin;
     rev_ = rev;
 
-    ledc_timer_config_t ledc_timer = {.speed_mode = LEDC_LOW_SPEED_MODE,
-                                      .duty_resolution = LEDC_TIMER_13_BIT,
-                                      .timer_num = LEDC_TIMER_1,
-                                      .freq_hz = 50,
-                                      .clk_cfg = LEDC_AUTO_CLK};
-    ESP_ERROR_CHECK(ledc_timer_config(&ledc_timer));
+    // 所有通道共用一个定时器，相位一致，只配置一次
+    static bool timer_configured = false;
+    if (!timer_configured) {
+        ledc_timer_config_t ledc_timer = {.speed_mode = LEDC_LOW_SPEED_MODE,
+                                          .duty_resolution = LEDC_TIMER_13_BIT,
+                                          .timer_num = LEDC_TIMER_1,
+                                          .freq_hz = 50,
+                                          .clk_cfg = LEDC_AUTO_CLK};
+        ESP_ERROR_CHECK(ledc_timer_config(&ledc_timer));
+        timer_configured = true;
+    }
 
     static int last_channel = 0;
     last_channel = (last_channel + 1) % 7 + 1;
@@ -83,6 +97,9 @@ void Oscillator::Attach(int pin, bool rev) {
     ESP_ERROR_CHECK(ledc_channel_config(&ledc_channel));
 
     ledc_speed_mode_ = LEDC_LOW_SPEED_MODE;
+    duty_ = 0;
+    pending_duty_ = UINT32_MAX;
+    attached_servos[ledc_channel_] = this;
 
     // pos_ = 90;
     // Write(pos_);
@@ -96,32 +113,33 @@ void Oscillator::Detach() {
         return;
 
     ESP_ERROR_CHECK(ledc_stop(ledc_speed_mode_, ledc_channel_, 0));
+    if (attached_servos[ledc_channel_] == this) {
+        attached_servos[ledc_channel_] = nullptr;
+    }
 
     is_attached_ = false;
 }
 
-void Oscillator::SetT(unsigned int T) {
-    period_ = T;
-
-    number_samples_ = period_ / sampling_period_;
-    inc_ = 2 * M_PI / number_samples_;
+void Oscillator::SetPh(double Ph) {
+    double turns = Ph / (2 * M_PI);
+    turns -= std::floor(turns);
+    phase0_ = (uint32_t)(turns * 4294967296.0);
 }
 
 void Oscillator::SetPosition(int position) {
     Write(position);
 }
 
-void Oscillator::Refresh() {
-    if (NextSample()) {
-        if (!stop_) {
-            int pos = std::round(amplitude_ * std::sin(phase_ + phase0_) + offset_);
-            if (rev_)
-                pos = -pos;
-            Write(pos + 90);
-        }
-
-        phase_ = phase_ + inc_;
+void Oscillator::Refresh(uint32_t elapsed_ms) {
+    if (stop_ || period_ == 0) {
+        return;
     }
+    uint32_t phase = phase0_ + (uint32_t)(((uint64_t)(elapsed_ms % period_) << 32) / period_);
+    int pos = ((int32_t)amplitude_ * Sine(phase) + (1 << 14)) >> 15;
+    pos += offset_;
+    if (rev_)
+        pos = -pos;
+    Write(pos + 90);
 }
 
 void Oscillator::Write(int position) {
@@ -146,8 +164,37 @@ void Oscillator::Write(int position) {
 
     angle = std::min(std::max(angle, 0), 180);
 
-    uint32_t duty = (uint32_t)(((angle / 180.0) * 2.0 + 0.5) * 8191 / 20.0);
+    // 0.5ms ~ 2.5ms 脉宽对应 20ms 周期的 13 位占空比
+    pending_duty_ = (uint32_t)((500 + angle * 2000 / 180) * 8191 / 20000);
+    if (batch_depth == 0) {
+        CommitDuty();
+    }
+}
 
-    ESP_ERROR_CHECK(ledc_set_duty(ledc_speed_mode_, ledc_channel_, duty));
+void Oscillator::CommitDuty() {
+    // 保持不动的舵机不再写寄存器
+    if (pending_duty_ == UINT32_MAX || pending_duty_ == duty_) {
+        pending_duty_ = UINT32_MAX;
+        return;
+    }
+    duty_ = pending_duty_;
+    pending_duty_ = UINT32_MAX;
+    ESP_ERROR_CHECK(ledc_set_duty(ledc_speed_mode_, ledc_channel_, duty_));
     ESP_ERROR_CHECK(ledc_update_duty(ledc_speed_mode_, ledc_channel_));
 }
+
+// 只由运动任务调用
+void Oscillator::BeginBatch() {
+    batch_depth++;
+}
+
+void Oscillator::EndBatch() {
+    if (--batch_depth > 0) {
+        return;
+    }
+    for (auto servo : attached_servos) {
+        if (servo != nullptr) {
+            servo->CommitDuty();
+        }
+    }
+}
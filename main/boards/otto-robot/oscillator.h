@@ -18,6 +18,8 @@
 #define SERVO_MAX_DEGREE 90                   // 最大角度
 #define SERVO_TIMEBASE_RESOLUTION_HZ 1000000  // 1MHz, 1us per tick
 #define SERVO_TIMEBASE_PERIOD 20000           // 20000 ticks, 20ms
+#define SERVO_MOTION_TICK_MS 20               // 运动插值步长，与舵机 PWM 周期一致
+#define SERVO_MAX_COUNT 8                     // LEDC 低速通道数
 
 class Oscillator {
 public:
@@ -28,8 +30,8 @@ public:
 
     void SetA(unsigned int amplitude) { amplitude_ = amplitude; };
     void SetO(int offset) { offset_ = offset; };
-    void SetPh(double Ph) { phase0_ = Ph; };
-    void SetT(unsigned int period);
+    void SetPh(double Ph);
+    void SetT(unsigned int period) { period_ = period; };
     void SetTrim(int trim) { trim_ = trim; };
     void SetLimiter(int diff_limit) { diff_limit_ = diff_limit; };
     void DisableLimiter() { diff_limit_ = 0; };
@@ -37,13 +39,18 @@ public:
     void SetPosition(int position);
     void Stop() { stop_ = true; };
     void Play() { stop_ = false; };
-    void Reset() { phase_ = 0; };
-    void Refresh();
+    // 按振荡开始后经过的时间更新位置
+    void Refresh(uint32_t elapsed_ms);
     int GetPosition() { return pos_; }
 
+    // 批量更新：期间 Write 只记下占空比，EndBatch 一次提交所有变化的通道。所有舵机共用一个 LEDC 定时器，
+    // 新占空比在下一个 PWM 周期开始时一起生效，同一步的各个关节不会错开一个 20ms 周期
+    static void BeginBatch();
+    static void EndBatch();
+
 private:
-    bool NextSample();
     void Write(int position);
+    void CommitDuty();
     uint32_t AngleToCompare(int angle);
 
 private:
@@ -53,20 +60,12 @@ private:
     unsigned int amplitude_;  //-- Amplitude (degrees)
     int offset_;              //-- Offset (degrees)
     unsigned int period_;     //-- Period (miliseconds)
-    double phase0_;           //-- Phase (radians)
+    uint32_t phase0_;         //-- Phase (2^32 = one turn)
 
     //-- Internal variables
     int pos_;                       //-- Current servo pos
     int pin_;                       //-- Pin where the servo is connected
     int trim_;                      //-- Calibration offset
-    double phase_;                  //-- Current phase
-    double inc_;                    //-- Increment of phase
-    double number_samples_;         //-- Number of samples
-    unsigned int sampling_period_;  //-- sampling period (ms)
-
-    long previous_millis_;
-    long current_millis_;
-
     //-- Oscillation mode. If true, the servo is stopped
     bool stop_;
 
@@ -78,6 +77,17 @@ private:
 
     ledc_channel_t ledc_channel_;
     ledc_mode_t ledc_speed_mode_;
+    uint32_t duty_ = UINT32_MAX;            // 已提交的占空比
+    uint32_t pending_duty_ = UINT32_MAX;
+};
+
+// 作用域内的舵机写入合并成一次提交
+class ServoBatch {
+public:
+    ServoBatch() { Oscillator::BeginBatch(); }
+    ~ServoBatch() { Oscillator::EndBatch(); }
+    ServoBatch(const ServoBatch&) = delete;
+    ServoBatch& operator=(const ServoBatch&) = delete;
 };
 
 #endif  // __OSCILLATOR_H__
\ No newline at end of file
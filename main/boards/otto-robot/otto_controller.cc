@@ -14,9 +14,14 @@
 #include "otto_movements.h"
 #include "sdkconfig.h"
 #include "settings.h"
+#include "stream_player.h"
+#include "task_stack.h"
 
 #define TAG "OttoController"
 
+// 低于音频任务（opus_codec 为 2），舞蹈动作不再抢占 TTS 解码
+#define ACTION_TASK_PRIORITY 1
+
 class OttoController {
 private:
     Otto otto_;
@@ -63,6 +68,12 @@ private:
                 ESP_LOGI(TAG, "执行动作: %d", params.action_type);
                 controller->is_action_in_progress_ = true;
 
+                // 播放音乐时舞蹈动作按节拍对齐周期并在拍点上开始
+                if (params.action_type >= ACTION_SWING && params.action_type <= ACTION_FLAPPING &&
+                    params.action_type != ACTION_BEND && params.action_type != ACTION_SHAKE_LEG) {
+                    params.speed = StreamPlayer::GetInstance().beat_tracker().AlignToBeat(params.speed);
+                }
+
                 switch (params.action_type) {
                     case ACTION_WALK:
                         controller->otto_.Walk(params.steps, params.speed, params.direction,
@@ -138,8 +149,8 @@ private:
 
     void StartActionTaskIfNeeded() {
         if (action_task_handle_ == nullptr) {
-            xTaskCreate(ActionTask, "otto_action", 1024 * 3, this, configMAX_PRIORITIES - 1,
-                        &action_task_handle_);
+            TaskStacks::GetInstance().Create(ActionTask, "otto_action", 1024 * 3, this, ACTION_TASK_PRIORITY,
+                &action_task_handle_);
         }
     }
 
@@ -359,7 +370,7 @@ public:
         mcp_server.AddTool("self.otto.stop", "立即停止", PropertyList(),
                            [this](const PropertyList& properties) -> ReturnValue {
                                if (action_task_handle_ != nullptr) {
-                                   vTaskDelete(action_task_handle_);
+                                   TaskStacks::GetInstance().Delete(action_task_handle_);
                                    action_task_handle_ = nullptr;
                                }
                                is_action_in_progress_ = false;
@@ -476,7 +487,7 @@ public:
 
     ~OttoController() {
         if (action_task_handle_ != nullptr) {
-            vTaskDelete(action_task_handle_);
+            TaskStacks::GetInstance().Delete(action_task_handle_);
             action_task_handle_ = nullptr;
         }
         vQueueDelete(action_queue_);
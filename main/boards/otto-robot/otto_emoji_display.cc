@@ -8,6 +8,7 @@
 
 #include "display/lcd_display.h"
 #include "font_awesome_symbols.h"
+#include "assets.h"
 
 #define TAG "OttoEmojiDisplay"
 
@@ -53,8 +54,7 @@ OttoEmojiDisplay::OttoEmojiDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_p
                                    int width, int height, int offset_x, int offset_y, bool mirror_x,
                                    bool mirror_y, bool swap_xy, DisplayFonts fonts)
     : SpiLcdDisplay(panel_io, panel, width, height, offset_x, offset_y, mirror_x, mirror_y, swap_xy,
-                    fonts),
-      emotion_gif_(nullptr) {
+                    fonts) {
     SetupGifContainer();
 };
 
@@ -86,13 +86,14 @@ void OttoEmojiDisplay::SetupGifContainer() {
     lv_obj_set_style_border_width(emotion_label_, 0, 0);
     lv_obj_add_flag(emotion_label_, LV_OBJ_FLAG_HIDDEN);
 
-    emotion_gif_ = lv_gif_create(content_);
+    emotion_gif_ = std::make_unique<GifPlayer>(content_);
+    lv_obj_t* gif_obj = emotion_gif_->obj();
     int gif_size = LV_HOR_RES;
-    lv_obj_set_size(emotion_gif_, gif_size, gif_size);
-    lv_obj_set_style_border_width(emotion_gif_, 0, 0);
-    lv_obj_set_style_bg_opa(emotion_gif_, LV_OPA_TRANSP, 0);
-    lv_obj_center(emotion_gif_);
-    lv_gif_set_src(emotion_gif_, &staticstate);
+    lv_obj_set_size(gif_obj, gif_size, gif_size);
+    lv_obj_set_style_border_width(gif_obj, 0, 0);
+    lv_obj_set_style_bg_opa(gif_obj, LV_OPA_TRANSP, 0);
+    lv_obj_center(gif_obj);
+    emotion_gif_->SetSource(&staticstate);
 
     chat_message_label_ = lv_label_create(content_);
     lv_label_set_text(chat_message_label_, "");
@@ -118,15 +119,24 @@ void OttoEmojiDisplay::SetEmotion(const char* emotion) {
 
     DisplayLockGuard lock(this);
 
+    // 资源分区里有同名 GIF（如 happy.gif）时优先使用
+    auto& assets = Assets::GetInstance();
+    const lv_image_dsc_t* asset_gif = assets.GetEmoji(emotion, nullptr);
+    if (asset_gif != nullptr) {
+        emotion_gif_->SetSource(asset_gif);
+        ESP_LOGI(TAG, "设置表情: %s", emotion);
+        return;
+    }
+
     for (const auto& map : emotion_maps_) {
         if (map.name && strcmp(map.name, emotion) == 0) {
-            lv_gif_set_src(emotion_gif_, map.gif);
+            emotion_gif_->SetSource(map.gif);
             ESP_LOGI(TAG, "设置表情: %s", emotion);
             return;
         }
     }
 
-    lv_gif_set_src(emotion_gif_, &staticstate);
+    emotion_gif_->SetSource(&staticstate);
     ESP_LOGI(TAG, "未知表情'%s'，使用默认", emotion);
 }
 
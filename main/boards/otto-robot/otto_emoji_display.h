@@ -1,8 +1,9 @@
 #pragma once
 
-#include <libs/gif/lv_gif.h>
+#include <memory>
 
 #include "display/lcd_display.h"
+#include "display/gif_player.h"
 #include "otto_emoji_gif.h"
 
 /**
@@ -35,7 +36,7 @@ public:
 private:
     void SetupGifContainer();
 
-    lv_obj_t* emotion_gif_;  ///< GIF表情组件
+    std::unique_ptr<GifPlayer> emotion_gif_;  ///< GIF表情播放器，切换表情时复用帧缓冲
 
     // 表情映射
     struct EmotionMap {
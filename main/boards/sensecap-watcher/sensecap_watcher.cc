@@ -194,7 +194,8 @@ private:
 
     void OnKnobRotate(bool clockwise) {
         auto codec = GetAudioCodec();
-        int current_volume = codec->output_volume();
+        // 快速转动时按还没写入的目标值累加，codec 由 RequestOutputVolume 限速写入
+        int current_volume = codec->target_output_volume();
         int new_volume = current_volume + (clockwise ? -5 : 5); 
 
         // 确保音量在有效范围内
@@ -206,15 +207,9 @@ private:
             ESP_LOGW(TAG, "Volume reached minimum limit: %d", new_volume);
         }
 
-        codec->SetOutputVolume(new_volume);
+        codec->RequestOutputVolume(new_volume);
         ESP_LOGI(TAG, "Volume changed from %d to %d", current_volume, new_volume);
-        
-        // 显示通知前检查实际变化
-        if (new_volume != codec->output_volume()) {
-            ESP_LOGE(TAG, "Failed to set volume! Expected:%d Actual:%d", 
-                   new_volume, codec->output_volume());
-        }
-        GetDisplay()->ShowNotification(std::string(Lang::Strings::VOLUME) + ": "+std::to_string(codec->output_volume()));
+        GetDisplay()->ShowNotification(std::string(Lang::Strings::VOLUME) + ": "+std::to_string(new_volume));
         power_save_timer_->WakeUp();
     }
 
@@ -4,15 +4,23 @@
 #include "board.h"
 #include "system_info.h"
 #include "config.h"
+#include "application.h"
+#include "json_writer.h"
+#include "transfer_manager.h"
 
 #include <esp_log.h>
 #include <esp_heap_caps.h>
+#include <esp_timer.h>
 #include <img_converters.h>
 #include <cstring>
+#include <map>
 
 #define TAG "SscmaCamera"
 
 #define IMG_JPEG_BUF_SIZE   48 * 1024
+// 持续检测时，不超过这个时间的结果可以直接返回
+#define SSCMA_RESULT_MAX_AGE_US  (1000 * 1000)
+#define SSCMA_INVOKE_TIMEOUT_MS  3000
 
 SscmaCamera::SscmaCamera(esp_io_expander_handle_t io_exp_handle) {
     sscma_client_io_spi_config_t spi_io_config = {0};
@@ -44,12 +52,18 @@ SscmaCamera::SscmaCamera(esp_io_expander_handle_t io_exp_handle) {
     sscma_client_new(sscma_client_io_handle_, &sscma_client_config, &sscma_client_handle_);
 
     sscma_data_queue_ = xQueueCreate(1, sizeof(SscmaData));
+    inference_done_ = xSemaphoreCreateBinary();
 
     sscma_client_callback_t callback = {0};
 
     callback.on_event = [](sscma_client_handle_t client, const sscma_client_reply_t *reply, void *user_ctx) {
         SscmaCamera* self = static_cast<SscmaCamera*>(user_ctx);
         if (!self) return;
+        cJSON* name = cJSON_GetObjectItem(reply->payload, "name");
+        if (cJSON_IsString(name) && strcmp(name->valuestring, "INVOKE") == 0) {
+            self->OnInference(reply);
+            return;
+        }
         char *img = NULL;
         int img_size = 0;
         if (sscma_utils_fetch_image_from_reply(reply, &img, &img_size) == ESP_OK)
@@ -100,6 +114,15 @@ SscmaCamera::SscmaCamera(esp_io_expander_handle_t io_exp_handle) {
             info->id ? info->id : "NULL", 
             info->name ? info->name : "NULL");
     }
+    // 模型的类别名称，推理结果里只有类别序号
+    sscma_client_model_t *model;
+    if (sscma_client_get_model(sscma_client_handle_, &model, true) == ESP_OK) {
+        for (int i = 0; i < SSCMA_CLIENT_MODEL_MAX_CLASSES && model->classes[i] != nullptr; i++) {
+            class_names_.push_back(model->classes[i]);
+        }
+        ESP_LOGI(TAG, "Model: %s, %u classes", model->name ? model->name : "NULL", (unsigned)class_names_.size());
+    }
+    InitializeTools();
     // 初始化JPEG数据的内存
     jpeg_data_.len = 0;
     jpeg_data_.buf = (uint8_t*)heap_caps_malloc(IMG_JPEG_BUF_SIZE, MALLOC_CAP_SPIRAM);;
@@ -160,6 +183,9 @@ SscmaCamera::~SscmaCamera() {
     if (sscma_data_queue_) {
         vQueueDelete(sscma_data_queue_);
     }
+    if (inference_done_) {
+        vSemaphoreDelete(inference_done_);
+    }
     if (jpeg_data_.buf) {
         heap_caps_free(jpeg_data_.buf);
         jpeg_data_.buf = nullptr;
@@ -184,7 +210,20 @@ void SscmaCamera::SetExplainUrl(const std::string& url, const std::string& token
 }
 
 bool SscmaCamera::Capture() {
+    // 拍照前先停止持续检测，拍完再恢复
+    bool watching = watching_;
+    if (watching) {
+        sscma_client_break(sscma_client_handle_);
+    }
+    bool success = CaptureFrame();
+    if (watching && sscma_client_invoke(sscma_client_handle_, -1, true, false) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to resume detection");
+        watching_ = false;
+    }
+    return success;
+}
 
+bool SscmaCamera::CaptureFrame() {
     SscmaData data;
     int ret = 0;
     
@@ -278,6 +317,7 @@ std::string SscmaCamera::Explain(const std::string& question) {
         return "{\"success\": false, \"message\": \"Image explain URL or token is not set\"}";
     }
 
+    TransferScope transfer(kTransferInteractive);
     auto network = Board::GetInstance().GetNetwork();
     auto http = network->CreateHttp(3);
     // 构造multipart/form-data请求体
@@ -322,6 +362,7 @@ std::string SscmaCamera::Explain(const std::string& question) {
     
     // 第三块：JPEG数据
     http->Write((const char*)jpeg_data_.buf, jpeg_data_.len);
+    transfer.Account(jpeg_data_.len);
 
     // 第四块：multipart尾部
     http->Write(multipart_footer.c_str(), multipart_footer.size());
@@ -340,3 +381,157 @@ std::string SscmaCamera::Explain(const std::string& question) {
     ESP_LOGI(TAG, "Explain image size=%d, question=%s\n%s", jpeg_data_.len, question.c_str(), result.c_str());
     return result;
 }
+
+void SscmaCamera::InitializeTools() {
+    auto& mcp_server = McpServer::GetInstance();
+    mcp_server.AddTool("self.camera.detect",
+        "Run the vision model on the device and return what it sees, without uploading a photo.\n"
+        "Prefer this tool over `self.camera.take_photo` for questions like whether anyone is there or how many people there are.\n"
+        "Return:\n"
+        "  `counts`: number of objects of each label; `boxes`: label, score (0-100) and box center x/y and size w/h in 640x480 pixels;\n"
+        "  `classes`: label and score for classification models.",
+        PropertyList(),
+        [this](const PropertyList& properties) -> ReturnValue {
+            return Detect();
+        });
+    mcp_server.AddTool("self.camera.set_watch",
+        "Keep running the vision model on the device. While enabled, a `notifications/message` event with the object counts is sent "
+        "whenever the counts change.",
+        PropertyList({
+            Property("enabled", kPropertyTypeBoolean)
+        }),
+        [this](const PropertyList& properties) -> ReturnValue {
+            return SetWatching(properties["enabled"].value<bool>());
+        });
+}
+
+std::string SscmaCamera::GetLabel(int target) const {
+    if (target >= 0 && target < (int)class_names_.size()) {
+        return class_names_[target];
+    }
+    return std::to_string(target);
+}
+
+void SscmaCamera::OnInference(const sscma_client_reply_t* reply) {
+    {
+        std::lock_guard<std::mutex> lock(result_mutex_);
+        if (sscma_utils_copy_boxes_from_reply(reply, boxes_, SSCMA_MAX_RESULTS, &num_boxes_) != ESP_OK) {
+            num_boxes_ = 0;
+        }
+        if (sscma_utils_copy_classes_from_reply(reply, classes_, SSCMA_MAX_RESULTS, &num_classes_) != ESP_OK) {
+            num_classes_ = 0;
+        }
+        result_time_us_ = esp_timer_get_time();
+    }
+    xSemaphoreGive(inference_done_);
+
+    if (!watching_) {
+        return;
+    }
+    // 只在数量变化时推送，框的位置每帧都会变
+    std::string counts = GetCountsJson();
+    if (counts == last_counts_) {
+        return;
+    }
+    last_counts_ = counts;
+    Application::GetInstance().SendMcpMessage([&counts](JsonWriter& writer) {
+        writer.Raw("{\"jsonrpc\":\"2.0\",\"method\":\"notifications/message\",\"params\":{\"level\":\"info\",")
+            .Raw("\"logger\":\"self.camera\",\"data\":{\"event\":\"detection\",\"counts\":").Raw(counts).Raw("}}}");
+    }, counts.size() + 128);
+}
+
+std::string SscmaCamera::GetCountsJson() {
+    std::map<std::string, int> counts;
+    {
+        std::lock_guard<std::mutex> lock(result_mutex_);
+        for (int i = 0; i < num_boxes_; i++) {
+            counts[GetLabel(boxes_[i].target)]++;
+        }
+    }
+    std::string json;
+    JsonWriter writer(json);
+    writer.Raw("{");
+    for (auto it = counts.begin(); it != counts.end(); ++it) {
+        if (it != counts.begin()) {
+            writer.Raw(",");
+        }
+        writer.String(it->first).Raw(":").Int(it->second);
+    }
+    writer.Raw("}");
+    return json;
+}
+
+std::string SscmaCamera::GetResultJson() {
+    std::string counts = GetCountsJson();
+    std::string json;
+    JsonWriter writer(json);
+    std::lock_guard<std::mutex> lock(result_mutex_);
+    writer.Raw("{\"success\":true,\"counts\":").Raw(counts).Raw(",\"boxes\":[");
+    for (int i = 0; i < num_boxes_; i++) {
+        auto& box = boxes_[i];
+        writer.Raw(i > 0 ? ",{\"label\":" : "{\"label\":").String(GetLabel(box.target))
+            .Raw(",\"score\":").Int(box.score)
+            .Raw(",\"x\":").Int(box.x).Raw(",\"y\":").Int(box.y)
+            .Raw(",\"w\":").Int(box.w).Raw(",\"h\":").Int(box.h).Raw("}");
+    }
+    writer.Raw("],\"classes\":[");
+    for (int i = 0; i < num_classes_; i++) {
+        writer.Raw(i > 0 ? ",{\"label\":" : "{\"label\":").String(GetLabel(classes_[i].target))
+            .Raw(",\"score\":").Int(classes_[i].score).Raw("}");
+    }
+    writer.Raw("]}");
+    return json;
+}
+
+std::string SscmaCamera::Detect() {
+    if (sscma_client_handle_ == nullptr) {
+        return "{\"success\": false, \"message\": \"SSCMA client is not initialized\"}";
+    }
+
+    // 持续检测时直接使用最新结果
+    if (watching_) {
+        std::unique_lock<std::mutex> lock(result_mutex_);
+        bool fresh = esp_timer_get_time() - result_time_us_ < SSCMA_RESULT_MAX_AGE_US;
+        lock.unlock();
+        if (fresh) {
+            return GetResultJson();
+        }
+        if (xSemaphoreTake(inference_done_, pdMS_TO_TICKS(SSCMA_INVOKE_TIMEOUT_MS)) != pdPASS) {
+            return "{\"success\": false, \"message\": \"Detection timeout\"}";
+        }
+        return GetResultJson();
+    }
+
+    xSemaphoreTake(inference_done_, 0);
+    if (sscma_client_invoke(sscma_client_handle_, 1, false, false) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to invoke model");
+        return "{\"success\": false, \"message\": \"Failed to run detection\"}";
+    }
+    if (xSemaphoreTake(inference_done_, pdMS_TO_TICKS(SSCMA_INVOKE_TIMEOUT_MS)) != pdPASS) {
+        return "{\"success\": false, \"message\": \"Detection timeout\"}";
+    }
+    std::string result = GetResultJson();
+    ESP_LOGI(TAG, "Detect: %s", result.c_str());
+    return result;
+}
+
+bool SscmaCamera::SetWatching(bool enabled) {
+    if (sscma_client_handle_ == nullptr || enabled == watching_) {
+        return sscma_client_handle_ != nullptr;
+    }
+    if (enabled) {
+        last_counts_.clear();
+        watching_ = true;
+        // filter 为 true 时协处理器只在结果变化时上报
+        if (sscma_client_invoke(sscma_client_handle_, -1, true, false) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to start detection");
+            watching_ = false;
+            return false;
+        }
+    } else {
+        watching_ = false;
+        sscma_client_break(sscma_client_handle_);
+    }
+    ESP_LOGI(TAG, "Detection watching %s", enabled ? "enabled" : "disabled");
+    return true;
+}
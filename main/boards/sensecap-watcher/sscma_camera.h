@@ -4,9 +4,14 @@
 #include <lvgl.h>
 #include <thread>
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
+#include <freertos/semphr.h>
 #include <esp_io_expander_tca95xx_16bit.h>
 #include <esp_jpeg_dec.h>
 #include <mbedtls/base64.h>
@@ -23,6 +28,9 @@ struct JpegData {
     size_t len;
 };
 
+// 每次推理最多保留的结果数
+#define SSCMA_MAX_RESULTS 16
+
 class SscmaCamera : public Camera {
 private:
     lv_img_dsc_t preview_image_;
@@ -35,6 +43,25 @@ private:
     jpeg_dec_handle_t *jpeg_dec_;
     jpeg_dec_io_t *jpeg_io_;
     jpeg_dec_header_info_t *jpeg_out_;
+
+    // 协处理器上模型的推理结果，由 SSCMA 处理任务写入
+    std::mutex result_mutex_;
+    SemaphoreHandle_t inference_done_ = nullptr;
+    std::vector<std::string> class_names_;
+    sscma_client_box_t boxes_[SSCMA_MAX_RESULTS];
+    int num_boxes_ = 0;
+    sscma_client_class_t classes_[SSCMA_MAX_RESULTS];
+    int num_classes_ = 0;
+    int64_t result_time_us_ = 0;
+    std::atomic<bool> watching_ = false;
+    std::string last_counts_;
+
+    bool CaptureFrame();
+    void OnInference(const sscma_client_reply_t* reply);
+    std::string GetLabel(int target) const;
+    std::string GetCountsJson();
+    std::string GetResultJson();
+    void InitializeTools();
 public:
     SscmaCamera(esp_io_expander_handle_t io_exp_handle);
     ~SscmaCamera();
@@ -45,6 +72,11 @@ public:
     virtual bool SetHMirror(bool enabled) override;
     virtual bool SetVFlip(bool enabled) override;
     virtual std::string Explain(const std::string& question);
+
+    // 用协处理器上的模型检测一次，返回 JSON 格式的目标、数量和框，不上传图片
+    std::string Detect();
+    // 持续检测，目标数量变化时通过 MCP 通知推送
+    bool SetWatching(bool enabled);
 };
 
 #endif // ESP32_CAMERA_H
@@ -32,22 +32,8 @@ static const sh8601_lcd_init_cmd_t lcd_init_cmds[] =
     {0x51, (uint8_t []){0xFF}, 1, 0},
 };
 
-class CustomLcdDisplay : public SpiLcdDisplay {
+class CustomLcdDisplay : public QspiLcdDisplay {
 public:
-    static void MyDrawEventCb(lv_event_t *e) {
-        lv_area_t *area = (lv_area_t *)lv_event_get_param(e);   
-        uint16_t x1 = area->x1;
-        uint16_t x2 = area->x2; 
-        uint16_t y1 = area->y1;
-        uint16_t y2 = area->y2; 
-        // round the start of coordinate down to the nearest 2M number
-        area->x1 = (x1 >> 1) << 1;
-        area->y1 = (y1 >> 1) << 1;
-        // round the end of coordinate up to the nearest 2N+1 number
-        area->x2 = ((x2 >> 1) << 1) + 1;
-        area->y2 = ((y2 >> 1) << 1) + 1;
-    }
-
     CustomLcdDisplay(esp_lcd_panel_io_handle_t io_handle,
                     esp_lcd_panel_handle_t panel_handle,
                     int width,
@@ -57,15 +43,14 @@ public:
                     bool mirror_x,
                     bool mirror_y,
                     bool swap_xy)
-        : SpiLcdDisplay(io_handle, panel_handle,
+        : QspiLcdDisplay(io_handle, panel_handle,
                     width, height, offset_x, offset_y, mirror_x, mirror_y, swap_xy,
                     {
                         .text_font = &font_puhui_30_4,
                         .icon_font = &font_awesome_30_4,
                         .emoji_font = font_emoji_64_init(),
-                    }) {
-        DisplayLockGuard lock(this);
-        lv_display_add_event_cb(display_, MyDrawEventCb, LV_EVENT_INVALIDATE_AREA, NULL);
+                    },
+                    {.x_align = 2, .y_align = 2}) {
     }
 };
 
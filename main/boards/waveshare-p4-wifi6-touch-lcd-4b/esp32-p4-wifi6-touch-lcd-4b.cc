@@ -17,6 +17,7 @@
 #include <driver/i2c_master.h>
 #include <esp_lvgl_port.h>
 #include "esp_lcd_touch_gt911.h"
+#include "touch_input.h"
 #define TAG "WaveshareEsp32p44b"
 
 LV_FONT_DECLARE(font_puhui_30_4);
@@ -146,11 +147,7 @@ private:
         ESP_ERROR_CHECK(esp_lcd_new_panel_io_i2c(i2c_bus_, &tp_io_config, &tp_io_handle));
         ESP_LOGI(TAG, "Initialize touch controller");
         ESP_ERROR_CHECK(esp_lcd_touch_new_i2c_gt911(tp_io_handle, &tp_cfg, &tp));
-        const lvgl_port_touch_cfg_t touch_cfg = {
-            .disp = lv_display_get_default(),
-            .handle = tp,
-        };
-        lvgl_port_add_touch(&touch_cfg);
+        TouchInput::Attach(tp);
         ESP_LOGI(TAG, "Touch panel initialized successfully");
     }
     void InitializeButtons() {
@@ -275,6 +275,7 @@ CustomLcdDisplay::CustomLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_p
     lvgl_port_cfg_t port_cfg = ESP_LVGL_PORT_INIT_CONFIG();
     port_cfg.task_priority = 1;
     port_cfg.timer_period_ms = 50;
+    port_cfg.task_affinity = DISPLAY_TASK_AFFINITY;
     lvgl_port_init(&port_cfg);
     trans_done_sem = xSemaphoreCreateCounting(1, 0);
     trans_buf_1 = (uint16_t *)heap_caps_malloc(DISPLAY_TRANS_SIZE * sizeof(uint16_t), MALLOC_CAP_DMA);
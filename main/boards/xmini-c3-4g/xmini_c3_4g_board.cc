@@ -56,14 +56,19 @@ private:
             ESP_LOGI(TAG, "Enabling sleep mode");
             // Show the standby screen
             GetDisplay()->SetPowerSaveMode(true);
-            // Enable sleep mode, and sleep in 1 second after DTR is set to high
-            modem_->SetSleepMode(true, 1);
-            // Set the DTR pin to high to make the modem enter sleep mode
-            modem_->GetAtUart()->SetDtrPin(true);
+            // PPP 数据模式下没有 AtModem，模组保持在线
+            if (modem_ != nullptr) {
+                // Enable sleep mode, and sleep in 1 second after DTR is set to high
+                modem_->SetSleepMode(true, 1);
+                // Set the DTR pin to high to make the modem enter sleep mode
+                modem_->GetAtUart()->SetDtrPin(true);
+            }
         });
         sleep_timer_->OnExitLightSleepMode([this]() {
             // Set the DTR pin to low to make the modem wake up
-            modem_->GetAtUart()->SetDtrPin(false);
+            if (modem_ != nullptr) {
+                modem_->GetAtUart()->SetDtrPin(false);
+            }
             // Hide the standby screen
             GetDisplay()->SetPowerSaveMode(false);
         });
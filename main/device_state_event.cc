@@ -1,5 +1,14 @@
 #include "device_state_event.h"
 
+#include <esp_log.h>
+
+#define TAG "DeviceStateEvent"
+
+// 事件循环繁忙时最多等待的时间，避免阻塞主循环
+#define DEVICE_STATE_POST_TIMEOUT_MS 100
+// 投递失败后重试的间隔
+#define DEVICE_STATE_RETRY_MS 50
+
 ESP_EVENT_DEFINE_BASE(XIAOZHI_STATE_EVENTS);
 
 DeviceStateEventManager& DeviceStateEventManager::GetInstance() {
@@ -7,22 +16,64 @@ DeviceStateEventManager& DeviceStateEventManager::GetInstance() {
     return instance;
 }
 
-void DeviceStateEventManager::RegisterStateChangeCallback(std::function<void(DeviceState, DeviceState)> callback) {
+void DeviceStateEventManager::RegisterStateChangeCallback(Callback callback, bool synchronous) {
     std::lock_guard<std::mutex> lock(mutex_);
-    callbacks_.push_back(callback);
+    auto& subscribers = synchronous ? sync_subscribers_ : async_subscribers_;
+    size_t index = subscribers.count.load(std::memory_order_relaxed);
+    if (index >= subscribers.callbacks.size()) {
+        ESP_LOGE(TAG, "Too many state change callbacks");
+        return;
+    }
+    subscribers.callbacks[index] = std::move(callback);
+    subscribers.count.store(index + 1, std::memory_order_release);
 }
 
 void DeviceStateEventManager::PostStateChangeEvent(DeviceState previous_state, DeviceState current_state) {
+    sync_subscribers_.Dispatch(previous_state, current_state);
+    if (async_subscribers_.count.load(std::memory_order_acquire) == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(post_mutex_);
+    if (pending_) {
+        // 还有没投递出去的变化，合并后一起发，异步订阅者不会先看到新状态再看到旧状态
+        previous_state = pending_previous_;
+    }
+    PostLocked(previous_state, current_state, pdMS_TO_TICKS(DEVICE_STATE_POST_TIMEOUT_MS));
+}
+
+bool DeviceStateEventManager::PostLocked(DeviceState previous_state, DeviceState current_state, TickType_t timeout) {
     device_state_event_data_t event_data = {
         .previous_state = previous_state,
         .current_state = current_state
     };
-    esp_event_post(XIAOZHI_STATE_EVENTS, XIAOZHI_STATE_CHANGED_EVENT, &event_data, sizeof(event_data), portMAX_DELAY);
+    esp_err_t err = esp_event_post(XIAOZHI_STATE_EVENTS, XIAOZHI_STATE_CHANGED_EVENT, &event_data, sizeof(event_data),
+        timeout);
+    if (err == ESP_OK) {
+        if (pending_) {
+            ESP_LOGI(TAG, "Posted the delayed state change %d -> %d", previous_state, current_state);
+            pending_ = false;
+        }
+        return true;
+    }
+    if (!pending_) {
+        ESP_LOGW(TAG, "Failed to post state change %d -> %d: %s, retrying", previous_state, current_state, esp_err_to_name(err));
+        pending_ = true;
+        pending_previous_ = previous_state;
+    }
+    pending_current_ = current_state;
+    if (!esp_timer_is_active(retry_timer_)) {
+        esp_timer_start_once(retry_timer_, DEVICE_STATE_RETRY_MS * 1000);
+    }
+    return false;
 }
 
-std::vector<std::function<void(DeviceState, DeviceState)>> DeviceStateEventManager::GetCallbacks() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return callbacks_;
+// 在 esp_timer 任务里运行，不等待；主循环正在投递时由它合并并在失败时重新启动定时器
+void DeviceStateEventManager::RetryPending() {
+    std::unique_lock<std::mutex> lock(post_mutex_, std::try_to_lock);
+    if (lock.owns_lock() && pending_) {
+        PostLocked(pending_previous_, pending_current_, 0);
+    }
 }
 
 DeviceStateEventManager::DeviceStateEventManager() {
@@ -35,12 +86,23 @@ DeviceStateEventManager::DeviceStateEventManager() {
         [](void* handler_args, esp_event_base_t base, int32_t id, void* event_data) {
             auto* data = static_cast<device_state_event_data_t*>(event_data);
             auto& manager = DeviceStateEventManager::GetInstance();
-            for (const auto& callback : manager.GetCallbacks()) {
-                callback(data->previous_state, data->current_state);
-            }
+            manager.async_subscribers_.Dispatch(data->previous_state, data->current_state);
         }, nullptr));
+
+    esp_timer_create_args_t timer_args = {
+        .callback = [](void* arg) {
+            static_cast<DeviceStateEventManager*>(arg)->RetryPending();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "state_event_retry",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &retry_timer_));
 }
 
 DeviceStateEventManager::~DeviceStateEventManager() {
+    esp_timer_stop(retry_timer_);
+    esp_timer_delete(retry_timer_);
     esp_event_handler_unregister(XIAOZHI_STATE_EVENTS, XIAOZHI_STATE_CHANGED_EVENT, nullptr);
-}
\ No newline at end of file
+}
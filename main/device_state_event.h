@@ -2,8 +2,10 @@
 #define _DEVICE_STATE_EVENT_H_
 
 #include <esp_event.h>
+#include <esp_timer.h>
 #include <functional>
-#include <vector>
+#include <array>
+#include <atomic>
 #include <mutex>
 #include "device_state.h"
 
@@ -18,22 +20,57 @@ struct device_state_event_data_t {
     DeviceState current_state;
 };
 
+#define DEVICE_STATE_MAX_CALLBACKS 8
+
+/*
+ * Subscribers live in a fixed array that is only appended to, the count is published after the slot is
+ * written, so dispatch reads it without a lock and without copying the callbacks.
+ * Synchronous callbacks run directly in PostStateChangeEvent() on the caller's task (the main loop), for
+ * listeners like LEDs that must follow fast transitions, they must not block. The others run on the
+ * default event loop; the event is only posted when there are such callbacks, esp_event copies the data
+ * to the heap for every post. A post that times out is not dropped: it is kept as pending, merged with the
+ * later transitions (oldest previous state, latest current state) and retried from a timer, so the async
+ * listeners always end up on the current state.
+ */
 class DeviceStateEventManager {
 public:
+    using Callback = std::function<void(DeviceState, DeviceState)>;
+
     static DeviceStateEventManager& GetInstance();
     DeviceStateEventManager(const DeviceStateEventManager&) = delete;
     DeviceStateEventManager& operator=(const DeviceStateEventManager&) = delete;
 
-    void RegisterStateChangeCallback(std::function<void(DeviceState, DeviceState)> callback);
+    void RegisterStateChangeCallback(Callback callback, bool synchronous = false);
     void PostStateChangeEvent(DeviceState previous_state, DeviceState current_state);
-    std::vector<std::function<void(DeviceState, DeviceState)>> GetCallbacks();
 
 private:
+    struct Subscribers {
+        std::array<Callback, DEVICE_STATE_MAX_CALLBACKS> callbacks;
+        std::atomic<size_t> count{0};
+
+        void Dispatch(DeviceState previous_state, DeviceState current_state) const {
+            size_t n = count.load(std::memory_order_acquire);
+            for (size_t i = 0; i < n; i++) {
+                callbacks[i](previous_state, current_state);
+            }
+        }
+    };
+
     DeviceStateEventManager();
     ~DeviceStateEventManager();
 
-    std::vector<std::function<void(DeviceState, DeviceState)>> callbacks_;
+    bool PostLocked(DeviceState previous_state, DeviceState current_state, TickType_t timeout);
+    void RetryPending();
+
+    Subscribers sync_subscribers_;
+    Subscribers async_subscribers_;
     std::mutex mutex_;
+    // 投递按顺序进行，没投递出去的变化合并到 pending 里等重试
+    std::mutex post_mutex_;
+    bool pending_ = false;
+    DeviceState pending_previous_ = kDeviceStateUnknown;
+    DeviceState pending_current_ = kDeviceStateUnknown;
+    esp_timer_handle_t retry_timer_ = nullptr;
 };
 
-#endif // _DEVICE_STATE_EVENT_H_ 
\ No newline at end of file
+#endif // _DEVICE_STATE_EVENT_H_ 
@@ -10,10 +10,20 @@
 #include "font_awesome_symbols.h"
 #include "audio_codec.h"
 #include "settings.h"
+#include "assets.h"
 #include "assets/lang_config.h"
 
 #define TAG "Display"
 
+// LVGL 刷新周期 (ms)
+#define DISPLAY_REFR_PERIOD_BOOST_MS      20
+#define DISPLAY_REFR_PERIOD_IDLE_MS       100
+#define DISPLAY_REFR_PERIOD_POWER_SAVE_MS 250
+
+// 状态栏数据源的轮询间隔 (s)
+#define STATUS_BAR_BATTERY_INTERVAL_S 5
+#define STATUS_BAR_NETWORK_INTERVAL_S 10
+
 Display::Display() {
     // Notification timer
     esp_timer_create_args_t notification_timer_args = {
@@ -30,6 +40,20 @@ Display::Display() {
     };
     ESP_ERROR_CHECK(esp_timer_create(&notification_timer_args, &notification_timer_));
 
+    // Refresh boost timer
+    esp_timer_create_args_t refresh_boost_timer_args = {
+        .callback = [](void *arg) {
+            Display *display = static_cast<Display*>(arg);
+            display->refresh_boosted_ = false;
+            display->UpdateRefreshPeriod();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "refresh_boost_timer",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&refresh_boost_timer_args, &refresh_boost_timer_));
+
     // Create a power management lock
     auto ret = esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "display_update", &pm_lock_);
     if (ret == ESP_ERR_NOT_SUPPORTED) {
@@ -44,6 +68,10 @@ Display::~Display() {
         esp_timer_stop(notification_timer_);
         esp_timer_delete(notification_timer_);
     }
+    if (refresh_boost_timer_ != nullptr) {
+        esp_timer_stop(refresh_boost_timer_);
+        esp_timer_delete(refresh_boost_timer_);
+    }
 
     if (network_label_ != nullptr) {
         lv_obj_del(network_label_);
@@ -71,6 +99,8 @@ void Display::SetStatus(const char* status) {
     lv_obj_add_flag(notification_label_, LV_OBJ_FLAG_HIDDEN);
 
     last_status_update_time_ = std::chrono::system_clock::now();
+    // 时钟被别的状态覆盖，下次空闲时重新显示
+    clock_minute_ = -1;
 }
 
 void Display::ShowNotification(const std::string &notification, int duration_ms) {
@@ -93,87 +123,58 @@ void Display::ShowNotification(const char* notification, int duration_ms) {
 void Display::UpdateStatusBar(bool update_all) {
     auto& app = Application::GetInstance();
     auto& board = Board::GetInstance();
-    auto codec = board.GetAudioCodec();
+    auto device_state = app.GetDeviceState();
+    auto now = std::chrono::system_clock::now();
 
-    // Update mute icon
-    {
-        DisplayLockGuard lock(this);
-        if (mute_label_ == nullptr) {
-            return;
-        }
-
-        // 如果静音状态改变，则更新图标
-        if (codec->output_volume() == 0 && !muted_) {
-            muted_ = true;
-            lv_label_set_text(mute_label_, FONT_AWESOME_VOLUME_MUTE);
-        } else if (codec->output_volume() > 0 && muted_) {
-            muted_ = false;
-            lv_label_set_text(mute_label_, "");
-        }
-    }
+    // 先在锁外采集各个来源，和已经显示的内容比较，只有变化的部分在一次加锁里更新
+    bool muted = board.GetAudioCodec()->output_volume() == 0;
 
-    // Update time
-    if (app.GetDeviceState() == kDeviceStateIdle) {
-        if (last_status_update_time_ + std::chrono::seconds(10) < std::chrono::system_clock::now()) {
-            // Set status to clock "HH:MM"
-            time_t now = time(NULL);
-            struct tm* tm = localtime(&now);
+    // 空闲时状态栏显示时钟，同一分钟内文字不变，不再格式化
+    char clock_text[16] = "";
+    if (device_state == kDeviceStateIdle && last_status_update_time_ + std::chrono::seconds(10) < now) {
+        time_t seconds = time(NULL);
+        if (seconds / 60 != clock_minute_) {
+            struct tm tm;
+            localtime_r(&seconds, &tm);
             // Check if the we have already set the time
-            if (tm->tm_year >= 2025 - 1900) {
-                char time_str[16];
-                strftime(time_str, sizeof(time_str), "%H:%M  ", tm);
-                SetStatus(time_str);
+            if (tm.tm_year >= 2025 - 1900) {
+                strftime(clock_text, sizeof(clock_text), "%H:%M  ", &tm);
+                clock_minute_ = seconds / 60;
             } else {
-                ESP_LOGW(TAG, "System time is not set, tm_year: %d", tm->tm_year);
+                ESP_LOGW(TAG, "System time is not set, tm_year: %d", tm.tm_year);
             }
         }
     }
 
-    esp_pm_lock_acquire(pm_lock_);
-    // 更新电池图标
-    int battery_level;
-    bool charging, discharging;
-    const char* icon = nullptr;
-    if (board.GetBatteryLevel(battery_level, charging, discharging)) {
-        if (charging) {
-            icon = FONT_AWESOME_BATTERY_CHARGING;
-        } else {
-            const char* levels[] = {
-                FONT_AWESOME_BATTERY_EMPTY, // 0-19%
-                FONT_AWESOME_BATTERY_1,    // 20-39%
-                FONT_AWESOME_BATTERY_2,    // 40-59%
-                FONT_AWESOME_BATTERY_3,    // 60-79%
-                FONT_AWESOME_BATTERY_FULL, // 80-99%
-                FONT_AWESOME_BATTERY_FULL, // 100%
-            };
-            icon = levels[battery_level / 20];
-        }
-        DisplayLockGuard lock(this);
-        if (battery_label_ != nullptr && battery_icon_ != icon) {
-            battery_icon_ = icon;
-            lv_label_set_text(battery_label_, battery_icon_);
-        }
-
-        if (low_battery_popup_ != nullptr) {
-            if (strcmp(icon, FONT_AWESOME_BATTERY_EMPTY) == 0 && discharging) {
-                if (lv_obj_has_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN)) { // 如果低电量提示框隐藏，则显示
-                    lv_obj_clear_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
-                    app.PlaySound(Lang::Sounds::P3_LOW_BATTERY);
-                }
+    // 电池每 STATUS_BAR_BATTERY_INTERVAL_S 秒读一次，网络图标每 STATUS_BAR_NETWORK_INTERVAL_S 秒
+    const char* battery_icon = battery_icon_;
+    bool low_battery = low_battery_;
+    const char* network_icon = network_icon_;
+    bool read_battery = update_all || status_bar_ticks_ % STATUS_BAR_BATTERY_INTERVAL_S == 0;
+    bool read_network = update_all || status_bar_ticks_ % STATUS_BAR_NETWORK_INTERVAL_S == 0;
+    status_bar_ticks_++;
+    if (read_battery || read_network) {
+        esp_pm_lock_acquire(pm_lock_);
+        int battery_level;
+        bool charging, discharging;
+        if (read_battery && board.GetBatteryLevel(battery_level, charging, discharging)) {
+            if (charging) {
+                battery_icon = FONT_AWESOME_BATTERY_CHARGING;
             } else {
-                // Hide the low battery popup when the battery is not empty
-                if (!lv_obj_has_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN)) { // 如果低电量提示框显示，则隐藏
-                    lv_obj_add_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
-                }
+                const char* levels[] = {
+                    FONT_AWESOME_BATTERY_EMPTY, // 0-19%
+                    FONT_AWESOME_BATTERY_1,    // 20-39%
+                    FONT_AWESOME_BATTERY_2,    // 40-59%
+                    FONT_AWESOME_BATTERY_3,    // 60-79%
+                    FONT_AWESOME_BATTERY_FULL, // 80-99%
+                    FONT_AWESOME_BATTERY_FULL, // 100%
+                };
+                battery_icon = levels[battery_level / 20];
             }
+            low_battery = strcmp(battery_icon, FONT_AWESOME_BATTERY_EMPTY) == 0 && discharging;
         }
-    }
 
-    // 每 10 秒更新一次网络图标
-    static int seconds_counter = 0;
-    if (update_all || seconds_counter++ % 10 == 0) {
         // 升级固件时，不读取 4G 网络状态，避免占用 UART 资源
-        auto device_state = Application::GetInstance().GetDeviceState();
         static const std::vector<DeviceState> allowed_states = {
             kDeviceStateIdle,
             kDeviceStateStarting,
@@ -181,17 +182,56 @@ void Display::UpdateStatusBar(bool update_all) {
             kDeviceStateListening,
             kDeviceStateActivating,
         };
-        if (std::find(allowed_states.begin(), allowed_states.end(), device_state) != allowed_states.end()) {
-            icon = board.GetNetworkStateIcon();
-            if (network_label_ != nullptr && icon != nullptr && network_icon_ != icon) {
-                DisplayLockGuard lock(this);
-                network_icon_ = icon;
-                lv_label_set_text(network_label_, network_icon_);
+        if (read_network && std::find(allowed_states.begin(), allowed_states.end(), device_state) != allowed_states.end()) {
+            auto icon = board.GetNetworkStateIcon();
+            if (icon != nullptr) {
+                network_icon = icon;
             }
         }
+        esp_pm_lock_release(pm_lock_);
     }
 
-    esp_pm_lock_release(pm_lock_);
+    bool show_low_battery = false;
+    if (muted != muted_ || clock_text[0] != '\0' || battery_icon != battery_icon_ || low_battery != low_battery_ ||
+        network_icon != network_icon_) {
+        DisplayLockGuard lock(this);
+        if (mute_label_ == nullptr) {
+            return;
+        }
+        if (muted != muted_) {
+            muted_ = muted;
+            lv_label_set_text(mute_label_, muted_ ? FONT_AWESOME_VOLUME_MUTE : "");
+        }
+        if (clock_text[0] != '\0') {
+            lv_label_set_text(status_label_, clock_text);
+            lv_obj_clear_flag(status_label_, LV_OBJ_FLAG_HIDDEN);
+            lv_obj_add_flag(notification_label_, LV_OBJ_FLAG_HIDDEN);
+            last_status_update_time_ = now;
+        }
+        if (battery_icon != battery_icon_ && battery_label_ != nullptr) {
+            battery_icon_ = battery_icon;
+            lv_label_set_text(battery_label_, battery_icon_);
+        }
+        if (low_battery != low_battery_) {
+            low_battery_ = low_battery;
+            if (low_battery_popup_ != nullptr) {
+                if (low_battery_) {
+                    lv_obj_clear_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
+                    show_low_battery = true;
+                } else {
+                    // Hide the low battery popup when the battery is not empty
+                    lv_obj_add_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
+                }
+            }
+        }
+        if (network_icon != network_icon_ && network_label_ != nullptr) {
+            network_icon_ = network_icon;
+            lv_label_set_text(network_label_, network_icon_);
+        }
+    }
+    if (show_low_battery) {
+        app.PlaySound(Assets::GetInstance().GetSound("low_battery", Lang::Sounds::P3_LOW_BATTERY));
+    }
 }
 
 
@@ -285,6 +325,8 @@ void Display::SetTheme(const std::string& theme_name) {
 }
 
 void Display::SetPowerSaveMode(bool on) {
+    power_save_ = on;
+    UpdateRefreshPeriod();
     if (on) {
         SetChatMessage("system", "");
         SetEmotion("sleepy");
@@ -292,4 +334,91 @@ void Display::SetPowerSaveMode(bool on) {
         SetChatMessage("system", "");
         SetEmotion("neutral");
     }
-}
\ No newline at end of file
+}
+void Display::SetIdle(bool idle) {
+    idle_ = idle;
+    UpdateRefreshPeriod();
+}
+
+void Display::SetAnimationActive(bool active) {
+    animation_active_ = active;
+    UpdateRefreshPeriod();
+}
+
+void Display::BoostRefresh(int duration_ms) {
+    esp_timer_stop(refresh_boost_timer_);
+    refresh_boosted_ = true;
+    UpdateRefreshPeriod();
+    esp_timer_start_once(refresh_boost_timer_, duration_ms * 1000);
+}
+
+void Display::SetBatterySaver(bool on) {
+    battery_saver_ = on;
+    UpdateRefreshPeriod();
+}
+
+void Display::SetCpuSaver(bool on) {
+    cpu_saver_ = on;
+    UpdateRefreshPeriod();
+}
+
+void Display::SetAudioCritical(bool on) {
+    if (audio_critical_ == on) {
+        return;
+    }
+    audio_critical_ = on;
+    UpdateRefreshPeriod();
+}
+
+void Display::SetRenderingPaused(bool paused) {
+    if (rendering_paused_ == paused) {
+        return;
+    }
+    rendering_paused_ = paused;
+    ESP_LOGI(TAG, "Rendering %s", paused ? "paused" : "resumed");
+    UpdateRefreshPeriod();
+}
+
+bool Display::RenderFullFrame() {
+    if (display_ == nullptr) {
+        return false;
+    }
+    DisplayLockGuard lock(this);
+    lv_obj_invalidate(lv_screen_active());
+    lv_refr_now(display_);
+    return true;
+}
+
+void Display::UpdateRefreshPeriod() {
+    if (display_ == nullptr) {
+        return;
+    }
+    DisplayLockGuard lock(this);
+    lv_timer_t* refr_timer = lv_display_get_refr_timer(display_);
+    if (refr_timer == nullptr) {
+        return;
+    }
+
+    // 背光关闭时屏幕不可见，暂停刷新定时器，界面状态照常更新，恢复时整屏重绘一次
+    if (rendering_paused_) {
+        lv_timer_pause(refr_timer);
+        refr_timer_paused_ = true;
+        return;
+    }
+
+    uint32_t period = LV_DEF_REFR_PERIOD;
+    bool saver = battery_saver_ || cpu_saver_ || audio_critical_;
+    if ((animation_active_ || refresh_boosted_) && !saver) {
+        period = DISPLAY_REFR_PERIOD_BOOST_MS;
+    } else if (power_save_) {
+        period = DISPLAY_REFR_PERIOD_POWER_SAVE_MS;
+    } else if (idle_ || saver) {
+        period = DISPLAY_REFR_PERIOD_IDLE_MS;
+    }
+    lv_timer_set_period(refr_timer, period);
+    if (refr_timer_paused_) {
+        refr_timer_paused_ = false;
+        lv_timer_resume(refr_timer);
+        lv_obj_invalidate(lv_screen_active());
+    }
+}
@@ -7,7 +7,23 @@
 #include <esp_pm.h>
 
 #include <string>
+#include <atomic>
 #include <chrono>
+#include <ctime>
+#include <cctype>
+
+// LVGL 和频谱任务的核心，默认离开 AFE 所在的核心 1
+#if defined(CONFIG_DISPLAY_TASK_CORE) && CONFIG_DISPLAY_TASK_CORE >= 0
+#define DISPLAY_TASK_AFFINITY CONFIG_DISPLAY_TASK_CORE
+#else
+#define DISPLAY_TASK_AFFINITY -1
+#endif
+
+// 拼接同一条回复的句子：前后都是 ASCII 时补一个空格，中文直接相连
+inline bool NeedsSentenceSpace(char last, char first) {
+    return (unsigned char)last < 0x80 && (unsigned char)first < 0x80 && !isspace((unsigned char)last) &&
+        !isspace((unsigned char)first);
+}
 
 struct DisplayFonts {
     const lv_font_t* text_font = nullptr;
@@ -25,13 +41,32 @@ public:
     virtual void ShowNotification(const std::string &notification, int duration_ms = 3000);
     virtual void SetEmotion(const char* emotion);
     virtual void SetChatMessage(const char* role, const char* content);
+    // 把文字接到同一角色的最后一条消息后面，不支持的显示改为整条替换
+    virtual void AppendChatMessage(const char* role, const char* content) { SetChatMessage(role, content); }
     virtual void SetMusicInfo(const char* song_name);
+    // 歌曲封面，RGB565，边长为 GetMusicCoverSize()，传空时隐藏；调用方在替换或隐藏之前保持图片有效
+    virtual void SetMusicCover(const lv_img_dsc_t* image) {}
+    // 封面边长（像素），0 表示不显示封面
+    virtual int GetMusicCoverSize() { return 0; }
     virtual void SetIcon(const char* icon);
     virtual void SetPreviewImage(const lv_img_dsc_t* image);
     virtual void SetTheme(const std::string& theme_name);
     virtual std::string GetTheme() { return current_theme_name_; }
     virtual void UpdateStatusBar(bool update_all = false);
     virtual void SetPowerSaveMode(bool on);
+    // 刷新率调度：空闲/省电时降低，动画、频谱、滚动时提高，背光关闭时暂停渲染
+    void SetIdle(bool idle);
+    void SetAnimationActive(bool active);
+    void BoostRefresh(int duration_ms);
+    void SetRenderingPaused(bool paused);
+    // 电量低时刷新率不高于待机时，动画也不再提高刷新率
+    void SetBatterySaver(bool on);
+    // 唤醒词检测跟不上时同样降低刷新率，把 CPU 让给音频
+    void SetCpuSaver(bool on);
+    // 音频处于关键窗口（断流、编码积压）时降低刷新率，频谱等非必要渲染推迟，音频优先于动画
+    void SetAudioCritical(bool on);
+    // 立即重绘并刷新整个屏幕，用于性能测试，没有 LVGL 显示时返回 false
+    bool RenderFullFrame();
     virtual void start() {}
     virtual void clearScreen() {}  // 清除FFT显示，默认为空实现
     virtual void stopFft() {}      // 停止FFT显示，默认为空实现
@@ -59,10 +94,26 @@ protected:
     const char* battery_icon_ = nullptr;
     const char* network_icon_ = nullptr;
     bool muted_ = false;
+    bool low_battery_ = false;
+    time_t clock_minute_ = -1;      // 状态栏上时钟显示的分钟，-1 表示显示的不是时钟
+    int status_bar_ticks_ = 0;
     std::string current_theme_name_;
 
     std::chrono::system_clock::time_point last_status_update_time_;
     esp_timer_handle_t notification_timer_ = nullptr;
+    esp_timer_handle_t refresh_boost_timer_ = nullptr;
+
+    bool idle_ = false;
+    bool power_save_ = false;
+    bool animation_active_ = false;
+    bool refresh_boosted_ = false;
+    bool rendering_paused_ = false;
+    bool refr_timer_paused_ = false;
+    bool battery_saver_ = false;
+    bool cpu_saver_ = false;
+    std::atomic<bool> audio_critical_{false};   // 频谱任务也会读
+
+    void UpdateRefreshPeriod();
 
     friend class DisplayLockGuard;
     virtual bool Lock(int timeout_ms = 0) = 0;
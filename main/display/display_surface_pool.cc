@@ -0,0 +1,72 @@
+#include "display_surface_pool.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+
+#define TAG "DisplaySurfacePool"
+
+static size_t AlignSurfaceSize(size_t size) {
+    return (size + DISPLAY_SURFACE_ALIGNMENT - 1) & ~(size_t)(DISPLAY_SURFACE_ALIGNMENT - 1);
+}
+
+static void* AllocateSurface(size_t size) {
+    return heap_caps_aligned_alloc(DISPLAY_SURFACE_ALIGNMENT, AlignSurfaceSize(size), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+}
+
+void DisplaySurfacePool::SetSurfaceSize(size_t size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size = AlignSurfaceSize(size);
+    if (size == surface_size_) {
+        return;
+    }
+    // 已经分配、未被借出的按新尺寸重新分配
+    for (auto& surface : surfaces_) {
+        if (!surface.leased && surface.data != nullptr) {
+            heap_caps_free(surface.data);
+            surface.data = nullptr;
+        }
+    }
+    surface_size_ = size;
+}
+
+void* DisplaySurfacePool::Lease(size_t size) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (size <= surface_size_) {
+            for (int i = 0; i < CONFIG_DISPLAY_SURFACE_POOL_SIZE && i < DISPLAY_SURFACE_MAX_COUNT; i++) {
+                auto& surface = surfaces_[i];
+                if (surface.leased) {
+                    continue;
+                }
+                if (surface.data == nullptr) {
+                    surface.data = AllocateSurface(surface_size_);
+                    if (surface.data == nullptr) {
+                        ESP_LOGE(TAG, "Failed to allocate surface of %u bytes", (unsigned)surface_size_);
+                        break;
+                    }
+                    ESP_LOGI(TAG, "Surface %d allocated, %u bytes", i, (unsigned)surface_size_);
+                }
+                surface.leased = true;
+                return surface.data;
+            }
+        }
+    }
+    ESP_LOGW(TAG, "No pooled surface for %u bytes, allocating a separate one", (unsigned)size);
+    return AllocateSurface(size);
+}
+
+void DisplaySurfacePool::Return(void* data) {
+    if (data == nullptr) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& surface : surfaces_) {
+            if (surface.data == data) {
+                surface.leased = false;
+                return;
+            }
+        }
+    }
+    heap_caps_free(data);
+}
@@ -0,0 +1,53 @@
+#ifndef DISPLAY_SURFACE_POOL_H
+#define DISPLAY_SURFACE_POOL_H
+
+#include <array>
+#include <cstddef>
+#include <mutex>
+
+#include "sdkconfig.h"
+
+// 满足 PPA 和 cache 写回的对齐要求
+#define DISPLAY_SURFACE_ALIGNMENT 128
+#define DISPLAY_SURFACE_MAX_COUNT 2
+
+/*
+ * Full screen RGB565 buffers in PSRAM shared by the spectrum canvas and the camera preview.
+ *
+ * Each surface is allocated the first time it is leased and kept afterwards, so switching between the
+ * spectrum and the preview reuses the same memory instead of freeing and allocating ~2 bytes per pixel
+ * of the panel each time, and a fragmented PSRAM cannot make the next switch fail. Requests bigger than
+ * a surface, or made while all CONFIG_DISPLAY_SURFACE_POOL_SIZE surfaces are leased, get a block of their
+ * own that is freed on Return().
+ */
+class DisplaySurfacePool {
+public:
+    static DisplaySurfacePool& GetInstance() {
+        static DisplaySurfacePool instance;
+        return instance;
+    }
+    DisplaySurfacePool(const DisplaySurfacePool&) = delete;
+    DisplaySurfacePool& operator=(const DisplaySurfacePool&) = delete;
+
+    // Called by the display with its frame size, before the first lease
+    void SetSurfaceSize(size_t size);
+    // Aligned to DISPLAY_SURFACE_ALIGNMENT, nullptr when out of memory
+    void* Lease(size_t size);
+    void Return(void* surface);
+
+    size_t surface_size() const { return surface_size_; }
+
+private:
+    struct Surface {
+        void* data = nullptr;
+        bool leased = false;
+    };
+
+    DisplaySurfacePool() = default;
+
+    std::mutex mutex_;
+    std::array<Surface, DISPLAY_SURFACE_MAX_COUNT> surfaces_;
+    size_t surface_size_ = 0;
+};
+
+#endif // DISPLAY_SURFACE_POOL_H
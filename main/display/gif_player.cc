@@ -0,0 +1,428 @@
+#include "gif_player.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+#include <cstdint>
+
+#define TAG "GifPlayer"
+
+#define GIF_PLAYER_TIMER_PERIOD_MS     10
+#define GIF_PLAYER_MIN_DELAY_MS        20
+// 落后时最多连续解码的帧数，超过后重新对齐时间
+#define GIF_PLAYER_MAX_CATCHUP_FRAMES  4
+#define GIF_LZW_MAX_CODES              4096
+
+static inline uint16_t ReadU16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+GifPlayer::GifPlayer(lv_obj_t* parent) {
+    image_ = lv_image_create(parent);
+    lv_obj_add_event_cb(image_, OnDelete, LV_EVENT_DELETE, this);
+    timer_ = lv_timer_create(OnTimer, GIF_PLAYER_TIMER_PERIOD_MS, this);
+    lv_timer_pause(timer_);
+}
+
+GifPlayer::~GifPlayer() {
+    if (timer_ != nullptr) {
+        lv_timer_delete(timer_);
+    }
+    if (image_ != nullptr) {
+        lv_obj_remove_event_cb_with_user_data(image_, OnDelete, this);
+        lv_obj_delete(image_);
+    }
+    heap_caps_free(canvas_);
+    heap_caps_free(lzw_prefix_);
+    heap_caps_free(lzw_suffix_);
+    heap_caps_free(lzw_stack_);
+}
+
+void GifPlayer::OnDelete(lv_event_t* e) {
+    auto self = static_cast<GifPlayer*>(lv_event_get_user_data(e));
+    self->image_ = nullptr;
+    self->Stop();
+}
+
+void GifPlayer::Stop() {
+    if (timer_ != nullptr) {
+        lv_timer_pause(timer_);
+    }
+    data_ = nullptr;
+}
+
+bool GifPlayer::EnsureBuffers(int width, int height) {
+    if (lzw_prefix_ == nullptr) {
+        lzw_prefix_ = (uint16_t*)heap_caps_malloc(GIF_LZW_MAX_CODES * sizeof(uint16_t), MALLOC_CAP_8BIT);
+        lzw_suffix_ = (uint8_t*)heap_caps_malloc(GIF_LZW_MAX_CODES, MALLOC_CAP_8BIT);
+        lzw_stack_ = (uint8_t*)heap_caps_malloc(GIF_LZW_MAX_CODES + 1, MALLOC_CAP_8BIT);
+        if (lzw_prefix_ == nullptr || lzw_suffix_ == nullptr || lzw_stack_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate LZW tables");
+            return false;
+        }
+    }
+
+    size_t size = (size_t)width * height * sizeof(uint16_t);
+    if (size > canvas_capacity_) {
+        if (image_ != nullptr) {
+            lv_image_cache_drop(&image_dsc_);
+        }
+        heap_caps_free(canvas_);
+        canvas_ = (uint16_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (canvas_ == nullptr) {
+            canvas_ = (uint16_t*)heap_caps_malloc(size, MALLOC_CAP_8BIT);
+        }
+        if (canvas_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate %dx%d frame buffer", width, height);
+            canvas_capacity_ = 0;
+            return false;
+        }
+        canvas_capacity_ = size;
+    }
+    return true;
+}
+
+void GifPlayer::LoadPalette(uint16_t* palette, const uint8_t* colors, int count) {
+    for (int i = 0; i < count; i++) {
+        palette[i] = lv_color_to_u16(lv_color_make(colors[i * 3], colors[i * 3 + 1], colors[i * 3 + 2]));
+    }
+    for (int i = count; i < 256; i++) {
+        palette[i] = 0;
+    }
+}
+
+void GifPlayer::SetSource(const lv_image_dsc_t* src) {
+    if (src == nullptr || image_ == nullptr) {
+        Stop();
+        return;
+    }
+    // 多个表情映射到同一个 GIF 时继续播放，不从头开始
+    if (src == source_ && data_ != nullptr) {
+        return;
+    }
+
+    // 部分资源（如 otto-emoji-gif-component）的 data_size 小于实际长度，与 lv_gif 一样以结尾符为准
+    const uint8_t* data = src->data;
+    size_t size = SIZE_MAX;
+    if (src->data_size < 13 || memcmp(data, "GIF", 3) != 0) {
+        ESP_LOGE(TAG, "Invalid GIF source");
+        Stop();
+        return;
+    }
+
+    int width = ReadU16(data + 6);
+    int height = ReadU16(data + 8);
+    uint8_t flags = data[10];
+    size_t pos = 13;
+    has_global_palette_ = flags & 0x80;
+    if (has_global_palette_) {
+        int count = 2 << (flags & 0x07);
+        if (pos + count * 3 > size) {
+            ESP_LOGE(TAG, "Truncated GIF palette");
+            Stop();
+            return;
+        }
+        LoadPalette(global_palette_, data + pos, count);
+        pos += count * 3;
+    }
+    if (width == 0 || height == 0 || !EnsureBuffers(width, height)) {
+        Stop();
+        return;
+    }
+
+    source_ = src;
+    data_ = data;
+    size_ = size;
+    pos_ = pos;
+    loop_pos_ = pos;
+    width_ = width;
+    height_ = height;
+    bg_color_ = has_global_palette_ ? global_palette_[data[11]] : 0;
+    for (int i = 0; i < width * height; i++) {
+        canvas_[i] = bg_color_;
+    }
+    delay_ms_ = 100;
+    disposal_ = 0;
+    transparent_index_ = -1;
+    last_disposal_ = 0;
+
+    if (!DecodeNextFrame()) {
+        ESP_LOGE(TAG, "Failed to decode the first frame");
+        Stop();
+        return;
+    }
+
+    image_dsc_.header.magic = LV_IMAGE_HEADER_MAGIC;
+    image_dsc_.header.cf = LV_COLOR_FORMAT_RGB565;
+    image_dsc_.header.flags = LV_IMAGE_FLAGS_MODIFIABLE;
+    image_dsc_.header.w = width;
+    image_dsc_.header.h = height;
+    image_dsc_.header.stride = width * sizeof(uint16_t);
+    image_dsc_.data_size = width * height * sizeof(uint16_t);
+    image_dsc_.data = (const uint8_t*)canvas_;
+    lv_image_cache_drop(&image_dsc_);
+    lv_image_set_src(image_, &image_dsc_);
+
+    last_frame_tick_ = lv_tick_get();
+    lv_timer_resume(timer_);
+}
+
+void GifPlayer::OnTimer(lv_timer_t* timer) {
+    auto self = static_cast<GifPlayer*>(lv_timer_get_user_data(timer));
+    if (self->data_ == nullptr || self->image_ == nullptr) {
+        return;
+    }
+
+    uint32_t elapsed = lv_tick_elaps(self->last_frame_tick_);
+    if (elapsed < self->frame_delay_ms_) {
+        return;
+    }
+
+    // 已经落后的帧只解码不刷新，只把最后一帧送到屏幕
+    int decoded = 0;
+    do {
+        elapsed -= self->frame_delay_ms_;
+        self->last_frame_tick_ += self->frame_delay_ms_;
+        if (!self->DecodeNextFrame()) {
+            ESP_LOGE(TAG, "GIF decode error, stopping");
+            self->Stop();
+            return;
+        }
+        decoded++;
+    } while (elapsed >= self->frame_delay_ms_ && decoded < GIF_PLAYER_MAX_CATCHUP_FRAMES);
+
+    if (elapsed >= self->frame_delay_ms_) {
+        self->last_frame_tick_ = lv_tick_get();
+    }
+
+    lv_image_cache_drop(&self->image_dsc_);
+    lv_obj_invalidate(self->image_);
+}
+
+bool GifPlayer::SkipSubBlocks() {
+    while (pos_ < size_) {
+        uint8_t length = data_[pos_++];
+        if (length == 0) {
+            return true;
+        }
+        pos_ += length;
+    }
+    return false;
+}
+
+bool GifPlayer::DecodeNextFrame() {
+    bool rewound = false;
+    while (true) {
+        if (pos_ >= size_ || data_[pos_] == 0x3B) {
+            // 到达结尾，从第一帧重新开始
+            if (rewound) {
+                return false;
+            }
+            rewound = true;
+            pos_ = loop_pos_;
+            continue;
+        }
+
+        uint8_t block = data_[pos_];
+        if (block == 0x21) {
+            if (pos_ + 2 > size_) {
+                return false;
+            }
+            uint8_t label = data_[pos_ + 1];
+            if (label == 0xF9 && pos_ + 8 <= size_) {
+                uint8_t flags = data_[pos_ + 3];
+                disposal_ = (flags >> 2) & 0x07;
+                transparent_index_ = (flags & 0x01) ? data_[pos_ + 6] : -1;
+                delay_ms_ = ReadU16(data_ + pos_ + 4) * 10;
+            }
+            pos_ += 2;
+            if (!SkipSubBlocks()) {
+                return false;
+            }
+        } else if (block == 0x2C) {
+            return DecodeImage();
+        } else {
+            return false;
+        }
+    }
+}
+
+bool GifPlayer::DecodeImage() {
+    if (pos_ + 11 > size_) {
+        return false;
+    }
+    const uint8_t* desc = data_ + pos_ + 1;
+    int left = ReadU16(desc);
+    int top = ReadU16(desc + 2);
+    int fw = ReadU16(desc + 4);
+    int fh = ReadU16(desc + 6);
+    uint8_t flags = desc[8];
+    bool interlaced = flags & 0x40;
+    pos_ += 10;
+
+    const uint16_t* palette = global_palette_;
+    if (flags & 0x80) {
+        int count = 2 << (flags & 0x07);
+        if (pos_ + count * 3 > size_) {
+            return false;
+        }
+        LoadPalette(local_palette_, data_ + pos_, count);
+        palette = local_palette_;
+        pos_ += count * 3;
+    } else if (!has_global_palette_) {
+        return false;
+    }
+
+    // 处置上一帧：2 恢复背景色，其余（包括 3）保留画布
+    if (last_disposal_ == 2) {
+        for (int y = last_area_.y1; y <= last_area_.y2; y++) {
+            for (int x = last_area_.x1; x <= last_area_.x2; x++) {
+                canvas_[y * width_ + x] = bg_color_;
+            }
+        }
+    }
+    last_disposal_ = disposal_;
+    last_area_.x1 = LV_MIN(left, width_ - 1);
+    last_area_.y1 = LV_MIN(top, height_ - 1);
+    last_area_.x2 = LV_MIN(left + fw, width_) - 1;
+    last_area_.y2 = LV_MIN(top + fh, height_) - 1;
+    frame_delay_ms_ = LV_MAX(delay_ms_, (uint32_t)GIF_PLAYER_MIN_DELAY_MS);
+    int transparent = transparent_index_;
+    disposal_ = 0;
+    transparent_index_ = -1;
+
+    if (pos_ >= size_) {
+        return false;
+    }
+    int min_code_size = data_[pos_++];
+    if (min_code_size < 2 || min_code_size > 8) {
+        return false;
+    }
+
+    // 按子块读取 LZW 码流
+    size_t block_left = 0;
+    bool blocks_ended = false;
+    uint32_t bits = 0;
+    int bit_count = 0;
+    auto read_code = [&](int code_size) -> int {
+        while (bit_count < code_size) {
+            if (block_left == 0) {
+                if (pos_ >= size_) {
+                    return -1;
+                }
+                block_left = data_[pos_++];
+                if (block_left == 0) {
+                    blocks_ended = true;
+                    return -1;
+                }
+            }
+            if (pos_ >= size_) {
+                return -1;
+            }
+            bits |= (uint32_t)data_[pos_++] << bit_count;
+            bit_count += 8;
+            block_left--;
+        }
+        int code = bits & ((1 << code_size) - 1);
+        bits >>= code_size;
+        bit_count -= code_size;
+        return code;
+    };
+
+    // 输出像素，处理隔行扫描和画布裁剪
+    static const uint8_t kPassStart[] = {0, 4, 2, 1};
+    static const uint8_t kPassStep[] = {8, 8, 4, 2};
+    int x = 0, y = 0, pass = 0;
+    auto put_pixel = [&](uint8_t index) {
+        if (y >= fh) {
+            return;
+        }
+        int cx = left + x;
+        int cy = top + y;
+        if (index != transparent && cx < width_ && cy < height_) {
+            canvas_[cy * width_ + cx] = palette[index];
+        }
+        if (++x < fw) {
+            return;
+        }
+        x = 0;
+        if (!interlaced) {
+            y++;
+            return;
+        }
+        y += kPassStep[pass];
+        while (y >= fh && pass < 3) {
+            pass++;
+            y = kPassStart[pass];
+        }
+    };
+
+    int clear_code = 1 << min_code_size;
+    int end_code = clear_code + 1;
+    int next_code = end_code + 1;
+    int code_size = min_code_size + 1;
+    int prev = -1;
+    uint8_t first = 0;
+    for (int i = 0; i < clear_code; i++) {
+        lzw_prefix_[i] = 0xFFFF;
+        lzw_suffix_[i] = i;
+    }
+
+    while (true) {
+        int code = read_code(code_size);
+        if (code < 0 || code == end_code) {
+            break;
+        }
+        if (code == clear_code) {
+            next_code = end_code + 1;
+            code_size = min_code_size + 1;
+            prev = -1;
+            continue;
+        }
+        if (prev < 0) {
+            if (code >= clear_code) {
+                return false;
+            }
+            first = code;
+            put_pixel(first);
+            prev = code;
+            continue;
+        }
+
+        int in_code = code;
+        int sp = 0;
+        if (code >= next_code) {
+            if (code > next_code) {
+                return false;
+            }
+            lzw_stack_[sp++] = first;
+            code = prev;
+        }
+        while (code >= clear_code) {
+            lzw_stack_[sp++] = lzw_suffix_[code];
+            code = lzw_prefix_[code];
+        }
+        first = lzw_suffix_[code];
+        lzw_stack_[sp++] = first;
+        while (sp > 0) {
+            put_pixel(lzw_stack_[--sp]);
+        }
+
+        if (next_code < GIF_LZW_MAX_CODES) {
+            lzw_prefix_[next_code] = prev;
+            lzw_suffix_[next_code] = first;
+            next_code++;
+            if (next_code == (1 << code_size) && code_size < 12) {
+                code_size++;
+            }
+        }
+        prev = in_code;
+    }
+
+    // 跳过图像数据剩余的子块
+    if (!blocks_ended) {
+        pos_ += block_left;
+        return SkipSubBlocks();
+    }
+    return true;
+}
@@ -0,0 +1,71 @@
+#ifndef GIF_PLAYER_H
+#define GIF_PLAYER_H
+
+#include <lvgl.h>
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Streaming GIF player for the emoji displays.
+ *
+ * lv_gif keeps a full ARGB8888 canvas plus an index frame per source and reallocates both on every
+ * lv_gif_set_src(). GifPlayer decodes one frame at a time straight from the flash-resident GIF into a
+ * single RGB565 frame buffer that is shown through an lv_image. Switching sources only rewinds the
+ * parser; the frame buffer and LZW tables are reused and only grow when a larger GIF shows up. When
+ * the LVGL task falls behind, the frames that are already late are decoded without being flushed.
+ * Must only be used from the LVGL task, i.e. under the display lock.
+ */
+class GifPlayer {
+public:
+    GifPlayer(lv_obj_t* parent);
+    ~GifPlayer();
+
+    lv_obj_t* obj() const { return image_; }
+    void SetSource(const lv_image_dsc_t* src);
+    void Stop();
+
+private:
+    static void OnTimer(lv_timer_t* timer);
+    static void OnDelete(lv_event_t* e);
+
+    bool EnsureBuffers(int width, int height);
+    bool DecodeNextFrame();
+    bool DecodeImage();
+    bool SkipSubBlocks();
+    void LoadPalette(uint16_t* palette, const uint8_t* colors, int count);
+
+    lv_obj_t* image_ = nullptr;
+    lv_timer_t* timer_ = nullptr;
+    lv_image_dsc_t image_dsc_ = {};
+
+    uint16_t* canvas_ = nullptr;
+    size_t canvas_capacity_ = 0;
+    uint16_t* lzw_prefix_ = nullptr;
+    uint8_t* lzw_suffix_ = nullptr;
+    uint8_t* lzw_stack_ = nullptr;
+
+    const lv_image_dsc_t* source_ = nullptr;
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    size_t pos_ = 0;
+    size_t loop_pos_ = 0;
+    int width_ = 0;
+    int height_ = 0;
+    uint16_t global_palette_[256];
+    uint16_t local_palette_[256];
+    bool has_global_palette_ = false;
+    uint16_t bg_color_ = 0;
+
+    // 图形控制扩展，作用于下一帧
+    uint32_t delay_ms_ = 100;
+    int disposal_ = 0;
+    int transparent_index_ = -1;
+    // 上一帧的处置方式和区域，绘制下一帧前执行
+    int last_disposal_ = 0;
+    lv_area_t last_area_ = {};
+    uint32_t frame_delay_ms_ = 100;
+    uint32_t last_frame_tick_ = 0;
+};
+
+#endif // GIF_PLAYER_H
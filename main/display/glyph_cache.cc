@@ -0,0 +1,226 @@
+#include "glyph_cache.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+#include <vector>
+
+#define TAG "GlyphCache"
+
+#define GLYPH_CACHE_MAX_ENTRIES   512
+#define GLYPH_CACHE_BUCKETS       256
+#define GLYPH_CACHE_BITMAP_BUDGET (128 * 1024)
+// CJK 部首及以后的字符不参与字距调整，缓存时可忽略下一个字符
+#define GLYPH_CACHE_CJK_START     0x2E80
+
+const lv_font_t* GlyphCache::Wrap(const lv_font_t* font) {
+    static std::vector<GlyphCache*> caches;
+
+    if (font == nullptr || font->get_glyph_dsc != lv_font_get_glyph_dsc_fmt_txt ||
+        font->get_glyph_bitmap != lv_font_get_bitmap_fmt_txt) {
+        return font;
+    }
+    if (heap_caps_get_total_size(MALLOC_CAP_SPIRAM) == 0) {
+        return font;
+    }
+    for (auto cache : caches) {
+        if (cache->base_ == font || &cache->font_ == font) {
+            return &cache->font_;
+        }
+    }
+
+    auto cache = new GlyphCache(font);
+    if (cache->entries_ == nullptr || cache->buckets_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate glyph cache");
+        heap_caps_free(cache->entries_);
+        heap_caps_free(cache->buckets_);
+        delete cache;
+        return font;
+    }
+    caches.push_back(cache);
+    ESP_LOGI(TAG, "Glyph cache enabled for font with line height %d", (int)font->line_height);
+    return &cache->font_;
+}
+
+GlyphCache::GlyphCache(const lv_font_t* base) : base_(base), font_(*base) {
+    font_.get_glyph_dsc = GetGlyphDsc;
+    font_.get_glyph_bitmap = GetGlyphBitmap;
+    font_.user_data = this;
+
+    auto fdsc = static_cast<const lv_font_fmt_txt_dsc_t*>(base->dsc);
+    kerning_ = base->kerning != LV_FONT_KERNING_NONE && fdsc->kern_dsc != nullptr;
+
+    entries_ = (Entry*)heap_caps_calloc(GLYPH_CACHE_MAX_ENTRIES, sizeof(Entry), MALLOC_CAP_SPIRAM);
+    buckets_ = (int16_t*)heap_caps_malloc(GLYPH_CACHE_BUCKETS * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+    if (buckets_ != nullptr) {
+        for (int i = 0; i < GLYPH_CACHE_BUCKETS; i++) {
+            buckets_[i] = -1;
+        }
+    }
+}
+
+bool GlyphCache::GetGlyphDsc(const lv_font_t* font, lv_font_glyph_dsc_t* dsc_out, uint32_t letter, uint32_t letter_next) {
+    auto self = static_cast<GlyphCache*>(font->user_data);
+    auto base = self->base_;
+
+    if (!self->IsCacheable(letter)) {
+        self->last_entry_ = -1;
+        return base->get_glyph_dsc(base, dsc_out, letter, letter_next);
+    }
+
+    int index = self->Find(letter);
+    if (index >= 0) {
+        self->Touch(index);
+        *dsc_out = self->entries_[index].dsc;
+        self->last_entry_ = index;
+        return true;
+    }
+
+    if (!base->get_glyph_dsc(base, dsc_out, letter, 0)) {
+        self->last_entry_ = -1;
+        return false;
+    }
+    self->last_entry_ = self->Insert(letter, *dsc_out);
+    return true;
+}
+
+const void* GlyphCache::GetGlyphBitmap(lv_font_glyph_dsc_t* g_dsc, lv_draw_buf_t* draw_buf) {
+    auto self = static_cast<GlyphCache*>(g_dsc->resolved_font->user_data);
+    lv_font_glyph_dsc_t base_dsc = *g_dsc;
+    base_dsc.resolved_font = self->base_;
+
+    // 绘制时总是先取描述再取位图，只需核对上一次命中的条目
+    int index = self->last_entry_;
+    if (index < 0 || self->entries_[index].dsc.gid.index != g_dsc->gid.index) {
+        return self->base_->get_glyph_bitmap(&base_dsc, draw_buf);
+    }
+
+    Entry& entry = self->entries_[index];
+    if (entry.bitmap.data != nullptr) {
+        return &entry.bitmap;
+    }
+
+    uint32_t stride = lv_draw_buf_width_to_stride(g_dsc->box_w, LV_COLOR_FORMAT_A8);
+    size_t size = stride * g_dsc->box_h;
+    if (size == 0 || !self->ReserveBitmap(size)) {
+        return self->base_->get_glyph_bitmap(&base_dsc, draw_buf);
+    }
+    void* data = heap_caps_aligned_alloc(LV_DRAW_BUF_ALIGN, size, MALLOC_CAP_SPIRAM);
+    if (data == nullptr) {
+        return self->base_->get_glyph_bitmap(&base_dsc, draw_buf);
+    }
+
+    lv_draw_buf_init(&entry.bitmap, g_dsc->box_w, g_dsc->box_h, LV_COLOR_FORMAT_A8, stride, data, size);
+    if (self->base_->get_glyph_bitmap(&base_dsc, &entry.bitmap) == nullptr) {
+        heap_caps_free(data);
+        memset(&entry.bitmap, 0, sizeof(entry.bitmap));
+        return nullptr;
+    }
+    self->bitmap_bytes_ += size;
+    return &entry.bitmap;
+}
+
+bool GlyphCache::IsCacheable(uint32_t letter) const {
+    return !kerning_ || letter >= GLYPH_CACHE_CJK_START;
+}
+
+int GlyphCache::Find(uint32_t letter) {
+    for (int i = buckets_[letter % GLYPH_CACHE_BUCKETS]; i >= 0; i = entries_[i].hash_next) {
+        if (entries_[i].letter == letter) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int GlyphCache::Insert(uint32_t letter, const lv_font_glyph_dsc_t& dsc) {
+    int index;
+    if (count_ < GLYPH_CACHE_MAX_ENTRIES) {
+        index = count_++;
+    } else {
+        index = lru_tail_;
+        Evict(index);
+    }
+
+    Entry& entry = entries_[index];
+    memset(&entry, 0, sizeof(entry));
+    entry.letter = letter;
+    entry.dsc = dsc;
+    entry.hash_next = buckets_[letter % GLYPH_CACHE_BUCKETS];
+    buckets_[letter % GLYPH_CACHE_BUCKETS] = index;
+
+    entry.lru_prev = -1;
+    entry.lru_next = lru_head_;
+    if (lru_head_ >= 0) {
+        entries_[lru_head_].lru_prev = index;
+    }
+    lru_head_ = index;
+    if (lru_tail_ < 0) {
+        lru_tail_ = index;
+    }
+    return index;
+}
+
+void GlyphCache::Touch(int index) {
+    if (index == lru_head_) {
+        return;
+    }
+    Unlink(index);
+    Entry& entry = entries_[index];
+    entry.lru_prev = -1;
+    entry.lru_next = lru_head_;
+    entries_[lru_head_].lru_prev = index;
+    lru_head_ = index;
+    if (lru_tail_ < 0) {
+        lru_tail_ = index;
+    }
+}
+
+void GlyphCache::Unlink(int index) {
+    Entry& entry = entries_[index];
+    if (entry.lru_prev >= 0) {
+        entries_[entry.lru_prev].lru_next = entry.lru_next;
+    } else {
+        lru_head_ = entry.lru_next;
+    }
+    if (entry.lru_next >= 0) {
+        entries_[entry.lru_next].lru_prev = entry.lru_prev;
+    } else {
+        lru_tail_ = entry.lru_prev;
+    }
+}
+
+void GlyphCache::Evict(int index) {
+    Entry& entry = entries_[index];
+    DropBitmap(entry);
+    Unlink(index);
+
+    int16_t* link = &buckets_[entry.letter % GLYPH_CACHE_BUCKETS];
+    while (*link >= 0 && *link != index) {
+        link = &entries_[*link].hash_next;
+    }
+    if (*link == index) {
+        *link = entry.hash_next;
+    }
+}
+
+void GlyphCache::DropBitmap(Entry& entry) {
+    if (entry.bitmap.data != nullptr) {
+        bitmap_bytes_ -= entry.bitmap.data_size;
+        heap_caps_free(entry.bitmap.unaligned_data);
+        entry.bitmap.data = nullptr;
+    }
+}
+
+bool GlyphCache::ReserveBitmap(size_t bytes) {
+    if (bytes > GLYPH_CACHE_BITMAP_BUDGET) {
+        return false;
+    }
+    // 从最久未用的条目开始释放位图，描述信息保留
+    for (int i = lru_tail_; i >= 0 && bitmap_bytes_ + bytes > GLYPH_CACHE_BITMAP_BUDGET; i = entries_[i].lru_prev) {
+        if (i != last_entry_) {
+            DropBitmap(entries_[i]);
+        }
+    }
+    return bitmap_bytes_ + bytes <= GLYPH_CACHE_BITMAP_BUDGET;
+}
@@ -0,0 +1,58 @@
+#ifndef GLYPH_CACHE_H
+#define GLYPH_CACHE_H
+
+#include <lvgl.h>
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * PSRAM glyph cache for lv_font_fmt_txt bitmap fonts (xiaozhi-fonts).
+ *
+ * Wrap() returns a copy of the font whose callbacks memoize the glyph descriptor lookup (a scan over
+ * the cmaps plus a binary search per character, done several times per character while a label lays
+ * out its text) and the unpacked A8 bitmap, with LRU eviction per font. Fonts of other types, such as
+ * FreeType which has its own cache, are returned unchanged, as is every font when there is no PSRAM.
+ * Must only be used from the LVGL task, i.e. under the display lock.
+ */
+class GlyphCache {
+public:
+    static const lv_font_t* Wrap(const lv_font_t* font);
+
+private:
+    struct Entry {
+        uint32_t letter;
+        int16_t lru_prev;
+        int16_t lru_next;
+        int16_t hash_next;
+        lv_font_glyph_dsc_t dsc;
+        lv_draw_buf_t bitmap;
+    };
+
+    GlyphCache(const lv_font_t* base);
+
+    static bool GetGlyphDsc(const lv_font_t* font, lv_font_glyph_dsc_t* dsc_out, uint32_t letter, uint32_t letter_next);
+    static const void* GetGlyphBitmap(lv_font_glyph_dsc_t* g_dsc, lv_draw_buf_t* draw_buf);
+
+    bool IsCacheable(uint32_t letter) const;
+    int Find(uint32_t letter);
+    int Insert(uint32_t letter, const lv_font_glyph_dsc_t& dsc);
+    void Touch(int index);
+    void Unlink(int index);
+    void Evict(int index);
+    void DropBitmap(Entry& entry);
+    bool ReserveBitmap(size_t bytes);
+
+    const lv_font_t* base_;
+    lv_font_t font_;
+    bool kerning_ = false;
+    Entry* entries_ = nullptr;
+    int16_t* buckets_ = nullptr;
+    int count_ = 0;
+    int lru_head_ = -1;
+    int lru_tail_ = -1;
+    int last_entry_ = -1;
+    size_t bitmap_bytes_ = 0;
+};
+
+#endif // GLYPH_CACHE_H
@@ -16,6 +16,20 @@
 #include "settings.h"
 
 #include "board.h"
+#include "stream_player.h"
+#include "glyph_cache.h"
+#include "display_surface_pool.h"
+#include "task_stack.h"
+#include "assets.h"
+
+#include <dl_rfft.h>
+#include <soc/soc_caps.h>
+#if SOC_MIPI_DSI_SUPPORTED
+#include <esp_lcd_mipi_dsi.h>
+#endif
+#if CONFIG_USE_PPA_DISPLAY_ACCEL
+#include <esp_cache.h>
+#endif
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -23,9 +37,32 @@
 
 #define TAG "LcdDisplay"
 
+// 聊天消息滚动动画期间的高刷新时长
+#define SCROLL_REFRESH_BOOST_MS 500
+
 #define FFT_SIZE 512
-static int current_heights[40] = {0};
-static float avg_power_spectrum[FFT_SIZE/2]={-25.0f};
+static int current_heights[SPECTRUM_MAX_BARS] = {0};
+// 画布上已画出的频谱条：电平块数和峰值块所在行（-1 表示没有），增量重绘时与新状态比较
+static int drawn_blocks[SPECTRUM_MAX_BARS] = {0};
+static int drawn_peak_y[SPECTRUM_MAX_BARS] = {0};
+
+// 频谱条覆盖的频率范围，对数划分
+#define SPECTRUM_MIN_FREQ 50.0f
+#define SPECTRUM_MAX_FREQ 16000.0f
+// 显示的动态范围，上端跟随最响的频段，每次刷新最多下降 SPECTRUM_REF_RELEASE_DB，安静时不低于下限以免放大底噪
+#define SPECTRUM_RANGE_DB 36.0f
+#define SPECTRUM_REF_RELEASE_DB 0.5f
+#define SPECTRUM_REF_FLOOR_DB -45.0f
+// 条高上升和回落的平滑系数，Q8
+#define SPECTRUM_ATTACK_Q8 192
+#define SPECTRUM_DECAY_Q8 40
+
+// 有 PSRAM 时 FFT 的状态都放在 PSRAM，不占内部 RAM
+#if CONFIG_SPIRAM
+#define FFT_MALLOC_CAPS (MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+#else
+#define FFT_MALLOC_CAPS MALLOC_CAP_8BIT
+#endif
 
 #define COLOR_BLACK   0x0000
 #define COLOR_RED     0xF800
@@ -92,6 +129,8 @@ LcdDisplay::LcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_
     : panel_io_(panel_io), panel_(panel), fonts_(fonts) {
     width_ = width;
     height_ = height;
+    fonts_.text_font = GlyphCache::Wrap(fonts_.text_font);
+    DisplaySurfacePool::GetInstance().SetSurfaceSize(width_ * height_ * sizeof(uint16_t));
 
     // Load theme from settings
     Settings settings("display", false);
@@ -105,9 +144,54 @@ LcdDisplay::LcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_
     }
 }
 
+// 给 WiFi、I2S 等留下的内部 DMA 内存
+#define DRAW_BUFFER_INTERNAL_RESERVE (64 * 1024)
+
+struct DrawBufferPlan {
+    uint32_t lines;
+    bool double_buffer;
+    bool spiram;
+};
+
+// 选择 LVGL 绘制缓冲区：优先双缓冲，渲染下一条时上一条还在传输；内部 DMA 内存不够时减小条带高度，
+// PSRAM 支持 DMA 时放到 PSRAM，否则退回单缓冲
+static DrawBufferPlan ChooseDrawBuffers(int width, int height, int max_lines, int min_lines, bool spiram_dma) {
+    size_t line_bytes = width * sizeof(uint16_t);
+    size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    size_t free_size = heap_caps_get_free_size(MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    size_t available = free_size > DRAW_BUFFER_INTERNAL_RESERVE ? free_size - DRAW_BUFFER_INTERNAL_RESERVE : 0;
+    max_lines = std::min(max_lines, height);
+    min_lines = std::min(min_lines, height);
+
+    const DrawBufferPlan candidates[] = {
+        {(uint32_t)max_lines, true, false},
+        {(uint32_t)min_lines, true, false},
+    };
+    DrawBufferPlan plan = {(uint32_t)min_lines, false, false};
+    for (const auto& candidate : candidates) {
+        size_t bytes = candidate.lines * line_bytes;
+        if (bytes <= largest && bytes * 2 <= available) {
+            plan = candidate;
+            break;
+        }
+    }
+    if (!plan.double_buffer && spiram_dma) {
+        plan = {(uint32_t)max_lines, true, true};
+    }
+    ESP_LOGI(TAG, "LVGL draw buffer: %lu lines x%d in %s (internal DMA free %u, largest %u)",
+        plan.lines, plan.double_buffer ? 2 : 1, plan.spiram ? "PSRAM" : "internal RAM", free_size, largest);
+    return plan;
+}
+
 SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
                            int width, int height, int offset_x, int offset_y, bool mirror_x, bool mirror_y, bool swap_xy,
                            DisplayFonts fonts)
+    : SpiLcdDisplay(panel_io, panel, width, height, offset_x, offset_y, mirror_x, mirror_y, swap_xy, fonts, 40, 20, 1) {
+}
+
+SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
+                           int width, int height, int offset_x, int offset_y, bool mirror_x, bool mirror_y, bool swap_xy,
+                           DisplayFonts fonts, int max_lines, int min_lines, int line_align)
     : LcdDisplay(panel_io, panel, fonts, width, height) {
 
     // draw white
@@ -127,15 +211,21 @@ SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
     lvgl_port_cfg_t port_cfg = ESP_LVGL_PORT_INIT_CONFIG();
     port_cfg.task_priority = 1;
     port_cfg.timer_period_ms = 50;
+    port_cfg.task_affinity = DISPLAY_TASK_AFFINITY;
     lvgl_port_init(&port_cfg);
 
     ESP_LOGI(TAG, "Adding LCD display");
+    // SPI 传输期间 LVGL 可以渲染另一块缓冲区，不必每个条带都等 SPI
+    DrawBufferPlan plan = ChooseDrawBuffers(width_, height_, max_lines, min_lines, false);
+    if (line_align > 1 && plan.lines > (uint32_t)line_align) {
+        plan.lines -= plan.lines % line_align;
+    }
     const lvgl_port_display_cfg_t display_cfg = {
         .io_handle = panel_io_,
         .panel_handle = panel_,
         .control_handle = nullptr,
-        .buffer_size = static_cast<uint32_t>(width_ * 20),
-        .double_buffer = false,
+        .buffer_size = static_cast<uint32_t>(width_ * plan.lines),
+        .double_buffer = plan.double_buffer,
         .trans_size = 0,
         .hres = static_cast<uint32_t>(width_),
         .vres = static_cast<uint32_t>(height_),
@@ -166,28 +256,104 @@ SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
         lv_display_set_offset(display_, offset_x, offset_y);
     }
 
-    // 初始化 FFT 相关内存
-    fft_real = (float*)heap_caps_malloc(FFT_SIZE * sizeof(float), MALLOC_CAP_SPIRAM);
-    fft_imag = (float*)heap_caps_malloc(FFT_SIZE * sizeof(float), MALLOC_CAP_SPIRAM);
-    hanning_window_float = (float*)heap_caps_malloc(FFT_SIZE * sizeof(float), MALLOC_CAP_SPIRAM);
-    
-    // 创建窗函数
-    for (int i = 0; i < FFT_SIZE; i++) {
-        hanning_window_float[i] = 0.5 * (1.0 - cos(2.0 * M_PI * i / (FFT_SIZE - 1)));
+    SetupUI();
+}
+
+// QSPI 80MHz 四线一帧约 10ms，条带越高每帧的传输和 LVGL flush 次数越少
+#define QSPI_DRAW_BUFFER_MAX_LINES 80
+#define QSPI_DRAW_BUFFER_MIN_LINES 20
+// 60Hz 面板一个 TE 周期约 16ms，没等到就直接发送
+#define QSPI_TE_TIMEOUT_MS 20
+
+QspiLcdDisplay::QspiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
+                           int width, int height, int offset_x, int offset_y, bool mirror_x, bool mirror_y, bool swap_xy,
+                           DisplayFonts fonts, QspiPanelCaps caps)
+    : SpiLcdDisplay(panel_io, panel, width, height, offset_x, offset_y, mirror_x, mirror_y, swap_xy, fonts,
+                    QSPI_DRAW_BUFFER_MAX_LINES, QSPI_DRAW_BUFFER_MIN_LINES, std::max<int>(caps.y_align, 1)),
+      caps_(caps) {
+    if (display_ == nullptr) {
+        return;
     }
-    
-    if(audio_data==nullptr){
-        audio_data=(int16_t*)heap_caps_malloc(sizeof(int16_t)*1152, MALLOC_CAP_SPIRAM);
-        memset(audio_data,0,sizeof(int16_t)*1152);
+    caps_.x_align = std::max<uint8_t>(caps_.x_align, 1);
+    caps_.y_align = std::max<uint8_t>(caps_.y_align, 1);
+
+    DisplayLockGuard lock(this);
+    if (caps_.x_align > 1 || caps_.y_align > 1) {
+        lv_display_add_event_cb(display_, RounderEventCallback, LV_EVENT_INVALIDATE_AREA, this);
     }
-    if(frame_audio_data==nullptr){
-        frame_audio_data=(int16_t*)heap_caps_malloc(sizeof(int16_t)*1152, MALLOC_CAP_SPIRAM);
-        memset(frame_audio_data,0,sizeof(int16_t)*1152);
+    if (caps_.te_gpio != GPIO_NUM_NC) {
+        InitializeTe();
     }
-    
-    ESP_LOGI(TAG,"Initialize fft_input, audio_data, frame_audio_data, spectrum_data");
+}
 
-    SetupUI();
+QspiLcdDisplay::~QspiLcdDisplay() {
+    if (te_semaphore_ != nullptr) {
+        gpio_isr_handler_remove(caps_.te_gpio);
+        vSemaphoreDelete(te_semaphore_);
+    }
+}
+
+void QspiLcdDisplay::RounderEventCallback(lv_event_t* e) {
+    auto self = (QspiLcdDisplay*)lv_event_get_user_data(e);
+    auto area = (lv_area_t*)lv_event_get_param(e);
+    int x_align = self->caps_.x_align;
+    int y_align = self->caps_.y_align;
+    // 起点向下、终点向上取整到对齐的倍数
+    area->x1 = area->x1 / x_align * x_align;
+    area->x2 = (area->x2 / x_align + 1) * x_align - 1;
+    area->y1 = area->y1 / y_align * y_align;
+    area->y2 = (area->y2 / y_align + 1) * y_align - 1;
+}
+
+void QspiLcdDisplay::InitializeTe() {
+    te_semaphore_ = xSemaphoreCreateBinary();
+    gpio_config_t io_conf = {
+        .pin_bit_mask = 1ULL << caps_.te_gpio,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_POSEDGE,
+    };
+    ESP_ERROR_CHECK(gpio_config(&io_conf));
+    // The ISR service may already be installed by another driver
+    esp_err_t err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "Failed to install GPIO ISR service: %s", esp_err_to_name(err));
+        vSemaphoreDelete(te_semaphore_);
+        te_semaphore_ = nullptr;
+        return;
+    }
+    ESP_ERROR_CHECK(gpio_isr_handler_add(caps_.te_gpio, TeIsrHandler, this));
+
+    lv_display_add_event_cb(display_, RenderStartEventCallback, LV_EVENT_RENDER_START, this);
+    lv_display_add_event_cb(display_, FlushStartEventCallback, LV_EVENT_FLUSH_START, this);
+    ESP_LOGI(TAG, "Flush synchronized to TE on GPIO %d", caps_.te_gpio);
+}
+
+void IRAM_ATTR QspiLcdDisplay::TeIsrHandler(void* arg) {
+    auto self = (QspiLcdDisplay*)arg;
+    BaseType_t woken = pdFALSE;
+    xSemaphoreGiveFromISR(self->te_semaphore_, &woken);
+    if (woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+void QspiLcdDisplay::RenderStartEventCallback(lv_event_t* e) {
+    auto self = (QspiLcdDisplay*)lv_event_get_user_data(e);
+    self->wait_te_ = true;
+}
+
+// 只等每帧的第一个条带，之后的条带跟在扫描线后面
+void QspiLcdDisplay::FlushStartEventCallback(lv_event_t* e) {
+    auto self = (QspiLcdDisplay*)lv_event_get_user_data(e);
+    if (!self->wait_te_) {
+        return;
+    }
+    self->wait_te_ = false;
+    // 丢掉渲染期间的旧信号，从下一次消隐开始发送
+    xSemaphoreTake(self->te_semaphore_, 0);
+    xSemaphoreTake(self->te_semaphore_, pdMS_TO_TICKS(QSPI_TE_TIMEOUT_MS));
 }
 
 // RGB LCD实现
@@ -210,6 +376,7 @@ RgbLcdDisplay::RgbLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
     lvgl_port_cfg_t port_cfg = ESP_LVGL_PORT_INIT_CONFIG();
     port_cfg.task_priority = 1;
     port_cfg.timer_period_ms = 50;
+    port_cfg.task_affinity = DISPLAY_TASK_AFFINITY;
     lvgl_port_init(&port_cfg);
 
     ESP_LOGI(TAG, "Adding LCD display");
@@ -268,15 +435,27 @@ MipiLcdDisplay::MipiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel
 
     ESP_LOGI(TAG, "Initialize LVGL port");
     lvgl_port_cfg_t port_cfg = ESP_LVGL_PORT_INIT_CONFIG();
+    port_cfg.task_affinity = DISPLAY_TASK_AFFINITY;
     lvgl_port_init(&port_cfg);
 
     ESP_LOGI(TAG, "Adding LCD display");
+    // 面板有两个帧缓冲时 LVGL 直接画进 PSRAM 帧缓冲并在 vsync 切换，否则用条带缓冲
+    bool avoid_tearing = false;
+#if SOC_MIPI_DSI_SUPPORTED
+    void* fb0 = nullptr;
+    void* fb1 = nullptr;
+    avoid_tearing = esp_lcd_dpi_panel_get_frame_buffer(panel, 2, &fb0, &fb1) == ESP_OK;
+#endif
+    DrawBufferPlan plan = {static_cast<uint32_t>(height_), false, false};
+    if (!avoid_tearing) {
+        plan = ChooseDrawBuffers(width_, height_, 100, 50, true);
+    }
     const lvgl_port_display_cfg_t disp_cfg = {
             .io_handle = panel_io,
             .panel_handle = panel,
             .control_handle = nullptr,
-            .buffer_size = static_cast<uint32_t>(width_ * 50),
-            .double_buffer = false,
+            .buffer_size = static_cast<uint32_t>(width_ * plan.lines),
+            .double_buffer = plan.double_buffer,
             .hres = static_cast<uint32_t>(width_),
             .vres = static_cast<uint32_t>(height_),
             .monochrome = false,
@@ -288,14 +467,15 @@ MipiLcdDisplay::MipiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel
         },
         .flags = {
             .buff_dma = true,
-            .buff_spiram =false,
+            .buff_spiram = plan.spiram,
             .sw_rotate = false,
+            .direct_mode = avoid_tearing,
         },
     };
 
     const lvgl_port_display_dsi_cfg_t dpi_cfg = {
         .flags = {
-            .avoid_tearing = false,
+            .avoid_tearing = avoid_tearing,
         }
     };
     display_ = lvgl_port_add_disp_dsi(&disp_cfg, &dpi_cfg);
@@ -325,10 +505,11 @@ LcdDisplay::~LcdDisplay() {
         }
         
         if (fft_task_handle != nullptr) {
-            vTaskDelete(fft_task_handle);
+            TaskStacks::GetInstance().Delete(fft_task_handle);
             fft_task_handle = nullptr;
         }
     }
+    ReleaseFft();
     
     // 然后再清理 LVGL 对象
     if (content_ != nullptr) {
@@ -346,6 +527,13 @@ LcdDisplay::~LcdDisplay() {
     if (display_ != nullptr) {
         lv_display_delete(display_);
     }
+    if (theme_styles_initialized_) {
+        auto& styles = theme_styles_;
+        for (auto style : {&styles.screen, &styles.container, &styles.content, &styles.text, &styles.user_bubble,
+                &styles.assistant_bubble, &styles.system_bubble, &styles.low_battery}) {
+            lv_style_reset(style);
+        }
+    }
 
     if (panel_ != nullptr) {
         esp_lcd_panel_del(panel_);
@@ -353,6 +541,11 @@ LcdDisplay::~LcdDisplay() {
     if (panel_io_ != nullptr) {
         esp_lcd_panel_io_del(panel_io_);
     }
+#if CONFIG_USE_PPA_DISPLAY_ACCEL
+    if (ppa_fill_client_ != nullptr) {
+        ppa_unregister_client(ppa_fill_client_);
+    }
+#endif
 }
 
 bool LcdDisplay::Lock(int timeout_ms) {
@@ -363,14 +556,25 @@ void LcdDisplay::Unlock() {
     lvgl_port_unlock();
 }
 
+// 资源分区里的字体优先于编进固件的字体，binfont 依赖 LVGL 的内存和文件系统，要在 LVGL 初始化之后加载
+void LcdDisplay::LoadAssetFonts() {
+    auto& assets = Assets::GetInstance();
+    auto text_font = assets.GetFont("text_font", nullptr);
+    if (text_font != nullptr) {
+        fonts_.text_font = GlyphCache::Wrap(text_font);
+    }
+    fonts_.icon_font = assets.GetFont("icon_font", fonts_.icon_font);
+}
+
 #if CONFIG_USE_WECHAT_MESSAGE_STYLE
 void LcdDisplay::SetupUI() {
     DisplayLockGuard lock(this);
+    LoadAssetFonts();
+    UpdateThemeStyles();
 
     auto screen = lv_screen_active();
     lv_obj_set_style_text_font(screen, fonts_.text_font, 0);
-    lv_obj_set_style_text_color(screen, current_theme_.text, 0);
-    lv_obj_set_style_bg_color(screen, current_theme_.background, 0);
+    lv_obj_add_style(screen, &theme_styles_.screen, 0);
 
     /* Container */
     container_ = lv_obj_create(screen);
@@ -379,15 +583,13 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_style_pad_all(container_, 0, 0);
     lv_obj_set_style_border_width(container_, 0, 0);
     lv_obj_set_style_pad_row(container_, 0, 0);
-    lv_obj_set_style_bg_color(container_, current_theme_.background, 0);
-    lv_obj_set_style_border_color(container_, current_theme_.border, 0);
+    lv_obj_add_style(container_, &theme_styles_.container, 0);
 
     /* Status bar */
     status_bar_ = lv_obj_create(container_);
     lv_obj_set_size(status_bar_, LV_HOR_RES, LV_SIZE_CONTENT);
     lv_obj_set_style_radius(status_bar_, 0, 0);
-    lv_obj_set_style_bg_color(status_bar_, current_theme_.background, 0);
-    lv_obj_set_style_text_color(status_bar_, current_theme_.text, 0);
+    lv_obj_add_style(status_bar_, &theme_styles_.screen, 0);
     
     /* Content - Chat area */
     content_ = lv_obj_create(container_);
@@ -395,8 +597,7 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_width(content_, LV_HOR_RES);
     lv_obj_set_flex_grow(content_, 1);
     lv_obj_set_style_pad_all(content_, 10, 0);
-    lv_obj_set_style_bg_color(content_, current_theme_.chat_background, 0); // Background for chat area
-    lv_obj_set_style_border_color(content_, current_theme_.border, 0); // Border color for chat area
+    lv_obj_add_style(content_, &theme_styles_.content, 0); // Background and border of the chat area
 
     // Enable scrolling for chat content
     lv_obj_set_scrollbar_mode(content_, LV_SCROLLBAR_MODE_OFF);
@@ -426,14 +627,14 @@ void LcdDisplay::SetupUI() {
     // 创建emotion_label_在状态栏最左侧
     emotion_label_ = lv_label_create(status_bar_);
     lv_obj_set_style_text_font(emotion_label_, &font_awesome_30_4, 0);
-    lv_obj_set_style_text_color(emotion_label_, current_theme_.text, 0);
+    lv_obj_add_style(emotion_label_, &theme_styles_.text, 0);
     lv_label_set_text(emotion_label_, FONT_AWESOME_AI_CHIP);
     lv_obj_set_style_margin_right(emotion_label_, 5, 0); // 添加右边距，与后面的元素分隔
 
     notification_label_ = lv_label_create(status_bar_);
     lv_obj_set_flex_grow(notification_label_, 1);
     lv_obj_set_style_text_align(notification_label_, LV_TEXT_ALIGN_CENTER, 0);
-    lv_obj_set_style_text_color(notification_label_, current_theme_.text, 0);
+    lv_obj_add_style(notification_label_, &theme_styles_.text, 0);
     lv_label_set_text(notification_label_, "");
     lv_obj_add_flag(notification_label_, LV_OBJ_FLAG_HIDDEN);
 
@@ -441,31 +642,31 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_flex_grow(status_label_, 1);
     lv_label_set_long_mode(status_label_, LV_LABEL_LONG_SCROLL_CIRCULAR);
     lv_obj_set_style_text_align(status_label_, LV_TEXT_ALIGN_CENTER, 0);
-    lv_obj_set_style_text_color(status_label_, current_theme_.text, 0);
+    lv_obj_add_style(status_label_, &theme_styles_.text, 0);
     lv_label_set_text(status_label_, Lang::Strings::INITIALIZING);
     
     mute_label_ = lv_label_create(status_bar_);
     lv_label_set_text(mute_label_, "");
     lv_obj_set_style_text_font(mute_label_, fonts_.icon_font, 0);
-    lv_obj_set_style_text_color(mute_label_, current_theme_.text, 0);
+    lv_obj_add_style(mute_label_, &theme_styles_.text, 0);
 
     network_label_ = lv_label_create(status_bar_);
     lv_label_set_text(network_label_, "");
     lv_obj_set_style_text_font(network_label_, fonts_.icon_font, 0);
-    lv_obj_set_style_text_color(network_label_, current_theme_.text, 0);
+    lv_obj_add_style(network_label_, &theme_styles_.text, 0);
     lv_obj_set_style_margin_left(network_label_, 5, 0); // 添加左边距，与前面的元素分隔
 
     battery_label_ = lv_label_create(status_bar_);
     lv_label_set_text(battery_label_, "");
     lv_obj_set_style_text_font(battery_label_, fonts_.icon_font, 0);
-    lv_obj_set_style_text_color(battery_label_, current_theme_.text, 0);
+    lv_obj_add_style(battery_label_, &theme_styles_.text, 0);
     lv_obj_set_style_margin_left(battery_label_, 5, 0); // 添加左边距，与前面的元素分隔
 
     low_battery_popup_ = lv_obj_create(screen);
     lv_obj_set_scrollbar_mode(low_battery_popup_, LV_SCROLLBAR_MODE_OFF);
     lv_obj_set_size(low_battery_popup_, LV_HOR_RES * 0.9, fonts_.text_font->line_height * 2);
     lv_obj_align(low_battery_popup_, LV_ALIGN_BOTTOM_MID, 0, 0);
-    lv_obj_set_style_bg_color(low_battery_popup_, current_theme_.low_battery, 0);
+    lv_obj_add_style(low_battery_popup_, &theme_styles_.low_battery, 0);
     lv_obj_set_style_radius(low_battery_popup_, 10, 0);
     low_battery_label_ = lv_label_create(low_battery_popup_);
     lv_label_set_text(low_battery_label_, Lang::Strings::BATTERY_NEED_CHARGE);
@@ -478,6 +679,48 @@ void LcdDisplay::SetupUI() {
 #else
 #define  MAX_MESSAGES 20
 #endif
+// 消息容器的标记，区别于图片气泡等其他子对象
+static const char* const kMessageContainer = "message";
+
+// 创建一条消息：全宽透明容器 -> 气泡 -> 文本，内容在 SetChatMessage 中填写
+lv_obj_t* LcdDisplay::CreateMessageContainer() {
+    lv_obj_t* container = lv_obj_create(content_);
+    lv_obj_set_width(container, LV_HOR_RES);
+    lv_obj_set_height(container, LV_SIZE_CONTENT);
+    lv_obj_set_scrollbar_mode(container, LV_SCROLLBAR_MODE_OFF);
+    lv_obj_set_user_data(container, (void*)kMessageContainer);
+
+    // Make container transparent and borderless
+    lv_obj_set_style_bg_opa(container, LV_OPA_TRANSP, 0);
+    lv_obj_set_style_border_width(container, 0, 0);
+    lv_obj_set_style_pad_all(container, 0, 0);
+
+    lv_obj_t* msg_bubble = lv_obj_create(container);
+    lv_obj_set_style_radius(msg_bubble, 8, 0);
+    lv_obj_set_scrollbar_mode(msg_bubble, LV_SCROLLBAR_MODE_OFF);
+    lv_obj_set_style_border_width(msg_bubble, 1, 0);
+    lv_obj_set_style_pad_all(msg_bubble, 8, 0);
+    lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
+    lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
+    // Don't grow
+    lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
+
+    lv_obj_t* msg_text = lv_label_create(msg_bubble);
+    lv_label_set_long_mode(msg_text, LV_LABEL_LONG_WRAP);
+    lv_obj_set_style_text_font(msg_text, fonts_.text_font, 0);
+    return container;
+}
+
+// 循环使用的气泡可能换了角色，先去掉原来的气泡样式
+void LcdDisplay::SetBubbleStyle(lv_obj_t* bubble, lv_style_t* style) {
+    for (auto old_style : {&theme_styles_.user_bubble, &theme_styles_.assistant_bubble, &theme_styles_.system_bubble}) {
+        if (old_style != style) {
+            lv_obj_remove_style(bubble, old_style, 0);
+        }
+    }
+    lv_obj_add_style(bubble, style, 0);
+}
+
 void LcdDisplay::SetChatMessage(const char* role, const char* content) {
     DisplayLockGuard lock(this);
     if (content_ == nullptr) {
@@ -487,49 +730,37 @@ void LcdDisplay::SetChatMessage(const char* role, const char* content) {
     //避免出现空的消息框
     if(strlen(content) == 0) return;
     
-    // 检查消息数量是否超过限制
+    // 消息对象循环使用：达到上限后把最早的一条移到末尾改写，不再反复删除和创建 LVGL 对象
+    lv_obj_t* container = nullptr;
     uint32_t child_count = lv_obj_get_child_cnt(content_);
-    if (child_count >= MAX_MESSAGES) {
-        // 删除最早的消息（第一个子对象）
-        lv_obj_t* first_child = lv_obj_get_child(content_, 0);
-        lv_obj_t* last_child = lv_obj_get_child(content_, child_count - 1);
-        if (first_child != nullptr) {
-            lv_obj_del(first_child);
-        }
-        // Scroll to the last message immediately
-        if (last_child != nullptr) {
-            lv_obj_scroll_to_view_recursive(last_child, LV_ANIM_OFF);
-        }
-    }
     
-    // 折叠系统消息（如果是系统消息，检查最后一个消息是否也是系统消息）
+    // 折叠系统消息：最后一条也是系统消息时直接改写它
     if (strcmp(role, "system") == 0 && child_count > 0) {
-        // 获取最后一个消息容器
         lv_obj_t* last_container = lv_obj_get_child(content_, child_count - 1);
-        if (last_container != nullptr && lv_obj_get_child_cnt(last_container) > 0) {
-            // 获取容器内的气泡
-            lv_obj_t* last_bubble = lv_obj_get_child(last_container, 0);
-            if (last_bubble != nullptr) {
-                // 检查气泡类型是否为系统消息
-                void* bubble_type_ptr = lv_obj_get_user_data(last_bubble);
-                if (bubble_type_ptr != nullptr && strcmp((const char*)bubble_type_ptr, "system") == 0) {
-                    // 如果最后一个消息也是系统消息，则删除它
-                    lv_obj_del(last_container);
-                }
+        if (lv_obj_get_user_data(last_container) == kMessageContainer) {
+            void* bubble_type_ptr = lv_obj_get_user_data(lv_obj_get_child(last_container, 0));
+            if (bubble_type_ptr != nullptr && strcmp((const char*)bubble_type_ptr, "system") == 0) {
+                container = last_container;
             }
         }
     }
     
-    // Create a message bubble
-    lv_obj_t* msg_bubble = lv_obj_create(content_);
-    lv_obj_set_style_radius(msg_bubble, 8, 0);
-    lv_obj_set_scrollbar_mode(msg_bubble, LV_SCROLLBAR_MODE_OFF);
-    lv_obj_set_style_border_width(msg_bubble, 1, 0);
-    lv_obj_set_style_border_color(msg_bubble, current_theme_.border, 0);
-    lv_obj_set_style_pad_all(msg_bubble, 8, 0);
-
-    // Create the message text
-    lv_obj_t* msg_text = lv_label_create(msg_bubble);
+    if (container == nullptr && child_count >= MAX_MESSAGES) {
+        lv_obj_t* first_child = lv_obj_get_child(content_, 0);
+        if (lv_obj_get_user_data(first_child) == kMessageContainer) {
+            container = first_child;
+            lv_obj_move_to_index(container, -1);
+        } else {
+            // 图片等其他对象仍然删除
+            lv_obj_del(first_child);
+        }
+    }
+    if (container == nullptr) {
+        container = CreateMessageContainer();
+    }
+    
+    lv_obj_t* msg_bubble = lv_obj_get_child(container, 0);
+    lv_obj_t* msg_text = lv_obj_get_child(msg_bubble, 0);
     lv_label_set_text(msg_text, content);
     
     // 计算文本实际宽度
@@ -554,113 +785,92 @@ void LcdDisplay::SetChatMessage(const char* role, const char* content) {
     
     // 设置消息文本的宽度
     lv_obj_set_width(msg_text, bubble_width);  // 减去padding
-    lv_label_set_long_mode(msg_text, LV_LABEL_LONG_WRAP);
-    lv_obj_set_style_text_font(msg_text, fonts_.text_font, 0);
-
-    // 设置气泡宽度
-    lv_obj_set_width(msg_bubble, bubble_width);
-    lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
 
     // Set alignment and style based on message role
     if (strcmp(role, "user") == 0) {
         // User messages are right-aligned with green background
-        lv_obj_set_style_bg_color(msg_bubble, current_theme_.user_bubble, 0);
-        // Set text color for contrast
-        lv_obj_set_style_text_color(msg_text, current_theme_.text, 0);
+        SetBubbleStyle(msg_bubble, &theme_styles_.user_bubble);
         
         // 设置自定义属性标记气泡类型
         lv_obj_set_user_data(msg_bubble, (void*)"user");
         
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
-    } else if (strcmp(role, "assistant") == 0) {
-        // Assistant messages are left-aligned with white background
-        lv_obj_set_style_bg_color(msg_bubble, current_theme_.assistant_bubble, 0);
-        // Set text color for contrast
-        lv_obj_set_style_text_color(msg_text, current_theme_.text, 0);
-        
-        // 设置自定义属性标记气泡类型
-        lv_obj_set_user_data(msg_bubble, (void*)"assistant");
-        
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
+        // Right align the bubble in the container
+        lv_obj_align(msg_bubble, LV_ALIGN_RIGHT_MID, -25, 0);
     } else if (strcmp(role, "system") == 0) {
         // System messages are center-aligned with light gray background
-        lv_obj_set_style_bg_color(msg_bubble, current_theme_.system_bubble, 0);
-        // Set text color for contrast
-        lv_obj_set_style_text_color(msg_text, current_theme_.system_text, 0);
+        SetBubbleStyle(msg_bubble, &theme_styles_.system_bubble);
         
         // 设置自定义属性标记气泡类型
         lv_obj_set_user_data(msg_bubble, (void*)"system");
         
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
-    }
-    
-    // Create a full-width container for user messages to ensure right alignment
-    if (strcmp(role, "user") == 0) {
-        // Create a full-width container
-        lv_obj_t* container = lv_obj_create(content_);
-        lv_obj_set_width(container, LV_HOR_RES);
-        lv_obj_set_height(container, LV_SIZE_CONTENT);
-        
-        // Make container transparent and borderless
-        lv_obj_set_style_bg_opa(container, LV_OPA_TRANSP, 0);
-        lv_obj_set_style_border_width(container, 0, 0);
-        lv_obj_set_style_pad_all(container, 0, 0);
-        
-        // Move the message bubble into this container
-        lv_obj_set_parent(msg_bubble, container);
-        
-        // Right align the bubble in the container
-        lv_obj_align(msg_bubble, LV_ALIGN_RIGHT_MID, -25, 0);
-        
-        // Auto-scroll to this container
-        lv_obj_scroll_to_view_recursive(container, LV_ANIM_ON);
-    } else if (strcmp(role, "system") == 0) {
-        // 为系统消息创建全宽容器以确保居中对齐
-        lv_obj_t* container = lv_obj_create(content_);
-        lv_obj_set_width(container, LV_HOR_RES);
-        lv_obj_set_height(container, LV_SIZE_CONTENT);
-        
-        // 使容器透明且无边框
-        lv_obj_set_style_bg_opa(container, LV_OPA_TRANSP, 0);
-        lv_obj_set_style_border_width(container, 0, 0);
-        lv_obj_set_style_pad_all(container, 0, 0);
-        
-        // 将消息气泡移入此容器
-        lv_obj_set_parent(msg_bubble, container);
-        
         // 将气泡居中对齐在容器中
         lv_obj_align(msg_bubble, LV_ALIGN_CENTER, 0, 0);
-        
-        // 自动滚动底部
-        lv_obj_scroll_to_view_recursive(container, LV_ANIM_ON);
     } else {
-        // For assistant messages
+        // Assistant messages are left-aligned with white background
+        SetBubbleStyle(msg_bubble, &theme_styles_.assistant_bubble);
+        
+        // 设置自定义属性标记气泡类型
+        lv_obj_set_user_data(msg_bubble, (void*)"assistant");
+        
         // Left align assistant messages
         lv_obj_align(msg_bubble, LV_ALIGN_LEFT_MID, 0, 0);
-
-        // Auto-scroll to the message bubble
-        lv_obj_scroll_to_view_recursive(msg_bubble, LV_ANIM_ON);
     }
     
+    // 自动滚动底部
+    lv_obj_scroll_to_view_recursive(container, LV_ANIM_ON);
+    BoostRefresh(SCROLL_REFRESH_BOOST_MS);
+    
     // Store reference to the latest message label
     chat_message_label_ = msg_text;
 }
 
+// 流式回复：句子接到最后一条同角色气泡的文字后面，不新建气泡，也不再改样式和对齐
+void LcdDisplay::AppendChatMessage(const char* role, const char* content) {
+    DisplayLockGuard lock(this);
+    if (content_ == nullptr || content[0] == '\0') {
+        return;
+    }
+    lv_obj_t* msg_bubble = nullptr;
+    uint32_t child_count = lv_obj_get_child_cnt(content_);
+    if (child_count > 0) {
+        lv_obj_t* last_container = lv_obj_get_child(content_, child_count - 1);
+        if (lv_obj_get_user_data(last_container) == kMessageContainer) {
+            msg_bubble = lv_obj_get_child(last_container, 0);
+            auto bubble_type = (const char*)lv_obj_get_user_data(msg_bubble);
+            if (bubble_type == nullptr || strcmp(bubble_type, role) != 0) {
+                msg_bubble = nullptr;
+            }
+        }
+    }
+    if (msg_bubble == nullptr) {
+        SetChatMessage(role, content);
+        return;
+    }
+
+    lv_obj_t* msg_text = lv_obj_get_child(msg_bubble, 0);
+    const char* text = lv_label_get_text(msg_text);
+    size_t length = strlen(text);
+    if (length > 0 && NeedsSentenceSpace(text[length - 1], content[0])) {
+        std::string spaced = " ";
+        spaced += content;
+        lv_label_ins_text(msg_text, LV_LABEL_POS_LAST, spaced.c_str());
+    } else {
+        lv_label_ins_text(msg_text, LV_LABEL_POS_LAST, content);
+    }
+
+    // 气泡到了最大宽度以后只会增加行数，不用再量整段文字的宽度
+    lv_coord_t max_width = LV_HOR_RES * 85 / 100 - 16;
+    if (lv_obj_get_style_width(msg_text, 0) < max_width) {
+        text = lv_label_get_text(msg_text);
+        lv_coord_t text_width = lv_txt_get_width(text, strlen(text), fonts_.text_font, 0);
+        lv_obj_set_width(msg_text, std::clamp<lv_coord_t>(text_width, 20, max_width));
+    }
+
+    lv_obj_scroll_to_view_recursive(lv_obj_get_parent(msg_bubble), LV_ANIM_ON);
+    BoostRefresh(SCROLL_REFRESH_BOOST_MS);
+    chat_message_label_ = msg_text;
+}
+
 void LcdDisplay::SetPreviewImage(const lv_img_dsc_t* img_dsc) {
     DisplayLockGuard lock(this);
     if (content_ == nullptr) {
@@ -673,11 +883,8 @@ void LcdDisplay::SetPreviewImage(const lv_img_dsc_t* img_dsc) {
         lv_obj_set_style_radius(img_bubble, 8, 0);
         lv_obj_set_scrollbar_mode(img_bubble, LV_SCROLLBAR_MODE_OFF);
         lv_obj_set_style_border_width(img_bubble, 1, 0);
-        lv_obj_set_style_border_color(img_bubble, current_theme_.border, 0);
         lv_obj_set_style_pad_all(img_bubble, 8, 0);
-        
-        // Set image bubble background color (similar to system message)
-        lv_obj_set_style_bg_color(img_bubble, current_theme_.assistant_bubble, 0);
+        lv_obj_add_style(img_bubble, &theme_styles_.assistant_bubble, 0);
         
         // 设置自定义属性标记气泡类型
         lv_obj_set_user_data(img_bubble, (void*)"image");
@@ -760,16 +967,18 @@ void LcdDisplay::SetPreviewImage(const lv_img_dsc_t* img_dsc) {
 
         // Auto-scroll to the image bubble
         lv_obj_scroll_to_view_recursive(img_bubble, LV_ANIM_ON);
+        BoostRefresh(SCROLL_REFRESH_BOOST_MS);
     }
 }
 #else
 void LcdDisplay::SetupUI() {
     DisplayLockGuard lock(this);
+    LoadAssetFonts();
+    UpdateThemeStyles();
 
     auto screen = lv_screen_active();
     lv_obj_set_style_text_font(screen, fonts_.text_font, 0);
-    lv_obj_set_style_text_color(screen, current_theme_.text, 0);
-    lv_obj_set_style_bg_color(screen, current_theme_.background, 0);
+    lv_obj_add_style(screen, &theme_styles_.screen, 0);
 
     /* Container */
     container_ = lv_obj_create(screen);
@@ -778,15 +987,13 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_style_pad_all(container_, 0, 0);
     lv_obj_set_style_border_width(container_, 0, 0);
     lv_obj_set_style_pad_row(container_, 0, 0);
-    lv_obj_set_style_bg_color(container_, current_theme_.background, 0);
-    lv_obj_set_style_border_color(container_, current_theme_.border, 0);
+    lv_obj_add_style(container_, &theme_styles_.container, 0);
 
     /* Status bar */
     status_bar_ = lv_obj_create(container_);
     lv_obj_set_size(status_bar_, LV_HOR_RES, fonts_.text_font->line_height);
     lv_obj_set_style_radius(status_bar_, 0, 0);
-    lv_obj_set_style_bg_color(status_bar_, current_theme_.background, 0);
-    lv_obj_set_style_text_color(status_bar_, current_theme_.text, 0);
+    lv_obj_add_style(status_bar_, &theme_styles_.screen, 0);
     
     /* Content */
     content_ = lv_obj_create(container_);
@@ -795,15 +1002,14 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_width(content_, LV_HOR_RES);
     lv_obj_set_flex_grow(content_, 1);
     lv_obj_set_style_pad_all(content_, 5, 0);
-    lv_obj_set_style_bg_color(content_, current_theme_.chat_background, 0);
-    lv_obj_set_style_border_color(content_, current_theme_.border, 0); // Border color for content
+    lv_obj_add_style(content_, &theme_styles_.content, 0);
 
     lv_obj_set_flex_flow(content_, LV_FLEX_FLOW_COLUMN); // 垂直布局（从上到下）
     lv_obj_set_flex_align(content_, LV_FLEX_ALIGN_CENTER, LV_FLEX_ALIGN_CENTER, LV_FLEX_ALIGN_SPACE_EVENLY); // 子对象居中对齐，等距分布
 
     emotion_label_ = lv_label_create(content_);
     lv_obj_set_style_text_font(emotion_label_, &font_awesome_30_4, 0);
-    lv_obj_set_style_text_color(emotion_label_, current_theme_.text, 0);
+    lv_obj_add_style(emotion_label_, &theme_styles_.text, 0);
     lv_label_set_text(emotion_label_, FONT_AWESOME_AI_CHIP);
 
     preview_image_ = lv_image_create(content_);
@@ -816,7 +1022,7 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_width(chat_message_label_, LV_HOR_RES * 0.9); // 限制宽度为屏幕宽度的 90%
     lv_label_set_long_mode(chat_message_label_, LV_LABEL_LONG_WRAP); // 设置为自动换行模式
     lv_obj_set_style_text_align(chat_message_label_, LV_TEXT_ALIGN_CENTER, 0); // 设置文本居中对齐
-    lv_obj_set_style_text_color(chat_message_label_, current_theme_.text, 0);
+    lv_obj_add_style(chat_message_label_, &theme_styles_.text, 0);
 
     /* Status bar */
     lv_obj_set_flex_flow(status_bar_, LV_FLEX_FLOW_ROW);
@@ -829,12 +1035,12 @@ void LcdDisplay::SetupUI() {
     network_label_ = lv_label_create(status_bar_);
     lv_label_set_text(network_label_, "");
     lv_obj_set_style_text_font(network_label_, fonts_.icon_font, 0);
-    lv_obj_set_style_text_color(network_label_, current_theme_.text, 0);
+    lv_obj_add_style(network_label_, &theme_styles_.text, 0);
 
     notification_label_ = lv_label_create(status_bar_);
     lv_obj_set_flex_grow(notification_label_, 1);
     lv_obj_set_style_text_align(notification_label_, LV_TEXT_ALIGN_CENTER, 0);
-    lv_obj_set_style_text_color(notification_label_, current_theme_.text, 0);
+    lv_obj_add_style(notification_label_, &theme_styles_.text, 0);
     lv_label_set_text(notification_label_, "");
     lv_obj_add_flag(notification_label_, LV_OBJ_FLAG_HIDDEN);
 
@@ -842,23 +1048,23 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_flex_grow(status_label_, 1);
     lv_label_set_long_mode(status_label_, LV_LABEL_LONG_SCROLL_CIRCULAR);
     lv_obj_set_style_text_align(status_label_, LV_TEXT_ALIGN_CENTER, 0);
-    lv_obj_set_style_text_color(status_label_, current_theme_.text, 0);
+    lv_obj_add_style(status_label_, &theme_styles_.text, 0);
     lv_label_set_text(status_label_, Lang::Strings::INITIALIZING);
     mute_label_ = lv_label_create(status_bar_);
     lv_label_set_text(mute_label_, "");
     lv_obj_set_style_text_font(mute_label_, fonts_.icon_font, 0);
-    lv_obj_set_style_text_color(mute_label_, current_theme_.text, 0);
+    lv_obj_add_style(mute_label_, &theme_styles_.text, 0);
 
     battery_label_ = lv_label_create(status_bar_);
     lv_label_set_text(battery_label_, "");
     lv_obj_set_style_text_font(battery_label_, fonts_.icon_font, 0);
-    lv_obj_set_style_text_color(battery_label_, current_theme_.text, 0);
+    lv_obj_add_style(battery_label_, &theme_styles_.text, 0);
 
     low_battery_popup_ = lv_obj_create(screen);
     lv_obj_set_scrollbar_mode(low_battery_popup_, LV_SCROLLBAR_MODE_OFF);
     lv_obj_set_size(low_battery_popup_, LV_HOR_RES * 0.9, fonts_.text_font->line_height * 2);
     lv_obj_align(low_battery_popup_, LV_ALIGN_BOTTOM_MID, 0, 0);
-    lv_obj_set_style_bg_color(low_battery_popup_, current_theme_.low_battery, 0);
+    lv_obj_add_style(low_battery_popup_, &theme_styles_.low_battery, 0);
     lv_obj_set_style_radius(low_battery_popup_, 10, 0);
     low_battery_label_ = lv_label_create(low_battery_popup_);
     lv_label_set_text(low_battery_label_, Lang::Strings::BATTERY_NEED_CHARGE);
@@ -997,6 +1203,70 @@ void LcdDisplay::SetMusicInfo(const char* song_name) {
 #endif
 }
 
+void LcdDisplay::SetMusicCover(const lv_img_dsc_t* image) {
+#if !CONFIG_USE_WECHAT_MESSAGE_STYLE
+    // 封面显示在预览图片的位置，代替表情
+    DisplayLockGuard lock(this);
+    if (preview_image_ == nullptr) {
+        return;
+    }
+    if (image != nullptr) {
+        // 两张封面轮流使用同一块描述符，丢掉 LVGL 缓存里的旧内容
+        lv_image_cache_drop(image);
+        lv_image_set_scale(preview_image_, LV_SCALE_NONE);
+        lv_image_set_src(preview_image_, image);
+        lv_obj_clear_flag(preview_image_, LV_OBJ_FLAG_HIDDEN);
+        if (emotion_label_ != nullptr) {
+            lv_obj_add_flag(emotion_label_, LV_OBJ_FLAG_HIDDEN);
+        }
+    } else {
+        lv_image_set_src(preview_image_, nullptr);
+        lv_obj_add_flag(preview_image_, LV_OBJ_FLAG_HIDDEN);
+        if (emotion_label_ != nullptr) {
+            lv_obj_clear_flag(emotion_label_, LV_OBJ_FLAG_HIDDEN);
+        }
+    }
+#endif
+}
+
+int LcdDisplay::GetMusicCoverSize() {
+#if CONFIG_USE_WECHAT_MESSAGE_STYLE
+    return 0;
+#else
+    // 和预览图片区域一样，取屏幕较短边的一半
+    return std::min(width_, height_) / 2;
+#endif
+}
+
+void LcdDisplay::UpdateThemeStyles() {
+    auto& styles = theme_styles_;
+    if (!theme_styles_initialized_) {
+        for (auto style : {&styles.screen, &styles.container, &styles.content, &styles.text, &styles.user_bubble,
+                &styles.assistant_bubble, &styles.system_bubble, &styles.low_battery}) {
+            lv_style_init(style);
+        }
+        theme_styles_initialized_ = true;
+    }
+
+    lv_style_set_bg_color(&styles.screen, current_theme_.background);
+    lv_style_set_text_color(&styles.screen, current_theme_.text);
+    lv_style_set_bg_color(&styles.container, current_theme_.background);
+    lv_style_set_border_color(&styles.container, current_theme_.border);
+    lv_style_set_bg_color(&styles.content, current_theme_.chat_background);
+    lv_style_set_border_color(&styles.content, current_theme_.border);
+    lv_style_set_text_color(&styles.text, current_theme_.text);
+    lv_style_set_bg_color(&styles.user_bubble, current_theme_.user_bubble);
+    lv_style_set_border_color(&styles.user_bubble, current_theme_.border);
+    lv_style_set_text_color(&styles.user_bubble, current_theme_.text);
+    lv_style_set_bg_color(&styles.assistant_bubble, current_theme_.assistant_bubble);
+    lv_style_set_border_color(&styles.assistant_bubble, current_theme_.border);
+    lv_style_set_text_color(&styles.assistant_bubble, current_theme_.text);
+    lv_style_set_bg_color(&styles.system_bubble, current_theme_.system_bubble);
+    lv_style_set_border_color(&styles.system_bubble, current_theme_.border);
+    lv_style_set_text_color(&styles.system_bubble, current_theme_.system_text);
+    lv_style_set_bg_color(&styles.low_battery, current_theme_.low_battery);
+}
+
 void LcdDisplay::SetTheme(const std::string& theme_name) {
     DisplayLockGuard lock(this);
     
@@ -1010,186 +1280,60 @@ void LcdDisplay::SetTheme(const std::string& theme_name) {
         return;
     }
     
-    // Get the active screen
-    lv_obj_t* screen = lv_screen_active();
-    
-    // Update the screen colors
-    lv_obj_set_style_bg_color(screen, current_theme_.background, 0);
-    lv_obj_set_style_text_color(screen, current_theme_.text, 0);
-    
-    // Update container colors
-    if (container_ != nullptr) {
-        lv_obj_set_style_bg_color(container_, current_theme_.background, 0);
-        lv_obj_set_style_border_color(container_, current_theme_.border, 0);
-    }
-    
-    // Update status bar colors
-    if (status_bar_ != nullptr) {
-        lv_obj_set_style_bg_color(status_bar_, current_theme_.background, 0);
-        lv_obj_set_style_text_color(status_bar_, current_theme_.text, 0);
-        
-        // Update status bar elements
-        if (network_label_ != nullptr) {
-            lv_obj_set_style_text_color(network_label_, current_theme_.text, 0);
-        }
-        if (status_label_ != nullptr) {
-            lv_obj_set_style_text_color(status_label_, current_theme_.text, 0);
-        }
-        if (notification_label_ != nullptr) {
-            lv_obj_set_style_text_color(notification_label_, current_theme_.text, 0);
-        }
-        if (mute_label_ != nullptr) {
-            lv_obj_set_style_text_color(mute_label_, current_theme_.text, 0);
-        }
-        if (battery_label_ != nullptr) {
-            lv_obj_set_style_text_color(battery_label_, current_theme_.text, 0);
-        }
-        if (emotion_label_ != nullptr) {
-            lv_obj_set_style_text_color(emotion_label_, current_theme_.text, 0);
-        }
+    // 所有控件共用主题样式，只需更新样式再通知一次，与聊天记录条数无关
+    UpdateThemeStyles();
+    lv_obj_report_style_change(nullptr);
+
+    // No errors occurred. Save theme to settings
+    Display::SetTheme(theme_name);
+}
+
+// FFT 相关内存在显示频谱时分配，stopFft 时释放，所有面板类型共用
+bool LcdDisplay::InitializeFft() {
+    if (fft_handle_ != nullptr) {
+        return true;
+    }
+    // 旋转因子表在 init 时一次生成
+    fft_handle_ = dl_rfft_f32_init(FFT_SIZE, FFT_MALLOC_CAPS);
+    fft_real = (float*)heap_caps_aligned_alloc(16, FFT_SIZE * sizeof(float), FFT_MALLOC_CAPS);
+    hanning_window_float = (float*)heap_caps_malloc(FFT_SIZE * sizeof(float), FFT_MALLOC_CAPS);
+    avg_power_spectrum = (float*)heap_caps_malloc(FFT_SIZE / 2 * sizeof(float), FFT_MALLOC_CAPS);
+    frame_audio_data = (int16_t*)heap_caps_calloc(FFT_SIZE, sizeof(int16_t), FFT_MALLOC_CAPS);
+    if (fft_handle_ == nullptr || fft_real == nullptr || hanning_window_float == nullptr ||
+        avg_power_spectrum == nullptr || frame_audio_data == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate FFT buffers");
+        ReleaseFft();
+        return false;
+    }
+    
+    // 创建窗函数，并入 int16 -> float 和 1/N 归一化，准备数据时只需一次乘法
+    for (int i = 0; i < FFT_SIZE; i++) {
+        hanning_window_float[i] = 0.5 * (1.0 - cos(2.0 * M_PI * i / (FFT_SIZE - 1))) / (32768.0 * FFT_SIZE);
     }
     
-    // Update content area colors
-    if (content_ != nullptr) {
-        lv_obj_set_style_bg_color(content_, current_theme_.chat_background, 0);
-        lv_obj_set_style_border_color(content_, current_theme_.border, 0);
-        
-        // If we have the chat message style, update all message bubbles
-#if CONFIG_USE_WECHAT_MESSAGE_STYLE
-        // Iterate through all children of content (message containers or bubbles)
-        uint32_t child_count = lv_obj_get_child_cnt(content_);
-        for (uint32_t i = 0; i < child_count; i++) {
-            lv_obj_t* obj = lv_obj_get_child(content_, i);
-            if (obj == nullptr) continue;
-            
-            lv_obj_t* bubble = nullptr;
-            
-            // 检查这个对象是容器还是气泡
-            // 如果是容器（用户或系统消息），则获取其子对象作为气泡
-            // 如果是气泡（助手消息），则直接使用
-            if (lv_obj_get_child_cnt(obj) > 0) {
-                // 可能是容器，检查它是否为用户或系统消息容器
-                // 用户和系统消息容器是透明的
-                lv_opa_t bg_opa = lv_obj_get_style_bg_opa(obj, 0);
-                if (bg_opa == LV_OPA_TRANSP) {
-                    // 这是用户或系统消息的容器
-                    bubble = lv_obj_get_child(obj, 0);
-                } else {
-                    // 这可能是助手消息的气泡自身
-                    bubble = obj;
-                }
-            } else {
-                // 没有子元素，可能是其他UI元素，跳过
-                continue;
-            }
-            
-            if (bubble == nullptr) continue;
-            
-            // 使用保存的用户数据来识别气泡类型
-            void* bubble_type_ptr = lv_obj_get_user_data(bubble);
-            if (bubble_type_ptr != nullptr) {
-                const char* bubble_type = static_cast<const char*>(bubble_type_ptr);
-                
-                // 根据气泡类型应用正确的颜色
-                if (strcmp(bubble_type, "user") == 0) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.user_bubble, 0);
-                } else if (strcmp(bubble_type, "assistant") == 0) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.assistant_bubble, 0); 
-                } else if (strcmp(bubble_type, "system") == 0) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.system_bubble, 0);
-                } else if (strcmp(bubble_type, "image") == 0) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.system_bubble, 0);
-                }
-                
-                // Update border color
-                lv_obj_set_style_border_color(bubble, current_theme_.border, 0);
-                
-                // Update text color for the message
-                if (lv_obj_get_child_cnt(bubble) > 0) {
-                    lv_obj_t* text = lv_obj_get_child(bubble, 0);
-                    if (text != nullptr) {
-                        // 根据气泡类型设置文本颜色
-                        if (strcmp(bubble_type, "system") == 0) {
-                            lv_obj_set_style_text_color(text, current_theme_.system_text, 0);
-                        } else {
-                            lv_obj_set_style_text_color(text, current_theme_.text, 0);
-                        }
-                    }
-                }
-            } else {
-                // 如果没有标记，回退到之前的逻辑（颜色比较）
-                // ...保留原有的回退逻辑...
-                lv_color_t bg_color = lv_obj_get_style_bg_color(bubble, 0);
-            
-                // 改进bubble类型检测逻辑，不仅使用颜色比较
-                bool is_user_bubble = false;
-                bool is_assistant_bubble = false;
-                bool is_system_bubble = false;
-            
-                // 检查用户bubble
-                if (lv_color_eq(bg_color, DARK_USER_BUBBLE_COLOR) || 
-                    lv_color_eq(bg_color, LIGHT_USER_BUBBLE_COLOR) ||
-                    lv_color_eq(bg_color, current_theme_.user_bubble)) {
-                    is_user_bubble = true;
-                }
-                // 检查系统bubble
-                else if (lv_color_eq(bg_color, DARK_SYSTEM_BUBBLE_COLOR) || 
-                         lv_color_eq(bg_color, LIGHT_SYSTEM_BUBBLE_COLOR) ||
-                         lv_color_eq(bg_color, current_theme_.system_bubble)) {
-                    is_system_bubble = true;
-                }
-                // 剩余的都当作助手bubble处理
-                else {
-                    is_assistant_bubble = true;
-                }
-            
-                // 根据bubble类型应用正确的颜色
-                if (is_user_bubble) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.user_bubble, 0);
-                } else if (is_assistant_bubble) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.assistant_bubble, 0);
-                } else if (is_system_bubble) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.system_bubble, 0);
-                }
-                
-                // Update border color
-                lv_obj_set_style_border_color(bubble, current_theme_.border, 0);
-                
-                // Update text color for the message
-                if (lv_obj_get_child_cnt(bubble) > 0) {
-                    lv_obj_t* text = lv_obj_get_child(bubble, 0);
-                    if (text != nullptr) {
-                        // 回退到颜色检测逻辑
-                        if (lv_color_eq(bg_color, current_theme_.system_bubble) ||
-                            lv_color_eq(bg_color, DARK_SYSTEM_BUBBLE_COLOR) || 
-                            lv_color_eq(bg_color, LIGHT_SYSTEM_BUBBLE_COLOR)) {
-                            lv_obj_set_style_text_color(text, current_theme_.system_text, 0);
-                        } else {
-                            lv_obj_set_style_text_color(text, current_theme_.text, 0);
-                        }
-                    }
-                }
-            }
-        }
-#else
-        // Simple UI mode - just update the main chat message
-        if (chat_message_label_ != nullptr) {
-            lv_obj_set_style_text_color(chat_message_label_, current_theme_.text, 0);
-        }
-        
-        if (emotion_label_ != nullptr) {
-            lv_obj_set_style_text_color(emotion_label_, current_theme_.text, 0);
-        }
-#endif
+    for (int i = 0; i < FFT_SIZE/2; i++) {
+        avg_power_spectrum[i] = -25.0f;
     }
+    frame_audio_fill = 0;
+    frame_audio_segments = 0;
     
-    // Update low battery popup
-    if (low_battery_popup_ != nullptr) {
-        lv_obj_set_style_bg_color(low_battery_popup_, current_theme_.low_battery, 0);
-    }
+    ESP_LOGI(TAG,"Initialize fft_input, frame_audio_data, spectrum_data");
+    return true;
+}
 
-    // No errors occurred. Save theme to settings
-    Display::SetTheme(theme_name);
+void LcdDisplay::ReleaseFft() {
+    if (fft_handle_ != nullptr) {
+        dl_rfft_f32_deinit(fft_handle_);
+        fft_handle_ = nullptr;
+    }
+    heap_caps_free(fft_real);
+    heap_caps_free(hanning_window_float);
+    heap_caps_free(avg_power_spectrum);
+    heap_caps_free(frame_audio_data);
+    fft_real = nullptr;
+    hanning_window_float = nullptr;
+    avg_power_spectrum = nullptr;
+    frame_audio_data = nullptr;
 }
 
 void LcdDisplay::create_canvas(){
@@ -1198,7 +1342,7 @@ void LcdDisplay::create_canvas(){
         lv_obj_del(canvas_);
     }
     if (canvas_buffer_ != nullptr) {
-        heap_caps_free(canvas_buffer_);
+        DisplaySurfacePool::GetInstance().Return(canvas_buffer_);
         canvas_buffer_ = nullptr;
     }
 
@@ -1206,7 +1350,25 @@ void LcdDisplay::create_canvas(){
     canvas_width_=width_;
     canvas_height_=height_-status_bar_height;
 
-    canvas_buffer_=(uint16_t*)heap_caps_malloc(canvas_width_ * canvas_height_ * sizeof(uint16_t), MALLOC_CAP_8BIT | MALLOC_CAP_SPIRAM);
+#if CONFIG_USE_PPA_DISPLAY_ACCEL
+    // PPA 写回的缓冲区地址和长度都要按 cache line 对齐
+    size_t alignment = 64;
+    esp_cache_get_alignment(MALLOC_CAP_SPIRAM | MALLOC_CAP_DMA, &alignment);
+    canvas_buffer_size_ = (canvas_width_ * canvas_height_ * sizeof(uint16_t) + alignment - 1) & ~(alignment - 1);
+    canvas_buffer_=(uint16_t*)DisplaySurfacePool::GetInstance().Lease(canvas_buffer_size_);
+    if (ppa_fill_client_ == nullptr) {
+        ppa_client_config_t ppa_config = {
+            .oper_type = PPA_OPERATION_FILL,
+            .max_pending_trans_num = 1,
+        };
+        if (ppa_register_client(&ppa_config, &ppa_fill_client_) != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to register PPA fill client, using CPU fills");
+            ppa_fill_client_ = nullptr;
+        }
+    }
+#else
+    canvas_buffer_=(uint16_t*)DisplaySurfacePool::GetInstance().Lease(canvas_width_ * canvas_height_ * sizeof(uint16_t));
+#endif
     if (canvas_buffer_ == nullptr) {
         ESP_LOGE(TAG, "Failed to allocate canvas buffer");
         return;
@@ -1220,7 +1382,7 @@ void LcdDisplay::create_canvas(){
 
     lv_obj_set_pos(canvas_, 0, status_bar_height);
     lv_obj_set_size(canvas_, canvas_width_, canvas_height_);
-    lv_canvas_fill_bg(canvas_, lv_color_make(0, 0, 0), LV_OPA_TRANSP);
+    clearScreen();
     lv_obj_move_foreground(canvas_);
 
     ESP_LOGI(TAG, "canvas created successfully");
@@ -1235,15 +1397,19 @@ void LcdDisplay::start(){
     
     vTaskDelay(pdMS_TO_TICKS(500));
 
+    // 频谱动画期间提高刷新率
+    SetAnimationActive(true);
+
     // 创建周期性更新任务
     fft_task_should_stop = false;  // 重置停止标志
-    xTaskCreate(
+    TaskStacks::GetInstance().Create(
         periodicUpdateTaskWrapper,
         "display_fft",      // 任务名称
         4096*2,             // 堆栈大小
         this,               // 参数
         1,                  // 优先级
-        &fft_task_handle    // 保存到成员变量
+        &fft_task_handle,   // 保存到成员变量
+        DISPLAY_TASK_AFFINITY < 0 ? tskNO_AFFINITY : DISPLAY_TASK_AFFINITY
     );
     
   
@@ -1264,6 +1430,10 @@ void LcdDisplay::periodicUpdateTaskWrapper(void* arg) {
 void LcdDisplay::periodicUpdateTask() {
     ESP_LOGI(TAG, "Periodic update task started");
     
+    if (!InitializeFft()) {
+        fft_task_handle = nullptr;
+        return;
+    }
     if(canvas_==nullptr){
         create_canvas();
     }
@@ -1272,40 +1442,32 @@ void LcdDisplay::periodicUpdateTask() {
     }
   
 
-    auto music = Board::GetInstance().GetMusic();
+    // 播放线程每解码一帧就唤醒这里，不再轮询
+    auto& pcm_tap = StreamPlayer::GetInstance().pcm_tap();
+    if (!pcm_tap.Attach()) {
+        ESP_LOGE(TAG, "Failed to attach PCM tap");
+    }
         
     const TickType_t displayInterval = pdMS_TO_TICKS(40);  
-    const TickType_t audioProcessInterval = pdMS_TO_TICKS(15); 
+    // 音频关键窗口内频谱降到 6Hz
+    const TickType_t criticalDisplayInterval = pdMS_TO_TICKS(160);
     
     TickType_t lastDisplayTime = xTaskGetTickCount();
-    TickType_t lastAudioTime = xTaskGetTickCount();
     
     while (!fft_task_should_stop) {
         
-        TickType_t currentTime = xTaskGetTickCount();
-        
-        
-        if (currentTime - lastAudioTime >= audioProcessInterval) {
-            if(music->GetAudioData() != nullptr) {
-                readAudioData();  // 快速处理，不阻塞
-            } else {
-                vTaskDelay(pdMS_TO_TICKS(100));
-            }
-            lastAudioTime = currentTime;
+        // 超时只用于检查停止标志
+        PcmTap::Frame frame;
+        if (pcm_tap.Read(&frame, 100)) {
+            readAudioData(frame);  // 快速处理，不阻塞
         }
+        TickType_t currentTime = xTaskGetTickCount();
         
         // 显示刷新（30Hz）
-        if (currentTime - lastDisplayTime >= displayInterval) {
+        if (currentTime - lastDisplayTime >= (audio_critical_ ? criticalDisplayInterval : displayInterval)) {
             if (fft_data_ready) {
                 DisplayLockGuard lock(this);
-                drawSpectrumIfReady();
-                lv_area_t refresh_area;
-                refresh_area.x1 = 0;
-                refresh_area.y1 = height_-100;
-                refresh_area.x2 = canvas_width_ -1;
-                refresh_area.y2 = height_ -1; // 只刷新频谱区域
-                lv_obj_invalidate_area(canvas_, &refresh_area);
-                //lv_obj_invalidate(canvas_);
+                drawSpectrumIfReady();  // 只提交有变化的区域
                 fft_data_ready = false;
                 lastDisplayTime = currentTime;
             }   // 绘制操作
@@ -1314,83 +1476,70 @@ void LcdDisplay::periodicUpdateTask() {
             // 更新FPS计数
             //FPS();
         }
-        
-        
-        
-        vTaskDelay(pdMS_TO_TICKS(10));
-        // 短暂延迟
-        
     }
     
+    pcm_tap.Detach();
     ESP_LOGI(TAG, "FFT display task stopped");
-    fft_task_handle = nullptr;  // 清空任务句柄
-    vTaskDelete(NULL);  // 删除当前任务
+    fft_task_handle = nullptr;  // 清空任务句柄，返回后由 TaskStacks 删除任务
 }
 
 
 
-void LcdDisplay::readAudioData(){
-   
-    auto music = Board::GetInstance().GetMusic();
-    
-    if(music->GetAudioData()!=nullptr){
-        
-    
-        if(audio_display_last_update<=2){
-            memcpy(audio_data,music->GetAudioData(),sizeof(int16_t)*1152);
-            for(int i=0;i<1152;i++){
-                frame_audio_data[i]+=audio_data[i];
-            }
-            audio_display_last_update++;
-            
-        }else{
-            const int HOP_SIZE = 512;
-            const int NUM_SEGMENTS = 1 + (1152 - FFT_SIZE) / HOP_SIZE;
-    
-            for (int seg = 0; seg < NUM_SEGMENTS; seg++) {
-                int start = seg * HOP_SIZE;
-                if (start + FFT_SIZE > 1152) break;
-
-        // 准备当前段数据
-                for (int i = 0; i < FFT_SIZE; i++) {
-                    int idx = start + i;
-                    //float sample =frame_audio_data[idx] / 32768.0f;
-                    float sample =frame_audio_data[idx] / 32768.0f;
-                    fft_real[i] = sample * hanning_window_float[i];
-                    fft_imag[i] = 0.0f;
-                    
-                }
-
-                compute(fft_real, fft_imag, FFT_SIZE, true);
-        
-        // 计算功率谱并累加（双边）
-                for (int i = 0; i < FFT_SIZE/2; i++) {
-                    avg_power_spectrum[i] += fft_real[i] * fft_real[i]+fft_imag[i] * fft_imag[i]; // 功率 = 幅度平方
-                }
-            }
-        
-    // 计算平均值
-            for (int i = 0; i < FFT_SIZE/2; i++) {
-                avg_power_spectrum[i] /= NUM_SEGMENTS;
-            }
+void LcdDisplay::readAudioData(const PcmTap::Frame& frame){
+    const int HOP_SIZE = 512;
+    const int NUM_SEGMENTS = 2;
 
-        audio_display_last_update=0;
-        //memcpy(spectrum_data, avg_power_spectrum, sizeof(float) * FFT_SIZE/2);
-        fft_data_ready=true;
+    // 采样率变化时丢弃旧样本，不同采样率的数据不能放进同一个窗口
+    if (frame.sample_rate != frame_audio_sample_rate) {
+        frame_audio_sample_rate = frame.sample_rate;
+        frame_audio_fill = 0;
+        frame_audio_segments = 0;
+    }
 
-        //draw_spectrum(avg_power_spectrum, FFT_SIZE/2);
-        memset(frame_audio_data,0,sizeof(int16_t)*1152);
+    // 帧长不固定（MP3 1152/576，WAV、Opus 各不相同），样本连续写入窗口，每满 FFT_SIZE 做一段
+    size_t offset = 0;
+    while (offset < frame.samples) {
+        size_t count = std::min(frame.samples - offset, (size_t)FFT_SIZE - frame_audio_fill);
+        memcpy(frame_audio_data + frame_audio_fill, frame.pcm + offset, count * sizeof(int16_t));
+        frame_audio_fill += count;
+        offset += count;
+        if (frame_audio_fill < FFT_SIZE) {
+            break;
+        }
 
+        // 准备当前段数据（加窗）
+        for (int i = 0; i < FFT_SIZE; i++) {
+            fft_real[i] = frame_audio_data[i] * hanning_window_float[i];
         }
-    }else{
-            ESP_LOGI(TAG, "audio_data is nullptr");
-            vTaskDelay(pdMS_TO_TICKS(500));
-        }   
+
+        dl_rfft_f32_run(fft_handle_, fft_real);
+
+        // 计算功率谱并累加：fft_real[0] 为直流，fft_real[1] 为 N/2 分量，之后为复数对
+        avg_power_spectrum[0] += fft_real[0] * fft_real[0];
+        for (int i = 1; i < FFT_SIZE/2; i++) {
+            float re = fft_real[2 * i];
+            float im = fft_real[2 * i + 1];
+            avg_power_spectrum[i] += re * re + im * im; // 功率 = 幅度平方
+        }
+
+        // 窗口滑动 HOP_SIZE
+        memmove(frame_audio_data, frame_audio_data + HOP_SIZE, sizeof(int16_t) * (FFT_SIZE - HOP_SIZE));
+        frame_audio_fill = FFT_SIZE - HOP_SIZE;
+
+        if (++frame_audio_segments == NUM_SEGMENTS) {
+            // 计算平均值
+            for (int i = 0; i < FFT_SIZE/2; i++) {
+                avg_power_spectrum[i] /= NUM_SEGMENTS;
+            }
+            frame_audio_segments = 0;
+            fft_data_ready = true;
+        }
+    }
 }
 
 uint16_t LcdDisplay::get_bar_color(int x_pos){
 
-    static uint16_t color_table[40];
+    static uint16_t color_table[SPECTRUM_MAX_BARS];
     static bool initialized = false;
     
     if (!initialized) {
@@ -1413,88 +1562,92 @@ uint16_t LcdDisplay::get_bar_color(int x_pos){
  }
 
 
-void LcdDisplay::draw_spectrum(float *power_spectrum,int fft_size){
-   
-    
-    const int bartotal=40;
-    int bar_height;
-    const int bar_max_height=canvas_height_-100;
-    const int bar_width=240/bartotal;
-    int x_pos=0;
-    int y_pos = (canvas_height_) - 1;
+// 10 * log10(x)：指数位直接给出 log2 的整数部分，尾数部分用二次多项式近似，误差约 0.02 dB
+static inline float FastPowerDb(float x) {
+    if (!(x > 1e-20f)) {
+        return -200.0f;
+    }
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    int exponent = (int)((bits >> 23) & 0xFF) - 127;
+    bits = (bits & 0x007FFFFF) | 0x3F800000;
+    float mantissa;
+    memcpy(&mantissa, &bits, sizeof(mantissa));
+    float t = mantissa - 1.0f;
+    return 3.0103f * (exponent + t * (1.3465552f - 0.3465552f * t));
+}
 
-    float magnitude[bartotal]={0};
-    float max_magnitude=0;
+// 按对数频率把 FFT 频点分到各条，低频不足一个频点的条至少占一个，后面顺延
+void LcdDisplay::UpdateSpectrumBands(int sample_rate) {
+    const int bins = FFT_SIZE / 2;
+    spectrum_band_sample_rate_ = sample_rate;
+    spectrum_band_width_ = canvas_width_;
+    spectrum_bars_ = std::clamp(canvas_width_ / SPECTRUM_MIN_BAR_WIDTH, 1, SPECTRUM_MAX_BARS);
+
+    float bin_hz = (float)sample_rate / FFT_SIZE;
+    float max_freq = std::min(SPECTRUM_MAX_FREQ, sample_rate / 2.0f);
+    float ratio = max_freq / SPECTRUM_MIN_FREQ;
+    spectrum_band_start_[0] = std::max(1, (int)(SPECTRUM_MIN_FREQ / bin_hz + 0.5f));
+    for (int i = 1; i <= spectrum_bars_; i++) {
+        int bin = (int)(SPECTRUM_MIN_FREQ * powf(ratio, (float)i / spectrum_bars_) / bin_hz + 0.5f);
+        spectrum_band_start_[i] = std::min(bins, std::max(bin, spectrum_band_start_[i - 1] + 1));
+    }
+    memset(spectrum_levels_, 0, sizeof(spectrum_levels_));
+    ESP_LOGI(TAG, "Spectrum: %d bars, bins %d-%d at %d Hz", spectrum_bars_, spectrum_band_start_[0],
+        spectrum_band_start_[spectrum_bars_], sample_rate);
+}
 
-    const float MIN_DB = -25.0f;
-    const float MAX_DB = 0.0f;
-    
-    for (int bin = 0; bin < bartotal; bin++) {
-        int start = bin * (fft_size / bartotal);
-        int end = (bin+1) * (fft_size / bartotal);
-        magnitude[bin] = 0;
-        int count=0;
-        for (int k = start; k < end; k++) {
-            magnitude[bin] += sqrt(power_spectrum[k]);
-            count++;
-        }
-        if(count>0){
-            magnitude[bin] /= count;
-        }
-      
-
-        if (magnitude[bin] > max_magnitude) max_magnitude = magnitude[bin];
-    }
-
-
-    magnitude[1]=magnitude[1]*0.6;
-    magnitude[2]=magnitude[2]*0.7;
-    magnitude[3]=magnitude[3]*0.8;
-    magnitude[4]=magnitude[4]*0.8;
-    magnitude[5]=magnitude[5]*0.9;
-    /*
-    if (bartotal >= 6) {
-        magnitude[0] *= 0.3f; // 最低频
-        magnitude[1] *= 1.1f;
-        magnitude[2] *= 1.0f;
-        magnitude[3] *= 0.9f;
-        magnitude[4] *= 0.8f;
-        magnitude[5] *= 0.7f;
-        // 更高频率保持或进一步衰减
-        for (int i = 6; i < bartotal; i++) {
-            magnitude[i] *= 0.6f;
+void LcdDisplay::draw_spectrum(float *power_spectrum,int fft_size){
+    if (spectrum_band_sample_rate_ != frame_audio_sample_rate || spectrum_band_width_ != canvas_width_) {
+        UpdateSpectrumBands(frame_audio_sample_rate);
+    }
+    const int bar_max_height=canvas_height_-100;
+    const int bar_width=canvas_width_/spectrum_bars_;
+    const int x_offset=(canvas_width_-bar_width*spectrum_bars_)/2;
+    const int y_pos=canvas_height_-1;
+
+    // 频段内直接累加功率，对数频段的功率和对粉红噪声是平的，不再需要逐条的衰减系数
+    float band_db[SPECTRUM_MAX_BARS];
+    float max_db = -200.0f;
+    for (int i = 0; i < spectrum_bars_; i++) {
+        int end = std::min<int>(spectrum_band_start_[i + 1], fft_size);
+        float power = 0.0f;
+        for (int k = spectrum_band_start_[i]; k < end; k++) {
+            power += power_spectrum[k];
         }
+        band_db[i] = FastPowerDb(power);
+        max_db = std::max(max_db, band_db[i]);
     }
-    */    
+    spectrum_ref_db_ = std::max({max_db, spectrum_ref_db_ - SPECTRUM_REF_RELEASE_DB, SPECTRUM_REF_FLOOR_DB});
+    const float min_db = spectrum_ref_db_ - SPECTRUM_RANGE_DB;
 
-    for (int bin = 1; bin < bartotal; bin++) {
-        
-        if (magnitude[bin] > 0.0f && max_magnitude > 0.0f) {
-            // 相对dB值：20 * log10(magnitude/ref_level)
-            magnitude[bin] = 20.0f * log10f(magnitude[bin] / max_magnitude+ 1e-10);
-        } else {
-            magnitude[bin] = MIN_DB;
-        }
-        if (magnitude[bin] > max_magnitude) max_magnitude = magnitude[bin];
+    // 只清除并重绘有变化的块，脏区域合并成一个矩形提交，避免 LVGL 的无效区缓冲溢出后整屏刷新
+    lv_area_t dirty = {canvas_width_, canvas_height_, -1, -1};
+    for (int i = 0; i < spectrum_bars_; i++) {
+        float level = std::clamp((band_db[i] - min_db) / SPECTRUM_RANGE_DB, 0.0f, 1.0f);
+        int32_t target = (int32_t)(level * bar_max_height * 256);
+        int32_t& current = spectrum_levels_[i];
+        int32_t coefficient = target > current ? SPECTRUM_ATTACK_Q8 : SPECTRUM_DECAY_Q8;
+        current += (int32_t)(((int64_t)(target - current) * coefficient) >> 8);
+
+        int color=get_bar_color(i * SPECTRUM_MAX_BARS / spectrum_bars_);
+        draw_bar(x_offset+bar_width*i,y_pos,bar_width,current >> 8,color,i,&dirty);
     }
 
-    clearScreen();
-    
-    for (int k = 1; k < bartotal; k++) {  // 跳过直流分量（k=0）
-        x_pos=canvas_width_/bartotal*(k-1);
-        float mag=(magnitude[k] - MIN_DB) / (MAX_DB - MIN_DB);
-        mag = std::max(0.0f, std::min(1.0f, mag));
-        bar_height=int(mag*(bar_max_height));
-        
-        int color=get_bar_color(k);
-        draw_bar(x_pos,y_pos,bar_width,bar_height, color,k-1);
-        //printf("x: %d, y: %d,\n", x_pos, bar_height);
+    if (dirty.x2 >= dirty.x1) {
+        lv_area_t coords;
+        lv_obj_get_coords(canvas_, &coords);
+        lv_area_move(&dirty, coords.x1, coords.y1);
+        lv_obj_invalidate_area(canvas_, &dirty);
     }
+}
 
-    
+// 电平块 j 的最下面一行，块高 block_y_size，向上画
+static int block_bottom(int canvas_height, int j) {
+    return j == 0 ? canvas_height - 1 : canvas_height - j * 6;
 }
 
-void LcdDisplay::draw_bar(int x,int y,int bar_width,int bar_height,uint16_t color,int bar_index){
+void LcdDisplay::draw_bar(int x,int y,int bar_width,int bar_height,uint16_t color,int bar_index,lv_area_t* dirty){
 
     const int block_space=2;
     const int block_x_size=bar_width-block_space;
@@ -1502,6 +1655,8 @@ void LcdDisplay::draw_bar(int x,int y,int bar_width,int bar_height,uint16_t colo
     
     int blocks_per_col=(bar_height/(block_y_size+block_space));
     int start_x=(block_x_size+block_space)/2+x;
+    int blocks=std::max(blocks_per_col,1);
+    int peak_y=-1;
     
     if(current_heights[bar_index]<bar_height) 
     {
@@ -1511,37 +1666,95 @@ void LcdDisplay::draw_bar(int x,int y,int bar_width,int bar_height,uint16_t colo
         int fall_speed=2;
         current_heights[bar_index]=current_heights[bar_index]-fall_speed;
         if(current_heights[bar_index]>(block_y_size+block_space)) 
-        draw_block(start_x,canvas_height_-current_heights[bar_index],block_x_size,block_y_size,color,bar_index);
+        peak_y=canvas_height_-current_heights[bar_index];
 
     }
-   
-    draw_block(start_x,canvas_height_-1,block_x_size,block_y_size,color,bar_index);
 
-    for(int j=1;j<blocks_per_col;j++){
-        
-        int start_y=j*(block_y_size+block_space);
-        draw_block(start_x,canvas_height_-start_y,block_x_size,block_y_size,color,bar_index); 
-        
+    // 变化的行范围：增减的电平块，以及旧的和新的峰值块
+    int top=canvas_height_;
+    int bottom=-1;
+    int old_blocks=drawn_blocks[bar_index];
+    int old_peak_y=drawn_peak_y[bar_index];
+    if(blocks!=old_blocks){
+        top=std::min(top,block_bottom(canvas_height_,std::max(blocks,old_blocks)-1)-block_y_size+1);
+        bottom=std::max(bottom,block_bottom(canvas_height_,std::min(blocks,old_blocks)));
+    }
+    if(peak_y!=old_peak_y){
+        for(int py : {peak_y, old_peak_y}){
+            if(py>=0){
+                top=std::min(top,py-block_y_size+1);
+                bottom=std::max(bottom,py);
+            }
+        }
+    }
+    drawn_blocks[bar_index]=blocks;
+    drawn_peak_y[bar_index]=peak_y;
+    if(bottom<top){
+        return;
+    }
+    top=std::max(top,0);
+    bottom=std::min(bottom,canvas_height_-1);
+
+    // 清除这段后重画落在其中的块
+    draw_block(start_x,bottom,block_x_size,bottom-top+1,COLOR_BLACK,bar_index);
+    for(int j=0;j<blocks;j++){
+        int block_y=block_bottom(canvas_height_,j);
+        if(block_y-block_y_size+1>bottom){
+            continue;
+        }
+        if(block_y<top){
+            break;
+        }
+        int clip_y=std::min(block_y,bottom);
+        int clip_top=std::max(block_y-block_y_size+1,top);
+        draw_block(start_x,clip_y,block_x_size,clip_y-clip_top+1,color,bar_index);
+    }
+    if(peak_y>=0 && peak_y-block_y_size+1<=bottom && peak_y>=top){
+        int clip_y=std::min(peak_y,bottom);
+        int clip_top=std::max(peak_y-block_y_size+1,top);
+        draw_block(start_x,clip_y,block_x_size,clip_y-clip_top+1,color,bar_index);
     }
-    
 
+    dirty->x1=std::min<int32_t>(dirty->x1,start_x);
+    dirty->x2=std::max<int32_t>(dirty->x2,start_x+block_x_size-1);
+    dirty->y1=std::min<int32_t>(dirty->y1,top);
+    dirty->y2=std::max<int32_t>(dirty->y2,bottom);
 }
 
 void LcdDisplay::draw_block(int x,int y,int block_x_size,int block_y_size,uint16_t color,int bar_index){
-    
-    /*
-    for(int dy=0;dy<block_y_size;dy++){
-        for(int dx=0;dx<block_x_size;dx++){
-            canvas_buffer_[(y-dy)*canvas_width_+x+dx]=color;    
-        }   
-    }
-    */
-    for (int row = y; row > y-block_y_size;row--) {
+    fill_canvas(x, y - block_y_size + 1, block_x_size, block_y_size, color);
+}   
+
+#define PPA_FILL_MIN_PIXELS (16 * 1024)
+
+// 填充画布上的矩形，P4 上大块区域交给 PPA，小块仍由 CPU 逐行填充
+void LcdDisplay::fill_canvas(int x, int y, int w, int h, uint16_t color) {
+#if CONFIG_USE_PPA_DISPLAY_ACCEL
+    // PPA 每次都要同步整个画布的 cache，只有大块填充才划算
+    if (ppa_fill_client_ != nullptr && w * h >= PPA_FILL_MIN_PIXELS) {
+        ppa_fill_oper_config_t fill_config = {};
+        fill_config.out.buffer = canvas_buffer_;
+        fill_config.out.buffer_size = canvas_buffer_size_;
+        fill_config.out.pic_w = canvas_width_;
+        fill_config.out.pic_h = canvas_height_;
+        fill_config.out.block_offset_x = x;
+        fill_config.out.block_offset_y = y;
+        fill_config.out.fill_cm = PPA_FILL_COLOR_MODE_RGB565;
+        fill_config.fill_block_w = w;
+        fill_config.fill_block_h = h;
+        fill_config.fill_argb_color.val = 0xFF000000 |
+            ((color & 0xF800) << 8) | ((color & 0x07E0) << 5) | ((color & 0x001F) << 3);
+        fill_config.mode = PPA_TRANS_MODE_BLOCKING;
+        if (ppa_do_fill(ppa_fill_client_, &fill_config) == ESP_OK) {
+            return;
+        }
+    }
+#endif
+    for (int row = y; row < y + h; row++) {
         // 一次绘制一行
-        uint16_t* line_start = &canvas_buffer_[row * canvas_width_ + x];
-        std::fill_n(line_start, block_x_size, color);
+        std::fill_n(&canvas_buffer_[row * canvas_width_ + x], w, color);
     }
-}   
+}
 
 void LcdDisplay::clearScreen() {
    // DisplayLockGuard lock(this);
@@ -1550,7 +1763,12 @@ void LcdDisplay::clearScreen() {
     //    canvas_buffer_[i] = COLOR_BLACK;
     //}
     //lv_obj_invalidate(canvas_);
-    std::fill_n(canvas_buffer_, canvas_width_ * canvas_height_, COLOR_BLACK);
+    if (canvas_buffer_ == nullptr) {
+        return;
+    }
+    fill_canvas(0, 0, canvas_width_, canvas_height_, COLOR_BLACK);
+    memset(drawn_blocks, 0, sizeof(drawn_blocks));
+    memset(drawn_peak_y, -1, sizeof(drawn_peak_y));
 
 }
 
@@ -1571,7 +1789,7 @@ void LcdDisplay::stopFft() {
         
         if (fft_task_handle != nullptr) {
             ESP_LOGW(TAG, "FFT task did not stop gracefully, force deleting");
-            vTaskDelete(fft_task_handle);
+            TaskStacks::GetInstance().Delete(fft_task_handle);
             fft_task_handle = nullptr;
         } else {
             ESP_LOGI(TAG, "FFT display task stopped successfully");
@@ -1583,15 +1801,14 @@ void LcdDisplay::stopFft() {
     
     // 重置FFT状态变量
     fft_data_ready = false;
-    audio_display_last_update = 0;
+    frame_audio_fill = 0;
+    frame_audio_segments = 0;
     
     // 重置频谱条高度
     memset(current_heights, 0, sizeof(current_heights));
     
-    // 重置平均功率谱数据
-    for (int i = 0; i < FFT_SIZE/2; i++) {
-        avg_power_spectrum[i] = -25.0f;
-    }
+    // 任务已经退出，FFT 状态可以释放，下次显示频谱时重新分配
+    ReleaseFft();
     
     // 删除FFT画布对象，让原始UI重新显示
     if (canvas_ != nullptr) {
@@ -1600,16 +1817,18 @@ void LcdDisplay::stopFft() {
         ESP_LOGI(TAG, "FFT canvas deleted");
     }
     
-    // 释放画布缓冲区内存
+    // 画布缓冲区还给显示缓冲池，摄像头预览可以复用
     if (canvas_buffer_ != nullptr) {
-        heap_caps_free(canvas_buffer_);
+        DisplaySurfacePool::GetInstance().Return(canvas_buffer_);
         canvas_buffer_ = nullptr;
-        ESP_LOGI(TAG, "FFT canvas buffer freed");
+        ESP_LOGI(TAG, "FFT canvas buffer returned");
     }
     
     // 重置画布尺寸变量
     canvas_width_ = 0;
     canvas_height_ = 0;
+
+    SetAnimationActive(false);
     
     ESP_LOGI(TAG, "FFT display stopped, original UI restored");
 }
@@ -1655,59 +1874,3 @@ void LcdDisplay::MyUI(){
    
 
 }
-
-
-void LcdDisplay::compute(float* real, float* imag, int n, bool forward) {
-    // 位反转排序
-    int j = 0;
-    for (int i = 0; i < n; i++) {
-        if (j > i) {
-            std::swap(real[i], real[j]);
-            std::swap(imag[i], imag[j]);
-        }
-        
-        int m = n >> 1;
-        while (m >= 1 && j >= m) {
-            j -= m;
-            m >>= 1;
-        }
-        j += m;
-    }
-
-    // FFT计算
-    for (int s = 1; s <= (int)log2(n); s++) {
-        int m = 1 << s;
-        int m2 = m >> 1;
-        float w_real = 1.0f;
-        float w_imag = 0.0f;
-        float angle = (forward ? -2.0f : 2.0f) * M_PI / m;
-        float wm_real = cosf(angle);
-        float wm_imag = sinf(angle);
-        
-        for (int j = 0; j < m2; j++) {
-            for (int k = j; k < n; k += m) {
-                int k2 = k + m2;
-                float t_real = w_real * real[k2] - w_imag * imag[k2];
-                float t_imag = w_real * imag[k2] + w_imag * real[k2];
-                
-                real[k2] = real[k] - t_real;
-                imag[k2] = imag[k] - t_imag;
-                real[k] += t_real;
-                imag[k] += t_imag;
-            }
-            
-            float w_temp = w_real;
-            w_real = w_real * wm_real - w_imag * wm_imag;
-            w_imag = w_temp * wm_imag + w_imag * wm_real;
-        }
-    }
-    
-    // 正向变换需要缩放
-    if (forward) {
-        for (int i = 0; i < n; i++) {
-            real[i] /= n;
-            imag[i] /= n;
-        }
-    }
-    
-}
\ No newline at end of file
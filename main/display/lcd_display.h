@@ -6,6 +6,11 @@
 #include <esp_lcd_panel_io.h>
 #include <esp_lcd_panel_ops.h>
 #include <font_emoji.h>
+#include <dl_fft.h>
+#include "pcm_tap.h"
+#if CONFIG_USE_PPA_DISPLAY_ACCEL
+#include <driver/ppa.h>
+#endif
 
 #include <atomic>
 #include <vector>
@@ -13,6 +18,12 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/event_groups.h>  
+#include <freertos/semphr.h>
+#include <driver/gpio.h>
+
+// 频谱条数的上限，窄屏按 SPECTRUM_MIN_BAR_WIDTH 减少条数
+#define SPECTRUM_MAX_BARS 40
+#define SPECTRUM_MIN_BAR_WIDTH 6
 
 // Theme color structure
 struct ThemeColors {
@@ -27,6 +38,18 @@ struct ThemeColors {
     lv_color_t low_battery;
 };
 
+// Shared styles carrying the theme colors, widgets attach them so a theme switch only updates the styles
+struct ThemeStyles {
+    lv_style_t screen;              // Background and text, also the status bar
+    lv_style_t container;           // Background and border
+    lv_style_t content;             // Chat background and border
+    lv_style_t text;
+    lv_style_t user_bubble;         // Background, border and text of each bubble kind
+    lv_style_t assistant_bubble;
+    lv_style_t system_bubble;
+    lv_style_t low_battery;
+};
+
 
 class LcdDisplay : public Display {
 protected:
@@ -42,13 +65,22 @@ protected:
 
     DisplayFonts fonts_;
     ThemeColors current_theme_;
+    ThemeStyles theme_styles_;
+    bool theme_styles_initialized_ = false;
 
     void SetupUI();
+    // Writes current_theme_ into the shared styles, initializing them the first time
+    void UpdateThemeStyles();
+    void LoadAssetFonts();
+#if CONFIG_USE_WECHAT_MESSAGE_STYLE
+    lv_obj_t* CreateMessageContainer();
+    void SetBubbleStyle(lv_obj_t* bubble, lv_style_t* style);
+#endif
     virtual bool Lock(int timeout_ms = 0) override;
     virtual void Unlock() override;
 
     // FFT 绘制方法
-    void readAudioData();
+    void readAudioData(const PcmTap::Frame& frame);
     
     
   
@@ -65,28 +97,46 @@ protected:
     void create_canvas();
     uint16_t get_bar_color(int x_pos);
     void draw_spectrum(float *power_spectrum,int fft_size);
-    void draw_bar(int x,int y,int bar_width,int bar_height,uint16_t color,int bar_index);
+    void draw_bar(int x,int y,int bar_width,int bar_height,uint16_t color,int bar_index,lv_area_t* dirty);
     void draw_block(int x,int y,int block_x_size,int block_y_size,uint16_t color,int bar_index);
+    void fill_canvas(int x, int y, int w, int h, uint16_t color);
+#if CONFIG_USE_PPA_DISPLAY_ACCEL
+    ppa_client_handle_t ppa_fill_client_ = nullptr;
+    size_t canvas_buffer_size_ = 0;
+#endif
     
     int canvas_width_;
     int canvas_height_;
    
     
-    int16_t* audio_data=nullptr;
-    int16_t* frame_audio_data=nullptr;
+    int16_t* frame_audio_data=nullptr;     // 最近 FFT_SIZE 个样本，按 HOP_SIZE 滑动
     uint32_t last_fft_update = 0;
     bool fft_data_ready = false;
     float* spectrum_data=nullptr;
 
     // FFT 相关变量
-    int audio_display_last_update = 0;
+    size_t frame_audio_fill = 0;
+    int frame_audio_segments = 0;
+    int frame_audio_sample_rate = 0;
     std::atomic<bool> fft_task_should_stop = false;  // FFT任务停止标志
     TaskHandle_t fft_task_handle = nullptr;          // FFT任务句柄
 
-    float* fft_real;
-    float* fft_imag;
-    float* hanning_window_float;
-    void compute(float* real, float* imag, int n, bool forward);
+    dl_fft_f32_t* fft_handle_ = nullptr;
+    float* fft_real = nullptr;
+    float* hanning_window_float = nullptr;
+    float* avg_power_spectrum = nullptr;
+    // 每个频谱条对应的 FFT 频点范围 [start[i], start[i + 1])，按对数频率划分，采样率或画布宽度变化时重新计算
+    uint16_t spectrum_band_start_[SPECTRUM_MAX_BARS + 1] = {0};
+    int spectrum_bars_ = 0;
+    int spectrum_band_sample_rate_ = 0;
+    int spectrum_band_width_ = 0;
+    // 平滑后的条高，Q8 像素
+    int32_t spectrum_levels_[SPECTRUM_MAX_BARS] = {0};
+    // 显示范围的上端，跟随最响的频段，快升慢降
+    float spectrum_ref_db_ = 0.0f;
+    void UpdateSpectrumBands(int sample_rate);
+    bool InitializeFft();
+    void ReleaseFft();
     
     // 添加缺少的方法声明
     void drawSpectrumIfReady();
@@ -103,9 +153,12 @@ public:
     virtual void SetEmotion(const char* emotion) override;
     virtual void SetIcon(const char* icon) override;
     virtual void SetMusicInfo(const char* song_name) override;
+    virtual void SetMusicCover(const lv_img_dsc_t* image) override;
+    virtual int GetMusicCoverSize() override;
     virtual void SetPreviewImage(const lv_img_dsc_t* img_dsc) override;
 #if CONFIG_USE_WECHAT_MESSAGE_STYLE
     virtual void SetChatMessage(const char* role, const char* content) override; 
+    virtual void AppendChatMessage(const char* role, const char* content) override;
 #endif  
 
     // Add theme switching function
@@ -139,15 +192,45 @@ public:
                   int width, int height, int offset_x, int offset_y,
                   bool mirror_x, bool mirror_y, bool swap_xy,
                   DisplayFonts fonts);
+
+protected:
+    // max_lines / min_lines: LVGL 条带高度的上下限，line_align: 条带高度取整的行数
+    SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
+                  int width, int height, int offset_x, int offset_y,
+                  bool mirror_x, bool mirror_y, bool swap_xy,
+                  DisplayFonts fonts, int max_lines, int min_lines, int line_align);
+};
+
+// What a QSPI / AMOLED controller needs from the flush path
+struct QspiPanelCaps {
+    // Partial windows start and span a multiple of this many pixels (SH8601/CO5300: 2, SPD2010: 4 in x)
+    uint8_t x_align = 1;
+    uint8_t y_align = 1;
+    // Tearing effect output of the panel, GPIO_NUM_NC when not wired
+    gpio_num_t te_gpio = GPIO_NUM_NC;
 };
 
 // QSPI LCD显示器
-class QspiLcdDisplay : public LcdDisplay {
+// 条带更高，每帧的 QSPI 传输次数更少；按面板要求对齐刷新窗口；接了 TE 时每帧第一个条带等 TE 再发送。
+// 总线 max_transfer_sz 放得下一个条带时每个条带只有一次 DMA 传输，否则 esp_lcd 会拆成多次
+class QspiLcdDisplay : public SpiLcdDisplay {
 public:
     QspiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
                    int width, int height, int offset_x, int offset_y,
                    bool mirror_x, bool mirror_y, bool swap_xy,
-                   DisplayFonts fonts);
+                   DisplayFonts fonts, QspiPanelCaps caps = {});
+    virtual ~QspiLcdDisplay();
+
+private:
+    static void RounderEventCallback(lv_event_t* e);
+    static void RenderStartEventCallback(lv_event_t* e);
+    static void FlushStartEventCallback(lv_event_t* e);
+    static void TeIsrHandler(void* arg);
+    void InitializeTe();
+
+    QspiPanelCaps caps_;
+    SemaphoreHandle_t te_semaphore_ = nullptr;
+    bool wait_te_ = false;
 };
 
 // MCU8080 LCD显示器
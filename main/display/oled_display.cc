@@ -4,6 +4,7 @@
 
 #include <string>
 #include <algorithm>
+#include <cstring>
 
 #include <esp_log.h>
 #include <esp_err.h>
@@ -11,11 +12,17 @@
 
 #define TAG "OledDisplay"
 
+// SH1106 内部有 132 列，128 列的屏从第 2 列开始
+#define SH1106_COLUMN_OFFSET    2
+#define SH1106_CMD_COLUMN_LOW   0x00
+#define SH1106_CMD_COLUMN_HIGH  0x10
+#define SH1106_CMD_PAGE_ADDR    0xB0
+
 LV_FONT_DECLARE(font_awesome_30_1);
 
 OledDisplay::OledDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
-    int width, int height, bool mirror_x, bool mirror_y, DisplayFonts fonts)
-    : panel_io_(panel_io), panel_(panel), fonts_(fonts) {
+    int width, int height, bool mirror_x, bool mirror_y, DisplayFonts fonts, OledController controller)
+    : panel_io_(panel_io), panel_(panel), controller_(controller), fonts_(fonts) {
     width_ = width;
     height_ = height;
 
@@ -24,6 +31,7 @@ OledDisplay::OledDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handl
     port_cfg.task_priority = 1;
     port_cfg.task_stack = 6144;
     port_cfg.timer_period_ms = 50;
+    port_cfg.task_affinity = DISPLAY_TASK_AFFINITY;
     lvgl_port_init(&port_cfg);
 
     ESP_LOGI(TAG, "Adding OLED display");
@@ -57,6 +65,13 @@ OledDisplay::OledDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handl
         return;
     }
 
+    // 单色屏在 esp_lvgl_port 中只能整屏刷新，这里接管 flush，只把内容变化的页发给屏幕
+    pages_.assign(width_ * height_ / 8, 0);
+    sent_.assign(width_ * height_ / 8, 0);
+    tx_buffer_.resize(width_ * height_ / 8);
+    lv_display_set_user_data(display_, this);
+    lv_display_set_flush_cb(display_, FlushCallback);
+
     if (height_ == 64) {
         SetupUI_128x64();
     } else {
@@ -87,6 +102,107 @@ OledDisplay::~OledDisplay() {
     lvgl_port_deinit();
 }
 
+void OledDisplay::FlushCallback(lv_display_t* disp, const lv_area_t* area, uint8_t* color_map) {
+    auto self = static_cast<OledDisplay*>(lv_display_get_user_data(disp));
+    self->Flush(area, color_map);
+    // I2C 传输是同步的，发送完成后缓冲区即可复用；没有变化时也要通知 LVGL
+    lv_display_flush_ready(disp);
+}
+
+void OledDisplay::Flush(const lv_area_t* area, const uint8_t* color_map) {
+    // 与 esp_lvgl_port 相同的转换：亮色像素对应熄灭的点
+    auto color = reinterpret_cast<const lv_color16_t*>(color_map);
+    for (int y = area->y1; y <= area->y2; y++) {
+        uint8_t* page = &pages_[width_ * (y >> 3)];
+        uint8_t bit = 1 << (y & 7);
+        for (int x = area->x1; x <= area->x2; x++, color++) {
+            if (color->blue > 16) {
+                page[x] &= ~bit;
+            } else {
+                page[x] |= bit;
+            }
+        }
+    }
+
+    // SSD1306 可以一次写入多页的窗口，相邻的脏页合并成一次传输；SH1106 每次只能写一页
+    bool merge = controller_ == kOledControllerSsd1306;
+    int page_count = height_ / 8;
+    int run_first = -1, run_x1 = 0, run_x2 = 0;
+    for (int page = 0; page < page_count; page++) {
+        const uint8_t* now = &pages_[width_ * page];
+        const uint8_t* old = &sent_[width_ * page];
+        int x1 = 0, x2 = width_ - 1;
+        if (sent_valid_) {
+            while (x1 < width_ && now[x1] == old[x1]) {
+                x1++;
+            }
+            while (x2 >= x1 && now[x2] == old[x2]) {
+                x2--;
+            }
+        }
+
+        if (x1 > x2) {
+            if (run_first >= 0) {
+                SendPages(run_first, page - 1, run_x1, run_x2);
+                run_first = -1;
+            }
+            continue;
+        }
+        if (run_first >= 0 && merge) {
+            run_x1 = std::min(run_x1, x1);
+            run_x2 = std::max(run_x2, x2);
+            continue;
+        }
+        if (run_first >= 0) {
+            SendPages(run_first, page - 1, run_x1, run_x2);
+        }
+        run_first = page;
+        run_x1 = x1;
+        run_x2 = x2;
+    }
+    if (run_first >= 0) {
+        SendPages(run_first, page_count - 1, run_x1, run_x2);
+    }
+    sent_valid_ = true;
+}
+
+void OledDisplay::SendPages(int first_page, int last_page, int x1, int x2) {
+    int span = x2 - x1 + 1;
+    esp_err_t ret = ESP_OK;
+
+    if (controller_ == kOledControllerSh1106) {
+        // 驱动的 draw_bitmap 总是发送整屏，这里直接写命令，页地址和列地址合并为一次传输
+        for (int page = first_page; page <= last_page && ret == ESP_OK; page++) {
+            int column = x1 + SH1106_COLUMN_OFFSET;
+            uint8_t params[2] = {
+                static_cast<uint8_t>(SH1106_CMD_COLUMN_LOW | (column & 0x0F)),
+                static_cast<uint8_t>(SH1106_CMD_COLUMN_HIGH | (column >> 4)),
+            };
+            ret = esp_lcd_panel_io_tx_param(panel_io_, SH1106_CMD_PAGE_ADDR | page, params, sizeof(params));
+            if (ret == ESP_OK) {
+                ret = esp_lcd_panel_io_tx_color(panel_io_, -1, &pages_[width_ * page + x1], span);
+            }
+        }
+    } else {
+        const uint8_t* data = &pages_[width_ * first_page];
+        if (span != width_) {
+            uint8_t* out = tx_buffer_.data();
+            for (int page = first_page; page <= last_page; page++, out += span) {
+                memcpy(out, &pages_[width_ * page + x1], span);
+            }
+            data = tx_buffer_.data();
+        }
+        ret = esp_lcd_panel_draw_bitmap(panel_, x1, first_page * 8, x2 + 1, (last_page + 1) * 8, data);
+    }
+
+    if (ret != ESP_OK) {
+        // 下次刷新时重新发送
+        ESP_LOGE(TAG, "Failed to send pages %d-%d: %s", first_page, last_page, esp_err_to_name(ret));
+        return;
+    }
+    memcpy(&sent_[width_ * first_page], &pages_[width_ * first_page], width_ * (last_page - first_page + 1));
+}
+
 bool OledDisplay::Lock(int timeout_ms) {
     return lvgl_port_lock(timeout_ms);
 }
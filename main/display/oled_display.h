@@ -6,10 +6,24 @@
 #include <esp_lcd_panel_io.h>
 #include <esp_lcd_panel_ops.h>
 
+#include <vector>
+
+enum OledController {
+    kOledControllerSsd1306,
+    kOledControllerSh1106,
+};
+
 class OledDisplay : public Display {
 private:
     esp_lcd_panel_io_handle_t panel_io_ = nullptr;
     esp_lcd_panel_handle_t panel_ = nullptr;
+    OledController controller_;
+
+    // 按页（8 行）存放的帧数据，与上次发送的内容对比，只发送变化的页
+    std::vector<uint8_t> pages_;
+    std::vector<uint8_t> sent_;
+    std::vector<uint8_t> tx_buffer_;
+    bool sent_valid_ = false;
 
     lv_obj_t* status_bar_ = nullptr;
     lv_obj_t* content_ = nullptr;
@@ -23,12 +37,16 @@ private:
     virtual bool Lock(int timeout_ms = 0) override;
     virtual void Unlock() override;
 
+    static void FlushCallback(lv_display_t* disp, const lv_area_t* area, uint8_t* color_map);
+    void Flush(const lv_area_t* area, const uint8_t* color_map);
+    void SendPages(int first_page, int last_page, int x1, int x2);
+
     void SetupUI_128x64();
     void SetupUI_128x32();
 
 public:
     OledDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel, int width, int height, bool mirror_x, bool mirror_y,
-                DisplayFonts fonts);
+                DisplayFonts fonts, OledController controller = kOledControllerSsd1306);
     ~OledDisplay();
 
     virtual void SetChatMessage(const char* role, const char* content) override;
@@ -0,0 +1,135 @@
+#include "hot_log.h"
+
+#include <esp_timer.h>
+#include <freertos/task.h>
+#include <cstdio>
+#include <string>
+
+#define TAG "HotLog"
+
+HotLog::HotLog() {
+    ring_ = xRingbufferCreate(CONFIG_HOT_LOG_BUFFER_SIZE, RINGBUF_TYPE_NOSPLIT);
+    if (ring_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create the log ring");
+        return;
+    }
+    xTaskCreate([](void* arg) {
+        static_cast<HotLog*>(arg)->DrainTask();
+        vTaskDelete(NULL);
+    }, "hot_log", 3072, this, 1, nullptr);
+}
+
+// 同一调用点一般只在一个任务里执行，计数不加锁，偶尔少算一次无所谓
+bool HotLog::Admit(HotLogSite& site, uint32_t* suppressed) {
+    int64_t now_us = esp_timer_get_time();
+    if (site.last_us != 0 && now_us - site.last_us < CONFIG_HOT_LOG_INTERVAL_MS * 1000LL) {
+        site.suppressed++;
+        return false;
+    }
+    site.last_us = now_us;
+    *suppressed = site.suppressed;
+    site.suppressed = 0;
+    return true;
+}
+
+void HotLog::Push(const uint8_t* record, size_t size) {
+    if (ring_ == nullptr || xRingbufferSend(ring_, record, size, 0) != pdTRUE) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void HotLog::DrainTask() {
+    while (true) {
+        size_t size = 0;
+        auto record = static_cast<const Record*>(xRingbufferReceive(ring_, &size, portMAX_DELAY));
+        if (record == nullptr) {
+            continue;
+        }
+        Print(record, size);
+        vRingbufferReturnItem(ring_, (void*)record);
+
+        uint32_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0) {
+            ESP_LOGW(TAG, "%lu records dropped, the log ring was full", (unsigned long)dropped);
+        }
+    }
+}
+
+// 逐个转换说明符格式化，整数统一按 long long 输出，长度修饰符去掉
+void HotLog::Print(const Record* record, size_t size) {
+    const uint8_t* arg = record->data;
+    const uint8_t* end = reinterpret_cast<const uint8_t*>(record) + size;
+    const char* p = record->format;
+    std::string text;
+    char piece[96];
+    while (*p != '\0') {
+        if (*p != '%') {
+            text.push_back(*p++);
+            continue;
+        }
+        if (p[1] == '%') {
+            text.push_back('%');
+            p += 2;
+            continue;
+        }
+        char spec[16];
+        size_t spec_length = 0;
+        spec[spec_length++] = *p++;
+        while (*p != '\0' && strchr("-+ #0123456789.", *p) != nullptr && spec_length < sizeof(spec) - 4) {
+            spec[spec_length++] = *p++;
+        }
+        while (*p != '\0' && strchr("hlLqjzt", *p) != nullptr) {
+            p++;
+        }
+        char conversion = *p;
+        if (conversion == '\0') {
+            break;
+        }
+        p++;
+
+        if (arg >= end) {
+            text.append("?");
+            continue;
+        }
+        uint8_t type = *arg++;
+        piece[0] = '\0';
+        if (type == kArgString) {
+            size_t length = *arg++;
+            spec[spec_length++] = 's';
+            spec[spec_length] = '\0';
+            snprintf(piece, sizeof(piece), spec, reinterpret_cast<const char*>(arg));
+            arg += length + 1;
+        } else {
+            int64_t int_value;
+            double double_value;
+            memcpy(&int_value, arg, sizeof(int_value));
+            memcpy(&double_value, arg, sizeof(double_value));
+            arg += sizeof(int64_t);
+            if (type == kArgDouble) {
+                spec[spec_length++] = strchr("fFeEgGaA", conversion) != nullptr ? conversion : 'f';
+                spec[spec_length] = '\0';
+                snprintf(piece, sizeof(piece), spec, double_value);
+            } else if (type == kArgPointer || conversion == 'p') {
+                spec[spec_length++] = 'p';
+                spec[spec_length] = '\0';
+                snprintf(piece, sizeof(piece), spec, (void*)(uintptr_t)int_value);
+            } else if (conversion == 'c') {
+                spec[spec_length++] = 'c';
+                spec[spec_length] = '\0';
+                snprintf(piece, sizeof(piece), spec, (int)int_value);
+            } else {
+                spec[spec_length++] = 'l';
+                spec[spec_length++] = 'l';
+                spec[spec_length++] = strchr("diouxX", conversion) != nullptr ? conversion : 'd';
+                spec[spec_length] = '\0';
+                snprintf(piece, sizeof(piece), spec, (long long)int_value);
+            }
+        }
+        text.append(piece);
+    }
+    if (record->suppressed > 0) {
+        snprintf(piece, sizeof(piece), " (%lu more suppressed)", (unsigned long)record->suppressed);
+        text.append(piece);
+    }
+    ESP_LOG_LEVEL((esp_log_level_t)record->level, record->tag, "%s", text.c_str());
+}
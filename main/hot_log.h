@@ -0,0 +1,166 @@
+#ifndef _HOT_LOG_H_
+#define _HOT_LOG_H_
+
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/ringbuf.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/*
+ * Logging for per-frame paths (decoders, audio tasks, per-request headers).
+ *
+ * HOT_LOGE/W/I/D compile to nothing above CONFIG_HOT_LOG_LEVEL. An enabled call site logs at most
+ * once per CONFIG_HOT_LOG_INTERVAL_MS and counts what it skipped. The call only copies the arguments
+ * into a ring buffer (strings up to HOT_LOG_MAX_STRING bytes), the low priority drain task formats and
+ * prints them, so a blocking UART no longer stretches the frame. When the ring is full the record is
+ * dropped and counted. The format must be a string literal, %* widths are not supported.
+ */
+
+#define HOT_LOG_MAX_ARGS 8
+#define HOT_LOG_MAX_STRING 48
+#define HOT_LOG_MAX_RECORD 192
+
+struct HotLogSite {
+    int64_t last_us = 0;
+    uint32_t suppressed = 0;    // 上次输出之后被限流的次数
+};
+
+class HotLog {
+public:
+    static HotLog& GetInstance() {
+        static HotLog instance;
+        return instance;
+    }
+    HotLog(const HotLog&) = delete;
+    HotLog& operator=(const HotLog&) = delete;
+
+    template <typename... Args>
+    void Write(HotLogSite& site, esp_log_level_t level, const char* tag, const char* format, Args... args) {
+        static_assert(sizeof...(Args) <= HOT_LOG_MAX_ARGS, "Too many hot log arguments");
+        uint32_t suppressed;
+        if (!Admit(site, &suppressed)) {
+            return;
+        }
+        alignas(Record) uint8_t buffer[HOT_LOG_MAX_RECORD];
+        auto record = reinterpret_cast<Record*>(buffer);
+        record->tag = tag;
+        record->format = format;
+        record->suppressed = suppressed;
+        record->level = level;
+        Encoder encoder = { buffer, offsetof(Record, data), false };
+        (Encode(encoder, args), ...);
+        Push(buffer, encoder.size);
+    }
+
+private:
+    struct Record {
+        const char* tag;
+        const char* format;
+        uint32_t suppressed;
+        uint8_t level;
+        uint8_t data[];     // 参数：类型字节 + 值，字符串带长度字节和结尾的 0
+    };
+
+    enum ArgType : uint8_t {
+        kArgInt = 'i',
+        kArgDouble = 'f',
+        kArgString = 's',
+        kArgPointer = 'p',
+    };
+
+    RingbufHandle_t ring_ = nullptr;
+    std::atomic<uint32_t> dropped_{0};
+
+    HotLog();
+
+    bool Admit(HotLogSite& site, uint32_t* suppressed);
+    void Push(const uint8_t* record, size_t size);
+    void DrainTask();
+    void Print(const Record* record, size_t size);
+
+    struct Encoder {
+        uint8_t* buffer;
+        size_t size;
+        bool full;      // 放不下的参数和它之后的参数都不记录，输出时显示为 ?
+    };
+
+    static void Put(Encoder& encoder, ArgType type, const void* value, size_t value_size) {
+        if (encoder.full || encoder.size + 1 + value_size > HOT_LOG_MAX_RECORD) {
+            encoder.full = true;
+            return;
+        }
+        encoder.buffer[encoder.size++] = type;
+        memcpy(encoder.buffer + encoder.size, value, value_size);
+        encoder.size += value_size;
+    }
+
+    template <typename T>
+    static void Encode(Encoder& encoder, T value) {
+        if constexpr (std::is_integral_v<T> || std::is_enum_v<T>) {
+            int64_t v = static_cast<int64_t>(value);
+            Put(encoder, kArgInt, &v, sizeof(v));
+        } else if constexpr (std::is_floating_point_v<T>) {
+            double v = value;
+            Put(encoder, kArgDouble, &v, sizeof(v));
+        } else if constexpr (std::is_same_v<std::decay_t<std::remove_pointer_t<T>>, char>) {
+            // 类型、长度、内容和结尾的 0，放不下时截短
+            if (encoder.full || encoder.size + 3 > HOT_LOG_MAX_RECORD) {
+                encoder.full = true;
+                return;
+            }
+            const char* s = value != nullptr ? value : "(null)";
+            size_t length = std::min<size_t>(strnlen(s, HOT_LOG_MAX_STRING), HOT_LOG_MAX_RECORD - encoder.size - 3);
+            encoder.buffer[encoder.size++] = kArgString;
+            encoder.buffer[encoder.size++] = length;
+            memcpy(encoder.buffer + encoder.size, s, length);
+            encoder.size += length;
+            encoder.buffer[encoder.size++] = 0;
+        } else {
+            static_assert(std::is_pointer_v<T>, "Unsupported hot log argument");
+            int64_t v = reinterpret_cast<uintptr_t>(value);
+            Put(encoder, kArgPointer, &v, sizeof(v));
+        }
+    }
+};
+
+// 只用于编译期检查格式和参数，不会被调用
+static inline void __attribute__((format(printf, 1, 2))) HotLogCheckFormat(const char* format, ...) {}
+
+#define HOT_LOG_IMPL(level, tag, format, ...) do { \
+    if (false) { HotLogCheckFormat(format, ##__VA_ARGS__); } \
+    static HotLogSite hot_log_site; \
+    HotLog::GetInstance().Write(hot_log_site, level, tag, format, ##__VA_ARGS__); \
+} while (0)
+
+#define HOT_LOG_DISABLED(format, ...) do { \
+    if (false) { HotLogCheckFormat(format, ##__VA_ARGS__); } \
+} while (0)
+
+#if CONFIG_HOT_LOG_LEVEL >= 1
+#define HOT_LOGE(tag, format, ...) HOT_LOG_IMPL(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#else
+#define HOT_LOGE(tag, format, ...) HOT_LOG_DISABLED(format, ##__VA_ARGS__)
+#endif
+#if CONFIG_HOT_LOG_LEVEL >= 2
+#define HOT_LOGW(tag, format, ...) HOT_LOG_IMPL(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#else
+#define HOT_LOGW(tag, format, ...) HOT_LOG_DISABLED(format, ##__VA_ARGS__)
+#endif
+#if CONFIG_HOT_LOG_LEVEL >= 3
+#define HOT_LOGI(tag, format, ...) HOT_LOG_IMPL(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#else
+#define HOT_LOGI(tag, format, ...) HOT_LOG_DISABLED(format, ##__VA_ARGS__)
+#endif
+#if CONFIG_HOT_LOG_LEVEL >= 4
+#define HOT_LOGD(tag, format, ...) HOT_LOG_IMPL(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#else
+#define HOT_LOGD(tag, format, ...) HOT_LOG_DISABLED(format, ##__VA_ARGS__)
+#endif
+
+#endif // _HOT_LOG_H_
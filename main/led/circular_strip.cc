@@ -1,16 +1,30 @@
 #include "circular_strip.h"
 #include "application.h"
+#include "stream_player.h"
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <soc/soc_caps.h>
+#include <algorithm>
+#include <cstdlib>
 
 #define TAG "CircularStrip"
 
 #define BLINK_INFINITE -1
 
+// 低于音频任务，动画只在帧内容变化时才刷新灯带
+#define STRIP_TASK_PRIORITY 1
+#define STRIP_REACTIVE_INTERVAL_MS 20
+#define STRIP_MUSIC_POLL_MS 200
+#define STRIP_DMA_MIN_LEDS 8
+#define STRIP_DMA_BLOCK_SYMBOLS 1024
+
 CircularStrip::CircularStrip(gpio_num_t gpio, uint8_t max_leds) : max_leds_(max_leds) {
     // If the gpio is not connected, you should use NoLed class
     assert(gpio != GPIO_NUM_NC);
 
     colors_.resize(max_leds_);
+    frame_.resize(max_leds_);
+    shown_.resize(max_leds_);
 
     led_strip_config_t strip_config = {};
     strip_config.strip_gpio_num = gpio;
@@ -21,27 +35,34 @@ CircularStrip::CircularStrip(gpio_num_t gpio, uint8_t max_leds) : max_leds_(max_
     led_strip_rmt_config_t rmt_config = {};
     rmt_config.resolution_hz = 10 * 1000 * 1000; // 10MHz
 
-    ESP_ERROR_CHECK(led_strip_new_rmt_device(&strip_config, &rmt_config, &led_strip_));
+    esp_err_t err = ESP_FAIL;
+#if SOC_RMT_SUPPORT_DMA
+    // 较长的灯带用 DMA 一次送完整帧，不再每 48 个符号进一次中断补数据；DMA 通道被占用时退回普通模式
+    if (max_leds_ > STRIP_DMA_MIN_LEDS) {
+        rmt_config.mem_block_symbols = STRIP_DMA_BLOCK_SYMBOLS;
+        rmt_config.flags.with_dma = true;
+        err = led_strip_new_rmt_device(&strip_config, &rmt_config, &led_strip_);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "RMT DMA unavailable (%s), using interrupt mode", esp_err_to_name(err));
+            rmt_config.mem_block_symbols = 0;
+            rmt_config.flags.with_dma = false;
+        }
+    }
+#endif
+    if (err != ESP_OK) {
+        ESP_ERROR_CHECK(led_strip_new_rmt_device(&strip_config, &rmt_config, &led_strip_));
+    }
     led_strip_clear(led_strip_);
 
-    esp_timer_create_args_t strip_timer_args = {
-        .callback = [](void *arg) {
-            auto strip = static_cast<CircularStrip*>(arg);
-            std::lock_guard<std::mutex> lock(strip->mutex_);
-            if (strip->strip_callback_ != nullptr) {
-                strip->strip_callback_();
-            }
-        },
-        .arg = this,
-        .dispatch_method = ESP_TIMER_TASK,
-        .name = "strip_timer",
-        .skip_unhandled_events = false,
-    };
-    ESP_ERROR_CHECK(esp_timer_create(&strip_timer_args, &strip_timer_));
+    xTaskCreate([](void* arg) {
+        static_cast<CircularStrip*>(arg)->RenderTask();
+    }, "led_strip", 3072, this, STRIP_TASK_PRIORITY, &render_task_);
 }
 
 CircularStrip::~CircularStrip() {
-    esp_timer_stop(strip_timer_);
+    if (render_task_ != nullptr) {
+        vTaskDelete(render_task_);
+    }
     if (led_strip_ != nullptr) {
         led_strip_del(led_strip_);
     }
@@ -49,131 +70,188 @@ CircularStrip::~CircularStrip() {
 
 
 void CircularStrip::SetAllColor(StripColor color) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    esp_timer_stop(strip_timer_);
-    for (int i = 0; i < max_leds_; i++) {
-        colors_[i] = color;
-        led_strip_set_pixel(led_strip_, i, color.red, color.green, color.blue);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (int i = 0; i < max_leds_; i++) {
+            colors_[i] = color;
+        }
     }
-    led_strip_refresh(led_strip_);
+    StartEffect(Effect::kStatic, 0);
 }
 
 void CircularStrip::SetSingleColor(uint8_t index, StripColor color) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    esp_timer_stop(strip_timer_);
-    colors_[index] = color;
-    led_strip_set_pixel(led_strip_, index, color.red, color.green, color.blue);
-    led_strip_refresh(led_strip_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        colors_[index] = color;
+    }
+    StartEffect(Effect::kStatic, 0);
 }
 
 void CircularStrip::Blink(StripColor color, int interval_ms) {
-    for (int i = 0; i < max_leds_; i++) {
-        colors_[i] = color;
-    }
-    StartStripTask(interval_ms, [this]() {
-        static bool on = true;
-        if (on) {
-            for (int i = 0; i < max_leds_; i++) {
-                led_strip_set_pixel(led_strip_, i, colors_[i].red, colors_[i].green, colors_[i].blue);
-            }
-            led_strip_refresh(led_strip_);
-        } else {
-            led_strip_clear(led_strip_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (int i = 0; i < max_leds_; i++) {
+            colors_[i] = color;
         }
-        on = !on;
-    });
+    }
+    StartEffect(Effect::kBlink, interval_ms);
 }
 
 void CircularStrip::FadeOut(int interval_ms) {
-    StartStripTask(interval_ms, [this]() {
-        bool all_off = true;
-        for (int i = 0; i < max_leds_; i++) {
-            colors_[i].red /= 2;
-            colors_[i].green /= 2;
-            colors_[i].blue /= 2;
-            if (colors_[i].red != 0 || colors_[i].green != 0 || colors_[i].blue != 0) {
-                all_off = false;
-            }
-            led_strip_set_pixel(led_strip_, i, colors_[i].red, colors_[i].green, colors_[i].blue);
-        }
-        if (all_off) {
-            led_strip_clear(led_strip_);
-            esp_timer_stop(strip_timer_);
-        } else {
-            led_strip_refresh(led_strip_);
-        }
-    });
+    StartEffect(Effect::kFadeOut, interval_ms);
 }
 
 void CircularStrip::Breathe(StripColor low, StripColor high, int interval_ms) {
-    StartStripTask(interval_ms, [this, low, high]() {
-        static bool increase = true;
-        static StripColor color = low;
-        if (increase) {
-            if (color.red < high.red) {
-                color.red++;
-            }
-            if (color.green < high.green) {
-                color.green++;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        low_ = low;
+        high_ = high;
+    }
+    StartEffect(Effect::kBreathe, interval_ms);
+}
+
+void CircularStrip::Scroll(StripColor low, StripColor high, int length, int interval_ms) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        low_ = low;
+        high_ = high;
+        length_ = length;
+    }
+    StartEffect(Effect::kScroll, interval_ms);
+}
+
+void CircularStrip::StartEffect(Effect effect, int interval_ms) {
+    if (led_strip_ == nullptr) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        effect_ = effect;
+        interval_ms_ = interval_ms;
+        effect_start_ms_ = esp_timer_get_time() / 1000;
+    }
+    xTaskNotifyGive(render_task_);
+}
+
+static uint8_t BreatheChannel(uint8_t low, uint8_t high, int64_t step, int span) {
+    // 和逐步加减一样：上升时各通道各自加到 high，全部到顶后再各自减回 low
+    if (step <= span) {
+        return std::min<int>(low + step, std::max(low, high));
+    }
+    return std::max<int>(high - (step - span), std::min(low, high));
+}
+
+// 按效果的开始时间算出当前一帧，返回距离下一次需要重画的毫秒数，-1 表示等到效果改变
+int CircularStrip::RenderFrame(int64_t now_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t elapsed_ms = now_ms - effect_start_ms_;
+    int64_t step = interval_ms_ > 0 ? elapsed_ms / interval_ms_ : 0;
+    int next_ms = interval_ms_ > 0 ? interval_ms_ - elapsed_ms % interval_ms_ : -1;
+    auto wake = [&next_ms](int ms) {
+        if (next_ms < 0 || ms < next_ms) {
+            next_ms = ms;
+        }
+    };
+
+    switch (effect_) {
+        case Effect::kStatic:
+            frame_ = colors_;
+            next_ms = -1;
+            break;
+        case Effect::kBlink:
+            for (int i = 0; i < max_leds_; i++) {
+                frame_[i] = step % 2 == 0 ? colors_[i] : StripColor{};
             }
-            if (color.blue < high.blue) {
-                color.blue++;
+            break;
+        case Effect::kFadeOut: {
+            // 每一步亮度减半，8 步后一定全灭
+            int shift = std::min<int64_t>(step, 8);
+            for (int i = 0; i < max_leds_; i++) {
+                frame_[i] = { (uint8_t)(colors_[i].red >> shift), (uint8_t)(colors_[i].green >> shift),
+                              (uint8_t)(colors_[i].blue >> shift) };
             }
-            if (color.red == high.red && color.green == high.green && color.blue == high.blue) {
-                increase = false;
+            if (shift == 8) {
+                colors_ = frame_;
+                effect_ = Effect::kStatic;
+                next_ms = -1;
             }
-        } else {
-            if (color.red > low.red) {
-                color.red--;
+            break;
+        }
+        case Effect::kBreathe: {
+            int span = std::max({ std::abs(high_.red - low_.red), std::abs(high_.green - low_.green),
+                                  std::abs(high_.blue - low_.blue), 1 });
+            int64_t phase = step % (2 * span);
+            StripColor color = { BreatheChannel(low_.red, high_.red, phase, span),
+                                 BreatheChannel(low_.green, high_.green, phase, span),
+                                 BreatheChannel(low_.blue, high_.blue, phase, span) };
+            for (int i = 0; i < max_leds_; i++) {
+                frame_[i] = color;
             }
-            if (color.green > low.green) {
-                color.green--;
+            break;
+        }
+        case Effect::kScroll: {
+            int offset = step % max_leds_;
+            for (int i = 0; i < max_leds_; i++) {
+                frame_[i] = low_;
             }
-            if (color.blue > low.blue) {
-                color.blue--;
+            for (int j = 0; j < length_; j++) {
+                frame_[(offset + j) % max_leds_] = high_;
             }
-            if (color.red == low.red && color.green == low.green && color.blue == low.blue) {
-                increase = true;
+            break;
+        }
+    }
+
+    // 叠加实时反应：聆听时检测到人声变亮，待机播放音乐时跟着节拍闪
+    auto& app = Application::GetInstance();
+    auto device_state = app.GetDeviceState();
+    if (device_state == kDeviceStateListening) {
+        if (app.IsVoiceDetected()) {
+            for (auto& color : frame_) {
+                color = { (uint8_t)std::min(color.red * 2, 255), (uint8_t)std::min(color.green * 2, 255),
+                          (uint8_t)std::min(color.blue * 2, 255) };
             }
         }
-        for (int i = 0; i < max_leds_; i++) {
-            led_strip_set_pixel(led_strip_, i, color.red, color.green, color.blue);
+        wake(STRIP_REACTIVE_INTERVAL_MS);
+    } else if (device_state == kDeviceStateIdle) {
+        int beat_ms;
+        int64_t next_beat_ms;
+        if (StreamPlayer::GetInstance().beat_tracker().GetBeat(&beat_ms, &next_beat_ms)) {
+            // 拍点上最亮，按平方衰减到下一拍
+            int remaining = std::clamp<int>(next_beat_ms - now_ms, 0, beat_ms);
+            int level = low_brightness_ + (default_brightness_ - low_brightness_) * remaining * remaining / (beat_ms * beat_ms);
+            StripColor pulse = { (uint8_t)low_brightness_, (uint8_t)low_brightness_, (uint8_t)level };
+            for (auto& color : frame_) {
+                color = { std::max(color.red, pulse.red), std::max(color.green, pulse.green),
+                          std::max(color.blue, pulse.blue) };
+            }
+            wake(STRIP_REACTIVE_INTERVAL_MS);
+        } else {
+            wake(STRIP_MUSIC_POLL_MS);
         }
-        led_strip_refresh(led_strip_);
-    });
+    }
+    return next_ms;
 }
 
-void CircularStrip::Scroll(StripColor low, StripColor high, int length, int interval_ms) {
-    for (int i = 0; i < max_leds_; i++) {
-        colors_[i] = low;
-    }
-    StartStripTask(interval_ms, [this, low, high, length]() {
-        static int offset = 0;
+void CircularStrip::RenderTask() {
+    while (true) {
+        int next_ms = RenderFrame(esp_timer_get_time() / 1000);
+
+        bool changed = false;
         for (int i = 0; i < max_leds_; i++) {
-            colors_[i] = low;
-        }
-        for (int j = 0; j < length; j++) {
-            int i = (offset + j) % max_leds_;
-            colors_[i] = high;
+            auto& color = frame_[i];
+            if (color.red != shown_[i].red || color.green != shown_[i].green || color.blue != shown_[i].blue) {
+                led_strip_set_pixel(led_strip_, i, color.red, color.green, color.blue);
+                shown_[i] = color;
+                changed = true;
+            }
         }
-        for (int i = 0; i < max_leds_; i++) {
-            led_strip_set_pixel(led_strip_, i, colors_[i].red, colors_[i].green, colors_[i].blue);
+        if (changed) {
+            led_strip_refresh(led_strip_);
         }
-        led_strip_refresh(led_strip_);
-        offset = (offset + 1) % max_leds_;
-    });
-}
 
-void CircularStrip::StartStripTask(int interval_ms, std::function<void()> cb) {
-    if (led_strip_ == nullptr) {
-        return;
+        TickType_t wait = next_ms < 0 ? portMAX_DELAY : std::max<TickType_t>(1, pdMS_TO_TICKS(next_ms));
+        ulTaskNotifyTake(pdTRUE, wait);
     }
-
-    std::lock_guard<std::mutex> lock(mutex_);
-    esp_timer_stop(strip_timer_);
-    
-    strip_callback_ = cb;
-    esp_timer_start_periodic(strip_timer_, interval_ms * 1000);
 }
 
 void CircularStrip::SetBrightness(uint8_t default_brightness, uint8_t low_brightness) {
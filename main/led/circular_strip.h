@@ -4,7 +4,8 @@
 #include "led.h"
 #include <driver/gpio.h>
 #include <led_strip.h>
-#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include <atomic>
 #include <mutex>
 #include <vector>
@@ -30,20 +31,36 @@ public:
     void Scroll(StripColor low, StripColor high, int length, int interval_ms);
 
 private:
+    enum class Effect {
+        kStatic,
+        kBlink,
+        kFadeOut,
+        kBreathe,
+        kScroll,
+    };
+
     std::mutex mutex_;
-    TaskHandle_t blink_task_ = nullptr;
+    TaskHandle_t render_task_ = nullptr;
     led_strip_handle_t led_strip_ = nullptr;
     int max_leds_ = 0;
+    // 效果参数由 mutex_ 保护，每一帧都由渲染任务根据开始时间重新算出，不在回调里累积状态
     std::vector<StripColor> colors_;
-    int blink_counter_ = 0;
-    int blink_interval_ms_ = 0;
-    esp_timer_handle_t strip_timer_ = nullptr;
-    std::function<void()> strip_callback_ = nullptr;
+    Effect effect_ = Effect::kStatic;
+    StripColor low_, high_;
+    int length_ = 0;
+    int interval_ms_ = 0;
+    int64_t effect_start_ms_ = 0;
+
+    // 只由渲染任务访问，和已经送出的一帧相同时不再刷新
+    std::vector<StripColor> frame_;
+    std::vector<StripColor> shown_;
 
     uint8_t default_brightness_ = DEFAULT_BRIGHTNESS;
     uint8_t low_brightness_ = LOW_BRIGHTNESS;
 
-    void StartStripTask(int interval_ms, std::function<void()> cb);
+    void StartEffect(Effect effect, int interval_ms);
+    void RenderTask();
+    int RenderFrame(int64_t now_ms);
     void Rainbow(StripColor low, StripColor high, int interval_ms);
     void FadeOut(int interval_ms);
 };
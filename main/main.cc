@@ -7,11 +7,19 @@
 
 #include "application.h"
 #include "system_info.h"
+#include "benchmark.h"
+#include "black_box.h"
+#include "memory_guard.h"
 
 #define TAG "main"
 
 extern "C" void app_main(void)
 {
+    // First, so the trace left by the previous boot is kept and allocation failures are caught from here on
+    BlackBox::GetInstance().Initialize();
+    // Take the reserves while the heap is still in one piece
+    MemoryGuard::GetInstance().Initialize();
+
     // Initialize the default event loop
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
@@ -24,6 +32,13 @@ extern "C" void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
 
+#if CONFIG_BENCHMARK_ON_BOOT
+    // Nothing else is running yet, so the numbers are repeatable
+    auto results = Benchmark::RunCoreSuite();
+    Benchmark::Log(results);
+    ESP_LOGI(TAG, "Benchmark: %s", Benchmark::ToJson(results).c_str());
+#endif
+
     // Launch the application
     auto& app = Application::GetInstance();
     app.Start();
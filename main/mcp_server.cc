@@ -9,16 +9,43 @@
  #include <algorithm>
  #include <cstring>
  #include <cctype>
- #include <esp_pthread.h>
+ #include <freertos/task.h>
  
  #include "application.h"
  #include "display.h"
  #include "board.h"
+ #include "system_metrics.h"
+ #include "task_stack.h"
+ #include "black_box.h"
+ #include "power_policy.h"
+ #include "memory_guard.h"
+ #include "benchmark.h"
+ #include "audio/cache_profiler.h"
+ #include "audio/model_manager.h"
  #include "boards/common/esp32_music.h"
+ #include "boards/common/esp32_sing.h"
+ #include "boards/common/song_cache.h"
+#if CONFIG_SESSION_RECORDER
+ #include "settings.h"
+ #include "protocols/replay_protocol.h"
+#endif
+#if CONFIG_SOAK_TEST
+ #include "soak_test.h"
+#endif
  
  #define TAG "MCP"
  
  #define DEFAULT_TOOLCALL_STACK_SIZE 6144
+ #define MCP_TOOLCALL_QUEUE_SIZE 4
+ // 设备自己发起的调用没有 JSON-RPC 请求，用这个 id 代替，结果不回复
+ #define MCP_LOCAL_CALL_ID -1
+ #define MCP_LOCAL_CALL_NOTICE_MAX 8
+ 
+ static const int kToolCallStackSizes[kMcpToolStackCount] = { 4096, DEFAULT_TOOLCALL_STACK_SIZE, 10240 };
+ static const char* const kToolCallTaskNames[kMcpToolStackCount] = { "tool_call_s", "tool_call", "tool_call_l" };
+ 
+ // 当前任务正在执行的工具调用，供工具回调上报进度和检查取消
+ static thread_local void* current_tool_call = nullptr;
  
  McpServer::McpServer() {
  }
@@ -56,7 +83,244 @@
              auto codec = board.GetAudioCodec();
              codec->SetOutputVolume(properties["volume"].value<int>());
              return true;
+         }, kMcpToolStackSmall);
+
+     AddTool("self.audio_speaker.set_sound_profile",
+         "Shape the loudness of the speaker output.\n"
+         "Args:\n"
+         "  `eq`: `flat` (unchanged), `small_speaker` (cut the bass a small speaker cannot play, louder and clearer) or `voice` (speech band only).\n"
+         "  `limiter`: Make quiet parts louder and keep peaks from distorting.",
+         PropertyList({
+             Property("eq", kPropertyTypeString, "flat"),
+             Property("limiter", kPropertyTypeBoolean, false)
+         }),
+         [&board](const PropertyList& properties) -> ReturnValue {
+             auto eq = properties["eq"].value<std::string>();
+             AudioEqProfile profile = kAudioEqFlat;
+             if (eq == "small_speaker") {
+                 profile = kAudioEqSmallSpeaker;
+             } else if (eq == "voice") {
+                 profile = kAudioEqVoice;
+             } else if (eq != "flat") {
+                 return "{\"success\": false, \"message\": \"Invalid eq profile\"}";
+             }
+             auto codec = board.GetAudioCodec();
+             codec->SetEqProfile(profile);
+             codec->SetLimiter(properties["limiter"].value<bool>());
+             return true;
+         }, kMcpToolStackSmall);
+
+     AddTool("self.audio.get_latency_stats",
+         "Get the p50 / p99 / max latency of every stage of the audio pipeline (processor, encode, send queue, decode, playback, downlink), in milliseconds.\n"
+         "Args:\n"
+         "  `reset`: Clear the statistics after reading them.",
+         PropertyList({
+             Property("reset", kPropertyTypeBoolean, false)
+         }),
+         [](const PropertyList& properties) -> ReturnValue {
+             auto& tracer = Application::GetInstance().GetAudioService().latency_tracer();
+             auto json = tracer.ToJson();
+             if (properties["reset"].value<bool>()) {
+                 tracer.Reset();
+             }
+             return json;
+         });
+
+     AddTool("self.audio.get_models",
+         "List the speech models (wake word, noise suppression, VAD, commands) in the model pack and the partition it comes from, "
+         "the selected wake word model, and the internal RAM / PSRAM each loaded model instance takes.",
+         PropertyList(),
+         [](const PropertyList& properties) -> ReturnValue {
+             return ModelManager::GetInstance().ToJson();
+         });
+
+#if CONFIG_USE_AFE_WAKE_WORD || CONFIG_USE_ESP_WAKE_WORD
+     AddTool("self.audio.set_wake_word_model",
+         "Switch the wake word to another WakeNet model of the model pack (see self.audio.get_models), the choice is kept across restarts. "
+         "`applied` is `now` when it already listens for the new wake word, `after_restart` otherwise.\n"
+         "Args:\n"
+         "  `model`: The model name, e.g. wn9_nihaoxiaozhi_tts",
+         PropertyList({
+             Property("model", kPropertyTypeString)
+         }),
+         [](const PropertyList& properties) -> ReturnValue {
+             bool applied = false;
+             auto model = properties["model"].value<std::string>();
+             if (!Application::GetInstance().GetAudioService().SwitchWakeWordModel(model, &applied)) {
+                 return "{\"success\": false, \"message\": \"Unknown wake word model\"}";
+             }
+             return std::string("{\"success\": true, \"applied\": \"") + (applied ? "now" : "after_restart") + "\"}";
+         });
+#endif
+
+#if CONFIG_AUDIO_CACHE_PROFILE
+     AddTool("self.audio.get_cache_stats",
+         "Get the share of CPU cycles the audio hot paths (input, encode, decode, output, MP3 decode) lose to instruction / data cache misses, "
+         "with their average and maximum time in microseconds. High stalls while the screen is busy explain audio glitches.\n"
+         "Args:\n"
+         "  `reset`: Clear the statistics after reading them.",
+         PropertyList({
+             Property("reset", kPropertyTypeBoolean, false)
+         }),
+         [](const PropertyList& properties) -> ReturnValue {
+             auto& profiler = CacheProfiler::GetInstance();
+             auto json = profiler.ToJson();
+             if (properties["reset"].value<bool>()) {
+                 profiler.Reset();
+             }
+             return json;
+         });
+#endif
+
+     AddTool("self.get_system_metrics",
+         "Get runtime metrics of the device: CPU and free stack of the main tasks, internal / PSRAM heap, counters, "
+         "latency histograms and the heap / CPU history of the last minutes. Use it to diagnose slowness or memory problems.",
+         PropertyList(),
+         [](const PropertyList& properties) -> ReturnValue {
+             return SystemMetrics::GetInstance().ToJson();
+         });
+
+     AddTool("self.get_black_box",
+         "Get the black box trace kept across reboots: state changes, playback underruns, full queues, decode errors, "
+         "allocation failures and task watchdog hits with their time in ms since boot. `boot` is 0 for the current boot, "
+         "-1 for the one before and so on, `reset_reason` is the esp_reset_reason_t of the last reboot. "
+         "Use it to find out what happened before a reboot or stall. Set `clear` to empty the trace after reading.",
+         PropertyList({
+             Property("clear", kPropertyTypeBoolean, false)
+         }),
+         [](const PropertyList& properties) -> ReturnValue {
+             auto& black_box = BlackBox::GetInstance();
+             auto json = black_box.ToJson();
+             if (properties["clear"].value<bool>()) {
+                 black_box.Clear();
+             }
+             return json;
+         });
+
+     AddTool("self.power.set_policy",
+         "Set how the device trades quality for battery runtime. `auto` follows the battery level, "
+         "`saver` lowers the screen refresh rate and brightness and the voice encoding quality, `critical` also caps the CPU frequency, "
+         "`normal` turns the saving off until set back to `auto`. Returns the current policy and battery level.",
+         PropertyList({
+             Property("mode", kPropertyTypeString, "auto")
+         }),
+         [](const PropertyList& properties) -> ReturnValue {
+             auto mode = properties["mode"].value<std::string>();
+             auto& policy = PowerPolicy::GetInstance();
+             if (mode == "auto") {
+                 policy.SetOverride(-1);
+             } else if (mode == "normal") {
+                 policy.SetOverride(kPowerPolicyNormal);
+             } else if (mode == "saver") {
+                 policy.SetOverride(kPowerPolicySaver);
+             } else if (mode == "critical") {
+                 policy.SetOverride(kPowerPolicyCritical);
+             } else {
+                 return "{\"success\": false, \"message\": \"Invalid mode\"}";
+             }
+             return policy.GetStatusJson();
+         });
+
+     AddTool("self.audio.run_loopback_benchmark",
+         "Play a short chirp through the speaker, record it with the microphone and measure the acoustic round trip latency, "
+         "the codec output buffer latency and the per-stage pipeline latencies, in milliseconds. Used to compare boards and firmware builds.\n"
+         "The room should be quiet and the speaker volume not muted.",
+         PropertyList(),
+         [](const PropertyList& properties) -> ReturnValue {
+             return Application::GetInstance().GetAudioService().RunLoopbackBenchmark();
+         });
+
+     AddAsyncTool("self.benchmark.run",
+         "Measure the performance profile of this board: Opus encode / decode, MP3 decode, resampling and FFT time per frame, "
+         "SRAM / PSRAM / flash bandwidth and the time of a full screen render. The profile is saved on the device and used to pick defaults. "
+         "Takes a few seconds, results are less stable while audio is playing.",
+         PropertyList(),
+         [display = board.GetDisplay()](const PropertyList& properties) -> ReturnValue {
+             return Benchmark::RunDeviceSuite(display);
+         });
+
+#if CONFIG_SESSION_RECORDER
+     AddTool("self.session.record",
+         "Start or stop recording the conversations to a file on the device: the server messages and audio and the microphone input, "
+         "with their timing. The recording is replayed with self.session.replay to compare firmware builds on the same traffic. "
+         "Returns the recorder status (records written, records dropped because the storage was too slow).",
+         PropertyList({
+             Property("start", kPropertyTypeBoolean, true)
+         }),
+         [](const PropertyList& properties) -> ReturnValue {
+             auto& recorder = SessionRecorder::GetInstance();
+             if (properties["start"].value<bool>()) {
+                 if (!recorder.Start()) {
+                     return "{\"success\": false, \"message\": \"Failed to start recording\"}";
+                 }
+             } else {
+                 recorder.Stop();
+             }
+             return recorder.ToJson();
+         });
+
+     AddTool("self.session.replay",
+         "Restart the device and play the recorded conversations back instead of connecting to the server. "
+         "`realtime` keeps the recorded timing and microphone input, `fast` sends the audio as fast as the decoder takes it, "
+         "`off` goes back to the server. Each conversation logs a summary when it ends.",
+         PropertyList({
+             Property("mode", kPropertyTypeString)
+         }),
+         [](const PropertyList& properties) -> ReturnValue {
+             auto mode = properties["mode"].value<std::string>();
+             ReplayMode replay_mode;
+             if (mode == "off") {
+                 replay_mode = kReplayModeOff;
+             } else if (mode == "realtime") {
+                 replay_mode = kReplayModeRealtime;
+             } else if (mode == "fast") {
+                 replay_mode = kReplayModeFast;
+             } else {
+                 return "{\"success\": false, \"message\": \"Invalid mode\"}";
+             }
+             Settings settings("session", true);
+             settings.SetInt("replay", replay_mode);
+             Application::GetInstance().Schedule([]() {
+                 Application::GetInstance().Reboot();
+             });
+             return true;
          });
+#endif
+
+#if CONFIG_SOAK_TEST
+     AddTool("self.soak.start",
+         "Start the soak test: the device repeats wake word, a whole conversation, a local sound, music and a camera photo "
+         "in a loop and records heap, CPU, stack and latency metrics over time. Used to find slow regressions between firmware builds. "
+         "Read the report with self.soak.get_report.\n"
+         "Args:\n"
+         "  `cycles`: Number of cycles, 0 runs until stopped.",
+         PropertyList({
+             Property("cycles", kPropertyTypeInteger, 0, 0, 100000)
+         }),
+         [](const PropertyList& properties) -> ReturnValue {
+             if (!SoakTest::GetInstance().Start(properties["cycles"].value<int>())) {
+                 return "{\"success\": false, \"message\": \"The soak test is already running\"}";
+             }
+             return true;
+         });
+
+     AddTool("self.soak.get_report",
+         "Get the soak test report: cycles done, time and failures of every step, first / last / minimum largest free heap block, "
+         "maximum CPU and minimum free stack per task, the p99 of every latency histogram at the start, now and at most, "
+         "and the metric samples over time.\n"
+         "Args:\n"
+         "  `stop`: Stop the soak test after the current step.",
+         PropertyList({
+             Property("stop", kPropertyTypeBoolean, false)
+         }),
+         [](const PropertyList& properties) -> ReturnValue {
+             auto& soak = SoakTest::GetInstance();
+             if (properties["stop"].value<bool>()) {
+                 soak.Stop();
+             }
+             return soak.ToJson();
+         });
+#endif
      
      auto backlight = board.GetBacklight();
      if (backlight) {
@@ -69,7 +333,7 @@
                  uint8_t brightness = static_cast<uint8_t>(properties["brightness"].value<int>());
                  backlight->SetBrightness(brightness, true);
                  return true;
-             });
+             }, kMcpToolStackSmall);
      }
  
      auto display = board.GetDisplay();
@@ -87,27 +351,81 @@
  
      auto camera = board.GetCamera();
      if (camera) {
-         AddTool("self.camera.take_photo",
+         AddAsyncTool("self.camera.take_photo",
              "Take a photo and explain it. Use this tool after the user asks you to see something.\n"
+             "Pick the smallest resolution that answers the question, a smaller photo uploads and answers faster.\n"
              "Args:\n"
              "  `question`: The question that you want to ask about the photo.\n"
+             "  `resolution`: `thumbnail` (160px wide, e.g. is the light on), `low` (320px), `medium` (640px), "
+             "`high` (full sensor resolution, e.g. read small text), or `default`.\n"
+             "  `crop_x`, `crop_y`, `crop_width`, `crop_height`: Region to keep, in percent of the frame, "
+             "e.g. 25, 25, 50, 50 keeps the center.\n"
+             "  `quality`: JPEG quality 1 to 100, 0 for the default.\n"
              "Return:\n"
              "  A JSON object that provides the photo information.",
              PropertyList({
-                 Property("question", kPropertyTypeString)
+                 Property("question", kPropertyTypeString),
+                 Property("resolution", kPropertyTypeString, "default"),
+                 Property("crop_x", kPropertyTypeInteger, 0, 0, 99),
+                 Property("crop_y", kPropertyTypeInteger, 0, 0, 99),
+                 Property("crop_width", kPropertyTypeInteger, 100, 1, 100),
+                 Property("crop_height", kPropertyTypeInteger, 100, 1, 100),
+                 Property("quality", kPropertyTypeInteger, 0, 0, 100)
              }),
              [camera](const PropertyList& properties) -> ReturnValue {
+                 // 各档位上传的最大宽度，high 不缩小
+                 static const std::pair<const char*, int> kResolutions[] = {
+                     {"thumbnail", 160}, {"low", 320}, {"medium", 640}, {"high", 4096},
+                 };
+                 CameraPhotoOptions options;
+                 auto resolution = properties["resolution"].value<std::string>();
+                 for (auto& [name, width] : kResolutions) {
+                     if (resolution == name) {
+                         options.max_width = width;
+                     }
+                 }
+                 options.crop_x = properties["crop_x"].value<int>();
+                 options.crop_y = properties["crop_y"].value<int>();
+                 options.crop_width = properties["crop_width"].value<int>();
+                 options.crop_height = properties["crop_height"].value<int>();
+                 options.quality = properties["quality"].value<int>();
+                 camera->SetPhotoOptions(options);
                  if (!camera->Capture()) {
                      return "{\"success\": false, \"message\": \"Failed to capture photo\"}";
                  }
+                 auto& server = McpServer::GetInstance();
+                 if (server.IsToolCallCancelled()) {
+                     return "{\"success\": false, \"message\": \"Cancelled\"}";
+                 }
+                 server.ReportProgress("Photo captured, uploading it for explanation");
                  auto question = properties["question"].value<std::string>();
                  return camera->Explain(question);
-             });
+             }, nullptr, kMcpToolStackLarge);
+
+         AddTool("self.camera.start_stream",
+             "Start sending low resolution camera frames over the audio channel, so you can keep watching while talking.\n"
+             "Only frames that changed noticeably are sent. The stream stops when the conversation ends.\n"
+             "Args:\n"
+             "  `fps`: Frames per second to sample, 1 to 5.",
+             PropertyList({
+                 Property("fps", kPropertyTypeInteger, 1, 1, 5)
+             }),
+             [camera](const PropertyList& properties) -> ReturnValue {
+                 return camera->StartStreaming(properties["fps"].value<int>());
+             }, kMcpToolStackSmall);
+
+         AddTool("self.camera.stop_stream",
+             "Stop sending camera frames.",
+             PropertyList(),
+             [camera](const PropertyList& properties) -> ReturnValue {
+                 camera->StopStreaming();
+                 return true;
+             }, kMcpToolStackSmall);
      }
  
      auto music = board.GetMusic();
      if (music) {
-         AddTool("self.music.play_song",
+         AddAsyncTool("self.music.play_song",
              "播放指定的歌曲。当用户要求播放音乐时使用此工具，会自动获取歌曲详情并开始流式播放。\n"
              "参数:\n"
              "  `song_name`: 要播放的歌曲名称（必需）。\n"
@@ -122,14 +440,71 @@
                  auto song_name = properties["song_name"].value<std::string>();
                  auto artist_name = properties["artist_name"].value<std::string>();
                  
+                 McpServer::GetInstance().ReportProgress("正在获取歌曲资源");
                  if (!music->Download(song_name, artist_name)) {
                      return "{\"success\": false, \"message\": \"获取音乐资源失败\"}";
                  }
+                 // 取消时可能还在查询歌曲，播放开始后再停一次
+                 if (McpServer::GetInstance().IsToolCallCancelled()) {
+                     music->StopStreaming();
+                     return "{\"success\": false, \"message\": \"已取消\"}";
+                 }
                  auto download_result = music->GetDownloadResult();
                  ESP_LOGI(TAG, "Music details result: %s", download_result.c_str());
                  return "{\"success\": true, \"message\": \"音乐开始播放\"}";
+             }, [music]() {
+                 music->StopStreaming();
              });
  
+         AddTool("self.music.enqueue_song",
+             "把歌曲加入播放列表。用户说‘下一首放…’、‘把…加到播放列表’时使用；当前没有播放时立即开始播放，"
+             "否则在当前歌曲结束后无缝接着播放。\n"
+             "参数:\n"
+             "  `song_name`: 歌曲名称（必需）。\n"
+             "  `artist_name`: 艺术家名称（可选，默认为空字符串）。\n"
+             "返回:\n"
+             "  加入结果和播放列表中等待的歌曲数。",
+             PropertyList({
+                 Property("song_name", kPropertyTypeString),
+                 Property("artist_name", kPropertyTypeString, "")
+             }),
+             [music](const PropertyList& properties) -> ReturnValue {
+                 auto song_name = properties["song_name"].value<std::string>();
+                 auto artist_name = properties["artist_name"].value<std::string>();
+                 auto esp32_music = static_cast<Esp32Music*>(music);
+                 if (!esp32_music->Enqueue(song_name, artist_name)) {
+                     return "{\"success\": false, \"message\": \"获取音乐资源失败\"}";
+                 }
+                 return "{\"success\": true, \"queued\": " + std::to_string(esp32_music->GetPlaylistSize()) + "}";
+             });
+
+         AddTool("self.music.next_song",
+             "切换到播放列表中的下一首歌曲。用户说‘下一首’、‘切歌’时使用。",
+             PropertyList(),
+             [music](const PropertyList& properties) -> ReturnValue {
+                 auto esp32_music = static_cast<Esp32Music*>(music);
+                 if (!esp32_music->Next()) {
+                     return "{\"success\": false, \"message\": \"播放列表为空\"}";
+                 }
+                 return "{\"success\": true, \"message\": \"已切换到下一首\"}";
+             });
+
+         AddTool("self.music.seek",
+             "跳转到当前歌曲的指定位置。用户说‘从第30秒开始放’、‘跳到1分钟’时使用。\n"
+             "参数:\n"
+             "  `position_seconds`: 从歌曲开头算起的秒数。",
+             PropertyList({
+                 Property("position_seconds", kPropertyTypeInteger, 0, 3600)
+             }),
+             [music](const PropertyList& properties) -> ReturnValue {
+                 int position = properties["position_seconds"].value<int>();
+                 auto esp32_music = static_cast<Esp32Music*>(music);
+                 if (!esp32_music->Seek((int64_t)position * 1000)) {
+                     return "{\"success\": false, \"message\": \"当前歌曲不支持跳转\"}";
+                 }
+                 return "{\"success\": true, \"message\": \"已跳转\"}";
+             });
+
          AddTool("self.music.set_display_mode",
              "设置音乐播放时的显示模式。可以选择显示频谱或歌词，比如用户说‘打开频谱’或者‘显示频谱’，‘打开歌词’或者‘显示歌词’就设置对应的显示模式。\n"
              "参数:\n"
@@ -187,28 +562,72 @@
                  ESP_LOGI(TAG, "Sing details result: %s", download_result.c_str());
                  return "{\"success\": true, \"message\": \"歌曲开始播放\"}";
              });
+
+         AddTool("self.sing.set_key_tempo",
+             "调整唱歌的音调和速度，正在唱的歌立即生效，不需要重新下载，之后唱的歌也沿用。用户说升调、降调、唱快点、唱慢点、恢复原调时使用。\n"
+             "参数:\n"
+             "  `key`: 升降的半音数，正数升调，负数降调，0 为原调。\n"
+             "  `tempo`: 速度百分比，100 为原速。",
+             PropertyList({
+                 Property("key", kPropertyTypeInteger, 0, -12, 12),
+                 Property("tempo", kPropertyTypeInteger, 100, 50, 200)
+             }),
+             [sing](const PropertyList& properties) -> ReturnValue {
+                 auto esp32_sing = static_cast<Esp32Sing*>(sing);
+                 bool playing = esp32_sing->SetKeyAndTempo(properties["key"].value<int>(), properties["tempo"].value<int>());
+                 return "{\"success\": true, \"key\": " + std::to_string(esp32_sing->key()) +
+                     ", \"tempo\": " + std::to_string(esp32_sing->tempo_percent()) +
+                     ", \"applied\": \"" + (playing ? "now" : "next_song") + "\"}";
+             });
      }
+#ifdef CONFIG_SONG_CACHE
+     if (music || sing) {
+         AddTool("self.music.clear_cache",
+             "清空设备上缓存的歌曲，之后播放会重新联网下载。只在用户明确要求清理缓存或释放空间时使用。",
+             PropertyList(),
+             [](const PropertyList& properties) -> ReturnValue {
+                 size_t removed = SongCache::GetInstance().Clear();
+                 return "{\"success\": true, \"removed\": " + std::to_string(removed) + "}";
+             });
+     }
+#endif
      // Restore the original tools list to the end of the tools list
      tools_.insert(tools_.end(), original_tools.begin(), original_tools.end());
+     tools_pages_.clear();
  }
  
  void McpServer::AddTool(McpTool* tool) {
      // Prevent adding duplicate tools
-     if (std::find_if(tools_.begin(), tools_.end(), [tool](const McpTool* t) { return t->name() == tool->name(); }) != tools_.end()) {
+     if (!tool_index_.emplace(tool->name(), tool).second) {
          ESP_LOGW(TAG, "Tool %s already added", tool->name().c_str());
          return;
      }
  
      ESP_LOGI(TAG, "Add tool: %s", tool->name().c_str());
      tools_.push_back(tool);
+     tool->json();
+     tools_pages_.clear();
+ }
+ 
+ McpTool* McpServer::FindTool(const std::string& name) const {
+     auto it = tool_index_.find(name);
+     return it != tool_index_.end() ? it->second : nullptr;
  }
  
- void McpServer::AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback) {
-     AddTool(new McpTool(name, description, properties, callback));
+ void McpServer::AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback,
+     McpToolStack stack) {
+     AddTool(new McpTool(name, description, properties, callback, stack));
+ }
+ 
+ void McpServer::AddAsyncTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback,
+     std::function<void()> on_cancel, McpToolStack stack) {
+     auto tool = new McpTool(name, description, properties, callback, stack);
+     tool->SetAsync(on_cancel);
+     AddTool(tool);
  }
  
  void McpServer::ParseMessage(const std::string& message) {
-     cJSON* json = cJSON_Parse(message.c_str());
+     cJSON* json = MemoryGuard::ParseJson(message.c_str());
      if (json == nullptr) {
          ESP_LOGE(TAG, "Failed to parse MCP message: %s", message.c_str());
          return;
@@ -237,6 +656,20 @@
  }
  
  void McpServer::ParseMessage(const cJSON* json) {
+     if (!cJSON_IsArray(json)) {
+         ParseRequest(json, nullptr);
+         return;
+     }
+     // 同一批里不同栈大小的工具在各自的工作任务上并行执行，同一组的按顺序执行
+     auto batch = std::make_shared<Batch>();
+     const cJSON* item = nullptr;
+     cJSON_ArrayForEach(item, json) {
+         ParseRequest(item, batch);
+     }
+     ReleaseBatch(batch);
+ }
+
+ void McpServer::ParseRequest(const cJSON* json, const std::shared_ptr<Batch>& batch) {
      // Check JSONRPC version
      auto version = cJSON_GetObjectItem(json, "jsonrpc");
      if (version == nullptr || !cJSON_IsString(version) || strcmp(version->valuestring, "2.0") != 0) {
@@ -253,6 +686,13 @@
      
      auto method_str = std::string(method->valuestring);
      if (method_str.find("notifications") == 0) {
+         if (method_str == "notifications/cancelled") {
+             auto params = cJSON_GetObjectItem(json, "params");
+             auto request_id = cJSON_GetObjectItem(params, "requestId");
+             if (cJSON_IsNumber(request_id)) {
+                 CancelToolCall(request_id->valueint);
+             }
+         }
          return;
      }
      
@@ -281,7 +721,8 @@
          std::string message = "{\"protocolVersion\":\"2024-11-05\",\"capabilities\":{\"tools\":{}},\"serverInfo\":{\"name\":\"" BOARD_NAME "\",\"version\":\"";
          message += app_desc->version;
          message += "\"}}";
-         ReplyResult(id_int, message);
+         ReplyResult(id_int, message, batch.get());
+         SendLocalCallNotices();
      } else if (method_str == "tools/list") {
          std::string cursor_str = "";
          if (params != nullptr) {
@@ -290,17 +731,17 @@
                  cursor_str = std::string(cursor->valuestring);
              }
          }
-         GetToolsList(id_int, cursor_str);
+         GetToolsList(id_int, cursor_str, batch.get());
      } else if (method_str == "tools/call") {
          if (!cJSON_IsObject(params)) {
              ESP_LOGE(TAG, "tools/call: Missing params");
-             ReplyError(id_int, "Missing params");
+             ReplyError(id_int, "Missing params", batch.get());
              return;
          }
          auto tool_name = cJSON_GetObjectItem(params, "name");
          if (!cJSON_IsString(tool_name)) {
              ESP_LOGE(TAG, "tools/call: Missing name");
-             ReplyError(id_int, "Missing name");
+             ReplyError(id_int, "Missing name", batch.get());
              return;
          }
         auto tool_arguments = cJSON_GetObjectItem(params, "arguments");
@@ -317,12 +758,9 @@
                 args_obj = parsed_args;
             } else {
                 // 回退策略：如果该工具只有一个必需的字符串参数，则将该字符串直接映射到该参数
-                auto tool_iter = std::find_if(tools_.begin(), tools_.end(), 
-                                              [tool_name](const McpTool* tool) { 
-                                                  return tool->name() == std::string(tool_name->valuestring); 
-                                              });
-                if (tool_iter != tools_.end()) {
-                    const auto& props = (*tool_iter)->properties();
+                auto tool = FindTool(tool_name->valuestring);
+                if (tool != nullptr) {
+                    const auto& props = tool->properties();
                     // 统计必需参数数量与类型
                     int required_count = 0;
                     std::string required_string_name;
@@ -343,118 +781,180 @@
                         ESP_LOGW(TAG, "tools/call: Fallback mapped raw string to arg '%s' for tool %s", required_string_name.c_str(), tool_name->valuestring);
                     } else {
                         ESP_LOGE(TAG, "tools/call: Invalid arguments (string not JSON object): %s", tool_arguments->valuestring);
-                        ReplyError(id_int, "Invalid arguments");
+                        ReplyError(id_int, "Invalid arguments", batch.get());
                         if (parsed_args) cJSON_Delete(parsed_args);
                         return;
                     }
                 } else {
                     ESP_LOGE(TAG, "tools/call: Invalid arguments (string not JSON object): %s", tool_arguments->valuestring);
-                    ReplyError(id_int, "Invalid arguments");
+                    ReplyError(id_int, "Invalid arguments", batch.get());
                     if (parsed_args) cJSON_Delete(parsed_args);
                     return;
                 }
             }
         } else {
             ESP_LOGE(TAG, "tools/call: Invalid arguments type");
-            ReplyError(id_int, "Invalid arguments");
+            ReplyError(id_int, "Invalid arguments", batch.get());
             return;
         }
          auto stack_size = cJSON_GetObjectItem(params, "stackSize");
          if (stack_size != nullptr && !cJSON_IsNumber(stack_size)) {
              ESP_LOGE(TAG, "tools/call: Invalid stackSize");
-             ReplyError(id_int, "Invalid stackSize");
+             ReplyError(id_int, "Invalid stackSize", batch.get());
              if (parsed_args) cJSON_Delete(parsed_args);
              return;
          }
-         DoToolCall(id_int, std::string(tool_name->valuestring), args_obj, stack_size ? stack_size->valueint : DEFAULT_TOOLCALL_STACK_SIZE);
+         auto meta = cJSON_GetObjectItem(params, "_meta");
+         auto progress_token = cJSON_IsObject(meta) ? cJSON_GetObjectItem(meta, "progressToken") : nullptr;
+         DoToolCall(id_int, std::string(tool_name->valuestring), args_obj, stack_size ? stack_size->valueint : DEFAULT_TOOLCALL_STACK_SIZE, progress_token,
+             batch);
          if (parsed_args) cJSON_Delete(parsed_args);
      } else {
          ESP_LOGE(TAG, "Method not implemented: %s", method_str.c_str());
-         ReplyError(id_int, "Method not implemented: " + method_str);
+         ReplyError(id_int, "Method not implemented: " + method_str, batch.get());
      }
  }
  
- void McpServer::ReplyResult(int id, const std::string& result) {
-     std::string payload = "{\"jsonrpc\":\"2.0\",\"id\":";
-     payload += std::to_string(id) + ",\"result\":";
-     payload += result;
-     payload += "}";
-     Application::GetInstance().SendMcpMessage(payload);
- }
- 
- void McpServer::ReplyError(int id, const std::string& message) {
-     std::string payload = "{\"jsonrpc\":\"2.0\",\"id\":";
-     payload += std::to_string(id);
-     payload += ",\"error\":{\"message\":\"";
-     payload += message;
-     payload += "\"}}";
-     Application::GetInstance().SendMcpMessage(payload);
- }
- 
- void McpServer::GetToolsList(int id, const std::string& cursor) {
+ void McpServer::SendReply(Batch* batch, const std::function<void(JsonWriter& writer)>& write, size_t size_hint) {
+    if (batch == nullptr) {
+        Application::GetInstance().SendMcpMessage(write, size_hint);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(batch->mutex);
+    if (!batch->responses.empty()) {
+        batch->responses.push_back(',');
+    }
+    JsonWriter writer(batch->responses);
+    write(writer);
+}
+
+// 最后一个回复到达后发送；全是通知时没有回复，按规范什么也不发
+void McpServer::ReleaseBatch(const std::shared_ptr<Batch>& batch) {
+    std::string responses;
+    {
+        std::lock_guard<std::mutex> lock(batch->mutex);
+        if (--batch->pending > 0) {
+            return;
+        }
+        responses.swap(batch->responses);
+    }
+    if (responses.empty()) {
+        return;
+    }
+    Application::GetInstance().SendMcpMessage([&responses](JsonWriter& writer) {
+        writer.Raw("[").Raw(responses).Raw("]");
+    }, responses.size() + 2);
+}
+
+void McpServer::ReplyResult(int id, const std::string& result, Batch* batch) {
+    SendReply(batch, [id, &result](JsonWriter& writer) {
+        writer.Raw("{\"jsonrpc\":\"2.0\",\"id\":").Int(id).Raw(",\"result\":").Raw(result).Raw("}");
+    }, result.size() + 48);
+}
+
+void McpServer::ReplyError(int id, const std::string& message, Batch* batch) {
+    if (id == MCP_LOCAL_CALL_ID) {
+        ESP_LOGW(TAG, "Local tool call failed: %s", message.c_str());
+        return;
+    }
+    SendReply(batch, [id, &message](JsonWriter& writer) {
+        writer.Raw("{\"jsonrpc\":\"2.0\",\"id\":").Int(id).Raw(",\"error\":{\"message\":").String(message).Raw("}}");
+    }, message.size() + 64);
+}
+
+// 工具结果直接写入协议消息，不经过 cJSON
+void McpServer::ReplyToolResult(int id, const ReturnValue& value, Batch* batch) {
+    auto text = std::get_if<std::string>(&value);
+    if (id == MCP_LOCAL_CALL_ID) {
+        ESP_LOGI(TAG, "Local tool call result: %s", text != nullptr ? text->c_str() : "-");
+        return;
+    }
+    SendReply(batch, [id, &value, text](JsonWriter& writer) {
+        writer.Raw("{\"jsonrpc\":\"2.0\",\"id\":").Int(id).Raw(",\"result\":{\"content\":[{\"type\":\"text\",\"text\":");
+        if (text != nullptr) {
+            writer.String(*text);
+        } else if (std::holds_alternative<bool>(value)) {
+            writer.Raw(std::get<bool>(value) ? "\"true\"" : "\"false\"");
+        } else {
+            writer.Raw("\"").Int(std::get<int>(value)).Raw("\"");
+        }
+        writer.Raw("}],\"isError\":false}}");
+    }, (text != nullptr ? text->size() : 0) + 96);
+}
+
+void McpServer::BuildToolsPages() {
      const int max_payload_size = 8000;
-     std::string json = "{\"tools\":[";
-     
-     bool found_cursor = cursor.empty();
+     tools_pages_.clear();
      auto it = tools_.begin();
-     std::string next_cursor = "";
-     
-     while (it != tools_.end()) {
-         // 如果我们还没有找到起始位置，继续搜索
-         if (!found_cursor) {
-             if ((*it)->name() == cursor) {
-                 found_cursor = true;
-             } else {
-                 ++it;
-                 continue;
+     while (true) {
+         ToolsPage page;
+         if (it != tools_.begin()) {
+             page.cursor = (*it)->name();
+         }
+         std::string json = "{\"tools\":[";
+         auto page_start = it;
+         while (it != tools_.end()) {
+             // 添加tool前检查大小
+             auto& tool_json = (*it)->json();
+             if (json.length() + tool_json.length() + 30 > max_payload_size) {
+                 break;
+             }
+             if (it != page_start) {
+                 json += ",";
              }
+             json += tool_json;
+             ++it;
          }
-         
-         // 添加tool前检查大小
-         std::string tool_json = (*it)->to_json() + ",";
-         if (json.length() + tool_json.length() + 30 > max_payload_size) {
-             // 如果添加这个tool会超出大小限制，设置next_cursor并退出循环
-             next_cursor = (*it)->name();
-             break;
+         if (it == page_start && it != tools_.end()) {
+             // 单个工具就超出大小限制，这一页返回错误，后面的页不再生成
+             tools_pages_.push_back(std::move(page));
+             return;
+         }
+         if (it == tools_.end()) {
+             json += "]}";
+         } else {
+             json += "],\"nextCursor\":\"" + (*it)->name() + "\"}";
+         }
+         page.result = std::move(json);
+         tools_pages_.push_back(std::move(page));
+         if (it == tools_.end()) {
+             return;
          }
-         
-         json += tool_json;
-         ++it;
      }
-     
-     if (json.back() == ',') {
-         json.pop_back();
+ }
+ 
+ void McpServer::GetToolsList(int id, const std::string& cursor, Batch* batch) {
+     if (tools_pages_.empty()) {
+         BuildToolsPages();
      }
-     
-     if (json.back() == '[' && !tools_.empty()) {
-         // 如果没有添加任何tool，返回错误
-         ESP_LOGE(TAG, "tools/list: Failed to add tool %s because of payload size limit", next_cursor.c_str());
-         ReplyError(id, "Failed to add tool " + next_cursor + " because of payload size limit");
+ 
+     auto page = std::find_if(tools_pages_.begin(), tools_pages_.end(), [&cursor](const ToolsPage& page) {
+         return page.cursor == cursor;
+     });
+     if (page == tools_pages_.end()) {
+         ESP_LOGE(TAG, "tools/list: Invalid cursor %s", cursor.c_str());
+         ReplyError(id, "Invalid cursor: " + cursor, batch);
          return;
      }
- 
-     if (next_cursor.empty()) {
-         json += "]}";
-     } else {
-         json += "],\"nextCursor\":\"" + next_cursor + "\"}";
+     if (page->result.empty()) {
+         auto& tool_name = page->cursor.empty() ? tools_.front()->name() : page->cursor;
+         ESP_LOGE(TAG, "tools/list: Failed to add tool %s because of payload size limit", tool_name.c_str());
+         ReplyError(id, "Failed to add tool " + tool_name + " because of payload size limit", batch);
+         return;
      }
-     
-     ReplyResult(id, json);
+     ReplyResult(id, page->result, batch);
  }
  
- void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, int stack_size) {
-     auto tool_iter = std::find_if(tools_.begin(), tools_.end(), 
-                                  [&tool_name](const McpTool* tool) { 
-                                      return tool->name() == tool_name; 
-                                  });
-     
-     if (tool_iter == tools_.end()) {
+ void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, int stack_size, const cJSON* progress_token,
+     const std::shared_ptr<Batch>& batch) {
+     auto tool = FindTool(tool_name);
+     if (tool == nullptr) {
          ESP_LOGE(TAG, "tools/call: Unknown tool: %s", tool_name.c_str());
-         ReplyError(id, "Unknown tool: " + tool_name);
+         ReplyError(id, "Unknown tool: " + tool_name, batch.get());
          return;
      }
  
-     PropertyList arguments = (*tool_iter)->properties();
+     PropertyList arguments = tool->properties();
      try {
          for (auto& argument : arguments) {
              bool found = false;
@@ -474,31 +974,208 @@
  
              if (!argument.has_default_value() && !found) {
                  ESP_LOGE(TAG, "tools/call: Missing valid argument: %s", argument.name().c_str());
-                 ReplyError(id, "Missing valid argument: " + argument.name());
+                 ReplyError(id, "Missing valid argument: " + argument.name(), batch.get());
                  return;
              }
          }
      } catch (const std::exception& e) {
          ESP_LOGE(TAG, "tools/call: %s", e.what());
-         ReplyError(id, e.what());
+         ReplyError(id, e.what(), batch.get());
          return;
      }
  
-     // Start a task to receive data with stack size
-     esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
-     cfg.thread_name = "tool_call";
-     cfg.stack_size = stack_size;
-     cfg.prio = 1;
-     esp_pthread_set_cfg(&cfg);
- 
-     // Use a thread to call the tool to avoid blocking the main thread
-     tool_call_thread_ = std::thread([this, id, tool_iter, arguments = std::move(arguments)]() {
-         try {
-             ReplyResult(id, (*tool_iter)->Call(arguments));
-         } catch (const std::exception& e) {
-             ESP_LOGE(TAG, "tools/call: %s", e.what());
-             ReplyError(id, e.what());
+     // 服务端指定的 stackSize 只用来选更大的一组，不再为每次调用单独分配栈
+     int stack = tool->stack();
+     while (stack < kMcpToolStackLarge && stack_size > kToolCallStackSizes[stack]) {
+         stack++;
+     }
+     if (stack_size > kToolCallStackSizes[stack]) {
+         ESP_LOGW(TAG, "tools/call: stackSize %d exceeds %d", stack_size, kToolCallStackSizes[stack]);
+     }
+ 
+     auto call = new ToolCall{id, tool, std::move(arguments), batch};
+     if (cJSON_IsString(progress_token)) {
+         JsonWriter(call->progress_token).String(progress_token->valuestring);
+     } else if (cJSON_IsNumber(progress_token)) {
+         JsonWriter(call->progress_token).Int(progress_token->valueint);
+     } else {
+         JsonWriter(call->progress_token).Int(id);
+     }
+
+     // 接收任务和主循环（本地调用）都会走到这里，建队列和入队都在锁内，队列满时不等待，直接回复忙。
+     // 工作任务取到调用后要先在 StartToolCall() 里拿这把锁，受理回复和批量计数在锁内完成，总是先于它的进度通知和结果
+     bool queued = false;
+     {
+         std::lock_guard<std::mutex> lock(tool_calls_mutex_);
+         auto& queue = tool_call_queues_[stack];
+         if (queue == nullptr) {
+             queue = xQueueCreate(MCP_TOOLCALL_QUEUE_SIZE, sizeof(ToolCall*));
+             // 工具会写 NVS，栈留在内部 RAM，只借 TaskStacks 检查栈余量
+             TaskStacks::GetInstance().Create([](void* arg) {
+                 McpServer::GetInstance().ToolCallWorker((QueueHandle_t)arg);
+             }, kToolCallTaskNames[stack], kToolCallStackSizes[stack], queue, 1);
          }
-     });
-     tool_call_thread_.detach();
+         queued = xQueueSend(queue, &call, 0) == pdTRUE;
+         if (queued) {
+             tool_calls_.push_back(call);
+             if (tool->async()) {
+                 ReplyToolResult(id, std::string("{\"success\": true, \"status\": \"accepted\", \"message\": "
+                     "\"The task is running in the background, its progress and result will be sent as notifications/progress.\"}"),
+                     batch.get());
+                 // 异步工具的结果走进度通知，不占用批量回复
+                 call->batch.reset();
+             } else if (batch) {
+                 std::lock_guard<std::mutex> batch_lock(batch->mutex);
+                 batch->pending++;
+             }
+         }
+     }
+     if (!queued) {
+         ESP_LOGE(TAG, "tools/call: Too many pending calls, drop %s", tool_name.c_str());
+         delete call;
+         ReplyError(id, "Too many pending tool calls", batch.get());
+     }
+ }
+ 
+ void McpServer::CallToolLocally(const std::string& name, const std::string& arguments) {
+     if (FindTool(name) == nullptr) {
+         ESP_LOGW(TAG, "Local tool call: Unknown tool: %s", name.c_str());
+         return;
+     }
+     auto json = cJSON_Parse(arguments.c_str());
+     DoToolCall(MCP_LOCAL_CALL_ID, name, json, 0, nullptr);
+     bool valid_arguments = cJSON_IsObject(json);
+     cJSON_Delete(json);
+
+     std::lock_guard<std::mutex> lock(tool_calls_mutex_);
+     if (local_call_notices_.size() >= MCP_LOCAL_CALL_NOTICE_MAX) {
+         local_call_notices_.pop_front();
+     }
+     local_call_notices_.emplace_back(name, valid_arguments ? arguments : "{}");
+ }
+
+ // 标准的 MCP 日志通知，不认识的服务器会忽略，不需要服务端配合新的方法
+ void McpServer::SendLocalCallNotices() {
+     std::deque<std::pair<std::string, std::string>> notices;
+     {
+         std::lock_guard<std::mutex> lock(tool_calls_mutex_);
+         notices.swap(local_call_notices_);
+     }
+     for (auto& [name, arguments] : notices) {
+         Application::GetInstance().SendMcpMessage([&name, &arguments](JsonWriter& writer) {
+             writer.Raw("{\"jsonrpc\":\"2.0\",\"method\":\"notifications/message\",\"params\":{\"level\":\"info\",")
+                 .Raw("\"logger\":\"local_tool_call\",\"data\":{\"name\":").String(name)
+                 .Raw(",\"arguments\":").Raw(arguments).Raw("}}}");
+         }, name.size() + arguments.size() + 128);
+     }
+ }
+ 
+ // Use persistent workers to call the tools to avoid blocking the main thread
+ void McpServer::ToolCallWorker(QueueHandle_t queue) {
+     ToolCall* call;
+     while (xQueueReceive(queue, &call, portMAX_DELAY) == pdTRUE) {
+         if (StartToolCall(call)) {
+             current_tool_call = call;
+             try {
+                 auto result = call->tool->Call(call->arguments);
+                 if (IsToolCallCancelled(call)) {
+                     ESP_LOGI(TAG, "tools/call: Drop the result of cancelled %s", call->tool->name().c_str());
+                 } else if (!call->tool->async()) {
+                     ReplyToolResult(call->id, result, call->batch.get());
+                 } else if (std::holds_alternative<std::string>(result)) {
+                     SendProgress(call, std::get<std::string>(result), true);
+                 } else if (std::holds_alternative<bool>(result)) {
+                     SendProgress(call, std::get<bool>(result) ? "true" : "false", true);
+                 } else {
+                     SendProgress(call, std::to_string(std::get<int>(result)), true);
+                 }
+             } catch (const std::exception& e) {
+                 ESP_LOGE(TAG, "tools/call: %s", e.what());
+                 if (call->tool->async()) {
+                     std::string error;
+                     JsonWriter(error).Raw("{\"success\": false, \"message\": ").String(e.what()).Raw("}");
+                     SendProgress(call, error, true);
+                 } else {
+                     ReplyError(call->id, e.what(), call->batch.get());
+                 }
+             }
+             current_tool_call = nullptr;
+         }
+         // 取消的调用没有回复，也要让批量回复继续
+         if (call->batch) {
+             ReleaseBatch(call->batch);
+         }
+         FinishToolCall(call);
+     }
+ }
+ 
+ // 排队中的调用直接跳过，正在执行的异步工具通过 on_cancel 中断，其余只丢弃结果
+ void McpServer::CancelToolCall(int id) {
+     McpTool* running_tool = nullptr;
+     {
+         std::lock_guard<std::mutex> lock(tool_calls_mutex_);
+         for (auto call : tool_calls_) {
+             if (call->id == id && !call->cancelled) {
+                 ESP_LOGI(TAG, "tools/call: Cancel %s (id %d)", call->tool->name().c_str(), id);
+                 call->cancelled = true;
+                 if (call->running) {
+                     running_tool = call->tool;
+                 }
+             }
+         }
+     }
+     if (running_tool != nullptr) {
+         running_tool->Cancel();
+     }
+ }
+ 
+ bool McpServer::StartToolCall(ToolCall* call) {
+     std::lock_guard<std::mutex> lock(tool_calls_mutex_);
+     call->running = !call->cancelled;
+     return call->running;
+ }
+ 
+ bool McpServer::IsToolCallCancelled(ToolCall* call) {
+     std::lock_guard<std::mutex> lock(tool_calls_mutex_);
+     return call->cancelled;
+ }
+ 
+ bool McpServer::IsToolCallCancelled() {
+     auto call = static_cast<ToolCall*>(current_tool_call);
+     return call != nullptr && IsToolCallCancelled(call);
+ }
+ 
+ void McpServer::ReportProgress(const std::string& message) {
+     auto call = static_cast<ToolCall*>(current_tool_call);
+     if (call == nullptr || !call->tool->async() || IsToolCallCancelled(call)) {
+         return;
+     }
+     SendProgress(call, message, false);
+ }
+ 
+ // 完成时 total 等于 progress，message 为工具结果
+ void McpServer::SendProgress(ToolCall* call, const std::string& message, bool done) {
+     int progress = ++call->progress;
+     if (call->id == MCP_LOCAL_CALL_ID) {
+         if (done) {
+             ESP_LOGI(TAG, "Local tool call result: %s", message.c_str());
+         }
+         return;
+     }
+     Application::GetInstance().SendMcpMessage([call, &message, progress, done](JsonWriter& writer) {
+         writer.Raw("{\"jsonrpc\":\"2.0\",\"method\":\"notifications/progress\",\"params\":{\"progressToken\":")
+             .Raw(call->progress_token).Raw(",\"progress\":").Int(progress);
+         if (done) {
+             writer.Raw(",\"total\":").Int(progress);
+         }
+         writer.Raw(",\"message\":").String(message).Raw("}}");
+     }, message.size() + 128);
+ }
+ 
+ void McpServer::FinishToolCall(ToolCall* call) {
+     {
+         std::lock_guard<std::mutex> lock(tool_calls_mutex_);
+         tool_calls_.erase(std::find(tool_calls_.begin(), tool_calls_.end(), call));
+     }
+     delete call;
  }
\ No newline at end of file
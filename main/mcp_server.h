@@ -3,15 +3,23 @@
 
 #include <string>
 #include <vector>
+#include <deque>
 #include <map>
+#include <unordered_map>
 #include <functional>
 #include <variant>
 #include <optional>
 #include <stdexcept>
 #include <thread>
+#include <mutex>
+#include <memory>
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
 #include <cJSON.h>
 
+class JsonWriter;
+
 // 添加类型别名
 using ReturnValue = std::variant<bool, int, std::string>;
 
@@ -171,26 +179,62 @@ public:
     }
 };
 
+// 工具调用在常驻的工作任务中执行，按工具所需的栈大小分组
+enum McpToolStack {
+    kMcpToolStackSmall,     // 只改设置，如音量、亮度
+    kMcpToolStackNormal,
+    kMcpToolStackLarge,     // 拍照并上传识别
+    kMcpToolStackCount,
+};
+
 class McpTool {
 private:
     std::string name_;
     std::string description_;
     PropertyList properties_;
     std::function<ReturnValue(const PropertyList&)> callback_;
+    McpToolStack stack_;
+    std::string json_;
+    bool async_ = false;
+    std::function<void()> on_cancel_;
 
 public:
     McpTool(const std::string& name, 
             const std::string& description, 
             const PropertyList& properties, 
-            std::function<ReturnValue(const PropertyList&)> callback)
+            std::function<ReturnValue(const PropertyList&)> callback,
+            McpToolStack stack = kMcpToolStackNormal)
         : name_(name), 
         description_(description), 
         properties_(properties), 
-        callback_(callback) {}
+        callback_(callback),
+        stack_(stack) {}
 
     inline const std::string& name() const { return name_; }
     inline const std::string& description() const { return description_; }
     inline const PropertyList& properties() const { return properties_; }
+    inline McpToolStack stack() const { return stack_; }
+    inline bool async() const { return async_; }
+
+    // 异步工具先回复已受理，结果通过进度通知返回；on_cancel 用于中断正在执行的调用
+    void SetAsync(std::function<void()> on_cancel) {
+        async_ = true;
+        on_cancel_ = on_cancel;
+    }
+
+    void Cancel() {
+        if (on_cancel_) {
+            on_cancel_();
+        }
+    }
+
+    // 描述信息注册后不再变化，只序列化一次
+    const std::string& json() {
+        if (json_.empty()) {
+            json_ = to_json();
+        }
+        return json_;
+    }
 
     std::string to_json() const {
         std::vector<std::string> required = properties_.GetRequired();
@@ -223,29 +267,8 @@ public:
         return result;
     }
 
-    std::string Call(const PropertyList& properties) {
-        ReturnValue return_value = callback_(properties);
-        // 返回结果
-        cJSON* result = cJSON_CreateObject();
-        cJSON* content = cJSON_CreateArray();
-        cJSON* text = cJSON_CreateObject();
-        cJSON_AddStringToObject(text, "type", "text");
-        if (std::holds_alternative<std::string>(return_value)) {
-            cJSON_AddStringToObject(text, "text", std::get<std::string>(return_value).c_str());
-        } else if (std::holds_alternative<bool>(return_value)) {
-            cJSON_AddStringToObject(text, "text", std::get<bool>(return_value) ? "true" : "false");
-        } else if (std::holds_alternative<int>(return_value)) {
-            cJSON_AddStringToObject(text, "text", std::to_string(std::get<int>(return_value)).c_str());
-        }
-        cJSON_AddItemToArray(content, text);
-        cJSON_AddItemToObject(result, "content", content);
-        cJSON_AddBoolToObject(result, "isError", false);
-
-        auto json_str = cJSON_PrintUnformatted(result);
-        std::string result_str(json_str);
-        cJSON_free(json_str);
-        cJSON_Delete(result);
-        return result_str;
+    ReturnValue Call(const PropertyList& properties) {
+        return callback_(properties);
     }
 };
 
@@ -258,7 +281,19 @@ public:
 
     void AddCommonTools();
     void AddTool(McpTool* tool);
-    void AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback);
+    void AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback,
+        McpToolStack stack = kMcpToolStackNormal);
+    // The call is answered as accepted at once, the result follows in a notifications/progress message
+    void AddAsyncTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback,
+        std::function<void()> on_cancel = nullptr, McpToolStack stack = kMcpToolStackNormal);
+    // For the tool callback running on the calling task, no-op outside of a tool call
+    void ReportProgress(const std::string& message);
+    // Runs a tool on behalf of the device itself, e.g. an offline speech command or a button, without waiting for the
+    // cloud. The result is only logged; the server is told about the call with a notifications/message after its next
+    // initialize, so the conversation context knows the lamp is already on. Safe to call from any task.
+    void CallToolLocally(const std::string& name, const std::string& arguments);
+    bool IsToolCallCancelled();
+    // A JSON-RPC batch array is answered with one array of the responses
     void ParseMessage(const cJSON* json);
     void ParseMessage(const std::string& message);
 
@@ -266,16 +301,63 @@ private:
     McpServer();
     ~McpServer();
 
-    void ParseCapabilities(const cJSON* capabilities);
+    // 批量请求的回复先收集起来，同步工具调用都完成后作为一个数组发送
+    struct Batch {
+        std::mutex mutex;
+        std::string responses;
+        int pending = 1;        // 解析过程本身占一个，每个排队的同步调用各占一个
+    };
+
+    struct ToolCall {
+        int id;
+        McpTool* tool;
+        PropertyList arguments;
+        std::shared_ptr<Batch> batch;
+        std::string progress_token;     // Encoded JSON value, the request id when the client did not give one
+        int progress = 0;
+        bool running = false;
+        bool cancelled = false;
+    };
 
-    void ReplyResult(int id, const std::string& result);
-    void ReplyError(int id, const std::string& message);
+    void ParseCapabilities(const cJSON* capabilities);
 
-    void GetToolsList(int id, const std::string& cursor);
-    void DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, int stack_size);
+    void ParseRequest(const cJSON* json, const std::shared_ptr<Batch>& batch);
+    void SendReply(Batch* batch, const std::function<void(JsonWriter& writer)>& write, size_t size_hint);
+    void ReleaseBatch(const std::shared_ptr<Batch>& batch);
+    void ReplyResult(int id, const std::string& result, Batch* batch = nullptr);
+    void ReplyError(int id, const std::string& message, Batch* batch = nullptr);
+    void ReplyToolResult(int id, const ReturnValue& value, Batch* batch = nullptr);
+
+    void GetToolsList(int id, const std::string& cursor, Batch* batch);
+    void DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, int stack_size, const cJSON* progress_token,
+        const std::shared_ptr<Batch>& batch = nullptr);
+    void CancelToolCall(int id);
+    void ToolCallWorker(QueueHandle_t queue);
+    bool StartToolCall(ToolCall* call);
+    bool IsToolCallCancelled(ToolCall* call);
+    void SendProgress(ToolCall* call, const std::string& message, bool done);
+    void FinishToolCall(ToolCall* call);
+
+    struct ToolsPage {
+        std::string cursor;     // Name of the first tool, empty for the first page
+        std::string result;     // Empty when the first tool alone exceeds the payload limit
+    };
+
+    void BuildToolsPages();
+    McpTool* FindTool(const std::string& name) const;
 
     std::vector<McpTool*> tools_;
-    std::thread tool_call_thread_;
+    std::unordered_map<std::string, McpTool*> tool_index_;
+    // tools/list 的分页结果，工具列表变化时清空，下次请求时重新生成
+    std::vector<ToolsPage> tools_pages_;
+    // 每种栈大小一个队列和工作任务，首次用到时创建
+    QueueHandle_t tool_call_queues_[kMcpToolStackCount] = {};
+    std::mutex tool_calls_mutex_;
+    std::vector<ToolCall*> tool_calls_;
+    // 本地执行过、还没告诉服务器的工具调用，最多保留 MCP_LOCAL_CALL_NOTICE_MAX 条
+    std::deque<std::pair<std::string, std::string>> local_call_notices_;
+
+    void SendLocalCallNotices();
 };
 
 #endif // MCP_SERVER_H
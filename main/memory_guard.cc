@@ -0,0 +1,200 @@
+#include "memory_guard.h"
+#include "black_box.h"
+#include "sdkconfig.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cJSON.h>
+
+#define TAG "MemoryGuard"
+
+static const size_t kArenaClassSizes[MEMORY_ARENA_CLASS_COUNT] = {32, 64, 128, 256};
+
+static const char* const kReserveNames[kMemoryReserveCount] = {
+    "tls",
+    "camera",
+};
+
+static const size_t kReserveSizes[kMemoryReserveCount] = {
+    CONFIG_MEMORY_TLS_RESERVE_KB * 1024,
+    CONFIG_MEMORY_CAMERA_RESERVE_KB * 1024,
+};
+
+thread_local int MemoryGuard::arena_scope_depth_ = 0;
+
+#if CONFIG_SPIRAM
+static void* JsonMalloc(size_t size) {
+    return heap_caps_malloc_prefer(size, 2, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+}
+
+static void JsonFree(void* ptr) {
+    heap_caps_free(ptr);
+}
+#endif
+
+void MemoryGuard::Initialize() {
+    for (int i = 0; i < kMemoryReserveCount; i++) {
+        reserves_[i].size = kReserveSizes[i];
+        Retake(reserves_[i]);
+    }
+
+    cJSON_Hooks hooks = {};
+#if CONFIG_SPIRAM
+    // cJSON 不需要 DMA，全部放到 PSRAM，内部 RAM 留给驱动和 TLS
+    hooks.malloc_fn = JsonMalloc;
+    hooks.free_fn = JsonFree;
+#else
+    arena_size_ = CONFIG_MEMORY_SMALL_ARENA_KB * 1024;
+    arena_ = arena_size_ > 0 ? (uint8_t*)heap_caps_malloc(arena_size_, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT) : nullptr;
+    if (arena_ != nullptr) {
+        // 每个大小类分到同样多的字节，块按地址顺序串到空闲链表
+        size_t class_bytes = arena_size_ / MEMORY_ARENA_CLASS_COUNT;
+        uint8_t* begin = arena_;
+        for (int i = 0; i < MEMORY_ARENA_CLASS_COUNT; i++) {
+            auto& size_class = classes_[i];
+            size_class.block_size = kArenaClassSizes[i];
+            size_class.begin = begin;
+            size_t count = class_bytes / size_class.block_size;
+            size_class.end = begin + count * size_class.block_size;
+            for (size_t n = count; n-- > 0;) {
+                uint8_t* block = begin + n * size_class.block_size;
+                *(void**)block = size_class.free_list;
+                size_class.free_list = block;
+            }
+            size_class.free_count = count;
+            size_class.min_free_count = size_class.free_count;
+            begin += class_bytes;
+        }
+        // 只有 JsonArenaScope 里的分配走 arena，其余等同 malloc/free
+        hooks.malloc_fn = AllocateSmall;
+        hooks.free_fn = FreeSmall;
+    }
+#endif
+    if (hooks.malloc_fn != nullptr) {
+        cJSON_InitHooks(&hooks);
+    }
+    ESP_LOGI(TAG, "Reserved tls %u camera %u bytes, small block arena %u bytes", reserves_[kMemoryReserveTls].size,
+        reserves_[kMemoryReserveCamera].size, arena_size_);
+}
+
+void MemoryGuard::Release(MemoryReserve reserve) {
+    void* block = nullptr;
+    portENTER_CRITICAL(&lock_);
+    auto& entry = reserves_[reserve];
+    if (entry.borrowers++ == 0) {
+        block = entry.block;
+        entry.block = nullptr;
+    }
+    portEXIT_CRITICAL(&lock_);
+    heap_caps_free(block);
+}
+
+void MemoryGuard::Restore(MemoryReserve reserve) {
+    portENTER_CRITICAL(&lock_);
+    bool last = --reserves_[reserve].borrowers == 0;
+    portEXIT_CRITICAL(&lock_);
+    if (last) {
+        Retake(reserves_[reserve]);
+    }
+}
+
+void MemoryGuard::Retake(Reserve& reserve) {
+    if (reserve.size == 0 || reserve.block != nullptr) {
+        return;
+    }
+    void* block = heap_caps_malloc(reserve.size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    portENTER_CRITICAL(&lock_);
+    // 分配期间又有人借用时不再持有
+    if (reserve.borrowers == 0 && reserve.block == nullptr) {
+        reserve.block = block;
+        block = nullptr;
+    }
+    portEXIT_CRITICAL(&lock_);
+    heap_caps_free(block);
+}
+
+cJSON* MemoryGuard::ParseJson(const char* text) {
+    JsonArenaScope arena;
+    return cJSON_Parse(text);
+}
+
+void* MemoryGuard::AllocateSmall(size_t size) {
+    // 第三方组件可能用 free() 释放 cJSON 的输出，作用域外不能给出 arena 的块
+    if (arena_scope_depth_ == 0) {
+        return malloc(size);
+    }
+    auto& guard = GetInstance();
+    for (auto& size_class : guard.classes_) {
+        if (size > size_class.block_size) {
+            continue;
+        }
+        void* block = nullptr;
+        portENTER_CRITICAL(&guard.lock_);
+        if (size_class.free_list != nullptr) {
+            block = size_class.free_list;
+            size_class.free_list = *(void**)block;
+            if (--size_class.free_count < size_class.min_free_count) {
+                size_class.min_free_count = size_class.free_count;
+            }
+        }
+        portEXIT_CRITICAL(&guard.lock_);
+        if (block != nullptr) {
+            return block;
+        }
+        guard.arena_fallbacks_++;
+        break;
+    }
+    return malloc(size);
+}
+
+void MemoryGuard::FreeSmall(void* ptr) {
+    auto& guard = GetInstance();
+    auto block = (uint8_t*)ptr;
+    if (block < guard.arena_ || block >= guard.arena_ + guard.arena_size_) {
+        free(ptr);
+        return;
+    }
+    for (auto& size_class : guard.classes_) {
+        if (block >= size_class.begin && block < size_class.end) {
+            portENTER_CRITICAL(&guard.lock_);
+            *(void**)block = size_class.free_list;
+            size_class.free_list = block;
+            size_class.free_count++;
+            portEXIT_CRITICAL(&guard.lock_);
+            return;
+        }
+    }
+}
+
+void MemoryGuard::Check() {
+    // 借用结束时没能取回的预留块，空闲时再试
+    for (auto& reserve : reserves_) {
+        if (reserve.borrowers == 0) {
+            Retake(reserve);
+        }
+    }
+
+    size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+    bool alarm = largest < CONFIG_MEMORY_LARGEST_BLOCK_ALARM_KB * 1024;
+    if (alarm && !alarm_) {
+        size_t free_size = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+        ESP_LOGW(TAG, "Internal heap fragmented: largest block %u of %u free bytes", largest, free_size);
+        BlackBox::GetInstance().Record(kBlackBoxHeapFragmented, largest / 1024, free_size);
+    }
+    alarm_ = alarm;
+}
+
+void MemoryGuard::PrintStats() const {
+    for (int i = 0; i < kMemoryReserveCount; i++) {
+        if (reserves_[i].size > 0) {
+            ESP_LOGI(TAG, "reserve %s: %u bytes %s", kReserveNames[i], reserves_[i].size,
+                reserves_[i].block != nullptr ? "held" : "released");
+        }
+    }
+    if (arena_ != nullptr) {
+        for (const auto& size_class : classes_) {
+            ESP_LOGI(TAG, "arena %u: %u free, minimum %u", size_class.block_size, size_class.free_count, size_class.min_free_count);
+        }
+        ESP_LOGI(TAG, "arena fallbacks: %lu", (unsigned long)arena_fallbacks_.load());
+    }
+}
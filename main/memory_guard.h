@@ -0,0 +1,113 @@
+#ifndef _MEMORY_GUARD_H_
+#define _MEMORY_GUARD_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include <freertos/FreeRTOS.h>
+
+struct cJSON;
+
+#define MEMORY_ARENA_CLASS_COUNT 4
+
+enum MemoryReserve {
+    kMemoryReserveTls,
+    kMemoryReserveCamera,
+    kMemoryReserveCount,
+};
+
+/*
+ * Keeps the internal heap usable for the large allocations that fail first when it fragments.
+ *
+ * Reserves: a contiguous internal block per big consumer is taken at boot, while the heap is still in one
+ * piece, and held until a MemoryReservation around the consumer frees it right before the allocation; it
+ * is taken back when the last reservation ends. A block that cannot be taken back is retried by Check().
+ *
+ * Small block arena: while a JsonArenaScope is open in the current task, cJSON allocations are served
+ * from per size class free lists in a region carved out at boot, so the nodes of the parsed server
+ * messages are not scattered between long lived blocks. Bigger requests fall back to the heap. The
+ * hooks are process wide, but outside a scope they are plain malloc and free only returns the arena
+ * blocks to their lists, so components that free cJSON output with libc free() never see an arena
+ * block. Only wrap parses whose tree is released with cJSON_Delete(). With PSRAM the allocations are
+ * redirected there instead, nothing of cJSON needs DMA.
+ *
+ * Check() runs on the clock timer and warns, and records in the black box, when the largest internal
+ * block drops below CONFIG_MEMORY_LARGEST_BLOCK_ALARM_KB.
+ */
+class MemoryGuard {
+public:
+    static MemoryGuard& GetInstance() {
+        static MemoryGuard instance;
+        return instance;
+    }
+    MemoryGuard(const MemoryGuard&) = delete;
+    MemoryGuard& operator=(const MemoryGuard&) = delete;
+
+    void Initialize();
+    void Check();
+    void PrintStats() const;
+
+    void Release(MemoryReserve reserve);
+    void Restore(MemoryReserve reserve);
+
+    // cJSON_Parse() with the nodes in the small block arena, the tree must be released with cJSON_Delete()
+    static cJSON* ParseJson(const char* text);
+
+    static void* AllocateSmall(size_t size);
+    static void FreeSmall(void* ptr);
+
+    // Per task nesting depth of JsonArenaScope
+    static thread_local int arena_scope_depth_;
+
+private:
+    struct Reserve {
+        size_t size = 0;
+        void* block = nullptr;
+        int borrowers = 0;
+    };
+
+    struct SizeClass {
+        uint8_t* begin = nullptr;
+        uint8_t* end = nullptr;
+        void* free_list = nullptr;
+        size_t block_size = 0;
+        size_t free_count = 0;
+        size_t min_free_count = 0;
+    };
+
+    MemoryGuard() = default;
+    void Retake(Reserve& reserve);
+
+    portMUX_TYPE lock_ = portMUX_INITIALIZER_UNLOCKED;
+    std::array<Reserve, kMemoryReserveCount> reserves_;
+    std::array<SizeClass, MEMORY_ARENA_CLASS_COUNT> classes_;
+    uint8_t* arena_ = nullptr;
+    size_t arena_size_ = 0;
+    std::atomic<uint32_t> arena_fallbacks_ = 0;
+    bool alarm_ = false;
+};
+
+// Frees the reserve for the duration of the scope, so the allocations in it find one contiguous block
+class MemoryReservation {
+public:
+    explicit MemoryReservation(MemoryReserve reserve) : reserve_(reserve) { MemoryGuard::GetInstance().Release(reserve_); }
+    ~MemoryReservation() { MemoryGuard::GetInstance().Restore(reserve_); }
+    MemoryReservation(const MemoryReservation&) = delete;
+    MemoryReservation& operator=(const MemoryReservation&) = delete;
+
+private:
+    MemoryReserve reserve_;
+};
+
+// cJSON allocations of the current task come from the small block arena for the duration of the scope
+class JsonArenaScope {
+public:
+    JsonArenaScope() { MemoryGuard::arena_scope_depth_++; }
+    ~JsonArenaScope() { MemoryGuard::arena_scope_depth_--; }
+    JsonArenaScope(const JsonArenaScope&) = delete;
+    JsonArenaScope& operator=(const JsonArenaScope&) = delete;
+};
+
+#endif // _MEMORY_GUARD_H_
@@ -0,0 +1,53 @@
+#include "network_monitor.h"
+
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "NetworkMonitor"
+
+// 没有信号强度时（尚未上报）按中等信号估计
+#define NETWORK_UNKNOWN_SIGNAL 70
+#define NETWORK_RTT_GOOD_MS 150
+#define NETWORK_RTT_BAD_MS 1000
+
+void NetworkMonitor::ReportSignal(int percent) {
+    signal_ = percent < 0 ? -1 : std::min(percent, 100);
+}
+
+void NetworkMonitor::ReportRtt(int rtt_ms) {
+    // 每次会话只有一次采样，新值权重一半
+    int old = rtt_ms_;
+    rtt_ms_ = old == 0 ? rtt_ms : (old + rtt_ms) / 2;
+    ESP_LOGI(TAG, "RTT %d ms, score %d", rtt_ms, Score());
+}
+
+void NetworkMonitor::ReportSendBacklog(size_t packets) {
+    send_backlog_ = packets;
+}
+
+void NetworkMonitor::ReportPacket(bool lost) {
+    // 指数平均，约 64 帧（4 秒）的窗口，只有解码任务写入
+    // 用百万分比保存，避免整数除法让小的丢包率降不到 0
+    int loss = loss_ppm_;
+    loss += ((lost ? 1000000 : 0) - loss) / 64;
+    loss_ppm_ = loss;
+}
+
+int NetworkMonitor::Score() const {
+    int signal = signal_;
+    if (signal == -1) {
+        return 0;
+    }
+    int score = signal < 0 ? NETWORK_UNKNOWN_SIGNAL : signal;
+
+    int rtt = rtt_ms_;
+    if (rtt > NETWORK_RTT_GOOD_MS) {
+        score -= std::min(rtt - NETWORK_RTT_GOOD_MS, NETWORK_RTT_BAD_MS - NETWORK_RTT_GOOD_MS) * 40 /
+            (NETWORK_RTT_BAD_MS - NETWORK_RTT_GOOD_MS);
+    }
+    // 每 1% 丢包扣 5 分，最多 40 分
+    score -= std::min(loss_permille() / 2, 40);
+    // 发送队列积压超过 2 帧说明上行跟不上
+    score -= std::min(std::max(send_backlog_ - 2, 0) * 5, 30);
+    return std::clamp(score, 0, 100);
+}
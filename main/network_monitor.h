@@ -0,0 +1,51 @@
+#ifndef _NETWORK_MONITOR_H_
+#define _NETWORK_MONITOR_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Below this score the link is treated as poor by the subsystems that adapt to it
+#define NETWORK_SCORE_POOR 40
+
+/*
+ * Link quality shared by the protocol, codec and streaming decisions.
+ *
+ * The inputs are reported by whoever sees them: the boards report the signal strength when the
+ * status bar polls the network icon, the protocols report the hello round trip, the main loop the
+ * uplink send queue and the decoder the downlink packets that were lost (sequenced transports only).
+ * Score() folds them into 0-100; the inputs are atomics, so it can be read from any task.
+ */
+class NetworkMonitor {
+public:
+    static NetworkMonitor& GetInstance() {
+        static NetworkMonitor instance;
+        return instance;
+    }
+    NetworkMonitor(const NetworkMonitor&) = delete;
+    NetworkMonitor& operator=(const NetworkMonitor&) = delete;
+
+    // 0-100, or -1 when the network is down
+    void ReportSignal(int percent);
+    void ReportRtt(int rtt_ms);
+    void ReportSendBacklog(size_t packets);
+    void ReportPacket(bool lost);
+
+    int Score() const;
+    bool IsPoor() const { return Score() < NETWORK_SCORE_POOR; }
+
+    int signal() const { return signal_; }
+    int rtt_ms() const { return rtt_ms_; }
+    // Loss rate in 1/1000
+    int loss_permille() const { return loss_ppm_ / 1000; }
+
+private:
+    NetworkMonitor() = default;
+
+    std::atomic<int> signal_{-2};   // -2: not reported yet
+    std::atomic<int> rtt_ms_{0};
+    std::atomic<int> send_backlog_{0};
+    std::atomic<int> loss_ppm_{0};
+};
+
+#endif // _NETWORK_MONITOR_H_
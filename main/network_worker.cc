@@ -0,0 +1,99 @@
+#include "network_worker.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <chrono>
+
+#define TAG "NetworkWorker"
+
+// TLS 握手需要和主任务相当的栈
+#define NETWORK_WORKER_STACK_SIZE 8192
+#define NETWORK_WORKER_PRIORITY 3
+#define NETWORK_WORKER_MAX_TASKS 2
+#define NETWORK_WORKER_IDLE_MS 5000
+
+struct DelayedJob {
+    esp_timer_handle_t timer;
+    std::function<void()> job;
+};
+
+void NetworkWorker::Post(std::function<void()> job) {
+    bool start_worker = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.push_back(std::move(job));
+        if (idle_workers_ == 0 && workers_ < NETWORK_WORKER_MAX_TASKS) {
+            workers_++;
+            start_worker = true;
+        } else {
+            cv_.notify_one();
+        }
+    }
+    if (!start_worker) {
+        return;
+    }
+    BaseType_t created = xTaskCreate([](void* arg) {
+        ((NetworkWorker*)arg)->WorkerLoop();
+        vTaskDelete(NULL);
+    }, "net_worker", NETWORK_WORKER_STACK_SIZE, this, NETWORK_WORKER_PRIORITY, nullptr);
+    if (created != pdPASS) {
+        // 已有的工作任务之后会处理队列里的任务
+        std::lock_guard<std::mutex> lock(mutex_);
+        workers_--;
+        ESP_LOGE(TAG, "Failed to create worker task, %d running, %u jobs queued", workers_, (unsigned)jobs_.size());
+    }
+}
+
+void NetworkWorker::PostDelayed(int delay_ms, std::function<void()> job) {
+    auto delayed = new DelayedJob{nullptr, std::move(job)};
+    esp_timer_create_args_t timer_args = {
+        .callback = [](void* arg) {
+            auto delayed = (DelayedJob*)arg;
+            // 定时器在工作任务里删除，这时回调已经返回
+            NetworkWorker::GetInstance().Post([delayed]() {
+                esp_timer_delete(delayed->timer);
+                auto job = std::move(delayed->job);
+                delete delayed;
+                job();
+            });
+        },
+        .arg = delayed,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "net_worker_delay",
+        .skip_unhandled_events = true,
+    };
+    if (esp_timer_create(&timer_args, &delayed->timer) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create delay timer, posting now");
+        auto job = std::move(delayed->job);
+        delete delayed;
+        Post(std::move(job));
+        return;
+    }
+    esp_timer_start_once(delayed->timer, (uint64_t)delay_ms * 1000);
+}
+
+void NetworkWorker::WorkerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        if (jobs_.empty()) {
+            idle_workers_++;
+            bool has_job = cv_.wait_for(lock, std::chrono::milliseconds(NETWORK_WORKER_IDLE_MS), [this]() {
+                return !jobs_.empty();
+            });
+            idle_workers_--;
+            if (!has_job) {
+                break;
+            }
+        }
+        auto job = std::move(jobs_.front());
+        jobs_.pop_front();
+        lock.unlock();
+        job();
+        // 捕获的对象在锁外析构
+        job = nullptr;
+        lock.lock();
+    }
+    workers_--;
+}
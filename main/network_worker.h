@@ -0,0 +1,40 @@
+#ifndef _NETWORK_WORKER_H_
+#define _NETWORK_WORKER_H_
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+/*
+ * Shared tasks for short, blocking network jobs (one request, one handshake) that used to get a task each.
+ *
+ * Jobs run in order on up to NETWORK_WORKER_MAX_TASKS workers, a new worker is only started when every
+ * running one is busy, and a worker exits after NETWORK_WORKER_IDLE_MS without work, so no stack is held
+ * while there is nothing to do. Waiting between attempts must not sleep on a worker: PostDelayed() arms a
+ * timer and posts the job when it fires.
+ */
+class NetworkWorker {
+public:
+    static NetworkWorker& GetInstance() {
+        static NetworkWorker instance;
+        return instance;
+    }
+    NetworkWorker(const NetworkWorker&) = delete;
+    NetworkWorker& operator=(const NetworkWorker&) = delete;
+
+    void Post(std::function<void()> job);
+    void PostDelayed(int delay_ms, std::function<void()> job);
+
+private:
+    NetworkWorker() = default;
+    void WorkerLoop();
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> jobs_;
+    int workers_ = 0;
+    int idle_workers_ = 0;
+};
+
+#endif // _NETWORK_WORKER_H_
@@ -0,0 +1,90 @@
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <cstddef>
+
+template <typename T>
+class ObjectPoolBase {
+public:
+    virtual ~ObjectPoolBase() = default;
+    virtual void Release(T* object) = 0;
+};
+
+// Returns the object to its pool, or deletes it if it was allocated from the heap
+template <typename T>
+struct PoolDeleter {
+    ObjectPoolBase<T>* pool = nullptr;
+
+    void operator()(T* object) const {
+        if (pool != nullptr) {
+            pool->Release(object);
+        } else {
+            delete object;
+        }
+    }
+};
+
+template <typename T>
+using PooledPtr = std::unique_ptr<T, PoolDeleter<T>>;
+
+/*
+ * Fixed-size pool of preallocated objects.
+ *
+ * Released objects keep their members, including the capacity of their vectors,
+ * so the steady-state audio traffic does not touch the heap. When the pool is
+ * exhausted, Acquire() falls back to a heap object which is deleted on release.
+ */
+template <typename T, size_t Size>
+class ObjectPool : public ObjectPoolBase<T> {
+public:
+    ObjectPool() {
+        for (size_t i = 0; i < Size; i++) {
+            free_list_[i] = &objects_[i];
+        }
+        free_count_ = Size;
+    }
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    PooledPtr<T> Acquire() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (free_count_ > 0) {
+                return PooledPtr<T>(free_list_[--free_count_], PoolDeleter<T>{this});
+            }
+            fallback_count_++;
+        }
+        return PooledPtr<T>(new T(), PoolDeleter<T>{});
+    }
+
+    void Release(T* object) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_list_[free_count_++] = object;
+    }
+
+    size_t available() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return free_count_;
+    }
+
+    // How many times the pool ran out and a heap object was used instead
+    size_t fallback_count() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return fallback_count_;
+    }
+
+    static constexpr size_t size() { return Size; }
+
+private:
+    mutable std::mutex mutex_;
+    std::array<T, Size> objects_;
+    std::array<T*, Size> free_list_;
+    size_t free_count_ = 0;
+    size_t fallback_count_ = 0;
+};
+
+#endif // OBJECT_POOL_H
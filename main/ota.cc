@@ -2,6 +2,9 @@
 #include "system_info.h"
 #include "settings.h"
 #include "assets/lang_config.h"
+#include "ota_image_writer.h"
+#include "transfer_manager.h"
+#include "json_fields.h"
 
 #include <cJSON.h>
 #include <esp_log.h>
@@ -10,17 +13,35 @@
 #include <esp_app_format.h>
 #include <esp_efuse.h>
 #include <esp_efuse_table.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
 #ifdef SOC_HMAC_SUPPORTED
 #include <esp_hmac.h>
 #endif
 
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <vector>
 #include <sstream>
 #include <algorithm>
+#include <atomic>
 
 #define TAG "Ota"
 
+// 有 PSRAM 时用 64KB 整块写入，esp_ota_write 每次只需一次块擦除
+#define OTA_READ_BUFFER_SIZE (8 * 1024)
+#define OTA_READ_BUFFER_SIZE_PSRAM (64 * 1024)
+#define OTA_PIPELINE_BUFFERS 2
+#define OTA_PIPELINE_BUFFERS_PSRAM 3
+#define OTA_PIPELINE_MAX_BUFFERS 3
+#define OTA_MAX_RESUME_RETRIES 5
+// NVS 字符串最长 4000 字节，更大的应答不缓存
+#define OTA_MAX_CACHED_RESPONSE 3072
+
 
 Ota::Ota() {
 #ifdef ESP_EFUSE_BLOCK_USR_DATA
@@ -68,8 +89,59 @@ std::unique_ptr<Http> Ota::SetupHttp() {
     return http;
 }
 
+// 把配置段的字段写入同名的 Settings 命名空间，值未变化时不写
+static void StoreSection(const JsonFields& section, const char* ns) {
+    Settings settings(ns, true);
+    std::string_view key_view;
+    std::string value;
+    bool is_string;
+    for (int i = 0; i < section.size(); i++) {
+        if (!section.GetField(i, key_view, value, &is_string)) {
+            continue;
+        }
+        std::string key(key_view);
+        if (is_string) {
+            if (settings.GetString(key) != value) {
+                settings.SetString(key, value);
+            }
+        } else if (!value.empty() && (value[0] == '-' || (value[0] >= '0' && value[0] <= '9'))) {
+            int32_t number = (int32_t)strtod(value.c_str(), nullptr);
+            if (settings.GetInt(key) != number) {
+                settings.SetInt(key, number);
+            }
+        }
+    }
+}
+
+// RFC 1123 格式的 Date 头，例如 "Sun, 06 Nov 1994 08:49:37 GMT"，返回毫秒时间戳
+static bool ParseHttpDate(const std::string& date, double* timestamp_ms) {
+    static const char* kMonths = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    char month_name[4] = {0};
+    int day, year, hour, minute, second;
+    if (sscanf(date.c_str(), "%*[^,], %d %3s %d %d:%d:%d", &day, month_name, &year, &hour, &minute, &second) != 6) {
+        return false;
+    }
+    const char* found = strstr(kMonths, month_name);
+    if (found == nullptr || strlen(month_name) != 3 || (found - kMonths) % 3 != 0) {
+        return false;
+    }
+    int month = (found - kMonths) / 3 + 1;
+    // 公历日期转为 1970-01-01 以来的天数
+    int y = year - (month <= 2 ? 1 : 0);
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int64_t days = (int64_t)era * 146097 + doe - 719468;
+    *timestamp_ms = ((days * 86400) + hour * 3600 + minute * 60 + second) * 1000.0;
+    return true;
+}
+
 /* 
  * Specification: https://ccnphfhqs21z.feishu.cn/wiki/FjW6wZmisimNBBkov6OcmfvknVd
+ *
+ * 上次的应答和服务器给的 ETag 保存在 NVS 中，请求时带上 If-None-Match，配置没有变化时服务器返回 304，
+ * 直接使用保存的应答，服务器时间改用 Date 头
  */
 bool Ota::CheckVersion() {
     auto& board = Board::GetInstance();
@@ -87,6 +159,16 @@ bool Ota::CheckVersion() {
 
     auto http = SetupHttp();
 
+    Settings cache("ota", true);
+    std::string etag = cache.GetString("etag");
+    // 应答和固件版本、地址一起缓存，换了固件或服务器后不能再用
+    std::string cache_key = current_version_ + " " + url;
+    if (!etag.empty() && cache.GetString("key") == cache_key) {
+        http->SetHeader("If-None-Match", etag);
+    } else {
+        etag.clear();
+    }
+
     std::string data = board.GetJson();
     std::string method = data.length() > 0 ? "POST" : "GET";
     http->SetContent(std::move(data));
@@ -97,106 +179,110 @@ bool Ota::CheckVersion() {
     }
 
     auto status_code = http->GetStatusCode();
-    if (status_code != 200) {
+    bool cached = false;
+    std::string date;
+    if (status_code == 304 && !etag.empty()) {
+        date = http->GetResponseHeader("Date");
+        http->Close();
+        data = cache.GetString("response");
+        cached = true;
+        ESP_LOGI(TAG, "Version check not modified, using the cached response");
+    } else if (status_code == 200) {
+        etag = http->GetResponseHeader("ETag");
+        data = http->ReadAll();
+        http->Close();
+    } else {
         ESP_LOGE(TAG, "Failed to check version, status code: %d", status_code);
         return false;
     }
 
-    data = http->ReadAll();
-    http->Close();
+    if (!ParseVersionResponse(data, cached, date)) {
+        if (cached) {
+            // 缓存损坏，下次请求完整的应答
+            cache.EraseKey("etag");
+        }
+        return false;
+    }
 
-    // Response: { "firmware": { "version": "1.0.0", "url": "http://" } }
-    // Parse the JSON response and check if the version is newer
-    // If it is, set has_new_version_ to true and store the new version and URL
-    
-    cJSON *root = cJSON_Parse(data.c_str());
-    if (root == NULL) {
+    // 激活码每次都可能不同，带激活信息的应答不缓存
+    if (!cached) {
+        if (!etag.empty() && !has_activation_code_ && !has_activation_challenge_ && data.size() <= OTA_MAX_CACHED_RESPONSE) {
+            if (cache.GetString("response") != data) {
+                cache.SetString("response", data);
+            }
+            if (cache.GetString("key") != cache_key) {
+                cache.SetString("key", cache_key);
+            }
+            if (cache.GetString("etag") != etag) {
+                cache.SetString("etag", etag);
+            }
+        } else if (!cache.GetString("etag").empty()) {
+            cache.EraseKey("etag");
+            cache.EraseKey("response");
+        }
+    }
+    return true;
+}
+
+// Response: { "firmware": { "version": "1.0.0", "url": "http://" } }
+// 只记录各个字段在应答中的位置，不建立 cJSON 树
+bool Ota::ParseVersionResponse(const std::string& data, bool cached, const std::string& date) {
+    JsonFields root;
+    if (!root.Parse(data.data(), data.size())) {
         ESP_LOGE(TAG, "Failed to parse JSON response");
         return false;
     }
 
     has_activation_code_ = false;
     has_activation_challenge_ = false;
-    cJSON *activation = cJSON_GetObjectItem(root, "activation");
-    if (cJSON_IsObject(activation)) {
-        cJSON* message = cJSON_GetObjectItem(activation, "message");
-        if (cJSON_IsString(message)) {
-            activation_message_ = message->valuestring;
-        }
-        cJSON* code = cJSON_GetObjectItem(activation, "code");
-        if (cJSON_IsString(code)) {
-            activation_code_ = code->valuestring;
+    JsonFields activation;
+    if (root.GetObject("activation", activation)) {
+        activation.GetString("message", activation_message_);
+        if (activation.GetString("code", activation_code_)) {
             has_activation_code_ = true;
         }
-        cJSON* challenge = cJSON_GetObjectItem(activation, "challenge");
-        if (cJSON_IsString(challenge)) {
-            activation_challenge_ = challenge->valuestring;
+        if (activation.GetString("challenge", activation_challenge_)) {
             has_activation_challenge_ = true;
         }
-        cJSON* timeout_ms = cJSON_GetObjectItem(activation, "timeout_ms");
-        if (cJSON_IsNumber(timeout_ms)) {
-            activation_timeout_ms_ = timeout_ms->valueint;
+        double timeout_ms;
+        if (activation.GetNumber("timeout_ms", timeout_ms)) {
+            activation_timeout_ms_ = (int)timeout_ms;
         }
     }
 
     has_mqtt_config_ = false;
-    cJSON *mqtt = cJSON_GetObjectItem(root, "mqtt");
-    if (cJSON_IsObject(mqtt)) {
-        Settings settings("mqtt", true);
-        cJSON *item = NULL;
-        cJSON_ArrayForEach(item, mqtt) {
-            if (cJSON_IsString(item)) {
-                if (settings.GetString(item->string) != item->valuestring) {
-                    settings.SetString(item->string, item->valuestring);
-                }
-            } else if (cJSON_IsNumber(item)) {
-                if (settings.GetInt(item->string) != item->valueint) {
-                    settings.SetInt(item->string, item->valueint);
-                }
-            }
-        }
+    JsonFields mqtt;
+    if (root.GetObject("mqtt", mqtt)) {
+        StoreSection(mqtt, "mqtt");
         has_mqtt_config_ = true;
     } else {
         ESP_LOGI(TAG, "No mqtt section found !");
     }
 
     has_websocket_config_ = false;
-    cJSON *websocket = cJSON_GetObjectItem(root, "websocket");
-    if (cJSON_IsObject(websocket)) {
-        Settings settings("websocket", true);
-        cJSON *item = NULL;
-        cJSON_ArrayForEach(item, websocket) {
-            if (cJSON_IsString(item)) {
-                if (settings.GetString(item->string) != item->valuestring) {
-                    settings.SetString(item->string, item->valuestring);
-                }
-            } else if (cJSON_IsNumber(item)) {
-                if (settings.GetInt(item->string) != item->valueint) {
-                    settings.SetInt(item->string, item->valueint);
-                }
-            }
-        }
+    JsonFields websocket;
+    if (root.GetObject("websocket", websocket)) {
+        StoreSection(websocket, "websocket");
         has_websocket_config_ = true;
     } else {
         ESP_LOGI(TAG, "No websocket section found!");
     }
 
     has_server_time_ = false;
-    cJSON *server_time = cJSON_GetObjectItem(root, "server_time");
-    if (cJSON_IsObject(server_time)) {
-        cJSON *timestamp = cJSON_GetObjectItem(server_time, "timestamp");
-        cJSON *timezone_offset = cJSON_GetObjectItem(server_time, "timezone_offset");
-        
-        if (cJSON_IsNumber(timestamp)) {
+    JsonFields server_time;
+    if (root.GetObject("server_time", server_time)) {
+        double ts;
+        bool has_timestamp = cached ? ParseHttpDate(date, &ts) : server_time.GetNumber("timestamp", ts);
+        if (has_timestamp) {
             // 设置系统时间
             struct timeval tv;
-            double ts = timestamp->valuedouble;
-            
+
             // 如果有时区偏移，计算本地时间
-            if (cJSON_IsNumber(timezone_offset)) {
-                ts += (timezone_offset->valueint * 60 * 1000); // 转换分钟为毫秒
+            double timezone_offset;
+            if (server_time.GetNumber("timezone_offset", timezone_offset)) {
+                ts += ((int)timezone_offset * 60 * 1000); // 转换分钟为毫秒
             }
-            
+
             tv.tv_sec = (time_t)(ts / 1000);  // 转换毫秒为秒
             tv.tv_usec = (suseconds_t)((long long)ts % 1000) * 1000;  // 剩余的毫秒转换为微秒
             settimeofday(&tv, NULL);
@@ -207,18 +293,12 @@ bool Ota::CheckVersion() {
     }
 
     has_new_version_ = false;
-    cJSON *firmware = cJSON_GetObjectItem(root, "firmware");
-    if (cJSON_IsObject(firmware)) {
-        cJSON *version = cJSON_GetObjectItem(firmware, "version");
-        if (cJSON_IsString(version)) {
-            firmware_version_ = version->valuestring;
-        }
-        cJSON *url = cJSON_GetObjectItem(firmware, "url");
-        if (cJSON_IsString(url)) {
-            firmware_url_ = url->valuestring;
-        }
+    JsonFields firmware;
+    if (root.GetObject("firmware", firmware)) {
+        bool has_version = firmware.GetString("version", firmware_version_);
+        bool has_url = firmware.GetString("url", firmware_url_);
 
-        if (cJSON_IsString(version) && cJSON_IsString(url)) {
+        if (has_version && has_url) {
             // Check if the version is newer, for example, 0.1.0 is newer than 0.0.1
             has_new_version_ = IsNewVersionAvailable(current_version_, firmware_version_);
             if (has_new_version_) {
@@ -227,16 +307,14 @@ bool Ota::CheckVersion() {
                 ESP_LOGI(TAG, "Current is the latest version");
             }
             // If the force flag is set to 1, the given version is forced to be installed
-            cJSON *force = cJSON_GetObjectItem(firmware, "force");
-            if (cJSON_IsNumber(force) && force->valueint == 1) {
+            double force;
+            if (firmware.GetNumber("force", force) && force == 1) {
                 has_new_version_ = true;
             }
         }
     } else {
         ESP_LOGW(TAG, "No firmware section found!");
     }
-
-    cJSON_Delete(root);
     return true;
 }
 
@@ -260,97 +338,203 @@ void Ota::MarkCurrentVersionValid() {
     }
 }
 
-bool Ota::Upgrade(const std::string& firmware_url) {
-    ESP_LOGI(TAG, "Upgrading firmware from %s", firmware_url.c_str());
-    esp_ota_handle_t update_handle = 0;
-    auto update_partition = esp_ota_get_next_update_partition(NULL);
-    if (update_partition == NULL) {
-        ESP_LOGE(TAG, "Failed to get update partition");
-        return false;
+// 下载和写 flash 并行：两个缓冲区轮流交给写入任务
+struct OtaPipeline {
+    OtaImageWriter* writer;
+    char* buffers[OTA_PIPELINE_MAX_BUFFERS] = {};
+    int buffer_count;
+    size_t buffer_size;
+    QueueHandle_t free_queue;       // Index of the buffers that can be filled
+    QueueHandle_t filled_queue;     // OtaChunk, a negative index stops the writer
+    SemaphoreHandle_t done;
+    std::atomic<esp_err_t> err{ESP_OK};
+    std::atomic<size_t> flashed{0};         // Image bytes written to flash
+    std::atomic<int64_t> flash_time_us{0};  // Time spent in the writer, including erase and inflate
+};
+
+struct OtaChunk {
+    int index;
+    size_t size;
+};
+
+static void OtaWriterTask(void* arg) {
+    auto pipeline = (OtaPipeline*)arg;
+    OtaChunk chunk;
+    while (xQueueReceive(pipeline->filled_queue, &chunk, portMAX_DELAY) == pdTRUE && chunk.index >= 0) {
+        if (pipeline->err == ESP_OK) {
+            auto start_time = esp_timer_get_time();
+            auto err = pipeline->writer->Write((const uint8_t*)pipeline->buffers[chunk.index], chunk.size);
+            pipeline->flash_time_us += esp_timer_get_time() - start_time;
+            pipeline->flashed = pipeline->writer->written();
+            if (err != ESP_OK) {
+                if (err != ESP_ERR_INVALID_VERSION) {
+                    ESP_LOGE(TAG, "Failed to write OTA data: %s", esp_err_to_name(err));
+                }
+                pipeline->err = err;
+            }
+        }
+        xQueueSend(pipeline->free_queue, &chunk.index, portMAX_DELAY);
     }
+    xSemaphoreGive(pipeline->done);
+    vTaskDelete(NULL);
+}
 
-    ESP_LOGI(TAG, "Writing to partition %s at offset 0x%lx", update_partition->label, update_partition->address);
-    bool image_header_checked = false;
-    std::string image_header;
-
+// 断线后用 Range 从已下载的位置继续，解压和写入状态都保留在内存中
+std::unique_ptr<Http> Ota::OpenFirmware(const std::string& firmware_url, size_t offset, size_t& body_length) {
     auto network = Board::GetInstance().GetNetwork();
     auto http = network->CreateHttp(0);
+    if (offset > 0) {
+        http->SetHeader("Range", "bytes=" + std::to_string(offset) + "-");
+    }
     if (!http->Open("GET", firmware_url)) {
         ESP_LOGE(TAG, "Failed to open HTTP connection");
-        return false;
+        return nullptr;
     }
 
-    if (http->GetStatusCode() != 200) {
-        ESP_LOGE(TAG, "Failed to get firmware, status code: %d", http->GetStatusCode());
+    int expected = offset > 0 ? 206 : 200;
+    if (http->GetStatusCode() != expected) {
+        ESP_LOGE(TAG, "Failed to get firmware at offset %u, status code: %d", offset, http->GetStatusCode());
+        return nullptr;
+    }
+    body_length = http->GetBodyLength();
+    return http;
+}
+
+bool Ota::Upgrade(const std::string& firmware_url) {
+    ESP_LOGI(TAG, "Upgrading firmware from %s", firmware_url.c_str());
+    auto update_partition = esp_ota_get_next_update_partition(NULL);
+    if (update_partition == NULL) {
+        ESP_LOGE(TAG, "Failed to get update partition");
         return false;
     }
+    ESP_LOGI(TAG, "Writing to partition %s at offset 0x%lx", update_partition->label, update_partition->address);
 
-    size_t content_length = http->GetBodyLength();
+    size_t content_length = 0;
+    auto http = OpenFirmware(firmware_url, 0, content_length);
+    if (!http) {
+        return false;
+    }
     if (content_length == 0) {
         ESP_LOGE(TAG, "Failed to get content length");
         return false;
     }
 
-    char buffer[512];
-    size_t total_read = 0, recent_read = 0;
+    OtaImageWriter writer(update_partition);
+    OtaPipeline pipeline;
+    pipeline.writer = &writer;
+    bool has_psram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM) >= 2 * OTA_PIPELINE_BUFFERS_PSRAM * OTA_READ_BUFFER_SIZE_PSRAM;
+    pipeline.buffer_count = has_psram ? OTA_PIPELINE_BUFFERS_PSRAM : OTA_PIPELINE_BUFFERS;
+    pipeline.buffer_size = has_psram ? OTA_READ_BUFFER_SIZE_PSRAM : OTA_READ_BUFFER_SIZE;
+    pipeline.free_queue = xQueueCreate(pipeline.buffer_count, sizeof(int));
+    pipeline.filled_queue = xQueueCreate(pipeline.buffer_count + 1, sizeof(OtaChunk));
+    pipeline.done = xSemaphoreCreateBinary();
+    bool buffers_ok = true;
+    for (int i = 0; i < pipeline.buffer_count; i++) {
+        pipeline.buffers[i] = (char*)heap_caps_malloc(pipeline.buffer_size, has_psram ? MALLOC_CAP_SPIRAM : MALLOC_CAP_8BIT);
+        buffers_ok = buffers_ok && pipeline.buffers[i] != nullptr;
+        xQueueSend(pipeline.free_queue, &i, 0);
+    }
+
+    bool success = buffers_ok;
+    if (!buffers_ok) {
+        ESP_LOGE(TAG, "Failed to allocate download buffers");
+    } else {
+        xTaskCreate(OtaWriterTask, "ota_writer", 4096, &pipeline, 4, nullptr);
+    }
+
+    size_t total_read = 0, recent_read = 0, last_flashed = 0;
+    int64_t last_flash_time = 0;
+    int retries = 0;
     auto last_calc_time = esp_timer_get_time();
-    while (true) {
-        int ret = http->Read(buffer, sizeof(buffer));
-        if (ret < 0) {
-            ESP_LOGE(TAG, "Failed to read HTTP data: %s", esp_err_to_name(ret));
-            return false;
+    TransferScope transfer(kTransferBackground);
+    while (success && total_read < content_length) {
+        int index;
+        xQueueReceive(pipeline.free_queue, &index, portMAX_DELAY);
+        if (pipeline.err != ESP_OK) {
+            xQueueSend(pipeline.free_queue, &index, 0);
+            success = false;
+            break;
+        }
+
+        // 尽量装满缓冲区，减少 flash 写入次数
+        char* buffer = pipeline.buffers[index];
+        size_t filled = 0;
+        bool dropped = false;
+        while (filled < pipeline.buffer_size && total_read + filled < content_length) {
+            int ret = http->Read(buffer + filled, pipeline.buffer_size - filled);
+            if (ret <= 0) {
+                dropped = true;
+                break;
+            }
+            transfer.Account(ret);
+            filled += ret;
+        }
+        if (filled > 0) {
+            OtaChunk chunk = { index, filled };
+            xQueueSend(pipeline.filled_queue, &chunk, portMAX_DELAY);
+        } else {
+            xQueueSend(pipeline.free_queue, &index, 0);
         }
 
         // Calculate speed and progress every second
-        recent_read += ret;
-        total_read += ret;
-        if (esp_timer_get_time() - last_calc_time >= 1000000 || ret == 0) {
+        recent_read += filled;
+        total_read += filled;
+        if (esp_timer_get_time() - last_calc_time >= 1000000 || total_read == content_length) {
             size_t progress = total_read * 100 / content_length;
-            ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Speed: %uB/s", progress, total_read, content_length, recent_read);
+            // 写入速度按写入任务实际忙碌的时间计算，低于下载速度说明 flash 是瓶颈
+            size_t flashed = pipeline.flashed;
+            int64_t flash_time = pipeline.flash_time_us;
+            size_t flash_speed = flash_time > last_flash_time ? (flashed - last_flashed) * 1000000LL / (flash_time - last_flash_time) : 0;
+            last_flashed = flashed;
+            last_flash_time = flash_time;
+            ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Speed: %uB/s, Flash: %uB/s", progress, total_read, content_length, recent_read, flash_speed);
             if (upgrade_callback_) {
-                upgrade_callback_(progress, recent_read);
+                upgrade_callback_(progress, recent_read, flash_speed);
             }
             last_calc_time = esp_timer_get_time();
             recent_read = 0;
         }
 
-        if (ret == 0) {
-            break;
-        }
-
-        if (!image_header_checked) {
-            image_header.append(buffer, ret);
-            if (image_header.size() >= sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)) {
-                esp_app_desc_t new_app_info;
-                memcpy(&new_app_info, image_header.data() + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), sizeof(esp_app_desc_t));
-                ESP_LOGI(TAG, "New firmware version: %s", new_app_info.version);
-
-                auto current_version = esp_app_get_description()->version;
-                if (memcmp(new_app_info.version, current_version, sizeof(new_app_info.version)) == 0) {
-                    ESP_LOGE(TAG, "Firmware version is the same, skipping upgrade");
-                    return false;
-                }
-
-                if (esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, &update_handle)) {
-                    esp_ota_abort(update_handle);
-                    ESP_LOGE(TAG, "Failed to begin OTA");
-                    return false;
+        if (dropped && total_read < content_length) {
+            http->Close();
+            http.reset();
+            while (!http && pipeline.err == ESP_OK && ++retries <= OTA_MAX_RESUME_RETRIES) {
+                ESP_LOGW(TAG, "Download interrupted at %u/%u, resuming (%d/%d)", total_read, content_length, retries, OTA_MAX_RESUME_RETRIES);
+                vTaskDelay(pdMS_TO_TICKS(1000 * retries));
+                size_t remaining = 0;
+                http = OpenFirmware(firmware_url, total_read, remaining);
+                if (http && remaining != content_length - total_read) {
+                    ESP_LOGE(TAG, "Unexpected resumed length %u, expected %u", remaining, content_length - total_read);
+                    http.reset();
+                    break;
                 }
-
-                image_header_checked = true;
-                std::string().swap(image_header);
+            }
+            if (!http) {
+                success = false;
             }
         }
-        auto err = esp_ota_write(update_handle, buffer, ret);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to write OTA data: %s", esp_err_to_name(err));
-            esp_ota_abort(update_handle);
-            return false;
-        }
     }
-    http->Close();
+    if (http) {
+        http->Close();
+    }
+
+    if (buffers_ok) {
+        OtaChunk stop = { -1, 0 };
+        xQueueSend(pipeline.filled_queue, &stop, portMAX_DELAY);
+        xSemaphoreTake(pipeline.done, portMAX_DELAY);
+    }
+    for (int i = 0; i < pipeline.buffer_count; i++) {
+        heap_caps_free(pipeline.buffers[i]);
+    }
+    vQueueDelete(pipeline.free_queue);
+    vQueueDelete(pipeline.filled_queue);
+    vSemaphoreDelete(pipeline.done);
+
+    if (!success || pipeline.err != ESP_OK) {
+        return false;
+    }
 
-    esp_err_t err = esp_ota_end(update_handle);
+    esp_err_t err = writer.Finish();
     if (err != ESP_OK) {
         if (err == ESP_ERR_OTA_VALIDATE_FAILED) {
             ESP_LOGE(TAG, "Image validation failed, image is corrupted");
@@ -366,11 +550,11 @@ bool Ota::Upgrade(const std::string& firmware_url) {
         return false;
     }
 
-    ESP_LOGI(TAG, "Firmware upgrade successful");
+    ESP_LOGI(TAG, "Firmware upgrade successful%s", writer.compressed() ? " (compressed image)" : "");
     return true;
 }
 
-bool Ota::StartUpgrade(std::function<void(int progress, size_t speed)> callback) {
+bool Ota::StartUpgrade(std::function<void(int progress, size_t speed, size_t flash_speed)> callback) {
     upgrade_callback_ = callback;
     return Upgrade(firmware_url_);
 }
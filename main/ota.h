@@ -20,7 +20,7 @@ public:
     bool HasWebsocketConfig() { return has_websocket_config_; }
     bool HasActivationCode() { return has_activation_code_; }
     bool HasServerTime() { return has_server_time_; }
-    bool StartUpgrade(std::function<void(int progress, size_t speed)> callback);
+    bool StartUpgrade(std::function<void(int progress, size_t speed, size_t flash_speed)> callback);
     void MarkCurrentVersionValid();
 
     const std::string& GetFirmwareVersion() const { return firmware_version_; }
@@ -47,8 +47,10 @@ private:
     int activation_timeout_ms_ = 30000;
 
     bool Upgrade(const std::string& firmware_url);
-    std::function<void(int progress, size_t speed)> upgrade_callback_;
+    std::unique_ptr<Http> OpenFirmware(const std::string& firmware_url, size_t offset, size_t& body_length);
+    std::function<void(int progress, size_t speed, size_t flash_speed)> upgrade_callback_;
     std::vector<int> ParseVersion(const std::string& version);
+    bool ParseVersionResponse(const std::string& data, bool cached, const std::string& date);
     bool IsNewVersionAvailable(const std::string& currentVersion, const std::string& newVersion);
     std::string GetActivationPayload();
     std::unique_ptr<Http> SetupHttp();
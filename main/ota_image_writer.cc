@@ -0,0 +1,135 @@
+#include "ota_image_writer.h"
+
+#include <esp_log.h>
+#include <esp_app_format.h>
+#include <esp_app_desc.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+
+#if __has_include("rom/miniz.h")
+#include "rom/miniz.h"
+#define OTA_HAS_ZLIB 1
+#endif
+
+#define TAG "OtaImageWriter"
+
+#define OTA_ZLIB_MAGIC 0x78
+
+OtaImageWriter::OtaImageWriter(const esp_partition_t* partition) : partition_(partition) {
+}
+
+OtaImageWriter::~OtaImageWriter() {
+    if (begun_ && !finished_) {
+        esp_ota_abort(handle_);
+    }
+    heap_caps_free(inflator_);
+    heap_caps_free(dict_);
+}
+
+esp_err_t OtaImageWriter::Write(const uint8_t* data, size_t size) {
+    if (size == 0) {
+        return ESP_OK;
+    }
+    if (!format_known_) {
+        format_known_ = true;
+        compressed_ = data[0] == OTA_ZLIB_MAGIC;
+        if (compressed_) {
+#ifdef OTA_HAS_ZLIB
+            inflator_ = heap_caps_malloc(sizeof(tinfl_decompressor), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+            if (inflator_ == nullptr) {
+                inflator_ = heap_caps_malloc(sizeof(tinfl_decompressor), MALLOC_CAP_8BIT);
+            }
+            dict_ = (uint8_t*)heap_caps_malloc(TINFL_LZ_DICT_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+            if (dict_ == nullptr) {
+                dict_ = (uint8_t*)heap_caps_malloc(TINFL_LZ_DICT_SIZE, MALLOC_CAP_8BIT);
+            }
+            if (inflator_ == nullptr || dict_ == nullptr) {
+                ESP_LOGE(TAG, "Failed to allocate the inflate buffers");
+                return ESP_ERR_NO_MEM;
+            }
+            tinfl_init((tinfl_decompressor*)inflator_);
+            ESP_LOGI(TAG, "Compressed firmware image");
+#else
+            ESP_LOGE(TAG, "Compressed firmware is not supported on this chip");
+            return ESP_ERR_NOT_SUPPORTED;
+#endif
+        }
+    }
+    return compressed_ ? Inflate(data, size) : WriteImage(data, size);
+}
+
+esp_err_t OtaImageWriter::Inflate(const uint8_t* data, size_t size) {
+#ifdef OTA_HAS_ZLIB
+    auto inflator = (tinfl_decompressor*)inflator_;
+    while (!inflate_done_) {
+        size_t in_size = size;
+        size_t out_size = TINFL_LZ_DICT_SIZE - dict_offset_;
+        // 字典作为环形输出缓冲区，解压出的数据立即写入分区
+        auto status = tinfl_decompress(inflator, data, &in_size, dict_, dict_ + dict_offset_, &out_size,
+            TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT);
+        data += in_size;
+        size -= in_size;
+        if (out_size > 0) {
+            auto err = WriteImage(dict_ + dict_offset_, out_size);
+            if (err != ESP_OK) {
+                return err;
+            }
+            dict_offset_ = (dict_offset_ + out_size) & (TINFL_LZ_DICT_SIZE - 1);
+        }
+        if (status < TINFL_STATUS_DONE) {
+            ESP_LOGE(TAG, "Failed to inflate firmware: %d", (int)status);
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        if (status == TINFL_STATUS_DONE) {
+            inflate_done_ = true;
+        } else if (status == TINFL_STATUS_NEEDS_MORE_INPUT && size == 0) {
+            break;
+        }
+    }
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t OtaImageWriter::WriteImage(const uint8_t* data, size_t size) {
+    written_ += size;
+    if (begun_) {
+        return esp_ota_write(handle_, data, size);
+    }
+
+    const size_t header_size = sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t);
+    image_header_.append((const char*)data, size);
+    if (image_header_.size() < header_size) {
+        return ESP_OK;
+    }
+
+    esp_app_desc_t new_app_info;
+    memcpy(&new_app_info, image_header_.data() + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), sizeof(esp_app_desc_t));
+    ESP_LOGI(TAG, "New firmware version: %s", new_app_info.version);
+
+    auto current_version = esp_app_get_description()->version;
+    if (memcmp(new_app_info.version, current_version, sizeof(new_app_info.version)) == 0) {
+        ESP_LOGE(TAG, "Firmware version is the same, skipping upgrade");
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    auto err = esp_ota_begin(partition_, OTA_WITH_SEQUENTIAL_WRITES, &handle_);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to begin OTA: %s", esp_err_to_name(err));
+        return err;
+    }
+    begun_ = true;
+    err = esp_ota_write(handle_, image_header_.data(), image_header_.size());
+    std::string().swap(image_header_);
+    return err;
+}
+
+esp_err_t OtaImageWriter::Finish() {
+    if (!begun_ || (compressed_ && !inflate_done_)) {
+        ESP_LOGE(TAG, "Firmware image is incomplete");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    finished_ = true;
+    return esp_ota_end(handle_);
+}
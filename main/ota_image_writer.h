@@ -0,0 +1,49 @@
+#ifndef OTA_IMAGE_WRITER_H
+#define OTA_IMAGE_WRITER_H
+
+#include <esp_err.h>
+#include <esp_partition.h>
+#include <esp_ota_ops.h>
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Streams the downloaded firmware into the update partition.
+ *
+ * The format is detected from the first byte: 0xE9 is a plain app image, a zlib header (0x78) is
+ * inflated on the fly with the ROM miniz through a 32KB ring dictionary, so compressed images need
+ * no more flash or RAM than the window. esp_ota_begin() is only called once the app description of
+ * the new image has been checked, ESP_ERR_INVALID_VERSION is returned when it is the running one.
+ */
+class OtaImageWriter {
+public:
+    OtaImageWriter(const esp_partition_t* partition);
+    ~OtaImageWriter();
+
+    esp_err_t Write(const uint8_t* data, size_t size);
+    esp_err_t Finish();
+    bool compressed() const { return compressed_; }
+    // Bytes of the decompressed image written so far
+    size_t written() const { return written_; }
+
+private:
+    esp_err_t Inflate(const uint8_t* data, size_t size);
+    esp_err_t WriteImage(const uint8_t* data, size_t size);
+
+    const esp_partition_t* partition_;
+    esp_ota_handle_t handle_ = 0;
+    bool begun_ = false;
+    bool finished_ = false;
+    bool format_known_ = false;
+    bool compressed_ = false;
+    bool inflate_done_ = false;
+    std::string image_header_;
+    void* inflator_ = nullptr;
+    uint8_t* dict_ = nullptr;
+    size_t dict_offset_ = 0;
+    size_t written_ = 0;
+};
+
+#endif // OTA_IMAGE_WRITER_H
@@ -0,0 +1,85 @@
+#include "power_policy.h"
+#include "board.h"
+
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "PowerPolicy"
+
+// 电量回升超过阈值这么多才退出，避免在阈值附近来回切换
+#define POWER_POLICY_HYSTERESIS 5
+
+static const char* const kLevelNames[] = {"normal", "saver", "critical"};
+
+void PowerPolicy::Subscribe(Callback callback) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        callbacks_.push_back(callback);
+    }
+    callback(level_);
+}
+
+void PowerPolicy::Update() {
+    int level = 0;
+    bool charging = false, discharging = false;
+    if (!Board::GetInstance().GetBatteryLevel(level, charging, discharging)) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        battery_level_ = level;
+        charging_ = charging;
+        if (charging || !discharging || CONFIG_POWER_POLICY_SAVER_LEVEL == 0) {
+            battery_policy_ = kPowerPolicyNormal;
+        } else if (level <= CONFIG_POWER_POLICY_CRITICAL_LEVEL) {
+            battery_policy_ = kPowerPolicyCritical;
+        } else if (level <= CONFIG_POWER_POLICY_SAVER_LEVEL) {
+            // Critical is only left with the hysteresis as well
+            if (battery_policy_ != kPowerPolicyCritical || level > CONFIG_POWER_POLICY_CRITICAL_LEVEL + POWER_POLICY_HYSTERESIS) {
+                battery_policy_ = kPowerPolicySaver;
+            }
+        } else if (level > CONFIG_POWER_POLICY_SAVER_LEVEL + POWER_POLICY_HYSTERESIS) {
+            battery_policy_ = kPowerPolicyNormal;
+        }
+    }
+    Apply();
+}
+
+void PowerPolicy::SetOverride(int level) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        override_ = level < 0 ? -1 : std::min(level, (int)kPowerPolicyCritical);
+    }
+    Apply();
+}
+
+void PowerPolicy::Apply() {
+    std::vector<Callback> callbacks;
+    PowerPolicyLevel level;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        level = override_ >= 0 ? (PowerPolicyLevel)override_ : battery_policy_;
+        if (level == level_) {
+            return;
+        }
+        level_ = level;
+        callbacks = callbacks_;
+    }
+    ESP_LOGI(TAG, "Power policy %s, battery %d%%%s", kLevelNames[level], battery_level_, charging_ ? " charging" : "");
+    for (auto& callback : callbacks) {
+        callback(level);
+    }
+}
+
+std::string PowerPolicy::GetStatusJson() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string json = "{\"policy\":\"";
+    json += kLevelNames[level_];
+    json += "\",\"override\":";
+    json += override_ >= 0 ? "true" : "false";
+    json += ",\"battery_level\":" + std::to_string(battery_level_);
+    json += ",\"charging\":";
+    json += charging_ ? "true" : "false";
+    json += "}";
+    return json;
+}
@@ -0,0 +1,59 @@
+#ifndef _POWER_POLICY_H_
+#define _POWER_POLICY_H_
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum PowerPolicyLevel {
+    kPowerPolicyNormal = 0,
+    kPowerPolicySaver,      // 电量低：降低刷新率和背光，编码复杂度降到最低，关闭频谱和摄像头预热
+    kPowerPolicyCritical,   // 电量极低：在省电基础上再限制 CPU 最高频率
+};
+
+/*
+ * Scales the workload to the battery state, battery runtime matters more than peak quality.
+ *
+ * The level follows Board::GetBatteryLevel(), so it works with whatever the board reads the battery
+ * from (AdcBatteryMonitor, Axp2101, Sy6970), with a few percent of hysteresis. While charging or
+ * without a battery it stays normal. Subsystems subscribe once and decide themselves what to turn
+ * down; the callbacks run on the task that calls Update() or SetOverride().
+ */
+class PowerPolicy {
+public:
+    static PowerPolicy& GetInstance() {
+        static PowerPolicy instance;
+        return instance;
+    }
+    PowerPolicy(const PowerPolicy&) = delete;
+    PowerPolicy& operator=(const PowerPolicy&) = delete;
+
+    using Callback = std::function<void(PowerPolicyLevel)>;
+    // The callback is also called at once with the current level
+    void Subscribe(Callback callback);
+    // Polls the battery, called every few seconds from the clock timer
+    void Update();
+    // -1 follows the battery again
+    void SetOverride(int level);
+
+    PowerPolicyLevel level() const { return level_; }
+    bool saving() const { return level_ != kPowerPolicyNormal; }
+    std::string GetStatusJson();
+
+private:
+    PowerPolicy() = default;
+
+    std::mutex mutex_;
+    std::vector<Callback> callbacks_;
+    std::atomic<PowerPolicyLevel> level_{kPowerPolicyNormal};
+    PowerPolicyLevel battery_policy_ = kPowerPolicyNormal;
+    int override_ = -1;
+    int battery_level_ = -1;
+    bool charging_ = false;
+
+    void Apply();
+};
+
+#endif // _POWER_POLICY_H_
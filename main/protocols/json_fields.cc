@@ -0,0 +1,278 @@
+#include "json_fields.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+static size_t SkipSpaces(const char* p, size_t pos, size_t len) {
+    while (pos < len && (p[pos] == ' ' || p[pos] == '\t' || p[pos] == '\n' || p[pos] == '\r')) {
+        pos++;
+    }
+    return pos;
+}
+
+// pos 指向起始引号，返回结束引号之后的位置，失败返回 0
+static size_t ScanString(const char* p, size_t pos, size_t len, bool* escaped) {
+    *escaped = false;
+    for (pos++; pos < len; pos++) {
+        if (p[pos] == '\\') {
+            *escaped = true;
+            pos++;
+        } else if (p[pos] == '"') {
+            return pos + 1;
+        }
+    }
+    return 0;
+}
+
+// 跳过嵌套的对象或数组，返回之后的位置，失败返回 0
+static size_t SkipContainer(const char* p, size_t pos, size_t len) {
+    int depth = 0;
+    bool escaped;
+    while (pos < len) {
+        char c = p[pos];
+        if (c == '"') {
+            pos = ScanString(p, pos, len, &escaped);
+            if (pos == 0) {
+                return 0;
+            }
+            continue;
+        }
+        if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            if (--depth == 0) {
+                return pos + 1;
+            }
+        }
+        pos++;
+    }
+    return 0;
+}
+
+static int HexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool ReadHex4(std::string_view s, size_t pos, uint32_t* value) {
+    if (pos + 4 > s.size()) {
+        return false;
+    }
+    *value = 0;
+    for (size_t i = 0; i < 4; i++) {
+        int v = HexValue(s[pos + i]);
+        if (v < 0) {
+            return false;
+        }
+        *value = (*value << 4) | v;
+    }
+    return true;
+}
+
+static void AppendUtf8(std::string& out, uint32_t cp) {
+    if (cp < 0x80) {
+        out += (char)cp;
+    } else if (cp < 0x800) {
+        out += (char)(0xC0 | (cp >> 6));
+        out += (char)(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out += (char)(0xE0 | (cp >> 12));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    } else {
+        out += (char)(0xF0 | (cp >> 18));
+        out += (char)(0x80 | ((cp >> 12) & 0x3F));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+}
+
+bool JsonFields::Parse(const char* json, size_t len) {
+    count_ = 0;
+    size_t pos = SkipSpaces(json, 0, len);
+    if (pos >= len || json[pos] != '{') {
+        return false;
+    }
+    pos = SkipSpaces(json, pos + 1, len);
+    if (pos < len && json[pos] == '}') {
+        return true;
+    }
+
+    while (pos < len) {
+        bool escaped;
+        if (json[pos] != '"') {
+            return false;
+        }
+        size_t key_end = ScanString(json, pos, len, &escaped);
+        if (key_end == 0) {
+            return false;
+        }
+        std::string_view key(json + pos + 1, key_end - pos - 2);
+
+        pos = SkipSpaces(json, key_end, len);
+        if (pos >= len || json[pos] != ':') {
+            return false;
+        }
+        pos = SkipSpaces(json, pos + 1, len);
+        if (pos >= len) {
+            return false;
+        }
+
+        Field field = {key, {}, false, false};
+        if (json[pos] == '"') {
+            size_t end = ScanString(json, pos, len, &field.escaped);
+            if (end == 0) {
+                return false;
+            }
+            field.value = std::string_view(json + pos + 1, end - pos - 2);
+            field.is_string = true;
+            pos = end;
+        } else if (json[pos] == '{' || json[pos] == '[') {
+            size_t end = SkipContainer(json, pos, len);
+            if (end == 0) {
+                return false;
+            }
+            field.value = std::string_view(json + pos, end - pos);
+            pos = end;
+        } else {
+            size_t start = pos;
+            while (pos < len && json[pos] != ',' && json[pos] != '}' && json[pos] != ' ' &&
+                   json[pos] != '\t' && json[pos] != '\n' && json[pos] != '\r') {
+                pos++;
+            }
+            field.value = std::string_view(json + start, pos - start);
+        }
+        if (count_ < JSON_FIELDS_MAX) {
+            fields_[count_++] = field;
+        }
+
+        pos = SkipSpaces(json, pos, len);
+        if (pos >= len) {
+            return false;
+        }
+        if (json[pos] == '}') {
+            return true;
+        }
+        if (json[pos] != ',') {
+            return false;
+        }
+        pos = SkipSpaces(json, pos + 1, len);
+    }
+    return false;
+}
+
+const JsonFields::Field* JsonFields::Find(const char* key) const {
+    for (int i = 0; i < count_; i++) {
+        if (fields_[i].key == key) {
+            return &fields_[i];
+        }
+    }
+    return nullptr;
+}
+
+bool JsonFields::GetView(const char* key, std::string_view& out) const {
+    auto field = Find(key);
+    if (field == nullptr || !field->is_string || field->escaped) {
+        return false;
+    }
+    out = field->value;
+    return true;
+}
+
+bool JsonFields::Equals(const char* key, const char* value) const {
+    std::string_view view;
+    return GetView(key, view) && view == value;
+}
+
+bool JsonFields::GetNumber(const char* key, double& out) const {
+    auto field = Find(key);
+    if (field == nullptr || field->is_string || field->value.empty()) {
+        return false;
+    }
+    char c = field->value[0];
+    if (c != '-' && (c < '0' || c > '9')) {
+        return false;
+    }
+    // 数字后面总有分隔符，strtod 不会越界
+    out = strtod(field->value.data(), nullptr);
+    return true;
+}
+
+bool JsonFields::GetObject(const char* key, JsonFields& out) const {
+    auto field = Find(key);
+    if (field == nullptr || field->is_string || field->value.empty() || field->value[0] != '{') {
+        return false;
+    }
+    return out.Parse(field->value.data(), field->value.size());
+}
+
+bool JsonFields::GetField(int index, std::string_view& key, std::string& value, bool* is_string) const {
+    if (index < 0 || index >= count_) {
+        return false;
+    }
+    auto& field = fields_[index];
+    key = field.key;
+    *is_string = field.is_string;
+    if (!field.is_string) {
+        value.assign(field.value.data(), field.value.size());
+        return true;
+    }
+    return Unescape(field, value);
+}
+
+bool JsonFields::GetString(const char* key, std::string& out) const {
+    auto field = Find(key);
+    if (field == nullptr || !field->is_string) {
+        return false;
+    }
+    return Unescape(*field, out);
+}
+
+bool JsonFields::Unescape(const Field& field, std::string& out) {
+    auto s = field.value;
+    if (!field.escaped) {
+        out.assign(s.data(), s.size());
+        return true;
+    }
+
+    out.clear();
+    out.reserve(s.size());
+    for (size_t i = 0; i < s.size(); i++) {
+        char c = s[i];
+        if (c != '\\' || i + 1 >= s.size()) {
+            out += c;
+            continue;
+        }
+        c = s[++i];
+        switch (c) {
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'u': {
+            uint32_t cp;
+            if (!ReadHex4(s, i + 1, &cp)) {
+                return false;
+            }
+            i += 4;
+            // UTF-16 代理对
+            uint32_t low;
+            if (cp >= 0xD800 && cp < 0xDC00 && i + 2 < s.size() && s[i + 1] == '\\' && s[i + 2] == 'u' &&
+                ReadHex4(s, i + 3, &low) && low >= 0xDC00 && low < 0xE000) {
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                i += 6;
+            }
+            AppendUtf8(out, cp);
+            break;
+        }
+        default:
+            out += c;
+            break;
+        }
+    }
+    return true;
+}
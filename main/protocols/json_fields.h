@@ -0,0 +1,50 @@
+#ifndef JSON_FIELDS_H
+#define JSON_FIELDS_H
+
+#include <string>
+#include <string_view>
+#include <cstddef>
+
+#define JSON_FIELDS_MAX 16
+
+/*
+ * Allocation-free view of the top-level fields of a JSON object, for the frequent control
+ * messages (tts, stt, llm) that would otherwise build a cJSON tree of dozens of small heap nodes.
+ *
+ * Parse() only records where each key and value is in the input, which must outlive the object.
+ * Nested objects can be parsed again with GetObject(), arrays can not be read, messages that
+ * need them (mcp) go through cJSON instead.
+ */
+class JsonFields {
+public:
+    bool Parse(const char* json, size_t len);
+
+    // Unescaped string value, false if the key is missing or not a string
+    bool GetString(const char* key, std::string& out) const;
+    // The raw string value, false if the key is missing, not a string or contains escapes
+    bool GetView(const char* key, std::string_view& out) const;
+    bool Equals(const char* key, const char* value) const;
+    bool GetNumber(const char* key, double& out) const;
+    // Parses a nested object into out, which views the same input
+    bool GetObject(const char* key, JsonFields& out) const;
+
+    int size() const { return count_; }
+    // Fields in input order, strings unescaped and other values as their literal text
+    bool GetField(int index, std::string_view& key, std::string& value, bool* is_string) const;
+
+private:
+    struct Field {
+        std::string_view key;
+        std::string_view value;     // Without the quotes for strings
+        bool is_string;
+        bool escaped;
+    };
+
+    Field fields_[JSON_FIELDS_MAX];
+    int count_ = 0;
+
+    const Field* Find(const char* key) const;
+    static bool Unescape(const Field& field, std::string& out);
+};
+
+#endif // JSON_FIELDS_H
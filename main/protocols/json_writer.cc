@@ -0,0 +1,42 @@
+#include "json_writer.h"
+
+#include <cstdio>
+
+JsonWriter& JsonWriter::String(std::string_view value) {
+    out_.push_back('"');
+    size_t start = 0;
+    for (size_t i = 0; i < value.size(); i++) {
+        unsigned char c = value[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        // 连续的普通字符整段追加
+        out_.append(value.data() + start, i - start);
+        start = i + 1;
+        switch (c) {
+            case '"': out_.append("\\\""); break;
+            case '\\': out_.append("\\\\"); break;
+            case '\b': out_.append("\\b"); break;
+            case '\f': out_.append("\\f"); break;
+            case '\n': out_.append("\\n"); break;
+            case '\r': out_.append("\\r"); break;
+            case '\t': out_.append("\\t"); break;
+            default: {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out_.append(escaped);
+                break;
+            }
+        }
+    }
+    out_.append(value.data() + start, value.size() - start);
+    out_.push_back('"');
+    return *this;
+}
+
+JsonWriter& JsonWriter::Int(int value) {
+    char buffer[12];
+    int len = snprintf(buffer, sizeof(buffer), "%d", value);
+    out_.append(buffer, len);
+    return *this;
+}
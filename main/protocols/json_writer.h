@@ -0,0 +1,27 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <string>
+#include <string_view>
+
+/*
+ * Appends JSON to an existing string, so a message and its envelope are serialized in one pass
+ * into the buffer that is sent, instead of building a cJSON tree and copying the printed text.
+ * There is no structure checking, the caller writes the punctuation with Raw().
+ */
+class JsonWriter {
+public:
+    JsonWriter(std::string& out) : out_(out) {}
+
+    // Already encoded JSON or punctuation
+    JsonWriter& Raw(std::string_view json) { out_.append(json); return *this; }
+    // Quoted and escaped string
+    JsonWriter& String(std::string_view value);
+    JsonWriter& Int(int value);
+    JsonWriter& Bool(bool value) { return Raw(value ? "true" : "false"); }
+
+private:
+    std::string& out_;
+};
+
+#endif // JSON_WRITER_H
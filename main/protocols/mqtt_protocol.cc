@@ -1,10 +1,15 @@
 #include "mqtt_protocol.h"
 #include "board.h"
 #include "application.h"
+#include "jitter_buffer.h"
 #include "settings.h"
+#include "network_monitor.h"
+#include "memory_guard.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <cstring>
+#include <algorithm>
 #include <arpa/inet.h>
 #include "assets/lang_config.h"
 
@@ -12,10 +17,26 @@
 
 MqttProtocol::MqttProtocol() {
     event_group_handle_ = xEventGroupCreate();
+    if (xTaskCreate([](void* arg) {
+            auto protocol = static_cast<MqttProtocol*>(arg);
+            protocol->SendTask();
+            xEventGroupSetBits(protocol->event_group_handle_, MQTT_PROTOCOL_SEND_EXIT_EVENT);
+            vTaskDelete(NULL);
+        }, "mqtt_send", 4096, this, 4, &send_task_) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the send task");
+        send_task_ = nullptr;
+    }
 }
 
 MqttProtocol::~MqttProtocol() {
     ESP_LOGI(TAG, "MqttProtocol deinit");
+    if (send_task_ != nullptr) {
+        // 不能在 publish 中途删除任务，那时它可能持有 queue_mutex_ 或 mqtt_mutex_；
+        // 通知它退出并等待，publish 本身受 MQTT 客户端的网络超时限制
+        xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SEND_STOP_EVENT);
+        xEventGroupWaitBits(event_group_handle_, MQTT_PROTOCOL_SEND_EXIT_EVENT, pdFALSE, pdFALSE, portMAX_DELAY);
+        send_task_ = nullptr;
+    }
     vEventGroupDelete(event_group_handle_);
 }
 
@@ -23,7 +44,8 @@ bool MqttProtocol::Start() {
     return StartMqttClient(false);
 }
 
-bool MqttProtocol::StartMqttClient(bool report_error) {
+bool MqttProtocol::StartMqttClient(bool report_error, bool background) {
+    std::lock_guard<std::mutex> lock(mqtt_mutex_);
     if (mqtt_ != nullptr) {
         ESP_LOGW(TAG, "Mqtt client already started");
         mqtt_.reset();
@@ -54,7 +76,11 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     });
 
     mqtt_->OnMessage([this](const std::string& topic, const std::string& payload) {
-        cJSON* root = cJSON_Parse(payload.c_str());
+        if (DispatchIncomingMessage(payload.data(), payload.size())) {
+            last_incoming_time_ = std::chrono::steady_clock::now();
+            return;
+        }
+        cJSON* root = MemoryGuard::ParseJson(payload.c_str());
         if (root == nullptr) {
             ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
             return;
@@ -95,11 +121,15 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     }
     if (!mqtt_->Connect(broker_address, broker_port, client_id, username, password)) {
         ESP_LOGE(TAG, "Failed to connect to endpoint");
-        SetError(Lang::Strings::SERVER_NOT_CONNECTED);
+        if (!background) {
+            SetError(Lang::Strings::SERVER_NOT_CONNECTED);
+        }
         return false;
     }
 
     ESP_LOGI(TAG, "Connected to endpoint");
+    last_incoming_time_ = std::chrono::steady_clock::now();
+    ResetProbeInterval();
     return true;
 }
 
@@ -112,38 +142,98 @@ bool MqttProtocol::SendText(const std::string& text) {
         ESP_LOGE(TAG, "SendText: publish_topic_ is empty, message not sent: %s", text.c_str());
         return false;
     }
-    if (!mqtt_->Publish(publish_topic_, text)) {
-        ESP_LOGE(TAG, "Failed to publish message: %s", text.c_str());
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        bool mcp = text.find("\"type\":\"mcp\"") != std::string::npos;
+        auto& queue = mcp ? mcp_queue_ : control_queue_;
+        if (queue.size() >= MQTT_SEND_QUEUE_MAX) {
+            ESP_LOGE(TAG, "SendText: send queue full, drop message: %.*s", 256, text.c_str());
+            return false;
+        }
+        queue.push_back(text);
+    }
+    xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SEND_EVENT);
+    return true;
+}
+
+bool MqttProtocol::Publish(const std::string& payload, int qos) {
+    bool published;
+    {
+        std::lock_guard<std::mutex> lock(mqtt_mutex_);
+        published = mqtt_ != nullptr && mqtt_->Publish(publish_topic_, payload, qos);
+    }
+    if (!published) {
+        ESP_LOGE(TAG, "Failed to publish message: %.*s", 256, payload.c_str());
         SetError(Lang::Strings::SERVER_ERROR);
         return false;
     }
     return true;
 }
 
-bool MqttProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
+void MqttProtocol::SendTask() {
+    std::string payload;
+    while (true) {
+        auto bits = xEventGroupWaitBits(event_group_handle_, MQTT_PROTOCOL_SEND_EVENT | MQTT_PROTOCOL_SEND_STOP_EVENT,
+            pdFALSE, pdFALSE, portMAX_DELAY);
+        if (bits & MQTT_PROTOCOL_SEND_STOP_EVENT) {
+            return;
+        }
+        xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_SEND_EVENT);
+        while (!(xEventGroupGetBits(event_group_handle_) & MQTT_PROTOCOL_SEND_STOP_EVENT)) {
+            int qos;
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex_);
+                bool control = !control_queue_.empty();
+                auto& queue = control ? control_queue_ : mcp_queue_;
+                if (queue.empty()) {
+                    break;
+                }
+                qos = control ? CONFIG_MQTT_CONTROL_QOS : CONFIG_MQTT_MCP_QOS;
+                payload = std::move(queue.front());
+                queue.pop_front();
+                // 上一次 publish 期间排起来的消息一次发出，例如唤醒词和开始监听
+                if (text_batch_ && !queue.empty() && payload.size() + queue.front().size() + 3 <= MQTT_TEXT_BATCH_MAX_SIZE) {
+                    payload.insert(0, 1, '[');
+                    while (!queue.empty() && payload.size() + queue.front().size() + 2 <= MQTT_TEXT_BATCH_MAX_SIZE) {
+                        payload += ',';
+                        payload += queue.front();
+                        queue.pop_front();
+                    }
+                    payload += ']';
+                }
+            }
+            Publish(payload, qos);
+        }
+    }
+}
+
+bool MqttProtocol::SendAudio(AudioStreamPacketPtr packet) {
     std::lock_guard<std::mutex> lock(channel_mutex_);
     if (udp_ == nullptr) {
         return false;
     }
 
-    std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(packet->payload.size());
-    *(uint32_t*)&nonce[8] = htonl(packet->timestamp);
-    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
-
-    std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + packet->payload.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
+    // 包头即 nonce，直接写在复用的发送缓冲区里，稳态下不再分配内存
+    size_t payload_size = packet->payload.size();
+    udp_send_buffer_.resize(aes_nonce_.size() + payload_size);
+    auto buffer = (uint8_t*)udp_send_buffer_.data();
+    memcpy(buffer, aes_nonce_.data(), aes_nonce_.size());
+    *(uint16_t*)&buffer[2] = htons(payload_size);
+    *(uint32_t*)&buffer[8] = htonl(packet->timestamp);
+    *(uint32_t*)&buffer[12] = htonl(++local_sequence_);
 
+    // CTR 模式会修改计数器，在栈上复制一份
     size_t nc_off = 0;
+    uint8_t nonce_counter[16];
     uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, packet->payload.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)packet->payload.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
+    memcpy(nonce_counter, buffer, sizeof(nonce_counter));
+    if (mbedtls_aes_crypt_ctr(&aes_ctx_, payload_size, &nc_off, nonce_counter, stream_block,
+        packet->payload.data(), buffer + aes_nonce_.size()) != 0) {
         ESP_LOGE(TAG, "Failed to encrypt audio data");
         return false;
     }
 
-    return udp_->Send(encrypted) > 0;
+    return udp_->Send(udp_send_buffer_) > 0;
 }
 
 void MqttProtocol::CloseAudioChannel() {
@@ -158,13 +248,62 @@ void MqttProtocol::CloseAudioChannel() {
     message += "}";
     SendText(message);
 
+    ResetProbeInterval();
     if (on_audio_channel_closed_ != nullptr) {
         on_audio_channel_closed_();
     }
 }
 
+// 空闲时 MQTT 连接一直保持着，唤醒后直接发 hello。断线时在后台重连，
+// 服务器支持 ping 时还按 RTT 判断半开的连接，免得等到唤醒之后才发现
+void MqttProtocol::CheckLiveness() {
+#if CONFIG_PROTOCOL_PROBE_MIN_INTERVAL_SECONDS > 0
+    if (udp_ != nullptr) {
+        return;
+    }
+    bool connected;
+    {
+        std::lock_guard<std::mutex> lock(mqtt_mutex_);
+        // 没有配置 endpoint 时从未创建客户端
+        if (mqtt_ == nullptr) {
+            return;
+        }
+        connected = mqtt_->IsConnected();
+    }
+    if (connected && IsProbeLost()) {
+        ESP_LOGW(TAG, "No pong in %d ms, the connection is half-open", ProbeTimeoutMs());
+        connected = false;
+    }
+    if (!connected) {
+        auto now = std::chrono::steady_clock::now();
+        if (now - reconnect_time_ < std::chrono::milliseconds(MQTT_RECONNECT_INTERVAL_MS)) {
+            return;
+        }
+        reconnect_time_ = now;
+        ESP_LOGI(TAG, "Reconnecting in the background");
+        StartMqttClient(false, true);
+        return;
+    }
+    if (!ping_ || !IsProbeDue()) {
+        return;
+    }
+    // 不进发送队列，失败时也不报错，下次检查时重连
+    bool published;
+    {
+        std::lock_guard<std::mutex> lock(mqtt_mutex_);
+        published = mqtt_ != nullptr && mqtt_->Publish(publish_topic_, "{\"type\":\"ping\"}", 0);
+    }
+    if (published) {
+        OnProbeSent(true);
+    } else {
+        ESP_LOGW(TAG, "Failed to publish the ping");
+    }
+#endif
+}
+
 bool MqttProtocol::OpenAudioChannel() {
-    if (mqtt_ == nullptr || !mqtt_->IsConnected()) {
+    // 半开的连接 IsConnected() 仍为 true，只有探测能发现
+    if (mqtt_ == nullptr || !mqtt_->IsConnected() || IsProbeLost()) {
         ESP_LOGI(TAG, "MQTT is not connected, try to connect now");
         if (!StartMqttClient(true)) {
             return false;
@@ -173,10 +312,13 @@ bool MqttProtocol::OpenAudioChannel() {
 
     error_occurred_ = false;
     session_id_ = "";
+    text_batch_ = false;
     xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 
+    // hello 不进发送队列，直接发出
     auto message = GetHelloMessage();
-    if (!SendText(message)) {
+    int64_t hello_time = esp_timer_get_time();
+    if (!Publish(message, 0)) {
         return false;
     }
 
@@ -187,6 +329,7 @@ bool MqttProtocol::OpenAudioChannel() {
         SetError(Lang::Strings::SERVER_TIMEOUT);
         return false;
     }
+    NetworkMonitor::GetInstance().ReportRtt((esp_timer_get_time() - hello_time) / 1000);
 
     std::lock_guard<std::mutex> lock(channel_mutex_);
     auto network = Board::GetInstance().GetNetwork();
@@ -197,7 +340,7 @@ bool MqttProtocol::OpenAudioChannel() {
          * |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
          * |payload payload_len|
          */
-        if (data.size() < sizeof(aes_nonce_)) {
+        if (data.size() < aes_nonce_.size()) {
             ESP_LOGE(TAG, "Invalid audio packet size: %u", data.size());
             return;
         }
@@ -207,25 +350,29 @@ bool MqttProtocol::OpenAudioChannel() {
         }
         uint32_t timestamp = ntohl(*(uint32_t*)&data[8]);
         uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
-        if (sequence < remote_sequence_) {
+        // Slightly reordered packets are passed on, the jitter buffer puts them back in order
+        if (sequence + JITTER_BUFFER_MAX_PACKETS <= remote_sequence_) {
             ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
             return;
         }
-        if (sequence != remote_sequence_ + 1) {
+        if (sequence > remote_sequence_ + 1) {
             ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
         }
 
         size_t decrypted_size = data.size() - aes_nonce_.size();
         size_t nc_off = 0;
+        uint8_t nonce[16];
         uint8_t stream_block[16] = {0};
-        auto nonce = (uint8_t*)data.data();
-        auto encrypted = (uint8_t*)data.data() + aes_nonce_.size();
-        auto packet = std::make_unique<AudioStreamPacket>();
+        memcpy(nonce, data.data(), sizeof(nonce));
+        auto encrypted = (const uint8_t*)data.data() + aes_nonce_.size();
+        auto packet = AcquireAudioStreamPacket();
         packet->sample_rate = server_sample_rate_;
         packet->frame_duration = server_frame_duration_;
         packet->timestamp = timestamp;
+        packet->sequence = sequence;
+        packet->time_us = esp_timer_get_time();
         packet->payload.resize(decrypted_size);
-        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)packet->payload.data());
+        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, packet->payload.data());
         if (ret != 0) {
             ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
             return;
@@ -233,7 +380,7 @@ bool MqttProtocol::OpenAudioChannel() {
         if (on_incoming_audio_ != nullptr) {
             on_incoming_audio_(std::move(packet));
         }
-        remote_sequence_ = sequence;
+        remote_sequence_ = std::max(remote_sequence_, sequence);
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
@@ -256,12 +403,16 @@ std::string MqttProtocol::GetHelloMessage() {
     cJSON_AddBoolToObject(features, "aec", true);
 #endif
     cJSON_AddBoolToObject(features, "mcp", true);
+    cJSON_AddBoolToObject(features, "text_batch", true);
+    AddFlowControlFeature(features);
+    AddPingFeature(features);
     cJSON_AddItemToObject(root, "features", features);
     cJSON* audio_params = cJSON_CreateObject();
     cJSON_AddStringToObject(audio_params, "format", "opus");
     cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
     cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
+    cJSON_AddNumberToObject(audio_params, "frame_duration", client_frame_duration_);
+    AddAudioCodecs(audio_params);
     cJSON_AddItemToObject(root, "audio_params", audio_params);
     auto json_str = cJSON_PrintUnformatted(root);
     std::string message(json_str);
@@ -283,9 +434,18 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
         ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
     }
 
+    // 服务器同意后，排队的文本消息可以合并成 JSON 数组发布
+    auto features = cJSON_GetObjectItem(root, "features");
+    text_batch_ = cJSON_IsObject(features) && cJSON_IsTrue(cJSON_GetObjectItem(features, "text_batch"));
+    ParseFlowControlFeature(features);
+    ParsePingFeature(features);
+
     // Get sample rate from hello message
     auto audio_params = cJSON_GetObjectItem(root, "audio_params");
     if (cJSON_IsObject(audio_params)) {
+        if (!CheckAudioFormat(audio_params)) {
+            return;
+        }
         auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
         if (cJSON_IsNumber(sample_rate)) {
             server_sample_rate_ = sample_rate->valueint;
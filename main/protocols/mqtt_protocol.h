@@ -9,16 +9,26 @@
 #include <mbedtls/aes.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <freertos/task.h>
 
 #include <functional>
 #include <string>
 #include <map>
 #include <mutex>
+#include <deque>
+#include <atomic>
 
 #define MQTT_PING_INTERVAL_SECONDS 90
 #define MQTT_RECONNECT_INTERVAL_MS 10000
 
 #define MQTT_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
+#define MQTT_PROTOCOL_SEND_EVENT (1 << 1)
+#define MQTT_PROTOCOL_SEND_STOP_EVENT (1 << 2)
+#define MQTT_PROTOCOL_SEND_EXIT_EVENT (1 << 3)
+
+#define MQTT_SEND_QUEUE_MAX 16
+// 合并后一次 publish 的最大长度
+#define MQTT_TEXT_BATCH_MAX_SIZE 2048
 
 class MqttProtocol : public Protocol {
 public:
@@ -26,10 +36,11 @@ public:
     ~MqttProtocol();
 
     bool Start() override;
-    bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
+    bool SendAudio(AudioStreamPacketPtr packet) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
+    void CheckLiveness() override;
 
 private:
     EventGroupHandle_t event_group_handle_;
@@ -37,20 +48,33 @@ private:
     std::string publish_topic_;
 
     std::mutex channel_mutex_;
+    std::mutex mqtt_mutex_;
     std::unique_ptr<Mqtt> mqtt_;
+    // 控制消息优先于 MCP 消息；发送中排起的同类消息在服务器支持 text_batch 时合并成一个 JSON 数组
+    std::mutex queue_mutex_;
+    std::deque<std::string> control_queue_;
+    std::deque<std::string> mcp_queue_;
+    std::atomic<bool> text_batch_ = false;
+    TaskHandle_t send_task_ = nullptr;
     std::unique_ptr<Udp> udp_;
     mbedtls_aes_context aes_ctx_;
     std::string aes_nonce_;
+    std::string udp_send_buffer_;
     std::string udp_server_;
     int udp_port_;
     uint32_t local_sequence_;
     uint32_t remote_sequence_;
+    std::chrono::steady_clock::time_point reconnect_time_;
 
-    bool StartMqttClient(bool report_error=false);
+    // background 为 true 时连接失败不报错，由下一次 CheckLiveness() 重试
+    bool StartMqttClient(bool report_error=false, bool background=false);
     void ParseServerHello(const cJSON* root);
     std::string DecodeHexString(const std::string& hex_string);
 
+    // 只排队，返回 true 表示已经进入发送队列；publish 失败由发送任务通过 SetError() 报告
     bool SendText(const std::string& text) override;
+    bool Publish(const std::string& payload, int qos);
+    void SendTask();
     std::string GetHelloMessage();
 };
 
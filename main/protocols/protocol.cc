@@ -1,15 +1,77 @@
 #include "protocol.h"
+#include "audio_service.h"
+#include "network_monitor.h"
+#if CONFIG_SESSION_RECORDER
+#include "session_recorder.h"
+#endif
 
 #include <esp_log.h>
+#include <cstring>
+#include <algorithm>
 
 #define TAG "Protocol"
 
+// Enough for full decode and send queues and a full jitter buffer, plus the packets being
+// received, decoded, encoded or sent, so TTS bursts do not fall back to heap packets
+#define AUDIO_STREAM_PACKET_POOL_SIZE (MAX_DECODE_PACKETS_IN_QUEUE + MAX_SEND_PACKETS_IN_QUEUE + JITTER_BUFFER_MAX_PACKETS + 4)
+
+// 探测超时按握手测得的 RTT 计算，还没有 RTT 时用上限
+#define PROBE_TIMEOUT_RTT_FACTOR 4
+#define PROBE_TIMEOUT_MARGIN_MS 500
+#define PROBE_TIMEOUT_MIN_MS 1500
+#define PROBE_TIMEOUT_MAX_MS 10000
+
+AudioStreamPacketPtr AcquireAudioStreamPacket() {
+    static ObjectPool<AudioStreamPacket, AUDIO_STREAM_PACKET_POOL_SIZE> pool;
+    auto packet = pool.Acquire();
+    packet->borrowed_payload = {};
+    packet->cached_sound.reset();
+    packet->codec = kAudioPayloadOpus;
+    return packet;
+}
+
 void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
     on_incoming_json_ = callback;
 }
 
-void Protocol::OnIncomingAudio(std::function<void(std::unique_ptr<AudioStreamPacket> packet)> callback) {
+void Protocol::OnIncomingMessage(const std::string& type, std::function<void(const JsonFields& fields)> callback) {
+    message_handlers_[type] = callback;
+}
+
+bool Protocol::DispatchIncomingMessage(const char* data, size_t len) {
+#if CONFIG_SESSION_RECORDER
+    // 所有协议收到的文本消息都经过这里
+    SessionRecorder::GetInstance().RecordText(data, len);
+#endif
+    if (message_handlers_.empty()) {
+        return false;
+    }
+    JsonFields fields;
+    std::string_view type;
+    if (!fields.Parse(data, len) || !fields.GetView("type", type)) {
+        return false;
+    }
+    // 消息类型都很短，构造 std::string 不会分配堆内存
+    auto it = message_handlers_.find(std::string(type));
+    if (it == message_handlers_.end()) {
+        return false;
+    }
+    it->second(fields);
+    return true;
+}
+
+void Protocol::OnIncomingAudio(std::function<void(AudioStreamPacketPtr packet)> callback) {
+#if CONFIG_SESSION_RECORDER
+    on_incoming_audio_ = [callback](AudioStreamPacketPtr packet) {
+        auto& recorder = SessionRecorder::GetInstance();
+        if (recorder.recording()) {
+            recorder.RecordAudio(*packet);
+        }
+        callback(std::move(packet));
+    };
+#else
     on_incoming_audio_ = callback;
+#endif
 }
 
 void Protocol::OnAudioChannelOpened(std::function<void()> callback) {
@@ -17,7 +79,14 @@ void Protocol::OnAudioChannelOpened(std::function<void()> callback) {
 }
 
 void Protocol::OnAudioChannelClosed(std::function<void()> callback) {
+#if CONFIG_SESSION_RECORDER
+    on_audio_channel_closed_ = [callback]() {
+        SessionRecorder::GetInstance().RecordClose();
+        callback();
+    };
+#else
     on_audio_channel_closed_ = callback;
+#endif
 }
 
 void Protocol::OnNetworkError(std::function<void(const std::string& message)> callback) {
@@ -65,10 +134,126 @@ void Protocol::SendStopListening() {
     SendText(message);
 }
 
+bool Protocol::SendAudioBatch(AudioStreamPacketPtr* packets, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (!SendAudio(std::move(packets[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Protocol::AddAudioCodecs(cJSON* audio_params) {
+    cJSON* codecs = cJSON_CreateArray();
+    cJSON_AddItemToArray(codecs, cJSON_CreateString("opus"));
+    cJSON_AddItemToObject(audio_params, "codecs", codecs);
+}
+
+bool Protocol::CheckAudioFormat(const cJSON* audio_params) {
+    auto format = cJSON_GetObjectItem(audio_params, "format");
+    if (cJSON_IsString(format) && strcmp(format->valuestring, "opus") != 0) {
+        ESP_LOGE(TAG, "Unsupported audio format: %s", format->valuestring);
+        return false;
+    }
+    return true;
+}
+
+void Protocol::AddFlowControlFeature(cJSON* features) {
+    cJSON_AddNumberToObject(features, "flow_control", AUDIO_DECODE_QUEUE_MS);
+}
+
+void Protocol::ParseFlowControlFeature(const cJSON* features) {
+    flow_control_ = cJSON_IsObject(features) && cJSON_IsTrue(cJSON_GetObjectItem(features, "flow_control"));
+    if (flow_control_) {
+        ESP_LOGI(TAG, "Downlink flow control enabled, %d ms buffer", AUDIO_DECODE_QUEUE_MS);
+    }
+}
+
+void Protocol::AddPingFeature(cJSON* features) {
+#if CONFIG_PROTOCOL_PROBE_MIN_INTERVAL_SECONDS > 0
+    cJSON_AddBoolToObject(features, "ping", true);
+#endif
+}
+
+void Protocol::ParsePingFeature(const cJSON* features) {
+    ping_ = cJSON_IsObject(features) && cJSON_IsTrue(cJSON_GetObjectItem(features, "ping"));
+    if (ping_) {
+        // 收到 pong 即更新 last_incoming_time_，不需要交给应用层
+        message_handlers_.emplace("pong", [](const JsonFields&) {});
+    }
+}
+
+bool Protocol::IsProbeDue() const {
+    if (probe_answer_expected_ && probe_time_ > last_incoming_time_) {
+        return false;
+    }
+    auto last = std::max(last_incoming_time_, probe_time_);
+    return std::chrono::steady_clock::now() - last >= std::chrono::seconds(probe_interval_s_);
+}
+
+bool Protocol::IsProbeLost() const {
+    if (!probe_answer_expected_ || probe_time_ <= last_incoming_time_) {
+        return false;
+    }
+    return std::chrono::steady_clock::now() - probe_time_ > std::chrono::milliseconds(ProbeTimeoutMs());
+}
+
+void Protocol::OnProbeSent(bool expect_answer) {
+    // 上一次探测有回应（或者无从得知），连接稳定时逐步放宽间隔
+    if (probe_time_.time_since_epoch().count() != 0) {
+        probe_interval_s_ = std::min(probe_interval_s_ * 2, CONFIG_PROTOCOL_PROBE_MAX_INTERVAL_SECONDS);
+    }
+    probe_time_ = std::chrono::steady_clock::now();
+    probe_answer_expected_ = expect_answer;
+}
+
+void Protocol::ResetProbeInterval() {
+    probe_interval_s_ = CONFIG_PROTOCOL_PROBE_MIN_INTERVAL_SECONDS;
+    probe_time_ = {};
+    probe_answer_expected_ = false;
+}
+
+int Protocol::ProbeTimeoutMs() const {
+    int rtt_ms = NetworkMonitor::GetInstance().rtt_ms();
+    if (rtt_ms <= 0) {
+        return PROBE_TIMEOUT_MAX_MS;
+    }
+    return std::clamp(rtt_ms * PROBE_TIMEOUT_RTT_FACTOR + PROBE_TIMEOUT_MARGIN_MS, PROBE_TIMEOUT_MIN_MS, PROBE_TIMEOUT_MAX_MS);
+}
+
+void Protocol::SendFlowControl(int buffered_ms, bool overflow) {
+    if (!flow_control_) {
+        return;
+    }
+    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"flow\"";
+    message += ",\"buffered_ms\":" + std::to_string(buffered_ms);
+    message += ",\"capacity_ms\":" + std::to_string(AUDIO_DECODE_QUEUE_MS);
+    if (overflow) {
+        message += ",\"overflow\":true";
+    }
+    message += "}";
+    SendText(message);
+}
+
 void Protocol::SendMcpMessage(const std::string& payload) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"mcp\",\"payload\":" + payload + "}";
+    SendMcpEnvelope(BuildMcpMessage([&payload](JsonWriter& writer) {
+        writer.Raw(payload);
+    }, payload.size()));
+}
+
+std::string Protocol::BuildMcpMessage(const std::function<void(JsonWriter& writer)>& write_payload, size_t size_hint) const {
+    std::string message;
+    message.reserve(size_hint + session_id_.size() + 64);
+    JsonWriter writer(message);
+    writer.Raw("{\"session_id\":").String(session_id_).Raw(",\"type\":\"mcp\",\"payload\":");
+    write_payload(writer);
+    writer.Raw("}");
+    return message;
+}
+
+void Protocol::SendMcpEnvelope(const std::string& message) {
     if (!SendText(message)) {
-        ESP_LOGE(TAG, "SendMcpMessage failed, payload: %s", payload.c_str());
+        ESP_LOGE(TAG, "SendMcpMessage failed, message: %.*s", 256, message.c_str());
     }
 }
 
@@ -79,6 +264,9 @@ bool Protocol::IsTimeout() const {
     bool timeout = duration.count() > kTimeoutSeconds;
     if (timeout) {
         ESP_LOGE(TAG, "Channel timeout %ld seconds", (long)duration.count());
+    } else if (IsProbeLost()) {
+        ESP_LOGE(TAG, "Channel timeout, no pong in %d ms", ProbeTimeoutMs());
+        timeout = true;
     }
     return timeout;
 }
@@ -1,22 +1,63 @@
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
+#include <sdkconfig.h>
 #include <cJSON.h>
 #include <string>
+#include <string_view>
 #include <functional>
 #include <chrono>
 #include <vector>
+#include <memory>
+#include <unordered_map>
+
+#include "object_pool.h"
+#include "json_fields.h"
+#include "json_writer.h"
+
+class CachedSound;
+
+// Codec of AudioStreamPacket::payload, local sounds may carry raw frames already at the output sample rate
+enum AudioPayloadCodec : uint8_t {
+    kAudioPayloadOpus = 0,
+    kAudioPayloadPcm16 = 1,
+    kAudioPayloadImaAdpcm = 2,
+};
 
 struct AudioStreamPacket {
     int sample_rate = 0;
     int frame_duration = 0;
     uint32_t timestamp = 0;
+    uint32_t sequence = 0;  // Transport sequence number, 0 if the transport is ordered (no jitter buffering)
+    int64_t time_us = 0;    // Local time of the last pipeline stage, for latency tracing
     std::vector<uint8_t> payload;
+    // Borrowed payload in read-only memory (embedded sounds), used instead of payload when not empty
+    std::string_view borrowed_payload;
+    // Decoded PCM cache of the sound this packet belongs to, see AudioService::PlaySound()
+    std::shared_ptr<CachedSound> cached_sound;
+    size_t cached_frame = 0;
+    AudioPayloadCodec codec = kAudioPayloadOpus;
 };
 
+using AudioStreamPacketPtr = PooledPtr<AudioStreamPacket>;
+
+// When this many packets wait in the send queue, up to AUDIO_SEND_BATCH_MAX_PACKETS are sent in one write
+#define AUDIO_SEND_BATCH_WATERMARK 3
+#define AUDIO_SEND_BATCH_MAX_PACKETS 5
+
+// Packets are recycled through a preallocated pool, all fields except borrowed_payload, cached_sound and codec must be set by the caller
+AudioStreamPacketPtr AcquireAudioStreamPacket();
+
+// Message type of BinaryProtocol2/3 carrying a JPEG video frame
+#define BINARY_PROTOCOL_TYPE_JPEG 2
+// Runtime metrics report, see system_metrics.h
+#define BINARY_PROTOCOL_TYPE_METRICS 3
+// Part of a long text message, see TextChunkHeader
+#define BINARY_PROTOCOL_TYPE_TEXT_CHUNK 4
+
 struct BinaryProtocol2 {
     uint16_t version;
-    uint16_t type;          // Message type (0: OPUS, 1: JSON)
+    uint16_t type;          // Message type (0: OPUS, 1: JSON, 2: JPEG, 3: METRICS, 4: TEXT_CHUNK)
     uint32_t reserved;      // Reserved for future use
     uint32_t timestamp;     // Timestamp in milliseconds (used for server-side AEC)
     uint32_t payload_size;  // Payload size in bytes
@@ -30,6 +71,33 @@ struct BinaryProtocol3 {
     uint8_t payload[];
 } __attribute__((packed));
 
+#define BINARY_PROTOCOL4_CODEC_OPUS 0
+#define BINARY_PROTOCOL4_CODEC_JPEG 1  // Video frame, sequence counts video frames separately
+#define BINARY_PROTOCOL4_CODEC_METRICS 2
+#define BINARY_PROTOCOL4_CODEC_TEXT_CHUNK 3
+#define BINARY_PROTOCOL4_FLAG_FEC (1 << 0)  // The payload carries in-band FEC for the previous frame
+#define BINARY_PROTOCOL4_FLAG_DTX (1 << 1)  // Discontinuous transmission (silence) frame
+
+struct BinaryProtocol4 {
+    uint8_t codec;          // Codec id, BINARY_PROTOCOL4_CODEC_*
+    uint8_t flags;          // BINARY_PROTOCOL4_FLAG_*
+    uint16_t payload_size;  // Payload size in bytes
+    uint32_t sequence;      // Per-direction frame counter starting at 1, 0 is never sent
+    uint32_t timestamp;     // Timestamp in milliseconds (used for server-side AEC)
+    uint8_t payload[];      // Payload data
+} __attribute__((packed));
+
+#define TEXT_CHUNK_FLAG_LAST (1 << 0)
+
+// Payload of a TEXT_CHUNK binary frame. The receiver appends the data of chunks with the same message id
+// and handles the text once the last chunk arrives. Audio frames may come between the chunks.
+struct TextChunkHeader {
+    uint16_t message_id;    // Network byte order, per connection counter
+    uint8_t flags;          // TEXT_CHUNK_FLAG_*
+    uint8_t reserved;
+    uint8_t data[];         // UTF-8 text, may split a multi-byte character
+} __attribute__((packed));
+
 enum AbortReason {
     kAbortReasonNone,
     kAbortReasonWakeWordDetected
@@ -51,12 +119,20 @@ public:
     inline int server_frame_duration() const {
         return server_frame_duration_;
     }
+    // Uplink frame duration proposed in the next client hello
+    void SetFrameDuration(int duration_ms) { client_frame_duration_ = duration_ms; }
+    // A server that accepts the proposal answers with the same frame duration, older servers always answer 60
+    inline int uplink_frame_duration() const {
+        return server_frame_duration_ == client_frame_duration_ ? client_frame_duration_ : 60;
+    }
     inline const std::string& session_id() const {
         return session_id_;
     }
 
-    void OnIncomingAudio(std::function<void(std::unique_ptr<AudioStreamPacket> packet)> callback);
+    void OnIncomingAudio(std::function<void(AudioStreamPacketPtr packet)> callback);
     void OnIncomingJson(std::function<void(const cJSON* root)> callback);
+    // Frequent messages of this type are parsed with JsonFields instead of building a cJSON tree
+    void OnIncomingMessage(const std::string& type, std::function<void(const JsonFields& fields)> callback);
     void OnAudioChannelOpened(std::function<void()> callback);
     void OnAudioChannelClosed(std::function<void()> callback);
     void OnNetworkError(std::function<void(const std::string& message)> callback);
@@ -65,27 +141,70 @@ public:
     virtual bool OpenAudioChannel() = 0;
     virtual void CloseAudioChannel() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
-    virtual bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) = 0;
+    // Keep a connection ready after a conversation so the next OpenAudioChannel() skips the handshake
+    virtual void PrewarmAudioChannel() {}
+    virtual bool IsWarmAudioChannelExpired() const { return false; }
+    virtual void ReleaseWarmAudioChannel() {}
+    // Called from the main loop while idle: probes the idle connection and reconnects it in the background when dead
+    virtual void CheckLiveness() {}
+    virtual bool SendAudio(AudioStreamPacketPtr packet) = 0;
+    // Protocols that negotiated aggregation pack the packets into one network write, others send them one by one
+    virtual bool SendAudioBatch(AudioStreamPacketPtr* packets, size_t count);
     virtual void SendWakeWordDetected(const std::string& wake_word);
     virtual void SendStartListening(ListeningMode mode);
     virtual void SendStopListening();
     virtual void SendAbortSpeaking(AbortReason reason);
     virtual void SendMcpMessage(const std::string& message);
+    // One JPEG frame of the camera stream, only binary protocol 2 and above carry video
+    virtual bool SendVideoFrame(const uint8_t* jpeg, size_t size, uint32_t timestamp) { return false; }
+    virtual bool SendMetricsReport(const uint8_t* report, size_t size) { return false; }
+    // Decode queue level for servers that negotiated flow_control, overflow means a packet was dropped
+    void SendFlowControl(int buffered_ms, bool overflow);
+    // The whole mcp message in one buffer, write_payload appends the payload, size_hint is the expected payload size
+    std::string BuildMcpMessage(const std::function<void(JsonWriter& writer)>& write_payload, size_t size_hint = 0) const;
+    void SendMcpEnvelope(const std::string& message);
 
 protected:
     std::function<void(const cJSON* root)> on_incoming_json_;
-    std::function<void(std::unique_ptr<AudioStreamPacket> packet)> on_incoming_audio_;
+    std::unordered_map<std::string, std::function<void(const JsonFields& fields)>> message_handlers_;
+    std::function<void(AudioStreamPacketPtr packet)> on_incoming_audio_;
     std::function<void()> on_audio_channel_opened_;
     std::function<void()> on_audio_channel_closed_;
     std::function<void(const std::string& message)> on_network_error_;
 
     int server_sample_rate_ = 24000;
     int server_frame_duration_ = 60;
+    int client_frame_duration_ = 60;
     bool error_occurred_ = false;
+    bool flow_control_ = false;
+    // The server answers {"type":"ping"} with a pong, kept across sessions since later connections go to the same server
+    bool ping_ = false;
+    bool probe_answer_expected_ = false;
+    int probe_interval_s_ = CONFIG_PROTOCOL_PROBE_MIN_INTERVAL_SECONDS;
+    std::chrono::time_point<std::chrono::steady_clock> probe_time_;
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
 
     virtual bool SendText(const std::string& text) = 0;
+    // Returns true if a handler registered with OnIncomingMessage() took the message
+    bool DispatchIncomingMessage(const char* data, size_t len);
+    // Lists the supported codecs in the client hello and checks the one chosen by the server hello
+    void AddAudioCodecs(cJSON* audio_params);
+    bool CheckAudioFormat(const cJSON* audio_params);
+    // The client hello offers the decode queue capacity in ms, the server enables the reports by answering true
+    void AddFlowControlFeature(cJSON* features);
+    void ParseFlowControlFeature(const cJSON* features);
+    void AddPingFeature(cJSON* features);
+    void ParsePingFeature(const cJSON* features);
+    // Nothing received for the probe interval and no probe in flight
+    bool IsProbeDue() const;
+    // A ping got no answer within the RTT based timeout, the connection is most likely half-open
+    bool IsProbeLost() const;
+    // expect_answer is false for probes without a reply we can see (websocket ping frames)
+    void OnProbeSent(bool expect_answer);
+    // Probes start again at the shortest interval, after a conversation or a reconnect
+    void ResetProbeInterval();
+    int ProbeTimeoutMs() const;
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
 };
@@ -0,0 +1,285 @@
+#include "replay_protocol.h"
+#include "application.h"
+#include "audio_service.h"
+#include "board.h"
+#include "memory_guard.h"
+#include "assets/lang_config.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "Replay"
+
+// 读文件系统的任务栈必须在内部 RAM
+#define REPLAY_TASK_STACK_SIZE 4096
+#define REPLAY_TASK_PRIORITY 5
+// 快速模式暂停时查看水位的间隔
+#define REPLAY_PAUSE_POLL_MS 10
+#define REPLAY_STOP_TIMEOUT_MS 2000
+
+ReplayProtocol::ReplayProtocol(ReplayMode mode) : mode_(mode) {
+}
+
+ReplayProtocol::~ReplayProtocol() {
+    CloseAudioChannel();
+    if (file_ != nullptr) {
+        fclose(file_);
+    }
+}
+
+bool ReplayProtocol::Start() {
+    file_ = fopen(CONFIG_SESSION_RECORDER_PATH, "rb");
+    if (file_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to open %s, is the file system mounted?", CONFIG_SESSION_RECORDER_PATH);
+        return false;
+    }
+    uint32_t magic = 0;
+    if (fread(&magic, sizeof(magic), 1, file_) != 1 || magic != SESSION_RECORD_MAGIC) {
+        ESP_LOGE(TAG, "%s is not a session recording", CONFIG_SESSION_RECORDER_PATH);
+        fclose(file_);
+        file_ = nullptr;
+        return false;
+    }
+    ESP_LOGW(TAG, "Replaying %s in %s mode", CONFIG_SESSION_RECORDER_PATH,
+        mode_ == kReplayModeFast ? "fast" : "realtime");
+    return true;
+}
+
+bool ReplayProtocol::ReadRecord(SessionRecordHeader& header) {
+    if (fread(&header, sizeof(header), 1, file_) != 1) {
+        return false;
+    }
+    // 多留一个字节给文本消息的结尾
+    payload_.resize(header.size + 1);
+    if (header.size > 0 && fread(payload_.data(), 1, header.size, file_) != header.size) {
+        return false;
+    }
+    payload_[header.size] = 0;
+    return true;
+}
+
+bool ReplayProtocol::FindHello() {
+    SessionRecordHeader header;
+    // 文件读完之后从头再来一遍
+    for (int pass = 0; pass < 2; pass++) {
+        while (ReadRecord(header)) {
+            if (header.type != kSessionRecordText) {
+                continue;
+            }
+            auto root = cJSON_Parse((const char*)payload_.data());
+            auto type = cJSON_GetObjectItem(root, "type");
+            bool hello = cJSON_IsString(type) && strcmp(type->valuestring, "hello") == 0;
+            if (hello) {
+                ParseHello(root);
+                session_start_ms_ = header.time_ms;
+            }
+            cJSON_Delete(root);
+            if (hello) {
+                return true;
+            }
+        }
+        clearerr(file_);
+        fseek(file_, sizeof(uint32_t), SEEK_SET);
+    }
+    return false;
+}
+
+void ReplayProtocol::ParseHello(const cJSON* root) {
+    auto session_id = cJSON_GetObjectItem(root, "session_id");
+    if (cJSON_IsString(session_id)) {
+        session_id_ = session_id->valuestring;
+    }
+    auto audio_params = cJSON_GetObjectItem(root, "audio_params");
+    if (cJSON_IsObject(audio_params)) {
+        auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
+        if (cJSON_IsNumber(sample_rate)) {
+            server_sample_rate_ = sample_rate->valueint;
+        }
+        auto frame_duration = cJSON_GetObjectItem(audio_params, "frame_duration");
+        if (cJSON_IsNumber(frame_duration)) {
+            server_frame_duration_ = frame_duration->valueint;
+        }
+    }
+    // 快速模式靠解码队列的水位报告暂停，与录制时服务器是否支持无关
+    flow_control_ = mode_ == kReplayModeFast;
+    ESP_LOGI(TAG, "Session %s: %d Hz, %d ms frames", session_id_.c_str(), server_sample_rate_, server_frame_duration_);
+}
+
+bool ReplayProtocol::OpenAudioChannel() {
+    if (file_ == nullptr) {
+        SetError(Lang::Strings::SERVER_NOT_CONNECTED);
+        return false;
+    }
+    if (replay_task_ != nullptr) {
+        CloseAudioChannel();
+    }
+    if (!FindHello()) {
+        ESP_LOGE(TAG, "No session in the recording");
+        SetError(Lang::Strings::SERVER_NOT_FOUND);
+        return false;
+    }
+
+    error_occurred_ = false;
+    uplink_packets_ = 0;
+    uplink_texts_ = 0;
+    stop_requested_ = false;
+    paused_ = false;
+    opened_ = true;
+    last_incoming_time_ = std::chrono::steady_clock::now();
+    if (mode_ == kReplayModeRealtime) {
+        SessionRecorder::GetInstance().BeginMicReplay();
+    }
+    if (on_audio_channel_opened_ != nullptr) {
+        on_audio_channel_opened_();
+    }
+
+    if (xTaskCreate([](void* arg) {
+            static_cast<ReplayProtocol*>(arg)->ReplayTask();
+            vTaskDelete(NULL);
+        }, "replay", REPLAY_TASK_STACK_SIZE, this, REPLAY_TASK_PRIORITY, &replay_task_) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the replay task");
+        replay_task_ = nullptr;
+        CloseAudioChannel();
+        return false;
+    }
+    return true;
+}
+
+void ReplayProtocol::ReplayTask() {
+    int64_t start_us = esp_timer_get_time();
+    int64_t max_late_us = 0;
+    uint32_t last_ms = session_start_ms_;
+    uint32_t texts = 0, packets = 0;
+    bool mic_checked = false, mic_usable = false;
+    const char* end = "end of file";
+    SessionRecordHeader header;
+
+    while (!stop_requested_) {
+        long position = ftell(file_);
+        if (!ReadRecord(header)) {
+            // 下一次从头开始
+            clearerr(file_);
+            fseek(file_, sizeof(uint32_t), SEEK_SET);
+            break;
+        }
+        last_ms = header.time_ms;
+
+        if (mode_ == kReplayModeRealtime) {
+            int64_t due_us = start_us + (int64_t)(header.time_ms - session_start_ms_) * 1000;
+            int64_t wait_us = due_us - esp_timer_get_time();
+            if (wait_us >= portTICK_PERIOD_MS * 1000) {
+                // CloseAudioChannel() 通知时提前醒来
+                ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait_us / 1000));
+                if (stop_requested_) {
+                    break;
+                }
+            } else if (wait_us < 0) {
+                max_late_us = std::max(max_late_us, -wait_us);
+            }
+        }
+
+        if (header.type == kSessionRecordText) {
+            auto data = (const char*)payload_.data();
+            if (!DispatchIncomingMessage(data, header.size)) {
+                auto root = MemoryGuard::ParseJson(data);
+                auto type = cJSON_GetObjectItem(root, "type");
+                bool hello = cJSON_IsString(type) && strcmp(type->valuestring, "hello") == 0;
+                if (!hello && on_incoming_json_ != nullptr) {
+                    on_incoming_json_(root);
+                }
+                cJSON_Delete(root);
+                if (hello) {
+                    // 下一个会话，留给下一次 OpenAudioChannel()
+                    fseek(file_, position, SEEK_SET);
+                    end = "next session";
+                    break;
+                }
+            }
+            texts++;
+        } else if (header.type == kSessionRecordAudio) {
+            while (mode_ == kReplayModeFast && paused_ && !stop_requested_) {
+                vTaskDelay(pdMS_TO_TICKS(REPLAY_PAUSE_POLL_MS));
+            }
+            auto packet = AcquireAudioStreamPacket();
+            packet->sample_rate = header.sample_rate;
+            packet->frame_duration = header.frame_duration;
+            packet->timestamp = header.timestamp;
+            packet->sequence = header.sequence;
+            packet->time_us = esp_timer_get_time();
+            packet->payload.assign(payload_.begin(), payload_.begin() + header.size);
+            on_incoming_audio_(std::move(packet));
+            packets++;
+        } else if (header.type == kSessionRecordMic) {
+            if (!mic_checked) {
+                mic_checked = true;
+                auto codec = Board::GetInstance().GetAudioCodec();
+                mic_usable = header.channels == codec->input_channels();
+                if (!mic_usable) {
+                    ESP_LOGW(TAG, "Recorded %d mic channels, the codec has %d, using the live microphone",
+                        header.channels, codec->input_channels());
+                    SessionRecorder::GetInstance().EndMicReplay();
+                }
+            }
+            if (mode_ == kReplayModeRealtime && mic_usable) {
+                SessionRecorder::GetInstance().PushMic((const int16_t*)payload_.data(), header.size / sizeof(int16_t));
+            }
+        } else if (header.type == kSessionRecordClose) {
+            end = "channel closed";
+            break;
+        }
+        last_incoming_time_ = std::chrono::steady_clock::now();
+    }
+
+    ESP_LOGI(TAG, "Session ended (%s): recorded %lu ms, took %lu ms, %lu texts, %lu packets, up to %lu ms late, "
+        "uplink %lu packets %lu texts", stop_requested_ ? "stopped" : end,
+        (unsigned long)(last_ms - session_start_ms_), (unsigned long)((esp_timer_get_time() - start_us) / 1000),
+        (unsigned long)texts, (unsigned long)packets, (unsigned long)(max_late_us / 1000),
+        (unsigned long)uplink_packets_.load(), (unsigned long)uplink_texts_.load());
+
+    bool stopped = stop_requested_;
+    replay_task_ = nullptr;
+    if (!stopped) {
+        Application::GetInstance().Schedule([this]() {
+            CloseAudioChannel();
+        });
+    }
+}
+
+void ReplayProtocol::CloseAudioChannel() {
+    stop_requested_ = true;
+    auto task = replay_task_;
+    if (task != nullptr && task != xTaskGetCurrentTaskHandle()) {
+        xTaskNotifyGive(task);
+        for (int waited = 0; replay_task_ != nullptr && waited < REPLAY_STOP_TIMEOUT_MS; waited += 10) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+    }
+    SessionRecorder::GetInstance().EndMicReplay();
+    if (opened_.exchange(false) && on_audio_channel_closed_ != nullptr) {
+        on_audio_channel_closed_();
+    }
+}
+
+bool ReplayProtocol::IsAudioChannelOpened() const {
+    return opened_ && !error_occurred_;
+}
+
+bool ReplayProtocol::SendAudio(AudioStreamPacketPtr packet) {
+    uplink_packets_++;
+    return opened_;
+}
+
+bool ReplayProtocol::SendText(const std::string& text) {
+    uplink_texts_++;
+    // 快速模式：解码队列到高水位时暂停投递，回到低水位后继续
+    if (mode_ == kReplayModeFast && text.find("\"type\":\"flow\"") != std::string::npos) {
+        JsonFields fields;
+        double buffered_ms;
+        if (fields.Parse(text.data(), text.size()) && fields.GetNumber("buffered_ms", buffered_ms)) {
+            paused_ = buffered_ms >= AUDIO_DECODE_HIGH_WATERMARK_MS;
+        }
+    }
+    return true;
+}
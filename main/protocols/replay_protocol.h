@@ -0,0 +1,63 @@
+#ifndef REPLAY_PROTOCOL_H
+#define REPLAY_PROTOCOL_H
+
+#include "protocol.h"
+#include "session_recorder.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+enum ReplayMode {
+    kReplayModeOff = 0,
+    kReplayModeRealtime = 1,    // 按录制时的时序
+    kReplayModeFast = 2,        // 尽快，按 flow control 的水位暂停
+};
+
+/*
+ * Plays a file of SessionRecorder back as if it came from the server, for benchmarking pipeline changes against
+ * the same real-world traffic without a server.
+ *
+ * Every OpenAudioChannel() takes the next recorded session: it starts at a server hello, whose audio params
+ * configure the channel, and ends at the channel close, the next hello or the end of the file (then the file starts
+ * over). A replay task delivers the text messages and audio packets through the normal callbacks. Realtime mode
+ * keeps the recorded timing and also feeds the recorded microphone PCM instead of the live one; fast mode skips
+ * the waits and the microphone and only pauses while the decode queue reports the high watermark. Uplink audio and
+ * text are counted and dropped. Each session ends with a summary: duration, how far delivery fell behind schedule,
+ * uplink packets.
+ */
+class ReplayProtocol : public Protocol {
+public:
+    explicit ReplayProtocol(ReplayMode mode);
+    ~ReplayProtocol();
+
+    bool Start() override;
+    bool OpenAudioChannel() override;
+    void CloseAudioChannel() override;
+    bool IsAudioChannelOpened() const override;
+    bool SendAudio(AudioStreamPacketPtr packet) override;
+
+private:
+    ReplayMode mode_;
+    FILE* file_ = nullptr;
+    TaskHandle_t replay_task_ = nullptr;
+    std::atomic<bool> opened_ = false;
+    std::atomic<bool> stop_requested_ = false;
+    std::atomic<bool> paused_ = false;
+    uint32_t session_start_ms_ = 0;
+    std::atomic<uint32_t> uplink_packets_ = 0;
+    std::atomic<uint32_t> uplink_texts_ = 0;
+    std::vector<uint8_t> payload_;
+
+    bool SendText(const std::string& text) override;
+    bool ReadRecord(SessionRecordHeader& header);
+    bool FindHello();
+    void ParseHello(const cJSON* root);
+    void ReplayTask();
+};
+
+#endif // REPLAY_PROTOCOL_H
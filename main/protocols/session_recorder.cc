@@ -0,0 +1,210 @@
+#include "session_recorder.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+
+#define TAG "SessionRecorder"
+
+#define SESSION_RECORDER_MIC_RING_SIZE (16 * 1024)
+
+bool SessionRecorder::Start() {
+    if (recording_) {
+        return true;
+    }
+    if (writer_task_ != nullptr) {
+        ESP_LOGW(TAG, "The previous recording is still being written");
+        return false;
+    }
+    if (ring_ == nullptr) {
+#if CONFIG_SPIRAM
+        ring_ = xRingbufferCreateWithCaps(CONFIG_SESSION_RECORDER_RING_KB * 1024, RINGBUF_TYPE_NOSPLIT, MALLOC_CAP_SPIRAM);
+#else
+        ring_ = xRingbufferCreate(CONFIG_SESSION_RECORDER_RING_KB * 1024, RINGBUF_TYPE_NOSPLIT);
+#endif
+        if (ring_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to create the record ring");
+            return false;
+        }
+    }
+    // 上次停止之后才进来的记录不属于这次录制
+    size_t size;
+    while (auto item = xRingbufferReceive(ring_, &size, 0)) {
+        vRingbufferReturnItem(ring_, item);
+    }
+
+    file_ = fopen(CONFIG_SESSION_RECORDER_PATH, "wb");
+    if (file_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to open %s, is the file system mounted?", CONFIG_SESSION_RECORDER_PATH);
+        return false;
+    }
+    uint32_t magic = SESSION_RECORD_MAGIC;
+    fwrite(&magic, sizeof(magic), 1, file_);
+
+    records_ = 0;
+    dropped_ = 0;
+    bytes_ = sizeof(magic);
+    start_us_ = esp_timer_get_time();
+    stop_requested_ = false;
+    recording_ = true;
+    // 写文件系统的任务栈必须在内部 RAM
+    if (xTaskCreate([](void* arg) {
+            static_cast<SessionRecorder*>(arg)->WriterTask();
+            vTaskDelete(NULL);
+        }, "session_writer", 4096, this, 2, &writer_task_) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the writer task");
+        recording_ = false;
+        fclose(file_);
+        file_ = nullptr;
+        return false;
+    }
+    ESP_LOGI(TAG, "Recording to %s", CONFIG_SESSION_RECORDER_PATH);
+    return true;
+}
+
+void SessionRecorder::Stop() {
+    if (!recording_) {
+        return;
+    }
+    recording_ = false;
+    stop_requested_ = true;
+}
+
+void SessionRecorder::WriterTask() {
+    while (true) {
+        size_t size = 0;
+        auto item = xRingbufferReceive(ring_, &size, pdMS_TO_TICKS(100));
+        if (item == nullptr) {
+            if (stop_requested_) {
+                break;
+            }
+            continue;
+        }
+        if (fwrite(item, 1, size, file_) != size) {
+            ESP_LOGE(TAG, "Failed to write the recording, the file system may be full");
+            recording_ = false;
+            stop_requested_ = true;
+        }
+        bytes_ += size;
+        vRingbufferReturnItem(ring_, item);
+    }
+    fclose(file_);
+    file_ = nullptr;
+    ESP_LOGI(TAG, "Recording stopped: %lu records, %lu dropped, %lu KB", (unsigned long)records_.load(),
+        (unsigned long)dropped_.load(), (unsigned long)(bytes_.load() / 1024));
+    writer_task_ = nullptr;
+}
+
+void SessionRecorder::Write(SessionRecordHeader& header, const void* data) {
+    if (!recording_) {
+        return;
+    }
+    header.time_ms = (esp_timer_get_time() - start_us_) / 1000;
+    void* item = nullptr;
+    if (xRingbufferSendAcquire(ring_, &item, sizeof(header) + header.size, 0) != pdTRUE) {
+        dropped_++;
+        return;
+    }
+    memcpy(item, &header, sizeof(header));
+    if (header.size > 0) {
+        memcpy((uint8_t*)item + sizeof(header), data, header.size);
+    }
+    xRingbufferSendComplete(ring_, item);
+    records_++;
+}
+
+void SessionRecorder::RecordText(const char* data, size_t len) {
+    SessionRecordHeader header = {};
+    header.type = kSessionRecordText;
+    header.size = len;
+    Write(header, data);
+}
+
+void SessionRecorder::RecordAudio(const AudioStreamPacket& packet) {
+    SessionRecordHeader header = {};
+    header.type = kSessionRecordAudio;
+    header.frame_duration = packet.frame_duration;
+    header.sample_rate = packet.sample_rate;
+    header.timestamp = packet.timestamp;
+    header.sequence = packet.sequence;
+    header.size = packet.payload.size();
+    Write(header, packet.payload.data());
+}
+
+void SessionRecorder::RecordMic(const std::vector<int16_t>& data, int sample_rate, int channels) {
+#if CONFIG_SESSION_RECORDER_MIC
+    SessionRecordHeader header = {};
+    header.type = kSessionRecordMic;
+    header.channels = channels;
+    header.sample_rate = sample_rate;
+    header.size = data.size() * sizeof(int16_t);
+    Write(header, data.data());
+#endif
+}
+
+void SessionRecorder::RecordClose() {
+    SessionRecordHeader header = {};
+    header.type = kSessionRecordClose;
+    Write(header, nullptr);
+}
+
+void SessionRecorder::BeginMicReplay() {
+    if (mic_ring_ == nullptr) {
+        mic_ring_ = xRingbufferCreate(SESSION_RECORDER_MIC_RING_SIZE, RINGBUF_TYPE_BYTEBUF);
+        if (mic_ring_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to create the mic replay ring");
+            return;
+        }
+    }
+    size_t size;
+    while (auto item = xRingbufferReceiveUpTo(mic_ring_, &size, 0, SESSION_RECORDER_MIC_RING_SIZE)) {
+        vRingbufferReturnItem(mic_ring_, item);
+    }
+    mic_underruns_ = 0;
+    replaying_mic_ = true;
+}
+
+void SessionRecorder::EndMicReplay() {
+    replaying_mic_ = false;
+}
+
+void SessionRecorder::PushMic(const int16_t* samples, size_t count) {
+    if (replaying_mic_ && mic_ring_ != nullptr) {
+        xRingbufferSend(mic_ring_, samples, count * sizeof(int16_t), 0);
+    }
+}
+
+void SessionRecorder::PullMic(std::vector<int16_t>& data) {
+    auto out = (uint8_t*)data.data();
+    size_t wanted = data.size() * sizeof(int16_t);
+    size_t copied = 0;
+    // 字节缓冲绕回时要取两次
+    while (copied < wanted) {
+        size_t size = 0;
+        auto item = xRingbufferReceiveUpTo(mic_ring_, &size, 0, wanted - copied);
+        if (item == nullptr) {
+            break;
+        }
+        memcpy(out + copied, item, size);
+        copied += size;
+        vRingbufferReturnItem(mic_ring_, item);
+    }
+    if (copied < wanted) {
+        memset(out + copied, 0, wanted - copied);
+        mic_underruns_++;
+    }
+}
+
+std::string SessionRecorder::ToJson() {
+    std::string json = "{\"recording\":";
+    json += recording_ ? "true" : "false";
+    json += ",\"path\":\"" CONFIG_SESSION_RECORDER_PATH "\"";
+    json += ",\"records\":" + std::to_string(records_.load());
+    json += ",\"dropped\":" + std::to_string(dropped_.load());
+    json += ",\"bytes\":" + std::to_string(bytes_.load());
+    json += ",\"replaying_mic\":";
+    json += replaying_mic_ ? "true" : "false";
+    json += ",\"mic_underruns\":" + std::to_string(mic_underruns_.load()) + "}";
+    return json;
+}
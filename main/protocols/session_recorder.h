@@ -0,0 +1,97 @@
+#ifndef SESSION_RECORDER_H
+#define SESSION_RECORDER_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/ringbuf.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "protocol.h"
+
+#define SESSION_RECORD_MAGIC 0x31525358  // "XSR1"
+
+enum SessionRecordType : uint8_t {
+    kSessionRecordText = 1,     // 收到的 JSON 消息，包括 hello
+    kSessionRecordAudio = 2,    // 收到的音频帧
+    kSessionRecordMic = 3,      // ReadAudioData() 读到的 PCM，交织的全部声道
+    kSessionRecordClose = 4,    // 音频通道关闭
+};
+
+// 每条记录的头，后面跟 size 字节的内容，字段按设备字节序
+struct SessionRecordHeader {
+    uint8_t type;
+    uint8_t channels;           // kSessionRecordMic 的声道数
+    uint16_t frame_duration;
+    uint32_t time_ms;           // 相对于开始录制
+    uint32_t sample_rate;
+    uint32_t timestamp;
+    uint32_t sequence;
+    uint32_t size;
+};
+
+/*
+ * Records a field session to a file so it can be replayed offline, see ReplayProtocol.
+ *
+ * Every incoming text message (Protocol::DispatchIncomingMessage), every incoming audio packet, the channel
+ * closes and, with CONFIG_SESSION_RECORDER_MIC, the microphone PCM read by AudioService go into a ring with
+ * their time since Start(). The calls copy and return, a writer task with an internal RAM stack appends the ring
+ * to CONFIG_SESSION_RECORDER_PATH, so a slow SD card never blocks the receive or audio input tasks; records
+ * that do not fit are dropped and counted.
+ *
+ * During a replay the recorded microphone PCM comes back through PushMic() / PullMic(): AudioService takes it
+ * instead of what the microphone captured, still paced by the real input.
+ */
+class SessionRecorder {
+public:
+    static SessionRecorder& GetInstance() {
+        static SessionRecorder instance;
+        return instance;
+    }
+    SessionRecorder(const SessionRecorder&) = delete;
+    SessionRecorder& operator=(const SessionRecorder&) = delete;
+
+    bool Start();
+    void Stop();
+    bool recording() const { return recording_.load(std::memory_order_relaxed); }
+
+    void RecordText(const char* data, size_t len);
+    void RecordAudio(const AudioStreamPacket& packet);
+    void RecordMic(const std::vector<int16_t>& data, int sample_rate, int channels);
+    void RecordClose();
+
+    void BeginMicReplay();
+    void EndMicReplay();
+    bool replaying_mic() const { return replaying_mic_.load(std::memory_order_relaxed); }
+    // 回放任务放入录制的 PCM，放不下时丢弃
+    void PushMic(const int16_t* samples, size_t count);
+    // 用回放的 PCM 覆盖 data，不够的部分补零
+    void PullMic(std::vector<int16_t>& data);
+
+    std::string ToJson();
+
+private:
+    RingbufHandle_t ring_ = nullptr;
+    RingbufHandle_t mic_ring_ = nullptr;
+    TaskHandle_t writer_task_ = nullptr;
+    FILE* file_ = nullptr;
+    std::atomic<bool> recording_ = false;
+    std::atomic<bool> stop_requested_ = false;
+    std::atomic<bool> replaying_mic_ = false;
+    int64_t start_us_ = 0;
+    std::atomic<uint32_t> records_ = 0;
+    std::atomic<uint32_t> dropped_ = 0;
+    std::atomic<uint32_t> bytes_ = 0;
+    std::atomic<uint32_t> mic_underruns_ = 0;
+
+    SessionRecorder() = default;
+
+    void Write(SessionRecordHeader& header, const void* data);
+    void WriterTask();
+};
+
+#endif // SESSION_RECORDER_H
@@ -3,10 +3,15 @@
 #include "system_info.h"
 #include "application.h"
 #include "settings.h"
+#include "network_monitor.h"
+#include "system_metrics.h"
+#include "memory_guard.h"
 
 #include <cstring>
+#include <algorithm>
 #include <cJSON.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <arpa/inet.h>
 #include "assets/lang_config.h"
 
@@ -25,45 +30,187 @@ bool WebsocketProtocol::Start() {
     return true;
 }
 
-bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
+bool WebsocketProtocol::SendAudio(AudioStreamPacketPtr packet) {
+    std::lock_guard<std::mutex> lock(send_mutex_);
     if (websocket_ == nullptr || !websocket_->IsConnected()) {
         return false;
     }
 
+    // 协议头直接插入到数据包自身的缓冲区前面，池化的数据包会保留容量，稳态下不再为每帧分配内存
+    auto& payload = packet->payload;
+    size_t payload_size = payload.size();
     if (version_ == 2) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol2) + packet->payload.size());
-        auto bp2 = (BinaryProtocol2*)serialized.data();
+        payload.insert(payload.begin(), sizeof(BinaryProtocol2), 0);
+        auto bp2 = (BinaryProtocol2*)payload.data();
         bp2->version = htons(version_);
         bp2->type = 0;
         bp2->reserved = 0;
         bp2->timestamp = htonl(packet->timestamp);
-        bp2->payload_size = htonl(packet->payload.size());
-        memcpy(bp2->payload, packet->payload.data(), packet->payload.size());
+        bp2->payload_size = htonl(payload_size);
 
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+        return websocket_->Send(payload.data(), payload.size(), true);
     } else if (version_ == 3) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol3) + packet->payload.size());
-        auto bp3 = (BinaryProtocol3*)serialized.data();
+        payload.insert(payload.begin(), sizeof(BinaryProtocol3), 0);
+        auto bp3 = (BinaryProtocol3*)payload.data();
         bp3->type = 0;
         bp3->reserved = 0;
-        bp3->payload_size = htons(packet->payload.size());
-        memcpy(bp3->payload, packet->payload.data(), packet->payload.size());
+        bp3->payload_size = htons(payload_size);
 
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+        return websocket_->Send(payload.data(), payload.size(), true);
+    } else if (version_ == 4) {
+        payload.insert(payload.begin(), sizeof(BinaryProtocol4), 0);
+        FillProtocol4Header((BinaryProtocol4*)payload.data(), *packet, payload_size);
+
+        return websocket_->Send(payload.data(), payload.size(), true);
+    } else {
+        return websocket_->Send(payload.data(), payload.size(), true);
+    }
+}
+
+bool WebsocketProtocol::SendAudioBatch(AudioStreamPacketPtr* packets, size_t count) {
+    if (!audio_batch_ || count < 2) {
+        return Protocol::SendAudioBatch(packets, count);
+    }
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    if (websocket_ == nullptr || !websocket_->IsConnected()) {
+        return false;
+    }
+
+    // 每帧保留自己的协议头，服务端按 payload_size 拆分
+    batch_buffer_.clear();
+    for (size_t i = 0; i < count; i++) {
+        auto& payload = packets[i]->payload;
+        size_t offset = batch_buffer_.size();
+        if (version_ == 2) {
+            batch_buffer_.resize(offset + sizeof(BinaryProtocol2) + payload.size());
+            auto bp2 = (BinaryProtocol2*)&batch_buffer_[offset];
+            bp2->version = htons(version_);
+            bp2->type = 0;
+            bp2->reserved = 0;
+            bp2->timestamp = htonl(packets[i]->timestamp);
+            bp2->payload_size = htonl(payload.size());
+            memcpy(bp2->payload, payload.data(), payload.size());
+        } else if (version_ == 4) {
+            batch_buffer_.resize(offset + sizeof(BinaryProtocol4) + payload.size());
+            auto bp4 = (BinaryProtocol4*)&batch_buffer_[offset];
+            FillProtocol4Header(bp4, *packets[i], payload.size());
+            memcpy(bp4->payload, payload.data(), payload.size());
+        } else {
+            batch_buffer_.resize(offset + sizeof(BinaryProtocol3) + payload.size());
+            auto bp3 = (BinaryProtocol3*)&batch_buffer_[offset];
+            bp3->type = 0;
+            bp3->reserved = 0;
+            bp3->payload_size = htons(payload.size());
+            memcpy(bp3->payload, payload.data(), payload.size());
+        }
+        packets[i].reset();
+    }
+    return websocket_->Send(batch_buffer_.data(), batch_buffer_.size(), true);
+}
+
+bool WebsocketProtocol::SendVideoFrame(const uint8_t* jpeg, size_t size, uint32_t timestamp) {
+    return SendBinaryPayload(BINARY_PROTOCOL_TYPE_JPEG, BINARY_PROTOCOL4_CODEC_JPEG, video_sequence_, jpeg, size, timestamp);
+}
+
+bool WebsocketProtocol::SendMetricsReport(const uint8_t* report, size_t size) {
+    return SendBinaryPayload(BINARY_PROTOCOL_TYPE_METRICS, BINARY_PROTOCOL4_CODEC_METRICS, metrics_sequence_, report, size,
+        (uint32_t)(esp_timer_get_time() / 1000));
+}
+
+bool WebsocketProtocol::SendBinaryPayload(uint16_t type, uint8_t codec, uint32_t& sequence, const uint8_t* data, size_t size, uint32_t timestamp) {
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    if (websocket_ == nullptr || !websocket_->IsConnected() || version_ < 2) {
+        return false;
+    }
+    // 协议 3/4 的长度字段只有 16 位
+    if (version_ != 2 && size > UINT16_MAX) {
+        ESP_LOGW(TAG, "Binary payload too large: %u bytes", (unsigned)size);
+        return false;
+    }
+
+    if (version_ == 2) {
+        payload_buffer_.resize(sizeof(BinaryProtocol2) + size);
+        auto bp2 = (BinaryProtocol2*)payload_buffer_.data();
+        bp2->version = htons(version_);
+        bp2->type = htons(type);
+        bp2->reserved = 0;
+        bp2->timestamp = htonl(timestamp);
+        bp2->payload_size = htonl(size);
+        memcpy(bp2->payload, data, size);
+    } else if (version_ == 4) {
+        payload_buffer_.resize(sizeof(BinaryProtocol4) + size);
+        auto bp4 = (BinaryProtocol4*)payload_buffer_.data();
+        bp4->codec = codec;
+        bp4->flags = 0;
+        bp4->payload_size = htons(size);
+        bp4->sequence = htonl(++sequence);
+        bp4->timestamp = htonl(timestamp);
+        memcpy(bp4->payload, data, size);
     } else {
-        return websocket_->Send(packet->payload.data(), packet->payload.size(), true);
+        payload_buffer_.resize(sizeof(BinaryProtocol3) + size);
+        auto bp3 = (BinaryProtocol3*)payload_buffer_.data();
+        bp3->type = type;
+        bp3->reserved = 0;
+        bp3->payload_size = htons(size);
+        memcpy(bp3->payload, data, size);
     }
+    return websocket_->Send(payload_buffer_.data(), payload_buffer_.size(), true);
+}
+
+void WebsocketProtocol::FillProtocol4Header(BinaryProtocol4* bp4, const AudioStreamPacket& packet, size_t payload_size) {
+    bp4->codec = BINARY_PROTOCOL4_CODEC_OPUS;
+    // DTX 期间编码器只输出 1~2 字节的帧
+    bp4->flags = payload_size <= 2 ? BINARY_PROTOCOL4_FLAG_DTX : 0;
+    bp4->payload_size = htons(payload_size);
+    bp4->sequence = htonl(++local_sequence_);
+    bp4->timestamp = htonl(packet.timestamp);
+}
+
+// 每个分片单独拿锁，上行任务可以在分片之间发送音频帧
+bool WebsocketProtocol::SendTextChunks(const std::string& text) {
+    uint16_t message_id;
+    {
+        std::lock_guard<std::mutex> lock(send_mutex_);
+        message_id = ++text_message_id_;
+    }
+    std::vector<uint8_t> chunk(sizeof(TextChunkHeader) + CONFIG_WEBSOCKET_TEXT_CHUNK_SIZE);
+    auto header = (TextChunkHeader*)chunk.data();
+    header->message_id = htons(message_id);
+    header->reserved = 0;
+    for (size_t offset = 0; offset < text.size(); offset += CONFIG_WEBSOCKET_TEXT_CHUNK_SIZE) {
+        size_t size = std::min<size_t>(text.size() - offset, CONFIG_WEBSOCKET_TEXT_CHUNK_SIZE);
+        header->flags = offset + size == text.size() ? TEXT_CHUNK_FLAG_LAST : 0;
+        memcpy(header->data, text.data() + offset, size);
+        if (!SendBinaryPayload(BINARY_PROTOCOL_TYPE_TEXT_CHUNK, BINARY_PROTOCOL4_CODEC_TEXT_CHUNK, text_chunk_sequence_,
+                chunk.data(), sizeof(TextChunkHeader) + size, (uint32_t)(esp_timer_get_time() / 1000))) {
+            return false;
+        }
+        // 同优先级的上行任务被唤醒后也能先发
+        taskYIELD();
+    }
+    return true;
 }
 
 bool WebsocketProtocol::SendText(const std::string& text) {
+#if CONFIG_WEBSOCKET_TEXT_CHUNK_SIZE > 0
+    if (text_chunks_ && text.size() > CONFIG_WEBSOCKET_TEXT_CHUNK_SIZE) {
+        if (!SendTextChunks(text)) {
+            ESP_LOGE(TAG, "Failed to send text in chunks, %u bytes", (unsigned)text.size());
+            SetError(Lang::Strings::SERVER_ERROR);
+            return false;
+        }
+        return true;
+    }
+#endif
+
+    std::unique_lock<std::mutex> lock(send_mutex_);
     if (websocket_ == nullptr || !websocket_->IsConnected()) {
         ESP_LOGE(TAG, "SendText: websocket not connected, drop message: %s", text.c_str());
         return false;
     }
 
     if (!websocket_->Send(text)) {
+        lock.unlock();
         ESP_LOGE(TAG, "Failed to send text: %s", text.c_str());
         SetError(Lang::Strings::SERVER_ERROR);
         return false;
@@ -73,14 +220,140 @@ bool WebsocketProtocol::SendText(const std::string& text) {
 }
 
 bool WebsocketProtocol::IsAudioChannelOpened() const {
-    return websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout();
+    return websocket_ != nullptr && websocket_->IsConnected() && !warm_ && !error_occurred_ && !IsTimeout();
 }
 
 void WebsocketProtocol::CloseAudioChannel() {
-    websocket_.reset();
+    ResetWebsocket();
+    warm_ = false;
 }
 
 bool WebsocketProtocol::OpenAudioChannel() {
+    error_occurred_ = false;
+    audio_batch_ = false;
+    text_chunks_ = false;
+    local_sequence_ = 0;
+
+    // 预热的连接已被服务器关闭或者探测没有回应时丢弃，warm_ 仍为 true，断开回调不会影响设备状态
+    if (warm_ && (websocket_ == nullptr || !websocket_->IsConnected() || IsProbeLost())) {
+        ResetWebsocket();
+    }
+    bool warm = warm_ && websocket_ != nullptr;
+    warm_ = false;
+    if (warm) {
+        ESP_LOGI(TAG, "Reusing pre-warmed websocket connection");
+    } else if (!Connect()) {
+        SetError(Lang::Strings::SERVER_NOT_CONNECTED);
+        return false;
+    }
+
+    // Send hello message to describe the client
+    auto message = GetHelloMessage();
+    int64_t hello_time = esp_timer_get_time();
+    if (!SendText(message)) {
+        return false;
+    }
+
+    // Wait for server hello
+    EventBits_t bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
+    if (!(bits & WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT)) {
+        ESP_LOGE(TAG, "Failed to receive server hello");
+        SetError(Lang::Strings::SERVER_TIMEOUT);
+        return false;
+    }
+    NetworkMonitor::GetInstance().ReportRtt((esp_timer_get_time() - hello_time) / 1000);
+
+    if (on_audio_channel_opened_ != nullptr) {
+        on_audio_channel_opened_();
+    }
+
+    return true;
+}
+
+void WebsocketProtocol::PrewarmAudioChannel() {
+#if CONFIG_AUDIO_CHANNEL_KEEP_WARM_SECONDS > 0
+    if (websocket_ != nullptr && websocket_->IsConnected()) {
+        return;
+    }
+
+    // 只完成 TCP/TLS 和 websocket 握手，不发送 hello，下次唤醒时直接复用
+    warm_ = true;
+    ResetWebsocket();
+    if (!Connect()) {
+        ResetWebsocket();
+        warm_ = false;
+        return;
+    }
+    last_incoming_time_ = std::chrono::steady_clock::now();
+    warm_deadline_ = last_incoming_time_ + std::chrono::seconds(CONFIG_AUDIO_CHANNEL_KEEP_WARM_SECONDS);
+    ResetProbeInterval();
+    ESP_LOGI(TAG, "Websocket pre-warmed for %d seconds", CONFIG_AUDIO_CHANNEL_KEEP_WARM_SECONDS);
+#endif
+}
+
+// 只探测预热的连接：会话中一直有音频往来，没有连接时也无需探测。
+// 连接断了就在后台重建，唤醒时仍能直接复用
+void WebsocketProtocol::CheckLiveness() {
+#if CONFIG_AUDIO_CHANNEL_KEEP_WARM_SECONDS > 0 && CONFIG_PROTOCOL_PROBE_MIN_INTERVAL_SECONDS > 0
+    if (!warm_ || IsWarmAudioChannelExpired()) {
+        return;
+    }
+    bool dead = websocket_ == nullptr || !websocket_->IsConnected();
+    if (!dead && IsProbeLost()) {
+        ESP_LOGW(TAG, "Pre-warmed websocket did not answer the ping in %d ms", ProbeTimeoutMs());
+        dead = true;
+    }
+    if (dead) {
+        ESP_LOGI(TAG, "Reconnecting the pre-warmed websocket");
+        auto deadline = warm_deadline_;
+        ResetWebsocket();
+        if (!Connect()) {
+            warm_ = false;
+            return;
+        }
+        last_incoming_time_ = std::chrono::steady_clock::now();
+        warm_deadline_ = deadline;
+        ResetProbeInterval();
+        return;
+    }
+    if (IsProbeDue() && !SendProbe()) {
+        ESP_LOGW(TAG, "Failed to send the ping, dropping the pre-warmed websocket");
+        ResetWebsocket();
+    }
+#endif
+}
+
+// 服务器在 hello 中声明支持 ping 时发应用层 ping，回复的 pong 可以看到；
+// 否则只能发 websocket ping 帧，收不到 pong 回调，但能保持 NAT 映射并让 TCP 及早发现对端已断开
+bool WebsocketProtocol::SendProbe() {
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    if (websocket_ == nullptr) {
+        return false;
+    }
+    if (ping_) {
+        if (!websocket_->Send("{\"type\":\"ping\"}")) {
+            return false;
+        }
+    } else {
+        websocket_->Ping();
+    }
+    OnProbeSent(ping_);
+    return true;
+}
+
+bool WebsocketProtocol::IsWarmAudioChannelExpired() const {
+    return warm_ && std::chrono::steady_clock::now() >= warm_deadline_;
+}
+
+void WebsocketProtocol::ReleaseWarmAudioChannel() {
+    if (warm_) {
+        ESP_LOGI(TAG, "Releasing pre-warmed websocket");
+        ResetWebsocket();
+        warm_ = false;
+    }
+}
+
+bool WebsocketProtocol::Connect() {
     Settings settings("websocket", false);
     std::string url = settings.GetString("url");
     std::string token = settings.GetString("token");
@@ -89,11 +362,9 @@ bool WebsocketProtocol::OpenAudioChannel() {
         version_ = version;
     }
 
-    error_occurred_ = false;
-
     auto network = Board::GetInstance().GetNetwork();
-    websocket_ = network->CreateWebSocket(1);
-    if (websocket_ == nullptr) {
+    auto websocket = network->CreateWebSocket(1);
+    if (websocket == nullptr) {
         ESP_LOGE(TAG, "Failed to create websocket");
         return false;
     }
@@ -103,51 +374,68 @@ bool WebsocketProtocol::OpenAudioChannel() {
         if (token.find(" ") == std::string::npos) {
             token = "Bearer " + token;
         }
-        websocket_->SetHeader("Authorization", token.c_str());
+        websocket->SetHeader("Authorization", token.c_str());
     }
-    websocket_->SetHeader("Protocol-Version", std::to_string(version_).c_str());
-    websocket_->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
-    websocket_->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
+    websocket->SetHeader("Protocol-Version", std::to_string(version_).c_str());
+    websocket->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
+    websocket->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
 
-    websocket_->OnData([this](const char* data, size_t len, bool binary) {
+    websocket->OnData([this](const char* data, size_t len, bool binary) {
         if (binary) {
             if (on_incoming_audio_ != nullptr) {
+                // Pooled packets keep their payload capacity, so assign() does not allocate in steady state.
+                // The header is read in place, the frame buffer belongs to the websocket and is not modified.
+                auto frame = (const uint8_t*)data;
+                const uint8_t* payload = frame;
+                size_t payload_size = len;
+                uint32_t timestamp = 0;
+                uint32_t sequence = 0;
                 if (version_ == 2) {
-                    BinaryProtocol2* bp2 = (BinaryProtocol2*)data;
-                    bp2->version = ntohs(bp2->version);
-                    bp2->type = ntohs(bp2->type);
-                    bp2->timestamp = ntohl(bp2->timestamp);
-                    bp2->payload_size = ntohl(bp2->payload_size);
-                    auto payload = (uint8_t*)bp2->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = bp2->timestamp,
-                        .payload = std::vector<uint8_t>(payload, payload + bp2->payload_size)
-                    }));
+                    auto bp2 = (const BinaryProtocol2*)frame;
+                    if (len < sizeof(BinaryProtocol2) || ntohl(bp2->payload_size) > len - sizeof(BinaryProtocol2)) {
+                        ESP_LOGE(TAG, "Invalid audio frame, size: %u", len);
+                        return;
+                    }
+                    timestamp = ntohl(bp2->timestamp);
+                    payload = bp2->payload;
+                    payload_size = ntohl(bp2->payload_size);
                 } else if (version_ == 3) {
-                    BinaryProtocol3* bp3 = (BinaryProtocol3*)data;
-                    bp3->type = bp3->type;
-                    bp3->payload_size = ntohs(bp3->payload_size);
-                    auto payload = (uint8_t*)bp3->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>(payload, payload + bp3->payload_size)
-                    }));
-                } else {
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len)
-                    }));
+                    auto bp3 = (const BinaryProtocol3*)frame;
+                    if (len < sizeof(BinaryProtocol3) || ntohs(bp3->payload_size) > len - sizeof(BinaryProtocol3)) {
+                        ESP_LOGE(TAG, "Invalid audio frame, size: %u", len);
+                        return;
+                    }
+                    payload = bp3->payload;
+                    payload_size = ntohs(bp3->payload_size);
+                } else if (version_ == 4) {
+                    // 带序号的帧经过抖动缓冲，丢帧时由解码器做丢包补偿
+                    auto bp4 = (const BinaryProtocol4*)frame;
+                    if (len < sizeof(BinaryProtocol4) || ntohs(bp4->payload_size) > len - sizeof(BinaryProtocol4)) {
+                        ESP_LOGE(TAG, "Invalid audio frame, size: %u", len);
+                        return;
+                    }
+                    if (bp4->codec != BINARY_PROTOCOL4_CODEC_OPUS) {
+                        ESP_LOGW(TAG, "Unsupported audio codec: %u", bp4->codec);
+                        return;
+                    }
+                    timestamp = ntohl(bp4->timestamp);
+                    sequence = ntohl(bp4->sequence);
+                    payload = bp4->payload;
+                    payload_size = ntohs(bp4->payload_size);
                 }
+
+                auto packet = AcquireAudioStreamPacket();
+                packet->sample_rate = server_sample_rate_;
+                packet->frame_duration = server_frame_duration_;
+                packet->sequence = sequence;
+                packet->time_us = esp_timer_get_time();
+                packet->timestamp = timestamp;
+                packet->payload.assign(payload, payload + payload_size);
+                on_incoming_audio_(std::move(packet));
             }
-        } else {
+        } else if (!DispatchIncomingMessage(data, len)) {
             // Parse JSON data
-            auto root = cJSON_Parse(data);
+            auto root = MemoryGuard::ParseJson(data);
             auto type = cJSON_GetObjectItem(root, "type");
             if (cJSON_IsString(type)) {
                 if (strcmp(type->valuestring, "hello") == 0) {
@@ -165,39 +453,35 @@ bool WebsocketProtocol::OpenAudioChannel() {
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
-    websocket_->OnDisconnected([this]() {
+    websocket->OnDisconnected([this]() {
         ESP_LOGI(TAG, "Websocket disconnected");
+        // 预热的连接还没有会话
+        if (warm_) {
+            return;
+        }
         if (on_audio_channel_closed_ != nullptr) {
             on_audio_channel_closed_();
         }
     });
 
     ESP_LOGI(TAG, "Connecting to websocket server: %s with version: %d", url.c_str(), version_);
-    if (!websocket_->Connect(url.c_str())) {
+    if (!websocket->Connect(url.c_str())) {
         ESP_LOGE(TAG, "Failed to connect to websocket server");
-        SetError(Lang::Strings::SERVER_NOT_CONNECTED);
-        return false;
-    }
-
-    // Send hello message to describe the client
-    auto message = GetHelloMessage();
-    if (!SendText(message)) {
-        return false;
-    }
-
-    // Wait for server hello
-    EventBits_t bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
-    if (!(bits & WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT)) {
-        ESP_LOGE(TAG, "Failed to receive server hello");
-        SetError(Lang::Strings::SERVER_TIMEOUT);
         return false;
     }
+    ResetWebsocket();
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    websocket_ = std::move(websocket);
+    return true;
+}
 
-    if (on_audio_channel_opened_ != nullptr) {
-        on_audio_channel_opened_();
+// 在锁外销毁旧连接，断开时会等待接收任务退出，而接收任务可能正在等锁发送 MCP 回复
+void WebsocketProtocol::ResetWebsocket() {
+    std::unique_ptr<WebSocket> websocket;
+    {
+        std::lock_guard<std::mutex> lock(send_mutex_);
+        websocket = std::move(websocket_);
     }
-
-    return true;
 }
 
 std::string WebsocketProtocol::GetHelloMessage() {
@@ -210,13 +494,30 @@ std::string WebsocketProtocol::GetHelloMessage() {
     cJSON_AddBoolToObject(features, "aec", true);
 #endif
     cJSON_AddBoolToObject(features, "mcp", true);
+    AddFlowControlFeature(features);
+    AddPingFeature(features);
+    if (version_ >= 2) {
+        cJSON_AddBoolToObject(features, "audio_batch", true);
+        // 摄像头视频流帧通过二进制协议发送
+        if (Board::GetInstance().GetCamera() != nullptr) {
+            cJSON_AddStringToObject(features, "video", "jpeg");
+        }
+#if CONFIG_METRICS_REPORT_INTERVAL > 0
+        cJSON_AddNumberToObject(features, "metrics", METRICS_REPORT_VERSION);
+#endif
+#if CONFIG_WEBSOCKET_TEXT_CHUNK_SIZE > 0
+        // 长文本消息拆成 TEXT_CHUNK 二进制帧，值为单个分片的最大长度
+        cJSON_AddNumberToObject(features, "text_chunks", CONFIG_WEBSOCKET_TEXT_CHUNK_SIZE);
+#endif
+    }
     cJSON_AddItemToObject(root, "features", features);
     cJSON_AddStringToObject(root, "transport", "websocket");
     cJSON* audio_params = cJSON_CreateObject();
     cJSON_AddStringToObject(audio_params, "format", "opus");
     cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
     cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
+    cJSON_AddNumberToObject(audio_params, "frame_duration", client_frame_duration_);
+    AddAudioCodecs(audio_params);
     cJSON_AddItemToObject(root, "audio_params", audio_params);
     auto json_str = cJSON_PrintUnformatted(root);
     std::string message(json_str);
@@ -238,8 +539,29 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
     }
 
+    auto features = cJSON_GetObjectItem(root, "features");
+    ParseFlowControlFeature(features);
+    ParsePingFeature(features);
+    if (cJSON_IsObject(features)) {
+        auto audio_batch = cJSON_GetObjectItem(features, "audio_batch");
+        audio_batch_ = cJSON_IsTrue(audio_batch) && version_ >= 2;
+        if (audio_batch_) {
+            ESP_LOGI(TAG, "Uplink audio batching enabled");
+        }
+#if CONFIG_WEBSOCKET_TEXT_CHUNK_SIZE > 0
+        auto text_chunks = cJSON_GetObjectItem(features, "text_chunks");
+        text_chunks_ = cJSON_IsTrue(text_chunks) && version_ >= 2;
+        if (text_chunks_) {
+            ESP_LOGI(TAG, "Long text messages are sent in chunks of %d bytes", CONFIG_WEBSOCKET_TEXT_CHUNK_SIZE);
+        }
+#endif
+    }
+
     auto audio_params = cJSON_GetObjectItem(root, "audio_params");
     if (cJSON_IsObject(audio_params)) {
+        if (!CheckAudioFormat(audio_params)) {
+            return;
+        }
         auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
         if (cJSON_IsNumber(sample_rate)) {
             server_sample_rate_ = sample_rate->valueint;
@@ -8,6 +8,10 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 
+#include <vector>
+#include <chrono>
+#include <mutex>
+
 #define WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
 
 class WebsocketProtocol : public Protocol {
@@ -16,18 +20,49 @@ public:
     ~WebsocketProtocol();
 
     bool Start() override;
-    bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
+    bool SendAudio(AudioStreamPacketPtr packet) override;
+    bool SendAudioBatch(AudioStreamPacketPtr* packets, size_t count) override;
+    bool SendVideoFrame(const uint8_t* jpeg, size_t size, uint32_t timestamp) override;
+    bool SendMetricsReport(const uint8_t* report, size_t size) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
+    void PrewarmAudioChannel() override;
+    bool IsWarmAudioChannelExpired() const override;
+    void ReleaseWarmAudioChannel() override;
+    void CheckLiveness() override;
 
 private:
     EventGroupHandle_t event_group_handle_;
     std::unique_ptr<WebSocket> websocket_;
+    // 音频由上行任务发送，文本由主循环和接收任务发送，替换和发送 websocket_ 时加锁
+    std::mutex send_mutex_;
     int version_ = 1;
+    // The server accepted several BinaryProtocol2/3 frames back to back in one websocket message
+    bool audio_batch_ = false;
+    // The server reassembles TEXT_CHUNK frames, long text no longer holds the connection in one write
+    bool text_chunks_ = false;
+    uint16_t text_message_id_ = 0;
+    uint32_t text_chunk_sequence_ = 0;
+    uint32_t local_sequence_ = 0;
+    uint32_t video_sequence_ = 0;
+    uint32_t metrics_sequence_ = 0;
+    std::vector<uint8_t> payload_buffer_;
+    std::vector<uint8_t> batch_buffer_;
+    // Connected without a session (no hello sent yet), see PrewarmAudioChannel()
+    bool warm_ = false;
+    std::chrono::steady_clock::time_point warm_deadline_;
+
+    bool Connect();
+    bool SendProbe();
+    void ResetWebsocket();
+    void FillProtocol4Header(BinaryProtocol4* bp4, const AudioStreamPacket& packet, size_t payload_size);
+    // Non-audio payload in the binary frame of the negotiated version, v4 uses codec and its own sequence
+    bool SendBinaryPayload(uint16_t type, uint8_t codec, uint32_t& sequence, const uint8_t* data, size_t size, uint32_t timestamp);
 
     void ParseServerHello(const cJSON* root);
     bool SendText(const std::string& text) override;
+    bool SendTextChunks(const std::string& text);
     std::string GetHelloMessage();
 };
 
@@ -1,12 +1,230 @@
 #include "settings.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_system.h>
 #include <nvs_flash.h>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <optional>
 
 #define TAG "Settings"
 
+// 第一次修改后等待这么久再写入，期间的修改合并为一次提交
+#define SETTINGS_COMMIT_DELAY_US (2 * 1000 * 1000)
+
+// esp-wifi-connect 直接读写 wifi 命名空间，不能缓存
+static bool IsSharedNamespace(const std::string& ns) {
+    return ns == "wifi";
+}
+
+class Settings::Store {
+public:
+    struct Value {
+        bool is_string = false;
+        int32_t int_value = 0;
+        std::string string_value;
+
+        bool operator==(const Value& other) const {
+            return is_string == other.is_string && int_value == other.int_value && string_value == other.string_value;
+        }
+    };
+
+    static Store& GetInstance() {
+        static Store instance;
+        return instance;
+    }
+
+    std::optional<Value> Get(const std::string& ns, const std::string& key) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& space = Load(ns);
+        auto it = space.values.find(key);
+        if (it == space.values.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    void Set(const std::string& ns, const std::string& key, Value value) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto& space = Load(ns);
+            auto it = space.values.find(key);
+            if (it != space.values.end() && it->second == value) {
+                return;
+            }
+            space.values[key] = value;
+            space.pending[key] = std::move(value);
+            ScheduleCommit();
+        }
+        NotifyChange(ns, key);
+    }
+
+    void Erase(const std::string& ns, const std::string& key) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto& space = Load(ns);
+            if (space.values.erase(key) == 0) {
+                return;
+            }
+            space.pending[key] = std::nullopt;
+            ScheduleCommit();
+        }
+        NotifyChange(ns, key);
+    }
+
+    void EraseAll(const std::string& ns) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto& space = Load(ns);
+            space.values.clear();
+            space.pending.clear();
+            space.erase_all = true;
+            ScheduleCommit();
+        }
+        NotifyChange(ns, "");
+    }
+
+    void AddObserver(const std::string& ns, std::function<void(const std::string& key)> callback) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        observers_[ns].push_back(std::move(callback));
+    }
+
+    void Commit() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        esp_timer_stop(commit_timer_);
+        for (auto& [ns, space] : namespaces_) {
+            if (!space.erase_all && space.pending.empty()) {
+                continue;
+            }
+            nvs_handle_t handle;
+            esp_err_t err = nvs_open(ns.c_str(), NVS_READWRITE, &handle);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to open namespace %s: %s", ns.c_str(), esp_err_to_name(err));
+                continue;
+            }
+            if (space.erase_all) {
+                ESP_ERROR_CHECK(nvs_erase_all(handle));
+            }
+            for (auto& [key, value] : space.pending) {
+                if (!value.has_value()) {
+                    err = nvs_erase_key(handle, key.c_str());
+                    if (err != ESP_ERR_NVS_NOT_FOUND) {
+                        ESP_ERROR_CHECK(err);
+                    }
+                } else if (value->is_string) {
+                    ESP_ERROR_CHECK(nvs_set_str(handle, key.c_str(), value->string_value.c_str()));
+                } else {
+                    ESP_ERROR_CHECK(nvs_set_i32(handle, key.c_str(), value->int_value));
+                }
+            }
+            ESP_ERROR_CHECK(nvs_commit(handle));
+            nvs_close(handle);
+            ESP_LOGI(TAG, "Committed %u changes to %s", (unsigned)space.pending.size(), ns.c_str());
+            space.pending.clear();
+            space.erase_all = false;
+        }
+    }
+
+private:
+    struct Namespace {
+        std::map<std::string, Value> values;
+        // nullopt 表示删除
+        std::map<std::string, std::optional<Value>> pending;
+        bool erase_all = false;
+    };
+
+    std::mutex mutex_;
+    std::map<std::string, Namespace> namespaces_;
+    std::map<std::string, std::vector<std::function<void(const std::string& key)>>> observers_;
+    esp_timer_handle_t commit_timer_ = nullptr;
+
+    Store() {
+        esp_timer_create_args_t timer_args = {
+            .callback = [](void* arg) {
+                static_cast<Store*>(arg)->Commit();
+            },
+            .arg = this,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "settings_commit",
+            .skip_unhandled_events = true,
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&timer_args, &commit_timer_));
+        esp_register_shutdown_handler([]() {
+            Store::GetInstance().Commit();
+        });
+    }
+
+    // 整个命名空间一次读入，Settings 只用到 i32 和字符串
+    Namespace& Load(const std::string& ns) {
+        auto it = namespaces_.find(ns);
+        if (it != namespaces_.end()) {
+            return it->second;
+        }
+        auto& space = namespaces_[ns];
+        nvs_handle_t handle;
+        if (nvs_open(ns.c_str(), NVS_READONLY, &handle) != ESP_OK) {
+            return space;
+        }
+        nvs_iterator_t iterator = nullptr;
+        esp_err_t err = nvs_entry_find(NVS_DEFAULT_PART_NAME, ns.c_str(), NVS_TYPE_ANY, &iterator);
+        while (err == ESP_OK) {
+            nvs_entry_info_t info;
+            nvs_entry_info(iterator, &info);
+            Value value;
+            if (info.type == NVS_TYPE_I32) {
+                if (nvs_get_i32(handle, info.key, &value.int_value) == ESP_OK) {
+                    space.values[info.key] = value;
+                }
+            } else if (info.type == NVS_TYPE_STR) {
+                size_t length = 0;
+                if (nvs_get_str(handle, info.key, nullptr, &length) == ESP_OK) {
+                    value.is_string = true;
+                    value.string_value.resize(length);
+                    if (nvs_get_str(handle, info.key, value.string_value.data(), &length) == ESP_OK) {
+                        while (!value.string_value.empty() && value.string_value.back() == '\0') {
+                            value.string_value.pop_back();
+                        }
+                        space.values[info.key] = std::move(value);
+                    }
+                }
+            }
+            err = nvs_entry_next(&iterator);
+        }
+        nvs_release_iterator(iterator);
+        nvs_close(handle);
+        ESP_LOGD(TAG, "Loaded %u values from %s", (unsigned)space.values.size(), ns.c_str());
+        return space;
+    }
+
+    void ScheduleCommit() {
+        if (!esp_timer_is_active(commit_timer_)) {
+            esp_timer_start_once(commit_timer_, SETTINGS_COMMIT_DELAY_US);
+        }
+    }
+
+    void NotifyChange(const std::string& ns, const std::string& key) {
+        std::vector<std::function<void(const std::string& key)>> callbacks;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = observers_.find(ns);
+            if (it == observers_.end()) {
+                return;
+            }
+            callbacks = it->second;
+        }
+        for (auto& callback : callbacks) {
+            callback(key);
+        }
+    }
+};
+
 Settings::Settings(const std::string& ns, bool read_write) : ns_(ns), read_write_(read_write) {
-    nvs_open(ns.c_str(), read_write_ ? NVS_READWRITE : NVS_READONLY, &nvs_handle_);
+    direct_ = IsSharedNamespace(ns);
+    if (direct_) {
+        nvs_open(ns.c_str(), read_write_ ? NVS_READWRITE : NVS_READONLY, &nvs_handle_);
+    }
 }
 
 Settings::~Settings() {
@@ -18,7 +236,22 @@ Settings::~Settings() {
     }
 }
 
+void Settings::OnChange(const std::string& ns, std::function<void(const std::string& key)> callback) {
+    Store::GetInstance().AddObserver(ns, std::move(callback));
+}
+
+void Settings::Flush() {
+    Store::GetInstance().Commit();
+}
+
 std::string Settings::GetString(const std::string& key, const std::string& default_value) {
+    if (!direct_) {
+        auto value = Store::GetInstance().Get(ns_, key);
+        if (!value.has_value() || !value->is_string) {
+            return default_value;
+        }
+        return value->string_value;
+    }
     if (nvs_handle_ == 0) {
         return default_value;
     }
@@ -38,15 +271,24 @@ std::string Settings::GetString(const std::string& key, const std::string& defau
 }
 
 void Settings::SetString(const std::string& key, const std::string& value) {
-    if (read_write_) {
+    if (!read_write_) {
+        ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
+    } else if (!direct_) {
+        Store::GetInstance().Set(ns_, key, { .is_string = true, .int_value = 0, .string_value = value });
+    } else {
         ESP_ERROR_CHECK(nvs_set_str(nvs_handle_, key.c_str(), value.c_str()));
         dirty_ = true;
-    } else {
-        ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
     }
 }
 
 int32_t Settings::GetInt(const std::string& key, int32_t default_value) {
+    if (!direct_) {
+        auto value = Store::GetInstance().Get(ns_, key);
+        if (!value.has_value() || value->is_string) {
+            return default_value;
+        }
+        return value->int_value;
+    }
     if (nvs_handle_ == 0) {
         return default_value;
     }
@@ -59,29 +301,35 @@ int32_t Settings::GetInt(const std::string& key, int32_t default_value) {
 }
 
 void Settings::SetInt(const std::string& key, int32_t value) {
-    if (read_write_) {
+    if (!read_write_) {
+        ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
+    } else if (!direct_) {
+        Store::GetInstance().Set(ns_, key, { .is_string = false, .int_value = value, .string_value = {} });
+    } else {
         ESP_ERROR_CHECK(nvs_set_i32(nvs_handle_, key.c_str(), value));
         dirty_ = true;
-    } else {
-        ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
     }
 }
 
 void Settings::EraseKey(const std::string& key) {
-    if (read_write_) {
+    if (!read_write_) {
+        ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
+    } else if (!direct_) {
+        Store::GetInstance().Erase(ns_, key);
+    } else {
         auto ret = nvs_erase_key(nvs_handle_, key.c_str());
         if (ret != ESP_ERR_NVS_NOT_FOUND) {
             ESP_ERROR_CHECK(ret);
         }
-    } else {
-        ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
     }
 }
 
 void Settings::EraseAll() {
-    if (read_write_) {
-        ESP_ERROR_CHECK(nvs_erase_all(nvs_handle_));
-    } else {
+    if (!read_write_) {
         ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
+    } else if (!direct_) {
+        Store::GetInstance().EraseAll(ns_);
+    } else {
+        ESP_ERROR_CHECK(nvs_erase_all(nvs_handle_));
     }
 }
@@ -2,8 +2,15 @@
 #define SETTINGS_H
 
 #include <string>
+#include <functional>
 #include <nvs_flash.h>
 
+/*
+ * Values are served from a process-wide cache, each namespace is read from NVS once on first use.
+ * Writes only touch the cache, changed values are written to NVS together a short while after the
+ * first change, so bursts like volume adjustments end up as one commit. Flush() writes them at once,
+ * it also runs on esp_restart().
+ */
 class Settings {
 public:
     Settings(const std::string& ns, bool read_write = false);
@@ -16,9 +23,18 @@ public:
     void EraseKey(const std::string& key);
     void EraseAll();
 
+    // Called with the key after a value of the namespace changes, key is empty after EraseAll()
+    static void OnChange(const std::string& ns, std::function<void(const std::string& key)> callback);
+    // Write pending changes to NVS now, call before powering off
+    static void Flush();
+
 private:
+    class Store;
+
     std::string ns_;
+    // Namespaces also written by other components bypass the cache
     nvs_handle_t nvs_handle_ = 0;
+    bool direct_ = false;
     bool read_write_ = false;
     bool dirty_ = false;
 };
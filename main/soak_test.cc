@@ -0,0 +1,320 @@
+#include "soak_test.h"
+#include "application.h"
+#include "board.h"
+#include "assets.h"
+#include "assets/lang_config.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_app_desc.h>
+#include <algorithm>
+#include <cstring>
+
+#define TAG "SoakTest"
+
+// 控制 Application 和摄像头、音乐，会间接读写 NVS，栈放在内部 RAM
+#define SOAK_TASK_STACK_SIZE 6144
+#define SOAK_TASK_PRIORITY 2
+#define SOAK_POLL_MS 50
+#define SOAK_WAKE_TIMEOUT_MS 10000
+#define SOAK_REPLY_TIMEOUT_MS 30000
+#define SOAK_CONVERSATION_TIMEOUT_MS 120000
+#define SOAK_SOUND_TIMEOUT_MS 10000
+#define SOAK_MUSIC_PLAY_MS 20000
+#define SOAK_IDLE_TIMEOUT_MS 5000
+
+static const char* const kStepNames[] = {
+    "wake", "reply", "conversation", "sound", "music", "camera",
+};
+static_assert(sizeof(kStepNames) / sizeof(kStepNames[0]) == kSoakStepCount, "Step names out of sync");
+
+static uint32_t GetU32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint16_t GetU16(const uint8_t* p) {
+    return ((uint16_t)p[0] << 8) | p[1];
+}
+
+bool SoakTest::Start(int cycles) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (task_ != nullptr) {
+        return false;
+    }
+    cycles_ = cycles;
+    cycle_ = 0;
+    start_us_ = esp_timer_get_time();
+    end_us_ = 0;
+    last_sample_us_ = 0;
+    sample_interval_s_ = CONFIG_SOAK_TEST_SAMPLE_SECONDS;
+    samples_.clear();
+    samples_.reserve(SOAK_TEST_MAX_SAMPLES);
+    task_max_cpu_.fill(0);
+    task_min_stack_.fill(0xFFFF);
+    failures_.fill(0);
+    for (auto& step : steps_) {
+        step.Reset();
+    }
+    stop_requested_ = false;
+
+    if (xTaskCreate([](void* arg) {
+            static_cast<SoakTest*>(arg)->Run();
+            vTaskDelete(NULL);
+        }, "soak_test", SOAK_TASK_STACK_SIZE, this, SOAK_TASK_PRIORITY, &task_) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the soak test task");
+        task_ = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void SoakTest::Stop() {
+    stop_requested_ = true;
+}
+
+bool SoakTest::WaitFor(const std::function<bool()>& condition, int timeout_ms) {
+    int64_t deadline = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+    while (!condition()) {
+        if (stop_requested_ || esp_timer_get_time() > deadline) {
+            return false;
+        }
+        vTaskDelay(pdMS_TO_TICKS(SOAK_POLL_MS));
+    }
+    return true;
+}
+
+void SoakTest::Fail(SoakStep step) {
+    failures_[step]++;
+    ESP_LOGW(TAG, "Cycle %lu: %s failed", (unsigned long)cycle_.load(), kStepNames[step]);
+}
+
+void SoakTest::ReturnToIdle() {
+    auto& app = Application::GetInstance();
+    // 说话中唤醒是打断，聆听中唤醒是关闭通道，实时模式打断之后还要再关一次
+    for (int i = 0; i < 3 && app.GetDeviceState() != kDeviceStateIdle && !stop_requested_; i++) {
+        auto state = app.GetDeviceState();
+        if (state == kDeviceStateListening || state == kDeviceStateSpeaking) {
+            app.WakeWordInvoke(CONFIG_SOAK_TEST_WAKE_WORD);
+        }
+        WaitFor([&app]() { return app.GetDeviceState() == kDeviceStateIdle; }, SOAK_IDLE_TIMEOUT_MS);
+    }
+}
+
+void SoakTest::RunCycle() {
+    auto& app = Application::GetInstance();
+    auto& board = Board::GetInstance();
+
+    // 唤醒并完成一轮对话
+    int64_t start = esp_timer_get_time();
+    app.WakeWordInvoke(CONFIG_SOAK_TEST_WAKE_WORD);
+    if (!WaitFor([&app]() {
+            auto state = app.GetDeviceState();
+            return state == kDeviceStateListening || state == kDeviceStateSpeaking;
+        }, SOAK_WAKE_TIMEOUT_MS)) {
+        Fail(kSoakStepWake);
+        ReturnToIdle();
+        return;
+    }
+    int64_t listening = esp_timer_get_time();
+    steps_[kSoakStepWake].Record(listening - start);
+
+    if (!WaitFor([&app]() { return app.GetDeviceState() == kDeviceStateSpeaking; }, SOAK_REPLY_TIMEOUT_MS)) {
+        Fail(kSoakStepReply);
+        ReturnToIdle();
+        return;
+    }
+    int64_t speaking = esp_timer_get_time();
+    steps_[kSoakStepReply].Record(speaking - listening);
+
+    // 实时模式说完之后继续聆听，这时结束对话
+    if (!WaitFor([&app]() { return app.GetDeviceState() != kDeviceStateSpeaking; }, SOAK_CONVERSATION_TIMEOUT_MS)) {
+        Fail(kSoakStepConversation);
+    } else {
+        steps_[kSoakStepConversation].Record(esp_timer_get_time() - speaking);
+    }
+    ReturnToIdle();
+    if (stop_requested_) {
+        return;
+    }
+
+    // 本地音效，经过和 TTS 相同的解码播放路径
+    start = esp_timer_get_time();
+    app.PlaySound(Assets::GetInstance().GetSound("success", Lang::Sounds::P3_SUCCESS));
+    vTaskDelay(pdMS_TO_TICKS(SOAK_POLL_MS));
+    if (!WaitFor([&app]() { return app.GetAudioService().IsIdle(); }, SOAK_SOUND_TIMEOUT_MS)) {
+        Fail(kSoakStepSound);
+    } else {
+        steps_[kSoakStepSound].Record(esp_timer_get_time() - start);
+    }
+
+    auto music = board.GetMusic();
+    if (music != nullptr && strlen(CONFIG_SOAK_TEST_SONG) > 0 && !stop_requested_) {
+        start = esp_timer_get_time();
+        if (!music->Download(CONFIG_SOAK_TEST_SONG)) {
+            Fail(kSoakStepMusic);
+        } else {
+            steps_[kSoakStepMusic].Record(esp_timer_get_time() - start);
+            WaitFor([]() { return false; }, SOAK_MUSIC_PLAY_MS);
+            music->StopStreaming();
+        }
+    }
+
+    auto camera = board.GetCamera();
+    if (camera != nullptr && !stop_requested_) {
+        start = esp_timer_get_time();
+        if (!camera->Capture()) {
+            Fail(kSoakStepCamera);
+        } else {
+            steps_[kSoakStepCamera].Record(esp_timer_get_time() - start);
+        }
+    }
+}
+
+void SoakTest::TakeSample() {
+    uint8_t report[METRICS_REPORT_MAX_SIZE];
+    size_t size = SystemMetrics::GetInstance().BuildReport(report, sizeof(report));
+    if (size < 32) {
+        return;
+    }
+    last_sample_us_ = esp_timer_get_time();
+
+    // 按 SystemMetrics::BuildReport() 的格式解析
+    size_t task_count = report[1], value_count = report[2], histogram_count = report[3];
+    Sample sample = {};
+    sample.uptime_s = GetU32(report + 4);
+    sample.cycle = cycle_;
+    sample.internal_free = GetU32(report + 8);
+    sample.internal_largest = GetU32(report + 12);
+    sample.internal_min_free = GetU32(report + 16);
+    sample.psram_largest = GetU32(report + 24);
+    sample.cpu_percent = report[28];
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    const uint8_t* p = report + 32;
+    for (size_t i = 0; i < task_count && i < task_max_cpu_.size(); i++, p += 4) {
+        task_max_cpu_[i] = std::max(task_max_cpu_[i], p[0]);
+        task_min_stack_[i] = std::min(task_min_stack_[i], GetU16(p + 2));
+    }
+    p += value_count * 4;
+    for (size_t i = 0; i < histogram_count && i < sample.p99_ms.size(); i++, p += 6) {
+        sample.p99_ms[i] = GetU16(p + 2);
+    }
+
+    if (samples_.size() == SOAK_TEST_MAX_SAMPLES) {
+        // 保留第一个和每隔一个，间隔加倍
+        size_t kept = 0;
+        for (size_t i = 0; i < samples_.size(); i += 2) {
+            samples_[kept++] = samples_[i];
+        }
+        samples_.resize(kept);
+        sample_interval_s_ *= 2;
+    }
+    samples_.push_back(sample);
+}
+
+void SoakTest::Run() {
+    auto& app = Application::GetInstance();
+    ESP_LOGI(TAG, "Soak test started, %d cycles", cycles_);
+    WaitFor([&app]() { return app.GetDeviceState() == kDeviceStateIdle; }, INT32_MAX);
+    TakeSample();
+
+    while (!stop_requested_ && (cycles_ == 0 || (int)cycle_ < cycles_)) {
+        RunCycle();
+        cycle_++;
+        if (esp_timer_get_time() - last_sample_us_ >= (int64_t)sample_interval_s_ * 1000000) {
+            TakeSample();
+        }
+        WaitFor([]() { return false; }, CONFIG_SOAK_TEST_IDLE_SECONDS * 1000);
+    }
+    TakeSample();
+    end_us_ = esp_timer_get_time();
+
+    uint32_t failures = 0;
+    for (auto count : failures_) {
+        failures += count;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    ESP_LOGI(TAG, "Soak test done: %lu cycles in %lld s, %lu failures", (unsigned long)cycle_.load(),
+        (end_us_ - start_us_) / 1000000, (unsigned long)failures);
+    if (!samples_.empty()) {
+        ESP_LOGI(TAG, "Internal largest block %lu -> %lu KB, min free %lu KB",
+            (unsigned long)(samples_.front().internal_largest / 1024),
+            (unsigned long)(samples_.back().internal_largest / 1024),
+            (unsigned long)(samples_.back().internal_min_free / 1024));
+    }
+    task_ = nullptr;
+}
+
+std::string SoakTest::ToJson() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    char buffer[160];
+    int64_t end = end_us_ != 0 ? end_us_ : esp_timer_get_time();
+
+    std::string json = "{\"running\":";
+    json += task_ != nullptr ? "true" : "false";
+    json += ",\"firmware\":\"" + std::string(esp_app_get_description()->version) + "\"";
+    json += ",\"board\":\"" BOARD_NAME "\"";
+    snprintf(buffer, sizeof(buffer), ",\"elapsed_s\":%lld,\"cycles\":%lu,\"sample_interval_s\":%d",
+        start_us_ != 0 ? (end - start_us_) / 1000000 : 0LL, (unsigned long)cycle_.load(), sample_interval_s_);
+    json += buffer;
+
+    json += ",\"steps\":{";
+    for (int i = 0; i < kSoakStepCount; i++) {
+        auto& step = steps_[i];
+        snprintf(buffer, sizeof(buffer), "%s\"%s\":{\"count\":%lu,\"failures\":%lu,\"p50_ms\":%lu,\"p99_ms\":%lu,\"max_ms\":%lu}",
+            i == 0 ? "" : ",", kStepNames[i], (unsigned long)step.count(), (unsigned long)failures_[i],
+            (unsigned long)(step.Percentile(50) / 1000), (unsigned long)(step.Percentile(99) / 1000),
+            (unsigned long)(step.max_us() / 1000));
+        json += buffer;
+    }
+    json += "}";
+
+    if (!samples_.empty()) {
+        auto& first = samples_.front();
+        auto& last = samples_.back();
+        uint32_t min_largest = UINT32_MAX, min_psram_largest = UINT32_MAX;
+        uint8_t max_cpu = 0;
+        for (auto& sample : samples_) {
+            min_largest = std::min(min_largest, sample.internal_largest);
+            min_psram_largest = std::min(min_psram_largest, sample.psram_largest);
+            max_cpu = std::max(max_cpu, sample.cpu_percent);
+        }
+        snprintf(buffer, sizeof(buffer), ",\"heap\":{\"internal_largest_first\":%lu,\"internal_largest_last\":%lu,"
+            "\"internal_largest_min\":%lu,\"internal_min_free\":%lu,\"psram_largest_min\":%lu},\"max_cpu\":%u",
+            (unsigned long)first.internal_largest, (unsigned long)last.internal_largest, (unsigned long)min_largest,
+            (unsigned long)last.internal_min_free, (unsigned long)min_psram_largest, max_cpu);
+        json += buffer;
+
+        json += ",\"tasks\":{";
+        for (size_t i = 0; i < SystemMetrics::TrackedTaskCount() && i < task_max_cpu_.size(); i++) {
+            snprintf(buffer, sizeof(buffer), "%s\"%s\":{\"max_cpu\":%u,\"min_stack\":%u}", i == 0 ? "" : ",",
+                SystemMetrics::TrackedTaskName(i), task_max_cpu_[i], task_min_stack_[i]);
+            json += buffer;
+        }
+        // 每个延迟直方图的 p99：第一个样本、最后一个样本、最大值，看是否随时间上升
+        json += "},\"latency_p99_ms\":{";
+        auto& metrics = SystemMetrics::GetInstance();
+        size_t histogram_count = std::min<size_t>(metrics.HistogramCount(), METRICS_MAX_HISTOGRAMS);
+        for (size_t i = 0; i < histogram_count; i++) {
+            uint16_t max_p99 = 0;
+            for (auto& sample : samples_) {
+                max_p99 = std::max(max_p99, sample.p99_ms[i]);
+            }
+            snprintf(buffer, sizeof(buffer), "%s\"%s\":[%u,%u,%u]", i == 0 ? "" : ",", metrics.HistogramName(i),
+                first.p99_ms[i], last.p99_ms[i], max_p99);
+            json += buffer;
+        }
+        // [uptime_s, cycle, internal_free, internal_largest, psram_largest, cpu%]
+        json += "},\"samples\":[";
+        for (size_t i = 0; i < samples_.size(); i++) {
+            auto& sample = samples_[i];
+            snprintf(buffer, sizeof(buffer), "%s[%lu,%lu,%lu,%lu,%lu,%u]", i == 0 ? "" : ",",
+                (unsigned long)sample.uptime_s, (unsigned long)sample.cycle, (unsigned long)sample.internal_free,
+                (unsigned long)sample.internal_largest, (unsigned long)sample.psram_largest, sample.cpu_percent);
+            json += buffer;
+        }
+        json += "]";
+    }
+    json += "}";
+    return json;
+}
@@ -0,0 +1,97 @@
+#ifndef SOAK_TEST_H
+#define SOAK_TEST_H
+
+#include <sdkconfig.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "system_metrics.h"
+#include "latency_tracer.h"
+
+#define SOAK_TEST_MAX_SAMPLES 240
+
+enum SoakStep {
+    kSoakStepWake,          // WakeWordInvoke() -> listening
+    kSoakStepReply,         // listening -> speaking
+    kSoakStepConversation,  // speaking -> back to idle
+    kSoakStepSound,         // local sound played through the decoder
+    kSoakStepMusic,         // music start -> stop
+    kSoakStepCamera,        // one Capture()
+    kSoakStepCount,
+};
+
+/*
+ * Long running soak test: drives Application through scripted cycles until stopped or the requested number of
+ * cycles is done, to catch what only shows up after hours (heap fragmentation, creeping latency, stack overflows).
+ *
+ * One cycle: wake word invoke and a whole conversation, a local sound, with CONFIG_SOAK_TEST_SONG a song played
+ * for a while and stopped, and one camera capture on boards with a camera. Started while the session replay of
+ * CONFIG_SESSION_RECORDER is active, the conversations are the recorded ones (recorded microphone PCM and TTS),
+ * so no server is needed and every build gets the same input. Steps that time out count as failures and the
+ * device is brought back to idle before the next cycle.
+ *
+ * Every CONFIG_SOAK_TEST_SAMPLE_SECONDS the SystemMetrics report (heap, largest blocks, CPU and free stack per task,
+ * latency percentiles) is kept as a sample; when SOAK_TEST_MAX_SAMPLES are full every other one is dropped and the
+ * interval doubles, so a run of any length fits. ToJson() is the report to compare between builds and boards.
+ */
+class SoakTest {
+public:
+    static SoakTest& GetInstance() {
+        static SoakTest instance;
+        return instance;
+    }
+    SoakTest(const SoakTest&) = delete;
+    SoakTest& operator=(const SoakTest&) = delete;
+
+    // cycles 0 runs until Stop()
+    bool Start(int cycles);
+    void Stop();
+    bool running() const { return task_ != nullptr; }
+    std::string ToJson();
+
+private:
+    struct Sample {
+        uint32_t uptime_s;
+        uint32_t cycle;
+        uint32_t internal_free;
+        uint32_t internal_largest;
+        uint32_t internal_min_free;
+        uint32_t psram_largest;
+        uint8_t cpu_percent;
+        std::array<uint16_t, METRICS_MAX_HISTOGRAMS> p99_ms;
+    };
+
+    TaskHandle_t task_ = nullptr;
+    std::atomic<bool> stop_requested_ = false;
+    std::mutex mutex_;
+    int cycles_ = 0;
+    std::atomic<uint32_t> cycle_ = 0;
+    int64_t start_us_ = 0;
+    int64_t end_us_ = 0;
+    int sample_interval_s_ = CONFIG_SOAK_TEST_SAMPLE_SECONDS;
+    int64_t last_sample_us_ = 0;
+    std::vector<Sample> samples_;
+    std::array<uint8_t, 8> task_max_cpu_;
+    std::array<uint16_t, 8> task_min_stack_;
+    std::array<uint32_t, kSoakStepCount> failures_;
+    std::array<LatencyHistogram, kSoakStepCount> steps_;
+
+    SoakTest() = default;
+
+    void Run();
+    void RunCycle();
+    void TakeSample();
+    bool WaitFor(const std::function<bool()>& condition, int timeout_ms);
+    void Fail(SoakStep step);
+    void ReturnToIdle();
+};
+
+#endif // SOAK_TEST_H
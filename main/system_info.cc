@@ -1,4 +1,6 @@
 #include "system_info.h"
+#include "audio_memory.h"
+#include "memory_guard.h"
 
 #include <freertos/task.h>
 #include <esp_log.h>
@@ -142,4 +144,6 @@ void SystemInfo::PrintHeapStats() {
     int free_sram = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
     int min_free_sram = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
     ESP_LOGI(TAG, "free sram: %u minimal sram: %u", free_sram, min_free_sram);
+    AudioMemory::PrintStats();
+    MemoryGuard::GetInstance().PrintStats();
 }
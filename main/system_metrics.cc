@@ -0,0 +1,255 @@
+#include "system_metrics.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+#define TAG "SystemMetrics"
+
+// 按前缀匹配，tool_call 包括不同栈大小的 tool_call_s / tool_call_l
+static const char* const kTrackedTasks[] = {
+    "main", "audio_input", "audio_output", "opus_codec", "audio_uplink", "display_fft", "tool_call",
+};
+static_assert(sizeof(kTrackedTasks) / sizeof(kTrackedTasks[0]) <= 8, "Too many tracked tasks");
+
+size_t SystemMetrics::TrackedTaskCount() {
+    return sizeof(kTrackedTasks) / sizeof(kTrackedTasks[0]);
+}
+
+const char* SystemMetrics::TrackedTaskName(size_t index) {
+    return kTrackedTasks[index];
+}
+
+static int TrackedTaskIndex(const char* name) {
+    for (size_t i = 0; i < SystemMetrics::TrackedTaskCount(); i++) {
+        if (strncmp(name, kTrackedTasks[i], strlen(kTrackedTasks[i])) == 0) {
+            // main 只匹配完整名称
+            if (i == 0 && name[4] != '\0') {
+                continue;
+            }
+            return i;
+        }
+    }
+    return -1;
+}
+
+std::atomic<uint32_t>& SystemMetrics::Value(const char* name, bool gauge) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < value_count_; i++) {
+        if (strcmp(values_[i].name, name) == 0) {
+            return values_[i].value;
+        }
+    }
+    if (value_count_ == values_.size()) {
+        ESP_LOGW(TAG, "Too many metrics, %s is not recorded", name);
+        return overflow_value_;
+    }
+    auto& value = values_[value_count_++];
+    value.name = name;
+    value.gauge = gauge;
+    return value.value;
+}
+
+void SystemMetrics::AddHistogram(const char* name, const LatencyHistogram* histogram) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (histogram_count_ == histograms_.size()) {
+        ESP_LOGW(TAG, "Too many histograms, %s is not recorded", name);
+        return;
+    }
+    histograms_[histogram_count_++] = { name, histogram };
+}
+
+size_t SystemMetrics::HistogramCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return histogram_count_;
+}
+
+const char* SystemMetrics::HistogramName(size_t index) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return index < histogram_count_ ? histograms_[index].name : nullptr;
+}
+
+void SystemMetrics::Sample() {
+    Snapshot snapshot;
+    snapshot.uptime_s = esp_timer_get_time() / 1000000;
+    snapshot.internal_free = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    snapshot.internal_largest = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+    snapshot.internal_min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+    snapshot.psram_free = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    snapshot.psram_largest = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    configRUN_TIME_COUNTER_TYPE total_run_time = 0;
+    UBaseType_t task_count = uxTaskGetSystemState(task_status_.data(), task_status_.size(), &total_run_time);
+    uint64_t elapsed = (uint64_t)(total_run_time - last_total_run_time_) * CONFIG_FREERTOS_NUMBER_OF_CORES;
+    bool has_previous = last_total_run_time_ != 0 && elapsed > 0;
+    uint64_t task_elapsed[8] = {};
+    uint64_t idle_elapsed = 0;
+
+    for (UBaseType_t i = 0; i < task_count; i++) {
+        auto& status = task_status_[i];
+        int index = TrackedTaskIndex(status.pcTaskName);
+        if (index >= 0) {
+            // 同名任务取最小剩余栈
+            uint32_t stack_free = status.usStackHighWaterMark * sizeof(StackType_t);
+            auto& task = snapshot.tasks[index];
+            task.stack_free = std::min<uint32_t>(task.stack_free, std::min<uint32_t>(stack_free, 0xFFFE));
+        }
+        if (!has_previous) {
+            continue;
+        }
+        for (size_t j = 0; j < last_run_time_count_; j++) {
+            if (last_run_times_[j].handle == status.xHandle) {
+                uint64_t delta = status.ulRunTimeCounter - last_run_times_[j].counter;
+                if (index >= 0) {
+                    task_elapsed[index] += delta;
+                }
+                if (strncmp(status.pcTaskName, "IDLE", 4) == 0) {
+                    idle_elapsed += delta;
+                }
+                break;
+            }
+        }
+    }
+
+    if (has_previous) {
+        for (size_t i = 0; i < TrackedTaskCount(); i++) {
+            snapshot.tasks[i].cpu_percent = std::min<uint64_t>(task_elapsed[i] * 100 / elapsed, 100);
+        }
+        snapshot.cpu_percent = idle_elapsed >= elapsed ? 0 : (elapsed - idle_elapsed) * 100 / elapsed;
+    }
+    for (UBaseType_t i = 0; i < task_count; i++) {
+        last_run_times_[i] = { task_status_[i].xHandle, task_status_[i].ulRunTimeCounter };
+    }
+    last_run_time_count_ = task_count;
+    if (task_count > 0) {
+        last_total_run_time_ = total_run_time;
+    }
+
+    history_[history_next_] = snapshot;
+    history_next_ = (history_next_ + 1) % history_.size();
+    if (history_count_ < history_.size()) {
+        history_count_++;
+    }
+}
+
+const SystemMetrics::Snapshot* SystemMetrics::Latest() const {
+    if (history_count_ == 0) {
+        return nullptr;
+    }
+    return &history_[(history_next_ + history_.size() - 1) % history_.size()];
+}
+
+std::string SystemMetrics::ToJson() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto latest = Latest();
+    if (latest == nullptr) {
+        return "{}";
+    }
+
+    char buffer[192];
+    std::string json;
+    snprintf(buffer, sizeof(buffer), "{\"uptime_s\":%lu,\"cpu_percent\":%u,\"heap\":{\"internal_free\":%lu,\"internal_largest\":%lu,"
+        "\"internal_min_free\":%lu,\"psram_free\":%lu,\"psram_largest\":%lu},\"tasks\":{",
+        (unsigned long)latest->uptime_s, latest->cpu_percent, (unsigned long)latest->internal_free,
+        (unsigned long)latest->internal_largest, (unsigned long)latest->internal_min_free,
+        (unsigned long)latest->psram_free, (unsigned long)latest->psram_largest);
+    json += buffer;
+    bool first = true;
+    for (size_t i = 0; i < TrackedTaskCount(); i++) {
+        auto& task = latest->tasks[i];
+        if (task.stack_free == 0xFFFF) {
+            continue;
+        }
+        snprintf(buffer, sizeof(buffer), "%s\"%s\":{\"cpu_percent\":%u,\"stack_free\":%u}", first ? "" : ",",
+            kTrackedTasks[i], task.cpu_percent, task.stack_free);
+        json += buffer;
+        first = false;
+    }
+
+    json += "},\"values\":{";
+    for (size_t i = 0; i < value_count_; i++) {
+        snprintf(buffer, sizeof(buffer), "%s\"%s\":%lu", i == 0 ? "" : ",", values_[i].name,
+            (unsigned long)values_[i].value.load(std::memory_order_relaxed));
+        json += buffer;
+    }
+
+    json += "},\"histograms\":{";
+    for (size_t i = 0; i < histogram_count_; i++) {
+        auto histogram = histograms_[i].histogram;
+        snprintf(buffer, sizeof(buffer), "%s\"%s\":{\"count\":%lu,\"p50_ms\":%.1f,\"p99_ms\":%.1f,\"max_ms\":%.1f}",
+            i == 0 ? "" : ",", histograms_[i].name, (unsigned long)histogram->count(),
+            histogram->Percentile(50) / 1000.0f, histogram->Percentile(99) / 1000.0f, histogram->max_us() / 1000.0f);
+        json += buffer;
+    }
+
+    // 历史只保留几项关键数据，最旧的在前
+    json += "},\"history\":[";
+    size_t start = (history_next_ + history_.size() - history_count_) % history_.size();
+    for (size_t i = 0; i < history_count_; i++) {
+        auto& snapshot = history_[(start + i) % history_.size()];
+        snprintf(buffer, sizeof(buffer), "%s[%lu,%u,%lu,%lu]", i == 0 ? "" : ",", (unsigned long)snapshot.uptime_s,
+            snapshot.cpu_percent, (unsigned long)snapshot.internal_free, (unsigned long)snapshot.psram_free);
+        json += buffer;
+    }
+    json += "],\"history_fields\":[\"uptime_s\",\"cpu_percent\",\"internal_free\",\"psram_free\"]}";
+    return json;
+}
+
+static uint8_t* PutU16(uint8_t* p, uint32_t value) {
+    value = std::min<uint32_t>(value, 0xFFFF);
+    p[0] = value >> 8;
+    p[1] = value;
+    return p + 2;
+}
+
+static uint8_t* PutU32(uint8_t* p, uint32_t value) {
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+    return p + 4;
+}
+
+size_t SystemMetrics::BuildReport(uint8_t* buffer, size_t size) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto latest = Latest();
+    size_t needed = 32 + TrackedTaskCount() * 4 + value_count_ * 4 + histogram_count_ * 6;
+    if (latest == nullptr || size < needed) {
+        return 0;
+    }
+
+    uint8_t* p = buffer;
+    *p++ = METRICS_REPORT_VERSION;
+    *p++ = TrackedTaskCount();
+    *p++ = value_count_;
+    *p++ = histogram_count_;
+    p = PutU32(p, latest->uptime_s);
+    p = PutU32(p, latest->internal_free);
+    p = PutU32(p, latest->internal_largest);
+    p = PutU32(p, latest->internal_min_free);
+    p = PutU32(p, latest->psram_free);
+    p = PutU32(p, latest->psram_largest);
+    *p++ = latest->cpu_percent;
+    *p++ = 0;
+    *p++ = 0;
+    *p++ = 0;
+    for (size_t i = 0; i < TrackedTaskCount(); i++) {
+        *p++ = latest->tasks[i].cpu_percent;
+        *p++ = 0;
+        p = PutU16(p, latest->tasks[i].stack_free);
+    }
+    for (size_t i = 0; i < value_count_; i++) {
+        p = PutU32(p, values_[i].value.load(std::memory_order_relaxed));
+    }
+    for (size_t i = 0; i < histogram_count_; i++) {
+        auto histogram = histograms_[i].histogram;
+        p = PutU16(p, histogram->Percentile(50) / 1000);
+        p = PutU16(p, histogram->Percentile(99) / 1000);
+        p = PutU16(p, histogram->max_us() / 1000);
+    }
+    return p - buffer;
+}
@@ -0,0 +1,116 @@
+#ifndef _SYSTEM_METRICS_H_
+#define _SYSTEM_METRICS_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "latency_tracer.h"
+
+#define METRICS_MAX_VALUES      16
+#define METRICS_MAX_HISTOGRAMS  8
+#define METRICS_HISTORY_SIZE    30  // 10 s samples, 5 minutes
+#define METRICS_MAX_TASKS       48  // Capacity of the uxTaskGetSystemState() snapshot
+#define METRICS_REPORT_MAX_SIZE 256
+#define METRICS_REPORT_VERSION  1
+
+/*
+ * Runtime telemetry: heap, per task CPU and stack usage, plus counters, gauges and latency histograms
+ * registered by the subsystems.
+ *
+ * Sample() is meant for the clock timer: it fills a preallocated task snapshot and computes the CPU
+ * share of each tracked task from the run time counters since the previous sample, the results go to
+ * a ring of the last METRICS_HISTORY_SIZE samples. ToJson() is the MCP view, BuildReport() the compact
+ * binary report, all fields big endian:
+ *   u8 version, u8 task count, u8 value count, u8 histogram count, u32 uptime in seconds,
+ *   u32 internal free, internal largest block, internal minimum free, psram free, psram largest block,
+ *   u8 total cpu %, 3 reserved bytes,
+ *   per tracked task (TrackedTaskName() order): u8 cpu %, u8 reserved, u16 free stack bytes (0xFFFF: not running),
+ *   per value (registration order): u32,
+ *   per histogram (registration order): u16 p50, p99 and max in ms.
+ */
+class SystemMetrics {
+public:
+    static SystemMetrics& GetInstance() {
+        static SystemMetrics instance;
+        return instance;
+    }
+    SystemMetrics(const SystemMetrics&) = delete;
+    SystemMetrics& operator=(const SystemMetrics&) = delete;
+
+    // Counters only go up, gauges hold the current value. The reference stays valid, look it up once.
+    std::atomic<uint32_t>& Counter(const char* name) { return Value(name, false); }
+    std::atomic<uint32_t>& Gauge(const char* name) { return Value(name, true); }
+    void AddHistogram(const char* name, const LatencyHistogram* histogram);
+
+    void Sample();
+    std::string ToJson() const;
+    size_t BuildReport(uint8_t* buffer, size_t size) const;
+
+    static size_t TrackedTaskCount();
+    static const char* TrackedTaskName(size_t index);
+    // Histograms in BuildReport() order
+    size_t HistogramCount() const;
+    const char* HistogramName(size_t index) const;
+
+private:
+    struct TaskSample {
+        uint8_t cpu_percent = 0;
+        uint16_t stack_free = 0xFFFF;
+    };
+
+    struct Snapshot {
+        uint32_t uptime_s = 0;
+        uint32_t internal_free = 0;
+        uint32_t internal_largest = 0;
+        uint32_t internal_min_free = 0;
+        uint32_t psram_free = 0;
+        uint32_t psram_largest = 0;
+        uint8_t cpu_percent = 0;
+        std::array<TaskSample, 8> tasks;
+    };
+
+    struct NamedValue {
+        const char* name = nullptr;
+        bool gauge = false;
+        std::atomic<uint32_t> value{0};
+    };
+
+    struct NamedHistogram {
+        const char* name = nullptr;
+        const LatencyHistogram* histogram = nullptr;
+    };
+
+    struct RunTime {
+        TaskHandle_t handle;
+        configRUN_TIME_COUNTER_TYPE counter;
+    };
+
+    SystemMetrics() = default;
+    std::atomic<uint32_t>& Value(const char* name, bool gauge);
+    const Snapshot* Latest() const;
+
+    mutable std::mutex mutex_;
+    std::array<NamedValue, METRICS_MAX_VALUES> values_;
+    size_t value_count_ = 0;
+    std::atomic<uint32_t> overflow_value_{0};
+    std::array<NamedHistogram, METRICS_MAX_HISTOGRAMS> histograms_;
+    size_t histogram_count_ = 0;
+
+    std::array<Snapshot, METRICS_HISTORY_SIZE> history_;
+    size_t history_count_ = 0;
+    size_t history_next_ = 0;
+
+    std::array<TaskStatus_t, METRICS_MAX_TASKS> task_status_;
+    std::array<RunTime, METRICS_MAX_TASKS> last_run_times_;
+    size_t last_run_time_count_ = 0;
+    configRUN_TIME_COUNTER_TYPE last_total_run_time_ = 0;
+};
+
+#endif // _SYSTEM_METRICS_H_
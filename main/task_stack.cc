@@ -0,0 +1,130 @@
+#include "task_stack.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <freertos/idf_additions.h>
+#include <algorithm>
+#include <cstring>
+
+#define TAG "TaskStacks"
+
+// 按前缀匹配任务名。只放纯计算或只碰外设寄存器、网络的任务；会读写 NVS、OTA 的任务不能放进来
+static const char* const kTaskPlacements[] = {
+    "opus_codec",           // Opus 编解码，只有计算
+    "opus_encoder",
+    "opus_decoder",
+    "audio_input",          // I2S/ADC 驱动把 DMA 缓冲拷贝到任务自己的缓冲区
+    "display_fft",          // 频谱计算和 LVGL 绘制
+    "otto_action",          // 舵机动作，微调值在创建任务之前已经从 NVS 读出
+    "electron_bot_action",
+    "music_lyric",          // 歌词下载和显示
+    // 不在表中的：tool_call 的工具会写 NVS（音量、亮度、唤醒词等设置），
+    // stream_fetch / stream_play 会读写 SPIFFS 上的歌曲缓存
+};
+
+bool TaskStacks::InPsram(const char* name) {
+#if CONFIG_TASK_STACK_IN_PSRAM
+    if (name == nullptr) {
+        return false;
+    }
+    for (auto placement : kTaskPlacements) {
+        if (strncmp(name, placement, strlen(placement)) == 0) {
+            return true;
+        }
+    }
+#endif
+    return false;
+}
+
+BaseType_t TaskStacks::Create(TaskFunction_t function, const char* name, uint32_t stack_size, void* arg,
+    UBaseType_t priority, TaskHandle_t* handle, BaseType_t core) {
+    bool psram = InPsram(name) && heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM) >= stack_size;
+    auto start = new Start{function, arg, psram};
+
+    // 任务先等这把锁，调用者的句柄写好、登记完成之后才开始运行
+    std::lock_guard<std::mutex> lock(mutex_);
+    TaskHandle_t task = nullptr;
+    BaseType_t created;
+    if (psram) {
+        created = xTaskCreatePinnedToCoreWithCaps(TaskEntry, name, stack_size, start, priority, &task, core,
+            MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    } else {
+        created = xTaskCreatePinnedToCore(TaskEntry, name, stack_size, start, priority, &task, core);
+    }
+    if (created != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create %s with a %lu byte %s stack", name, (unsigned long)stack_size,
+            psram ? "PSRAM" : "internal");
+        delete start;
+        if (handle != nullptr) {
+            *handle = nullptr;
+        }
+        return created;
+    }
+    if (psram) {
+        ESP_LOGI(TAG, "%s: %lu byte stack in PSRAM", name, (unsigned long)stack_size);
+    }
+    tasks_.push_back({task, name, stack_size, psram, false});
+    if (handle != nullptr) {
+        *handle = task;
+    }
+    return created;
+}
+
+void TaskStacks::TaskEntry(void* arg) {
+    auto start = static_cast<Start*>(arg);
+    {
+        std::lock_guard<std::mutex> lock(GetInstance().mutex_);
+    }
+    start->function(start->arg);
+    bool psram = start->psram;
+    delete start;
+
+    GetInstance().Forget(xTaskGetCurrentTaskHandle());
+    if (psram) {
+        vTaskDeleteWithCaps(NULL);
+    } else {
+        vTaskDelete(NULL);
+    }
+}
+
+bool TaskStacks::Forget(TaskHandle_t handle) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = std::find_if(tasks_.begin(), tasks_.end(), [handle](const Task& task) { return task.handle == handle; });
+    if (it == tasks_.end()) {
+        return false;
+    }
+    bool psram = it->psram;
+    tasks_.erase(it);
+    return psram;
+}
+
+void TaskStacks::Delete(TaskHandle_t handle) {
+    if (handle == nullptr) {
+        return;
+    }
+    if (Forget(handle)) {
+        vTaskDeleteWithCaps(handle);
+    } else {
+        vTaskDelete(handle);
+    }
+}
+
+void TaskStacks::ConfigureThread(esp_pthread_cfg_t& cfg) {
+    bool psram = InPsram(cfg.thread_name) && heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM) >= cfg.stack_size;
+    cfg.stack_alloc_caps = (psram ? MALLOC_CAP_SPIRAM : MALLOC_CAP_INTERNAL) | MALLOC_CAP_8BIT;
+}
+
+void TaskStacks::Check() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& task : tasks_) {
+        if (task.warned) {
+            continue;
+        }
+        uint32_t free_bytes = uxTaskGetStackHighWaterMark(task.handle) * sizeof(StackType_t);
+        if (free_bytes < TASK_STACK_WARN_BYTES) {
+            ESP_LOGW(TAG, "%s: only %lu of %lu stack bytes never used (%s)", task.name, (unsigned long)free_bytes,
+                (unsigned long)task.stack_size, task.psram ? "PSRAM" : "internal");
+            task.warned = true;
+        }
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef _TASK_STACK_H_
+#define _TASK_STACK_H_
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_pthread.h>
+
+#include <mutex>
+#include <vector>
+
+#define TASK_STACK_WARN_BYTES 512
+
+/*
+ * Creates the worker tasks and places their stacks by task name, see kTaskPlacements in task_stack.cc.
+ *
+ * With CONFIG_TASK_STACK_IN_PSRAM the listed tasks get their stack from PSRAM (xTaskCreatePinnedToCoreWithCaps,
+ * a static task underneath), which leaves the internal RAM to Wi-Fi, TLS and DMA buffers. Such a task cannot
+ * run while the cache is disabled, so it must never read or write flash (NVS, OTA, esp_partition) and must not
+ * hand stack memory to DMA; tasks that do are left out of the table, unlisted tasks stay in internal RAM.
+ *
+ * The task ends by returning from its function, the helper then deletes it the matching way, so the function
+ * must not call vTaskDelete(NULL) itself, and other tasks stop it with Delete() instead of vTaskDelete().
+ * Check() logs a task once when its free stack falls under TASK_STACK_WARN_BYTES.
+ */
+class TaskStacks {
+public:
+    static TaskStacks& GetInstance() {
+        static TaskStacks instance;
+        return instance;
+    }
+    TaskStacks(const TaskStacks&) = delete;
+    TaskStacks& operator=(const TaskStacks&) = delete;
+
+    BaseType_t Create(TaskFunction_t function, const char* name, uint32_t stack_size, void* arg,
+        UBaseType_t priority, TaskHandle_t* handle = nullptr, BaseType_t core = tskNO_AFFINITY);
+    void Delete(TaskHandle_t handle);
+    // std::thread 的栈按 cfg.thread_name 查同一张表，在 esp_pthread_set_cfg() 之前调用
+    void ConfigureThread(esp_pthread_cfg_t& cfg);
+    void Check();
+
+    static bool InPsram(const char* name);
+
+private:
+    struct Task {
+        TaskHandle_t handle;
+        const char* name;
+        uint32_t stack_size;
+        bool psram;
+        bool warned;
+    };
+    struct Start {
+        TaskFunction_t function;
+        void* arg;
+        bool psram;
+    };
+
+    std::mutex mutex_;
+    std::vector<Task> tasks_;
+
+    TaskStacks() = default;
+
+    static void TaskEntry(void* arg);
+    // 返回任务是否在 PSRAM 栈上，不在表中时为 false
+    bool Forget(TaskHandle_t handle);
+};
+
+#endif // _TASK_STACK_H_
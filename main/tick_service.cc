@@ -0,0 +1,155 @@
+#include "tick_service.h"
+#include "system_metrics.h"
+
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "TickService"
+
+TickService::TickService() {
+    esp_timer_create_args_t timer_args = {
+        .callback = [](void* arg) {
+            static_cast<TickService*>(arg)->OnTimer();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "tick_service",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &timer_));
+    window_start_us_ = esp_timer_get_time();
+}
+
+// 下一个周期整数倍的时刻，相同或成倍数的周期因此落在同一次唤醒上
+static int64_t NextAligned(int64_t now_us, int64_t period_us) {
+    return (now_us / period_us + 1) * period_us;
+}
+
+TickService::Entry* TickService::FindLocked(int id) {
+    for (auto& entry : entries_) {
+        if (entry.id == id) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+int TickService::Add(const char* name, int period_ms, int slack_ms, Callback callback, bool enabled) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t now_us = esp_timer_get_time();
+    Entry entry = {
+        .id = next_id_++,
+        .name = name,
+        .period_us = std::max(period_ms, 1) * 1000LL,
+        // 提前量不超过半个周期，否则会连续两次唤醒都执行
+        .slack_us = std::clamp(slack_ms, 0, period_ms / 2) * 1000LL,
+        .due_us = 0,
+        .enabled = enabled,
+        .callback = std::move(callback),
+        .runs = 0,
+    };
+    entry.due_us = NextAligned(now_us, entry.period_us);
+    entries_.push_back(std::move(entry));
+    ArmLocked(now_us);
+    return entries_.back().id;
+}
+
+void TickService::Remove(int id) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    entries_.erase(std::remove_if(entries_.begin(), entries_.end(), [id](const Entry& entry) {
+        return entry.id == id;
+    }), entries_.end());
+    ArmLocked(esp_timer_get_time());
+    // 拥有者通常在析构时注销，要等正在执行的这次回调结束
+    if (xTaskGetCurrentTaskHandle() != dispatch_task_) {
+        dispatch_cv_.wait(lock, [this, id]() { return dispatching_id_ != id; });
+    }
+}
+
+void TickService::SetEnabled(int id, bool enabled) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry* entry = FindLocked(id);
+    if (entry == nullptr || entry->enabled == enabled) {
+        return;
+    }
+    int64_t now_us = esp_timer_get_time();
+    entry->enabled = enabled;
+    if (enabled) {
+        entry->due_us = NextAligned(now_us, entry->period_us);
+    }
+    ArmLocked(now_us);
+}
+
+void TickService::ArmLocked(int64_t now_us) {
+    int64_t due_us = 0;
+    for (auto& entry : entries_) {
+        if (entry.enabled && (due_us == 0 || entry.due_us < due_us)) {
+            due_us = entry.due_us;
+        }
+    }
+    if (due_us == armed_due_us_) {
+        return;
+    }
+    // 在回调中重新计算时定时器已经停了，stop 失败可以忽略
+    esp_timer_stop(timer_);
+    armed_due_us_ = due_us;
+    if (due_us != 0) {
+        esp_timer_start_once(timer_, std::max<int64_t>(due_us - now_us, 1));
+    }
+}
+
+void TickService::OnTimer() {
+    std::vector<int> due_ids;
+    std::unique_lock<std::mutex> lock(mutex_);
+    dispatch_task_ = xTaskGetCurrentTaskHandle();
+    int64_t now_us = esp_timer_get_time();
+    wakeups_++;
+    total_wakeups_++;
+    for (auto& entry : entries_) {
+        if (!entry.enabled || entry.due_us - entry.slack_us > now_us) {
+            continue;
+        }
+        due_ids.push_back(entry.id);
+        entry.runs++;
+        // 落后时跳过错过的周期，不补执行
+        while (entry.due_us - entry.slack_us <= now_us) {
+            entry.due_us += entry.period_us;
+        }
+    }
+    armed_due_us_ = 0;
+    ArmLocked(now_us);
+
+    // 回调里可能再调用 SetEnabled，不能持锁；每次执行前在锁内确认还没有被 Remove()
+    for (int id : due_ids) {
+        Entry* entry = FindLocked(id);
+        if (entry == nullptr || !entry->enabled) {
+            continue;
+        }
+        Callback callback = entry->callback;
+        dispatching_id_ = id;
+        lock.unlock();
+        callback();
+        lock.lock();
+        dispatching_id_ = 0;
+        dispatch_cv_.notify_all();
+    }
+}
+
+void TickService::PrintStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t now_us = esp_timer_get_time();
+    int64_t elapsed_us = std::max<int64_t>(now_us - window_start_us_, 1);
+    uint32_t per_minute = (uint32_t)(wakeups_ * 60000000LL / elapsed_us);
+    wakeups_ = 0;
+    window_start_us_ = now_us;
+    int enabled = 0;
+    uint32_t runs = 0;
+    for (auto& entry : entries_) {
+        enabled += entry.enabled ? 1 : 0;
+        runs += entry.runs;
+    }
+    ESP_LOGI(TAG, "Ticks: %d/%d enabled, %lu wakeups/min, %lu wakeups for %lu runs since boot",
+        enabled, (int)entries_.size(), (unsigned long)per_minute, (unsigned long)total_wakeups_, (unsigned long)runs);
+    static auto& wakeups_gauge = SystemMetrics::GetInstance().Gauge("timer_wakeups_per_min");
+    wakeups_gauge = per_minute;
+}
@@ -0,0 +1,76 @@
+#ifndef _TICK_SERVICE_H_
+#define _TICK_SERVICE_H_
+
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <cstdint>
+
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+/*
+ * One esp_timer for the periodic housekeeping (clock, power save and sleep timers, battery monitor,
+ * audio power check) that used to own a periodic timer each and wake the chip separately.
+ *
+ * Every entry is due on multiples of its period counted from boot, so entries with the same or
+ * harmonic periods fall on the same wakeup. The timer is a one-shot armed for the earliest due entry,
+ * and on each wakeup every entry due within its slack runs too instead of waking the chip again a
+ * little later. Callbacks run in the esp_timer task like before and must stay short. An entry that
+ * falls behind skips the missed ticks, same as skip_unhandled_events.
+ */
+class TickService {
+public:
+    using Callback = std::function<void()>;
+
+    static TickService& GetInstance() {
+        static TickService instance;
+        return instance;
+    }
+    TickService(const TickService&) = delete;
+    TickService& operator=(const TickService&) = delete;
+
+    // 返回句柄，slack_ms 为允许提前执行的范围
+    int Add(const char* name, int period_ms, int slack_ms, Callback callback, bool enabled = true);
+    // 返回后回调不会再执行：正在执行时等它结束，在回调自己里调用时不等
+    void Remove(int id);
+    // 重新启用时从下一个周期整数倍开始，已经启用时不改变相位
+    void SetEnabled(int id, bool enabled);
+
+    // 打印并更新 timer_wakeups_per_min，按上次调用以来的平均值
+    void PrintStats();
+
+private:
+    struct Entry {
+        int id;
+        const char* name;
+        int64_t period_us;
+        int64_t slack_us;
+        int64_t due_us;
+        bool enabled;
+        Callback callback;
+        uint32_t runs;
+    };
+
+    TickService();
+
+    void OnTimer();
+    void ArmLocked(int64_t now_us);
+    Entry* FindLocked(int id);
+
+    std::mutex mutex_;
+    std::condition_variable dispatch_cv_;
+    int dispatching_id_ = 0;        // 正在执行的回调，0 表示没有
+    TaskHandle_t dispatch_task_ = nullptr;
+    esp_timer_handle_t timer_ = nullptr;
+    std::vector<Entry> entries_;
+    int next_id_ = 1;
+    int64_t armed_due_us_ = 0;      // 0 表示没有启动
+    uint32_t wakeups_ = 0;
+    uint32_t total_wakeups_ = 0;
+    int64_t window_start_us_ = 0;
+};
+
+#endif // _TICK_SERVICE_H_
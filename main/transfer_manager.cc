@@ -0,0 +1,124 @@
+#include "transfer_manager.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <chrono>
+
+#define TAG "TransferManager"
+
+#define TRANSFER_WINDOW_US 1000000
+// 链路很慢时也给低优先级留一点，避免连接因为长时间不读被服务端断开
+#define TRANSFER_MIN_ALLOWANCE 2048
+
+static const int kSharePercent[kTransferClassCount] = {
+    100,
+    CONFIG_TRANSFER_INTERACTIVE_SHARE_PERCENT,
+    CONFIG_TRANSFER_BACKGROUND_SHARE_PERCENT,
+};
+
+static const char* const kClassNames[kTransferClassCount] = {
+    "realtime",
+    "interactive",
+    "background",
+};
+
+const char* TransferManager::ClassName(TransferClass transfer_class) {
+    return transfer_class < kTransferClassCount ? kClassNames[transfer_class] : "unknown";
+}
+
+void TransferManager::Begin(TransferClass transfer_class) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    classes_[transfer_class].active++;
+}
+
+void TransferManager::End(TransferClass transfer_class) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    classes_[transfer_class].active--;
+    // 被它限速的传输不必等到窗口结束
+    resume_cv_.notify_all();
+}
+
+void TransferManager::SetConversationActive(bool active) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (conversation_active_ == active) {
+        return;
+    }
+    conversation_active_ = active;
+    if (!active) {
+        resume_cv_.notify_all();
+    }
+}
+
+void TransferManager::RollWindowLocked(int64_t now) {
+    if (now - window_start_us_ < TRANSFER_WINDOW_US) {
+        return;
+    }
+    // 中间隔了不止一个窗口时，上一个窗口里什么也没有传
+    bool consecutive = now - window_start_us_ < 2 * TRANSFER_WINDOW_US;
+    size_t total = 0;
+    for (auto& state : classes_) {
+        state.last_window_bytes = consecutive ? state.window_bytes : 0;
+        total += state.last_window_bytes;
+        state.window_bytes = 0;
+    }
+    // 链路速度取近期的峰值并缓慢衰减，被限速的窗口不会把估计越拉越低
+    link_rate_ = std::max(total, link_rate_ - link_rate_ / 8);
+    window_start_us_ = now;
+}
+
+bool TransferManager::HigherActiveLocked(TransferClass transfer_class) const {
+    // 只算真正在收发的：缓冲区已满暂停读取的流不占用链路
+    for (int i = 0; i < transfer_class; i++) {
+        if (classes_[i].active > 0 && classes_[i].last_window_bytes > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t TransferManager::AllowanceLocked(TransferClass transfer_class) const {
+    return std::max(link_rate_ * kSharePercent[transfer_class] / 100, (size_t)TRANSFER_MIN_ALLOWANCE);
+}
+
+void TransferManager::Account(TransferClass transfer_class, size_t bytes, const std::atomic<bool>* running) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    int64_t start = esp_timer_get_time();
+    RollWindowLocked(start);
+    auto& state = classes_[transfer_class];
+    state.window_bytes += bytes;
+    state.total_bytes += bytes;
+    if (transfer_class == kTransferRealtime) {
+        return;
+    }
+
+    auto keep_waiting = [running]() {
+        return running == nullptr || running->load();
+    };
+    if (transfer_class == kTransferBackground && conversation_active_) {
+        ESP_LOGI(TAG, "Background transfer paused during conversation");
+        while (conversation_active_ && keep_waiting()) {
+            resume_cv_.wait_for(lock, std::chrono::milliseconds(100));
+        }
+    }
+    // 份额用完的等到下一个窗口
+    while (HigherActiveLocked(transfer_class) && state.window_bytes > AllowanceLocked(transfer_class) && keep_waiting()) {
+        int64_t remaining = window_start_us_ + TRANSFER_WINDOW_US - esp_timer_get_time();
+        if (remaining > 0) {
+            resume_cv_.wait_for(lock, std::chrono::microseconds(remaining));
+        }
+        RollWindowLocked(esp_timer_get_time());
+    }
+    state.throttled_ms += (esp_timer_get_time() - start) / 1000;
+}
+
+void TransferManager::PrintStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i = 0; i < kTransferClassCount; i++) {
+        const auto& state = classes_[i];
+        if (state.active > 0) {
+            ESP_LOGI(TAG, "%s: %d active, %llu bytes, throttled %lu ms", kClassNames[i], state.active,
+                (unsigned long long)state.total_bytes, (unsigned long)state.throttled_ms);
+        }
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef _TRANSFER_MANAGER_H_
+#define _TRANSFER_MANAGER_H_
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+enum TransferClass {
+    kTransferRealtime,      // music / sing stream, never delayed
+    kTransferInteractive,   // answers the user is waiting for: song search, lyrics of the playing song, photo upload
+    kTransferBackground,    // OTA image, lyric prefetch
+    kTransferClassCount,
+};
+
+/*
+ * Arbitrates the HTTP transfers that share the one link.
+ *
+ * Transfers announce themselves with a TransferScope and call Account() after every read or write. While a
+ * higher class is moving data, a lower class gets at most its share (CONFIG_TRANSFER_*_SHARE_PERCENT) of the
+ * link rate per one second window and sleeps once it used it up; when it is alone it is not limited. The
+ * link rate is the recent peak of all transfers together. The TTS WebSocket does not go through here, a
+ * conversation instead pauses background transfers completely until it ends.
+ */
+class TransferManager {
+public:
+    static TransferManager& GetInstance() {
+        static TransferManager instance;
+        return instance;
+    }
+    TransferManager(const TransferManager&) = delete;
+    TransferManager& operator=(const TransferManager&) = delete;
+
+    void Begin(TransferClass transfer_class);
+    void End(TransferClass transfer_class);
+    // May block: paused background transfers wait here, stop waiting as soon as *running turns false
+    void Account(TransferClass transfer_class, size_t bytes, const std::atomic<bool>* running = nullptr);
+
+    void SetConversationActive(bool active);
+    void PrintStats();
+
+    static const char* ClassName(TransferClass transfer_class);
+
+private:
+    struct ClassState {
+        int active = 0;
+        size_t window_bytes = 0;
+        size_t last_window_bytes = 0;
+        uint64_t total_bytes = 0;
+        uint32_t throttled_ms = 0;
+    };
+
+    TransferManager() = default;
+    void RollWindowLocked(int64_t now);
+    bool HigherActiveLocked(TransferClass transfer_class) const;
+    size_t AllowanceLocked(TransferClass transfer_class) const;
+
+    std::mutex mutex_;
+    std::condition_variable resume_cv_;
+    std::array<ClassState, kTransferClassCount> classes_;
+    int64_t window_start_us_ = 0;
+    size_t link_rate_ = 0;              // bytes per window
+    bool conversation_active_ = false;
+};
+
+// Marks a transfer of the class as active for the lifetime of the scope
+class TransferScope {
+public:
+    explicit TransferScope(TransferClass transfer_class, const std::atomic<bool>* running = nullptr)
+        : class_(transfer_class), running_(running) { TransferManager::GetInstance().Begin(class_); }
+    ~TransferScope() { TransferManager::GetInstance().End(class_); }
+    TransferScope(const TransferScope&) = delete;
+    TransferScope& operator=(const TransferScope&) = delete;
+
+    void Account(size_t bytes) { TransferManager::GetInstance().Account(class_, bytes, running_); }
+
+private:
+    TransferClass class_;
+    const std::atomic<bool>* running_;
+};
+
+#endif // _TRANSFER_MANAGER_H_
@@ -0,0 +1,74 @@
+#include "warm_boot.h"
+
+#include <esp_attr.h>
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_rom_crc.h>
+#include <sys/time.h>
+#include <cstddef>
+#include <ctime>
+
+#define TAG "WarmBoot"
+
+#define WARM_BOOT_MAGIC 0x5842574D  // "XBWM"
+
+struct WarmBootState {
+    uint32_t magic;
+    uint32_t crc;
+    uint32_t sleeping;
+    int64_t sleep_time;             // 进入睡眠和上次版本检查时的系统时间（秒），深度睡眠期间 RTC 继续计时
+    int64_t version_check_time;
+};
+
+// 上电时是随机内容，用 magic 和 crc 判断是否有效
+static RTC_NOINIT_ATTR WarmBootState warm_boot_state;
+
+static uint32_t StateCrc(const WarmBootState& state) {
+    return esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(&state.sleeping),
+                            sizeof(state) - offsetof(WarmBootState, sleeping));
+}
+
+static bool StateValid() {
+    return warm_boot_state.magic == WARM_BOOT_MAGIC && warm_boot_state.crc == StateCrc(warm_boot_state);
+}
+
+static void CommitState() {
+    warm_boot_state.magic = WARM_BOOT_MAGIC;
+    warm_boot_state.crc = StateCrc(warm_boot_state);
+}
+
+WarmBoot::WarmBoot() {
+    if (!StateValid()) {
+        warm_boot_state = {};
+        CommitState();
+        return;
+    }
+    active_ = esp_reset_reason() == ESP_RST_DEEPSLEEP && warm_boot_state.sleeping;
+    if (active_) {
+        slept_s_ = time(nullptr) - warm_boot_state.sleep_time;
+        ESP_LOGI(TAG, "Warm boot after %lld s of deep sleep", slept_s_);
+    }
+    // 之后的复位不再当作唤醒
+    warm_boot_state.sleeping = 0;
+    CommitState();
+}
+
+void WarmBoot::Save() {
+    warm_boot_state.sleeping = 1;
+    warm_boot_state.sleep_time = time(nullptr);
+    CommitState();
+}
+
+void WarmBoot::MarkVersionChecked() {
+    warm_boot_state.version_check_time = time(nullptr);
+    CommitState();
+}
+
+bool WarmBoot::IsVersionCheckDue() const {
+    if (!active_ || warm_boot_state.version_check_time == 0) {
+        return true;
+    }
+    // 服务器校时后时间可能向前跳
+    int64_t elapsed = time(nullptr) - warm_boot_state.version_check_time;
+    return elapsed < 0 || elapsed >= CONFIG_WARM_BOOT_VERSION_CHECK_HOURS * 3600LL;
+}
@@ -0,0 +1,41 @@
+#ifndef _WARM_BOOT_H_
+#define _WARM_BOOT_H_
+
+#include <cstdint>
+
+/*
+ * State kept in RTC memory while SleepTimer holds the chip in deep sleep.
+ *
+ * A wake-up from that sleep is a warm boot: the device was already activated and running, so
+ * Application::Start() enables the wake word as soon as audio is up, skips the version banner and
+ * the success sound, and only repeats the background version check when the last successful one is
+ * older than CONFIG_WARM_BOOT_VERSION_CHECK_HOURS. Power-on, crashes, OTA reboots and deep sleep
+ * entered by the boards themselves (power off) stay cold boots.
+ */
+class WarmBoot {
+public:
+    static WarmBoot& GetInstance() {
+        static WarmBoot instance;
+        return instance;
+    }
+    WarmBoot(const WarmBoot&) = delete;
+    WarmBoot& operator=(const WarmBoot&) = delete;
+
+    bool active() const { return active_; }
+    // 睡眠了多少秒，系统时间没有设置过时不准
+    int64_t slept_s() const { return slept_s_; }
+
+    // SleepTimer 进入深度睡眠前调用
+    void Save();
+    // 版本检查成功后调用
+    void MarkVersionChecked();
+    bool IsVersionCheckDue() const;
+
+private:
+    WarmBoot();
+
+    bool active_ = false;
+    int64_t slept_s_ = 0;
+};
+
+#endif // _WARM_BOOT_H_
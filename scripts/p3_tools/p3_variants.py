@@ -0,0 +1,138 @@
+#!/usr/bin/env python3
+"""
+Build a P3 sound with per output rate variants.
+
+The file starts with the usual 16 kHz / 60 ms Opus variant, then for every --rate a raw variant at that
+sample rate (16-bit PCM or IMA ADPCM). The firmware (main/audio/sound_asset.h) plays the raw variant that
+matches the codec output rate without the Opus decoder and resampler, and falls back to Opus otherwise.
+Raw variants are only added to sounds not longer than --max-raw-ms, they cost 6-24x the flash of Opus.
+
+Usage:
+    python p3_variants.py input.wav output.p3 --rate 24000 --rate 48000 --raw adpcm
+"""
+import argparse
+import struct
+
+import librosa
+import numpy as np
+import opuslib
+
+P3_TYPE_OPUS = 0
+P3_TYPE_VARIANT = 0x10
+
+CODEC_OPUS = 0
+CODEC_PCM16 = 1
+CODEC_IMA_ADPCM = 2
+
+FRAME_DURATION_MS = 60
+
+IMA_STEP_TABLE = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97,
+    107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871,
+    5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623,
+    27086, 29794, 32767,
+]
+IMA_INDEX_TABLE = [-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8]
+
+
+def packet(packet_type, payload):
+    return struct.pack(">BBH", packet_type, 0, len(payload)) + payload
+
+
+def variant(codec, sample_rate, packets):
+    body = b"".join(packets)
+    header = struct.pack(">BBHII", codec, FRAME_DURATION_MS, 0, sample_rate, len(body))
+    return packet(P3_TYPE_VARIANT, header) + body
+
+
+def frames(pcm, sample_rate):
+    frame_size = sample_rate * FRAME_DURATION_MS // 1000
+    padded = np.pad(pcm, (0, -len(pcm) % frame_size))
+    return [padded[i:i + frame_size] for i in range(0, len(padded), frame_size)]
+
+
+def to_int16(audio):
+    return (np.clip(audio, -1.0, 1.0) * 32767).astype(np.int16)
+
+
+def encode_opus(audio):
+    encoder = opuslib.Encoder(16000, 1, opuslib.APPLICATION_AUDIO)
+    return [packet(P3_TYPE_OPUS, encoder.encode(frame.tobytes(), len(frame))) for frame in frames(to_int16(audio), 16000)]
+
+
+def encode_ima_adpcm(frame, index=0):
+    # 与固件的解码器一致：块头为首样本、步长索引和末尾是否有填充的半字节，之后每字节两个样本，低 4 位在前
+    # 步长索引沿用上一帧结束时的值，避免每帧开头重新适应
+    start_index = index
+    predictor = int(frame[0])
+    nibbles = []
+    for sample in frame[1:]:
+        step = IMA_STEP_TABLE[index]
+        diff = int(sample) - predictor
+        nibble = 8 if diff < 0 else 0
+        diff = abs(diff)
+        delta = step >> 3
+        if diff >= step:
+            nibble |= 4
+            diff -= step
+            delta += step
+        if diff >= step >> 1:
+            nibble |= 2
+            diff -= step >> 1
+            delta += step >> 1
+        if diff >= step >> 2:
+            nibble |= 1
+            delta += step >> 2
+        predictor = max(-32768, min(32767, predictor - delta if nibble & 8 else predictor + delta))
+        index = max(0, min(88, index + IMA_INDEX_TABLE[nibble]))
+        nibbles.append(nibble)
+    padded = len(nibbles) % 2
+    if padded:
+        nibbles.append(0)
+    out = bytearray(struct.pack("<hBB", int(frame[0]), start_index, padded))
+    for low, high in zip(nibbles[0::2], nibbles[1::2]):
+        out.append(low | (high << 4))
+    return bytes(out), index
+
+
+def encode_raw(audio, sample_rate, codec):
+    resampled = librosa.resample(audio, orig_sr=16000, target_sr=sample_rate)
+    result = []
+    index = 0
+    for frame in frames(to_int16(resampled), sample_rate):
+        if codec == CODEC_PCM16:
+            payload = frame.astype("<i2").tobytes()
+        else:
+            payload, index = encode_ima_adpcm(frame, index)
+        result.append(packet(codec, payload))
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build a P3 sound with raw variants for the given output rates")
+    parser.add_argument("input", help="Input audio file")
+    parser.add_argument("output", help="Output P3 file")
+    parser.add_argument("--rate", type=int, action="append", default=[], help="Output sample rate to embed, repeatable")
+    parser.add_argument("--raw", choices=["pcm", "adpcm"], default="adpcm", help="Format of the raw variants")
+    parser.add_argument("--max-raw-ms", type=int, default=1500, help="Only add raw variants to sounds up to this length")
+    args = parser.parse_args()
+
+    audio, _ = librosa.load(args.input, sr=16000, mono=True)
+    data = variant(CODEC_OPUS, 16000, encode_opus(audio))
+
+    duration_ms = len(audio) * 1000 // 16000
+    codec = CODEC_PCM16 if args.raw == "pcm" else CODEC_IMA_ADPCM
+    if duration_ms <= args.max_raw_ms:
+        for rate in args.rate:
+            data += variant(codec, rate, encode_raw(audio, rate, codec))
+    elif args.rate:
+        print(f"{args.input}: {duration_ms} ms is longer than {args.max_raw_ms} ms, Opus only")
+
+    with open(args.output, "wb") as f:
+        f.write(data)
+    print(f"{args.output}: {len(data)} bytes")
+
+
+if __name__ == "__main__":
+    main()